@@ -0,0 +1,148 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+OU_DN = 'ou=anon,%s' % DEFAULT_SUFFIX
+RENAMED_OU_DN = 'ou=anon2,%s' % DEFAULT_SUFFIX
+DEFAULT_ANON_ACI = ('(targetattr!="userPassword")(version 3.0; acl "Enable anonymous access"; '
+                    'allow (read, search, compare) userdn="ldap:///anyone";)')
+ANON_ACI = ('(targetattr="cn || sn")(version 3.0; acl "anonymous read"; '
+            'allow (read, search) userdn="ldap:///anyone";)')
+NUM_ENTRIES = 5
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+def _search_as_anonymous(topology, base):
+    topology.standalone.simple_bind_s('', '')
+    try:
+        entries = topology.standalone.search_s(base, ldap.SCOPE_ONELEVEL,
+                                               '(cn=anon*)', ['cn'])
+    except ldap.NO_SUCH_OBJECT:
+        entries = []
+    finally:
+        topology.standalone.simple_bind_s(DN_DM, PASSWORD)
+    return len(entries)
+
+
+def _add_entries(topology, base, acis):
+    attrs = {'objectclass': ['top', 'organizationalunit'], 'ou': base.split(',')[0].split('=')[1]}
+    if acis:
+        attrs['aci'] = acis
+    try:
+        topology.standalone.add_s(Entry((base, attrs)))
+        for i in xrange(NUM_ENTRIES):
+            topology.standalone.add_s(Entry(('cn=anon%d,%s' % (i, base),
+                                             {'objectclass': ['top', 'person'],
+                                              'sn': 'anon',
+                                              'cn': 'anon%d' % i})))
+    except ldap.LDAPError as e:
+        log.fatal('Failed to add the test entries: error (%s)' % e.message['desc'])
+        assert False
+
+
+def test_anon_profile_init(topology):
+    """Removes the default anonymous aci of the suffix, and adds the
+    entries readable by anonymous under an aci of their parent
+    """
+
+    standalone = topology.standalone
+
+    try:
+        standalone.modify_s(DEFAULT_SUFFIX, [(ldap.MOD_DELETE, 'aci', DEFAULT_ANON_ACI)])
+    except ldap.NO_SUCH_ATTRIBUTE:
+        pass
+    _add_entries(topology, OU_DN, [ANON_ACI])
+    assert _search_as_anonymous(topology, OU_DN) == NUM_ENTRIES
+
+
+def test_anon_profile_moddn(topology):
+    """Renames the entry holding the anonymous aci, and checks the profile
+    follows it instead of keeping its old target
+    """
+
+    standalone = topology.standalone
+
+    log.info('Rename %s to %s' % (OU_DN, RENAMED_OU_DN))
+    standalone.rename_s(OU_DN, 'ou=anon2', delold=1)
+    assert _search_as_anonymous(topology, RENAMED_OU_DN) == NUM_ENTRIES
+
+    log.info('Create %s again without the aci' % OU_DN)
+    _add_entries(topology, OU_DN, None)
+    assert _search_as_anonymous(topology, OU_DN) == 0
+
+
+def test_anon_profile_aci_change(topology):
+    """Removes and adds the anonymous aci back"""
+
+    standalone = topology.standalone
+
+    standalone.modify_s(RENAMED_OU_DN, [(ldap.MOD_DELETE, 'aci', ANON_ACI)])
+    assert _search_as_anonymous(topology, RENAMED_OU_DN) == 0
+
+    standalone.modify_s(RENAMED_OU_DN, [(ldap.MOD_ADD, 'aci', ANON_ACI)])
+    assert _search_as_anonymous(topology, RENAMED_OU_DN) == NUM_ENTRIES
+    assert _search_as_anonymous(topology, OU_DN) == 0
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
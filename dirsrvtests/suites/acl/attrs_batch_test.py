@@ -0,0 +1,156 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+OU_DN = 'ou=batch,%s' % DEFAULT_SUFFIX
+USER_DN = 'uid=reader,%s' % DEFAULT_SUFFIX
+USER_PW = 'password'
+READ_ACI = ('(targetattr="cn || sn || description")(version 3.0; acl "read some"; '
+            'allow (read, search) userdn="ldap:///%s";)' % USER_DN)
+MANAGER_ACI = ('(targetattr="telephonenumber")(version 3.0; acl "read managed"; '
+               'allow (read, search) userattr="manager#USERDN";)')
+NUM_ENTRIES = 10
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+def _search_as_user(topology, attrs):
+    topology.standalone.simple_bind_s(USER_DN, USER_PW)
+    try:
+        entries = topology.standalone.search_s(OU_DN, ldap.SCOPE_ONELEVEL,
+                                               '(objectclass=person)', attrs)
+    finally:
+        topology.standalone.simple_bind_s(DN_DM, PASSWORD)
+    return entries
+
+
+def _returned_attrs(entry):
+    return sorted([attr.lower() for attr in entry.data.keys()])
+
+
+def test_attrs_batch_init(topology):
+    """Adds the user and the entries the user reads"""
+
+    standalone = topology.standalone
+
+    try:
+        standalone.add_s(Entry((USER_DN, {'objectclass': ['top', 'person', 'inetuser'],
+                                          'sn': 'reader',
+                                          'cn': 'reader',
+                                          'userpassword': USER_PW})))
+        standalone.add_s(Entry((OU_DN, {'objectclass': ['top', 'organizationalunit'],
+                                        'ou': 'batch',
+                                        'aci': READ_ACI})))
+        for i in xrange(NUM_ENTRIES):
+            attrs = {'objectclass': ['top', 'person', 'inetorgperson'],
+                     'sn': 'batch',
+                     'cn': 'batch%d' % i,
+                     'description': 'entry %d' % i,
+                     'telephonenumber': '%d' % i,
+                     'mail': 'batch%d@example.com' % i}
+            if i % 2:
+                attrs['manager'] = USER_DN
+            standalone.add_s(Entry(('cn=batch%d,%s' % (i, OU_DN), attrs)))
+    except ldap.LDAPError as e:
+        log.fatal('Failed to add the test entries: error (%s)' % e.message['desc'])
+        assert False
+
+
+def test_attrs_batch_targetattr(topology):
+    """Checks only the attributes allowed by targetattr are returned,
+    whatever the attributes asked for and their order
+    """
+
+    for attrs in (None, ['mail', 'cn', 'telephonenumber', 'sn'], ['description', 'mail']):
+        entries = _search_as_user(topology, attrs)
+        assert len(entries) == NUM_ENTRIES
+        for entry in entries:
+            returned = _returned_attrs(entry)
+            log.info('%s: %s' % (entry.dn, returned))
+            assert 'mail' not in returned
+            assert 'telephonenumber' not in returned
+            if attrs is None or 'cn' in attrs:
+                assert 'cn' in returned
+            if attrs is None or 'description' in attrs:
+                assert 'description' in returned
+
+
+def test_attrs_batch_userattr(topology):
+    """Adds an aci depending on the values of each entry, and checks the
+    attribute is only returned for the entries it allows
+    """
+
+    standalone = topology.standalone
+
+    standalone.modify_s(OU_DN, [(ldap.MOD_ADD, 'aci', MANAGER_ACI)])
+    entries = _search_as_user(topology, ['cn', 'telephonenumber', 'manager'])
+    assert len(entries) == NUM_ENTRIES
+    for entry in entries:
+        i = int(entry.getValue('cn')[len('batch'):])
+        returned = _returned_attrs(entry)
+        log.info('%s: %s' % (entry.dn, returned))
+        assert ('telephonenumber' in returned) == bool(i % 2)
+        assert 'manager' not in returned
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
@@ -0,0 +1,160 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+OU_DN = 'ou=rules,%s' % DEFAULT_SUFFIX
+GROUP_DN = 'cn=rulegroup,%s' % DEFAULT_SUFFIX
+USER_PW = 'password'
+USERS = ['rule1', 'wild1', 'wild2', 'member', 'other']
+USERDN_ACI = ('(targetattr="*")(version 3.0; acl "userdn terms"; allow (read, search) '
+              'userdn="ldap:///uid=rule1,%s || ldap:///uid=wild*,%s";)' %
+              (DEFAULT_SUFFIX, DEFAULT_SUFFIX))
+GROUPDN_ACI = ('(targetattr="*")(version 3.0; acl "groupdn terms"; allow (read, search) '
+               'groupdn="ldap:///cn=nosuchgroup,%s || ldap:///%s";)' %
+               (DEFAULT_SUFFIX, GROUP_DN))
+WILD_ACI = ('(targetattr="*")(version 3.0; acl "userdn terms"; allow (read, search) '
+            'userdn="ldap:///uid=wild*,%s";)' % DEFAULT_SUFFIX)
+NUM_ENTRIES = 5
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+def _user_dn(uid):
+    return 'uid=%s,%s' % (uid, DEFAULT_SUFFIX)
+
+
+def _search_as_user(topology, uid):
+    topology.standalone.simple_bind_s(_user_dn(uid), USER_PW)
+    try:
+        entries = topology.standalone.search_s(OU_DN, ldap.SCOPE_ONELEVEL,
+                                               '(objectclass=person)', ['cn'])
+    finally:
+        topology.standalone.simple_bind_s(DN_DM, PASSWORD)
+    return len(entries)
+
+
+def _check_access(topology, allowed):
+    """Searches twice as each user, so that the second evaluation uses
+    the rules compiled by the first one
+    """
+
+    for uid in USERS:
+        expected = NUM_ENTRIES if uid in allowed else 0
+        for i in xrange(2):
+            found = _search_as_user(topology, uid)
+            log.info('%s sees %d entries' % (uid, found))
+            assert found == expected
+
+
+def test_bind_rules_init(topology):
+    """Adds the users, the group and the entries protected by userdn and
+    groupdn rules made of several terms
+    """
+
+    standalone = topology.standalone
+
+    try:
+        for uid in USERS:
+            standalone.add_s(Entry((_user_dn(uid), {'objectclass': ['top', 'person', 'inetuser'],
+                                                    'sn': uid,
+                                                    'cn': uid,
+                                                    'userpassword': USER_PW})))
+        standalone.add_s(Entry((GROUP_DN, {'objectclass': ['top', 'groupofnames'],
+                                           'cn': 'rulegroup',
+                                           'member': _user_dn('member')})))
+        standalone.add_s(Entry((OU_DN, {'objectclass': ['top', 'organizationalunit'],
+                                        'ou': 'rules',
+                                        'aci': [USERDN_ACI, GROUPDN_ACI]})))
+        for i in xrange(NUM_ENTRIES):
+            standalone.add_s(Entry(('cn=rules%d,%s' % (i, OU_DN),
+                                    {'objectclass': ['top', 'person'],
+                                     'sn': 'rules',
+                                     'cn': 'rules%d' % i})))
+    except ldap.LDAPError as e:
+        log.fatal('Failed to add the test entries: error (%s)' % e.message['desc'])
+        assert False
+
+
+def test_bind_rules_terms(topology):
+    """Checks every term of the userdn and groupdn rules is evaluated"""
+
+    _check_access(topology, ['rule1', 'wild1', 'wild2', 'member'])
+
+
+def test_bind_rules_aci_change(topology):
+    """Replaces the userdn rule, and checks the new rule is compiled
+    instead of the old one being reused
+    """
+
+    standalone = topology.standalone
+
+    standalone.modify_s(OU_DN, [(ldap.MOD_DELETE, 'aci', USERDN_ACI),
+                                (ldap.MOD_ADD, 'aci', WILD_ACI)])
+    _check_access(topology, ['wild1', 'wild2', 'member'])
+
+    log.info('Remove %s from %s' % (_user_dn('member'), GROUP_DN))
+    standalone.modify_s(GROUP_DN, [(ldap.MOD_DELETE, 'member', _user_dn('member'))])
+    _check_access(topology, ['wild1', 'wild2'])
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
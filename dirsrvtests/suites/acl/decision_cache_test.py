@@ -0,0 +1,209 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+ACL_PLUGIN_DN = 'cn=ACL Plugin,cn=plugins,cn=config'
+CACHE_SIZE_ATTR = 'nsslapd-acl-decision-cache-size'
+OU_DN = 'ou=cached,%s' % DEFAULT_SUFFIX
+USER_DN = 'uid=cacheuser,%s' % DEFAULT_SUFFIX
+USER_PW = 'password'
+GROUP_DN = 'cn=denied,%s' % DEFAULT_SUFFIX
+DENY_ACI = ('(targetattr="*")(version 3.0; acl "deny group"; deny (read, search) '
+            'groupdn="ldap:///%s";)' % GROUP_DN)
+NUM_ENTRIES = 20
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+def _search_as_user(topology):
+    topology.standalone.simple_bind_s(USER_DN, USER_PW)
+    try:
+        entries = topology.standalone.search_s(OU_DN, ldap.SCOPE_ONELEVEL,
+                                               '(objectclass=person)', ['cn'])
+    finally:
+        topology.standalone.simple_bind_s(DN_DM, PASSWORD)
+    return len(entries)
+
+
+def test_decision_cache_init(topology):
+    """Adds the user, the group and the entries the user searches"""
+
+    standalone = topology.standalone
+
+    entry = standalone.getEntry(ACL_PLUGIN_DN, ldap.SCOPE_BASE, '(objectclass=*)',
+                                [CACHE_SIZE_ATTR])
+    log.info('%s: %s' % (CACHE_SIZE_ATTR, entry.getValue(CACHE_SIZE_ATTR)))
+
+    try:
+        standalone.add_s(Entry((USER_DN, {'objectclass': ['top', 'person', 'inetuser'],
+                                          'sn': 'cacheuser',
+                                          'cn': 'cacheuser',
+                                          'userpassword': USER_PW})))
+        standalone.add_s(Entry((GROUP_DN, {'objectclass': ['top', 'groupofnames'],
+                                           'cn': 'denied'})))
+        standalone.add_s(Entry((OU_DN, {'objectclass': ['top', 'organizationalunit'],
+                                        'ou': 'cached',
+                                        'aci': DENY_ACI})))
+        for i in xrange(NUM_ENTRIES):
+            standalone.add_s(Entry(('cn=cached%d,%s' % (i, OU_DN),
+                                    {'objectclass': ['top', 'person'],
+                                     'sn': 'cached',
+                                     'cn': 'cached%d' % i})))
+    except ldap.LDAPError as e:
+        log.fatal('Failed to add the test entries: error (%s)' % e.message['desc'])
+        assert False
+
+
+def test_decision_cache_group_change(topology):
+    """Checks a cached decision is dropped when the membership of a group
+    used by an aci changes
+    """
+
+    standalone = topology.standalone
+
+    # Search twice so that the second search is served from the cache
+    assert _search_as_user(topology) == NUM_ENTRIES
+    assert _search_as_user(topology) == NUM_ENTRIES
+
+    log.info('Add %s to %s' % (USER_DN, GROUP_DN))
+    standalone.modify_s(GROUP_DN, [(ldap.MOD_ADD, 'member', USER_DN)])
+    assert _search_as_user(topology) == 0
+    assert _search_as_user(topology) == 0
+
+    log.info('Remove %s from %s' % (USER_DN, GROUP_DN))
+    standalone.modify_s(GROUP_DN, [(ldap.MOD_DELETE, 'member', USER_DN)])
+    assert _search_as_user(topology) == NUM_ENTRIES
+
+
+def test_decision_cache_aci_change(topology):
+    """Checks a cached decision is dropped when an aci changes"""
+
+    standalone = topology.standalone
+
+    standalone.modify_s(GROUP_DN, [(ldap.MOD_ADD, 'member', USER_DN)])
+    assert _search_as_user(topology) == 0
+
+    log.info('Remove the aci of %s' % OU_DN)
+    standalone.modify_s(OU_DN, [(ldap.MOD_DELETE, 'aci', DENY_ACI)])
+    assert _search_as_user(topology) == NUM_ENTRIES
+
+
+def test_decision_cache_moddn(topology):
+    """Checks the decisions cached for the entries under an aci-bearing
+    entry are dropped when it is renamed, so that new entries taking the
+    old dns are not served with them
+    """
+
+    standalone = topology.standalone
+
+    standalone.modify_s(OU_DN, [(ldap.MOD_ADD, 'aci', DENY_ACI)])
+    assert _search_as_user(topology) == 0
+    assert _search_as_user(topology) == 0
+
+    log.info('Rename %s and create it again without the aci' % OU_DN)
+    standalone.rename_s(OU_DN, 'ou=renamed', delold=1)
+    try:
+        standalone.add_s(Entry((OU_DN, {'objectclass': ['top', 'organizationalunit'],
+                                        'ou': 'cached'})))
+        for i in xrange(NUM_ENTRIES):
+            standalone.add_s(Entry(('cn=cached%d,%s' % (i, OU_DN),
+                                    {'objectclass': ['top', 'person'],
+                                     'sn': 'cached',
+                                     'cn': 'cached%d' % i})))
+    except ldap.LDAPError as e:
+        log.fatal('Failed to add the test entries: error (%s)' % e.message['desc'])
+        assert False
+    assert _search_as_user(topology) == NUM_ENTRIES
+
+
+def test_decision_cache_shared(topology):
+    """Checks the decisions are shared by the entries the same acis apply
+    to, and not by an entry another aci applies to
+    """
+
+    standalone = topology.standalone
+    target_aci = ('(target="ldap:///cn=cached1,%s")(targetattr="*")'
+                  '(version 3.0; acl "deny one entry"; deny (read, search) '
+                  'userdn="ldap:///%s";)' % (OU_DN, USER_DN))
+
+    standalone.modify_s(OU_DN, [(ldap.MOD_ADD, 'aci', target_aci)])
+    assert _search_as_user(topology) == NUM_ENTRIES - 1
+    assert _search_as_user(topology) == NUM_ENTRIES - 1
+
+    standalone.modify_s(OU_DN, [(ldap.MOD_DELETE, 'aci', target_aci)])
+    assert _search_as_user(topology) == NUM_ENTRIES
+
+
+def test_decision_cache_disabled(topology):
+    """Disables the cache and checks the access control still applies"""
+
+    standalone = topology.standalone
+
+    standalone.modify_s(ACL_PLUGIN_DN, [(ldap.MOD_REPLACE, CACHE_SIZE_ATTR, '0')])
+    standalone.restart(timeout=10)
+
+    standalone.modify_s(OU_DN, [(ldap.MOD_ADD, 'aci', DENY_ACI)])
+    assert _search_as_user(topology) == 0
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
@@ -0,0 +1,185 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+ACL_PLUGIN_DN = 'cn=ACL Plugin,cn=plugins,cn=config'
+GROUP_INDEX_ATTR = 'nsslapd-acl-group-index'
+OU_DN = 'ou=indexed,%s' % DEFAULT_SUFFIX
+USER_DN = 'uid=indexuser,%s' % DEFAULT_SUFFIX
+USER_PW = 'password'
+OUTER_GROUP_DN = 'cn=outer,%s' % DEFAULT_SUFFIX
+INNER_GROUP_DN = 'cn=inner,%s' % DEFAULT_SUFFIX
+DENY_ACI = ('(targetattr="*")(version 3.0; acl "deny outer group"; deny (read, search) '
+            'groupdn="ldap:///%s";)' % OUTER_GROUP_DN)
+NUM_ENTRIES = 10
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+def _search_as_user(topology):
+    topology.standalone.simple_bind_s(USER_DN, USER_PW)
+    try:
+        entries = topology.standalone.search_s(OU_DN, ldap.SCOPE_ONELEVEL,
+                                               '(objectclass=person)', ['cn'])
+    finally:
+        topology.standalone.simple_bind_s(DN_DM, PASSWORD)
+    return len(entries)
+
+
+def test_group_index_init(topology):
+    """Adds the user, a nested group and the entries the user searches"""
+
+    standalone = topology.standalone
+
+    try:
+        standalone.add_s(Entry((USER_DN, {'objectclass': ['top', 'person', 'inetuser'],
+                                          'sn': 'indexuser',
+                                          'cn': 'indexuser',
+                                          'userpassword': USER_PW})))
+        standalone.add_s(Entry((INNER_GROUP_DN, {'objectclass': ['top', 'groupofnames'],
+                                                 'cn': 'inner'})))
+        standalone.add_s(Entry((OUTER_GROUP_DN, {'objectclass': ['top', 'groupofnames'],
+                                                 'cn': 'outer',
+                                                 'member': INNER_GROUP_DN})))
+        standalone.add_s(Entry((OU_DN, {'objectclass': ['top', 'organizationalunit'],
+                                        'ou': 'indexed',
+                                        'aci': DENY_ACI})))
+        for i in xrange(NUM_ENTRIES):
+            standalone.add_s(Entry(('cn=indexed%d,%s' % (i, OU_DN),
+                                    {'objectclass': ['top', 'person'],
+                                     'sn': 'indexed',
+                                     'cn': 'indexed%d' % i})))
+    except ldap.LDAPError as e:
+        log.fatal('Failed to add the test entries: error (%s)' % e.message['desc'])
+        assert False
+
+
+def test_group_index_nested_member(topology):
+    """Checks that a membership through a nested group is seen as soon as
+    the nested group is modified, and is gone as soon as it is removed
+    """
+
+    standalone = topology.standalone
+
+    assert _search_as_user(topology) == NUM_ENTRIES
+
+    log.info('Add %s to %s' % (USER_DN, INNER_GROUP_DN))
+    standalone.modify_s(INNER_GROUP_DN, [(ldap.MOD_ADD, 'member', USER_DN)])
+    assert _search_as_user(topology) == 0
+
+    log.info('Remove %s from %s' % (INNER_GROUP_DN, OUTER_GROUP_DN))
+    standalone.modify_s(OUTER_GROUP_DN, [(ldap.MOD_DELETE, 'member', INNER_GROUP_DN)])
+    assert _search_as_user(topology) == NUM_ENTRIES
+
+    log.info('Rename %s' % INNER_GROUP_DN)
+    standalone.rename_s(INNER_GROUP_DN, 'cn=inner2', delold=1)
+    standalone.modify_s(OUTER_GROUP_DN, [(ldap.MOD_ADD, 'member',
+                                          'cn=inner2,%s' % DEFAULT_SUFFIX)])
+    assert _search_as_user(topology) == 0
+
+
+def test_group_index_after_restart(topology):
+    """Checks the index built at startup"""
+
+    standalone = topology.standalone
+
+    standalone.restart(timeout=10)
+    # the index is built in the background, the result must not depend on it
+    assert _search_as_user(topology) == 0
+    time.sleep(2)
+    assert _search_as_user(topology) == 0
+
+
+def test_group_index_change_during_build(topology):
+    """Changes a group while the index is built at startup, and checks
+    the change is applied to the built index
+    """
+
+    standalone = topology.standalone
+    inner2 = 'cn=inner2,%s' % DEFAULT_SUFFIX
+
+    standalone.restart(timeout=10)
+    standalone.modify_s(OUTER_GROUP_DN, [(ldap.MOD_DELETE, 'member', inner2)])
+    assert _search_as_user(topology) == NUM_ENTRIES
+    time.sleep(2)
+    assert _search_as_user(topology) == NUM_ENTRIES
+
+    standalone.modify_s(OUTER_GROUP_DN, [(ldap.MOD_ADD, 'member', inner2)])
+    assert _search_as_user(topology) == 0
+
+
+def test_group_index_disabled(topology):
+    """Disables the index and checks the group is still evaluated"""
+
+    standalone = topology.standalone
+
+    standalone.modify_s(ACL_PLUGIN_DN, [(ldap.MOD_REPLACE, GROUP_INDEX_ATTR, 'off')])
+    standalone.restart(timeout=10)
+    assert _search_as_user(topology) == 0
+
+    standalone.modify_s(OUTER_GROUP_DN, [(ldap.MOD_DELETE, 'member',
+                                          'cn=inner2,%s' % DEFAULT_SUFFIX)])
+    assert _search_as_user(topology) == NUM_ENTRIES
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
@@ -0,0 +1,138 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+OU_DN = 'ou=dns,%s' % DEFAULT_SUFFIX
+LDBM_MONITOR_DN = 'cn=monitor,cn=ldbm database,cn=plugins,cn=config'
+# rdn of the entry -> other spellings of its dn, relative to OU_DN
+DNS = {
+    'cn=plain': ['CN=plain', 'cn = plain', ' cn=plain ', 'cn=\\70lain', 'cn="plain"'],
+    'cn=Doe\\, John': ['cn=Doe\\2C John', 'cn="Doe, John"', 'CN = Doe\\, John'],
+    'cn=a\\=b': ['cn=a\\3Db', 'cn="a=b"'],
+    'cn=caf\xc3\xa9': ['cn=caf\\C3\\A9', 'CN=caf\xc3\xa9'],
+    'cn=multi+sn=valued': ['sn=valued+cn=multi', 'cn=multi + sn=valued'],
+}
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+def _ndn_cache_stats(topology):
+    entry = topology.standalone.search_s(LDBM_MONITOR_DN, ldap.SCOPE_BASE, '(objectclass=*)',
+                                         ['normalizedDnCacheTries', 'normalizedDnCacheHits',
+                                          'normalizedDnCacheMisses'])[0]
+    return (int(entry.getValue('normalizedDnCacheTries')),
+            int(entry.getValue('normalizedDnCacheHits')),
+            int(entry.getValue('normalizedDnCacheMisses')))
+
+
+def test_dn_normalize(topology):
+    """Reads entries with tricky rdns through dns which are normalized,
+    which take the fast path, and through other spellings of them, which
+    go through the normalizer and the ndn cache, and checks they all
+    name the same entry
+    """
+
+    topology.standalone.add_s(Entry((OU_DN, {'objectclass': ['top', 'organizationalunit'],
+                                             'ou': 'dns'})))
+    for rdn in DNS:
+        attrs = {'objectclass': ['top', 'person', 'extensibleobject']}
+        for av in rdn.split('+'):
+            attr, value = av.split('=', 1)
+            attrs.setdefault(attr, value.replace('\\', ''))
+        attrs.setdefault('sn', 'dns')
+        topology.standalone.add_s(Entry(('%s,%s' % (rdn, OU_DN), attrs)))
+
+    entries = topology.standalone.search_s(OU_DN, ldap.SCOPE_ONELEVEL, '(objectclass=*)', ['cn'])
+    ndns = [e.dn.lower() for e in entries]
+    assert len(ndns) == len(DNS)
+
+    # twice, so that the second round hits the ndn cache
+    for i in range(2):
+        for rdn, spellings in DNS.items():
+            for dn in [rdn] + spellings:
+                for suffix in [OU_DN, 'ou=dns, dc=example, dc=com', 'OU=dns;DC=example;DC=com']:
+                    entries = topology.standalone.search_s('%s,%s' % (dn, suffix), ldap.SCOPE_BASE,
+                                                           '(objectclass=*)', ['cn'])
+                    assert len(entries) == 1
+                    assert entries[0].dn.lower() in ndns
+
+    # the statistics are summed over the shards of the cache
+    tries, hits, misses = _ndn_cache_stats(topology)
+    assert tries > 0
+    assert hits > 0
+    assert tries == hits + misses
+
+    # a normalized dn neither misses nor ends up in the cache
+    for i in range(10):
+        topology.standalone.search_s(OU_DN, ldap.SCOPE_BASE, '(objectclass=*)', ['ou'])
+    assert _ndn_cache_stats(topology)[2] == misses
+
+    for dn in ['cn=x,,%s' % OU_DN, '=x,%s' % OU_DN, 'cn=,%s' % OU_DN]:
+        try:
+            topology.standalone.search_s(dn, ldap.SCOPE_BASE, '(objectclass=*)')
+            assert False
+        except (ldap.INVALID_DN_SYNTAX, ldap.NO_SUCH_OBJECT):
+            pass
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
@@ -73,6 +73,119 @@ def test_cos_(topology):
     return
 
 
+COS_TEMPLATES_DN = 'cn=cosTemplates,' + DEFAULT_SUFFIX
+COS_DEF_DN = 'cn=cosClassicDef,' + DEFAULT_SUFFIX
+
+
+def _wait_for_cos_value(topology, dn, value, timeout=10):
+    """
+    The CoS cache follows the changes asynchronously: poll the entry.
+    """
+    for count in range(timeout * 2):
+        ent = topology.standalone.getEntry(dn, ldap.SCOPE_BASE, '(objectclass=*)', ['postalCode'])
+        if ent.getValue('postalCode') == value:
+            return
+        time.sleep(0.5)
+    log.fatal('%s has postalCode %s instead of %s' % (dn, ent.getValue('postalCode'), value))
+    assert False
+
+
+def test_cos_classic_templates(topology):
+    """
+    A classic definition with many templates: each entry gets the value
+    of the template its specifier names, whatever the case, or the
+    default template value.
+    """
+
+    topology.standalone.add_s(Entry((COS_TEMPLATES_DN,
+                                     {'objectclass': 'top nsContainer'.split(),
+                                      'cn': 'cosTemplates'})))
+    for i in range(50):
+        topology.standalone.add_s(Entry(('cn=grade%d,%s' % (i, COS_TEMPLATES_DN),
+                                         {'objectclass': 'top extensibleObject cosTemplate'.split(),
+                                          'cn': 'grade%d' % i,
+                                          'postalCode': str(1000 + i)})))
+    topology.standalone.add_s(Entry(('cn=employeeType-default,' + COS_TEMPLATES_DN,
+                                     {'objectclass': 'top extensibleObject cosTemplate'.split(),
+                                      'cn': 'employeeType-default',
+                                      'postalCode': '999'})))
+    topology.standalone.add_s(Entry((COS_DEF_DN,
+                                     {'objectclass': 'top ldapSubEntry cosSuperDefinition cosClassicDefinition'.split(),
+                                      'cn': 'cosClassicDef',
+                                      'cosTemplateDn': COS_TEMPLATES_DN,
+                                      'cosSpecifier': 'employeeType',
+                                      'cosAttribute': 'postalCode'})))
+
+    users = [('cos_user1', 'grade1', '1001'),
+             ('cos_user2', 'GRADE42', '1042'),
+             ('cos_user3', 'grade99', '999'),
+             ('cos_user4', None, '999')]
+    for uid, grade, value in users:
+        attrs = {'objectclass': 'top person organizationalPerson inetorgperson'.split(),
+                 'sn': uid,
+                 'cn': uid,
+                 'uid': uid}
+        if grade:
+            attrs['employeeType'] = grade
+        topology.standalone.add_s(Entry(('uid=%s,%s' % (uid, DEFAULT_SUFFIX), attrs)))
+    for uid, grade, value in users:
+        _wait_for_cos_value(topology, 'uid=%s,%s' % (uid, DEFAULT_SUFFIX), value)
+
+    # a real value wins over the template
+    user_dn = 'uid=cos_user1,' + DEFAULT_SUFFIX
+    topology.standalone.modify_s(user_dn, [(ldap.MOD_ADD, 'postalCode', '77')])
+    _wait_for_cos_value(topology, user_dn, '77')
+    topology.standalone.modify_s(user_dn, [(ldap.MOD_DELETE, 'postalCode', '77')])
+    _wait_for_cos_value(topology, user_dn, '1001')
+
+    # changing the specifier picks another template
+    topology.standalone.modify_s(user_dn, [(ldap.MOD_REPLACE, 'employeeType', 'grade7')])
+    _wait_for_cos_value(topology, user_dn, '1007')
+
+
+def test_cos_template_updates(topology):
+    """
+    The cache follows the changes of single templates and definitions:
+    modified, added, deleted and renamed templates, and a modified
+    definition.
+    """
+
+    user1_dn = 'uid=cos_user1,' + DEFAULT_SUFFIX
+    user2_dn = 'uid=cos_user2,' + DEFAULT_SUFFIX
+    user3_dn = 'uid=cos_user3,' + DEFAULT_SUFFIX
+    user4_dn = 'uid=cos_user4,' + DEFAULT_SUFFIX
+
+    # modified template
+    topology.standalone.modify_s('cn=grade42,' + COS_TEMPLATES_DN,
+                                 [(ldap.MOD_REPLACE, 'postalCode', '2042')])
+    _wait_for_cos_value(topology, user2_dn, '2042')
+    _wait_for_cos_value(topology, user1_dn, '1007')
+
+    # added template
+    topology.standalone.add_s(Entry(('cn=grade99,' + COS_TEMPLATES_DN,
+                                     {'objectclass': 'top extensibleObject cosTemplate'.split(),
+                                      'cn': 'grade99',
+                                      'postalCode': '1099'})))
+    _wait_for_cos_value(topology, user3_dn, '1099')
+
+    # deleted template
+    topology.standalone.delete_s('cn=grade7,' + COS_TEMPLATES_DN)
+    _wait_for_cos_value(topology, user1_dn, '999')
+
+    # renamed template
+    topology.standalone.rename_s('cn=grade42,' + COS_TEMPLATES_DN, 'cn=grade43', delold=1)
+    _wait_for_cos_value(topology, user2_dn, '999')
+    topology.standalone.modify_s(user2_dn, [(ldap.MOD_REPLACE, 'employeeType', 'grade43')])
+    _wait_for_cos_value(topology, user2_dn, '2042')
+
+    # modified definition
+    topology.standalone.modify_s(user4_dn, [(ldap.MOD_ADD, 'postalCode', '77')])
+    _wait_for_cos_value(topology, user4_dn, '77')
+    topology.standalone.modify_s(COS_DEF_DN, [(ldap.MOD_REPLACE, 'cosAttribute', 'postalCode override')])
+    _wait_for_cos_value(topology, user4_dn, '999')
+    _wait_for_cos_value(topology, user3_dn, '1099')
+
+
 def test_cos_final(topology):
     topology.standalone.delete()
     log.info('cos test suite PASSED')
@@ -85,6 +198,8 @@ def run_isolated():
     topo = topology(True)
     test_cos_init(topo)
     test_cos_(topo)
+    test_cos_classic_templates(topo)
+    test_cos_template_updates(topo)
     test_cos_final(topo)
 
 
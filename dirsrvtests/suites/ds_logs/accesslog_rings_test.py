@@ -0,0 +1,193 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import re
+import sys
+import time
+import ldap
+import logging
+import pytest
+import threading
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+BUFFERING_ATTR = 'nsslapd-accesslog-logbuffering'
+NUM_CLIENTS = 8
+NUM_SEARCHES = 100
+TIME_RE = re.compile(r'^\[\d+/\w+/\d+:\d+:\d+:\d+ [+-]\d+\] ')
+LINE_RE = re.compile(r'^\[[^\]]+\] conn=(\d+) op=(-?\d+) (\w+)(.*)$')
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+class Client(threading.Thread):
+    """Searches for entries that do not exist, with filters naming the
+    run, the client and the search, on its own connection
+    """
+
+    def __init__(self, inst, run, idx):
+        threading.Thread.__init__(self)
+        self.inst = inst
+        self.run_name = run
+        self.idx = idx
+        self.errors = []
+
+    def run(self):
+        conn = ldap.initialize('ldap://%s:%s' % (self.inst.host, self.inst.port))
+        try:
+            conn.simple_bind_s(DN_DM, PASSWORD)
+            for i in range(NUM_SEARCHES):
+                conn.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE,
+                              '(cn=%s-%d-%d)' % (self.run_name, self.idx, i), ['cn'])
+            conn.unbind_s()
+        except ldap.LDAPError as e:
+            self.errors.append(str(e))
+
+
+def _run_clients(topology, run):
+    clients = [Client(topology.standalone, run, i) for i in range(NUM_CLIENTS)]
+    for client in clients:
+        client.start()
+    for client in clients:
+        client.join()
+        assert client.errors == []
+
+
+def _check_accesslog(topology, run):
+    """Checks each search of the clients of a run was logged once, before
+    its result, and that the operations of each connection are in order
+    """
+
+    filter_re = re.compile(r'filter="\(cn=%s-(\d+)-(\d+)\)"' % run)
+    searches = {}
+    requests = {}
+    with open(topology.standalone.accesslog, 'r') as f:
+        for line in f:
+            line = line.rstrip('\n')
+            if not line.startswith('['):
+                # the title, written again when the server restarts
+                requests = {}
+                continue
+            # every line is complete
+            assert TIME_RE.match(line)
+            m = LINE_RE.match(line)
+            if not m:
+                continue
+            conn, op, kind = int(m.group(1)), int(m.group(2)), m.group(3)
+            ops = requests.setdefault(conn, [])
+            if kind == 'SRCH':
+                f = filter_re.search(m.group(4))
+                if f:
+                    key = (int(f.group(1)), int(f.group(2)))
+                    searches[key] = searches.get(key, 0) + 1
+                # the operations of a connection are logged in order
+                if ops:
+                    assert op > ops[-1]
+                ops.append(op)
+            elif kind == 'RESULT' and op >= 0 and ops:
+                # and the result of a search after its request
+                assert op <= ops[-1]
+
+    for i in range(NUM_CLIENTS):
+        for j in range(NUM_SEARCHES):
+            assert searches.get((i, j)) == 1
+
+
+def test_accesslog_rings(topology):
+    """Logs the operations of concurrent clients through the per thread
+    rings of the buffered access log, and checks none is lost, repeated
+    or reordered within its connection
+    """
+
+    topology.standalone.modify_s(DN_CONFIG, [(ldap.MOD_REPLACE, BUFFERING_ATTR, 'on')])
+    _run_clients(topology, 'buffered')
+
+    # stopping the server drains the rings
+    topology.standalone.stop(timeout=10)
+    _check_accesslog(topology, 'buffered')
+    topology.standalone.start(timeout=10)
+
+
+def test_accesslog_rings_unbuffered(topology):
+    """Turns the buffering off, which bypasses the rings, and checks the
+    lines reach the access log while the server runs
+    """
+
+    topology.standalone.modify_s(DN_CONFIG, [(ldap.MOD_REPLACE, BUFFERING_ATTR, 'off')])
+    _run_clients(topology, 'unbuffered')
+    _check_accesslog(topology, 'unbuffered')
+    topology.standalone.modify_s(DN_CONFIG, [(ldap.MOD_REPLACE, BUFFERING_ATTR, 'on')])
+
+
+def test_accesslog_rings_switch(topology):
+    """Turns the buffering off while the clients run: the lines of the
+    rings are written before the ones logged directly, so the operations
+    of each connection stay in order
+    """
+
+    clients = [Client(topology.standalone, 'switch', i) for i in range(NUM_CLIENTS)]
+    for client in clients:
+        client.start()
+    time.sleep(0.2)
+    topology.standalone.modify_s(DN_CONFIG, [(ldap.MOD_REPLACE, BUFFERING_ATTR, 'off')])
+    for client in clients:
+        client.join()
+        assert client.errors == []
+    _check_accesslog(topology, 'switch')
+    topology.standalone.modify_s(DN_CONFIG, [(ldap.MOD_REPLACE, BUFFERING_ATTR, 'on')])
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
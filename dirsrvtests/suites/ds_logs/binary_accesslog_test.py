@@ -0,0 +1,188 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import json
+import time
+import ldap
+import logging
+import pytest
+import subprocess
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+BINARY_ATTR = 'nsslapd-accesslog-binary'
+BINARY_MAGIC = '\x89DSALOG\n'
+USER_DN = 'uid=binlog,%s' % DEFAULT_SUFFIX
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+def _read_magic(topology):
+    with open(topology.standalone.accesslog, 'rb') as f:
+        return f.read(len(BINARY_MAGIC))
+
+
+def _logdecode(topology, *args):
+    """Decodes the access log, and returns the lines logdecode printed"""
+
+    cmd = ['logdecode'] + list(args) + [topology.standalone.accesslog]
+    log.info(' '.join(cmd))
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    stdout, stderr = proc.communicate()
+    assert proc.returncode == 0
+    assert stderr == ''
+    return stdout.splitlines()
+
+
+def _check_searches(topology, count):
+    """Checks the decoded access log holds count searches for the test
+    entry, each with its request and its result record
+    """
+
+    results = [json.loads(line) for line in _logdecode(topology, '-j')]
+    results = [r for r in results if r.get('filter') == '(cn=binlog)']
+    assert len(results) == count
+    for r in results:
+        assert r['base'].lower() == DEFAULT_SUFFIX.lower()
+        assert r['tag'] == 101
+        assert r['err'] == 0
+        assert r['nentries'] == 1
+
+    lines = _logdecode(topology)
+    for r in results:
+        # the SRCH line, kept as a text record, and the RESULT line
+        # rebuilt from the operation record
+        conn_op = 'conn=%d op=%d ' % (r['conn'], r['op'])
+        srch = [l for l in lines if conn_op + 'SRCH' in l]
+        assert len(srch) == 1
+        assert 'filter="(cn=binlog)"' in srch[0]
+        result = [l for l in lines if conn_op + 'RESULT' in l]
+        assert len(result) == 1
+        assert 'err=0 tag=101 nentries=1 ' in result[0]
+
+
+def test_binary_accesslog_init(topology):
+    """Adds the entry the tests search for"""
+
+    try:
+        topology.standalone.add_s(Entry((USER_DN, {'objectclass': ['top', 'person'],
+                                                   'sn': 'binlog',
+                                                   'cn': 'binlog'})))
+    except ldap.LDAPError as e:
+        log.fatal('Failed to add the test entry: error (%s)' % e.message['desc'])
+        assert False
+
+
+def test_binary_accesslog_enable(topology):
+    """Turns the binary format on and checks the access log is rotated to a
+    binary file holding the operations
+    """
+
+    standalone = topology.standalone
+
+    standalone.modify_s(DN_CONFIG, [(ldap.MOD_REPLACE, BINARY_ATTR, 'on'),
+                                    (ldap.MOD_REPLACE, 'nsslapd-accesslog-logbuffering', 'off')])
+    standalone.restart(timeout=10)
+
+    entries = standalone.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE, '(cn=binlog)')
+    assert len(entries) == 1
+    time.sleep(2)
+
+    assert _read_magic(topology) == BINARY_MAGIC
+    _check_searches(topology, 1)
+
+
+def test_binary_accesslog_restart(topology):
+    """Restarts the server with the binary format already on, and checks
+    it keeps appending frames to the same file, without writing the magic
+    in the middle of it
+    """
+
+    standalone = topology.standalone
+
+    standalone.restart(timeout=10)
+
+    entries = standalone.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE, '(cn=binlog)')
+    assert len(entries) == 1
+    time.sleep(2)
+
+    with open(standalone.accesslog, 'rb') as f:
+        data = f.read()
+    assert data.startswith(BINARY_MAGIC)
+    assert data.count(BINARY_MAGIC) == 1
+    # the searches before and after the restart
+    _check_searches(topology, 2)
+
+
+def test_binary_accesslog_disable(topology):
+    """Turns the binary format off and checks the access log is text again"""
+
+    standalone = topology.standalone
+
+    standalone.modify_s(DN_CONFIG, [(ldap.MOD_REPLACE, BINARY_ATTR, 'off')])
+    standalone.restart(timeout=10)
+
+    entries = standalone.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE, '(cn=binlog)')
+    assert len(entries) == 1
+    time.sleep(2)
+
+    assert _read_magic(topology) != BINARY_MAGIC
+    with open(standalone.accesslog, 'rb') as f:
+        assert 'RESULT err=0 tag=101 nentries=1' in f.read()
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
@@ -0,0 +1,161 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+USER_DN = 'uid=indexed,%s' % DEFAULT_SUFFIX
+# enough attributes for the entry cache to index them
+USER_ATTRS = {'objectclass': ['top', 'person', 'organizationalperson',
+                              'inetorgperson', 'extensibleobject'],
+              'uid': 'indexed',
+              'cn': 'indexed',
+              'cn;lang-fr': 'indexe',
+              'sn': 'indexed',
+              'givenname': 'first',
+              'mail': 'indexed@example.com',
+              'telephonenumber': '1234',
+              'mobile': '5678',
+              'pager': '9012',
+              'title': 'tester',
+              'l': 'somewhere',
+              'st': 'state',
+              'street': 'street',
+              'postalcode': '12345',
+              'description': 'indexed entry',
+              'departmentnumber': '42',
+              'employeenumber': '7',
+              'employeetype': 'test',
+              'roomnumber': '101',
+              'initials': 'ie'}
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+def _matches(topology, filt):
+    """Reads the entry with a filter, the entry coming from the cache"""
+
+    entries = topology.standalone.search_s(USER_DN, ldap.SCOPE_BASE, filt)
+    return len(entries) == 1
+
+
+def test_entry_attr_index(topology):
+    """Looks the attributes of an entry with many attributes up, once it
+    is in the entry cache, by name, alias, case and options, and checks
+    the lookups follow the changes of the entry
+    """
+
+    topology.standalone.add_s(Entry((USER_DN, USER_ATTRS)))
+
+    # twice: the first read caches the entry
+    for i in range(2):
+        for attr, value in USER_ATTRS.items():
+            if attr == 'objectclass':
+                continue
+            assert _matches(topology, '(%s=%s)' % (attr, value))
+            assert _matches(topology, '(%s=%s)' % (attr.upper(), value))
+            assert _matches(topology, '(%s=*)' % attr)
+
+        # aliases and oids of the types
+        assert _matches(topology, '(surname=indexed)')
+        assert _matches(topology, '(commonName=indexed)')
+        assert _matches(topology, '(2.5.4.4=indexed)')
+        assert _matches(topology, '(userid=indexed)')
+
+        # a type with options only matches its own values
+        assert _matches(topology, '(cn;lang-fr=indexe)')
+        assert not _matches(topology, '(cn;lang-fr=indexed)')
+        assert _matches(topology, '(cn=indexe)')
+
+        assert not _matches(topology, '(manager=*)')
+        assert not _matches(topology, '(sn=other)')
+
+        entry = topology.standalone.search_s(USER_DN, ldap.SCOPE_BASE,
+                                             '(objectclass=*)', ['SN', 'Mail', 'l'])[0]
+        assert entry.getValue('sn') == 'indexed'
+        assert entry.getValue('mail') == 'indexed@example.com'
+        assert entry.getValue('l') == 'somewhere'
+        assert topology.standalone.compare_s(USER_DN, 'surname', 'indexed')
+
+    log.info('Modify the attributes of %s' % USER_DN)
+    topology.standalone.modify_s(USER_DN, [(ldap.MOD_REPLACE, 'sn', 'changed'),
+                                           (ldap.MOD_ADD, 'manager', DN_DM),
+                                           (ldap.MOD_DELETE, 'pager', None),
+                                           (ldap.MOD_DELETE, 'cn;lang-fr', None)])
+    for i in range(2):
+        assert _matches(topology, '(sn=changed)')
+        assert _matches(topology, '(surname=changed)')
+        assert not _matches(topology, '(sn=indexed)')
+        assert _matches(topology, '(manager=*)')
+        assert not _matches(topology, '(pager=*)')
+        assert not _matches(topology, '(cn=indexe)')
+        assert _matches(topology, '(cn=indexed)')
+
+    log.info('Rename %s' % USER_DN)
+    topology.standalone.rename_s(USER_DN, 'uid=renamed', delold=1)
+    entries = topology.standalone.search_s('uid=renamed,%s' % DEFAULT_SUFFIX,
+                                           ldap.SCOPE_BASE, '(uid=renamed)', ['uid'])
+    assert len(entries) == 1
+    assert entries[0].getValues('uid') == ['renamed']
+    topology.standalone.delete_s('uid=renamed,%s' % DEFAULT_SUFFIX)
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
@@ -169,6 +169,125 @@ def test_memberof_auto_add_oc(topology):
     log.info('Test complete.')
 
 
+def _check_memberof(topology, dn, groups):
+    ent = topology.standalone.getEntry(dn, ldap.SCOPE_BASE, '(objectclass=*)', ['memberOf'])
+    values = set([v.lower() for v in ent.getValues('memberOf')])
+    assert values == set([g.lower() for g in groups])
+
+
+def test_memberof_nested_groups(topology):
+    """
+    Check the memberOf values of a user as its nested groups get added,
+    changed, renamed and deleted.  The groups nested in each other are
+    tracked by the in memory group graph of the plugin.
+    """
+
+    user_dn = 'uid=nested_user,' + DEFAULT_SUFFIX
+    group_dns = ['cn=nested_group%d,%s' % (i, DEFAULT_SUFFIX) for i in range(3)]
+
+    topology.standalone.add_s(Entry((user_dn,
+                                     {'objectclass': 'top person organizationalPerson inetorgperson'.split(),
+                                      'sn': 'user',
+                                      'cn': 'nested user',
+                                      'uid': 'nested_user'})))
+
+    # group2 > group1 > group0 > user
+    for i, group_dn in enumerate(group_dns):
+        topology.standalone.add_s(Entry((group_dn,
+                                         {'objectclass': 'top groupOfNames'.split(),
+                                          'cn': 'nested_group%d' % i,
+                                          'member': i and group_dns[i - 1] or user_dn})))
+    _check_memberof(topology, user_dn, group_dns)
+
+    # cut group1 out of group2
+    topology.standalone.modify_s(group_dns[2], [(ldap.MOD_DELETE, 'member', group_dns[1])])
+    _check_memberof(topology, user_dn, group_dns[:2])
+
+    # and put it back, along with the user
+    topology.standalone.modify_s(group_dns[2], [(ldap.MOD_ADD, 'member', [group_dns[1], user_dn])])
+    _check_memberof(topology, user_dn, group_dns)
+
+    # the user stays in group2 directly
+    topology.standalone.modify_s(group_dns[2], [(ldap.MOD_DELETE, 'member', group_dns[1])])
+    _check_memberof(topology, user_dn, group_dns)
+    topology.standalone.modify_s(group_dns[2], [(ldap.MOD_REPLACE, 'member', group_dns[1])])
+    _check_memberof(topology, user_dn, group_dns)
+
+    # rename group0
+    topology.standalone.rename_s(group_dns[0], 'cn=nested_group0_new', delold=1)
+    group_dns[0] = 'cn=nested_group0_new,' + DEFAULT_SUFFIX
+    _check_memberof(topology, user_dn, group_dns)
+
+    # delete the middle group
+    topology.standalone.delete_s(group_dns[1])
+    _check_memberof(topology, user_dn, group_dns[:1])
+
+    # a fixup task rebuilds the graph and agrees
+    topology.standalone.tasks.fixupMemberOf(suffix=DEFAULT_SUFFIX, args={TASK_WAIT: True})
+    _check_memberof(topology, user_dn, group_dns[:1])
+
+    for dn in [group_dns[0], group_dns[2], user_dn]:
+        topology.standalone.delete_s(dn)
+
+    log.info('Test complete.')
+
+
+def test_memberof_parallel_fixup(topology):
+    """
+    Break the memberOf values of users in nested groups, then check that a
+    fixup task running with several threads restores them.
+    """
+
+    user_dns = ['uid=fixup_user%d,%s' % (i, DEFAULT_SUFFIX) for i in range(20)]
+    group_dns = ['cn=fixup_group%d,%s' % (i, DEFAULT_SUFFIX) for i in range(2)]
+
+    for i, user_dn in enumerate(user_dns):
+        topology.standalone.add_s(Entry((user_dn,
+                                         {'objectclass': 'top person organizationalPerson inetorgperson inetuser'.split(),
+                                          'sn': 'user',
+                                          'cn': 'fixup user %d' % i,
+                                          'uid': 'fixup_user%d' % i})))
+
+    # group1 > group0 > even users, and group1 > odd users
+    topology.standalone.add_s(Entry((group_dns[0],
+                                     {'objectclass': 'top groupOfNames'.split(),
+                                      'cn': 'fixup_group0',
+                                      'member': user_dns[0::2]})))
+    topology.standalone.add_s(Entry((group_dns[1],
+                                     {'objectclass': 'top groupOfNames'.split(),
+                                      'cn': 'fixup_group1',
+                                      'member': [group_dns[0]] + user_dns[1::2]})))
+
+    for user_dn in user_dns:
+        topology.standalone.modify_s(user_dn, [(ldap.MOD_REPLACE, 'memberOf', GROUP_DN)])
+
+    task_dn = 'cn=fixup_parallel,cn=memberOf task,cn=tasks,cn=config'
+    topology.standalone.add_s(Entry((task_dn,
+                                     {'objectclass': 'top extensibleObject'.split(),
+                                      'cn': 'fixup_parallel',
+                                      'basedn': DEFAULT_SUFFIX,
+                                      'filter': '(uid=fixup_user*)',
+                                      'threads': '4'})))
+    exitcode = None
+    for count in range(30):
+        entry = topology.standalone.getEntry(task_dn, attrlist=['nsTaskExitCode'])
+        if entry is None or entry.nsTaskExitCode:
+            exitcode = entry and entry.nsTaskExitCode
+            break
+        time.sleep(1)
+    assert exitcode == '0'
+
+    for user_dn in user_dns[0::2]:
+        _check_memberof(topology, user_dn, group_dns)
+    for user_dn in user_dns[1::2]:
+        _check_memberof(topology, user_dn, group_dns[1:])
+
+    for dn in group_dns + user_dns:
+        topology.standalone.delete_s(dn)
+
+    log.info('Test complete.')
+
+
 if __name__ == '__main__':
     # Run isolated
     # -s for DEBUG mode
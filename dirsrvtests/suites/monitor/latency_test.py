@@ -0,0 +1,120 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+LATENCY_ATTR = 'nsslapd-latency-stats'
+LATENCY_DN = 'cn=latency,cn=monitor'
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+def _latency(topology, attr):
+    """Returns the values of attr in cn=latency,cn=monitor, by name"""
+
+    entries = topology.standalone.search_s(LATENCY_DN, ldap.SCOPE_BASE,
+                                           '(objectclass=*)', [attr])
+    assert len(entries) == 1
+    values = {}
+    for value in entries[0].getValues(attr) or []:
+        name, stats = value.split(' ', 1)
+        values[name] = dict(field.split('=') for field in stats.split())
+    return values
+
+
+def test_latency_recorded(topology):
+    """Checks the searches show up in the operation and phase histograms"""
+
+    for i in range(10):
+        topology.standalone.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE,
+                                     '(objectclass=*)')
+
+    ops = _latency(topology, 'operationLatency')
+    assert 'search' in ops
+    assert int(ops['search']['count']) >= 10
+    search = ops['search']
+    assert int(search['p50']) <= int(search['p99']) <= int(search['max'])
+
+    phases = _latency(topology, 'phaseLatency')
+    for phase in ('queue', 'parse', 'backend', 'candidates', 'encode', 'send'):
+        assert phase in phases
+
+    assert 'userRoot' in _latency(topology, 'backendLatency')
+
+
+def test_latency_disable(topology):
+    """Turns the histograms off and checks they no longer grow"""
+
+    standalone = topology.standalone
+
+    standalone.modify_s(DN_CONFIG, [(ldap.MOD_REPLACE, LATENCY_ATTR, 'off')])
+    count = int(_latency(topology, 'operationLatency')['search']['count'])
+    for i in range(10):
+        standalone.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE, '(objectclass=*)')
+    assert int(_latency(topology, 'operationLatency')['search']['count']) == count
+
+    standalone.modify_s(DN_CONFIG, [(ldap.MOD_REPLACE, LATENCY_ATTR, 'on')])
+    standalone.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE, '(objectclass=*)')
+    assert int(_latency(topology, 'operationLatency')['search']['count']) > count
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
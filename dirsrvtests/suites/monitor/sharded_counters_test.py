@@ -0,0 +1,163 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+import threading
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+MONITOR_DN = 'cn=monitor'
+SNMP_DN = 'cn=snmp,cn=monitor'
+OU_DN = 'ou=counters,%s' % DEFAULT_SUFFIX
+NUM_CLIENTS = 8
+NUM_OPS = 50
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+class Client(threading.Thread):
+    """Adds, compares, finds and deletes its own entries, on its own
+    connection, so that the counters are updated by many threads
+    """
+
+    def __init__(self, inst, idx):
+        threading.Thread.__init__(self)
+        self.inst = inst
+        self.idx = idx
+        self.errors = []
+
+    def run(self):
+        conn = ldap.initialize('ldap://%s:%s' % (self.inst.host, self.inst.port))
+        try:
+            conn.simple_bind_s(DN_DM, PASSWORD)
+            for i in range(NUM_OPS):
+                name = 'counter-%d-%d' % (self.idx, i)
+                dn = 'cn=%s,%s' % (name, OU_DN)
+                conn.add_s(dn, [('objectclass', ['top', 'person']),
+                                ('cn', [name]), ('sn', [name])])
+                assert conn.compare_s(dn, 'sn', name)
+                entries = conn.search_s(OU_DN, ldap.SCOPE_SUBTREE, '(cn=%s)' % name)
+                assert len(entries) == 1
+                conn.delete_s(dn)
+            conn.unbind_s()
+        except (ldap.LDAPError, AssertionError) as e:
+            self.errors.append(str(e))
+
+
+def _counters(topology):
+    counters = {}
+    for dn in [MONITOR_DN, SNMP_DN]:
+        entry = topology.standalone.search_s(dn, ldap.SCOPE_BASE, '(objectclass=*)')[0]
+        for attr in entry.getAttrs():
+            try:
+                counters[attr.lower()] = int(entry.getValue(attr))
+            except ValueError:
+                pass
+    return counters
+
+
+def test_sharded_counters(topology):
+    """Updates the sharded operation counters from concurrent connections,
+    and checks their sums match the operations done
+    """
+
+    topology.standalone.add_s(Entry((OU_DN, {'objectclass': ['top', 'organizationalunit'],
+                                             'ou': 'counters'})))
+
+    before = _counters(topology)
+    clients = [Client(topology.standalone, i) for i in range(NUM_CLIENTS)]
+    for client in clients:
+        client.start()
+    for client in clients:
+        client.join()
+        assert client.errors == []
+    after = _counters(topology)
+
+    count = NUM_CLIENTS * NUM_OPS
+    assert after['addentryops'] - before['addentryops'] == count
+    assert after['removeentryops'] - before['removeentryops'] == count
+    assert after['compareops'] - before['compareops'] == count
+    assert after['wholesubtreesearchops'] - before['wholesubtreesearchops'] == count
+    # the subtree searches, and the base searches reading the counters
+    assert after['entriesreturned'] - before['entriesreturned'] >= count
+    assert after['entriessent'] - before['entriessent'] >= count
+    # binds, adds, compares, searches, deletes and unbinds
+    assert after['opsinitiated'] - before['opsinitiated'] >= NUM_CLIENTS * (4 * NUM_OPS + 2)
+    # all done but the search reading them
+    assert after['opsinitiated'] - after['opscompleted'] == 1
+    # decremented on other shards than they were incremented on, the
+    # counters must not wrap around below 0
+    assert 0 <= after['connectionsinmaxthreads'] < 2 ** 32
+
+
+def test_sharded_counters_stable(topology):
+    """Checks the counters keep their value across reads, the sums of
+    their shards being stable while nothing happens
+    """
+
+    first = _counters(topology)
+    second = _counters(topology)
+    for attr in ['addentryops', 'removeentryops', 'compareops', 'wholesubtreesearchops']:
+        assert first[attr] == second[attr]
+    # one more search, reading them
+    assert second['opsinitiated'] - first['opsinitiated'] == 2
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
@@ -7,6 +7,7 @@
 # --- END COPYRIGHT BLOCK ---
 #
 import os
+import re
 import sys
 import time
 import ldap
@@ -65,12 +66,92 @@ def test_referint_init(topology):
     return
 
 
-def test_referint_(topology):
+def test_referint_delayed_batch(topology):
     '''
-    Write a single test here...
+    Delete and rename members in delayed mode: the worker applies the
+    integrity log in batches, coalescing the renames of the same entry.
     '''
 
-    return
+    PLUGIN_DN = 'cn=' + PLUGIN_REFER_INTEGRITY + ',cn=plugins,cn=config'
+    GROUP_DN = 'cn=group,' + DEFAULT_SUFFIX
+
+    topology.standalone.plugins.enable(name=PLUGIN_REFER_INTEGRITY)
+    try:
+        topology.standalone.modify_s(PLUGIN_DN,
+                                     [(ldap.MOD_REPLACE, 'referint-update-delay', '2'),
+                                      (ldap.MOD_REPLACE, 'referint-batch-size', '10')])
+        # the batch counters are logged at the plugin level
+        topology.standalone.modify_s(DN_CONFIG,
+                                     [(ldap.MOD_REPLACE, 'nsslapd-errorlog-level', '65536')])
+    except ldap.LDAPError as e:
+        log.fatal('Failed to configure referint plugin: error ' + e.message['desc'])
+        assert False
+    topology.standalone.restart(timeout=10)
+    with open(topology.standalone.errlog, 'w') as errlog:
+        errlog.writelines("")
+
+    members = []
+    for idx in range(1, 4):
+        user_dn = 'uid=user%d,%s' % (idx, DEFAULT_SUFFIX)
+        try:
+            topology.standalone.add_s(Entry((user_dn,
+                                             {'objectclass': 'top person'.split(),
+                                              'sn': 'user',
+                                              'cn': 'user%d' % idx,
+                                              'uid': 'user%d' % idx})))
+        except ldap.LDAPError as e:
+            log.fatal('Failed to add user entry, error: ' + e.message['desc'])
+            assert False
+        members.append(user_dn)
+
+    try:
+        topology.standalone.add_s(Entry((GROUP_DN,
+                                         {'objectclass': 'top groupOfNames'.split(),
+                                          'cn': 'group',
+                                          'member': members})))
+    except ldap.LDAPError as e:
+        log.fatal('Failed to add group entry, error: ' + e.message['desc'])
+        assert False
+
+    try:
+        topology.standalone.delete_s(members[0])
+        topology.standalone.rename_s(members[1], 'uid=user2a', delold=1)
+        topology.standalone.rename_s('uid=user2a,' + DEFAULT_SUFFIX, 'uid=user2b', delold=1)
+        topology.standalone.delete_s(members[2])
+    except ldap.LDAPError as e:
+        log.fatal('Failed to update the members, error: ' + e.message['desc'])
+        assert False
+
+    # The updates are applied asynchronously
+    for i in range(30):
+        entries = topology.standalone.search_s(GROUP_DN, ldap.SCOPE_BASE, 'objectclass=*', ['member'])
+        values = [v.lower() for v in entries[0].getValues('member')]
+        if values == [('uid=user2b,' + DEFAULT_SUFFIX).lower()]:
+            break
+        time.sleep(1)
+    assert values == [('uid=user2b,' + DEFAULT_SUFFIX).lower()]
+
+    # The four records were read in one batch, where the rename chain
+    # user2 -> user2a -> user2b is coalesced into one update
+    records = updates = 0
+    with open(topology.standalone.errlog, 'r') as errlog:
+        for line in errlog:
+            match = re.search(r'(\d+) records coalesced to (\d+) updates', line)
+            if match:
+                records += int(match.group(1))
+                updates += int(match.group(2))
+    log.info('%d records coalesced to %d updates' % (records, updates))
+    assert records == 4
+    assert updates < records
+
+    try:
+        topology.standalone.modify_s(DN_CONFIG,
+                                     [(ldap.MOD_REPLACE, 'nsslapd-errorlog-level', '0')])
+    except ldap.LDAPError as e:
+        log.fatal('Failed to reset the error log level: error ' + e.message['desc'])
+        assert False
+
+    log.info('test_referint_delayed_batch: PASSED')
 
 
 def test_referint_final(topology):
@@ -84,7 +165,7 @@ def run_isolated():
 
     topo = topology(True)
     test_referint_init(topo)
-    test_referint_(topo)
+    test_referint_delayed_batch(topo)
     test_referint_final(topo)
 
 
@@ -0,0 +1,213 @@
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+from lib389.utils import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+BATCH_SIZE_ATTR = "nsds5ReplicaUpdateBatchSize"
+BATCH_OID = "2.16.840.1.113730.3.5.14"
+
+class TopologyReplication(object):
+    def __init__(self, master1, master2, m1_m2_agmt, m2_m1_agmt):
+        master1.open()
+        master2.open()
+        self.masters = ((master1, m1_m2_agmt),
+                        (master2, m2_m1_agmt))
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating master 1...
+    master1 = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_MASTER_1
+    args_instance[SER_PORT] = PORT_MASTER_1
+    args_instance[SER_SERVERID_PROP] = SERVERID_MASTER_1
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_master = args_instance.copy()
+    master1.allocate(args_master)
+    instance_master1 = master1.exists()
+    if instance_master1:
+        master1.delete()
+    master1.create()
+    master1.open()
+    master1.replica.enableReplication(suffix=SUFFIX, role=REPLICAROLE_MASTER, replicaId=REPLICAID_MASTER_1)
+
+    # Creating master 2...
+    master2 = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_MASTER_2
+    args_instance[SER_PORT] = PORT_MASTER_2
+    args_instance[SER_SERVERID_PROP] = SERVERID_MASTER_2
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_master = args_instance.copy()
+    master2.allocate(args_master)
+    instance_master2 = master2.exists()
+    if instance_master2:
+        master2.delete()
+    master2.create()
+    master2.open()
+    master2.replica.enableReplication(suffix=SUFFIX, role=REPLICAROLE_MASTER, replicaId=REPLICAID_MASTER_2)
+
+    #
+    # Create all the agreements
+    #
+    # Creating agreement from master 1 to master 2
+    properties = {RA_NAME:      r'meTo_$host:$port',
+                  RA_BINDDN:    defaultProperties[REPLICATION_BIND_DN],
+                  RA_BINDPW:    defaultProperties[REPLICATION_BIND_PW],
+                  RA_METHOD:    defaultProperties[REPLICATION_BIND_METHOD],
+                  RA_TRANSPORT_PROT: defaultProperties[REPLICATION_TRANSPORT]}
+    m1_m2_agmt = master1.agreement.create(suffix=SUFFIX, host=master2.host, port=master2.port, properties=properties)
+    if not m1_m2_agmt:
+        log.fatal("Fail to create a master -> master replica agreement")
+        sys.exit(1)
+    log.debug("%s created" % m1_m2_agmt)
+
+    # Creating agreement from master 2 to master 1
+    properties = {RA_NAME:      r'meTo_$host:$port',
+                  RA_BINDDN:    defaultProperties[REPLICATION_BIND_DN],
+                  RA_BINDPW:    defaultProperties[REPLICATION_BIND_PW],
+                  RA_METHOD:    defaultProperties[REPLICATION_BIND_METHOD],
+                  RA_TRANSPORT_PROT: defaultProperties[REPLICATION_TRANSPORT]}
+    m2_m1_agmt = master2.agreement.create(suffix=SUFFIX, host=master1.host, port=master1.port, properties=properties)
+    if not m2_m1_agmt:
+        log.fatal("Fail to create a master -> master replica agreement")
+        sys.exit(1)
+    log.debug("%s created" % m2_m1_agmt)
+
+    # Allow the replicas to get situated with the new agreements...
+    time.sleep(5)
+
+    #
+    # Initialize all the agreements
+    #
+    master1.agreement.init(SUFFIX, HOST_MASTER_2, PORT_MASTER_2)
+    master1.waitForReplInit(m1_m2_agmt)
+    master2.agreement.init(SUFFIX, HOST_MASTER_1, PORT_MASTER_1)
+    master2.waitForReplInit(m2_m1_agmt)
+
+    # Check replication is working...
+    if master1.testReplication(DEFAULT_SUFFIX, master2):
+        log.info('Replication is working.')
+    else:
+        log.fatal('Replication is not working.')
+        assert False
+
+    log.info("Set Replication Debugging loglevel for the errorlog")
+    master1.setLogLevel(lib389.LOG_REPLICA)
+    master2.setLogLevel(lib389.LOG_REPLICA)
+
+    # Delete each instance in the end
+    def fin():
+        master1.delete()
+        master2.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    master1.clearTmpDir(__file__)
+
+    return TopologyReplication(master1, master2, m1_m2_agmt, m2_m1_agmt)
+
+
+def test_invalid_value(topology):
+    """Tests that a negative batch size is rejected"""
+
+    master1 = topology.masters[0][0]
+    agmt = topology.masters[0][1]
+
+    log.info("Try to set %s: -1" % BATCH_SIZE_ATTR)
+    try:
+        mod = [(ldap.MOD_REPLACE, BATCH_SIZE_ATTR, "-1")]
+        master1.modify_s(agmt, mod)
+        assert False
+    except ldap.LDAPError as e:
+        assert e.message['desc'] == 'Operations error'
+
+
+def test_batch_extop_supported(topology):
+    """Checks the consumer advertises the batched update extended operation"""
+
+    master2 = topology.masters[1][0]
+
+    entry = master2.search_s("", ldap.SCOPE_BASE, "(objectclass=*)",
+                             ['supportedExtension'])
+    assert entry
+    assert BATCH_OID in entry[0].getValues('supportedExtension')
+
+
+def test_batched_updates(topology):
+    """Sends adds, modifies, renames and deletes in batches and checks
+    they are all replayed on the consumer
+    """
+
+    master1 = topology.masters[0][0]
+    master2 = topology.masters[1][0]
+    agmt = topology.masters[0][1]
+
+    log.info("Set %s: 50 on %s" % (BATCH_SIZE_ATTR, master1.serverid))
+    try:
+        master1.modify_s(agmt, [(ldap.MOD_REPLACE, BATCH_SIZE_ATTR, "50")])
+    except ldap.LDAPError as e:
+        log.fatal('Failed to set the batch size: error (%s)' % e.message['desc'])
+        assert False
+
+    log.info("Add, modify and rename 120 entries on %s" % master1.serverid)
+    for i in xrange(120):
+        test_dn = 'cn=batch%d,%s' % (i, DEFAULT_SUFFIX)
+        try:
+            master1.add_s(Entry((test_dn,
+                                 {'objectclass': ['top', 'person'],
+                                  'sn': 'batch',
+                                  'cn': 'batch%d' % i})))
+            master1.modify_s(test_dn, [(ldap.MOD_REPLACE, 'description', 'batched')])
+            master1.rename_s(test_dn, 'cn=renamed%d' % i, delold=1)
+        except ldap.LDAPError as e:
+            log.error('Failed to update entry (%s): error (%s)' % (test_dn,
+                                                                  e.message['desc']))
+            assert False
+
+    if not master1.testReplication(DEFAULT_SUFFIX, master2):
+        log.fatal('Replication is not working with batched updates.')
+        assert False
+
+    entries = master2.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE,
+                               "(&(cn=renamed*)(description=batched))", ['cn'])
+    assert len(entries) == 120
+
+    log.info("Remove the entries")
+    for i in xrange(120):
+        try:
+            master1.delete_s('cn=renamed%d,%s' % (i, DEFAULT_SUFFIX))
+        except ldap.LDAPError as e:
+            log.error('Failed to delete entry: error (%s)' % e.message['desc'])
+            assert False
+
+    if not master1.testReplication(DEFAULT_SUFFIX, master2):
+        log.fatal('Replication is not working with batched updates.')
+        assert False
+
+    entries = master2.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE,
+                               "(cn=renamed*)", ['cn'])
+    assert len(entries) == 0
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
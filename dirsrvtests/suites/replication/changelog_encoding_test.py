@@ -0,0 +1,173 @@
+import os
+import sys
+import glob
+import time
+import base64
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+from lib389.utils import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+CHANGELOG = 'cn=changelog5,cn=config'
+REPLICA_DN = 'cn=replica,cn="%s",cn=mapping tree,cn=config' % DEFAULT_SUFFIX
+OU_DN = 'ou=moved,%s' % DEFAULT_SUFFIX
+USER_DN = 'uid=encoded,%s' % DEFAULT_SUFFIX
+LONG_VALUE = 'long ' * 2000
+UTF8_VALUE = 'caf\xc3\xa9 cr\xc3\xa8me'
+
+
+class TopologyMaster(object):
+    def __init__(self, master1):
+        master1.open()
+        self.master1 = master1
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating master 1...
+    master1 = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_MASTER_1
+    args_instance[SER_PORT] = PORT_MASTER_1
+    args_instance[SER_SERVERID_PROP] = SERVERID_MASTER_1
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_master = args_instance.copy()
+    master1.allocate(args_master)
+    instance_master1 = master1.exists()
+    if instance_master1:
+        master1.delete()
+    master1.create()
+    master1.open()
+    master1.replica.enableReplication(suffix=SUFFIX, role=REPLICAROLE_MASTER, replicaId=REPLICAID_MASTER_1)
+
+    # Delete each instance in the end
+    def fin():
+        master1.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    master1.clearTmpDir(__file__)
+
+    return TopologyMaster(master1)
+
+
+def _read_changelog(master1):
+    """Exports the changelog with the CL2LDIF task, and returns its
+    records as a list of dicts mapping each type to its values
+    """
+
+    entry = master1.search_s(CHANGELOG, ldap.SCOPE_BASE, '(objectclass=*)',
+                             ['nsslapd-changelogdir'])
+    cldir = entry[0].getValue('nsslapd-changelogdir')
+    for name in glob.glob(os.path.join(cldir, '*.ldif')):
+        os.remove(name)
+
+    master1.modify_s(REPLICA_DN, [(ldap.MOD_REPLACE, 'nsds5task', 'CL2LDIF')])
+    names = glob.glob(os.path.join(cldir, '*.ldif'))
+    assert len(names) == 1
+
+    # unfold the lines, then split the records on the blank lines
+    lines = []
+    with open(names[0], 'r') as ldif:
+        for line in ldif:
+            line = line.rstrip('\n')
+            if line.startswith(' ') and lines:
+                lines[-1] += line[1:]
+            else:
+                lines.append(line)
+    records = []
+    record = {}
+    for line in lines + ['']:
+        if not line:
+            if record:
+                records.append(record)
+            record = {}
+            continue
+        if line.startswith('#'):
+            continue
+        if '::' in line:
+            attr, value = line.split('::', 1)
+            value = base64.b64decode(value.strip())
+        else:
+            attr, value = line.split(':', 1)
+            value = value.strip()
+        record.setdefault(attr.lower(), []).append(value)
+    return records
+
+
+def test_changelog_encoding(topology):
+    """Writes each kind of change, restarts the server so that they are
+    read back from the database, and checks the exported changelog
+    holds the original operations
+    """
+
+    master1 = topology.master1
+
+    log.info('Add, modify, rename and delete %s' % USER_DN)
+    try:
+        master1.add_s(Entry((OU_DN, {'objectclass': ['top', 'organizationalunit'],
+                                     'ou': 'moved'})))
+        master1.add_s(Entry((USER_DN, {'objectclass': ['top', 'person', 'extensibleobject'],
+                                       'uid': 'encoded',
+                                       'sn': 'encoded',
+                                       'cn': 'encoded',
+                                       'description': LONG_VALUE,
+                                       'street': UTF8_VALUE,
+                                       'telephonenumber': ['1234', '5678']})))
+        master1.modify_s(USER_DN, [(ldap.MOD_REPLACE, 'description', 'short'),
+                                   (ldap.MOD_ADD, 'mail', 'encoded@example.com'),
+                                   (ldap.MOD_DELETE, 'telephonenumber', '1234')])
+        master1.rename_s(USER_DN, 'uid=renamed', newsuperior=OU_DN, delold=1)
+        master1.delete_s('uid=renamed,%s' % OU_DN)
+    except ldap.LDAPError as e:
+        log.fatal('Failed to update %s: error (%s)' % (USER_DN, e.message['desc']))
+        assert False
+
+    master1.restart(timeout=10)
+
+    records = _read_changelog(master1)
+    changes = [r for r in records
+               if r.get('changetype') and
+               ('encoded' in r.get('dn', [''])[0] or 'renamed' in r.get('dn', [''])[0])]
+    assert [r['changetype'][0] for r in changes] == ['add', 'modify', 'modrdn', 'delete']
+    add, modify, modrdn, delete = changes
+
+    # every record carries its csn and the unique id of its target
+    for r in changes:
+        assert len(r['csn'][0]) == 20
+        assert r['nsuniqueid'][0] == add['nsuniqueid'][0]
+
+    assert LONG_VALUE in add['change'][0]
+    assert UTF8_VALUE in add['change'][0]
+    assert '5678' in add['change'][0]
+
+    assert 'replace: description' in modify['change'][0]
+    assert 'add: mail' in modify['change'][0]
+    assert 'encoded@example.com' in modify['change'][0]
+    assert 'delete: telephonenumber' in modify['change'][0]
+
+    assert modrdn['newrdn'][0].lower() == 'uid=renamed'
+    assert modrdn['deleteoldrdn'][0] == 'true'
+    assert modrdn['newsuperiordn'][0].lower() == OU_DN.lower()
+
+    assert delete['dn'][0].lower() == ('uid=renamed,%s' % OU_DN).lower()
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
@@ -0,0 +1,125 @@
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+from lib389.utils import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+CHANGELOG = 'cn=changelog5,cn=config'
+TRIM_RATE_ATTR = 'nsslapd-changelogtrim-rate'
+TRIM_INTERVAL_ATTR = 'nsslapd-changelogtrim-interval'
+MAXENTRIES_ATTR = 'nsslapd-changelogmaxentries'
+STATS_ATTRS = ['nsds5ChangelogTrimmedChanges', 'nsds5ChangelogTrimRate',
+               'nsds5ChangelogTrimLag', 'nsds5ChangelogReclaimedBytes']
+
+
+class TopologyMaster(object):
+    def __init__(self, master1):
+        master1.open()
+        self.master1 = master1
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating master 1...
+    master1 = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_MASTER_1
+    args_instance[SER_PORT] = PORT_MASTER_1
+    args_instance[SER_SERVERID_PROP] = SERVERID_MASTER_1
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_master = args_instance.copy()
+    master1.allocate(args_master)
+    instance_master1 = master1.exists()
+    if instance_master1:
+        master1.delete()
+    master1.create()
+    master1.open()
+    master1.replica.enableReplication(suffix=SUFFIX, role=REPLICAROLE_MASTER, replicaId=REPLICAID_MASTER_1)
+
+    # Delete each instance in the end
+    def fin():
+        master1.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    master1.clearTmpDir(__file__)
+
+    return TopologyMaster(master1)
+
+
+def test_invalid_value(topology):
+    """Tests that a negative trimming rate is rejected"""
+
+    master1 = topology.master1
+
+    log.info("Try to set %s: -5" % TRIM_RATE_ATTR)
+    try:
+        master1.modify_s(CHANGELOG, [(ldap.MOD_REPLACE, TRIM_RATE_ATTR, "-5")])
+        assert False
+    except ldap.UNWILLING_TO_PERFORM:
+        pass
+
+
+def test_rate_limited_trimming(topology):
+    """Trims the changelog at 20 changes per second, and checks the
+    trimming statistics of the changelog entry
+    """
+
+    master1 = topology.master1
+
+    log.info("Set %s: 20, %s: 10" % (TRIM_RATE_ATTR, MAXENTRIES_ATTR))
+    try:
+        master1.modify_s(CHANGELOG, [(ldap.MOD_REPLACE, TRIM_RATE_ATTR, "20"),
+                                     (ldap.MOD_REPLACE, MAXENTRIES_ATTR, "10"),
+                                     (ldap.MOD_REPLACE, TRIM_INTERVAL_ATTR, "2")])
+    except ldap.LDAPError as e:
+        log.fatal('Failed to configure the changelog: error (%s)' % e.message['desc'])
+        assert False
+
+    log.info("Add 200 entries on %s" % master1.serverid)
+    for i in xrange(200):
+        try:
+            master1.add_s(Entry(('cn=trim%d,%s' % (i, DEFAULT_SUFFIX),
+                                 {'objectclass': ['top', 'person'],
+                                  'sn': 'trim',
+                                  'cn': 'trim%d' % i})))
+        except ldap.LDAPError as e:
+            log.error('Failed to add entry: error (%s)' % e.message['desc'])
+            assert False
+
+    # at 20 changes per second the backlog takes about 10 seconds
+    trimmed = 0
+    for i in xrange(30):
+        time.sleep(1)
+        entry = master1.search_s(CHANGELOG, ldap.SCOPE_BASE, "(objectclass=*)", STATS_ATTRS)
+        assert entry
+        for attr in STATS_ATTRS:
+            assert entry[0].hasAttr(attr)
+        trimmed = int(entry[0].getValue('nsds5ChangelogTrimmedChanges'))
+        rate = int(entry[0].getValue('nsds5ChangelogTrimRate'))
+        assert rate <= 20
+        if trimmed >= 180:
+            break
+    assert trimmed >= 180
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
@@ -0,0 +1,203 @@
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+from lib389.utils import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+STREAMS_ATTR = "nsds5ReplicaTotalUpdateStreams"
+STREAM_OID = "2.16.840.1.113730.3.5.16"
+
+class TopologyReplication(object):
+    def __init__(self, master1, master2, m1_m2_agmt, m2_m1_agmt):
+        master1.open()
+        master2.open()
+        self.masters = ((master1, m1_m2_agmt),
+                        (master2, m2_m1_agmt))
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating master 1...
+    master1 = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_MASTER_1
+    args_instance[SER_PORT] = PORT_MASTER_1
+    args_instance[SER_SERVERID_PROP] = SERVERID_MASTER_1
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_master = args_instance.copy()
+    master1.allocate(args_master)
+    instance_master1 = master1.exists()
+    if instance_master1:
+        master1.delete()
+    master1.create()
+    master1.open()
+    master1.replica.enableReplication(suffix=SUFFIX, role=REPLICAROLE_MASTER, replicaId=REPLICAID_MASTER_1)
+
+    # Creating master 2...
+    master2 = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_MASTER_2
+    args_instance[SER_PORT] = PORT_MASTER_2
+    args_instance[SER_SERVERID_PROP] = SERVERID_MASTER_2
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_master = args_instance.copy()
+    master2.allocate(args_master)
+    instance_master2 = master2.exists()
+    if instance_master2:
+        master2.delete()
+    master2.create()
+    master2.open()
+    master2.replica.enableReplication(suffix=SUFFIX, role=REPLICAROLE_MASTER, replicaId=REPLICAID_MASTER_2)
+
+    #
+    # Create all the agreements
+    #
+    # Creating agreement from master 1 to master 2
+    properties = {RA_NAME:      r'meTo_$host:$port',
+                  RA_BINDDN:    defaultProperties[REPLICATION_BIND_DN],
+                  RA_BINDPW:    defaultProperties[REPLICATION_BIND_PW],
+                  RA_METHOD:    defaultProperties[REPLICATION_BIND_METHOD],
+                  RA_TRANSPORT_PROT: defaultProperties[REPLICATION_TRANSPORT]}
+    m1_m2_agmt = master1.agreement.create(suffix=SUFFIX, host=master2.host, port=master2.port, properties=properties)
+    if not m1_m2_agmt:
+        log.fatal("Fail to create a master -> master replica agreement")
+        sys.exit(1)
+    log.debug("%s created" % m1_m2_agmt)
+
+    # Creating agreement from master 2 to master 1
+    properties = {RA_NAME:      r'meTo_$host:$port',
+                  RA_BINDDN:    defaultProperties[REPLICATION_BIND_DN],
+                  RA_BINDPW:    defaultProperties[REPLICATION_BIND_PW],
+                  RA_METHOD:    defaultProperties[REPLICATION_BIND_METHOD],
+                  RA_TRANSPORT_PROT: defaultProperties[REPLICATION_TRANSPORT]}
+    m2_m1_agmt = master2.agreement.create(suffix=SUFFIX, host=master1.host, port=master1.port, properties=properties)
+    if not m2_m1_agmt:
+        log.fatal("Fail to create a master -> master replica agreement")
+        sys.exit(1)
+    log.debug("%s created" % m2_m1_agmt)
+
+    # Allow the replicas to get situated with the new agreements...
+    time.sleep(5)
+
+    #
+    # Initialize all the agreements
+    #
+    master1.agreement.init(SUFFIX, HOST_MASTER_2, PORT_MASTER_2)
+    master1.waitForReplInit(m1_m2_agmt)
+    master2.agreement.init(SUFFIX, HOST_MASTER_1, PORT_MASTER_1)
+    master2.waitForReplInit(m2_m1_agmt)
+
+    # Check replication is working...
+    if master1.testReplication(DEFAULT_SUFFIX, master2):
+        log.info('Replication is working.')
+    else:
+        log.fatal('Replication is not working.')
+        assert False
+
+    log.info("Set Replication Debugging loglevel for the errorlog")
+    master1.setLogLevel(lib389.LOG_REPLICA)
+    master2.setLogLevel(lib389.LOG_REPLICA)
+
+    # Delete each instance in the end
+    def fin():
+        master1.delete()
+        master2.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    master1.clearTmpDir(__file__)
+
+    return TopologyReplication(master1, master2, m1_m2_agmt, m2_m1_agmt)
+
+
+def test_invalid_value(topology):
+    """Tests that a number of streams lower than 1 is rejected"""
+
+    master1 = topology.masters[0][0]
+    agmt = topology.masters[0][1]
+
+    log.info("Try to set %s: 0" % STREAMS_ATTR)
+    try:
+        mod = [(ldap.MOD_REPLACE, STREAMS_ATTR, "0")]
+        master1.modify_s(agmt, mod)
+        assert False
+    except ldap.LDAPError as e:
+        assert e.message['desc'] == 'Operations error'
+
+
+def test_stream_extop_supported(topology):
+    """Checks the consumer advertises the parallel total update extended operation"""
+
+    master2 = topology.masters[1][0]
+
+    entry = master2.search_s("", ldap.SCOPE_BASE, "(objectclass=*)",
+                             ['supportedExtension'])
+    assert entry
+    assert STREAM_OID in entry[0].getValues('supportedExtension')
+
+
+def test_parallel_total_update(topology):
+    """Initializes the consumer over 4 connections with nested entries,
+    and checks that every entry, and its parent, made it to the consumer
+    """
+
+    master1 = topology.masters[0][0]
+    master2 = topology.masters[1][0]
+    agmt = topology.masters[0][1]
+
+    log.info("Add 20 branches of 25 entries on %s" % master1.serverid)
+    for i in xrange(20):
+        ou_dn = 'ou=branch%d,%s' % (i, DEFAULT_SUFFIX)
+        try:
+            master1.add_s(Entry((ou_dn,
+                                 {'objectclass': ['top', 'organizationalUnit'],
+                                  'ou': 'branch%d' % i})))
+            for j in xrange(25):
+                master1.add_s(Entry(('cn=leaf%d,%s' % (j, ou_dn),
+                                     {'objectclass': ['top', 'person'],
+                                      'sn': 'leaf',
+                                      'cn': 'leaf%d' % j})))
+        except ldap.LDAPError as e:
+            log.error('Failed to add entries under %s: error (%s)' % (ou_dn,
+                                                                     e.message['desc']))
+            assert False
+
+    log.info("Set %s: 4 on %s" % (STREAMS_ATTR, master1.serverid))
+    try:
+        master1.modify_s(agmt, [(ldap.MOD_REPLACE, STREAMS_ATTR, "4")])
+    except ldap.LDAPError as e:
+        log.fatal('Failed to set the number of streams: error (%s)' % e.message['desc'])
+        assert False
+
+    log.info("Initialize %s" % master2.serverid)
+    master1.agreement.init(SUFFIX, HOST_MASTER_2, PORT_MASTER_2)
+    master1.waitForReplInit(agmt)
+
+    entries = master2.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE,
+                               "(|(ou=branch*)(cn=leaf*))", ['cn'])
+    assert len(entries) == 20 * 25 + 20
+
+    if not master1.testReplication(DEFAULT_SUFFIX, master2):
+        log.fatal('Replication is not working after a parallel total update.')
+        assert False
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
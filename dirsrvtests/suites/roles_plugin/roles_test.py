@@ -24,6 +24,9 @@ log = logging.getLogger(__name__)
 
 installation1_prefix = None
 
+MANAGED_ROLE_DN = 'cn=managed_role,' + DEFAULT_SUFFIX
+FILTERED_ROLE_DN = 'cn=filtered_role,' + DEFAULT_SUFFIX
+
 
 class TopologyStandalone(object):
     def __init__(self, standalone):
@@ -73,6 +76,89 @@ def test_roles_(topology):
     return
 
 
+def _add_user(topology, uid, **attrs):
+    user_attrs = {'objectclass': 'top extensibleObject'.split(),
+                  'uid': uid}
+    user_attrs.update(attrs)
+    topology.standalone.add_s(Entry(('uid=%s,%s' % (uid, DEFAULT_SUFFIX), user_attrs)))
+
+
+def _role_members(topology, role_dn):
+    entries = topology.standalone.search_s(DEFAULT_SUFFIX, ldap.SCOPE_SUBTREE,
+                                           '(nsrole=%s)' % role_dn, ['uid'])
+    return sorted([entry.getValue('uid') for entry in entries])
+
+
+def _wait_for_role_members(topology, role_dn, expected):
+    # the member lists are populated by the roles thread
+    for i in range(30):
+        members = _role_members(topology, role_dn)
+        if members == sorted(expected):
+            return
+        time.sleep(1)
+    log.fatal('Members of %s: %s, expected %s' % (role_dn, members, expected))
+    assert False
+
+
+def test_roles_members(topology):
+    """
+    Searches on nsRole follow the adds, modifies, renames and deletes
+    of the members of managed and filtered roles.
+    """
+
+    topology.standalone.add_s(Entry((MANAGED_ROLE_DN,
+                                     {'objectclass': 'top LDAPsubentry nsRoleDefinition nsSimpleRoleDefinition nsManagedRoleDefinition'.split(),
+                                      'cn': 'managed_role'})))
+    topology.standalone.add_s(Entry((FILTERED_ROLE_DN,
+                                     {'objectclass': 'top LDAPsubentry nsRoleDefinition nsComplexRoleDefinition nsFilteredRoleDefinition'.split(),
+                                      'cn': 'filtered_role',
+                                      'nsRoleFilter': '(employeeType=staff)'})))
+
+    _add_user(topology, 'role_user1', nsRoleDN=MANAGED_ROLE_DN)
+    _add_user(topology, 'role_user2', employeeType='staff')
+    _add_user(topology, 'role_user3')
+    _wait_for_role_members(topology, MANAGED_ROLE_DN, ['role_user1'])
+    _wait_for_role_members(topology, FILTERED_ROLE_DN, ['role_user2'])
+
+    # modified members
+    topology.standalone.modify_s('uid=role_user3,' + DEFAULT_SUFFIX,
+                                 [(ldap.MOD_ADD, 'nsRoleDN', MANAGED_ROLE_DN),
+                                  (ldap.MOD_ADD, 'employeeType', 'staff')])
+    topology.standalone.modify_s('uid=role_user2,' + DEFAULT_SUFFIX,
+                                 [(ldap.MOD_REPLACE, 'employeeType', 'contractor')])
+    assert _role_members(topology, MANAGED_ROLE_DN) == ['role_user1', 'role_user3']
+    assert _role_members(topology, FILTERED_ROLE_DN) == ['role_user3']
+
+    # renamed member
+    topology.standalone.rename_s('uid=role_user1,' + DEFAULT_SUFFIX, 'uid=role_user4', delold=1)
+    assert _role_members(topology, MANAGED_ROLE_DN) == ['role_user3', 'role_user4']
+
+    # deleted member
+    topology.standalone.delete_s('uid=role_user3,' + DEFAULT_SUFFIX)
+    assert _role_members(topology, MANAGED_ROLE_DN) == ['role_user4']
+    assert _role_members(topology, FILTERED_ROLE_DN) == []
+
+    # modified role
+    topology.standalone.modify_s(FILTERED_ROLE_DN,
+                                 [(ldap.MOD_REPLACE, 'nsRoleFilter', '(employeeType=contractor)')])
+    _wait_for_role_members(topology, FILTERED_ROLE_DN, ['role_user2'])
+
+    # failed modify: the member bitmaps are left as they were
+    try:
+        topology.standalone.modify_s('uid=role_user2,' + DEFAULT_SUFFIX,
+                                     [(ldap.MOD_REPLACE, 'employeeType', 'staff'),
+                                      (ldap.MOD_DELETE, 'description', 'no such value')])
+        assert False
+    except ldap.NO_SUCH_ATTRIBUTE:
+        pass
+    assert _role_members(topology, FILTERED_ROLE_DN) == ['role_user2']
+
+    # the value of nsRole agrees
+    entry = topology.standalone.getEntry('uid=role_user4,' + DEFAULT_SUFFIX, ldap.SCOPE_BASE,
+                                         '(objectclass=*)', ['nsrole'])
+    assert MANAGED_ROLE_DN.lower() in [v.lower() for v in entry.getValues('nsrole')]
+
+
 def test_roles_final(topology):
     topology.standalone.delete()
     log.info('roles test suite PASSED')
@@ -85,6 +171,7 @@ def run_isolated():
     topo = topology(True)
     test_roles_init(topo)
     test_roles_(topo)
+    test_roles_members(topo)
     test_roles_final(topo)
 
 
@@ -0,0 +1,158 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+SCHEMA_DN = 'cn=schema'
+OU_DN = 'ou=plans,%s' % DEFAULT_SUFFIX
+TEST_ATTR = 'planAttr'
+TEST_OC = 'planObject'
+TEST_ATTR_DEF = ("( 1.3.6.1.4.1.40001.1 NAME '%s' SYNTAX 1.3.6.1.4.1.1466.115.121.1.15 "
+                 "X-ORIGIN 'test' )" % TEST_ATTR)
+TEST_OC_MAY = ("( 1.3.6.1.4.1.40001.2 NAME '%s' SUP top AUXILIARY MAY %s "
+               "X-ORIGIN 'test' )" % (TEST_OC, TEST_ATTR))
+TEST_OC_MUST = ("( 1.3.6.1.4.1.40001.2 NAME '%s' SUP top AUXILIARY MUST %s "
+                "X-ORIGIN 'test' )" % (TEST_OC, TEST_ATTR))
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+def _add(topology, name, objectclasses, attrs):
+    """Adds an entry, and returns the result code of the operation"""
+
+    entry = {'objectclass': objectclasses, 'cn': name}
+    entry.update(attrs)
+    try:
+        topology.standalone.add_s(Entry(('cn=%s,%s' % (name, OU_DN), entry)))
+    except ldap.OBJECT_CLASS_VIOLATION:
+        return ldap.OBJECT_CLASS_VIOLATION
+    return 0
+
+
+def test_schema_check_plan(topology):
+    """Adds entries with the same objectclass set, listed in other orders
+    and with duplicates, so that the cached plan is used, and checks its
+    required and allowed types
+    """
+
+    topology.standalone.add_s(Entry((OU_DN, {'objectclass': ['top', 'organizationalunit'],
+                                             'ou': 'plans'})))
+
+    for i in range(3):
+        assert _add(topology, 'ok%d' % i, ['top', 'person', 'organizationalperson'],
+                    {'sn': 'ok', 'telephonenumber': '1234', 'ou': 'plans'}) == 0
+        assert _add(topology, 'order%d' % i, ['organizationalPerson', 'PERSON', 'top', 'person'],
+                    {'sn': 'order', 'l': 'there'}) == 0
+        assert _add(topology, 'options%d' % i, ['top', 'person'],
+                    {'sn;lang-fr': 'options', 'SN': 'options'}) == 0
+
+        # sn is required by person
+        assert _add(topology, 'nosn%d' % i, ['top', 'person'], {}) == ldap.OBJECT_CLASS_VIOLATION
+        # l is only allowed by organizationalperson
+        assert _add(topology, 'nol%d' % i, ['top', 'person'],
+                    {'sn': 'nol', 'l': 'there'}) == ldap.OBJECT_CLASS_VIOLATION
+        # extensibleobject allows anything
+        assert _add(topology, 'ext%d' % i, ['top', 'person', 'extensibleobject'],
+                    {'sn': 'ext', 'l': 'there', 'mail': 'ext@example.com'}) == 0
+
+    # modifications are checked against the plan of the resulting entry
+    dn = 'cn=ok0,%s' % OU_DN
+    try:
+        topology.standalone.modify_s(dn, [(ldap.MOD_DELETE, 'sn', None)])
+        assert False
+    except ldap.OBJECT_CLASS_VIOLATION:
+        pass
+    try:
+        topology.standalone.modify_s(dn, [(ldap.MOD_ADD, 'mail', 'ok0@example.com')])
+        assert False
+    except ldap.OBJECT_CLASS_VIOLATION:
+        pass
+
+
+def test_schema_check_plan_flush(topology):
+    """Changes an objectclass and checks the entries using it are checked
+    against its new definition, not against the cached plan
+    """
+
+    topology.standalone.modify_s(SCHEMA_DN, [(ldap.MOD_ADD, 'attributetypes', TEST_ATTR_DEF)])
+    topology.standalone.modify_s(SCHEMA_DN, [(ldap.MOD_ADD, 'objectclasses', TEST_OC_MAY)])
+
+    assert _add(topology, 'may0', ['top', 'person', TEST_OC], {'sn': 'may'}) == 0
+    assert _add(topology, 'may1', ['top', 'person', TEST_OC],
+                {'sn': 'may', TEST_ATTR: 'value'}) == 0
+
+    log.info('Make %s required by %s' % (TEST_ATTR, TEST_OC))
+    topology.standalone.modify_s(SCHEMA_DN, [(ldap.MOD_DELETE, 'objectclasses', TEST_OC_MAY)])
+    topology.standalone.modify_s(SCHEMA_DN, [(ldap.MOD_ADD, 'objectclasses', TEST_OC_MUST)])
+
+    assert _add(topology, 'must0', ['top', 'person', TEST_OC],
+                {'sn': 'must'}) == ldap.OBJECT_CLASS_VIOLATION
+    assert _add(topology, 'must1', ['top', 'person', TEST_OC],
+                {'sn': 'must', TEST_ATTR: 'value'}) == 0
+
+    log.info('Remove %s' % TEST_OC)
+    topology.standalone.modify_s(SCHEMA_DN, [(ldap.MOD_DELETE, 'objectclasses', TEST_OC_MUST)])
+    assert _add(topology, 'gone0', ['top', 'person'], {'sn': 'gone', TEST_ATTR: 'value'}) == \
+        ldap.OBJECT_CLASS_VIOLATION
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
@@ -0,0 +1,166 @@
+# --- BEGIN COPYRIGHT BLOCK ---
+# Copyright (C) 2015 Red Hat, Inc.
+# All rights reserved.
+#
+# License: GPL (version 3 or any later version).
+# See LICENSE for details.
+# --- END COPYRIGHT BLOCK ---
+#
+import os
+import sys
+import time
+import ldap
+import logging
+import pytest
+import threading
+from lib389 import DirSrv, Entry, tools, tasks
+from lib389.tools import DirSrvTools
+from lib389._constants import *
+from lib389.properties import *
+from lib389.tasks import *
+
+logging.getLogger(__name__).setLevel(logging.DEBUG)
+log = logging.getLogger(__name__)
+
+installation1_prefix = None
+
+SCHEMA_DN = 'cn=schema'
+OU_DN = 'ou=snapshot,%s' % DEFAULT_SUFFIX
+NUM_SCHEMA_CHANGES = 20
+NUM_READERS = 4
+
+
+class TopologyStandalone(object):
+    def __init__(self, standalone):
+        standalone.open()
+        self.standalone = standalone
+
+
+@pytest.fixture(scope="module")
+def topology(request):
+    global installation1_prefix
+    if installation1_prefix:
+        args_instance[SER_DEPLOYED_DIR] = installation1_prefix
+
+    # Creating standalone instance ...
+    standalone = DirSrv(verbose=False)
+    args_instance[SER_HOST] = HOST_STANDALONE
+    args_instance[SER_PORT] = PORT_STANDALONE
+    args_instance[SER_SERVERID_PROP] = SERVERID_STANDALONE
+    args_instance[SER_CREATION_SUFFIX] = DEFAULT_SUFFIX
+    args_standalone = args_instance.copy()
+    standalone.allocate(args_standalone)
+    instance_standalone = standalone.exists()
+    if instance_standalone:
+        standalone.delete()
+    standalone.create()
+    standalone.open()
+
+    # Delete each instance in the end
+    def fin():
+        standalone.delete()
+    request.addfinalizer(fin)
+
+    # Clear out the tmp dir
+    standalone.clearTmpDir(__file__)
+
+    return TopologyStandalone(standalone)
+
+
+class SchemaReader(threading.Thread):
+    """Keeps adding, searching and deleting entries, which looks their
+    attribute types and objectclasses up, until told to stop
+    """
+
+    def __init__(self, inst, idx):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.inst = inst
+        self.idx = idx
+        self.stop = False
+        self.errors = []
+        self.rounds = 0
+
+    def run(self):
+        conn = ldap.initialize('ldap://%s:%s' % (self.inst.host, self.inst.port))
+        conn.simple_bind_s(DN_DM, PASSWORD)
+        dn = 'cn=reader%d,%s' % (self.idx, OU_DN)
+        while not self.stop:
+            try:
+                conn.add_s(Entry((dn, {'objectclass': ['top', 'person'],
+                                       'cn': 'reader%d' % self.idx,
+                                       'sn': 'reader'})))
+                entries = conn.search_s(OU_DN, ldap.SCOPE_ONELEVEL,
+                                        '(&(objectclass=person)(sn=reader))',
+                                        ['cn', 'sn'])
+                if dn.lower() not in [e[0].lower() for e in entries]:
+                    self.errors.append('%s not found' % dn)
+                conn.delete_s(dn)
+            except ldap.LDAPError as e:
+                self.errors.append(str(e))
+            self.rounds += 1
+        conn.unbind_s()
+
+
+def test_schema_snapshot(topology):
+    """Changes the schema while other connections keep looking attribute
+    types and objectclasses up, and checks that the lookups never fail
+    and that the new definitions are seen once added
+    """
+
+    topology.standalone.add_s(Entry((OU_DN, {'objectclass': ['top', 'organizationalunit'],
+                                             'ou': 'snapshot'})))
+
+    readers = [SchemaReader(topology.standalone, i) for i in range(NUM_READERS)]
+    for reader in readers:
+        reader.start()
+
+    for i in range(NUM_SCHEMA_CHANGES):
+        attr = 'snapshotAttr%d' % i
+        oc = 'snapshotObject%d' % i
+        log.info('Add the attribute type %s and the objectclass %s' % (attr, oc))
+        topology.standalone.modify_s(SCHEMA_DN, [(ldap.MOD_ADD, 'attributetypes',
+            "( 1.3.6.1.4.1.40000.%d.1 NAME '%s' SYNTAX 1.3.6.1.4.1.1466.115.121.1.15 "
+            "X-ORIGIN 'test' )" % (i, attr))])
+        topology.standalone.modify_s(SCHEMA_DN, [(ldap.MOD_ADD, 'objectclasses',
+            "( 1.3.6.1.4.1.40000.%d.2 NAME '%s' SUP top AUXILIARY MAY %s "
+            "X-ORIGIN 'test' )" % (i, oc, attr))])
+
+        # the definitions are visible right away, by name and by oid
+        dn = 'cn=%s,%s' % (oc, OU_DN)
+        topology.standalone.add_s(Entry((dn, {'objectclass': ['top', 'person', oc],
+                                              'cn': oc,
+                                              'sn': oc,
+                                              attr: 'value%d' % i})))
+        entries = topology.standalone.search_s(OU_DN, ldap.SCOPE_ONELEVEL,
+                                               '(1.3.6.1.4.1.40000.%d.1=value%d)' % (i, i),
+                                               [attr])
+        assert len(entries) == 1
+        assert entries[0].getValue(attr) == 'value%d' % i
+
+        # and so is their removal
+        topology.standalone.delete_s(dn)
+        topology.standalone.modify_s(SCHEMA_DN, [(ldap.MOD_DELETE, 'objectclasses',
+            "( 1.3.6.1.4.1.40000.%d.2 NAME '%s' SUP top AUXILIARY MAY %s "
+            "X-ORIGIN 'test' )" % (i, oc, attr))])
+        try:
+            topology.standalone.add_s(Entry((dn, {'objectclass': ['top', 'person', oc],
+                                                  'cn': oc,
+                                                  'sn': oc})))
+            assert False
+        except ldap.OBJECT_CLASS_VIOLATION:
+            pass
+
+    for reader in readers:
+        reader.stop = True
+    for reader in readers:
+        reader.join()
+        assert reader.rounds > 0
+        assert reader.errors == []
+
+
+if __name__ == '__main__':
+    # Run isolated
+    # -s for DEBUG mode
+    CURRENT_FILE = os.path.realpath(__file__)
+    pytest.main("-s %s" % CURRENT_FILE)
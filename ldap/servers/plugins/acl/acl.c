@@ -47,6 +47,11 @@ static	int acl__TestRights(Acl_PBlock *aclpb,int access, const char **right,
 						const char ** map_generic, aclResultReason_t *result_reason);
 static int 	acl__scan_for_acis(struct acl_pblock *aclpb, int *err);
 static void	acl__reset_cached_result (struct acl_pblock *aclpb );
+static int	acl__get_tfilter_result (Acl_PBlock *aclpb, aci_t *aci);
+static void	acl__set_tfilter_result (Acl_PBlock *aclpb, aci_t *aci, int matched);
+static int	acl__attrs_batch_result (Acl_PBlock *aclpb, Slapi_Entry *e, const char *attr,
+				int access);
+static void	acl__attrs_batch_reset (aclAttrsBatch *batch);
 static int 	acl__scan_match_handles ( struct acl_pblock *aclpb, int type);
 static int 	acl__attr_cached_result (struct acl_pblock *aclpb, char *attr, int access );
 static int 	acl__match_handlesFromCache (struct acl_pblock *aclpb, char *attr, int access);
@@ -227,6 +232,7 @@ acl_access_allowed(
 	Slapi_DN			*e_sdn;
 	Slapi_Operation		*op = NULL;
 	aclResultReason_t	decision_reason;
+	aclDecisionTicket	decision_ticket;
 	int					loglevel;
 	PRUint64 o_connid = 0xffffffffffffffff; /* no op */
 	int o_opid = -1; /* no op */
@@ -242,6 +248,7 @@ acl_access_allowed(
 
 	decision_reason.deciding_aci = NULL;
 	decision_reason.reason = ACL_REASON_NONE;
+	decision_ticket.adt_usable = 0;
 
 	/**
 	 * First, if the acl private write/delete on attribute right
@@ -444,6 +451,7 @@ acl_access_allowed(
 			"#### conn=%" NSPRIu64 " op=%d binddn=\"%s\"\n",
 			o_connid, o_opid, clientDn);
 		aclpb->aclpb_stat_total_entries++;
+		aclpb->aclpb_attrs_unbatchable = 0;
 
 		if (!(access & SLAPI_ACL_PROXY) &&
 							!( aclpb->aclpb_state & ACLPB_DONOT_EVALUATE_PROXY )) {
@@ -474,6 +482,7 @@ acl_access_allowed(
 
 		/* reset the cached result based on the scope */
 		acl__reset_cached_result (aclpb );
+		aclpb->aclpb_num_tfilter_cache = 0;
 
 		/* Find all the candidate aci's that apply by scanning up the DIT tree from edn. */
 		
@@ -550,7 +559,7 @@ acl_access_allowed(
 		}
 		goto cleanup_and_ret;
 	}
-	
+
 	/*
 	** Now we have all the information about the resource. Now we need to 
 	** figure out if there are any ACLs which can be applied.
@@ -570,6 +579,20 @@ acl_access_allowed(
 		goto cleanup_and_ret;
 	}
 
+	/*
+	** Check if the same decision has already been taken for this
+	** bind identity and the same acis by a previous evaluation.
+	*/
+	if ((ret_val = acldecision_lookup(aclpb, attr, access,
+									&decision_ticket)) != -1) {
+		if (ret_val == LDAP_SUCCESS) {
+			decision_reason.reason = ACL_REASON_DECISION_CACHED_ALLOW;
+		} else {
+			decision_reason.reason = ACL_REASON_DECISION_CACHED_DENY;
+		}
+		goto cleanup_and_ret;
+	}
+
 	slapi_log_error( SLAPI_LOG_ACL, plugin_name,
 		   "Processed attr:%s for entry:%s\n", attr ? attr : "NULL",
 		    n_edn);
@@ -597,6 +620,7 @@ acl_access_allowed(
 	} else {
 		ret_val = LDAP_INSUFFICIENT_ACCESS;
 	} 
+	acldecision_store(aclpb, attr, access, &decision_ticket, ret_val);
 
 cleanup_and_ret:
 
@@ -670,6 +694,8 @@ print_access_control_summary( char *source, int ret_val, char *clientDn,
 		{ACL_REASON_EVALCONTEXT_CACHED_ALLOW,	"cached context/parent allow"},
 		{ACL_REASON_EVALCONTEXT_CACHED_NOT_ALLOWED,	"cached context/parent deny"},
 		{ACL_REASON_EVALCONTEXT_CACHED_ATTR_STAR_ALLOW,	"cached context/parent allow any attr"},
+		{ACL_REASON_DECISION_CACHED_ALLOW,		"cached decision allow"},
+		{ACL_REASON_DECISION_CACHED_DENY,		"cached decision deny"},
 		{ACL_REASON_NONE,						"error occurred"},
 	};
 
@@ -1232,6 +1258,13 @@ acl_read_access_allowed_on_attr (
 
 		return LDAP_OPERATIONS_ERROR;
 	}
+
+	/* Was it already evaluated with the rest of the entry's attributes ? */
+	if ((ret_val = acl__attrs_batch_result(aclpb, e, attr, access)) != -1) {
+		TNF_PROBE_1_DEBUG(acl_read_access_allowed_on_attr_end ,"ACL","",
+		                  tnf_string,attrs_batch,"");
+		return ret_val;
+	}
 	
 	/*
 	 * Am I anonymous? then we can use our anonympous profile
@@ -1352,6 +1385,185 @@ acl_access_allowed_on_attr_Exit:
 
 	return(ret_val);
 }
+/***************************************************************************
+*
+* acl_read_access_allowed_on_attrs
+*	check read access on a set of attributes of the given entry.
+*
+* Used during search to evaluate, in one pass, the attributes that are
+* about to be returned for an entry.  The outcome is kept as a bitmap in
+* the aclpb and the following acl_read_access_allowed_on_attr() calls for
+* the entry are answered from it.  Calling it again for the same entry
+* only evaluates the attributes that are not known yet.
+*
+* Nothing is batched for a persistent search, whose entries do not live
+* as long as the aclpb, or when an aci of the entry depends on the values
+* (targattrfilters, userattr or parameterized bind rules).
+*
+* Input:
+*	attrs	- NULL terminated list of attribute types
+*
+* Returns:
+* 	LDAP_SUCCESS			- the attributes were evaluated
+*	<err>				- same return value as acl_read_access_allowed_on_attr()
+*
+* Error Handling:
+*	The partial result is dropped.
+*
+**************************************************************************/
+int
+acl_read_access_allowed_on_attrs (
+	Slapi_PBlock		*pb,
+	Slapi_Entry			*e,		/* The Slapi_Entry */
+	char				**attrs,	/* Attributes of the entry */
+	int					access		/* access rights */
+	)
+{
+	struct	acl_pblock	*aclpb;
+	Slapi_Operation		*op = NULL;
+	aclAttrsBatch		*batch;
+	char				*n_edn;
+	char				*batch_ndn;
+	int					num_known;
+	int					i, j;
+	int					rc;
+
+	if ( attrs == NULL || acl_skip_access_check ( pb, e ) ) {
+		return LDAP_SUCCESS;
+	}
+
+	aclpb = acl_get_aclpb ( pb, ACLPB_BINDDN_PBLOCK );
+	if ( !aclpb ) {
+		slapi_log_error ( SLAPI_LOG_FATAL, plugin_name,  "Missing aclpb 5 \n" );
+		return LDAP_OPERATIONS_ERROR;
+	}
+
+	batch = &aclpb->aclpb_attrs_batch;
+	n_edn = slapi_entry_get_ndn ( e );
+	slapi_pblock_get ( pb, SLAPI_OPERATION, &op );
+	if ( operation_is_flag_set ( op, OP_FLAG_PS ) ) {
+		/* the entry may be gone before the next one reuses its memory */
+		acl__attrs_batch_reset ( batch );
+		return LDAP_SUCCESS;
+	}
+	if ( batch->ab_ndn && ( batch->ab_entry != e || batch->ab_access != access ||
+							strcmp ( batch->ab_ndn, n_edn ) != 0 ) ) {
+		acl__attrs_batch_reset ( batch );
+	}
+
+	/* The lookups made while the batch is filled must not see it */
+	batch_ndn = batch->ab_ndn;
+	batch->ab_ndn = NULL;
+	num_known = batch->ab_num_types;
+
+	for ( i = 0; attrs[i] != NULL; i++ ) {
+		for ( j = 0; j < num_known; j++ ) {
+			if ( strcasecmp ( batch->ab_types[j], attrs[i] ) == 0 )
+				break;
+		}
+		if ( j < num_known )
+			continue;
+
+		if ( batch->ab_num_types == batch->ab_size ) {
+			int	num = batch->ab_size + ACL_ATTRS_BATCH_INCR;
+
+			batch->ab_types = (char **) slapi_ch_realloc (
+							(char *) batch->ab_types, num * sizeof (char *));
+			batch->ab_allowed = (unsigned char *) slapi_ch_realloc (
+							(char *) batch->ab_allowed, num >> 3);
+			memset ( batch->ab_allowed + (batch->ab_size >> 3), 0,
+							ACL_ATTRS_BATCH_INCR >> 3 );
+			batch->ab_size = num;
+		}
+
+		rc = acl_read_access_allowed_on_attr ( pb, e, attrs[i], NULL, access );
+		if ( rc == LDAP_SUCCESS ) {
+			ACL_ATTRS_BATCH_SET ( batch, batch->ab_num_types );
+		} else if ( rc != LDAP_INSUFFICIENT_ACCESS ) {
+			slapi_ch_free_string ( &batch_ndn );
+			acl__attrs_batch_reset ( batch );
+			return rc;
+		}
+		batch->ab_types[batch->ab_num_types++] = slapi_ch_strdup ( attrs[i] );
+	}
+
+	if ( aclpb->aclpb_attrs_unbatchable ) {
+		/* evaluate each attribute with its values when it is sent */
+		slapi_ch_free_string ( &batch_ndn );
+		acl__attrs_batch_reset ( batch );
+		return LDAP_SUCCESS;
+	}
+
+	batch->ab_ndn = batch_ndn ? batch_ndn : slapi_ch_strdup ( n_edn );
+	batch->ab_entry = e;
+	batch->ab_access = access;
+	batch->ab_next = num_known;
+
+	return LDAP_SUCCESS;
+}
+
+/*
+ * Lookup of an attribute in the batched results of the entry.
+ * Returns LDAP_SUCCESS, LDAP_INSUFFICIENT_ACCESS or -1 if not batched.
+ */
+static int
+acl__attrs_batch_result (Acl_PBlock *aclpb, Slapi_Entry *e, const char *attr, int access)
+{
+	aclAttrsBatch	*batch = &aclpb->aclpb_attrs_batch;
+	int				i;
+
+	if ( batch->ab_ndn == NULL || attr == NULL ||
+		 batch->ab_entry != e || batch->ab_access != access ||
+		 strcmp ( batch->ab_ndn, slapi_entry_get_ndn ( e ) ) != 0 ) {
+		return -1;
+	}
+
+	/* The attributes are normally sent in the order they were batched */
+	i = batch->ab_next;
+	if ( i >= batch->ab_num_types || strcasecmp ( batch->ab_types[i], attr ) != 0 ) {
+		for ( i = 0; i < batch->ab_num_types; i++ ) {
+			if ( strcasecmp ( batch->ab_types[i], attr ) == 0 )
+				break;
+		}
+		if ( i == batch->ab_num_types )
+			return -1;
+	}
+	batch->ab_next = i + 1;
+
+	return ACL_ATTRS_BATCH_ISSET ( batch, i ) ? LDAP_SUCCESS : LDAP_INSUFFICIENT_ACCESS;
+}
+
+/* Forget the batched results but keep the arrays for the next entry */
+static void
+acl__attrs_batch_reset (aclAttrsBatch *batch)
+{
+	int		i;
+
+	for ( i = 0; i < batch->ab_num_types; i++ ) {
+		slapi_ch_free_string ( &batch->ab_types[i] );
+	}
+	if ( batch->ab_allowed ) {
+		memset ( batch->ab_allowed, 0, batch->ab_size >> 3 );
+	}
+	slapi_ch_free_string ( &batch->ab_ndn );
+	batch->ab_entry = NULL;
+	batch->ab_access = 0;
+	batch->ab_num_types = 0;
+	batch->ab_next = 0;
+}
+
+void
+acl_attrs_batch_done (Acl_PBlock *aclpb)
+{
+	aclAttrsBatch	*batch = &aclpb->aclpb_attrs_batch;
+
+	acl__attrs_batch_reset ( batch );
+	slapi_ch_free ( (void **) &batch->ab_types );
+	slapi_ch_free ( (void **) &batch->ab_allowed );
+	batch->ab_size = 0;
+	aclpb->aclpb_attrs_unbatchable = 0;
+}
+
 /***************************************************************************
 *
 * acl_check_mods 
@@ -1656,7 +1868,7 @@ acl_modified (Slapi_PBlock *pb, int optype, Slapi_DN *e_sdn, void *change)
 			aclg_regen_group_signature();
 			if (  (optype == SLAPI_OPERATION_MODIFY) || (optype == SLAPI_OPERATION_DELETE ) ) {
 				/* Then we need to invalidate the acl signature also */
-				acl_signature = aclutil_gen_signature ( acl_signature );
+				acl_regen_aclsignature ();
 			}
 		}
 	}
@@ -1692,6 +1904,9 @@ acl_modified (Slapi_PBlock *pb, int optype, Slapi_DN *e_sdn, void *change)
 		aclg_markUgroupForRemoval (ugroup);
 	}
 
+	/* Same thing for the decisions cached for this entry as a bind identity */
+	acldecision_invalidate ( slapi_sdn_get_ndn ( e_sdn ) );
+
 	/*
 	 * Take the write lock around all the mods--so that
 	 * other operations will see the acicache either before the whole mod
@@ -1863,7 +2078,13 @@ acl_modified (Slapi_PBlock *pb, int optype, Slapi_DN *e_sdn, void *change)
 		acllist_acicache_WRITE_LOCK();
 		/* acllist_moddn_aci_needsLock expects normalized new_DN, 
 		 * which is no need to be case-ignored */
-		acllist_moddn_aci_needsLock ( e_sdn, new_DN );
+		if ( 0 == acllist_moddn_aci_needsLock ( e_sdn, new_DN ) ) {
+			/* the anonymous profile copied the old target of the acis */
+			aclanom_gen_anomProfile ( DONT_TAKE_ACLCACHE_READLOCK );
+		}
+		/* The cached decisions were taken with the acis at their old
+		 * place and on the entries under their old dn */
+		acl_regen_aclsignature ();
 		acllist_acicache_WRITE_UNLOCK();
 
 		/* deallocat the parent_DN */
@@ -1940,11 +2161,24 @@ acl__scan_for_acis(Acl_PBlock *aclpb, int *err)
 	attr_matched = ACL_FALSE;
 	deny_handle = 0;
 	allow_handle = 0;
+	aclpb->aclpb_decision_uncacheable = 0;
 
 	aclpb->aclpb_stat_acllist_scanned++;
 	aci = acllist_get_first_aci ( aclpb, &cookie );
 
 	while( aci ) {
+		/*
+		** The decision depends on the content of the entry if an aci
+		** for these rights could match it through a filter or a macro.
+		*/
+		if ( (aci->aci_access & aclpb->aclpb_access) &&
+			 (aci->aci_type & ACI_DECISION_UNCACHEABLE_TARGETS) ) {
+			aclpb->aclpb_decision_uncacheable = 1;
+		}
+		if ( (aci->aci_access & aclpb->aclpb_access) &&
+			 (aci->aci_type & ACI_ATTRS_UNBATCHABLE_TARGETS) ) {
+			aclpb->aclpb_attrs_unbatchable = 1;
+		}
 		if (acl__resource_match_aci(aclpb, aci, 0, &attr_matched)) {
 			/* Generate the ACL list handle  */
 			if (aci->aci_handle == NULL) {
@@ -1953,6 +2187,14 @@ acl__scan_for_acis(Acl_PBlock *aclpb, int *err)
 			}
 			aclutil_print_aci (aci, acl_access2str (aclpb->aclpb_access));
 
+			/* The subject rules may depend on more than the bind identity */
+			if (aci->aci_ruleType & ACI_DECISION_UNCACHEABLE_RULES) {
+				aclpb->aclpb_decision_uncacheable = 1;
+			}
+			if (aci->aci_ruleType & ACI_ATTRS_UNBATCHABLE_RULES) {
+				aclpb->aclpb_attrs_unbatchable = 1;
+			}
+
 			if (aci->aci_type & ACI_HAS_DENY_RULE) {
 				if (aclpb->aclpb_deny_handles[aci->aci_elevel] == NULL ) {
 					aclpb->aclpb_deny_handles[aci->aci_elevel] = aci;
@@ -2393,15 +2635,15 @@ acl__resource_match_aci( Acl_PBlock *aclpb, aci_t *aci, int skip_attrEval, int *
 													lasinfo,
 													ACL_EVAL_TARGET_FILTER);
 			slapi_ch_free((void**)&lasinfo);
-		} else {
-
+		} else if ((filter_matched = acl__get_tfilter_result(aclpb, aci)) == -1) {
 
+			filter_matched = ACL_TRUE;
 			if (slapi_vattr_filter_test(NULL, aclpb->aclpb_curr_entry, 
 				aci->targetFilter,
 				0 /*don't do acess chk*/)!= 0) {
 				filter_matched = ACL_FALSE;
 			}
-
+			acl__set_tfilter_result(aclpb, aci, filter_matched);
 		}
 
 		/* If it's a logical value we can do logic on it...otherwise we do not match */
@@ -3462,6 +3704,51 @@ acl__reset_cached_result (struct acl_pblock *aclpb )
 		aclpb->aclpb_cache_result[j].result = 0;
 	}
 }
+
+/***************************************************************************
+*
+* acl__get_tfilter_result
+* acl__set_tfilter_result
+*
+* Remember the outcome of the targetfilter of an aci for the current entry.
+* Testing the filter is the costly part of matching the target, and for a
+* search entry it would otherwise be done again for every attribute.
+* The results are dropped when acl_access_allowed() moves to a new entry.
+*
+* Returns:
+*	ACL_TRUE/ACL_FALSE	- cached outcome
+*	-1					- not cached
+*
+**************************************************************************/
+static int
+acl__get_tfilter_result (Acl_PBlock *aclpb, aci_t *aci)
+{
+	int		j;
+
+	if (aclpb->aclpb_res_type & ACLPB_EFFECTIVE_RIGHTS)
+		return -1;
+
+	for (j = 0; j < aclpb->aclpb_num_tfilter_cache; j++) {
+		if (aclpb->aclpb_tfilter_cache[j].aci_index == aci->aci_index)
+			return aclpb->aclpb_tfilter_cache[j].matched;
+	}
+	return -1;
+}
+
+static void
+acl__set_tfilter_result (Acl_PBlock *aclpb, aci_t *aci, int matched)
+{
+	int		j = aclpb->aclpb_num_tfilter_cache;
+
+	if ((aclpb->aclpb_res_type & ACLPB_EFFECTIVE_RIGHTS) ||
+		(j >= aclpb_max_selected_acls))
+		return;
+
+	aclpb->aclpb_tfilter_cache[j].aci_index = aci->aci_index;
+	aclpb->aclpb_tfilter_cache[j].matched = matched;
+	aclpb->aclpb_num_tfilter_cache++;
+}
+
 /*
  * acl_access_allowed_disjoint_resource
  * 
@@ -4092,6 +4379,7 @@ void
 acl_regen_aclsignature ()
 {
 	acl_signature = aclutil_gen_signature ( acl_signature );
+	acldecision_invalidate_all ();
 }
 	
 
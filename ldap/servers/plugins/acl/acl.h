@@ -186,6 +186,7 @@ struct scoped_entry_anominfo {
 	short anom_e_targetInfo[ACL_ANOM_MAX_ACL];
 	short anom_e_nummatched;
 	short anom_e_isrootds;	
+	PRUint32 anom_e_generation;	/* anom profile the indexes refer to */
 };
 
 typedef struct targetattr {
@@ -280,6 +281,15 @@ typedef struct aci {
 
 #define ACI_ATTR_RULES ( ACI_USERDNATTR_RULE | ACI_GROUPDNATTR_RULE | ACI_USERATTR_RULE  | ACI_PARAM_DNRULE | ACI_PARAM_ATTRRULE  | ACI_USERDN_SELFRULE)
 #define ACI_CACHE_RESULT_PER_ENTRY ACI_ATTR_RULES
+/* acis which prevent a decision from being kept in the decision cache */
+#define ACI_DECISION_UNCACHEABLE_TARGETS ( ACI_TARGET_FILTER | ACI_TARGET_MACRO_DN | \
+			ACI_TARGET_FILTER_MACRO_DN | ACI_TARGET_ATTR_ADD_FILTERS | ACI_TARGET_ATTR_DEL_FILTERS )
+/* acis whose outcome depends on the values of the entry: no attrs batch */
+#define ACI_ATTRS_UNBATCHABLE_TARGETS ( ACI_TARGET_ATTR_ADD_FILTERS | ACI_TARGET_ATTR_DEL_FILTERS )
+#define ACI_ATTRS_UNBATCHABLE_RULES ( ACI_USERATTR_RULE | ACI_PARAM_DNRULE | ACI_PARAM_ATTRRULE )
+#define ACI_DECISION_UNCACHEABLE_RULES ( ACI_ATTR_RULES | ACI_ROLEDN_RULE | ACI_IP_RULE | \
+			ACI_DNS_RULE | ACI_TIMEOFDAY_RULE | ACI_DAYOFWEEK_RULE | ACI_AUTHMETHOD_RULE | \
+			ACI_SSF_RULE )
 
 	short					aci_elevel;	/* Based on the aci type some idea about the
 								** execution flow 
@@ -327,6 +337,25 @@ typedef struct aci {
 int aclpb_max_selected_acls;    /* initialized from plugin config entry */
 int aclpb_max_cache_results;    /* initialized from plugin config entry */
 
+/*
+ * In plugin config entry, set this attribute to change the number of
+ * slots of the access decision cache (acldecision.c). 0 disables it.
+ */
+#define ATTR_ACL_DECISION_CACHE_SIZE            "nsslapd-acl-decision-cache-size"
+#define DEFAULT_ACL_DECISION_CACHE_SIZE         4096
+
+int acl_decision_cache_size;    /* initialized from plugin config entry */
+
+/*
+ * In plugin config entry, set this attribute to off to evaluate group
+ * memberships with internal searches instead of the in-memory group
+ * membership index (aclgroupindex.c).
+ */
+#define ATTR_ACL_GROUP_INDEX                    "nsslapd-acl-group-index"
+#define DEFAULT_ACL_GROUP_INDEX                 1
+
+int acl_group_index_enabled;    /* initialized from plugin config entry */
+
 typedef struct result_cache {
 	int				aci_index;
 	short			aci_ruleType;
@@ -340,6 +369,40 @@ typedef struct result_cache {
 #define ACLPB_CACHE_ERROR_REPORTED		(short)0x8000 /* error is reported */
 }r_cache_t;
 
+/*
+ * Outcome of a targetfilter test for an aci on the entry being evaluated.
+ * The filter only depends on the entry, so the outcome is shared by all
+ * the attributes of that entry.
+ */
+typedef struct tfilter_cache {
+	int				aci_index;
+	int				matched;		/* ACL_TRUE or ACL_FALSE */
+}tf_cache_t;
+
+/*
+ * Read access of a search entry's attribute set, evaluated in one pass by
+ * acl_read_access_allowed_on_attrs(). Bit i of ab_allowed is set when
+ * ab_types[i] may be returned. It lives in the aclpb, so it is private to
+ * the operation and its bind identity, and it is only valid for ab_entry
+ * (checked with its ndn, as the entry may be freed and its memory reused)
+ * and ab_access.
+ */
+struct acl_attrs_batch {
+	char			*ab_ndn;		/* entry the results apply to */
+	const Slapi_Entry	*ab_entry;
+	int				ab_access;
+	char			**ab_types;		/* attribute types evaluated */
+	unsigned char	*ab_allowed;	/* allow bitmap over ab_types */
+	int				ab_num_types;
+	int				ab_size;		/* slots allocated in ab_types */
+	int				ab_next;		/* type the next lookup should ask for */
+};
+typedef struct acl_attrs_batch aclAttrsBatch;
+
+#define ACL_ATTRS_BATCH_INCR		32
+#define ACL_ATTRS_BATCH_ISSET(b, i)	((b)->ab_allowed[(i) >> 3] & (1 << ((i) & 7)))
+#define ACL_ATTRS_BATCH_SET(b, i)	((b)->ab_allowed[(i) >> 3] |= (1 << ((i) & 7)))
+
 
 /*
  *  This is use to keep the result of the evaluation of the attr.
@@ -486,6 +549,10 @@ struct acl_pblock {
 	/* Current entry/dn/attr evaluation info */
 	Slapi_Entry				*aclpb_curr_entry;		/* current Entry being processed */
 	int						aclpb_num_entries;
+	int						aclpb_decision_uncacheable; /* last scan can't be cached */
+	int						*aclpb_decision_acis; /* indexes of the acis of the last scan */
+	int						aclpb_decision_acis_size;
+	int						aclpb_attrs_unbatchable; /* an aci of the entry depends on values */
 	Slapi_DN				*aclpb_curr_entry_sdn;	/* Entry's SDN */
 	Slapi_DN				*aclpb_authorization_sdn; /* dn used for authorization */
 
@@ -494,6 +561,9 @@ struct acl_pblock {
 	Slapi_Entry				*aclpb_filter_test_entry;	/* Scratch entry */
 	aci_t					*aclpb_curr_aci;
 	char					*aclpb_Evalattr;	/* The last attr evaluated  */
+	aclAttrsBatch			aclpb_attrs_batch;	/* Batched read results of the entry */
+	tf_cache_t				*aclpb_tfilter_cache;	/* targetfilter results of the entry */
+	int						aclpb_num_tfilter_cache;
         
         /* Source entry (MODDN) */
         Slapi_DN                                *aclpb_moddn_source_sdn; /* This is a pointer into the pb, do not free it */
@@ -663,7 +733,9 @@ ACL_REASON_ANON_DENIED,
 ACL_REASON_NO_MATCHED_SUBJECT_ALLOWS,
 ACL_REASON_EVALCONTEXT_CACHED_ALLOW,
 ACL_REASON_EVALCONTEXT_CACHED_NOT_ALLOWED,
-ACL_REASON_EVALCONTEXT_CACHED_ATTR_STAR_ALLOW
+ACL_REASON_EVALCONTEXT_CACHED_ATTR_STAR_ALLOW,
+ACL_REASON_DECISION_CACHED_ALLOW,
+ACL_REASON_DECISION_CACHED_DENY
 }aclReasonCode_t;
 
 typedef struct{
@@ -672,6 +744,17 @@ typedef struct{
 }aclResultReason_t;
 #define ACL_NO_DECIDING_ACI_INDEX -10
 
+/* Filled in by acldecision_lookup() and used by acldecision_store() */
+typedef struct acl_decision_ticket {
+	int			adt_usable;
+	PRInt32		adt_generation;
+	PRInt32		adt_change;
+	PRInt32		adt_client_generation;
+	int			adt_state;
+	int			adt_nacis;
+	PRUint32	adt_hash;
+}aclDecisionTicket;
+
 
 /* Extern declaration for backend state change fnc: acllist.c and aclinit.c */
 
@@ -723,6 +806,9 @@ extern int DS_LASGroupDnEval(NSErr_t *errp, char *attribute, CmpOp_t comparator,
 		PList_t subject, PList_t resource, PList_t auth_info,
 		PList_t global_auth);
 
+extern void DS_LASUserDnFlush(void **las_cookie);
+extern void DS_LASGroupDnFlush(void **las_cookie);
+
 extern int DS_LASRoleDnEval(NSErr_t *errp, char *attr_name, CmpOp_t comparator, 
 		char *attr_pattern, int *cachable, void **LAS_cookie, 
 		PList_t subject, PList_t resource, PList_t auth_info,
@@ -776,6 +862,9 @@ int  		acl_access_allowed_modrdn ( Slapi_PBlock *pb, Slapi_Entry *e, char *attr,
                                   struct berval *val, int access);
 int  		acl_read_access_allowed_on_attr ( Slapi_PBlock *pb, Slapi_Entry *e, char *attr,
                                   struct berval *val, int access);
+int  		acl_read_access_allowed_on_attrs ( Slapi_PBlock *pb, Slapi_Entry *e,
+                                   char **attrs, int access);
+void		acl_attrs_batch_done ( struct acl_pblock *aclpb );
 void 		acl_set_acllist (Slapi_PBlock *pb, int scope, char *base);
 void 		acl_gen_err_msg(int access, char *edn, char *attr, char **errbuf);
 void 		acl_modified (Slapi_PBlock *pb, int optype, Slapi_DN *e_sdn, void *change);
@@ -873,11 +962,30 @@ aclUserGroup * aclg_get_usersGroup ( struct acl_pblock *aclpb , char *n_dn);
 void		aclg_lock_groupCache (int type );
 void		aclg_unlock_groupCache (int type );
 
+int			acldecision_init ();
+void		acldecision_free ();
+int			acldecision_lookup ( struct acl_pblock *aclpb, const char *attr,
+								int access, aclDecisionTicket *ticket );
+void		acldecision_store ( struct acl_pblock *aclpb, const char *attr,
+								int access, aclDecisionTicket *ticket,
+								int result );
+void		acldecision_invalidate_all ();
+void		acldecision_invalidate ( const char *n_dn );
+
+int			aclgroupindex_init ();
+void		aclgroupindex_free ();
+void		aclgroupindex_rebuild ();
+int			aclgroupindex_ismember ( const char *group_ndn, const char *user_ndn,
+								int max_nestlevel );
+int			aclgroupindex_betxn_post_op ( Slapi_PBlock *pb );
+int			aclgroupindex_post_op ( Slapi_PBlock *pb );
+
 int			aclanom_init();
 int 		aclanom_match_profile (Slapi_PBlock *pb,  struct acl_pblock *aclpb, 
 									Slapi_Entry *e, char *attr, int access);
 void		aclanom_get_suffix_info(Slapi_Entry *e, struct acl_pblock *aclpb );
-void		aclanom_invalidateProfile();
+void		aclanom_add_aci ( aci_t *aci );
+void		aclanom_remove_acis ( aci_t *aci_list );
 void		aclanom__del_profile (int closing);
 
 typedef enum{
@@ -443,6 +443,19 @@ acl__handle_plugin_config_entry (Slapi_Entry *e,  void *callback_data )
         aclpb_max_cache_results = DEFAULT_ACLPB_MAX_SELECTED_ACLS;
     }
 
+    if (slapi_entry_attr_exists(e, ATTR_ACL_DECISION_CACHE_SIZE)) {
+        value = slapi_entry_attr_get_int(e, ATTR_ACL_DECISION_CACHE_SIZE);
+        acl_decision_cache_size = (value > 0) ? value : 0;
+    } else {
+        acl_decision_cache_size = DEFAULT_ACL_DECISION_CACHE_SIZE;
+    }
+
+    if (slapi_entry_attr_exists(e, ATTR_ACL_GROUP_INDEX)) {
+        acl_group_index_enabled = slapi_entry_attr_get_bool(e, ATTR_ACL_GROUP_INDEX);
+    } else {
+        acl_group_index_enabled = DEFAULT_ACL_GROUP_INDEX;
+    }
+
     return 0;
 }
 
@@ -732,6 +745,10 @@ acl__malloc_aclpb ( )
                 slapi_ch_calloc (aclpb_max_cache_results + 1 /* 1 for cache overflow warning */,
                 sizeof (r_cache_t));
 
+    /* allocate array for the targetfilter results of the current entry */
+    aclpb->aclpb_tfilter_cache = (tf_cache_t *)
+                slapi_ch_calloc (aclpb_max_selected_acls, sizeof (tf_cache_t));
+
     /* allocate arrays for target handles in eval_context */
     aclpb->aclpb_curr_entryEval_context.acle_handles_matched_target = (int *)
                 slapi_ch_calloc (aclpb_max_selected_acls, sizeof (int));
@@ -771,7 +788,10 @@ acl__free_aclpb ( Acl_PBlock **aclpb_ptr)
 
     slapi_ch_free((void**)&(aclpb->aclpb_handles_index));
     slapi_ch_free((void**)&(aclpb->aclpb_base_handles_index));
+    slapi_ch_free((void**)&(aclpb->aclpb_decision_acis));
     slapi_ch_free((void**)&(aclpb->aclpb_cache_result));
+    slapi_ch_free((void**)&(aclpb->aclpb_tfilter_cache));
+    acl_attrs_batch_done(aclpb);
     slapi_ch_free((void**)
            &(aclpb->aclpb_curr_entryEval_context.acle_handles_matched_target));
     slapi_ch_free((void**)
@@ -831,6 +851,7 @@ acl_init_aclpb ( Slapi_PBlock *pb, Acl_PBlock *aclpb, const char *ndn, int copy_
 
 	/* reset scoped entry cache to be empty */
 	aclpb->aclpb_scoped_entry_anominfo.anom_e_nummatched = 0;
+	aclpb->aclpb_scoped_entry_anominfo.anom_e_generation = 0;
 
 	if (PListAssignValue(aclpb->aclpb_proplist, DS_ATTR_USERDN,
 					slapi_sdn_get_ndn(aclpb->aclpb_authorization_sdn), 0) < 0) {
@@ -1128,11 +1149,16 @@ acl__done_aclpb ( struct acl_pblock *aclpb )
 
 	/* reset scoped entry cache to be empty */
 	aclpb->aclpb_scoped_entry_anominfo.anom_e_nummatched = 0;
+	aclpb->aclpb_scoped_entry_anominfo.anom_e_generation = 0;
 
 	/* Free up any of the string values left in the macro ht and remove
 	 * the entries.*/
 	acl_ht_free_all_entries_and_values(aclpb->aclpb_macro_ht);
 
+	/* Forget the per entry results */
+	aclpb->aclpb_num_tfilter_cache = 0;
+	acl_attrs_batch_done(aclpb);
+
 	/* Finally, set it to the no use state */	
 	aclpb->aclpb_state = 0;
 
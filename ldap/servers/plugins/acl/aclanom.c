@@ -15,9 +15,23 @@
 
 /************************************************************************
 Anonymous profile 
+
+The profile is the list of the simple "anyone" read/search acis, factored
+so that the access of an anonymous client can be decided without going
+through the acl evaluation.
+
+A published profile is never modified.  An aci change copies the current
+profile, adds or removes the slots of the changed acis only--the slots of
+the other acis are shared with the previous profile--and publishes the
+copy.  Readers do not take any lock: they announce themselves in the
+reader count of the current epoch, and a writer that has replaced the
+profile moves to the next epoch and waits for the readers of the previous
+one to leave before freeing the old profile.
 **************************************************************************/
 
 struct  anom_targetacl {
+	int				anom_refcnt;			/* profiles sharing this slot */
+	int				anom_aci_index;			/* aci the slot comes from */
 	int				anom_type;				/* defines for anom types same as aci_type */
 	int				anom_access;
     Slapi_DN		*anom_target;			/* target of the ACL */
@@ -27,48 +41,82 @@ struct  anom_targetacl {
 
 
 struct anom_profile {
-	short				anom_signature;
-	short				anom_numacls;
-	struct anom_targetacl anom_targetinfo[ACL_ANOM_MAX_ACL];
+	PRUint32			anom_generation;
+	int					anom_numacls;
+	int					anom_maxacls;
+	struct anom_targetacl **anom_targetinfo;
+	int					anom_numcancels;	/* acis too complex for a profile */
+	int					anom_maxcancels;
+	int					*anom_cancels;		/* index of these acis */
 };
 
-static struct anom_profile *acl_anom_profile = NULL;
+/* Only usable if no aci cancels it and the slots fit in the aclpb */
+#define ANOM_PROFILE_USABLE(p)	((p)->anom_numcancels == 0 && \
+								 (p)->anom_numacls > 0 && \
+								 (p)->anom_numacls < ACL_ANOM_MAX_ACL)
+
+/* What an aci brings to the profile */
+#define ANOM_ACI_IGNORED		0
+#define ANOM_ACI_SLOT			1
+#define ANOM_ACI_CANCELS		2
+
+#define ANOM_INCR_SLOTS			8
+
+static struct anom_profile * volatile acl_anom_profile = NULL;
+static int anom_profile_usable = 0;
+static PRUint32 anom_generation = 0;
 
-static Slapi_RWLock *anom_rwlock = NULL;
-#define ANOM_LOCK_READ()     slapi_rwlock_rdlock  (anom_rwlock )
-#define ANOM_UNLOCK_READ()   slapi_rwlock_unlock (anom_rwlock )
-#define ANOM_LOCK_WRITE()    slapi_rwlock_wrlock  (anom_rwlock )
-#define ANOM_UNLOCK_WRITE()  slapi_rwlock_unlock (anom_rwlock )
+static PRInt32 anom_epoch = 0;
+static PRInt32 anom_readers[2] = { 0, 0 };
+
+/* Serializes the writers, readers never take it */
+static PRLock *anom_update_lock = NULL;
+
+static struct anom_profile *aclanom__enter ( int *epoch_slot );
+static void aclanom__leave ( int epoch_slot );
+static void aclanom__publish ( struct anom_profile *a_profile );
+static struct anom_profile *aclanom__new_profile ( struct anom_profile *from );
+static void aclanom__free_profile ( struct anom_profile *a_profile );
+static int aclanom__make_slot ( aci_t *aci, struct anom_targetacl **slot );
+static int aclanom__add_to_profile ( struct anom_profile *a_profile, aci_t *aci );
+static void aclanom__free_slot ( struct anom_targetacl *slot );
+static void aclanom__get_suffix_info ( struct anom_profile *a_profile,
+							Slapi_Entry *e, struct acl_pblock *aclpb );
 
 /*
  * aclanom_init ();
- *	Generate a profile for the anonymous user.  We can use this profile
- *	later to determine what resources the client is allowed to.
- *
- * Dependency:
- * 		Before calling this, it is assumed that all the ACLs have been read
- *		and parsed. 
- *
- *		We will go thru all the ACL and pick the ANYONE ACL and generate the anom 
- *		profile.
+ *	Set up the publication of the profile for the anonymous user.
+ *	The profile is generated by aclanom_gen_anomProfile() once the
+ *	ACLs have been read, and then kept up to date by
+ *	aclanom_add_aci()/aclanom_remove_acis(). As the slots copy the
+ *	target of their aci, it is generated again when acis are moved by
+ *	a moddn.
  *
  */
 int
 aclanom_init ()
 {
 
-	acl_anom_profile = (struct anom_profile * )
-                slapi_ch_calloc (1, sizeof ( struct anom_profile ) );
-
-	if (( anom_rwlock = slapi_new_rwlock()) == NULL ) {
+	if (( anom_update_lock = PR_NewLock()) == NULL ) {
 		slapi_log_error( SLAPI_LOG_FATAL, plugin_name,
-				"Failed in getting the ANOM rwlock\n" );
+				"Failed in getting the ANOM lock\n" );
 		return 1;
 	}
 	return 0;
 }
 
 /*
+ * aclanom_gen_anomProfile
+ *	Generate a profile for the anonymous user.  We can use this profile
+ *	later to determine what resources the client is allowed to.
+ *
+ * Dependency:
+ * 		Before calling this, it is assumed that all the ACLs have been read
+ *		and parsed. 
+ *
+ *		We will go thru all the ACL and pick the ANYONE ACL and generate the anom 
+ *		profile.
+ *
  * Depending on the context, this routine may need to take the
  * acicache read lock.
 */
@@ -76,9 +124,6 @@ void
 aclanom_gen_anomProfile (acl_lock_flag_t lock_flag)
 {
 	aci_t					*aci = NULL;
-	int						i;
-	Targetattr				**srcattrArray;
-	Targetattr				*attr;
 	struct	anom_profile	*a_profile;
 	PRUint32				cookie;
 
@@ -88,7 +133,7 @@ aclanom_gen_anomProfile (acl_lock_flag_t lock_flag)
 	/*
 	 * This routine requires two locks:
 	 * the one for the global cache in acllist_acicache_READ_LOCK() and
-	 * the one for the anom profile.
+	 * the one serializing the updates of the anom profile.
 	 * They _must_ be taken in the order presented here or there
 	 * is a deadlock scenario with acllist_remove_aci_needsLock() which
 	 * takes them is this order.
@@ -97,244 +142,408 @@ aclanom_gen_anomProfile (acl_lock_flag_t lock_flag)
 	if ( lock_flag == DO_TAKE_ACLCACHE_READLOCK ) {
 		acllist_acicache_READ_LOCK();
 	}
-	ANOM_LOCK_WRITE  ();
-	a_profile = acl_anom_profile;
+	PR_Lock ( anom_update_lock );
 
-	if ( (!acl_get_aclsignature()) || ( !a_profile) ||
-			(a_profile->anom_signature ==  acl_get_aclsignature()) ) {
-		ANOM_UNLOCK_WRITE ();
-		if ( lock_flag == DO_TAKE_ACLCACHE_READLOCK ) {
-			acllist_acicache_READ_UNLOCK();
-		}
+	slapi_log_error(SLAPI_LOG_ACL, plugin_name, "GENERATING ANOM USER PROFILE\n");
+
+	a_profile = aclanom__new_profile ( NULL );
+
+	aci = acllist_get_first_aci ( NULL, &cookie );	
+	while ( aci ) {
+		aclanom__add_to_profile ( a_profile, aci );
+		aci =  acllist_get_next_aci ( NULL, aci, &cookie);
+	}
+
+	aclanom__publish ( a_profile );
+
+	PR_Unlock ( anom_update_lock );
+	if ( lock_flag == DO_TAKE_ACLCACHE_READLOCK ) {
+		acllist_acicache_READ_UNLOCK();
+	}
+}
+
+/*
+ * aclanom_add_aci
+ *	Bring a new aci in the profile.
+ *
+ *	ASSUMPTION: The acicache write lock has been obtained.
+ */
+void
+aclanom_add_aci ( aci_t *aci )
+{
+	struct	anom_profile	*a_profile;
+
+	PR_Lock ( anom_update_lock );
+
+	/* Not generated yet: aclanom_gen_anomProfile() will see the aci */
+	if ( acl_anom_profile == NULL ) {
+		PR_Unlock ( anom_update_lock );
 		return;
 	}
 
-	/* D0 we have one already. If we do, then clean it up */
-	aclanom__del_profile(0);
+	a_profile = aclanom__new_profile ( acl_anom_profile );
+	if ( aclanom__add_to_profile ( a_profile, aci ) == ANOM_ACI_IGNORED ) {
+		aclanom__free_profile ( a_profile );
+	} else {
+		aclanom__publish ( a_profile );
+	}
 
-	/* We have a new signature now */
-	a_profile->anom_signature =  acl_get_aclsignature();
+	PR_Unlock ( anom_update_lock );
+}
 
-	slapi_log_error(SLAPI_LOG_ACL, plugin_name, "GENERATING ANOM USER PROFILE\n");
-	/*
-	** Go thru the ACL list and find all the ACLs  which apply to the 
-	** anonymous user i.e anyone. we can generate a profile for that.
-	** We will llok at the simple case i.e it matches 
-	** cases not handled:
-	**  1) When there is a mix if rule types ( allows & denies )
-	**
-	*/
+/*
+ * aclanom_remove_acis
+ *	Take out of the profile the acis of the list (linked by aci_next)
+ *	before they are freed.
+ *
+ *	ASSUMPTION: The acicache write lock has been obtained.
+ */
+void
+aclanom_remove_acis ( aci_t *aci_list )
+{
+	struct	anom_profile	*a_profile;
+	aci_t					*aci;
+	int						i, changed = 0;
 
-	aci = acllist_get_first_aci ( NULL, &cookie );	
-	while ( aci ) {
-		int			a_numacl;
-		struct slapi_filter	*f;
-		char			**destattrArray;
-
-
-		/* 
-		 * We must not have a  rule like:  deny ( all )  userdn != "xyz" 
-		 * or groupdn !=
-		*/
-		if ( (aci->aci_type &  ACI_HAS_DENY_RULE) &&
-			( (aci->aci_type & ACI_CONTAIN_NOT_USERDN ) ||
-			  (aci->aci_type & ACI_CONTAIN_NOT_GROUPDN)	||
-				(aci->aci_type & ACI_CONTAIN_NOT_ROLEDN)) ){
-			slapi_log_error(SLAPI_LOG_ACL, plugin_name, 
-				"CANCELLING ANOM USER PROFILE BECAUSE OF DENY RULE\n");
-			goto cleanup;
-		}
+	PR_Lock ( anom_update_lock );
 
-		/* Must be a anyone rule */
-		if ( aci->aci_elevel != ACI_ELEVEL_USERDN_ANYONE ) {
-			aci =  acllist_get_next_aci ( NULL, aci, &cookie);
-			continue;
-		}
-		if (! (aci->aci_access &  ( SLAPI_ACL_READ | SLAPI_ACL_SEARCH)) ) {
-			aci =  acllist_get_next_aci ( NULL, aci, &cookie);
-			continue;
+	if ( acl_anom_profile == NULL ) {
+		PR_Unlock ( anom_update_lock );
+		return;
+	}
+
+	a_profile = aclanom__new_profile ( acl_anom_profile );
+	for ( aci = aci_list; aci; aci = aci->aci_next ) {
+		for ( i = 0; i < a_profile->anom_numacls; i++ ) {
+			if ( a_profile->anom_targetinfo[i]->anom_aci_index == aci->aci_index ) {
+				aclanom__free_slot ( a_profile->anom_targetinfo[i] );
+				memmove ( &a_profile->anom_targetinfo[i], &a_profile->anom_targetinfo[i+1],
+						(a_profile->anom_numacls - i - 1) * sizeof (struct anom_targetacl *) );
+				a_profile->anom_numacls--;
+				changed = 1;
+				break;
+			}
 		}
-		/* If the rule has anything other than userdn = "ldap:///anyone"
-		** let's not consider complex rules - let's make this lean.
-		*/
-		if ( aci->aci_ruleType & ~ACI_USERDN_RULE ){
-			slapi_log_error(SLAPI_LOG_ACL, plugin_name, 
-				"CANCELLING ANOM USER PROFILE BECAUSE OF COMPLEX RULE\n");
-			goto cleanup;
+		for ( i = 0; i < a_profile->anom_numcancels; i++ ) {
+			if ( a_profile->anom_cancels[i] == aci->aci_index ) {
+				a_profile->anom_cancels[i] =
+						a_profile->anom_cancels[--a_profile->anom_numcancels];
+				changed = 1;
+				break;
+			}
 		}
+	}
 
-		/* Must not be a or have a 
-		** 1 ) DENY RULE   2) targetfilter
-		** 3) no target pattern ( skip monitor acl  )
-		*/
-		if ( aci->aci_type & ( ACI_HAS_DENY_RULE  | ACI_TARGET_PATTERN |
-					ACI_TARGET_NOT | ACI_TARGET_FILTER_NOT )) {
-			const char	*dn = slapi_sdn_get_dn ( aci->aci_sdn );
+	if ( changed ) {
+		aclanom__publish ( a_profile );
+	} else {
+		aclanom__free_profile ( a_profile );
+	}
 
-			/* see if this is a monitor acl */
-			if (( strcasecmp ( dn, "cn=monitor") == 0 )  ||
-			    /* cn=monitor,cn=ldbm: No such object */
-			    ( strcasecmp ( dn, "cn=monitor,cn=ldbm") == 0 )) {
-				aci =  acllist_get_next_aci ( NULL, aci, &cookie);
-				continue;
-			} else {
-				/* clean up before leaving */
-				slapi_log_error(SLAPI_LOG_ACL, plugin_name, 
-					"CANCELLING ANOM USER PROFILE 1\n");
-				goto cleanup;
-			}
+	PR_Unlock ( anom_update_lock );
+}
 
-		}
+/*
+ * __aclanom_del_profile
+ *
+ *	Cleanup the anonymous user's profile we have.
+ *	Only used when closing, once no operation can be using it.
+ *
+ */
+void
+aclanom__del_profile (int closing)
+{
+	if ( !closing ) {
+		return;
+	}
 
-		/* Now we have an ALLOW ACL which applies to anyone */
-		a_numacl = a_profile->anom_numacls++;
+	if ( acl_anom_profile ) {
+		aclanom__free_profile ( acl_anom_profile );
+		acl_anom_profile = NULL;
+	}
+	anom_profile_usable = 0;
 
-		if ( a_profile->anom_numacls == ACL_ANOM_MAX_ACL ) {
-			slapi_log_error(SLAPI_LOG_ACL, plugin_name, "CANCELLING ANOM USER PROFILE 2\n");
-			goto cleanup;
-		}
+	if ( anom_update_lock ) {
+		PR_DestroyLock ( anom_update_lock );
+		anom_update_lock = NULL;
+	}
+}
 
-		if ( (f = aci->target) != NULL ) {
-			char            *avaType;
-			struct berval   *avaValue;
-			slapi_filter_get_ava ( f, &avaType, &avaValue );
+/*
+ * Readers: enter the current epoch and get the published profile.
+ * The profile stays valid until aclanom__leave().
+ */
+static struct anom_profile *
+aclanom__enter ( int *epoch_slot )
+{
+	PRInt32		epoch;
 
-			a_profile->anom_targetinfo[a_numacl].anom_target = 
-						slapi_sdn_new_dn_byval ( avaValue->bv_val );
-		} else {
-			a_profile->anom_targetinfo[a_numacl].anom_target = 
-						slapi_sdn_dup ( aci->aci_sdn );
+	for (;;) {
+		epoch = PR_AtomicAdd ( &anom_epoch, 0 );
+		PR_AtomicIncrement ( &anom_readers[epoch & 1] );
+		if ( epoch == PR_AtomicAdd ( &anom_epoch, 0 ) ) {
+			break;
 		}
+		/* a writer moved on meanwhile, it may not wait for us */
+		PR_AtomicDecrement ( &anom_readers[epoch & 1] );
+	}
+	*epoch_slot = epoch & 1;
 
-		a_profile->anom_targetinfo[a_numacl].anom_filter =  NULL;
-		if ( aci->targetFilterStr ) {
-			a_profile->anom_targetinfo[a_numacl].anom_filter =  slapi_str2filter ( aci->targetFilterStr );
-			if (NULL == a_profile->anom_targetinfo[a_numacl].anom_filter) {
-				const char	*dn = slapi_sdn_get_dn ( aci->aci_sdn );
-				slapi_log_error(SLAPI_LOG_FATAL, plugin_name,
-								"Error: invalid filter [%s] in anonymous aci in entry [%s]\n",
-								aci->targetFilterStr, dn);
-				goto cleanup;
-			}
-		}				
-
-		i = 0;
-		srcattrArray = aci->targetAttr;
-		while ( srcattrArray[i])
-			i++;
-
-		a_profile->anom_targetinfo[a_numacl].anom_targetAttrs = 
-					(char **) slapi_ch_calloc ( 1, (i+1) * sizeof(char *));
-
-		srcattrArray = aci->targetAttr;
-		destattrArray = a_profile->anom_targetinfo[a_numacl].anom_targetAttrs;
-
-		i = 0;
-		while ( srcattrArray[i] ) {
-			attr = srcattrArray[i];
-			if ( attr->attr_type & ACL_ATTR_FILTER ) {
-				/* Do'nt want to support these kind now */
-				destattrArray[i] = NULL;
-				/* clean up before leaving */
-				aclanom__del_profile (0);
-				slapi_log_error(SLAPI_LOG_ACL, plugin_name, 
-					"CANCELLING ANOM USER PROFILE 3\n");
-				goto cleanup;
-			}
+	return acl_anom_profile;
+}
 
-			destattrArray[i] = slapi_ch_strdup ( attr->u.attr_str );
-			i++;
-		}	
+static void
+aclanom__leave ( int epoch_slot )
+{
+	PR_AtomicDecrement ( &anom_readers[epoch_slot] );
+}
 
-		destattrArray[i] = NULL;
+/*
+ * Writers: replace the published profile and free the previous one once
+ * the readers that may still use it are gone.
+ *
+ *	ASSUMPTION: anom_update_lock is held.
+ */
+static void
+aclanom__publish ( struct anom_profile *a_profile )
+{
+	struct	anom_profile	*old_profile = acl_anom_profile;
+	PRInt32					old_epoch;
 
-		aclutil_print_aci ( aci, "anom" );	
-		/*  Here we are storing att the info from the acls. However
-		** we are only interested in a few things like ACI_TARGETATTR_NOT.
-		*/
-		a_profile->anom_targetinfo[a_numacl].anom_type = aci->aci_type;
-		a_profile->anom_targetinfo[a_numacl].anom_access = aci->aci_access;
-		
-		aci =  acllist_get_next_aci ( NULL, aci, &cookie);
+	a_profile->anom_generation = ++anom_generation;
+	if ( a_profile->anom_generation == 0 ) {
+		/* 0 means "no profile" in the aclpb */
+		a_profile->anom_generation = ++anom_generation;
 	}
+	anom_profile_usable = ANOM_PROFILE_USABLE ( a_profile );
 
-	ANOM_UNLOCK_WRITE ();
-	if ( lock_flag == DO_TAKE_ACLCACHE_READLOCK ) {
-		acllist_acicache_READ_UNLOCK();
+	acl_anom_profile = a_profile;
+	old_epoch = PR_AtomicIncrement ( &anom_epoch ) - 1;
+
+	if ( old_profile ) {
+		while ( PR_AtomicAdd ( &anom_readers[old_epoch & 1], 0 ) > 0 ) {
+			DS_Sleep ( PR_MillisecondsToInterval ( 1 ) );
+		}
+		aclanom__free_profile ( old_profile );
 	}
-	return;
+}
 
-cleanup:
-	aclanom__del_profile (0);
-	ANOM_UNLOCK_WRITE ();
-	if ( lock_flag == DO_TAKE_ACLCACHE_READLOCK ) {
-		acllist_acicache_READ_UNLOCK();
+/*
+ * A profile with the slots of "from", which it shares.
+ */
+static struct anom_profile *
+aclanom__new_profile ( struct anom_profile *from )
+{
+	struct	anom_profile	*a_profile;
+	int						i;
+
+	a_profile = (struct anom_profile *) slapi_ch_calloc ( 1, sizeof (struct anom_profile) );
+	if ( from == NULL ) {
+		return a_profile;
 	}
+
+	a_profile->anom_maxacls = from->anom_maxacls;
+	a_profile->anom_numacls = from->anom_numacls;
+	if ( a_profile->anom_maxacls ) {
+		a_profile->anom_targetinfo = (struct anom_targetacl **)
+				slapi_ch_calloc ( a_profile->anom_maxacls, sizeof (struct anom_targetacl *) );
+	}
+	for ( i = 0; i < from->anom_numacls; i++ ) {
+		a_profile->anom_targetinfo[i] = from->anom_targetinfo[i];
+		a_profile->anom_targetinfo[i]->anom_refcnt++;
+	}
+
+	a_profile->anom_maxcancels = from->anom_maxcancels;
+	a_profile->anom_numcancels = from->anom_numcancels;
+	if ( a_profile->anom_maxcancels ) {
+		a_profile->anom_cancels = (int *)
+				slapi_ch_calloc ( a_profile->anom_maxcancels, sizeof (int) );
+		memcpy ( a_profile->anom_cancels, from->anom_cancels,
+				from->anom_numcancels * sizeof (int) );
+	}
+
+	return a_profile;
 }
 
+static void
+aclanom__free_profile ( struct anom_profile *a_profile )
+{
+	int		i;
 
-void
-aclanom_invalidateProfile ()
+	for ( i = 0; i < a_profile->anom_numacls; i++ ) {
+		aclanom__free_slot ( a_profile->anom_targetinfo[i] );
+	}
+	slapi_ch_free ( (void **) &a_profile->anom_targetinfo );
+	slapi_ch_free ( (void **) &a_profile->anom_cancels );
+	slapi_ch_free ( (void **) &a_profile );
+}
+
+static void
+aclanom__free_slot ( struct anom_targetacl *slot )
 {
-	ANOM_LOCK_WRITE();
-	if ( acl_anom_profile && acl_anom_profile->anom_numacls )
-		acl_anom_profile->anom_signature = 0;
-	ANOM_UNLOCK_WRITE();
+	if ( --slot->anom_refcnt > 0 ) {
+		return;
+	}
 
+	/* Deallocate target */
+	slapi_sdn_free ( &slot->anom_target );
 
+	/* Deallocate filter */
+	if ( slot->anom_filter )
+		slapi_filter_free ( slot->anom_filter, 1 );
+
+	/* Deallocate attrs */
+	charray_free ( slot->anom_targetAttrs );
+
+	slapi_ch_free ( (void **) &slot );
 }
 
 /*
- * __aclanom_del_profile
- *
- *	Cleanup the anonymous user's profile we have.
- * 
- *	ASSUMPTION: A WRITE LOCK HAS BEEN OBTAINED
- *
+ * Record what the aci brings to a profile that is not published yet.
+ * Returns ANOM_ACI_IGNORED, ANOM_ACI_SLOT or ANOM_ACI_CANCELS.
  */
-void
-aclanom__del_profile (int closing)
+static int
+aclanom__add_to_profile ( struct anom_profile *a_profile, aci_t *aci )
+{
+	struct anom_targetacl	*slot = NULL;
+	int						rv;
+
+	rv = aclanom__make_slot ( aci, &slot );
+	if ( rv == ANOM_ACI_SLOT ) {
+		if ( a_profile->anom_numacls == a_profile->anom_maxacls ) {
+			a_profile->anom_maxacls += ANOM_INCR_SLOTS;
+			a_profile->anom_targetinfo = (struct anom_targetacl **)
+					slapi_ch_realloc ( (char *) a_profile->anom_targetinfo,
+					a_profile->anom_maxacls * sizeof (struct anom_targetacl *) );
+		}
+		a_profile->anom_targetinfo[a_profile->anom_numacls++] = slot;
+		if ( a_profile->anom_numacls == ACL_ANOM_MAX_ACL ) {
+			slapi_log_error(SLAPI_LOG_ACL, plugin_name,
+				"CANCELLING ANOM USER PROFILE 2\n");
+		}
+	} else if ( rv == ANOM_ACI_CANCELS ) {
+		if ( a_profile->anom_numcancels == a_profile->anom_maxcancels ) {
+			a_profile->anom_maxcancels += ANOM_INCR_SLOTS;
+			a_profile->anom_cancels = (int *)
+					slapi_ch_realloc ( (char *) a_profile->anom_cancels,
+					a_profile->anom_maxcancels * sizeof (int) );
+		}
+		a_profile->anom_cancels[a_profile->anom_numcancels++] = aci->aci_index;
+	}
+	return rv;
+}
+
+/*
+ * Build the profile slot of the aci if it is a simple allow rule which
+ * applies to anyone.
+ */
+static int
+aclanom__make_slot ( aci_t *aci, struct anom_targetacl **slot )
 {
+	struct anom_targetacl	*a_slot;
+	struct slapi_filter		*f;
+	Targetattr				**srcattrArray;
 	int						i;
-	struct	anom_profile	*a_profile;
 
+	/* 
+	 * We must not have a  rule like:  deny ( all )  userdn != "xyz" 
+	 * or groupdn !=
+	*/
+	if ( (aci->aci_type &  ACI_HAS_DENY_RULE) &&
+		( (aci->aci_type & ACI_CONTAIN_NOT_USERDN ) ||
+		  (aci->aci_type & ACI_CONTAIN_NOT_GROUPDN)	||
+			(aci->aci_type & ACI_CONTAIN_NOT_ROLEDN)) ){
+		slapi_log_error(SLAPI_LOG_ACL, plugin_name, 
+			"CANCELLING ANOM USER PROFILE BECAUSE OF DENY RULE\n");
+		return ANOM_ACI_CANCELS;
+	}
 
-	if ( (a_profile = acl_anom_profile) == NULL ) {
-		return;
+	/* Must be a anyone rule */
+	if ( aci->aci_elevel != ACI_ELEVEL_USERDN_ANYONE ) {
+		return ANOM_ACI_IGNORED;
+	}
+	if (! (aci->aci_access &  ( SLAPI_ACL_READ | SLAPI_ACL_SEARCH)) ) {
+		return ANOM_ACI_IGNORED;
+	}
+	/* If the rule has anything other than userdn = "ldap:///anyone"
+	** let's not consider complex rules - let's make this lean.
+	*/
+	if ( aci->aci_ruleType & ~ACI_USERDN_RULE ){
+		slapi_log_error(SLAPI_LOG_ACL, plugin_name, 
+			"CANCELLING ANOM USER PROFILE BECAUSE OF COMPLEX RULE\n");
+		return ANOM_ACI_CANCELS;
 	}
 
-	for ( i=0; i < a_profile->anom_numacls; i++ ) {
-		int	j = 0;
-		char	**destArray = a_profile->anom_targetinfo[i].anom_targetAttrs;
+	/* Must not be a or have a 
+	** 1 ) DENY RULE   2) targetfilter
+	** 3) no target pattern ( skip monitor acl  )
+	*/
+	if ( aci->aci_type & ( ACI_HAS_DENY_RULE  | ACI_TARGET_PATTERN |
+				ACI_TARGET_NOT | ACI_TARGET_FILTER_NOT )) {
+		const char	*dn = slapi_sdn_get_dn ( aci->aci_sdn );
+
+		/* see if this is a monitor acl */
+		if (( strcasecmp ( dn, "cn=monitor") == 0 )  ||
+		    /* cn=monitor,cn=ldbm: No such object */
+		    ( strcasecmp ( dn, "cn=monitor,cn=ldbm") == 0 )) {
+			return ANOM_ACI_IGNORED;
+		}
+		slapi_log_error(SLAPI_LOG_ACL, plugin_name, 
+			"CANCELLING ANOM USER PROFILE 1\n");
+		return ANOM_ACI_CANCELS;
+	}
 
-		/* Deallocate target */
-		slapi_sdn_free ( &a_profile->anom_targetinfo[i].anom_target );
-		
-		/* Deallocate filter */
-		if ( a_profile->anom_targetinfo[i].anom_filter )
-			slapi_filter_free ( a_profile->anom_targetinfo[i].anom_filter, 1 );
-
-		/* Deallocate attrs */
-		if ( destArray ) {
-			while ( destArray[j] ) {
-				slapi_ch_free ( (void **) &destArray[j] );
-				j++;
-			}
-			slapi_ch_free ( (void **) &destArray );
+	srcattrArray = aci->targetAttr;
+	for ( i = 0; srcattrArray[i]; i++ ) {
+		if ( srcattrArray[i]->attr_type & ACL_ATTR_FILTER ) {
+			/* Do'nt want to support these kind now */
+			slapi_log_error(SLAPI_LOG_ACL, plugin_name, 
+				"CANCELLING ANOM USER PROFILE 3\n");
+			return ANOM_ACI_CANCELS;
 		}
-		a_profile->anom_targetinfo[i].anom_targetAttrs = NULL;
-		a_profile->anom_targetinfo[i].anom_type = 0;
-        a_profile->anom_targetinfo[i].anom_access = 0;
 	}
-	a_profile->anom_numacls = 0;
 
-	if(closing){
-		slapi_destroy_rwlock(anom_rwlock);
-		anom_rwlock = NULL;
-		slapi_ch_free((void **)&acl_anom_profile);
+	/* Now we have an ALLOW ACL which applies to anyone */
+	a_slot = (struct anom_targetacl *) slapi_ch_calloc ( 1, sizeof (struct anom_targetacl) );
+	a_slot->anom_refcnt = 1;
+	a_slot->anom_aci_index = aci->aci_index;
+
+	if ( (f = aci->target) != NULL ) {
+		char            *avaType;
+		struct berval   *avaValue;
+		slapi_filter_get_ava ( f, &avaType, &avaValue );
+
+		a_slot->anom_target = slapi_sdn_new_dn_byval ( avaValue->bv_val );
+	} else {
+		a_slot->anom_target = slapi_sdn_dup ( aci->aci_sdn );
+	}
+
+	if ( aci->targetFilterStr ) {
+		a_slot->anom_filter =  slapi_str2filter ( aci->targetFilterStr );
+		if (NULL == a_slot->anom_filter) {
+			const char	*dn = slapi_sdn_get_dn ( aci->aci_sdn );
+			slapi_log_error(SLAPI_LOG_FATAL, plugin_name,
+							"Error: invalid filter [%s] in anonymous aci in entry [%s]\n",
+							aci->targetFilterStr, dn);
+			aclanom__free_slot ( a_slot );
+			return ANOM_ACI_CANCELS;
+		}
+	}				
+
+	a_slot->anom_targetAttrs = (char **) slapi_ch_calloc ( 1, (i+1) * sizeof(char *));
+	for ( i = 0; srcattrArray[i]; i++ ) {
+		a_slot->anom_targetAttrs[i] = slapi_ch_strdup ( srcattrArray[i]->u.attr_str );
 	}
 
-	/* Don't clean the signatue */
+	aclutil_print_aci ( aci, "anom" );	
+	/*  Here we are storing att the info from the acls. However
+	** we are only interested in a few things like ACI_TARGETATTR_NOT.
+	*/
+	a_slot->anom_type = aci->aci_type;
+	a_slot->anom_access = aci->aci_access;
+
+	*slot = a_slot;
+	return ANOM_ACI_SLOT;
 }
 
 /*
@@ -358,6 +567,9 @@ aclanom__del_profile (int closing)
  * So, if for an example an entry changes and a given anom profile entry
  * no longer applies, we will not notice until the next round of access
  * control checking on the entry--this is acceptable.
+ * The indices are those of the profile published at the time; if
+ * another one is published meanwhile, aclanom_match_profile() computes
+ * them again.
  * 
  * The gain on doing this factoring in the following type of search
  * was approx 6%:
@@ -368,34 +580,53 @@ aclanom__del_profile (int closing)
 void
 aclanom_get_suffix_info(Slapi_Entry *e,
 							struct acl_pblock *aclpb ) {
+	struct	anom_profile	*a_profile;
+	int						epoch_slot;
+
+	a_profile = aclanom__enter ( &epoch_slot );
+	if ( a_profile ) {
+		aclanom__get_suffix_info ( a_profile, e, aclpb );
+	} else {
+		aclpb->aclpb_scoped_entry_anominfo.anom_e_nummatched = 0;
+	}
+	aclanom__leave ( epoch_slot );
+}
+
+static void
+aclanom__get_suffix_info ( struct anom_profile *a_profile, Slapi_Entry *e,
+							struct acl_pblock *aclpb ) {
 	int i;
 	char     *ndn = NULL;
 	Slapi_DN    *e_sdn;
 	const char    *aci_ndn;
+	struct anom_targetacl *slot;
 	struct scoped_entry_anominfo *s_e_anominfo =
 			&aclpb->aclpb_scoped_entry_anominfo;
 
-	ANOM_LOCK_READ ();
-		
 	s_e_anominfo->anom_e_nummatched=0;
+	s_e_anominfo->anom_e_generation = a_profile->anom_generation;
+
+	if ( !ANOM_PROFILE_USABLE ( a_profile ) ) {
+		return;
+	}
 
 	ndn = slapi_entry_get_ndn ( e ) ;
 	e_sdn= slapi_entry_get_sdn ( e ) ;
-	for (i=acl_anom_profile->anom_numacls-1; i >= 0; i-- ) {
-		aci_ndn = slapi_sdn_get_ndn (acl_anom_profile->anom_targetinfo[i].anom_target);
-		if (!slapi_sdn_issuffix(e_sdn,acl_anom_profile->anom_targetinfo[i].anom_target)
+	for (i=a_profile->anom_numacls-1; i >= 0; i-- ) {
+		slot = a_profile->anom_targetinfo[i];
+		aci_ndn = slapi_sdn_get_ndn (slot->anom_target);
+		if (!slapi_sdn_issuffix(e_sdn,slot->anom_target)
 				|| (!slapi_is_rootdse(ndn) && slapi_is_rootdse(aci_ndn)))
 						continue;
-		if ( acl_anom_profile->anom_targetinfo[i].anom_filter ) {
+		if ( slot->anom_filter ) {
 			if ( slapi_vattr_filter_test( aclpb->aclpb_pblock, e,
-                               		acl_anom_profile->anom_targetinfo[i].anom_filter, 
+                               		slot->anom_filter, 
 					0 /*don't do acess chk*/)  != 0)
 				continue;
 		}
 		s_e_anominfo->anom_e_targetInfo[s_e_anominfo->anom_e_nummatched]=i;
 		s_e_anominfo->anom_e_nummatched++;
 	}
-	ANOM_UNLOCK_READ (); 
 }
 
 
@@ -429,6 +660,7 @@ aclanom_match_profile (Slapi_PBlock *pb, struct acl_pblock *aclpb, Slapi_Entry *
 	char					**destArray;
 	int						tmatched = 0;
 	int						loglevel;
+	int						epoch_slot;
 	struct scoped_entry_anominfo *s_e_anominfo =
 			&aclpb->aclpb_scoped_entry_anominfo;
 
@@ -439,30 +671,23 @@ aclanom_match_profile (Slapi_PBlock *pb, struct acl_pblock *aclpb, Slapi_Entry *
 		return -1;
 
 	/* If we are here means, the client is doing a anonymous read/search */
-	if ((a_profile = acl_anom_profile) == NULL ) {
+	if ( !anom_profile_usable ) {
 		return -1;
-	}		
-
-	ANOM_LOCK_READ ();
-	/* Check the signature first */
-	if ( a_profile->anom_signature != acl_get_aclsignature () ) {
-		/* Need to regenrate the signature.
-	 	 * Need a WRITE lock to generate the anom profile  -
-	 	 * which is obtained in acl__gen_anom_user_profile (). Since
-	 	 * I don't have upgrade lock -- I have to do this way.
-	 	 */
-		ANOM_UNLOCK_READ ();
-		aclanom_gen_anomProfile (DO_TAKE_ACLCACHE_READLOCK);
-		aclanom_get_suffix_info(e, aclpb );
-		ANOM_LOCK_READ ();
 	}
 
+	a_profile = aclanom__enter ( &epoch_slot );
+
 	/* doing this early saves use a malloc/free/normalize cost */
-	if ( !a_profile->anom_numacls ) {
-		ANOM_UNLOCK_READ ();
+	if ( a_profile == NULL || !ANOM_PROFILE_USABLE ( a_profile ) ) {
+		aclanom__leave ( epoch_slot );
 		return -1;
 	}
 
+	/* The profile changed since the entry context was set up */
+	if ( s_e_anominfo->anom_e_generation != a_profile->anom_generation ) {
+		aclanom__get_suffix_info ( a_profile, e, aclpb );
+	}
+
 	result = LDAP_INSUFFICIENT_ACCESS;
 
 	for ( k=0; k<s_e_anominfo->anom_e_nummatched; k++ ) {
@@ -472,7 +697,7 @@ aclanom_match_profile (Slapi_PBlock *pb, struct acl_pblock *aclpb, Slapi_Entry *
 		i = s_e_anominfo->anom_e_targetInfo[k];
 	
 		/* Check for right */
-		if ( !(a_profile->anom_targetinfo[i].anom_access & access) )
+		if ( !(a_profile->anom_targetinfo[i]->anom_access & access) )
 			continue;
 		
 		/*
@@ -486,7 +711,7 @@ aclanom_match_profile (Slapi_PBlock *pb, struct acl_pblock *aclpb, Slapi_Entry *
 			break;
 		}
 
-		destArray = a_profile->anom_targetinfo[i].anom_targetAttrs;
+		destArray = a_profile->anom_targetinfo[i]->anom_targetAttrs;
 		while ( destArray[j] ) {
 			if ( strcasecmp ( destArray[j], "*") == 0 ||
 				slapi_attr_type_cmp ( attr, destArray[j], 1 ) == 0 ) {
@@ -496,7 +721,7 @@ aclanom_match_profile (Slapi_PBlock *pb, struct acl_pblock *aclpb, Slapi_Entry *
 			j++;
 		}
 		
-		if ( a_profile->anom_targetinfo[i].anom_type  & ACI_TARGET_ATTR_NOT )
+		if ( a_profile->anom_targetinfo[i]->anom_type  & ACI_TARGET_ATTR_NOT )
 			result = matched ? LDAP_INSUFFICIENT_ACCESS : LDAP_SUCCESS;
 		else 
 			result = matched ? LDAP_SUCCESS : LDAP_INSUFFICIENT_ACCESS;
@@ -520,7 +745,7 @@ aclanom_match_profile (Slapi_PBlock *pb, struct acl_pblock *aclpb, Slapi_Entry *
 
 		if ( result == LDAP_SUCCESS) {
 			const char				*aci_ndn;
-			aci_ndn = slapi_sdn_get_ndn (acl_anom_profile->anom_targetinfo[i].anom_target);
+			aci_ndn = slapi_sdn_get_ndn (a_profile->anom_targetinfo[i]->anom_target);
 			if (access & SLAPI_ACL_MODDN) {
 				slapi_log_error(loglevel, plugin_name, 
 					"conn=%" NSPRIu64 " op=%d: Allow access on entry(%s).attr(%s) (from %s) to anonymous: acidn=\"%s\"\n",
@@ -554,7 +779,7 @@ aclanom_match_profile (Slapi_PBlock *pb, struct acl_pblock *aclpb, Slapi_Entry *
 		}
 	}
 
-	ANOM_UNLOCK_READ ();
+	aclanom__leave ( epoch_slot );
 	if ( tmatched == 0) 
 		return -1;
 	else 
@@ -568,8 +793,7 @@ aclanom_is_client_anonymous ( Slapi_PBlock *pb )
 
 
 	slapi_pblock_get ( pb, SLAPI_REQUESTOR_DN, &clientDn );
-	if (acl_anom_profile->anom_numacls  && 
-			acl_anom_profile->anom_signature  &&  
+	if (anom_profile_usable &&
 			(( NULL == clientDn) || (clientDn && *clientDn == '\0')) )
 		return 1;
 
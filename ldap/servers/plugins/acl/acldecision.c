@@ -0,0 +1,376 @@
+/** BEGIN COPYRIGHT BLOCK
+ * Copyright (C) 2015 Red Hat, Inc.
+ * All rights reserved.
+ *
+ * License: GPL (version 3 or any later version).
+ * See LICENSE for details.
+ * END COPYRIGHT BLOCK **/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "acl.h"
+
+/***************************************************************************
+ *
+ * This module deals with the global access decision cache.
+ *
+ * The per operation caches (aclpb_cache_result and the evaluation contexts)
+ * die with the operation, so every search re-evaluates the same acis for
+ * the same bind identity over and over again. This cache keeps the result
+ * of a READ/SEARCH evaluation across operations, keyed by
+ * (aci set generation, bind identity and group generation, acis matching
+ * the target, attribute, right, evaluation state).
+ *
+ * The target entry is not part of the key: once acl__scan_for_acis() has
+ * selected the acis which apply to it, the decision only depends on them,
+ * so it is shared by all the entries of a subtree the same acis apply to.
+ * The bind identity stays in the key, as the groups of a client are only
+ * known by evaluating them for that client.
+ *
+ * Only decisions which can not change unless an aci, a group or the bind
+ * entry changes are cached: if any aci in scope has a target filter, a
+ * targattrfilters or a macro, or if any aci which matched the resource has
+ * an attribute, role, ip, dns, time, authmethod or ssf bind rule, the
+ * evaluation is marked uncacheable by acl__scan_for_acis().
+ *
+ * The cache is a direct mapped table protected by an array of locks.
+ * Everything cached so far is dropped by bumping a generation counter:
+ * this is done by the aci change path (acl_regen_aclsignature) and by the
+ * group change path (aclg_regen_group_signature). When the entry of a bind
+ * identity is modified, only the decisions taken for that identity are
+ * dropped, like it is done for the user group cache: each bind identity
+ * hashes to one of ACLDECISION_NUM_CLIENT_GENS client generation counters,
+ * and bumping that counter drops the decisions of every identity sharing
+ * it without walking the table.
+ **************************************************************************/
+
+#define ACLDECISION_NUM_LOCKS		64
+#define ACLDECISION_NUM_CLIENT_GENS	1024
+
+/*
+ * The bits of aclpb_state that acl__TestRights() and acl__resource_match_aci()
+ * read or update while evaluating a READ/SEARCH right. The value before
+ * the evaluation is part of the key, the value after is restored on a hit.
+ */
+#define ACLDECISION_STATE_MASK	( ACLPB_EVALUATING_FIRST_ATTR | ACLPB_FOUND_ATTR_RULE | \
+				  ACLPB_ATTR_STAR_MATCHED | ACLPB_FOUND_A_ENTRY_TEST_RULE | \
+				  ACLPB_EXECUTING_DENY_HANDLES | ACLPB_EXECUTING_ALLOW_HANDLES )
+#define ACLDECISION_KEY_MASK	( ACLDECISION_STATE_MASK | ACLPB_SEARCH_BASED_ON_LIST | \
+				  ACLPB_DONOT_USE_CONTEXT_ACLS )
+
+typedef struct acl_decision {
+	PRUint32		ad_hash;
+	PRInt32			ad_generation;
+	PRInt32			ad_client_generation;
+	int				ad_access;
+	int				ad_state;		/* key state bits */
+	int				ad_new_state;	/* state bits after the evaluation */
+	int				ad_result;
+	int				ad_nacis;
+	int				*ad_acis;		/* indexes of the acis which applied */
+	char			*ad_clientdn;
+	char			*ad_attr;
+} aclDecision;
+
+typedef struct acl_decision_cache {
+	int				adc_size;
+	aclDecision		*adc_slots;
+	PRLock			*adc_locks[ACLDECISION_NUM_LOCKS];
+} aclDecisionCache;
+
+static aclDecisionCache	*aclDecisions = NULL;
+
+/* Bumped to drop every cached decision */
+static PRInt32	acldecision_generation = 1;
+/* Bumped by any invalidation, to stop an evaluation in progress from being stored */
+static PRInt32	acldecision_change = 1;
+/* Bumped to drop the decisions taken for the bind identities hashing to them */
+static PRInt32	acldecision_client_generations[ACLDECISION_NUM_CLIENT_GENS];
+
+#define ACLDECISION_CLIENT_GEN(h)	( &acldecision_client_generations[(h) % ACLDECISION_NUM_CLIENT_GENS] )
+
+#define ACLDECISION_LOCK(i)		PR_Lock ( aclDecisions->adc_locks[(i) % ACLDECISION_NUM_LOCKS] )
+#define ACLDECISION_UNLOCK(i)	PR_Unlock ( aclDecisions->adc_locks[(i) % ACLDECISION_NUM_LOCKS] )
+
+static PRUint32		__acldecision__hash_str ( PRUint32 h, const char *s, int nocase );
+static PRUint32		__acldecision__hash_key ( const char *clientdn, const int *acis, int nacis,
+								const char *attr, int access, int state );
+static int			__acldecision__get_acis ( struct acl_pblock *aclpb );
+static void			__acldecision__clear_slot ( aclDecision *d );
+static const char *	__acldecision__get_clientdn ( struct acl_pblock *aclpb );
+
+int
+acldecision_init ()
+{
+	int i;
+
+	if ( acl_decision_cache_size <= 0 ) {
+		slapi_log_error ( SLAPI_LOG_PLUGIN, plugin_name,
+				"ACL decision cache is disabled\n" );
+		return 0;
+	}
+
+	aclDecisions = (aclDecisionCache *) slapi_ch_calloc ( 1, sizeof ( aclDecisionCache ) );
+	aclDecisions->adc_size = acl_decision_cache_size;
+	aclDecisions->adc_slots = (aclDecision *) slapi_ch_calloc ( acl_decision_cache_size,
+								sizeof ( aclDecision ) );
+	for ( i = 0; i < ACLDECISION_NUM_LOCKS; i++ ) {
+		if ( NULL == ( aclDecisions->adc_locks[i] = PR_NewLock () ) ) {
+			slapi_log_error ( SLAPI_LOG_FATAL, plugin_name,
+				"Unable to allocate locks for the ACL decision cache\n" );
+			acldecision_free ();
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void
+acldecision_free ()
+{
+	int i;
+
+	if ( NULL == aclDecisions ) return;
+
+	for ( i = 0; i < aclDecisions->adc_size; i++ ) {
+		__acldecision__clear_slot ( &aclDecisions->adc_slots[i] );
+	}
+	for ( i = 0; i < ACLDECISION_NUM_LOCKS; i++ ) {
+		if ( aclDecisions->adc_locks[i] ) PR_DestroyLock ( aclDecisions->adc_locks[i] );
+	}
+	slapi_ch_free ( (void **) &aclDecisions->adc_slots );
+	slapi_ch_free ( (void **) &aclDecisions );
+}
+
+/*
+ * acldecision_lookup
+ *
+ *	Look for a cached decision, once acl__scan_for_acis() has selected the
+ *	acis which apply to the resource. The ticket is filled in so that the
+ *	caller can store the result of its own evaluation with acldecision_store().
+ *
+ *	Returns:
+ *		LDAP_SUCCESS		- cached allow
+ *		LDAP_INSUFFICIENT_ACCESS - cached deny
+ *		-1			- nothing usable in the cache
+ *
+ *	ASSUMPTIONS: A reader lock has been obtained for the acl list.
+ */
+int
+acldecision_lookup ( struct acl_pblock *aclpb, const char *attr, int access,
+						aclDecisionTicket *ticket )
+{
+	const char		*clientdn;
+	aclDecision		*d;
+	PRUint32		hash, client_hash;
+	int				slot;
+	int				ret_val = -1;
+
+	ticket->adt_usable = 0;
+
+	if ( NULL == aclDecisions ) return -1;
+
+	/* Only plain READ and SEARCH rights are cached */
+	if ( access != SLAPI_ACL_READ && access != SLAPI_ACL_SEARCH ) return -1;
+	if ( aclpb->aclpb_res_type & ACLPB_EFFECTIVE_RIGHTS ) return -1;
+	if ( aclpb->aclpb_curr_attrVal ) return -1;
+	if ( aclpb->aclpb_decision_uncacheable ) return -1;
+	if ( NULL == ( clientdn = __acldecision__get_clientdn ( aclpb ) ) ) return -1;
+
+	if ( NULL == attr ) attr = "";
+
+	ticket->adt_usable = 1;
+	ticket->adt_generation = PR_AtomicAdd ( &acldecision_generation, 0 );
+	ticket->adt_change = PR_AtomicAdd ( &acldecision_change, 0 );
+	client_hash = __acldecision__hash_str ( 0, clientdn, 0 );
+	ticket->adt_client_generation = PR_AtomicAdd ( ACLDECISION_CLIENT_GEN ( client_hash ), 0 );
+	ticket->adt_state = aclpb->aclpb_state & ACLDECISION_KEY_MASK;
+	ticket->adt_nacis = __acldecision__get_acis ( aclpb );
+
+	hash = __acldecision__hash_key ( clientdn, aclpb->aclpb_decision_acis, ticket->adt_nacis,
+								attr, access, ticket->adt_state );
+	ticket->adt_hash = hash;
+	slot = hash % aclDecisions->adc_size;
+	d = &aclDecisions->adc_slots[slot];
+
+	ACLDECISION_LOCK ( slot );
+	if ( d->ad_clientdn && d->ad_hash == hash &&
+		 d->ad_generation == ticket->adt_generation &&
+		 d->ad_client_generation == ticket->adt_client_generation &&
+		 d->ad_access == access &&
+		 d->ad_state == ticket->adt_state &&
+		 d->ad_nacis == ticket->adt_nacis &&
+		 memcmp ( d->ad_acis, aclpb->aclpb_decision_acis, d->ad_nacis * sizeof ( int ) ) == 0 &&
+		 strcmp ( d->ad_clientdn, clientdn ) == 0 &&
+		 strcasecmp ( d->ad_attr, attr ) == 0 ) {
+
+		aclpb->aclpb_state &= ~ACLDECISION_STATE_MASK;
+		aclpb->aclpb_state |= d->ad_new_state;
+		ret_val = d->ad_result;
+	}
+	ACLDECISION_UNLOCK ( slot );
+
+	return ret_val;
+}
+
+/*
+ * acldecision_store
+ *
+ *	Cache the result of an evaluation started after acldecision_lookup()
+ *	filled in the ticket. Nothing is stored if the evaluation can not be
+ *	reused or if something was invalidated in the meantime.
+ *
+ *	ASSUMPTIONS: A reader lock has been obtained for the acl list.
+ */
+void
+acldecision_store ( struct acl_pblock *aclpb, const char *attr, int access,
+						aclDecisionTicket *ticket, int result )
+{
+	const char		*clientdn;
+	aclDecision		*d;
+	int				slot;
+
+	if ( NULL == aclDecisions || !ticket->adt_usable ) return;
+	if ( aclpb->aclpb_decision_uncacheable ) return;
+	if ( result != LDAP_SUCCESS && result != LDAP_INSUFFICIENT_ACCESS ) return;
+	if ( ticket->adt_change != PR_AtomicAdd ( &acldecision_change, 0 ) ) return;
+	if ( NULL == ( clientdn = __acldecision__get_clientdn ( aclpb ) ) ) return;
+
+	if ( NULL == attr ) attr = "";
+
+	slot = ticket->adt_hash % aclDecisions->adc_size;
+	d = &aclDecisions->adc_slots[slot];
+
+	ACLDECISION_LOCK ( slot );
+	__acldecision__clear_slot ( d );
+	d->ad_hash = ticket->adt_hash;
+	d->ad_generation = ticket->adt_generation;
+	d->ad_client_generation = ticket->adt_client_generation;
+	d->ad_access = access;
+	d->ad_state = ticket->adt_state;
+	d->ad_new_state = aclpb->aclpb_state & ACLDECISION_STATE_MASK;
+	d->ad_result = result;
+	d->ad_nacis = ticket->adt_nacis;
+	d->ad_acis = (int *) slapi_ch_malloc ( ( ticket->adt_nacis ? ticket->adt_nacis : 1 ) * sizeof ( int ) );
+	memcpy ( d->ad_acis, aclpb->aclpb_decision_acis, ticket->adt_nacis * sizeof ( int ) );
+	d->ad_clientdn = slapi_ch_strdup ( clientdn );
+	d->ad_attr = slapi_ch_strdup ( attr );
+	ACLDECISION_UNLOCK ( slot );
+}
+
+/*
+ * acldecision_invalidate_all
+ *
+ *	Drop every cached decision. Called when the acis or the groups change.
+ */
+void
+acldecision_invalidate_all ()
+{
+	PR_AtomicIncrement ( &acldecision_change );
+	PR_AtomicIncrement ( &acldecision_generation );
+}
+
+/*
+ * acldecision_invalidate
+ *
+ *	The entry n_dn has been changed: drop the decisions taken for it as
+ *	a bind identity. Its content may have been used by a userdn url or
+ *	a dynamic group.
+ */
+void
+acldecision_invalidate ( const char *n_dn )
+{
+	PR_AtomicIncrement ( &acldecision_change );
+
+	if ( NULL == aclDecisions || NULL == n_dn ) return;
+
+	PR_AtomicIncrement ( ACLDECISION_CLIENT_GEN ( __acldecision__hash_str ( 0, n_dn, 0 ) ) );
+}
+
+static const char *
+__acldecision__get_clientdn ( struct acl_pblock *aclpb )
+{
+	if ( NULL == aclpb->aclpb_authorization_sdn ) return NULL;
+	return slapi_sdn_get_ndn ( aclpb->aclpb_authorization_sdn );
+}
+
+/*
+ * Collect the indexes of the deny then allow acis selected by the last
+ * acl__scan_for_acis(), in the order acl__TestRights() evaluates them.
+ */
+static int
+__acldecision__get_acis ( struct acl_pblock *aclpb )
+{
+	int		needed = aclpb->aclpb_num_deny_handles + aclpb->aclpb_num_allow_handles;
+	int		n = 0;
+	int		i, k;
+
+	if ( needed > aclpb->aclpb_decision_acis_size ) {
+		aclpb->aclpb_decision_acis = (int *) slapi_ch_realloc (
+					(char *) aclpb->aclpb_decision_acis, needed * sizeof ( int ) );
+		aclpb->aclpb_decision_acis_size = needed;
+	}
+	for ( i = 0, k = 0; i < ACI_MAX_ELEVEL + aclpb->aclpb_num_deny_handles &&
+				k < aclpb->aclpb_num_deny_handles; i++ ) {
+		if ( NULL == aclpb->aclpb_deny_handles[i] ) {
+			if ( i <= ACI_MAX_ELEVEL ) continue;
+			break;
+		}
+		aclpb->aclpb_decision_acis[n++] = aclpb->aclpb_deny_handles[i]->aci_index;
+		k++;
+	}
+	for ( i = 0, k = 0; i < ACI_MAX_ELEVEL + aclpb->aclpb_num_allow_handles &&
+				k < aclpb->aclpb_num_allow_handles; i++ ) {
+		if ( NULL == aclpb->aclpb_allow_handles[i] ) {
+			if ( i <= ACI_MAX_ELEVEL ) continue;
+			break;
+		}
+		aclpb->aclpb_decision_acis[n++] = aclpb->aclpb_allow_handles[i]->aci_index;
+		k++;
+	}
+	return n;
+}
+
+static void
+__acldecision__clear_slot ( aclDecision *d )
+{
+	slapi_ch_free_string ( &d->ad_clientdn );
+	slapi_ch_free ( (void **) &d->ad_acis );
+	slapi_ch_free_string ( &d->ad_attr );
+	d->ad_nacis = 0;
+	d->ad_hash = 0;
+}
+
+/* FNV-1a */
+static PRUint32
+__acldecision__hash_str ( PRUint32 h, const char *s, int nocase )
+{
+	if ( 0 == h ) h = 2166136261U;
+	for ( ; *s; s++ ) {
+		h ^= (unsigned char) ( nocase ? tolower ( (unsigned char) *s ) : *s );
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static PRUint32
+__acldecision__hash_key ( const char *clientdn, const int *acis, int nacis,
+								const char *attr, int access, int state )
+{
+	PRUint32 h;
+	int i;
+
+	h = __acldecision__hash_str ( 0, clientdn, 0 );
+	for ( i = 0; i < nacis; i++ ) {
+		h ^= (PRUint32) acis[i];
+		h *= 16777619U;
+	}
+	h = __acldecision__hash_str ( h ^ 0x02, attr, 1 );
+	h ^= (PRUint32) access;
+	h *= 16777619U;
+	h ^= (PRUint32) state;
+	h *= 16777619U;
+	return h;
+}
@@ -406,6 +406,7 @@ void
 aclg_regen_group_signature( )
 {
 	aclUserGroups->aclg_signature = aclutil_gen_signature ( aclUserGroups->aclg_signature );
+	acldecision_invalidate_all ();
 }
 
 void
@@ -0,0 +1,894 @@
+/** BEGIN COPYRIGHT BLOCK
+ * Copyright (C) 2015 Red Hat, Inc.
+ * All rights reserved.
+ *
+ * License: GPL (version 3 or any later version).
+ * See LICENSE for details.
+ * END COPYRIGHT BLOCK **/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "acl.h"
+
+/***************************************************************************
+ *
+ * This module deals with the global group membership index.
+ *
+ * To find out if a user is a member of a group, acllas__user_ismember_of_group()
+ * walks down the group and its nested groups with one internal search per
+ * group, and the result is only kept in the cache of that user, which is
+ * dropped whenever any group changes.
+ *
+ * The index keeps, for all the static groups of the local backends:
+ *	- group ndn  -> direct members, nested groups, has dynamic members
+ *	- member ndn -> groups which list it as a member
+ * so that a membership is resolved by walking up from the user in memory.
+ *
+ * The index is built by a thread at startup and rebuilt when a backend
+ * goes on or off line. Afterwards it is updated in place by the be txn
+ * post operation plugin registered by acl_init(), so no internal search
+ * is needed while evaluating an aci. The be txn post operations of a
+ * backend run under its serial lock, so the index sees the changes in
+ * commit order. The changes seen while the index is being built are
+ * queued, and replayed on the new index once the build is done.
+ *
+ * A be txn post operation can still be followed by an abort (a later
+ * plugin failing, or the parent operation of an internal operation).
+ * The post operation plugins check the result of the outermost operation
+ * which updated the index, and have it rebuilt if it failed.
+ *
+ * The index does not know how to evaluate memberURL and
+ * memberCertificateDescription: when a group reachable from the evaluated
+ * group has any, or if the index is not built yet, ACL_DONT_KNOW is
+ * returned and the caller falls back to the internal searches.
+ **************************************************************************/
+
+#define ACLGI_STATE_OFF			0	/* disabled, or not built yet */
+#define ACLGI_STATE_BUILDING	1
+#define ACLGI_STATE_READY		2
+#define ACLGI_STATE_FAILED		3	/* the build failed, until the next rebuild */
+
+#define ACLGI_INCR_LIST			8
+
+typedef struct acl_groupindex_group {
+	char			*agg_ndn;
+	char			**agg_members;		/* direct members */
+	int				agg_nmembers;
+	char			**agg_subgroups;	/* members which are groups: their agg_ndn */
+	int				agg_nsubgroups;
+	int				agg_maxsubgroups;
+	int				agg_dynamic;		/* has memberURL or memberCertificateDescription */
+} aclGroupIndexGroup;
+
+typedef struct acl_groupindex_member {
+	char			*agm_ndn;
+	char			**agm_groups;		/* agg_ndn of the groups listing this dn */
+	int				agm_ngroups;
+	int				agm_maxgroups;
+} aclGroupIndexMember;
+
+/* A group change seen while the index is not READY */
+typedef struct acl_groupindex_change {
+	char			*agc_old_ndn;		/* group before the change, if any */
+	struct acl_groupindex_group	*agc_group;	/* group after the change, if any */
+	struct acl_groupindex_change	*agc_next;
+} aclGroupIndexChange;
+
+typedef struct acl_groupindex {
+	Slapi_RWLock	*agi_rwlock;
+	PLHashTable		*agi_groups;		/* ndn -> aclGroupIndexGroup */
+	PLHashTable		*agi_members;		/* ndn -> aclGroupIndexMember */
+	int				agi_state;
+	PRUint32		agi_rebuilds;		/* rebuild requests */
+	aclGroupIndexChange	*agi_queue;		/* changes seen while not READY, in order */
+	aclGroupIndexChange	**agi_queue_tail;
+
+	Slapi_Mutex		*agi_build_lock;
+	Slapi_CondVar	*agi_build_cv;
+	int				agi_build_requested;
+	int				agi_stopping;
+	PRThread		*agi_build_thread;
+} aclGroupIndex;
+
+static aclGroupIndex	*aclGroupIdx = NULL;
+
+/* Set while the current operation of a thread has updated the index */
+static PRUintn		aclgi_thread_updated;
+
+static char *const	aclgi_filter_groups = "(|(objectclass=groupOfNames)(objectclass=groupOfUniqueNames)(objectclass=groupOfCertificates)(objectclass=groupOfURLs))";
+
+static void			__aclgi__build_thread ( void *arg );
+static int			__aclgi__build ( PLHashTable **groups, PLHashTable **members );
+static int			__aclgi__build_handler ( Slapi_Entry *e, void *callback_data );
+static int			__aclgi__is_group ( Slapi_Entry *e );
+static aclGroupIndexGroup *	__aclgi__new_group ( Slapi_Entry *e );
+static void			__aclgi__link_group ( PLHashTable *groups, PLHashTable *members,
+								aclGroupIndexGroup *g );
+static void			__aclgi__unlink_group ( PLHashTable *groups, PLHashTable *members,
+								const char *ndn );
+static void			__aclgi__free_group ( aclGroupIndexGroup *g );
+static void			__aclgi__apply ( PLHashTable *groups, PLHashTable *members,
+								const char *old_ndn, aclGroupIndexGroup *g );
+static void			__aclgi__free_queue ( aclGroupIndexChange *c );
+static PLHashTable *	__aclgi__new_table ( void );
+static void			__aclgi__free_tables ( PLHashTable *groups, PLHashTable *members );
+static void			__aclgi__add_ptr ( char ***list, int *num, int *max, char *s );
+static void			__aclgi__remove_ptr ( char **list, int *num, const char *s );
+static char *		__aclgi__key ( const char *dn );
+
+int
+aclgroupindex_init ()
+{
+	if ( !acl_group_index_enabled ) {
+		slapi_log_error ( SLAPI_LOG_ACL, plugin_name,
+				"Group membership index is disabled\n" );
+		return 0;
+	}
+
+	aclGroupIdx = (aclGroupIndex *) slapi_ch_calloc ( 1, sizeof ( aclGroupIndex ) );
+	aclGroupIdx->agi_rwlock = slapi_new_rwlock ();
+	aclGroupIdx->agi_build_lock = slapi_new_mutex ();
+	if ( aclGroupIdx->agi_build_lock ) {
+		aclGroupIdx->agi_build_cv = slapi_new_condvar ( aclGroupIdx->agi_build_lock );
+	}
+	if ( NULL == aclGroupIdx->agi_rwlock || NULL == aclGroupIdx->agi_build_cv ) {
+		slapi_log_error ( SLAPI_LOG_FATAL, plugin_name,
+				"Unable to allocate the locks of the group membership index\n" );
+		aclgroupindex_free ();
+		return 1;
+	}
+	if ( PR_NewThreadPrivateIndex ( &aclgi_thread_updated, NULL ) != PR_SUCCESS ) {
+		slapi_log_error ( SLAPI_LOG_FATAL, plugin_name,
+				"Unable to allocate the thread data of the group membership index\n" );
+		aclgroupindex_free ();
+		return 1;
+	}
+	aclGroupIdx->agi_state = ACLGI_STATE_OFF;
+	aclGroupIdx->agi_queue_tail = &aclGroupIdx->agi_queue;
+	aclGroupIdx->agi_build_requested = 1;
+
+	aclGroupIdx->agi_build_thread = PR_CreateThread ( PR_USER_THREAD,
+					__aclgi__build_thread,
+					NULL,
+					PR_PRIORITY_NORMAL,
+					PR_GLOBAL_THREAD,
+					PR_JOINABLE_THREAD,
+					SLAPD_DEFAULT_THREAD_STACKSIZE );
+	if ( NULL == aclGroupIdx->agi_build_thread ) {
+		slapi_log_error ( SLAPI_LOG_FATAL, plugin_name,
+				"Unable to start the group membership index thread\n" );
+		aclgroupindex_free ();
+		return 1;
+	}
+	return 0;
+}
+
+void
+aclgroupindex_free ()
+{
+	if ( NULL == aclGroupIdx ) return;
+
+	if ( aclGroupIdx->agi_build_thread ) {
+		slapi_lock_mutex ( aclGroupIdx->agi_build_lock );
+		aclGroupIdx->agi_stopping = 1;
+		slapi_notify_condvar ( aclGroupIdx->agi_build_cv, 1 );
+		slapi_unlock_mutex ( aclGroupIdx->agi_build_lock );
+		PR_JoinThread ( aclGroupIdx->agi_build_thread );
+	}
+
+	__aclgi__free_tables ( aclGroupIdx->agi_groups, aclGroupIdx->agi_members );
+	__aclgi__free_queue ( aclGroupIdx->agi_queue );
+	if ( aclGroupIdx->agi_build_cv ) slapi_destroy_condvar ( aclGroupIdx->agi_build_cv );
+	if ( aclGroupIdx->agi_build_lock ) slapi_destroy_mutex ( aclGroupIdx->agi_build_lock );
+	if ( aclGroupIdx->agi_rwlock ) slapi_destroy_rwlock ( aclGroupIdx->agi_rwlock );
+	slapi_ch_free ( (void **) &aclGroupIdx );
+}
+
+/*
+ * Drop the index and have the thread build it again. Used when a backend
+ * goes on or off line, as its groups appear or disappear without any
+ * operation, and when an operation which updated the index failed.
+ */
+void
+aclgroupindex_rebuild ()
+{
+	if ( NULL == aclGroupIdx ) return;
+
+	slapi_rwlock_wrlock ( aclGroupIdx->agi_rwlock );
+	__aclgi__free_tables ( aclGroupIdx->agi_groups, aclGroupIdx->agi_members );
+	aclGroupIdx->agi_groups = NULL;
+	aclGroupIdx->agi_members = NULL;
+	aclGroupIdx->agi_state = ACLGI_STATE_OFF;
+	aclGroupIdx->agi_rebuilds++;
+	slapi_rwlock_unlock ( aclGroupIdx->agi_rwlock );
+
+	slapi_lock_mutex ( aclGroupIdx->agi_build_lock );
+	aclGroupIdx->agi_build_requested = 1;
+	slapi_notify_condvar ( aclGroupIdx->agi_build_cv, 1 );
+	slapi_unlock_mutex ( aclGroupIdx->agi_build_lock );
+}
+
+/*
+ * aclgroupindex_ismember
+ *
+ *	Is user_ndn a member of group_ndn, directly or through at most
+ *	max_nestlevel levels of nested groups?
+ *
+ *	Returns:
+ *		ACL_TRUE		- member
+ *		ACL_FALSE		- not a member
+ *		ACL_DONT_KNOW	- the index can not tell, use the internal searches
+ */
+int
+aclgroupindex_ismember ( const char *group_ndn, const char *user_ndn, int max_nestlevel )
+{
+	aclGroupIndexGroup	*g, *sg;
+	aclGroupIndexMember	*m;
+	char		*group_key = NULL;
+	char		*user_key = NULL;
+	char		**visited = NULL;
+	int			nvisited = 0;
+	int			maxvisited = 0;
+	int			level_start, level_end;
+	int			level;
+	int			truncated = 0;
+	int			result = ACL_FALSE;
+	int			i, j, k;
+
+	if ( NULL == aclGroupIdx || NULL == group_ndn ) return ACL_DONT_KNOW;
+
+	group_key = __aclgi__key ( group_ndn );
+
+	slapi_rwlock_rdlock ( aclGroupIdx->agi_rwlock );
+	if ( aclGroupIdx->agi_state != ACLGI_STATE_READY ) {
+		result = ACL_DONT_KNOW;
+		goto done;
+	}
+
+	g = (aclGroupIndexGroup *) PL_HashTableLookupConst ( aclGroupIdx->agi_groups, group_key );
+	if ( NULL == g ) {
+		/* Not a local group: the search would not find it either */
+		goto done;
+	}
+
+	/*
+	 * Walk up from the user, one nesting level at a time: the groups
+	 * listing the user are level 0, the groups listing them level 1...
+	 */
+	if ( user_ndn && *user_ndn ) {
+		user_key = __aclgi__key ( user_ndn );
+		m = (aclGroupIndexMember *) PL_HashTableLookupConst ( aclGroupIdx->agi_members, user_key );
+		if ( m ) {
+			for ( i = 0; i < m->agm_ngroups; i++ ) {
+				__aclgi__add_ptr ( &visited, &nvisited, &maxvisited, m->agm_groups[i] );
+			}
+		}
+		level_start = 0;
+		for ( level = 0; level_start < nvisited; level++ ) {
+			level_end = nvisited;
+			for ( i = level_start; i < level_end; i++ ) {
+				if ( strcmp ( visited[i], g->agg_ndn ) == 0 ) {
+					result = ACL_TRUE;
+					goto done;
+				}
+			}
+			if ( level >= max_nestlevel ) {
+				/* the walk down below tells if we gave up too early */
+				break;
+			}
+			for ( i = level_start; i < level_end; i++ ) {
+				m = (aclGroupIndexMember *) PL_HashTableLookupConst ( aclGroupIdx->agi_members,
+											visited[i] );
+				if ( NULL == m ) continue;
+				for ( j = 0; j < m->agm_ngroups; j++ ) {
+					for ( k = 0; k < nvisited; k++ ) {
+						if ( visited[k] == m->agm_groups[j] ) break;
+					}
+					if ( k == nvisited ) {
+						__aclgi__add_ptr ( &visited, &nvisited, &maxvisited, m->agm_groups[j] );
+					}
+				}
+			}
+			level_start = level_end;
+		}
+	}
+
+	/*
+	 * Not found by the static members. The answer is only known if none of
+	 * the groups below the evaluated one has dynamic members, and if the
+	 * groups below it are not nested deeper than max_nestlevel (in which
+	 * case the walk up may have stopped too early).
+	 */
+	nvisited = 0;
+	__aclgi__add_ptr ( &visited, &nvisited, &maxvisited, g->agg_ndn );
+	level_start = 0;
+	for ( level = 0; level_start < nvisited; level++ ) {
+		level_end = nvisited;
+		for ( i = level_start; i < level_end; i++ ) {
+			sg = (aclGroupIndexGroup *) PL_HashTableLookupConst ( aclGroupIdx->agi_groups,
+											visited[i] );
+			if ( NULL == sg ) continue;
+			if ( sg->agg_dynamic ) {
+				result = ACL_DONT_KNOW;
+				goto done;
+			}
+			if ( level >= max_nestlevel ) {
+				if ( sg->agg_nsubgroups ) truncated = 1;
+				continue;
+			}
+			for ( j = 0; j < sg->agg_nsubgroups; j++ ) {
+				for ( k = 0; k < nvisited; k++ ) {
+					if ( visited[k] == sg->agg_subgroups[j] ) break;
+				}
+				if ( k == nvisited ) {
+					__aclgi__add_ptr ( &visited, &nvisited, &maxvisited, sg->agg_subgroups[j] );
+				}
+			}
+		}
+		level_start = level_end;
+	}
+	if ( truncated ) {
+		result = ACL_DONT_KNOW;
+	}
+
+done:
+	slapi_rwlock_unlock ( aclGroupIdx->agi_rwlock );
+	slapi_ch_free ( (void **) &visited );
+	slapi_ch_free_string ( &user_key );
+	slapi_ch_free_string ( &group_key );
+	return result;
+}
+
+/*
+ * aclgroupindex_betxn_post_op
+ *
+ *	Be txn post operation plugin function: update the index if the entry
+ *	is, or was, a group, or queue the change while the index is not READY.
+ */
+int
+aclgroupindex_betxn_post_op ( Slapi_PBlock *pb )
+{
+	Slapi_Backend	*be = NULL;
+	Slapi_DN		*sdn = NULL;
+	Slapi_Entry		*pre_e = NULL;
+	Slapi_Entry		*post_e = NULL;
+	aclGroupIndexGroup	*g = NULL;
+	aclGroupIndexChange	*c;
+	const char		*old_ndn = NULL;
+	int				optype = 0;
+	int				rc = 0;
+
+	if ( NULL == aclGroupIdx ) return SLAPI_PLUGIN_SUCCESS;
+
+	slapi_pblock_get ( pb, SLAPI_PLUGIN_OPRETURN, &rc );
+	if ( rc ) return SLAPI_PLUGIN_SUCCESS;
+
+	/* the groups of remote backends are not evaluated */
+	slapi_pblock_get ( pb, SLAPI_BACKEND, &be );
+	if ( NULL == be || slapi_be_is_flag_set ( be, SLAPI_BE_FLAG_REMOTE_DATA )) {
+		return SLAPI_PLUGIN_SUCCESS;
+	}
+
+	slapi_pblock_get ( pb, SLAPI_OPERATION_TYPE, &optype );
+	slapi_pblock_get ( pb, SLAPI_TARGET_SDN, &sdn );
+	if ( optype != SLAPI_OPERATION_ADD ) {
+		slapi_pblock_get ( pb, SLAPI_ENTRY_PRE_OP, &pre_e );
+	}
+	if ( optype != SLAPI_OPERATION_DELETE ) {
+		slapi_pblock_get ( pb, SLAPI_ENTRY_POST_OP, &post_e );
+		if ( NULL == post_e && optype == SLAPI_OPERATION_ADD ) {
+			slapi_pblock_get ( pb, SLAPI_ADD_ENTRY, &post_e );
+		}
+	}
+
+	if ( !__aclgi__is_group ( pre_e ) && !__aclgi__is_group ( post_e )) {
+		return SLAPI_PLUGIN_SUCCESS;
+	}
+
+	/* Build the new node before taking the lock */
+	if ( post_e && __aclgi__is_group ( post_e )) {
+		g = __aclgi__new_group ( post_e );
+	}
+	if ( pre_e ) {
+		old_ndn = slapi_entry_get_ndn ( pre_e );
+	} else if ( sdn ) {
+		old_ndn = slapi_sdn_get_ndn ( sdn );
+	}
+
+	slapi_rwlock_wrlock ( aclGroupIdx->agi_rwlock );
+	if ( aclGroupIdx->agi_state == ACLGI_STATE_READY ) {
+		__aclgi__apply ( aclGroupIdx->agi_groups, aclGroupIdx->agi_members, old_ndn, g );
+	} else if ( aclGroupIdx->agi_state == ACLGI_STATE_FAILED ) {
+		__aclgi__free_group ( g );
+	} else {
+		/* The build may not see this change: replay it on the new index */
+		c = (aclGroupIndexChange *) slapi_ch_calloc ( 1, sizeof ( aclGroupIndexChange ));
+		c->agc_old_ndn = slapi_ch_strdup ( old_ndn );
+		c->agc_group = g;
+		*aclGroupIdx->agi_queue_tail = c;
+		aclGroupIdx->agi_queue_tail = &c->agc_next;
+	}
+	slapi_rwlock_unlock ( aclGroupIdx->agi_rwlock );
+	PR_SetThreadPrivate ( aclgi_thread_updated, (void *) aclGroupIdx );
+
+	slapi_log_error ( SLAPI_LOG_ACL, plugin_name,
+			"Group membership index updated for %s\n",
+			sdn ? slapi_sdn_get_dn ( sdn ) : "NULL" );
+	return SLAPI_PLUGIN_SUCCESS;
+}
+
+/*
+ * aclgroupindex_post_op
+ *
+ *	Post operation plugin function (external and internal operations):
+ *	once the outermost operation which updated the index is over, have
+ *	the index rebuilt if that operation was aborted.
+ */
+int
+aclgroupindex_post_op ( Slapi_PBlock *pb )
+{
+	void			*txn = NULL;
+	int				rc = 0;
+
+	if ( NULL == aclGroupIdx ) return SLAPI_PLUGIN_SUCCESS;
+
+	/* Still inside the transaction of a parent operation */
+	slapi_pblock_get ( pb, SLAPI_TXN, &txn );
+	if ( txn ) return SLAPI_PLUGIN_SUCCESS;
+
+	if ( NULL == PR_GetThreadPrivate ( aclgi_thread_updated )) return SLAPI_PLUGIN_SUCCESS;
+	PR_SetThreadPrivate ( aclgi_thread_updated, NULL );
+
+	slapi_pblock_get ( pb, SLAPI_PLUGIN_OPRETURN, &rc );
+	if ( rc ) {
+		slapi_log_error ( SLAPI_LOG_ACL, plugin_name,
+				"Group change aborted (%d), rebuilding the group membership index\n", rc );
+		aclgroupindex_rebuild ();
+	}
+	return SLAPI_PLUGIN_SUCCESS;
+}
+
+/*
+ * The build thread: builds the index when asked to, until the plugin stops.
+ */
+static void
+__aclgi__build_thread ( void *arg )
+{
+	PLHashTable		*groups, *members;
+	aclGroupIndexChange	*c, *queue;
+	PRUint32		rebuilds;
+	int				nreplayed;
+
+	while ( 1 ) {
+		slapi_lock_mutex ( aclGroupIdx->agi_build_lock );
+		while ( !aclGroupIdx->agi_build_requested && !aclGroupIdx->agi_stopping ) {
+			slapi_wait_condvar ( aclGroupIdx->agi_build_cv, NULL );
+		}
+		aclGroupIdx->agi_build_requested = 0;
+		slapi_unlock_mutex ( aclGroupIdx->agi_build_lock );
+		if ( aclGroupIdx->agi_stopping ) break;
+
+		slapi_rwlock_wrlock ( aclGroupIdx->agi_rwlock );
+		aclGroupIdx->agi_state = ACLGI_STATE_BUILDING;
+		rebuilds = aclGroupIdx->agi_rebuilds;
+		slapi_rwlock_unlock ( aclGroupIdx->agi_rwlock );
+
+		groups = members = NULL;
+		if ( __aclgi__build ( &groups, &members ) != 0 ) {
+			__aclgi__free_tables ( groups, members );
+			slapi_rwlock_wrlock ( aclGroupIdx->agi_rwlock );
+			aclGroupIdx->agi_state = ( rebuilds == aclGroupIdx->agi_rebuilds ) ?
+							ACLGI_STATE_FAILED : ACLGI_STATE_OFF;
+			queue = aclGroupIdx->agi_queue;
+			aclGroupIdx->agi_queue = NULL;
+			aclGroupIdx->agi_queue_tail = &aclGroupIdx->agi_queue;
+			slapi_rwlock_unlock ( aclGroupIdx->agi_rwlock );
+			__aclgi__free_queue ( queue );
+			continue;
+		}
+
+		/*
+		 * The searches may or may not have seen the changes made in the
+		 * meantime: replaying them in order gives the state of the last one.
+		 */
+		nreplayed = 0;
+		slapi_rwlock_wrlock ( aclGroupIdx->agi_rwlock );
+		queue = aclGroupIdx->agi_queue;
+		aclGroupIdx->agi_queue = NULL;
+		aclGroupIdx->agi_queue_tail = &aclGroupIdx->agi_queue;
+		if ( rebuilds == aclGroupIdx->agi_rebuilds ) {
+			for ( c = queue; c; c = c->agc_next ) {
+				__aclgi__apply ( groups, members, c->agc_old_ndn, c->agc_group );
+				c->agc_group = NULL;
+				nreplayed++;
+			}
+			aclGroupIdx->agi_groups = groups;
+			aclGroupIdx->agi_members = members;
+			aclGroupIdx->agi_state = ACLGI_STATE_READY;
+			groups = members = NULL;
+		} else {
+			/* Dropped while we were searching: a new build has been requested */
+			aclGroupIdx->agi_state = ACLGI_STATE_OFF;
+		}
+		slapi_rwlock_unlock ( aclGroupIdx->agi_rwlock );
+
+		__aclgi__free_queue ( queue );
+		if ( groups ) {
+			__aclgi__free_tables ( groups, members );
+		} else {
+			slapi_log_error ( SLAPI_LOG_PLUGIN, plugin_name,
+					"Group membership index built, %d changes replayed\n", nreplayed );
+		}
+	}
+}
+
+/* Groups found by the build searches */
+typedef struct acl_groupindex_build {
+	aclGroupIndexGroup	**agb_groups;
+	int					agb_ngroups;
+	int					agb_maxgroups;
+} aclGroupIndexBuild;
+
+/*
+ * Search the groups of all the local suffixes and index them.
+ */
+static int
+__aclgi__build ( PLHashTable **groups, PLHashTable **members )
+{
+	char			*attrs[6];
+	Slapi_PBlock	*aPb;
+	Slapi_DN		*sdn;
+	void			*node;
+	int				rc = 0;
+	aclGroupIndexBuild	build = {0};
+	int				ngroups = 0;
+	int				i;
+
+	attrs[0] = "objectclass";
+	attrs[1] = "member";
+	attrs[2] = "uniquemember";
+	attrs[3] = "memberURL";
+	attrs[4] = "memberCertificateDescription";
+	attrs[5] = NULL;
+
+	*groups = __aclgi__new_table ();
+	*members = __aclgi__new_table ();
+	if ( NULL == *groups || NULL == *members ) return 1;
+
+	sdn = slapi_get_first_suffix ( &node, 1 );
+	while ( sdn && !aclGroupIdx->agi_stopping && rc == 0 ) {
+		aPb = slapi_pblock_new ();
+		slapi_search_internal_set_pb ( aPb,
+						slapi_sdn_get_dn ( sdn ),
+						LDAP_SCOPE_SUBTREE,
+						aclgi_filter_groups,
+						attrs,
+						0 /* attrsonly */,
+						NULL /* controls */,
+						NULL /* uniqueid */,
+						aclplugin_get_identity ( ACL_PLUGIN_IDENTITY ),
+						SLAPI_OP_FLAG_NEVER_CHAIN );
+		slapi_search_internal_callback_pb ( aPb, &build,
+						NULL /* result_callback */,
+						__aclgi__build_handler,
+						NULL /* referral_callback */ );
+		slapi_pblock_get ( aPb, SLAPI_PLUGIN_INTOP_RESULT, &rc );
+		slapi_pblock_destroy ( aPb );
+		if ( rc == LDAP_NO_SUCH_OBJECT ) {
+			rc = 0;
+		} else if ( rc != LDAP_SUCCESS ) {
+			slapi_log_error ( SLAPI_LOG_FATAL, plugin_name,
+					"Unable to search the groups of %s (%d), the group membership "
+					"index is not used\n", slapi_sdn_get_dn ( sdn ), rc );
+		}
+		sdn = slapi_get_next_suffix ( &node, 1 );
+	}
+	if ( aclGroupIdx->agi_stopping ) rc = 1;
+
+	/* Now that all the groups are known, link them */
+	for ( i = 0; i < build.agb_ngroups; i++ ) {
+		aclGroupIndexGroup *g = build.agb_groups[i];
+
+		if ( rc || PL_HashTableLookupConst ( *groups, g->agg_ndn )) {
+			/* same group seen through two suffixes */
+			__aclgi__free_group ( g );
+			continue;
+		}
+		__aclgi__link_group ( *groups, *members, g );
+		ngroups++;
+	}
+	slapi_ch_free ( (void **) &build.agb_groups );
+
+	if ( rc == 0 ) {
+		slapi_log_error ( SLAPI_LOG_ACL, plugin_name,
+				"Group membership index: %d groups\n", ngroups );
+	}
+	return rc;
+}
+
+static int
+__aclgi__build_handler ( Slapi_Entry *e, void *callback_data )
+{
+	aclGroupIndexBuild	*build = (aclGroupIndexBuild *) callback_data;
+	aclGroupIndexGroup	*g;
+
+	if ( aclGroupIdx->agi_stopping ) return -1;
+	if ( NULL == e ) return 0;
+
+	if ( NULL == ( g = __aclgi__new_group ( e ))) return 0;
+	if ( build->agb_ngroups == build->agb_maxgroups ) {
+		build->agb_maxgroups = build->agb_maxgroups ? 2 * build->agb_maxgroups : 64;
+		build->agb_groups = (aclGroupIndexGroup **) slapi_ch_realloc (
+							(char *) build->agb_groups,
+							build->agb_maxgroups * sizeof ( aclGroupIndexGroup * ));
+	}
+	build->agb_groups[build->agb_ngroups++] = g;
+	return 0;
+}
+
+static int
+__aclgi__is_group ( Slapi_Entry *e )
+{
+	if ( NULL == e ) return 0;
+
+	return ( slapi_entry_attr_hasvalue ( e, "objectclass", "groupOfNames" ) ||
+			 slapi_entry_attr_hasvalue ( e, "objectclass", "groupOfUniqueNames" ) ||
+			 slapi_entry_attr_hasvalue ( e, "objectclass", "groupOfCertificates" ) ||
+			 slapi_entry_attr_hasvalue ( e, "objectclass", "groupOfURLs" ));
+}
+
+/*
+ * Make a group node out of a group entry. The node is not linked yet.
+ */
+static aclGroupIndexGroup *
+__aclgi__new_group ( Slapi_Entry *e )
+{
+	aclGroupIndexGroup	*g;
+	Slapi_Attr			*attr;
+	Slapi_Value			*sval;
+	const struct berval	*bv;
+	char				*types[3];
+	int					nvalues;
+	int					t, i;
+
+	types[0] = "member";
+	types[1] = "uniquemember";
+	types[2] = NULL;
+
+	g = (aclGroupIndexGroup *) slapi_ch_calloc ( 1, sizeof ( aclGroupIndexGroup ));
+	g->agg_ndn = __aclgi__key ( slapi_entry_get_ndn ( e ));
+
+	nvalues = 0;
+	for ( t = 0; types[t]; t++ ) {
+		int n = 0;
+		if ( slapi_entry_attr_find ( e, types[t], &attr ) == 0 ) {
+			slapi_attr_get_numvalues ( attr, &n );
+			nvalues += n;
+		}
+	}
+	if ( nvalues ) {
+		g->agg_members = (char **) slapi_ch_calloc ( nvalues, sizeof ( char * ));
+	}
+
+	for ( t = 0; types[t]; t++ ) {
+		if ( slapi_entry_attr_find ( e, types[t], &attr ) != 0 ) continue;
+
+		for ( i = slapi_attr_first_value ( attr, &sval ); i != -1 && g->agg_nmembers < nvalues;
+				i = slapi_attr_next_value ( attr, i, &sval )) {
+			char *n_dn;
+
+			bv = slapi_value_get_berval ( sval );
+			if ( NULL == bv || NULL == bv->bv_val ) continue;
+			if ( NULL == ( n_dn = slapi_create_dn_string ( "%s", bv->bv_val ))) {
+				slapi_log_error ( SLAPI_LOG_ACL, plugin_name,
+						"Group membership index: invalid member %s in %s\n",
+						bv->bv_val, slapi_entry_get_dn_const ( e ));
+				continue;
+			}
+			g->agg_members[g->agg_nmembers++] = slapi_dn_ignore_case ( n_dn );
+		}
+	}
+
+	if ( slapi_entry_attr_find ( e, "memberURL", &attr ) == 0 ||
+		 slapi_entry_attr_find ( e, "memberCertificateDescription", &attr ) == 0 ) {
+		g->agg_dynamic = 1;
+	}
+	return g;
+}
+
+/*
+ * Insert a group node: register it as a group of each of its members,
+ * find its nested groups, and add it to the nested groups of the
+ * groups listing it.
+ */
+static void
+__aclgi__link_group ( PLHashTable *groups, PLHashTable *members, aclGroupIndexGroup *g )
+{
+	aclGroupIndexGroup	*sg;
+	aclGroupIndexMember	*m;
+	int					i;
+
+	PL_HashTableAdd ( groups, g->agg_ndn, g );
+
+	for ( i = 0; i < g->agg_nmembers; i++ ) {
+		if ( NULL == ( m = (aclGroupIndexMember *) PL_HashTableLookupConst ( members,
+											g->agg_members[i] ))) {
+			m = (aclGroupIndexMember *) slapi_ch_calloc ( 1, sizeof ( aclGroupIndexMember ));
+			m->agm_ndn = slapi_ch_strdup ( g->agg_members[i] );
+			PL_HashTableAdd ( members, m->agm_ndn, m );
+		}
+		__aclgi__add_ptr ( &m->agm_groups, &m->agm_ngroups, &m->agm_maxgroups, g->agg_ndn );
+
+		sg = (aclGroupIndexGroup *) PL_HashTableLookupConst ( groups, g->agg_members[i] );
+		if ( sg ) {
+			__aclgi__add_ptr ( &g->agg_subgroups, &g->agg_nsubgroups,
+								&g->agg_maxsubgroups, sg->agg_ndn );
+		}
+	}
+
+	if (( m = (aclGroupIndexMember *) PL_HashTableLookupConst ( members, g->agg_ndn ))) {
+		for ( i = 0; i < m->agm_ngroups; i++ ) {
+			sg = (aclGroupIndexGroup *) PL_HashTableLookupConst ( groups, m->agm_groups[i] );
+			if ( sg ) {
+				__aclgi__add_ptr ( &sg->agg_subgroups, &sg->agg_nsubgroups,
+									&sg->agg_maxsubgroups, g->agg_ndn );
+			}
+		}
+	}
+}
+
+/*
+ * Remove a group node, if there is one for ndn, and free it.
+ */
+static void
+__aclgi__unlink_group ( PLHashTable *groups, PLHashTable *members, const char *ndn )
+{
+	aclGroupIndexGroup	*g, *sg;
+	aclGroupIndexMember	*m;
+	char				*key;
+	int					i;
+
+	key = __aclgi__key ( ndn );
+	g = (aclGroupIndexGroup *) PL_HashTableLookupConst ( groups, key );
+	slapi_ch_free_string ( &key );
+	if ( NULL == g ) return;
+
+	for ( i = 0; i < g->agg_nmembers; i++ ) {
+		m = (aclGroupIndexMember *) PL_HashTableLookupConst ( members, g->agg_members[i] );
+		if ( NULL == m ) continue;
+		__aclgi__remove_ptr ( m->agm_groups, &m->agm_ngroups, g->agg_ndn );
+		if ( 0 == m->agm_ngroups ) {
+			PL_HashTableRemove ( members, m->agm_ndn );
+			slapi_ch_free ( (void **) &m->agm_groups );
+			slapi_ch_free_string ( &m->agm_ndn );
+			slapi_ch_free ( (void **) &m );
+		}
+	}
+
+	if (( m = (aclGroupIndexMember *) PL_HashTableLookupConst ( members, g->agg_ndn ))) {
+		for ( i = 0; i < m->agm_ngroups; i++ ) {
+			sg = (aclGroupIndexGroup *) PL_HashTableLookupConst ( groups, m->agm_groups[i] );
+			if ( sg ) {
+				__aclgi__remove_ptr ( sg->agg_subgroups, &sg->agg_nsubgroups, g->agg_ndn );
+			}
+		}
+	}
+
+	PL_HashTableRemove ( groups, g->agg_ndn );
+	__aclgi__free_group ( g );
+}
+
+/*
+ * Replace the group node of old_ndn, if any, by g, if any.
+ */
+static void
+__aclgi__apply ( PLHashTable *groups, PLHashTable *members,
+					const char *old_ndn, aclGroupIndexGroup *g )
+{
+	if ( old_ndn ) {
+		__aclgi__unlink_group ( groups, members, old_ndn );
+	}
+	if ( g ) {
+		__aclgi__unlink_group ( groups, members, g->agg_ndn );
+		__aclgi__link_group ( groups, members, g );
+	}
+}
+
+static void
+__aclgi__free_queue ( aclGroupIndexChange *c )
+{
+	aclGroupIndexChange *next;
+
+	for ( ; c; c = next ) {
+		next = c->agc_next;
+		__aclgi__free_group ( c->agc_group );
+		slapi_ch_free_string ( &c->agc_old_ndn );
+		slapi_ch_free ( (void **) &c );
+	}
+}
+
+static void
+__aclgi__free_group ( aclGroupIndexGroup *g )
+{
+	int i;
+
+	if ( NULL == g ) return;
+
+	for ( i = 0; i < g->agg_nmembers; i++ ) {
+		slapi_ch_free_string ( &g->agg_members[i] );
+	}
+	slapi_ch_free ( (void **) &g->agg_members );
+	slapi_ch_free ( (void **) &g->agg_subgroups );
+	slapi_ch_free_string ( &g->agg_ndn );
+	slapi_ch_free ( (void **) &g );
+}
+
+static PLHashTable *
+__aclgi__new_table ()
+{
+	return PL_NewHashTable ( 64, PL_HashString, PL_CompareStrings,
+							PL_CompareValues, NULL, NULL );
+}
+
+static PRIntn
+__aclgi__free_group_entry ( PLHashEntry *he, PRIntn i, void *arg )
+{
+	__aclgi__free_group ( (aclGroupIndexGroup *) he->value );
+	return HT_ENUMERATE_REMOVE | HT_ENUMERATE_NEXT;
+}
+
+static PRIntn
+__aclgi__free_member_entry ( PLHashEntry *he, PRIntn i, void *arg )
+{
+	aclGroupIndexMember *m = (aclGroupIndexMember *) he->value;
+
+	slapi_ch_free ( (void **) &m->agm_groups );
+	slapi_ch_free_string ( &m->agm_ndn );
+	slapi_ch_free ( (void **) &m );
+	return HT_ENUMERATE_REMOVE | HT_ENUMERATE_NEXT;
+}
+
+static void
+__aclgi__free_tables ( PLHashTable *groups, PLHashTable *members )
+{
+	if ( groups ) {
+		PL_HashTableEnumerateEntries ( groups, __aclgi__free_group_entry, NULL );
+		PL_HashTableDestroy ( groups );
+	}
+	if ( members ) {
+		PL_HashTableEnumerateEntries ( members, __aclgi__free_member_entry, NULL );
+		PL_HashTableDestroy ( members );
+	}
+}
+
+static void
+__aclgi__add_ptr ( char ***list, int *num, int *max, char *s )
+{
+	if ( *num == *max ) {
+		*max += ACLGI_INCR_LIST;
+		*list = (char **) slapi_ch_realloc ( (char *) *list, *max * sizeof ( char * ));
+	}
+	(*list)[(*num)++] = s;
+}
+
+static void
+__aclgi__remove_ptr ( char **list, int *num, const char *s )
+{
+	int i;
+
+	for ( i = 0; i < *num; i++ ) {
+		if ( list[i] == s ) {
+			list[i] = list[--(*num)];
+			return;
+		}
+	}
+}
+
+/* The index is keyed by normalized, case ignored dns */
+static char *
+__aclgi__key ( const char *dn )
+{
+	return slapi_dn_ignore_case ( slapi_ch_strdup ( dn ));
+}
@@ -160,6 +160,12 @@ aclinit_main()
 	/* Initialize the user-group cache */
 	rv = aclgroup_init ( );
 
+	/* Initialize the access decision cache */
+	rv = acldecision_init ( );
+
+	/* Start building the group membership index */
+	rv = aclgroupindex_init ( );
+
 	aclanom_gen_anomProfile (DO_TAKE_ACLCACHE_READLOCK);
 
 	/* Register both of the proxied authorization controls (version 1 and 2) */
@@ -493,7 +499,7 @@ __aclinit__RegisterLases(void)
 		return ACL_ERR;
 	}
 	if (ACL_LasRegister(NULL, DS_LAS_GROUPDN, (LASEvalFunc_t)DS_LASGroupDnEval, 
-				(LASFlushFunc_t)NULL) < 0) {
+				(LASFlushFunc_t)DS_LASGroupDnFlush) < 0) {
 		slapi_log_error (SLAPI_LOG_FATAL, plugin_name,
 				"Unable to register GROUPDN Las\n");
 		return ACL_ERR;
@@ -505,7 +511,7 @@ __aclinit__RegisterLases(void)
 		return ACL_ERR;
 	}
 	if (ACL_LasRegister(NULL, DS_LAS_USERDN, (LASEvalFunc_t)DS_LASUserDnEval, 
-				(LASFlushFunc_t)NULL) < 0) {
+				(LASFlushFunc_t)DS_LASUserDnFlush) < 0) {
 		slapi_log_error (SLAPI_LOG_FATAL, plugin_name,
 				"Unable to register USERDN Las\n");
 		return ACL_ERR;
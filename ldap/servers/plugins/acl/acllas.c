@@ -202,6 +202,40 @@ static char* const	type_memberCert = "memberCertificateDescription";
 #define ACLLAS_CACHE_NOT_MEMBER_GROUPS	0x2
 #define ACLLAS_CACHE_ALL_GROUPS			0x3
 
+/*
+ * Compiled userdn and groupdn rules.
+ *
+ * A rule like userdn = "ldap:///dn1 || ldap:///self" used to be split,
+ * trimmed, classified and normalized each time it was evaluated. It is
+ * now compiled once into a list of terms which is kept in the LAS cookie
+ * of the expression (as the ip LAS of libaccess does for its tree), and
+ * freed by the flush function of the LAS when the aci is destroyed.
+ */
+#define ACLLAS_TERM_SYNTAX_ERR		1	/* evaluation fails */
+#define ACLLAS_TERM_STOP			2	/* evaluation stops: bad pattern */
+#define ACLLAS_TERM_ANYONE			3
+#define ACLLAS_TERM_ALL				4
+#define ACLLAS_TERM_SELF			5
+#define ACLLAS_TERM_PARENT			6
+#define ACLLAS_TERM_DN				7	/* normalized dn */
+#define ACLLAS_TERM_PATTERN			8	/* userdn with wildcards */
+#define ACLLAS_TERM_URL				9	/* userdn url, groupdn full url */
+#define ACLLAS_TERM_MACRO			10
+#define ACLLAS_TERM_GROUP			11	/* group dn */
+
+typedef struct acllas_term {
+	int				at_type;
+	char			*at_value;
+	Slapi_Filter	*at_filter;		/* ACLLAS_TERM_PATTERN */
+	LDAPURLDesc		*at_ludp;		/* groupdn ACLLAS_TERM_URL */
+} acllasTerm;
+
+typedef struct acllas_program {
+	int				ap_num_terms;
+	int				ap_max_terms;
+	acllasTerm		*ap_terms;
+} acllasProgram;
+
 /****************************************************************************/
 /* prototypes                                                               */
 /****************************************************************************/
@@ -245,6 +279,14 @@ static char **
 acllas_replace_attr_macro( char *rule, lasInfo *lasinfo);
 static int 
 acllas_eval_one_target_filter( char * str, Slapi_Entry *e);
+static acllasProgram *
+acllas__get_program ( char *attr_pattern, void **LAS_cookie,
+						acllasProgram *(*compile)(char *) );
+static acllasProgram *	acllas__compile_userdn ( char *attr_pattern );
+static acllasProgram *	acllas__compile_groupdn ( char *attr_pattern );
+static acllasTerm *		acllas__add_term ( acllasProgram *prog, int type );
+static char *			acllas__next_term ( char **next );
+static void				acllas__free_program ( acllasProgram *prog );
 
 /****************************************************************************/
 
@@ -442,17 +484,14 @@ DS_LASUserDnEval(NSErr_t *errp, char *attr_name, CmpOp_t comparator,
 		PList_t global_auth)
 {
 
-	char		*users = NULL;
-	char		*s_user, *user = NULL;
-	char		*ptr = NULL;
-	char		*end_dn = NULL;
-	char		*n_edn = NULL;
-	char		*parent_dn = NULL;
-	int			matched;
-	int			rc;
-	short		len;
-	const size_t 	LDAP_URL_prefix_len = strlen(LDAP_URL_prefix);
-	const size_t 	LDAPS_URL_prefix_len = strlen(LDAPS_URL_prefix);
+	acllasProgram	*prog;
+	acllasTerm		*term;
+	char			*n_edn = NULL;
+	char			*parent_dn = NULL;
+	char			*rule;
+	int				matched;
+	int				rc;
+	int				i;
 	lasInfo			lasinfo;
 	int			got_undefined = 0;
 
@@ -463,219 +502,108 @@ DS_LASUserDnEval(NSErr_t *errp, char *attr_name, CmpOp_t comparator,
 		return LAS_EVAL_FAIL;
 	}
 
- 	users = slapi_ch_strdup(attr_pattern);
-	user = users;
+	prog = acllas__get_program ( attr_pattern, LAS_cookie, acllas__compile_userdn );
 	matched = ACL_FALSE;
 
 	/* check if the clientdn is one of the users */
-	while(user != 0 && *user != 0 && matched != ACL_TRUE ) {
-
-		/* ignore leading whitespace */
-		while(ldap_utf8isspace(user)) 
-			LDAP_UTF8INC(user);
+	for ( i = 0; i < prog->ap_num_terms && matched != ACL_TRUE; i++ ) {
+		term = &prog->ap_terms[i];
 
-		/* Now we must see the userdn in the following
-		** formats:
-		**
-		** The following formats are supported:
-		** 
-		**  1. The DN itself: 
-		**    	allow (read)  userdn = "ldap:///cn=prasanta, ..." 
-		**
-		**  2. keyword SELF: 
-		**    	allow (write)  
-		**         userdn = "ldap:///self"
-		**
-		**  3. Pattern: 
-		**    	deny (read) userdn = "ldap:///cn=*, o=netscape, c = us";
-		**
-		**  4. Anonymous user
-		**    	deny (read, write)    userdn = "ldap:///anyone"
-		**
-		**  5. All users (All authenticated users)
-		**    	allow (search)  **   	   userdn = "ldap:///all"
-		**  6. parent "ldap:///parent"
-		**  7. Synamic users using the URL
-		** 
-		**
-		** DNs must be separated by "||". Ex:
-		** allow (read)
-		** userdn = "ldap:///DN1 || ldap:///DN2" 
-		*/
-	
-		/* The DN is now "ldap:///DN" 
-		** remove the "ldap:///" part
-		*/
-		if (strncasecmp (user, LDAP_URL_prefix, LDAP_URL_prefix_len) == 0) {
-			s_user = user;
-			user += LDAP_URL_prefix_len;
-		} else if (strncasecmp (user, LDAPS_URL_prefix, LDAPS_URL_prefix_len) == 0) {
-			s_user = user;
-			user += LDAPS_URL_prefix_len;
-		} else {
-			char ebuf[ BUFSIZ ];
-			slapi_log_error(SLAPI_LOG_FATAL, plugin_name,
-			 	"DS_LASUserDnEval:Syntax error(%s)\n", 
-				 escape_string_with_punctuation( user, ebuf ));
+		if ( term->at_type == ACLLAS_TERM_SYNTAX_ERR ) {
 			return LAS_EVAL_FAIL;
 		}
 
-		/* Now we have the starting point of the "userdn" */
-		if ((end_dn = strstr(user, "||")) != NULL) {
-			auto char *t = end_dn;
-			LDAP_UTF8INC(end_dn);
-			LDAP_UTF8INC(end_dn);
-			*t = 0;
-		}
-
-		/* Now user is a null terminated string */
-
-		if (*user) {
-			while(ldap_utf8isspace(user)) 
-				LDAP_UTF8INC(user);
-			/* ignore trailing whitespace */
-			len = strlen(user);
-			ptr = user+len-1;
-			while(ptr >= user && ldap_utf8isspace(ptr)) {
-				*ptr = '\0';
-				LDAP_UTF8DEC(ptr);
-			}
-		}
-
 		/* 
 		** Check , if the user is a anonymous user. In that case
 		** We must find the rule "ldap:///anyone"
 		*/
 		if (lasinfo.anomUser) {
-			if (strcasecmp(user, "anyone") == 0 ) {
+			if ( term->at_type == ACLLAS_TERM_ANYONE ) {
 				/* matches  -- anonymous user */
 				matched = ACL_TRUE;
 				break;
-			} 
-		} else {
-			/* URL format */
-			
-			if ((PL_strcasestr (user, ACL_RULE_MACRO_DN_KEY) != NULL) ||
-			    (PL_strcasestr (user, ACL_RULE_MACRO_DN_LEVELS_KEY) != NULL) ||
-			    (PL_strcasestr (user, ACL_RULE_MACRO_ATTR_KEY) != NULL)) {
-				
-				matched = aclutil_evaluate_macro( s_user, &lasinfo,
-													ACL_EVAL_USER);
-				if (matched == ACL_TRUE) {
-					break;
-				}										
-				
-			} else if (strchr (user, '?') != NULL) {
-				/* URL format */
-				if (acllas__client_match_URL ( lasinfo.aclpb, lasinfo.clientDn, 
-							     s_user) == ACL_TRUE) {
-					matched = ACL_TRUE;
-					break;
-				}
-			} else if (strcasecmp(user, "anyone") == 0 ) {
-				/* Anyone means anyone in the world */
+			}
+			continue;
+		}
+
+		switch ( term->at_type ) {
+		case ACLLAS_TERM_MACRO:
+			/* the macro code may write in the rule: use a copy */
+			rule = slapi_ch_strdup ( term->at_value );
+			matched = aclutil_evaluate_macro( rule, &lasinfo, ACL_EVAL_USER);
+			slapi_ch_free_string ( &rule );
+			break;
+
+		case ACLLAS_TERM_URL:
+			rule = slapi_ch_strdup ( term->at_value );
+			if (acllas__client_match_URL ( lasinfo.aclpb, lasinfo.clientDn, 
+						     rule) == ACL_TRUE) {
 				matched = ACL_TRUE;
-				break;
-			} else if (strcasecmp(user, "self") == 0) {
-				if (n_edn == NULL) {
-					n_edn = slapi_entry_get_ndn (  lasinfo.resourceEntry );
-				}
-				if (slapi_utf8casecmp((ACLUCHP)lasinfo.clientDn, (ACLUCHP)n_edn) == 0)
-					matched = ACL_TRUE;
-				break;
-			} else if (strcasecmp(user, "parent") == 0) {
-				if (n_edn == NULL) {
-					n_edn = slapi_entry_get_ndn ( lasinfo.resourceEntry );
-				}
-				/* get the parent */
-				parent_dn = slapi_dn_parent(n_edn);
-				if (parent_dn && 
-					slapi_utf8casecmp ((ACLUCHP)lasinfo.clientDn, (ACLUCHP)parent_dn) == 0)
-					matched = ACL_TRUE;
+			}
+			slapi_ch_free_string ( &rule );
+			break;
 
-				if (parent_dn) slapi_ch_free ( (void **) &parent_dn );
-				break;
-			} else if (strcasecmp(user, "all") == 0) {
-				/* matches  -- */
+		case ACLLAS_TERM_ANYONE:
+			/* Anyone means anyone in the world */
+		case ACLLAS_TERM_ALL:
+			matched = ACL_TRUE;
+			break;
+
+		case ACLLAS_TERM_SELF:
+			if (n_edn == NULL) {
+				n_edn = slapi_entry_get_ndn (  lasinfo.resourceEntry );
+			}
+			if (slapi_utf8casecmp((ACLUCHP)lasinfo.clientDn, (ACLUCHP)n_edn) == 0)
 				matched = ACL_TRUE;
-				break;
-			} else if (strchr(user, '*')) {
-				char	line[200];
-				char *lineptr = &line[0];
-				char *newline = NULL;
-				int lenu = 0;
-				Slapi_Filter	*f = NULL;
-				char		*tt;
-				int		filterChoice;
-
-				/* 
-				** what we are doing is faking the str2simple()
-				** function with a "userdn = "user")
-				*/
-				for (tt = user; *tt; tt++)
-					*tt = TOLOWER ( *tt );
+			/* the following terms are not evaluated */
+			i = prog->ap_num_terms;
+			break;
 
-				if ((lenu = strlen(user)) > 190) { /* 200 - 9 for "(userdn=%s)" */
-					newline = slapi_ch_malloc(lenu + 10);
-					lineptr = newline;
-				}
+		case ACLLAS_TERM_PARENT:
+			if (n_edn == NULL) {
+				n_edn = slapi_entry_get_ndn ( lasinfo.resourceEntry );
+			}
+			/* get the parent */
+			parent_dn = slapi_dn_parent(n_edn);
+			if (parent_dn && 
+				slapi_utf8casecmp ((ACLUCHP)lasinfo.clientDn, (ACLUCHP)parent_dn) == 0)
+				matched = ACL_TRUE;
 
-				sprintf (lineptr, "(userdn=%s)", user);
-				if ((f = slapi_str2filter (lineptr)) == NULL) {
-					if (newline) slapi_ch_free((void **) &newline);
-					/* try the next one */
-					break;
-				}
-				if (newline) slapi_ch_free((void **) &newline);
-				filterChoice = slapi_filter_get_choice ( f );
+			if (parent_dn) slapi_ch_free ( (void **) &parent_dn );
+			i = prog->ap_num_terms;
+			break;
 
-				if (( filterChoice != LDAP_FILTER_SUBSTRINGS) &&
-			    		( filterChoice != LDAP_FILTER_PRESENT)) {
-			   		slapi_log_error( SLAPI_LOG_ACL, plugin_name, 
-			    			 "DS_LASUserDnEval:Error in gen. filter(%s)\n", user);
-				}
-				if ((rc = acl_match_substring( f, 
-							       lasinfo.clientDn,
-							       1 /*exact match */)
-							     ) == ACL_TRUE) {
-					matched = ACL_TRUE;
-					slapi_filter_free(f,1);
-					break;
-				}
-				if (rc == ACL_ERR) {
-					slapi_log_error( SLAPI_LOG_ACL, plugin_name, 
-							"DS_LASUserDnEval:Error in matching patteren(%s)\n",
-							user);
-				}
-				slapi_filter_free(f,1);
-			} else {
-				/* Must be a simple dn then */
-				char *normed = slapi_create_dn_string("%s", user);
-				if (NULL == normed) {
-					slapi_log_error( SLAPI_LOG_FATAL, plugin_name,
-						"DS_LASUserDnEval:Error in normalizing dn(%s)\n", user);
-					normed = user;
-				}
-				rc = slapi_utf8casecmp((ACLUCHP)lasinfo.clientDn, (ACLUCHP)normed);
-				if (normed != user) {
-					slapi_ch_free_string(&normed);
-				}
-				if (0 == rc) {
-					matched = ACL_TRUE;
-					break;
-				}
+		case ACLLAS_TERM_STOP:
+			i = prog->ap_num_terms;
+			break;
+
+		case ACLLAS_TERM_PATTERN:
+			if ((rc = acl_match_substring( term->at_filter,
+						       lasinfo.clientDn,
+						       1 /*exact match */)
+						     ) == ACL_TRUE) {
+				matched = ACL_TRUE;
+			} else if (rc == ACL_ERR) {
+				slapi_log_error( SLAPI_LOG_ACL, plugin_name, 
+						"DS_LASUserDnEval:Error in matching patteren(%s)\n",
+						term->at_value);
 			}
+			break;
+
+		case ACLLAS_TERM_DN:
+			/* Must be a simple dn then, normalized at compile time */
+			if (slapi_utf8casecmp((ACLUCHP)lasinfo.clientDn,
+						(ACLUCHP)term->at_value) == 0) {
+				matched = ACL_TRUE;
+			}
+			break;
 		}
 
 		if ( matched == ACL_DONT_KNOW ) {
 			/* record this but keep going--maybe another user will evaluate to TRUE */
 			got_undefined = 1;
 		}
-		/* Nothing matched -- try the next DN */
-		user = end_dn;
-	} /* end of while */
-
-	slapi_ch_free ( (void **) &users);
+	} /* end of for */
 
 	/*
 	 * If no terms were undefined, then evaluate as normal.
@@ -696,7 +624,14 @@ DS_LASUserDnEval(NSErr_t *errp, char *attr_name, CmpOp_t comparator,
 
 	return rc;
 }
-
+
+void
+DS_LASUserDnFlush(void **LAS_cookie)
+{
+	acllas__free_program ( (acllasProgram *) *LAS_cookie );
+	*LAS_cookie = NULL;
+}
+
 /***************************************************************************
 *
 * DS_LASGroupDnEval
@@ -729,16 +664,12 @@ DS_LASGroupDnEval(NSErr_t *errp, char *attr_name, CmpOp_t comparator,
 		PList_t global_auth)
 {
 
-	char			*groups;
-	char			*groupNameOrig;
-	char			*groupName;
-	char			*ptr;
-	char			*end_dn;
+	acllasProgram	*prog;
+	acllasTerm		*term;
+	char			*rule;
 	int				matched;
 	int				rc;
-	int				len;
-	const size_t 	LDAP_URL_prefix_len = strlen(LDAP_URL_prefix);
-	int				any_group = 0;
+	int				i;
 	lasInfo			lasinfo;
 	int 			got_undefined = 0;
 
@@ -750,162 +681,86 @@ DS_LASGroupDnEval(NSErr_t *errp, char *attr_name, CmpOp_t comparator,
 		return LAS_EVAL_FAIL;
 	}
 
- 	groups = slapi_ch_strdup(attr_pattern);
-	groupNameOrig = groupName = groups;
+	prog = acllas__get_program ( attr_pattern, LAS_cookie, acllas__compile_groupdn );
 	matched = ACL_FALSE;
 
 	/* check if the groupdn is one of the users */
-	while(groupName != 0 && *groupName != 0 && matched != ACL_TRUE) {
-
-		/* ignore leading whitespace */
-		while(ldap_utf8isspace(groupName)) 
-			LDAP_UTF8INC(groupName);
-
-		/* 
-		** The syntax allowed for the groupdn is
-		**
-		** Example:
-		**  groupdn = "ldap:///dn1 ||  ldap:///dn2";
-		**
-		*/
-	
-		if (strncasecmp (groupName, LDAP_URL_prefix,
-				 LDAP_URL_prefix_len) == 0) {
-			groupName += LDAP_URL_prefix_len;
-		} else {
-			char ebuf[ BUFSIZ ];
-			slapi_log_error(SLAPI_LOG_FATAL, plugin_name,
-				  "DS_LASGroupDnEval:Syntax error(%s)\n",
-				   escape_string_with_punctuation( groupName, ebuf ));
-		}
-	
-		/* Now we have the starting point of the "groupdn" */
-		if ((end_dn = strstr(groupName, "||")) != NULL) {
-			auto char *t = end_dn;
-			LDAP_UTF8INC(end_dn);
-			LDAP_UTF8INC(end_dn);
-			/* removing trailing spaces */
-			LDAP_UTF8DEC(t);
-			while (' ' == *t || '\t' == *t) {
-				LDAP_UTF8DEC(t);
-			}
-			LDAP_UTF8INC(t);
-			*t = '\0';
-			/* removing beginning spaces */
-			while (' ' == *end_dn || '\t' == *end_dn) {
-				LDAP_UTF8INC(end_dn);
-			}
-		}
-
-		if (*groupName) {
-			while(ldap_utf8isspace(groupName)) 
-				LDAP_UTF8INC(groupName);
-			/* ignore trailing whitespace */
-			len = strlen(groupName);
-			ptr = groupName+len-1;
-			while(ptr >= groupName && ldap_utf8isspace(ptr)) {
-				*ptr = '\0';
-				LDAP_UTF8DEC(ptr);
-			}
-		}
+	for ( i = 0; i < prog->ap_num_terms && matched != ACL_TRUE; i++ ) {
+		term = &prog->ap_terms[i];
 
 		/* 
 		** Now we have the DN of the group. Evaluate the "clientdn"
 		** and see if the user is a member of the group.
 		*/
-		if (0 == (strcasecmp(groupName, "anyone"))) {
-			any_group = 1;
-		}
-
-		if (any_group) {
+		if ( term->at_type == ACLLAS_TERM_ANYONE ) {
 			/* anyone in the world */
 			matched = ACL_TRUE;
 			break;
 		} else if ( lasinfo.anomUser && 
-				(lasinfo.aclpb->aclpb_clientcert == NULL) && (!any_group)) {
+				(lasinfo.aclpb->aclpb_clientcert == NULL)) {
 			slapi_log_error( SLAPI_LOG_ACL, plugin_name, 
-					"Group not evaluated(%s)\n", groupName);
+					"Group not evaluated(%s)\n", term->at_value);
 			break;
-		} else {			
-			if ((PL_strcasestr (groupName, ACL_RULE_MACRO_DN_KEY) != NULL) ||
-			    (PL_strcasestr (groupName, ACL_RULE_MACRO_DN_LEVELS_KEY) != NULL) ||
-			    (PL_strcasestr (groupName, ACL_RULE_MACRO_ATTR_KEY) != NULL)) {
-				matched = aclutil_evaluate_macro( groupName, &lasinfo,
-													ACL_EVAL_GROUP);
-				slapi_log_error ( SLAPI_LOG_ACL, plugin_name,
-						"DS_LASGroupDnEval: Param group name:%s\n",
-						groupName);
-			} else {
-				LDAPURLDesc		*ludp = NULL;
-				int             urlerr = 0;
-				int				rval;
-				Slapi_PBlock	*myPb = NULL;
-				Slapi_Entry		**grpentries = NULL;
-
-				/* Groupdn is full ldapurl? */
-				if ((0 == (urlerr = slapi_ldap_url_parse(groupNameOrig, &ludp, 0, NULL))) &&
-				    NULL != ludp->lud_dn &&
-					-1 != ludp->lud_scope &&
-					NULL != ludp->lud_filter) {
-					/* Yes, it is full ldapurl; Let's run the search */
-					myPb = slapi_pblock_new ();
-					slapi_search_internal_set_pb(
-								myPb,
-								ludp->lud_dn,
-								ludp->lud_scope,
-								ludp->lud_filter,
-								NULL,
-								0,
-								NULL /* controls */,
-								NULL /* uniqueid */,
-								aclplugin_get_identity (ACL_PLUGIN_IDENTITY),
-								0 );	
-					slapi_search_internal_pb(myPb);
-					slapi_pblock_get(myPb, SLAPI_PLUGIN_INTOP_RESULT, &rval);
-					if (rval == LDAP_SUCCESS) {
-						Slapi_Entry		**ep;
-						slapi_pblock_get(myPb,
-								SLAPI_PLUGIN_INTOP_SEARCH_ENTRIES, &grpentries);
-						if ((grpentries != NULL) && (grpentries[0] != NULL)) {
-							char *edn = NULL;
-							for (ep = grpentries; *ep; ep++) {
-								/* groups having ACI */
-								edn = slapi_entry_get_ndn(*ep);
-								matched = acllas_eval_one_group(edn, &lasinfo);
-								if (ACL_TRUE == matched) {
-									break; /* matched ! */
-								}
-							}
+		}
+
+		if ( term->at_type == ACLLAS_TERM_MACRO ) {
+			/* the macro code may write in the rule: use a copy */
+			rule = slapi_ch_strdup ( term->at_value );
+			matched = aclutil_evaluate_macro( rule, &lasinfo,
+												ACL_EVAL_GROUP);
+			slapi_ch_free_string ( &rule );
+			slapi_log_error ( SLAPI_LOG_ACL, plugin_name,
+					"DS_LASGroupDnEval: Param group name:%s\n",
+					term->at_value);
+		} else if ( term->at_type == ACLLAS_TERM_URL ) {
+			LDAPURLDesc		*ludp = term->at_ludp;
+			int				rval;
+			Slapi_PBlock	*myPb = NULL;
+			Slapi_Entry		**grpentries = NULL;
+
+			/* Groupdn is a full ldapurl; Let's run the search */
+			myPb = slapi_pblock_new ();
+			slapi_search_internal_set_pb(
+						myPb,
+						ludp->lud_dn,
+						ludp->lud_scope,
+						ludp->lud_filter,
+						NULL,
+						0,
+						NULL /* controls */,
+						NULL /* uniqueid */,
+						aclplugin_get_identity (ACL_PLUGIN_IDENTITY),
+						0 );	
+			slapi_search_internal_pb(myPb);
+			slapi_pblock_get(myPb, SLAPI_PLUGIN_INTOP_RESULT, &rval);
+			if (rval == LDAP_SUCCESS) {
+				Slapi_Entry		**ep;
+				slapi_pblock_get(myPb,
+						SLAPI_PLUGIN_INTOP_SEARCH_ENTRIES, &grpentries);
+				if ((grpentries != NULL) && (grpentries[0] != NULL)) {
+					char *edn = NULL;
+					for (ep = grpentries; *ep; ep++) {
+						/* groups having ACI */
+						edn = slapi_entry_get_ndn(*ep);
+						matched = acllas_eval_one_group(edn, &lasinfo);
+						if (ACL_TRUE == matched) {
+							break; /* matched ! */
 						}
 					}
-					slapi_free_search_results_internal(myPb);
-					slapi_pblock_destroy (myPb);
-	
-				} else {
-					if (urlerr) {
-						slapi_log_error ( SLAPI_LOG_ACL, plugin_name,
-										  "DS_LASGroupDnEval: Groupname [%s] not a valid ldap url: %d (%s)\n",
-										  groupNameOrig, urlerr, slapi_urlparse_err2string(urlerr));
-					}
-					/* normal evaluation */
-					matched = acllas_eval_one_group( groupName, &lasinfo );
-				}
-				if ( ludp ) {
-					ldap_free_urldesc( ludp );
 				}
 			}
-			
-			if ( matched == ACL_TRUE ) {
-				break;
-			} else if ( matched == ACL_DONT_KNOW ) {
-				/* record this but keep going--maybe another group will evaluate to TRUE */
-				got_undefined = 1;
-			}
+			slapi_free_search_results_internal(myPb);
+			slapi_pblock_destroy (myPb);
+		} else {
+			/* normal evaluation */
+			matched = acllas_eval_one_group( term->at_value, &lasinfo );
 		}
-		/* Nothing matched -- try the next DN */
-		groupNameOrig = groupName = end_dn;
 
-	} /* end of while */
+		if ( matched == ACL_DONT_KNOW ) {
+			/* record this but keep going--maybe another group will evaluate to TRUE */
+			got_undefined = 1;
+		}
+	} /* end of for */
 
 	/*
 	 * If no terms were undefined, then evaluate as normal.
@@ -924,9 +779,16 @@ DS_LASGroupDnEval(NSErr_t *errp, char *attr_name, CmpOp_t comparator,
 			"Returning UNDEFINED for groupdn evaluation.\n");
 	} 
 
-	slapi_ch_free ((void**) &groups);
 	return rc;
 }
+
+void
+DS_LASGroupDnFlush(void **LAS_cookie)
+{
+	acllas__free_program ( (acllasProgram *) *LAS_cookie );
+	*LAS_cookie = NULL;
+}
+
 /***************************************************************************
 *
 * DS_LASRoleDnEval
@@ -2030,6 +1892,18 @@ acllas__user_ismember_of_group( struct acl_pblock *aclpb,
 	*/
 	aclg_unlock_groupCache ( 1 /* reader */ );
 
+	/*
+	** Then ask the group membership index, which answers without any
+	** internal search unless dynamic groups are involved.
+	*/
+	result = aclgroupindex_ismember ( groupDN, clientDN, aclpb->aclpb_max_nesting_level );
+	if ( result != ACL_DONT_KNOW ) {
+		slapi_log_error( SLAPI_LOG_ACL, plugin_name, "Evaluated %s by the group index\n",
+			result == ACL_TRUE ? "ACL_TRUE" : "ACL_FALSE" );
+		return result;
+	}
+	result = ACL_FALSE;
+
 	/* Indicate the initialization handler  -- this module will be 
 	** called by the backend to evaluate the entry.
 	*/
@@ -3709,7 +3583,10 @@ __acllas_setup ( NSErr_t *errp, char *attr_name, CmpOp_t comparator,
 	memset ( linfo, 0, sizeof ( lasInfo) );
 
   	*cachable = 0;
-  	*LAS_cookie = (void *)0;
+	/*
+	 * The cookie is left alone: libaccess zeroes it when the expression is
+	 * created, and the userdn and groupdn LASes keep their compiled rule in it.
+	 */
 
 	if (strcmp(attr_name, lasType) != 0) {
 		slapi_log_error( SLAPI_LOG_ACL, plugin_name, 
@@ -4443,6 +4320,289 @@ acllas_eval_one_user( struct acl_pblock *aclpb, char * clientDN, char *rule) {
  * component, not .*, like it would otherwise.
  * 
 */
+/*
+ * acllas__get_program
+ *	Return the compiled form of the rule, compiling it the first time
+ *	the expression is evaluated.
+ *
+ *	The cookie is read with an acquire load and published with a release
+ *	store, so that a program compiled by another thread is seen complete.
+ *	The ACL critical section is only entered to compile it, and the cookie
+ *	checked again there, so that it is compiled once.
+ *
+ *	ASSUMPTIONS: A reader lock has been obtained for the acl list, so the
+ *	expression (and its cookie) can not go away under us.
+ */
+static acllasProgram *
+acllas__get_program ( char *attr_pattern, void **LAS_cookie,
+						acllasProgram *(*compile)(char *) )
+{
+	acllasProgram *prog;
+
+	if ( NULL != ( prog = (acllasProgram *) SLAPI_EPOCH_READ ( *LAS_cookie ) ) ) {
+		return prog;
+	}
+	ACL_CritEnter();
+	if ( NULL == ( prog = (acllasProgram *) SLAPI_EPOCH_READ ( *LAS_cookie ) ) ) {
+		prog = (*compile)( attr_pattern );
+		SLAPI_EPOCH_PUBLISH ( *LAS_cookie, (void *) prog );
+	}
+	ACL_CritExit();
+	return prog;
+}
+
+/*
+ * acllas__compile_userdn
+ *
+ * The following formats are supported:
+ *
+ *  1. The DN itself: 
+ *    	allow (read)  userdn = "ldap:///cn=prasanta, ..." 
+ *  2. keyword SELF: 
+ *    	allow (write) userdn = "ldap:///self"
+ *  3. Pattern: 
+ *    	deny (read) userdn = "ldap:///cn=*, o=netscape, c = us";
+ *  4. Anonymous user
+ *    	deny (read, write) userdn = "ldap:///anyone"
+ *  5. All users (All authenticated users)
+ *    	allow (search) userdn = "ldap:///all"
+ *  6. parent "ldap:///parent"
+ *  7. Dynamic users using the URL
+ *
+ * DNs must be separated by "||". Ex:
+ * allow (read) userdn = "ldap:///DN1 || ldap:///DN2" 
+ */
+static acllasProgram *
+acllas__compile_userdn ( char *attr_pattern )
+{
+	acllasProgram	*prog;
+	acllasTerm		*term;
+	char			*users, *next;
+	char			*s_user, *user;
+	const size_t 	LDAP_URL_prefix_len = strlen(LDAP_URL_prefix);
+	const size_t 	LDAPS_URL_prefix_len = strlen(LDAPS_URL_prefix);
+
+	prog = (acllasProgram *) slapi_ch_calloc ( 1, sizeof ( acllasProgram ) );
+	users = slapi_ch_strdup ( attr_pattern );
+	next = users;
+
+	while ( next && *next ) {
+		s_user = acllas__next_term ( &next );
+
+		/* remove the "ldap:///" part */
+		if (strncasecmp (s_user, LDAP_URL_prefix, LDAP_URL_prefix_len) == 0) {
+			user = s_user + LDAP_URL_prefix_len;
+		} else if (strncasecmp (s_user, LDAPS_URL_prefix, LDAPS_URL_prefix_len) == 0) {
+			user = s_user + LDAPS_URL_prefix_len;
+		} else {
+			char ebuf[ BUFSIZ ];
+			slapi_log_error(SLAPI_LOG_FATAL, plugin_name,
+			 	"DS_LASUserDnEval:Syntax error(%s)\n", 
+				 escape_string_with_punctuation( s_user, ebuf ));
+			acllas__add_term ( prog, ACLLAS_TERM_SYNTAX_ERR );
+			break;
+		}
+		while(ldap_utf8isspace(user)) 
+			LDAP_UTF8INC(user);
+
+		if ((PL_strcasestr (user, ACL_RULE_MACRO_DN_KEY) != NULL) ||
+		    (PL_strcasestr (user, ACL_RULE_MACRO_DN_LEVELS_KEY) != NULL) ||
+		    (PL_strcasestr (user, ACL_RULE_MACRO_ATTR_KEY) != NULL)) {
+			term = acllas__add_term ( prog, ACLLAS_TERM_MACRO );
+			term->at_value = slapi_ch_strdup ( s_user );
+		} else if (strchr (user, '?') != NULL) {
+			term = acllas__add_term ( prog, ACLLAS_TERM_URL );
+			term->at_value = slapi_ch_strdup ( s_user );
+		} else if (strcasecmp(user, "anyone") == 0 ) {
+			acllas__add_term ( prog, ACLLAS_TERM_ANYONE );
+		} else if (strcasecmp(user, "self") == 0) {
+			acllas__add_term ( prog, ACLLAS_TERM_SELF );
+		} else if (strcasecmp(user, "parent") == 0) {
+			acllas__add_term ( prog, ACLLAS_TERM_PARENT );
+		} else if (strcasecmp(user, "all") == 0) {
+			acllas__add_term ( prog, ACLLAS_TERM_ALL );
+		} else if (strchr(user, '*')) {
+			Slapi_Filter	*f = NULL;
+			char			*tt;
+			char			*line;
+			int				filterChoice;
+
+			/* 
+			** what we are doing is faking the str2simple()
+			** function with a "userdn = "user")
+			*/
+			for (tt = user; *tt; tt++)
+				*tt = TOLOWER ( *tt );
+
+			line = slapi_ch_smprintf ("(userdn=%s)", user);
+			f = slapi_str2filter (line);
+			slapi_ch_free_string (&line);
+			if (f == NULL) {
+				/* the evaluation stops here */
+				acllas__add_term ( prog, ACLLAS_TERM_STOP );
+				continue;
+			}
+			filterChoice = slapi_filter_get_choice ( f );
+			if (( filterChoice != LDAP_FILTER_SUBSTRINGS) &&
+		    		( filterChoice != LDAP_FILTER_PRESENT)) {
+		   		slapi_log_error( SLAPI_LOG_ACL, plugin_name, 
+		    			 "DS_LASUserDnEval:Error in gen. filter(%s)\n", user);
+			}
+			term = acllas__add_term ( prog, ACLLAS_TERM_PATTERN );
+			term->at_value = slapi_ch_strdup ( user );
+			term->at_filter = f;
+		} else {
+			char *normed = slapi_create_dn_string("%s", user);
+			if (NULL == normed) {
+				slapi_log_error( SLAPI_LOG_FATAL, plugin_name,
+					"DS_LASUserDnEval:Error in normalizing dn(%s)\n", user);
+				normed = slapi_ch_strdup ( user );
+			}
+			term = acllas__add_term ( prog, ACLLAS_TERM_DN );
+			term->at_value = normed;
+		}
+	}
+
+	slapi_ch_free_string ( &users );
+	return prog;
+}
+
+/*
+ * acllas__compile_groupdn
+ *
+ * The syntax allowed for the groupdn is
+ *  groupdn = "ldap:///dn1 ||  ldap:///dn2";
+ * where a dn can also be a full ldap url: ldap:///base?attrs?scope?filter
+ */
+static acllasProgram *
+acllas__compile_groupdn ( char *attr_pattern )
+{
+	acllasProgram	*prog;
+	acllasTerm		*term;
+	char			*groups, *next;
+	char			*groupNameOrig, *groupName;
+	const size_t 	LDAP_URL_prefix_len = strlen(LDAP_URL_prefix);
+
+	prog = (acllasProgram *) slapi_ch_calloc ( 1, sizeof ( acllasProgram ) );
+	groups = slapi_ch_strdup ( attr_pattern );
+	next = groups;
+
+	while ( next && *next ) {
+		groupNameOrig = groupName = acllas__next_term ( &next );
+
+		if (strncasecmp (groupName, LDAP_URL_prefix,
+				 LDAP_URL_prefix_len) == 0) {
+			groupName += LDAP_URL_prefix_len;
+		} else {
+			char ebuf[ BUFSIZ ];
+			slapi_log_error(SLAPI_LOG_FATAL, plugin_name,
+				  "DS_LASGroupDnEval:Syntax error(%s)\n",
+				   escape_string_with_punctuation( groupName, ebuf ));
+		}
+		while(ldap_utf8isspace(groupName)) 
+			LDAP_UTF8INC(groupName);
+
+		if (0 == (strcasecmp(groupName, "anyone"))) {
+			acllas__add_term ( prog, ACLLAS_TERM_ANYONE );
+		} else if ((PL_strcasestr (groupName, ACL_RULE_MACRO_DN_KEY) != NULL) ||
+		    (PL_strcasestr (groupName, ACL_RULE_MACRO_DN_LEVELS_KEY) != NULL) ||
+		    (PL_strcasestr (groupName, ACL_RULE_MACRO_ATTR_KEY) != NULL)) {
+			term = acllas__add_term ( prog, ACLLAS_TERM_MACRO );
+			term->at_value = slapi_ch_strdup ( groupName );
+		} else {
+			LDAPURLDesc		*ludp = NULL;
+			int             urlerr = 0;
+
+			/* Groupdn is full ldapurl? */
+			if ((0 == (urlerr = slapi_ldap_url_parse(groupNameOrig, &ludp, 0, NULL))) &&
+			    NULL != ludp->lud_dn &&
+				-1 != ludp->lud_scope &&
+				NULL != ludp->lud_filter) {
+				term = acllas__add_term ( prog, ACLLAS_TERM_URL );
+				term->at_ludp = ludp;
+			} else {
+				if (urlerr) {
+					slapi_log_error ( SLAPI_LOG_ACL, plugin_name,
+									  "DS_LASGroupDnEval: Groupname [%s] not a valid ldap url: %d (%s)\n",
+									  groupNameOrig, urlerr, slapi_urlparse_err2string(urlerr));
+				}
+				if ( ludp ) {
+					ldap_free_urldesc( ludp );
+				}
+				term = acllas__add_term ( prog, ACLLAS_TERM_GROUP );
+			}
+			term->at_value = slapi_ch_strdup ( groupName );
+		}
+	}
+
+	slapi_ch_free_string ( &groups );
+	return prog;
+}
+
+static acllasTerm *
+acllas__add_term ( acllasProgram *prog, int type )
+{
+	acllasTerm *term;
+
+	if ( prog->ap_num_terms == prog->ap_max_terms ) {
+		prog->ap_max_terms += 4;
+		prog->ap_terms = (acllasTerm *) slapi_ch_realloc ( (char *) prog->ap_terms,
+									prog->ap_max_terms * sizeof ( acllasTerm ) );
+	}
+	term = &prog->ap_terms[prog->ap_num_terms++];
+	memset ( term, 0, sizeof ( acllasTerm ) );
+	term->at_type = type;
+	return term;
+}
+
+/*
+ * Cut the next term of a "term1 || term2" list in place, without the
+ * surrounding whitespace, and move *next after it.
+ */
+static char *
+acllas__next_term ( char **next )
+{
+	char *term = *next;
+	char *end;
+	char *ptr;
+
+	if ((end = strstr(term, "||")) != NULL) {
+		*end = '\0';
+		*next = end + 2;
+	} else {
+		*next = NULL;
+	}
+
+	/* ignore leading whitespace */
+	while(ldap_utf8isspace(term)) 
+		LDAP_UTF8INC(term);
+	/* ignore trailing whitespace */
+	ptr = term + strlen(term) - 1;
+	while(ptr >= term && ldap_utf8isspace(ptr)) {
+		*ptr = '\0';
+		LDAP_UTF8DEC(ptr);
+	}
+	return term;
+}
+
+static void
+acllas__free_program ( acllasProgram *prog )
+{
+	int i;
+
+	if ( NULL == prog ) return;
+
+	for ( i = 0; i < prog->ap_num_terms; i++ ) {
+		acllasTerm *term = &prog->ap_terms[i];
+
+		slapi_ch_free_string ( &term->at_value );
+		if ( term->at_filter ) slapi_filter_free ( term->at_filter, 1 );
+		if ( term->at_ludp ) ldap_free_urldesc ( term->at_ludp );
+	}
+	slapi_ch_free ( (void **) &prog->ap_terms );
+	slapi_ch_free ( (void **) &prog );
+}
+
 static int
 acllas_eval_one_group(char *groupbuf, lasInfo *lasinfo) {
 
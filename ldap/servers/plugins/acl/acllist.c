@@ -31,7 +31,7 @@
  *
  * The only tricky issue is that there is also locking
  * implemented for the anonymous profile and sometimes we need to take both
- * locks cf. aclanom_anom_genProfile().  The rule is
+ * locks cf. aclanom_gen_anomProfile().  The rule is
  * always take the acicache lock first, followed by the anon lock--following
  * this rule will ensure no dead lock scenarios can arise.
  *
@@ -140,6 +140,9 @@ void acl_be_state_change_fnc ( void *handle, char *be_name, int old_state,
 										LDAP_SCOPE_SUBTREE,
 										ACL_REMOVE_ACIS,
 										DO_TAKE_ACLCACHE_WRITELOCK);
+
+		/* its groups are gone too */
+		aclgroupindex_rebuild();
 		
 	} else if ( old_state != SLAPI_BE_STATE_ON && new_state == SLAPI_BE_STATE_ON) {
 		slapi_log_error ( SLAPI_LOG_ACL, plugin_name, 
@@ -167,6 +170,8 @@ void acl_be_state_change_fnc ( void *handle, char *be_name, int old_state,
 										LDAP_SCOPE_SUBTREE,
 										ACL_ADD_ACIS,
 										DO_TAKE_ACLCACHE_WRITELOCK);
+
+		aclgroupindex_rebuild();
 	}
 
 }
@@ -214,8 +219,7 @@ acllist_insert_aci_needsLock_ext( Slapi_PBlock *pb, const Slapi_DN *e_sdn, const
 
 	slapi_ch_free ( (void **) &acl_str );
 	acl_regen_aclsignature ();
-	if ( aci->aci_elevel == ACI_ELEVEL_USERDN_ANYONE)
-		aclanom_invalidateProfile ();
+	aclanom_add_aci ( aci );
 	return 0;
 }
 
@@ -328,8 +332,8 @@ __acllist_aciContainer_node_dup ( caddr_t d1, caddr_t d2 )
  * Remove the ACL
  *
  * This routine must be called with the aclcache write lock taken.
- * It takes in addition the one for the anom profile taken in
- * aclanom_invalidateProfile().
+ * It takes in addition the one for the anom profile updates taken in
+ * aclanom_remove_acis().
  * They _must_ be taken in this order or there
  * is a deadlock scenario with aclanom_gen_anomProfile() which
  * also takes them is this order.
@@ -343,7 +347,6 @@ acllist_remove_aci_needsLock( const Slapi_DN *sdn,  const struct berval *attr )
 	int				rv = 0;
 	AciContainer	*aciListHead, *root;
 	AciContainer	*dContainer;
-	int				removed_anom_acl = 0;
 
 	/* we used to delete the ACL by value but we don't do that anymore.
 	 * rather we delete all the acls in that entry and then repopulate it if 
@@ -364,13 +367,13 @@ acllist_remove_aci_needsLock( const Slapi_DN *sdn,  const struct berval *attr )
 		return 0;
 	}
 
+	/* Take them out of the anonymous profile before they go away */
+	aclanom_remove_acis ( root->acic_list );
+
 	head = root->acic_list;
 	if ( head)
 		next = head->aci_next;
 	while ( head ) {
-		if ( head->aci_elevel == ACI_ELEVEL_USERDN_ANYONE)
-			removed_anom_acl = 1;
-
 		/* Free the acl */
 		acllist_free_aci ( head );
 
@@ -392,8 +395,6 @@ acllist_remove_aci_needsLock( const Slapi_DN *sdn,  const struct berval *attr )
 	acllist_free_aciContainer ( &dContainer );
 
 	acl_regen_aclsignature ();
-	if ( removed_anom_acl )
-		aclanom_invalidateProfile ();
 
 	/*
 	 * Now read back the entry and repopulate ACLs for that entry, but
@@ -418,15 +419,6 @@ acllist_remove_aci_needsLock( const Slapi_DN *sdn,  const struct berval *attr )
 	/* Now free the tmp container we used */
 	acllist_free_aciContainer ( &aciListHead );
 
-	/*
-	 * regenerate the anonymous profile if we have deleted
-	 * anyone acls.
-	 * We don't need the aclcache readlock because the context of
-	 * this routine is we have the write lock already.
-	*/
-	if ( removed_anom_acl )
-		aclanom_gen_anomProfile(DONT_TAKE_ACLCACHE_READLOCK);
-
 	return rv;
 }
 
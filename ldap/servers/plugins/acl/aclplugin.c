@@ -26,11 +26,14 @@ char *plugin_name = ACL_PLUGIN_NAME;
 static int aclplugin_preop_search ( Slapi_PBlock *pb );
 static int aclplugin_preop_modify ( Slapi_PBlock *pb );
 int aclplugin_preop_common ( Slapi_PBlock *pb );
+int acl_postop_init ( Slapi_PBlock *pb );
+int acl_internalpostop_init ( Slapi_PBlock *pb );
+int acl_betxnpostop_init ( Slapi_PBlock *pb );
 
 /*******************************************************************************
  *  ACL PLUGIN Architecture
  *
- *	There are 3 registered plugins:
+ *	There are 4 registered plugins:
  *
  *	1) PREOP ACL Plugin
  *		The preop plugin does all the initialization. It allocate the ACL
@@ -51,6 +54,10 @@ int aclplugin_preop_common ( Slapi_PBlock *pb );
  *		d) Check for access to a mod request.
  *		e) Update the in-memory ACL List.
  *
+ *	4) BETXNPOSTOP, POSTOP and INTERNALPOSTOP Plugins
+ *		Registered by the ACCESSCONTROL plugin, they keep the group
+ *		membership index up to date.
+ *
  *******************************************************************************/
 
 /*******************************************************************************
@@ -254,6 +261,56 @@ void * aclplugin_get_identity(int plug) {
         return NULL;
 }
 
+/*
+ * The post op plugins only maintain the group membership index. It is
+ * updated in the backend transaction, so in commit order, and the post
+ * op plugins have it rebuilt when the transaction was aborted.
+ */
+int
+acl_betxnpostop_init ( Slapi_PBlock *pb )
+{
+	int rc = 0;
+
+	rc = slapi_pblock_set( pb, SLAPI_PLUGIN_VERSION, SLAPI_PLUGIN_VERSION_01 );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_BE_TXN_POST_ADD_FN, (void *) aclgroupindex_betxn_post_op );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_BE_TXN_POST_DELETE_FN, (void *) aclgroupindex_betxn_post_op );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_BE_TXN_POST_MODIFY_FN, (void *) aclgroupindex_betxn_post_op );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_BE_TXN_POST_MODRDN_FN, (void *) aclgroupindex_betxn_post_op );
+
+	slapi_log_error( SLAPI_LOG_PLUGIN, plugin_name, "<= acl_betxnpostop_init %d\n", rc );
+	return rc;
+}
+
+int
+acl_postop_init ( Slapi_PBlock *pb )
+{
+	int rc = 0;
+
+	rc = slapi_pblock_set( pb, SLAPI_PLUGIN_VERSION, SLAPI_PLUGIN_VERSION_01 );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_POST_ADD_FN, (void *) aclgroupindex_post_op );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_POST_DELETE_FN, (void *) aclgroupindex_post_op );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_POST_MODIFY_FN, (void *) aclgroupindex_post_op );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_POST_MODRDN_FN, (void *) aclgroupindex_post_op );
+
+	slapi_log_error( SLAPI_LOG_PLUGIN, plugin_name, "<= acl_postop_init %d\n", rc );
+	return rc;
+}
+
+int
+acl_internalpostop_init ( Slapi_PBlock *pb )
+{
+	int rc = 0;
+
+	rc = slapi_pblock_set( pb, SLAPI_PLUGIN_VERSION, SLAPI_PLUGIN_VERSION_01 );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_INTERNAL_POST_ADD_FN, (void *) aclgroupindex_post_op );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_INTERNAL_POST_DELETE_FN, (void *) aclgroupindex_post_op );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_INTERNAL_POST_MODIFY_FN, (void *) aclgroupindex_post_op );
+	rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_INTERNAL_POST_MODRDN_FN, (void *) aclgroupindex_post_op );
+
+	slapi_log_error( SLAPI_LOG_PLUGIN, plugin_name, "<= acl_internalpostop_init %d\n", rc );
+	return rc;
+}
+
 int
 aclplugin_init (Slapi_PBlock *pb )
 {
@@ -277,7 +334,9 @@ aclplugin_stop ( Slapi_PBlock *pb )
 	ACL_MethodHashDestroy();
 	ACL_DestroyPools();
 	aclanom__del_profile(1);
+	aclgroupindex_free();
 	aclgroup_free();
+	acldecision_free();
 	//aclext_free_lockarray();
 	acllist_free();
 
@@ -316,6 +375,21 @@ acl_init( Slapi_PBlock *pb )
         rc |= slapi_pblock_set( pb, SLAPI_PLUGIN_ACL_MODS_UPDATE,
             (void *) acl_modified );
 
+        /*
+         * acl_modified() is not called for internal operations, which
+         * also change groups (referential integrity...): the group
+         * membership index is kept up to date by its own post op plugins.
+         */
+        rc |= slapi_register_plugin( "betxnpostoperation", 1 /* Enabled */,
+            "acl_betxnpostop_init", acl_betxnpostop_init,
+            "ACL betxnpostoperation plugin", NULL, g_acl_plugin_identity );
+        rc |= slapi_register_plugin( "postoperation", 1 /* Enabled */,
+            "acl_postop_init", acl_postop_init,
+            "ACL postoperation plugin", NULL, g_acl_plugin_identity );
+        rc |= slapi_register_plugin( "internalpostoperation", 1 /* Enabled */,
+            "acl_internalpostop_init", acl_internalpostop_init,
+            "ACL internalpostoperation plugin", NULL, g_acl_plugin_identity );
+
         slapi_log_error( SLAPI_LOG_PLUGIN, plugin_name, "<= acl_init %d\n", rc);
         return( rc );
 }
@@ -353,6 +427,8 @@ acl_access_allowed_main ( Slapi_PBlock *pb, Slapi_Entry *e, char **attrs,
 		} else {
 			rc = acl_read_access_allowed_on_attr ( pb, e, attr, val, access);
 		}
+	} else if ( ACLPLUGIN_ACCESS_READ_ON_ATTRS == flags) {
+		rc = acl_read_access_allowed_on_attrs ( pb, e, attrs, access);
 	} else if ( ACLPLUGIN_ACCESS_READ_ON_VLV == flags)
 		rc =  acl_access_allowed_disjoint_resource ( pb, e, attr, val, access);
 	else if ( ACLPLUGIN_ACCESS_MODRDN == flags)
@@ -54,6 +54,7 @@
 #include "prerror.h"
 #include "prcvar.h"
 #include "prio.h"
+#include "plhash.h"
 #include "vattr_spi.h"
 
 #include "cos_cache.h"
@@ -112,6 +113,7 @@ void * cos_get_plugin_identity();
 static volatile vattr_sp_handle *vattr_handle = NULL;
 
 static int cos_cache_notify_flag = 0;
+static int cos_cache_rebuild_flag = 0;
 
 /* service definition cache structs */
 
@@ -143,12 +145,12 @@ struct _cosAttribute
 	cosIndexedLinkedList list;
 	char *pAttrName;
 	cosAttrValue *pAttrValue;
-	cosAttrValue *pObjectclasses;
 	int attr_override;
 	int attr_operational;
 	int attr_operational_default;
 	int attr_cos_merge;
 	void *pParent;
+	Slapi_ValueSet *pValueSet; /* the values, ready to be copied out */
 };
 typedef struct _cosAttribute cosAttributes;
 
@@ -180,13 +182,55 @@ struct _cosDefinition
 	cosAttrValue *pCosOpDefault;
 	cosAttrValue *pCosMerge;
 	cosTemplates *pCosTmps;
+	PRInt32 refCount; /* the cache versions sharing this definition */
 };
 typedef struct _cosDefinition cosDefinitions;
 
+/*
+	cosDispatch: for one attribute type, the templates which may supply
+	it, grouped by definition.  The templates of a classic definition are
+	hashed by their grade, so that an entry only looks at the ones its
+	cosSpecifier values select; the others (pointer and indirect schemes,
+	default templates) are always looked at.  Templates are referred to
+	by their position in the cache attribute index.
+*/
+struct _cosIndexList
+{
+	int *pIndexes;
+	int count;
+	int max;
+};
+typedef struct _cosIndexList cosIndexList;
+
+struct _cosDefDispatch
+{
+	cosDefinitions *pDef;
+	PLHashTable *pGrades;	/* lower case grade -> cosIndexList */
+	cosIndexList always;
+};
+typedef struct _cosDefDispatch cosDefDispatch;
+
+struct _cosDispatch
+{
+	cosDefDispatch *pDefDispatch;
+	int defCount;
+	cosAttrValue *pObjectclasses; /* the objectclasses allowing the type */
+};
+typedef struct _cosDispatch cosDispatch;
+
+/*
+	A cache version is never modified once published.  The definitions
+	(with their templates) are shared by the versions, and refcounted:
+	a change to a definition or a template gives a new version, which
+	shares every definition with the current one but the changed ones.
+	Only the indexes are per version.
+*/
 struct _cos_cache
 {
-	cosDefinitions *pDefs;
+	cosDefinitions **ppDefs;
+	int defCount;
 	cosAttributes **ppAttrIndex;
+	cosDispatch **ppDispatch; /* at the first index of each attribute type */
 	int attrCount;
 	char **ppTemplateList;
 	int templateCount;
@@ -195,12 +239,40 @@ struct _cos_cache
 };
 typedef struct _cos_cache cosCache;
 
+/*
+	cosDelta: a definition or template entry which changed since the
+	cache version was built.  The cache thread reads these entries again
+	and patches a copy of the cache with them, rather than reading all
+	the definitions and templates in the DIT.
+*/
+struct _cosDelta
+{
+	struct _cosDelta *pNext;
+	int deltaType;
+	Slapi_DN *sdn;
+};
+typedef struct _cosDelta cosDelta;
+
+#define COS_DELTA_DEFINITION	0x1
+#define COS_DELTA_TEMPLATE	0x2
+#define COS_DELTA_REBUILD	0x4	/* no way to tell, rebuild the whole cache */
+
+/* past this, reading the whole cache again is cheaper */
+#define COS_CACHE_MAX_DELTAS	64
+
 /* cache manipulation function prototypes*/
 static cosCache *pCache; /* always the current global cache, only use getref to get */
 
 /* the place to start if you want a new cache */
 static int cos_cache_create();
 
+/* or to patch the current one */
+static int cos_cache_apply_deltas(cosDelta *pDeltas);
+static void cos_cache_add_delta(int deltaType, const char *dn);
+static void cos_cache_del_deltas(cosDelta **ppDeltas);
+static void cos_cache_install(cosCache *pNewCache);
+static void cos_cache_del_cache(cosCache *pOldCache);
+
 /* cache index related functions */
 static int cos_cache_index_all(cosCache *pCache);
 static int cos_cache_attr_compare(const void *e1, const void *e2);
@@ -208,6 +280,9 @@ static int cos_cache_template_index_compare(const void *e1, const void *e2);
 static int cos_cache_string_compare(const void *e1, const void *e2);
 static int cos_cache_template_index_bsearch(const char *dn);
 static int cos_cache_attr_index_bsearch( const cosCache *pCache, const cosAttributes *key, int lower, int upper );
+static int cos_cache_dispatch_build(cosCache *pCache);
+static void cos_cache_del_dispatch(cosCache *pCache);
+static int cos_cache_dispatch_candidates(cosCache *pCache, int attr_index, vattr_context *context, Slapi_Entry *e, const char *pDn, int **ppIndexes);
 
 /* the multi purpose list creation function, pass it something and it links it */
 static void cos_cache_add_ll_entry(void **attrval, void *theVal, int ( *compare )(const void *elem1, const void *elem2 ));
@@ -215,6 +290,7 @@ static void cos_cache_add_ll_entry(void **attrval, void *theVal, int ( *compare
 /* cosAttrValue manipulation */
 static int cos_cache_add_attrval(cosAttrValue **attrval, char *val);
 static void cos_cache_del_attrval_list(cosAttrValue **pVal);
+static cosAttrValue *cos_cache_dup_attrval_list(cosAttrValue *pVal);
 static int cos_cache_attrval_exists(cosAttrValue *pAttrs, const char *val);
 
 /* cosAttributes manipulation */
@@ -222,17 +298,25 @@ static int cos_cache_add_attr(cosAttributes **pAttrs, char *name, cosAttrValue *
 static void cos_cache_del_attr_list(cosAttributes **pAttrs);
 static int cos_cache_find_attr(cosCache *pCache, char *type);
 static int cos_cache_total_attr_count(cosCache *pCache);
+static void cos_cache_attr_valueset(cosAttributes *pAttr);
 static int cos_cache_cos_2_slapi_valueset(cosAttributes *pAttr, Slapi_ValueSet **out_vs);
 static int cos_cache_cmp_attr(cosAttributes *pAttr, Slapi_Value *test_this, int *result);
 
 /* cosTemplates manipulation */
-static int cos_cache_add_dn_tmpls(char *dn,  cosAttrValue *pCosSpecifier, cosAttrValue *pAttrs, cosTemplates **pTmpls);
+static int cos_cache_add_dn_tmpls(char *dn, int scope, cosAttrValue *pCosSpecifier, cosAttrValue *pAttrs, cosTemplates **pTmpls);
 static int cos_cache_add_tmpl(cosTemplates **pTemplates, cosAttrValue *dn, cosAttrValue *objclasses, cosAttrValue *pCosSpecifier, cosAttributes *pAttrs,cosAttrValue *cosPriority);
+static cosTemplates *cos_cache_dup_tmpl(cosTemplates *pTmpl);
+static void cos_cache_del_tmpl(cosTemplates *pTmpl);
 
 /* cosDefinitions manipulation */
 static int cos_cache_build_definition_list(cosDefinitions **pDefs, int *vattr_cacheable);
-static int cos_cache_add_dn_defs(char *dn, cosDefinitions **pDefs);
+static int cos_cache_add_dn_defs(char *dn, int scope, cosDefinitions **pDefs);
 static int cos_cache_add_defn(cosDefinitions **pDefs, cosAttrValue **dn, int cosType, cosAttrValue **tree, cosAttrValue **tmpDn, cosAttrValue **spec, cosAttrValue **pAttrs, cosAttrValue **pOverrides, cosAttrValue **pOperational, cosAttrValue **pCosMerge, cosAttrValue **pCosOpDefault);
+static void cos_cache_link_defn(cosDefinitions *pDef);
+static cosDefinitions *cos_cache_dup_defn(cosDefinitions *pDef);
+static void cos_cache_del_defn(cosDefinitions *pDef);
+static void cos_cache_append_defs(cosCache *pCache, cosDefinitions *pDefs);
+static int cos_cache_dn_equal(const char *dn, const Slapi_DN *sdn);
 static int cos_cache_entry_is_cos_related( Slapi_Entry *e);
 
 /* schema checking */
@@ -276,6 +360,10 @@ static Slapi_Mutex *stop_lock;
 static Slapi_CondVar *something_changed = NULL;
 static Slapi_CondVar *start_cond = NULL;
 
+/* the changes waiting for the cache thread, protected by change_lock */
+static cosDelta *cos_cache_deltas = NULL;
+static int cos_cache_delta_count = 0;
+
 
 /*
 	cos_cache_init
@@ -365,7 +453,8 @@ out:
 	cos_cache_wait_on_change
 	------------------------
 	sit around waiting on a notification that something has
-	changed, then fires off the cache re-creation
+	changed, then patches the cache with the changed entries, or
+	fires off the cache re-creation when that cannot be done
 
 	The way this stuff is written, we can look for the
 	template for a definiton, before the template has been added--I think
@@ -419,7 +508,17 @@ static void cos_cache_wait_on_change(void *arg)
 		 * before we go running off doing lots of stuff lets check if we should stop
 		*/
 		if(keeprunning) {
-			cos_cache_create();				
+			cosDelta *pDeltas = cos_cache_deltas;
+			int rebuild = cos_cache_rebuild_flag;
+
+			cos_cache_deltas = NULL;
+			cos_cache_delta_count = 0;
+			cos_cache_rebuild_flag = 0;
+
+			if(rebuild || cos_cache_apply_deltas(pDeltas)) {
+				cos_cache_create();
+			}
+			cos_cache_del_deltas(&pDeltas);
 		}
 		cos_cache_notify_flag = 0; /* Dealt with it */
 	}/* while */
@@ -448,14 +547,19 @@ static int cos_cache_create()
 
 	LDAPDebug( LDAP_DEBUG_TRACE, "--> cos_cache_create\n",0,0,0);
 
-	pNewCache = (cosCache*)slapi_ch_malloc(sizeof(cosCache));
+	pNewCache = (cosCache*)slapi_ch_calloc(1, sizeof(cosCache));
 	if(pNewCache)
 	{
-		pNewCache->pDefs = 0;
+		cosDefinitions *pDefs = 0;
+
 		pNewCache->refCount = 1; /* 1 is for us */
 		pNewCache->vattr_cacheable = 0; /* default is not cacheable */
 
-		ret = cos_cache_build_definition_list(&(pNewCache->pDefs), &(pNewCache->vattr_cacheable));
+		ret = cos_cache_build_definition_list(&pDefs, &(pNewCache->vattr_cacheable));
+
+		/* this takes the definitions still waiting for their templates too */
+		cos_cache_append_defs(pNewCache, pDefs);
+
 		if(!ret)
 		{
 			/* OK, we have a cache, lets add indexing for
@@ -464,52 +568,24 @@ static int cos_cache_create()
 			ret = cos_cache_index_all(pNewCache);
 			if(ret == 0)
 			{
-				/* right, indexed cache, lets do our duty for the schema */
-
-				ret = cos_cache_schema_build(pNewCache);
+				/* right, indexed cache, the per attribute dispatch tables */
+				ret = cos_cache_dispatch_build(pNewCache);
+				if(ret == 0)
+				{
+					/* and lets do our duty for the schema */
+					ret = cos_cache_schema_build(pNewCache);
+				}
 				if(ret == 0)
 				{
 					/* now to swap the new cache for the old cache */
-					cosCache *pOldCache;
-
-					slapi_lock_mutex(cache_lock);
-
-					/* turn off caching until the old cache is done */
-					if(pCache)
-					{
-						slapi_vattrcache_cache_none();
-
-						/*
-						 * be sure not to uncache other stuff
-						 * like roles if there is no change in
-						 * state
-						 */
-						if(pCache->vattr_cacheable)
-							slapi_entrycache_vattrcache_watermark_invalidate();
-					}
-					else
-					{
-						if(pNewCache && pNewCache->vattr_cacheable)
-						{
-							slapi_vattrcache_cache_all();
-						}
-					}
-
-					pOldCache = pCache;
-					pCache = pNewCache;
-
-					slapi_unlock_mutex(cache_lock);
-
-					if(pOldCache)
-						cos_cache_release(pOldCache);
-
+					cos_cache_install(pNewCache);
 					cache_built = 1;
 				}
 				else
 				{
 					/* we should not go on without proper schema checking */
 					cos_cache_release(pNewCache);
-					LDAPDebug( LDAP_DEBUG_ANY, "cos_cache_create: failed to cache the schema\n",0,0,0);			
+					LDAPDebug( LDAP_DEBUG_ANY, "cos_cache_create: failed to cache the schema or the dispatch tables\n",0,0,0);
 				}
 			}
 			else
@@ -527,7 +603,7 @@ static int cos_cache_create()
 				firstTime = 0;
 			}
 
-			slapi_ch_free((void**)&pNewCache);
+			cos_cache_del_cache(pNewCache); /* never published */
 		}
 	}
 	else
@@ -568,6 +644,338 @@ static int cos_cache_create()
 }
 
 
+/*
+	cos_cache_install
+	-----------------
+	swaps the new cache for the old one, releasing its refcount
+	to the old cache and allowing it to be destroyed.
+*/
+static void cos_cache_install(cosCache *pNewCache)
+{
+	cosCache *pOldCache;
+
+	slapi_lock_mutex(cache_lock);
+
+	/* turn off caching until the old cache is done */
+	if(pCache)
+	{
+		slapi_vattrcache_cache_none();
+
+		/*
+		 * be sure not to uncache other stuff
+		 * like roles if there is no change in
+		 * state
+		 */
+		if(pCache->vattr_cacheable)
+			slapi_entrycache_vattrcache_watermark_invalidate();
+	}
+	else
+	{
+		if(pNewCache && pNewCache->vattr_cacheable)
+		{
+			slapi_vattrcache_cache_all();
+		}
+	}
+
+	pOldCache = pCache;
+	pCache = pNewCache;
+
+	slapi_unlock_mutex(cache_lock);
+
+	if(pOldCache)
+		cos_cache_release(pOldCache);
+}
+
+/*
+	cos_cache_dn_equal
+	------------------
+	compares a dn of the cache to a changed entry dn
+*/
+static int cos_cache_dn_equal(const char *dn, const Slapi_DN *sdn)
+{
+	Slapi_DN *tmp_sdn = slapi_sdn_new_dn_byref(dn);
+	int ret = !slapi_sdn_compare(tmp_sdn, sdn);
+
+	slapi_sdn_free(&tmp_sdn);
+	return ret;
+}
+
+/*
+	cos_cache_add_delta
+	-------------------
+	records a changed definition or template for the cache thread,
+	called with change_lock held.  Past a few changes, or when the change
+	cannot be told, the whole cache is rebuilt instead.
+*/
+static void cos_cache_add_delta(int deltaType, const char *dn)
+{
+	Slapi_DN *sdn;
+	cosDelta *pDelta;
+	int type;
+
+	if(cos_cache_rebuild_flag)
+		return;
+
+	if((deltaType & COS_DELTA_REBUILD) || dn == NULL ||
+		cos_cache_delta_count >= COS_CACHE_MAX_DELTAS)
+	{
+		cos_cache_del_deltas(&cos_cache_deltas);
+		cos_cache_delta_count = 0;
+		cos_cache_rebuild_flag = 1;
+		return;
+	}
+
+	sdn = slapi_sdn_new_dn_byval(dn);
+	for(type = COS_DELTA_DEFINITION; type <= COS_DELTA_TEMPLATE; type <<= 1)
+	{
+		if(!(deltaType & type))
+			continue;
+
+		/* the entry is read again anyway, once is enough */
+		for(pDelta = cos_cache_deltas; pDelta; pDelta = pDelta->pNext)
+		{
+			if(pDelta->deltaType == type && !slapi_sdn_compare(pDelta->sdn, sdn))
+				break;
+		}
+		if(pDelta)
+			continue;
+
+		pDelta = (cosDelta*)slapi_ch_calloc(1, sizeof(cosDelta));
+		pDelta->deltaType = type;
+		pDelta->sdn = slapi_sdn_dup(sdn);
+		pDelta->pNext = cos_cache_deltas;
+		cos_cache_deltas = pDelta;
+		cos_cache_delta_count++;
+	}
+	slapi_sdn_free(&sdn);
+}
+
+/*
+	cos_cache_del_deltas
+	--------------------
+	walks the list deleting as it goes
+*/
+static void cos_cache_del_deltas(cosDelta **ppDeltas)
+{
+	while(*ppDeltas)
+	{
+		cosDelta *pTmp = (*ppDeltas)->pNext;
+
+		slapi_sdn_free(&((*ppDeltas)->sdn));
+		slapi_ch_free((void**)ppDeltas);
+		*ppDeltas = pTmp;
+	}
+}
+
+/*
+	cos_cache_apply_deltas
+	----------------------
+	Builds a new version of the cache from the current one and the
+	changed entries, and swaps it for the current one.  Only the changed
+	entries are read: a changed definition is read again with its
+	templates, a changed template is read again into a copy of the
+	definitions using it.  The other definitions are shared with the
+	current version, and the indexes are built again in memory.
+
+	returns 0 when the cache is up to date, non-zero when it must be
+	rebuilt from scratch
+*/
+static int cos_cache_apply_deltas(cosDelta *pDeltas)
+{
+	int ret = -1;
+	cosCache *pOldCache = pCache; /* only this thread changes it */
+	cosCache *pNewCache = 0;
+	cosDefinitions *pNewDefs = 0;
+	cosDelta *pDelta;
+	int *pPrivate = 0; /* the definitions the new version owns */
+	int def_index;
+	int count;
+	int changed = 0;
+
+	LDAPDebug( LDAP_DEBUG_TRACE, "--> cos_cache_apply_deltas\n",0,0,0);
+
+	if(pDeltas == NULL)
+	{
+		ret = 0;
+		goto out;
+	}
+	if(pOldCache == NULL)
+	{
+		/* cos was disabled, see if it is now */
+		goto out;
+	}
+
+	pNewCache = (cosCache*)slapi_ch_calloc(1, sizeof(cosCache));
+	pNewCache->refCount = 1; /* 1 is for us */
+	pNewCache->vattr_cacheable = pOldCache->vattr_cacheable;
+	pNewCache->defCount = pOldCache->defCount;
+	pNewCache->ppDefs = (cosDefinitions**)slapi_ch_malloc(
+		(pOldCache->defCount ? pOldCache->defCount : 1) * sizeof(cosDefinitions*));
+	memcpy(pNewCache->ppDefs, pOldCache->ppDefs, pOldCache->defCount * sizeof(cosDefinitions*));
+	pPrivate = (int*)slapi_ch_calloc(pOldCache->defCount ? pOldCache->defCount : 1, sizeof(int));
+
+	/* the changed definitions first: drop them, and read them again */
+	for(pDelta = pDeltas; pDelta; pDelta = pDelta->pNext)
+	{
+		if(pDelta->deltaType != COS_DELTA_DEFINITION)
+			continue;
+
+		for(def_index = 0; def_index < pNewCache->defCount; def_index++)
+		{
+			cosDefinitions *pDef = pNewCache->ppDefs[def_index];
+
+			if(pDef && cos_cache_dn_equal(pDef->pDn->val, pDelta->sdn))
+				pNewCache->ppDefs[def_index] = 0;
+		}
+
+		LDAPDebug( LDAP_DEBUG_PLUGIN, "cos: reading cos definition %s again\n",
+		           slapi_sdn_get_dn(pDelta->sdn),0,0);
+		cos_cache_add_dn_defs((char*)slapi_sdn_get_dn(pDelta->sdn), LDAP_SCOPE_BASE, &pNewDefs);
+		changed = 1;
+	}
+
+	/* then the changed templates, into copies of the definitions using them */
+	for(pDelta = pDeltas; pDelta; pDelta = pDelta->pNext)
+	{
+		Slapi_DN *parent;
+
+		if(pDelta->deltaType != COS_DELTA_TEMPLATE)
+			continue;
+
+		parent = slapi_sdn_new();
+		slapi_sdn_get_parent(pDelta->sdn, parent);
+
+		for(def_index = 0; def_index < pNewCache->defCount; def_index++)
+		{
+			cosDefinitions *pDef = pNewCache->ppDefs[def_index];
+			cosTemplates *pTmpls = 0;
+			cosTemplates **ppTmpl;
+			cosAttrValue *pTmplDn;
+
+			if(pDef == 0)
+				continue;
+
+			/* one level below the template dn for a classic scheme, the dn itself for a pointer one */
+			for(pTmplDn = pDef->pCosTemplateDn; pTmplDn; pTmplDn = pTmplDn->list.pNext)
+			{
+				if(cos_cache_dn_equal(pTmplDn->val, pDef->pCosSpecifier ? parent : pDelta->sdn))
+					break;
+			}
+			if(pTmplDn == 0)
+				continue;
+
+			/* the template as it is now, if it is still one */
+			cos_cache_add_dn_tmpls((char*)slapi_sdn_get_dn(pDelta->sdn), LDAP_SCOPE_BASE,
+			                       pDef->pCosSpecifier, pDef->pCosAttrs, &pTmpls);
+
+			for(ppTmpl = &pDef->pCosTmps; *ppTmpl; ppTmpl = (cosTemplates**)&((*ppTmpl)->list.pNext))
+			{
+				if(cos_cache_dn_equal((*ppTmpl)->pDn->val, pDelta->sdn))
+					break;
+			}
+			if(pTmpls == 0 && *ppTmpl == 0)
+			{
+				/* it was none of ours and is not now */
+				continue;
+			}
+
+			if(!pPrivate[def_index])
+			{
+				pDef = cos_cache_dup_defn(pDef);
+				pNewCache->ppDefs[def_index] = pDef;
+				pPrivate[def_index] = 1;
+
+				for(ppTmpl = &pDef->pCosTmps; *ppTmpl; ppTmpl = (cosTemplates**)&((*ppTmpl)->list.pNext))
+				{
+					if(cos_cache_dn_equal((*ppTmpl)->pDn->val, pDelta->sdn))
+						break;
+				}
+			}
+
+			/* swap the template for its current version */
+			if(*ppTmpl)
+			{
+				cosTemplates *pOldTmpl = *ppTmpl;
+
+				*ppTmpl = pOldTmpl->list.pNext;
+				cos_cache_del_tmpl(pOldTmpl);
+			}
+			if(pTmpls)
+				cos_cache_add_ll_entry((void**)&(pDef->pCosTmps), pTmpls, NULL);
+
+			changed = 1;
+		}
+
+		slapi_sdn_free(&parent);
+	}
+
+	if(!changed)
+	{
+		/* none of the changes was significant */
+		ret = 0;
+		goto out;
+	}
+
+	/* the new version takes its references on the definitions it keeps */
+	count = 0;
+	for(def_index = 0; def_index < pNewCache->defCount; def_index++)
+	{
+		cosDefinitions *pDef = pNewCache->ppDefs[def_index];
+
+		if(pDef == 0)
+			continue;
+
+		if(pPrivate[def_index])
+			cos_cache_link_defn(pDef);
+		else
+			PR_AtomicIncrement(&(pDef->refCount));
+
+		pNewCache->ppDefs[count++] = pDef;
+	}
+	pNewCache->defCount = count;
+	cos_cache_append_defs(pNewCache, pNewDefs);
+	pNewDefs = 0;
+	slapi_ch_free((void**)&pPrivate);
+
+	if(cos_cache_index_all(pNewCache) ||
+		cos_cache_dispatch_build(pNewCache) ||
+		cos_cache_schema_build(pNewCache))
+	{
+		/* typically, the last templates went away */
+		goto out;
+	}
+
+	cos_cache_install(pNewCache);
+	pNewCache = 0;
+	LDAPDebug( LDAP_DEBUG_PLUGIN, "cos: Class of service cache updated.\n",0,0,0);
+	ret = 0;
+
+out:
+	if(pPrivate)
+	{
+		/* the new version did not take anything yet */
+		for(def_index = 0; def_index < pNewCache->defCount; def_index++)
+		{
+			if(pPrivate[def_index])
+				cos_cache_del_defn(pNewCache->ppDefs[def_index]);
+		}
+		pNewCache->defCount = 0;
+		slapi_ch_free((void**)&pPrivate);
+	}
+	while(pNewDefs)
+	{
+		cosDefinitions *pDef = pNewDefs;
+
+		pNewDefs = pNewDefs->list.pNext;
+		cos_cache_del_defn(pDef);
+	}
+	if(pNewCache)
+		cos_cache_del_cache(pNewCache); /* never published */
+
+	LDAPDebug( LDAP_DEBUG_TRACE, "<-- cos_cache_apply_deltas\n",0,0,0);
+	return ret;
+}
+
 /*
 	cos_cache_build_definition_list
 	-------------------------------
@@ -643,7 +1051,7 @@ static int cos_cache_build_definition_list(cosDefinitions **pDefs, int *vattr_ca
 								/* here's a suffix, lets search it... */
 								if(suffixVals[valIndex]->bv_val)
 								{
-									if(!cos_cache_add_dn_defs(suffixVals[valIndex]->bv_val ,pDefs))
+									if(!cos_cache_add_dn_defs(suffixVals[valIndex]->bv_val, LDAP_SCOPE_SUBTREE, pDefs))
 									{
 										*vattr_cacheable = -1;
 										cos_def_available = 1;
@@ -1035,6 +1443,7 @@ bail:
 	-------------------------
 	takes a dn as argument and searches the dn for cos definitions,
 	adding any found to the definition list. Change to use search callback API.
+	A base scope reads the one definition again.
 
 	Returns: 0: found at least one definition entry that got added to the
 		cache successfully.
@@ -1043,7 +1452,7 @@ bail:
 
 #define DN_DEF_FILTER "(&(|(objectclass=cosSuperDefinition)(objectclass=cosDefinition))(objectclass=ldapsubentry))"
 
-static int cos_cache_add_dn_defs(char *dn, cosDefinitions **pDefs)
+static int cos_cache_add_dn_defs(char *dn, int scope, cosDefinitions **pDefs)
 {
 	Slapi_PBlock *pDnSearch = 0;
 	struct dn_defs_info info = {NULL, 0, 0};
@@ -1051,7 +1460,7 @@ static int cos_cache_add_dn_defs(char *dn, cosDefinitions **pDefs)
 	if (pDnSearch) {
 		info.ret=-1; /* assume no good defs */
 		info.pDefs=pDefs;
-		slapi_search_internal_set_pb(pDnSearch, dn, LDAP_SCOPE_SUBTREE,
+		slapi_search_internal_set_pb(pDnSearch, dn, scope,
 									 DN_DEF_FILTER,NULL,0,
 									 NULL,NULL,cos_get_plugin_identity(),0);
 		slapi_search_internal_callback_pb(pDnSearch,
@@ -1245,6 +1654,8 @@ static int 	cos_dn_tmpl_entries_cb (Slapi_Entry* e, void *callback_data) {
 	takes a dn as argument and searches the dn for cos templates,
 	adding any found to the template list
 	This is the new version using call back search API
+	The scope is one level below the dn for schemes with a cos specifier,
+	the dn itself otherwise, or when reading one template again.
 	
 	Returns: zero for success--found at least one good tmpl for this def.
 			non-zero: failed to add any templs for this def.
@@ -1252,21 +1663,14 @@ static int 	cos_dn_tmpl_entries_cb (Slapi_Entry* e, void *callback_data) {
 
 #define TMPL_FILTER "(&(objectclass=costemplate)(|(objectclass=costemplate)(objectclass=ldapsubentry)))"
 
-static int cos_cache_add_dn_tmpls(char *dn, cosAttrValue *pCosSpecifier, cosAttrValue *pAttrs, cosTemplates **pTmpls)
+static int cos_cache_add_dn_tmpls(char *dn, int scope, cosAttrValue *pCosSpecifier, cosAttrValue *pAttrs, cosTemplates **pTmpls)
 {
 	void *plugin_id;
-	int scope;
 	struct tmpl_info	info = {NULL, 0, 0};
 	Slapi_PBlock *pDnSearch = 0;
 
 	LDAPDebug( LDAP_DEBUG_TRACE, "--> cos_cache_add_dn_tmpls\n",0,0,0);
 	
-	/* no cos specifier means this is an indirect scheme */
-	if(pCosSpecifier)
-		scope = LDAP_SCOPE_ONELEVEL;
-	else
-		scope = LDAP_SCOPE_BASE;
-	
 	/* Use new internal operation API */
 	pDnSearch = slapi_pblock_new();
 	plugin_id=cos_get_plugin_identity();
@@ -1305,7 +1709,8 @@ static int cos_cache_add_dn_tmpls(char *dn, cosAttrValue *pCosSpecifier, cosAttr
 					back the error so we can roll two messages into one--this
 					is to reduce the number of error messages at cos definiton
 					load time--it is common to see the defs before the tmpls
-					arrive.
+					arrive.  The def is added all the same, so that the
+					tmpls are picked up as they arrive.
 					
 */
 static int cos_cache_add_defn(
@@ -1374,8 +1779,25 @@ static int cos_cache_add_defn(
 			
 			while(pTmpTmplDn && cosType != COSTYPE_INDIRECT)
 			{
-				/* create the template */
-				if(!cos_cache_add_dn_tmpls(pTmpTmplDn->val, *spec, *pAttrs, &(theDef->pCosTmps)))
+				/*
+					normalize the dn once and for all, the cache
+					versions sharing the def index it as is
+				*/
+				char *normed = slapi_create_dn_string("%s", pTmpTmplDn->val);
+				if (normed) {
+					slapi_ch_free_string(&pTmpTmplDn->val);
+					pTmpTmplDn->val = normed;
+				} else {
+					LDAPDebug(LDAP_DEBUG_ANY, 
+						"cos_cache_add_defn: failed to normalize dn %s. "
+						"Processing the pre normalized dn.\n", 
+						pTmpTmplDn->val, 0, 0);
+				}
+
+				/* create the template, no cos specifier means this is a pointer scheme */
+				if(!cos_cache_add_dn_tmpls(pTmpTmplDn->val,
+				                           *spec ? LDAP_SCOPE_ONELEVEL : LDAP_SCOPE_BASE,
+				                           *spec, *pAttrs, &(theDef->pCosTmps)))
 					tmplCount++;
 
 				pTmpTmplDn = pTmpTmplDn->list.pNext;
@@ -1388,49 +1810,47 @@ static int cos_cache_add_defn(
 				"no templates for cos definition at %s.\n",(*dn)->val,0,0);*/
 				ret = COS_DEF_ERROR_NO_TEMPLATES;
 			}
-			else
+			else if(cosType == COSTYPE_INDIRECT)
 			{
-				if(cosType == COSTYPE_INDIRECT)
-				{
-					/* 
-						Indirect cos schemes have no templates,
-						however, in order to take advantage of existing code
-						which is optimized to do a binary search on attributes
-						which are found through their templates, we add a dummy
-						template and dummy attributes.  The value of the attributes
-						will be ignored when later assessing a query.
-					*/
-					pAttrsIter = *pAttrs;
-
-					while(pAttrsIter)
-					{
-						pDummyAttrVal = NULL;
-						cos_cache_add_attrval(&pDummyAttrVal, "not used");
-						cos_cache_add_attr(&pDummyAttributes, pAttrsIter->val, pDummyAttrVal);
+				/* 
+					Indirect cos schemes have no templates,
+					however, in order to take advantage of existing code
+					which is optimized to do a binary search on attributes
+					which are found through their templates, we add a dummy
+					template and dummy attributes.  The value of the attributes
+					will be ignored when later assessing a query.
+				*/
+				pAttrsIter = *pAttrs;
 
-						pAttrsIter = pAttrsIter->list.pNext;
-					}
-					
-					cos_cache_add_attrval(tmpDn, "cn=dummy,");
+				while(pAttrsIter)
+				{
+					pDummyAttrVal = NULL;
+					cos_cache_add_attrval(&pDummyAttrVal, "not used");
+					cos_cache_add_attr(&pDummyAttributes, pAttrsIter->val, pDummyAttrVal);
 
-					cos_cache_add_tmpl(&(theDef->pCosTmps), *tmpDn, NULL, *spec, pDummyAttributes,NULL);
-					*tmpDn = 0;
+					pAttrsIter = pAttrsIter->list.pNext;
 				}
+				
+				cos_cache_add_attrval(tmpDn, "cn=dummy,");
 
-				theDef->pDn = *dn;
-				theDef->cosType = cosType;
-				theDef->pCosTargetTree = *tree;
-				theDef->pCosTemplateDn = *tmpDn;
-				theDef->pCosSpecifier = *spec;
-				theDef->pCosAttrs = *pAttrs;
-				theDef->pCosOverrides = *pOverrides;
-				theDef->pCosOperational = *pOperational;
-				theDef->pCosMerge = *pCosMerge;
-				theDef->pCosOpDefault = *pCosOpDefault;
-
-				cos_cache_add_ll_entry((void**)pDefs, theDef, NULL);
-				LDAPDebug( LDAP_DEBUG_PLUGIN, "Added cosDefinition %s\n",(*dn)->val,0,0);
+				cos_cache_add_tmpl(&(theDef->pCosTmps), *tmpDn, NULL, *spec, pDummyAttributes,NULL);
+				*tmpDn = 0;
 			}
+
+			theDef->pDn = *dn;
+			theDef->cosType = cosType;
+			theDef->pCosTargetTree = *tree;
+			theDef->pCosTemplateDn = *tmpDn;
+			theDef->pCosSpecifier = *spec;
+			theDef->pCosAttrs = *pAttrs;
+			theDef->pCosOverrides = *pOverrides;
+			theDef->pCosOperational = *pOperational;
+			theDef->pCosMerge = *pCosMerge;
+			theDef->pCosOpDefault = *pCosOpDefault;
+
+			cos_cache_link_defn(theDef);
+			cos_cache_add_ll_entry((void**)pDefs, theDef, NULL);
+			LDAPDebug( LDAP_DEBUG_PLUGIN, "Added cosDefinition %s\n",(*dn)->val,0,0);
 		}
 		else
 		{
@@ -1438,7 +1858,7 @@ static int cos_cache_add_defn(
 		}
 	}
 out:
-	if(ret < 0)
+	if(ret < 0 && ret != COS_DEF_ERROR_NO_TEMPLATES)
 	{
 		slapi_ch_free((void**)&theDef);
 		if(dn)
@@ -1457,6 +1877,129 @@ out:
 	return ret;
 }
 
+/*
+	cos_cache_link_defn
+	-------------------
+	fixes up the parent pointers of the templates and attributes of a
+	complete definition, and marks the attributes as overides if
+	necessary.  The definition is not modified afterwards, as cache
+	versions may share it: it starts with the reference of the version
+	being built.
+*/
+static void cos_cache_link_defn(cosDefinitions *pDef)
+{
+	cosTemplates *pCosTmps = pDef->pCosTmps;
+
+	pDef->refCount = 1;
+
+	while(pCosTmps)
+	{
+		cosAttributes *pAttrs = pCosTmps->pAttrs;
+
+		pCosTmps->pParent = pDef;
+
+		while(pAttrs)
+		{
+			pAttrs->pParent = pCosTmps;
+			pAttrs->attr_override = cos_cache_attrval_exists(pDef->pCosOverrides, pAttrs->pAttrName);
+			pAttrs->attr_operational = cos_cache_attrval_exists(pDef->pCosOperational, pAttrs->pAttrName);
+			pAttrs->attr_cos_merge = cos_cache_attrval_exists(pDef->pCosMerge, pAttrs->pAttrName);
+			pAttrs->attr_operational_default = cos_cache_attrval_exists(pDef->pCosOpDefault, pAttrs->pAttrName);
+
+			pAttrs = pAttrs->list.pNext;
+		}
+
+		pCosTmps = pCosTmps->list.pNext;
+	}
+}
+
+/*
+	cos_cache_dup_defn
+	------------------
+	copies a definition and its templates, for a cache version to patch
+	it; the copy must be linked once patched
+*/
+static cosDefinitions *cos_cache_dup_defn(cosDefinitions *pDef)
+{
+	cosDefinitions *theDef = (cosDefinitions*)slapi_ch_calloc(1, sizeof(cosDefinitions));
+	cosTemplates **ppLast = &theDef->pCosTmps;
+	cosTemplates *pCosTmps;
+
+	theDef->cosType = pDef->cosType;
+	theDef->pDn = cos_cache_dup_attrval_list(pDef->pDn);
+	theDef->pCosTargetTree = cos_cache_dup_attrval_list(pDef->pCosTargetTree);
+	theDef->pCosTemplateDn = cos_cache_dup_attrval_list(pDef->pCosTemplateDn);
+	theDef->pCosSpecifier = cos_cache_dup_attrval_list(pDef->pCosSpecifier);
+	theDef->pCosAttrs = cos_cache_dup_attrval_list(pDef->pCosAttrs);
+	theDef->pCosOverrides = cos_cache_dup_attrval_list(pDef->pCosOverrides);
+	theDef->pCosOperational = cos_cache_dup_attrval_list(pDef->pCosOperational);
+	theDef->pCosOpDefault = cos_cache_dup_attrval_list(pDef->pCosOpDefault);
+	theDef->pCosMerge = cos_cache_dup_attrval_list(pDef->pCosMerge);
+
+	for(pCosTmps = pDef->pCosTmps; pCosTmps; pCosTmps = pCosTmps->list.pNext)
+	{
+		*ppLast = cos_cache_dup_tmpl(pCosTmps);
+		ppLast = (cosTemplates**)&((*ppLast)->list.pNext);
+	}
+
+	return theDef;
+}
+
+/*
+	cos_cache_del_defn
+	------------------
+	deletes a definition and its templates
+*/
+static void cos_cache_del_defn(cosDefinitions *pDef)
+{
+	while(pDef->pCosTmps)
+	{
+		cosTemplates *pTmpT = pDef->pCosTmps;
+
+		pDef->pCosTmps = pTmpT->list.pNext;
+		cos_cache_del_tmpl(pTmpT);
+	}
+
+	cos_cache_del_attrval_list(&(pDef->pDn));
+	cos_cache_del_attrval_list(&(pDef->pCosTargetTree));
+	cos_cache_del_attrval_list(&(pDef->pCosTemplateDn));
+	cos_cache_del_attrval_list(&(pDef->pCosSpecifier));
+	cos_cache_del_attrval_list(&(pDef->pCosAttrs));
+	cos_cache_del_attrval_list(&(pDef->pCosOverrides));
+	cos_cache_del_attrval_list(&(pDef->pCosOperational));
+	cos_cache_del_attrval_list(&(pDef->pCosMerge));
+	cos_cache_del_attrval_list(&(pDef->pCosOpDefault));
+	slapi_ch_free((void**)&pDef);
+}
+
+/*
+	cos_cache_append_defs
+	---------------------
+	moves a list of new definitions to the definitions of the cache
+*/
+static void cos_cache_append_defs(cosCache *pCache, cosDefinitions *pDefs)
+{
+	cosDefinitions *pDef;
+	int count = 0;
+
+	for(pDef = pDefs; pDef; pDef = pDef->list.pNext)
+		count++;
+
+	if(count == 0)
+		return;
+
+	pCache->ppDefs = (cosDefinitions**)slapi_ch_realloc((char*)pCache->ppDefs,
+		(pCache->defCount + count) * sizeof(cosDefinitions*));
+
+	while(pDefs)
+	{
+		pDef = pDefs;
+		pDefs = pDefs->list.pNext;
+		pDef->list.pNext = NULL;
+		pCache->ppDefs[pCache->defCount++] = pDef;
+	}
+}
+
 /*
 	cos_cache_del_attrval_list
 	--------------------------
@@ -1479,6 +2022,29 @@ static void cos_cache_del_attrval_list(cosAttrValue **pVal)
 }
 
 
+/*
+	cos_cache_dup_attrval_list
+	--------------------------
+	copies the list, in the same order
+*/
+static cosAttrValue *cos_cache_dup_attrval_list(cosAttrValue *pVal)
+{
+	cosAttrValue *pDup = 0;
+	cosAttrValue **ppLast = &pDup;
+
+	for(; pVal; pVal = pVal->list.pNext)
+	{
+		cosAttrValue *theVal = (cosAttrValue*)slapi_ch_calloc(1, sizeof(cosAttrValue));
+
+		theVal->val = slapi_ch_strdup(pVal->val);
+		*ppLast = theVal;
+		ppLast = (cosAttrValue**)&(theVal->list.pNext);
+	}
+
+	return pDup;
+}
+
+
 /* 
 	cos_cache_add_attrval
 	---------------------
@@ -1715,8 +2281,6 @@ int cos_cache_release(cos_cache *ptheCache)
 
 	if(destroy)
 	{
-		cosDefinitions *pDef = pOldCache->pDefs;
-
 		/* now is the first time it is
 		 * safe to assess whether
 		 * vattr caching can be turned on
@@ -1727,52 +2291,40 @@ int cos_cache_release(cos_cache *ptheCache)
 		}
 
 		/* destroy the cache here - no locking required, no references outstanding */
+		cos_cache_del_cache(pOldCache);
+	}
 
-		if(pDef)
-			cos_cache_del_schema(pOldCache);
+	LDAPDebug( LDAP_DEBUG_TRACE, "<-- cos_cache_release\n",0,0,0);
 
-		while(pDef)
-		{
-			cosDefinitions *pTmpD = pDef;
-			cosTemplates *pCosTmps = pDef->pCosTmps;
+	return ret;
+}
 
-			while(pCosTmps)
-			{
-				cosTemplates *pTmpT = pCosTmps;
-				
-				pCosTmps = pCosTmps->list.pNext;
 
-				cos_cache_del_attr_list(&(pTmpT->pAttrs));
-				cos_cache_del_attrval_list(&(pTmpT->pObjectclasses));
-				cos_cache_del_attrval_list(&(pTmpT->pDn));
-				slapi_ch_free((void**)&(pTmpT->cosGrade));
-				slapi_ch_free((void**)&pTmpT);
-			}
+/*
+	cos_cache_del_cache
+	-------------------
+	destroys a cache version, and the definitions no other
+	version uses
+*/
+static void cos_cache_del_cache(cosCache *pOldCache)
+{
+	int def_index;
 
-			pDef = pDef->list.pNext;
-			
-			cos_cache_del_attrval_list(&(pTmpD->pDn));
-			cos_cache_del_attrval_list(&(pTmpD->pCosTargetTree));
-			cos_cache_del_attrval_list(&(pTmpD->pCosTemplateDn));
-			cos_cache_del_attrval_list(&(pTmpD->pCosSpecifier));
-			cos_cache_del_attrval_list(&(pTmpD->pCosAttrs));
-			cos_cache_del_attrval_list(&(pTmpD->pCosOverrides));
-			cos_cache_del_attrval_list(&(pTmpD->pCosOperational));
-			cos_cache_del_attrval_list(&(pTmpD->pCosMerge));
-			cos_cache_del_attrval_list(&(pTmpD->pCosOpDefault));
-			slapi_ch_free((void**)&pTmpD);
-		}
+	cos_cache_del_schema(pOldCache);
+	cos_cache_del_dispatch(pOldCache);
 
-		if(pOldCache->ppAttrIndex)
-			slapi_ch_free((void**)&(pOldCache->ppAttrIndex));
-		if(pOldCache->ppTemplateList)
-			slapi_ch_free((void**)&(pOldCache->ppTemplateList));
-		slapi_ch_free((void**)&pOldCache);
+	for(def_index = 0; def_index < pOldCache->defCount; def_index++)
+	{
+		if(PR_AtomicDecrement(&(pOldCache->ppDefs[def_index]->refCount)) == 0)
+			cos_cache_del_defn(pOldCache->ppDefs[def_index]);
 	}
+	slapi_ch_free((void**)&(pOldCache->ppDefs));
 
-	LDAPDebug( LDAP_DEBUG_TRACE, "<-- cos_cache_release\n",0,0,0);
-
-	return ret;
+	if(pOldCache->ppAttrIndex)
+		slapi_ch_free((void**)&(pOldCache->ppAttrIndex));
+	if(pOldCache->ppTemplateList)
+		slapi_ch_free((void**)&(pOldCache->ppTemplateList));
+	slapi_ch_free((void**)&pOldCache);
 }
 
 
@@ -1790,6 +2342,7 @@ static void cos_cache_del_attr_list(cosAttributes **pAttrs)
 		cosAttributes *pTmp = (*pAttrs)->list.pNext;
 
 		cos_cache_del_attrval_list(&((*pAttrs)->pAttrValue));
+		slapi_valueset_free((*pAttrs)->pValueSet);
 		slapi_ch_free((void**)&((*pAttrs)->pAttrName));
 		slapi_ch_free((void**)&(*pAttrs));
 		*pAttrs = pTmp;
@@ -1807,28 +2360,17 @@ static void cos_cache_del_attr_list(cosAttributes **pAttrs)
 */
 static void cos_cache_del_schema(cosCache *pCache)
 {
-	char *pLastName = 0;
 	int attr_index = 0;
 
 	LDAPDebug( LDAP_DEBUG_TRACE, "--> cos_cache_del_schema\n",0,0,0);
 
-	if(pCache && pCache->attrCount && pCache->ppAttrIndex)
+	if(pCache && pCache->ppDispatch)
 	{
-		pLastName = pCache->ppAttrIndex[0]->pAttrName;
-
-		for(attr_index=1; attr_index<pCache->attrCount; attr_index++)
+		for(attr_index=0; attr_index<pCache->attrCount; attr_index++)
 		{
-			if(slapi_utf8casecmp((unsigned char*)pCache->ppAttrIndex[attr_index]->pAttrName, (unsigned char*)pLastName))
-			{
-				/* remember what went before */
-				pLastName = pCache->ppAttrIndex[attr_index]->pAttrName;
-
-				/* then blow it away */
-				cos_cache_del_attrval_list(&(pCache->ppAttrIndex[attr_index]->pObjectclasses));
-			}
+			if(pCache->ppDispatch[attr_index])
+				cos_cache_del_attrval_list(&(pCache->ppDispatch[attr_index]->pObjectclasses));
 		}
-		/* Finally, remove the first attribute's objectclass list */
-		cos_cache_del_attrval_list(&(pCache->ppAttrIndex[0]->pObjectclasses));
 	}
 
 	LDAPDebug( LDAP_DEBUG_TRACE, "<-- cos_cache_del_schema\n",0,0,0);
@@ -1852,10 +2394,10 @@ static int cos_cache_add_attr(cosAttributes **pAttrs, char *name, cosAttrValue *
 	if(theAttr)
 	{
 		theAttr->pAttrValue = val;
-		theAttr->pObjectclasses = 0; /* schema issues come later */
 		theAttr->pAttrName = slapi_ch_strdup(name);
 		if(theAttr->pAttrName)
 		{
+			cos_cache_attr_valueset(theAttr);
 			cos_cache_add_ll_entry((void**)pAttrs, theAttr, NULL);
 			LDAPDebug( LDAP_DEBUG_PLUGIN, "cos_cache_add_attr: Added attribute %s\n",name,0,0);
 		}
@@ -1877,6 +2419,24 @@ static int cos_cache_add_attr(cosAttributes **pAttrs, char *name, cosAttrValue *
 }
 
 
+/*
+	cos_cache_attr_valueset
+	-----------------------
+	builds the values of the attribute, shared by all the entries
+	using the template
+*/
+static void cos_cache_attr_valueset(cosAttributes *pAttr)
+{
+	cosAttrValue *pAttrVal;
+
+	pAttr->pValueSet = slapi_valueset_new();
+	for(pAttrVal = pAttr->pAttrValue; pAttrVal; pAttrVal = pAttrVal->list.pNext)
+	{
+		slapi_valueset_add_value_ext(pAttr->pValueSet, slapi_value_new_string(pAttrVal->val), SLAPI_VALUE_FLAG_PASSIN);
+	}
+}
+
+
 /*
 	cos_cache_add_tmpl
 	------------------
@@ -2030,6 +2590,51 @@ static int cos_cache_add_tmpl(cosTemplates **pTemplates, cosAttrValue *dn, cosAt
 	return ret;
 }
 
+/*
+	cos_cache_dup_tmpl
+	------------------
+	copies a template and its attributes
+*/
+static cosTemplates *cos_cache_dup_tmpl(cosTemplates *pTmpl)
+{
+	cosTemplates *theTemp = (cosTemplates*)slapi_ch_calloc(1, sizeof(cosTemplates));
+	cosAttributes **ppLast = &theTemp->pAttrs;
+	cosAttributes *pAttrs;
+
+	theTemp->pDn = cos_cache_dup_attrval_list(pTmpl->pDn);
+	theTemp->pObjectclasses = cos_cache_dup_attrval_list(pTmpl->pObjectclasses);
+	theTemp->cosGrade = slapi_ch_strdup(pTmpl->cosGrade);
+	theTemp->template_default = pTmpl->template_default;
+	theTemp->cosPriority = pTmpl->cosPriority;
+
+	for(pAttrs = pTmpl->pAttrs; pAttrs; pAttrs = pAttrs->list.pNext)
+	{
+		cosAttributes *theAttr = (cosAttributes*)slapi_ch_calloc(1, sizeof(cosAttributes));
+
+		theAttr->pAttrName = slapi_ch_strdup(pAttrs->pAttrName);
+		theAttr->pAttrValue = cos_cache_dup_attrval_list(pAttrs->pAttrValue);
+		cos_cache_attr_valueset(theAttr);
+		*ppLast = theAttr;
+		ppLast = (cosAttributes**)&(theAttr->list.pNext);
+	}
+
+	return theTemp;
+}
+
+/*
+	cos_cache_del_tmpl
+	------------------
+	deletes a template and its attributes
+*/
+static void cos_cache_del_tmpl(cosTemplates *pTmpl)
+{
+	cos_cache_del_attr_list(&(pTmpl->pAttrs));
+	cos_cache_del_attrval_list(&(pTmpl->pObjectclasses));
+	cos_cache_del_attrval_list(&(pTmpl->pDn));
+	slapi_ch_free((void**)&(pTmpl->cosGrade));
+	slapi_ch_free((void**)&pTmpl);
+}
+
 /*
 	cos_cache_attrval_exists
 	------------------------
@@ -2221,6 +2826,9 @@ static int cos_cache_query_attr(cos_cache *ptheCache, vattr_context *context,
 	int using_default = 0;
 	int entry_has_value = 0;
 	int merge_mode = 0;
+	int *pCandidates = 0;	/* the templates worth looking at */
+	int candidateCount = 0;
+	int candidate = 0;
 
 	LDAPDebug( LDAP_DEBUG_TRACE, "--> cos_cache_query_attr\n",0,0,0);
 
@@ -2316,23 +2924,26 @@ static int cos_cache_query_attr(cos_cache *ptheCache, vattr_context *context,
 		Now we need to iterate through the attributes to discover
 		if one fits all the criteria, we'll take the first that does
 		and blow off the rest unless the definition has merge-scheme
-		set.
+		set.  Only the templates the dispatch table selects for this
+		entry are worth a look, in the order of the attribute index.
 	*/
-	do
+	candidateCount = cos_cache_dispatch_candidates(pCache, attr_index, context, e, pDn, &pCandidates);
+	for(candidate = 0; candidate < candidateCount && (hit == 0 || merge_mode); candidate++)
 	{
 		/* for convenience, define some pointers */
-		cosAttributes *pAttr = pCache->ppAttrIndex[attr_index]; 
+		cosAttributes *pAttr = pCache->ppAttrIndex[pCandidates[candidate]];
 		cosTemplates *pTemplate = (cosTemplates*)pAttr->pParent;
 		cosDefinitions *pDef = (cosDefinitions*)pTemplate->pParent;
 		cosAttrValue *pTargetTree = pDef->pCosTargetTree;
 
+		attr_index = pCandidates[candidate];
+
 		/* now for the tests */
 
 		/* would we be allowed to supply this attribute if we had one? */
 		if (entry_has_value && !pAttr->attr_override && !pAttr->attr_operational && !pAttr->attr_operational_default)
 		{
 			/* answer: no, move on to the next attribute */
-			attr_index++;
 			continue;
 		}
 
@@ -2340,7 +2951,6 @@ static int cos_cache_query_attr(cos_cache *ptheCache, vattr_context *context,
 		if(merge_mode && pAttr->attr_cos_merge == 0)
 		{
 			/* answer: no, move on to the next attribute */
-			attr_index++;
 			continue;
 		}
 
@@ -2531,15 +3141,7 @@ static int cos_cache_query_attr(cos_cache *ptheCache, vattr_context *context,
 
 		} /* while(hit == 0 && pTargetTree) */
 
-
-		if(hit==0 || merge_mode)
-			attr_index++;
-
-	} while(
-				(hit == 0 || merge_mode) && 
-				pCache->attrCount > attr_index && 
-				!slapi_utf8casecmp((unsigned char*)type, (unsigned char*)pCache->ppAttrIndex[attr_index]->pAttrName)
-				);
+	} /* for each candidate */
 
 	if(!merge_mode)
 		attr_matched_index = attr_index;
@@ -2601,6 +3203,7 @@ static int cos_cache_query_attr(cos_cache *ptheCache, vattr_context *context,
 	}
 
 bail:
+	slapi_ch_free((void**)&pCandidates);
 
 	LDAPDebug( LDAP_DEBUG_TRACE, "<-- cos_cache_query_attr\n",0,0,0);
 	return ret;
@@ -2657,7 +3260,7 @@ static int cos_cache_schema_check(cosCache *pCache, int attr_index, Slapi_Attr *
 	hint = slapi_attr_first_value( pObjclasses, &val );
 	while(hint != -1) 
 	{
-		ret = cos_cache_attrval_exists(pCache->ppAttrIndex[attr_index]->pObjectclasses, (char*) slapi_value_get_string(val));
+		ret = cos_cache_attrval_exists(pCache->ppDispatch[attr_index]->pObjectclasses, (char*) slapi_value_get_string(val));
 		if(ret)
 			break;
 	
@@ -2673,13 +3276,13 @@ static int cos_cache_schema_check(cosCache *pCache, int attr_index, Slapi_Attr *
 	----------------------
 	For each attribute in our global cache add the objectclasses which allow it.
 	This may be referred to later to check schema is not being violated.
+	The lists hang off the dispatch table of each attribute type, so they
+	must be built first.
 */
 static int cos_cache_schema_build(cosCache *pCache)
 {
 	int ret = 0; /* we assume success, with operational attributes not supplied in schema we might fail otherwise */
 	struct objclass	*oc;
-	char *pLastName = 0;
-	cosAttrValue *pLastRef = 0;
 	int attr_index = 0;
 
 	LDAPDebug( LDAP_DEBUG_TRACE, "--> cos_cache_schema_build\n",0,0,0);
@@ -2722,11 +3325,10 @@ static int cos_cache_schema_build(cosCache *pCache)
 							objectclass to the objectclass list
 							note the index refers to the first
 							occurrence of this attribute in the list,
-							later we will copy over references to this
-							list to all the other attribute duplicates.
+							where its dispatch table is.
 						*/
 
-						cos_cache_add_attrval(&(pCache->ppAttrIndex[attr_index]->pObjectclasses), oc->oc_name);
+						cos_cache_add_attrval(&(pCache->ppDispatch[attr_index]->pObjectclasses), oc->oc_name);
 						ret = 0;
 					}
 					index++;
@@ -2738,30 +3340,6 @@ static int cos_cache_schema_build(cosCache *pCache)
 	}
     oc_unlock();
 
-	/*
-		OK, now we need to add references to the real
-		lists to the duplicate attribute entries.
-		(this allows the schema check to be a little
-		less complex and just a little quicker)
-	*/
-	pLastName = pCache->ppAttrIndex[0]->pAttrName;
-	pLastRef = pCache->ppAttrIndex[0]->pObjectclasses;
-
-	for(attr_index=1; attr_index<pCache->attrCount; attr_index++)
-	{
-		if(!slapi_utf8casecmp((unsigned char*)pCache->ppAttrIndex[attr_index]->pAttrName, (unsigned char*)pLastName))
-		{
-			/* copy over reference */
-			pCache->ppAttrIndex[attr_index]->pObjectclasses = pLastRef;
-		}
-		else
-		{
-			/* remember what went before */
-			pLastName = pCache->ppAttrIndex[attr_index]->pAttrName;
-			pLastRef = pCache->ppAttrIndex[attr_index]->pObjectclasses;
-		}
-	}
-
 	LDAPDebug( LDAP_DEBUG_TRACE, "<-- cos_cache_schema_build\n",0,0,0);
 	return ret;
 }
@@ -2772,16 +3350,14 @@ static int cos_cache_schema_build(cosCache *pCache)
 	-------------------
 	Indexes every attribute in the cache for fast binary lookup
 	on attributes from the top level of the cache.
-	Also fixes up all parent pointers so that a single attribute
+	The parent pointers were fixed up with the definitions (see
+	cos_cache_link_defn()) so that a single attribute
 	lookup will allow access to all information regarding that attribute.
 	Attributes that appear more than once in the cache will also
 	be indexed more than once - this means that a pure binary
 	search is not possible, but it is possible to make use of a
 	duplicate entry aware binary search function - which are rare beasts,
 	so we'll need to provide cos_cache_attr_bsearch()
-
-	This is also a handy time to mark the attributes as overides if
-	necessary
 */
 
 static int cos_cache_index_all(cosCache *pCache)
@@ -2805,50 +3381,34 @@ static int cos_cache_index_all(cosCache *pCache)
 		int tmpindex = 0;
 		int cmpindex = 0;
 		int actualCount = 0;
+		int tmplDnCount = 0;
+		int def_index = 0;
+		cosAttrValue *pAttrVal = 0;
+
+		for(def_index = 0; def_index < pCache->defCount; def_index++)
+		{
+			for(pAttrVal = pCache->ppDefs[def_index]->pCosTemplateDn; pAttrVal; pAttrVal = pAttrVal->list.pNext)
+				tmplDnCount++;
+		}
 
 		pCache->ppAttrIndex = (cosAttributes**)slapi_ch_malloc(sizeof(cosAttributes*) * pCache->attrCount);
-		pCache->ppTemplateList = (char**)slapi_ch_calloc((pCache->templateCount + 1) * 2, sizeof(char*));
+		pCache->ppTemplateList = (char**)slapi_ch_calloc(tmplDnCount + 1, sizeof(char*));
 		if(pCache->ppAttrIndex && pCache->ppTemplateList)
 		{
 			int attrcount = 0;
-			cosDefinitions *pDef = pCache->pDefs;
-			cosAttrValue *pAttrVal = 0;
 
-			while(pDef)
+			for(def_index = 0; def_index < pCache->defCount; def_index++)
 			{
+				cosDefinitions *pDef = pCache->ppDefs[def_index];
 				cosTemplates *pCosTmps = pDef->pCosTmps;
 
 				while(pCosTmps)
 				{
 					cosAttributes *pAttrs = pCosTmps->pAttrs;
 
-					pCosTmps->pParent = pDef;
-		
 					while(pAttrs)
 					{
-						pAttrs->pParent = pCosTmps;
 						(pCache->ppAttrIndex)[attrcount] = pAttrs;
-
-						if(cos_cache_attrval_exists(pDef->pCosOverrides, pAttrs->pAttrName))
-							pAttrs->attr_override = 1;
-						else
-							pAttrs->attr_override = 0;
-
-						if(cos_cache_attrval_exists(pDef->pCosOperational, pAttrs->pAttrName))
-							pAttrs->attr_operational = 1;
-						else
-							pAttrs->attr_operational = 0;
-
-						if(cos_cache_attrval_exists(pDef->pCosMerge, pAttrs->pAttrName))
-							pAttrs->attr_cos_merge = 1;
-						else
-							pAttrs->attr_cos_merge = 0;
-
-						if(cos_cache_attrval_exists(pDef->pCosOpDefault, pAttrs->pAttrName))
-							pAttrs->attr_operational_default = 1;
-						else
-							pAttrs->attr_operational_default = 0;
-
 						attrcount++;
 
 						pAttrs = pAttrs->list.pNext;
@@ -2866,34 +3426,24 @@ static int cos_cache_index_all(cosCache *pCache)
 					BS alg) to find an ancestor tree for a target
 					that has been modified - that comes later in
 					this function however - right now we'll just
-					slap them in the list
+					slap them in the list (the dns were normalized
+					with the definition)
 				*/
 				pAttrVal = pDef->pCosTemplateDn;
 
 				while(pAttrVal)
 				{
-					char *normed = slapi_create_dn_string("%s", pAttrVal->val);
-					if (normed) {
-						slapi_ch_free_string(&pAttrVal->val);
-						pAttrVal->val = normed;
-					} else {
-						LDAPDebug(LDAP_DEBUG_ANY, 
-							"cos_cache_index_all: failed to normalize dn %s. "
-							"Processing the pre normalized dn.\n", 
-							pAttrVal->val, 0, 0);
-					}
 					pCache->ppTemplateList[tmpindex] = pAttrVal->val;
 
 					tmpindex++;
 					pAttrVal = pAttrVal->list.pNext;
 				}
-
-				pDef = pDef->list.pNext;
 			}
 
 			/* now sort the index array */
 			qsort(pCache->ppAttrIndex, attrcount, sizeof(cosAttributes*), cos_cache_attr_compare);
 			qsort(pCache->ppTemplateList, tmpindex, sizeof(char*), cos_cache_string_compare);
+			pCache->templateCount = tmpindex;
 
 			/*
 				now we have the sorted template dn list, we can get rid of
@@ -2993,15 +3543,15 @@ static int cos_cache_index_all(cosCache *pCache)
 static int cos_cache_total_attr_count(cosCache *pCache)
 {
 	int count = 0;
-	cosDefinitions *pDef = pCache->pDefs;
+	int def_index = 0;
 
 	LDAPDebug( LDAP_DEBUG_TRACE, "--> cos_cache_total_attr_count\n",0,0,0);
 
 	pCache->templateCount = 0;
 
-	while(pDef)
+	for(def_index = 0; def_index < pCache->defCount; def_index++)
 	{
-		cosTemplates *pCosTmps = pDef->pCosTmps;
+		cosTemplates *pCosTmps = pCache->ppDefs[def_index]->pCosTmps;
 
 		while(pCosTmps)
 		{
@@ -3016,8 +3566,6 @@ static int cos_cache_total_attr_count(cosCache *pCache)
 			pCache->templateCount++;
 			pCosTmps = pCosTmps->list.pNext;
 		}
-
-		pDef = pDef->list.pNext;
 	}
 
 	LDAPDebug( LDAP_DEBUG_TRACE, "<-- cos_cache_total_attr_count\n",0,0,0);
@@ -3164,6 +3712,269 @@ static int cos_cache_attr_index_bsearch( const cosCache *pCache, const cosAttrib
 }
 
 
+/*
+	cos_cache_index_list_add
+	------------------------
+	appends index to the list
+*/
+static void cos_cache_index_list_add(cosIndexList *pList, int index)
+{
+	if(pList->count == pList->max)
+	{
+		pList->max = pList->max ? pList->max * 2 : 4;
+		pList->pIndexes = (int*)slapi_ch_realloc((char*)pList->pIndexes, pList->max * sizeof(int));
+	}
+	pList->pIndexes[pList->count++] = index;
+}
+
+/*
+	cos_cache_dispatch_build
+	------------------------
+	builds the dispatch table of each attribute type
+
+	returns 0 on success
+*/
+static int cos_cache_dispatch_build(cosCache *pCache)
+{
+	int first = 0;
+	int attr_index = 0;
+
+	LDAPDebug( LDAP_DEBUG_TRACE, "--> cos_cache_dispatch_build\n",0,0,0);
+
+	pCache->ppDispatch = (cosDispatch**)slapi_ch_calloc(pCache->attrCount, sizeof(cosDispatch*));
+
+	while(first < pCache->attrCount)
+	{
+		cosDispatch *pDispatch = (cosDispatch*)slapi_ch_calloc(1, sizeof(cosDispatch));
+
+		pCache->ppDispatch[first] = pDispatch;
+
+		for(attr_index = first;
+			attr_index < pCache->attrCount &&
+			!slapi_utf8casecmp((unsigned char*)pCache->ppAttrIndex[attr_index]->pAttrName,
+			                   (unsigned char*)pCache->ppAttrIndex[first]->pAttrName);
+			attr_index++)
+		{
+			cosAttributes *pAttr = pCache->ppAttrIndex[attr_index];
+			cosTemplates *pTemplate = (cosTemplates*)pAttr->pParent;
+			cosDefinitions *pDef = (cosDefinitions*)pTemplate->pParent;
+			cosDefDispatch *pDefDispatch = 0;
+			char *grade = 0;
+			int i;
+
+			/* the definitions of a type are few */
+			for(i = 0; i < pDispatch->defCount; i++)
+			{
+				if(pDispatch->pDefDispatch[i].pDef == pDef)
+				{
+					pDefDispatch = &pDispatch->pDefDispatch[i];
+					break;
+				}
+			}
+			if(pDefDispatch == 0)
+			{
+				pDispatch->pDefDispatch = (cosDefDispatch*)slapi_ch_realloc(
+					(char*)pDispatch->pDefDispatch, (pDispatch->defCount + 1) * sizeof(cosDefDispatch));
+				pDefDispatch = &pDispatch->pDefDispatch[pDispatch->defCount++];
+				memset(pDefDispatch, 0, sizeof(cosDefDispatch));
+				pDefDispatch->pDef = pDef;
+			}
+
+			if(pDef->cosType == COSTYPE_CLASSIC && !pTemplate->template_default && pTemplate->cosGrade)
+				grade = (char*)slapi_utf8StrToLower((unsigned char*)pTemplate->cosGrade);
+
+			if(grade)
+			{
+				cosIndexList *pList;
+
+				if(pDefDispatch->pGrades == 0)
+				{
+					pDefDispatch->pGrades = PL_NewHashTable(16, PL_HashString, PL_CompareStrings,
+						PL_CompareValues, NULL, NULL);
+					if(pDefDispatch->pGrades == 0)
+					{
+						slapi_ch_free_string(&grade);
+						LDAPDebug( LDAP_DEBUG_ANY, "cos_cache_dispatch_build: failed to allocate memory\n",0,0,0);
+						return -1;
+					}
+				}
+				pList = (cosIndexList*)PL_HashTableLookup(pDefDispatch->pGrades, grade);
+				if(pList)
+				{
+					slapi_ch_free_string(&grade);
+				}
+				else
+				{
+					pList = (cosIndexList*)slapi_ch_calloc(1, sizeof(cosIndexList));
+					PL_HashTableAdd(pDefDispatch->pGrades, grade, pList);
+				}
+				cos_cache_index_list_add(pList, attr_index);
+			}
+			else
+			{
+				cos_cache_index_list_add(&pDefDispatch->always, attr_index);
+			}
+		}
+
+		first = attr_index;
+	}
+
+	LDAPDebug( LDAP_DEBUG_TRACE, "<-- cos_cache_dispatch_build\n",0,0,0);
+	return 0;
+}
+
+static PRIntn cos_cache_del_grade(PLHashEntry *he, PRIntn i, void *arg)
+{
+	cosIndexList *pList = (cosIndexList*)he->value;
+	char *grade = (char*)he->key;
+
+	slapi_ch_free((void**)&pList->pIndexes);
+	slapi_ch_free((void**)&pList);
+	slapi_ch_free_string(&grade);
+	return HT_ENUMERATE_REMOVE | HT_ENUMERATE_NEXT;
+}
+
+/*
+	cos_cache_del_dispatch
+	----------------------
+	delete the dispatch tables
+*/
+static void cos_cache_del_dispatch(cosCache *pCache)
+{
+	int attr_index;
+	int i;
+
+	if(pCache->ppDispatch == 0)
+		return;
+
+	for(attr_index = 0; attr_index < pCache->attrCount; attr_index++)
+	{
+		cosDispatch *pDispatch = pCache->ppDispatch[attr_index];
+
+		if(pDispatch == 0)
+			continue;
+
+		for(i = 0; i < pDispatch->defCount; i++)
+		{
+			if(pDispatch->pDefDispatch[i].pGrades)
+			{
+				PL_HashTableEnumerateEntries(pDispatch->pDefDispatch[i].pGrades, cos_cache_del_grade, 0);
+				PL_HashTableDestroy(pDispatch->pDefDispatch[i].pGrades);
+			}
+			slapi_ch_free((void**)&pDispatch->pDefDispatch[i].always.pIndexes);
+		}
+		slapi_ch_free((void**)&pDispatch->pDefDispatch);
+		slapi_ch_free((void**)&pDispatch);
+	}
+	slapi_ch_free((void**)&pCache->ppDispatch);
+}
+
+static int cos_cache_int_compare(const void *e1, const void *e2)
+{
+	return *(const int*)e1 - *(const int*)e2;
+}
+
+/*
+	cos_cache_dispatch_candidates
+	-----------------------------
+	collects the positions in the attribute index of the templates which
+	may supply the type found at attr_index to e: those of the definitions
+	targeting e, restricted for the classic ones to the grades the
+	cosSpecifier values of e name.  They are sorted, so that they are
+	looked at in the order of the index.
+
+	returns the number of positions, *ppIndexes is to be freed
+*/
+static int cos_cache_dispatch_candidates(cosCache *pCache, int attr_index, vattr_context *context, Slapi_Entry *e, const char *pDn, int **ppIndexes)
+{
+	cosDispatch *pDispatch = pCache->ppDispatch ? pCache->ppDispatch[attr_index] : 0;
+	cosIndexList candidates = {0, 0, 0};
+	int i, j;
+
+	if(pDispatch == 0)
+	{
+		/* no table, all the templates of the type */
+		for(i = attr_index; i < pCache->attrCount &&
+			!slapi_utf8casecmp((unsigned char*)pCache->ppAttrIndex[i]->pAttrName,
+			                   (unsigned char*)pCache->ppAttrIndex[attr_index]->pAttrName); i++)
+		{
+			cos_cache_index_list_add(&candidates, i);
+		}
+		*ppIndexes = candidates.pIndexes;
+		return candidates.count;
+	}
+
+	for(i = 0; i < pDispatch->defCount; i++)
+	{
+		cosDefDispatch *pDefDispatch = &pDispatch->pDefDispatch[i];
+		cosDefinitions *pDef = pDefDispatch->pDef;
+		cosAttrValue *pTargetTree;
+		cosAttrValue *pSpec;
+
+		/* the same test as cos_cache_query_attr() */
+		for(pTargetTree = pDef->pCosTargetTree; pTargetTree; pTargetTree = pTargetTree->list.pNext)
+		{
+			if(pTargetTree->val == 0 ||
+				slapi_dn_issuffix(pDn, pTargetTree->val) != 0 ||
+				(views_api && views_entry_exists(views_api, pTargetTree->val, e)))
+				break;
+		}
+		if(pTargetTree == 0)
+			continue;
+
+		for(j = 0; j < pDefDispatch->always.count; j++)
+			cos_cache_index_list_add(&candidates, pDefDispatch->always.pIndexes[j]);
+
+		if(pDefDispatch->pGrades == 0)
+			continue;
+
+		for(pSpec = pDef->pCosSpecifier; pSpec; pSpec = pSpec->list.pNext)
+		{
+			Slapi_ValueSet *pAttrSpecs = 0;
+			Slapi_Value *val = 0;
+			int type_name_disposition = 0;
+			char *actual_type_name = 0;
+			int free_flags = 0;
+			int index;
+
+			if(pSpec->val == 0)
+				continue;
+
+			slapi_vattr_values_get_sp(context, e, pSpec->val, &pAttrSpecs, &type_name_disposition, &actual_type_name, 0, &free_flags);
+			slapi_ch_free((void **) &actual_type_name);
+			if(pAttrSpecs == 0)
+				continue;
+
+			for(index = slapi_valueset_first_value(pAttrSpecs, &val); val;
+				index = slapi_valueset_next_value(pAttrSpecs, index, &val))
+			{
+				char *grade = (char*)slapi_utf8StrToLower((unsigned char*)slapi_value_get_string(val));
+				cosIndexList *pList = grade ? (cosIndexList*)PL_HashTableLookupConst(pDefDispatch->pGrades, grade) : 0;
+
+				for(j = 0; pList && j < pList->count; j++)
+					cos_cache_index_list_add(&candidates, pList->pIndexes[j]);
+				slapi_ch_free_string(&grade);
+			}
+			slapi_valueset_free(pAttrSpecs);
+		}
+	}
+
+	/* back to the order of the index, without duplicates */
+	if(candidates.count > 1)
+	{
+		qsort(candidates.pIndexes, candidates.count, sizeof(int), cos_cache_int_compare);
+		for(i = 1, j = 0; i < candidates.count; i++)
+		{
+			if(candidates.pIndexes[i] != candidates.pIndexes[j])
+				candidates.pIndexes[++j] = candidates.pIndexes[i];
+		}
+		candidates.count = j + 1;
+	}
+
+	*ppIndexes = candidates.pIndexes;
+	return candidates.count;
+}
+
 static int cos_cache_cmp_attr(cosAttributes *pAttr, Slapi_Value *test_this, int *result)
 {
 	int ret = 0;
@@ -3198,6 +4009,8 @@ static int cos_cache_cmp_attr(cosAttributes *pAttr, Slapi_Value *test_this, int
 	cos_cache_cos_2_slapi_attr
 	----------------------
 	converts a cosAttributes structure to a Slapi_Attribute
+	the values come from the valueset prepared with the dispatch
+	tables, when there is one
 */
 static int cos_cache_cos_2_slapi_valueset(cosAttributes *pAttr, Slapi_ValueSet **out_vs)
 {
@@ -3229,6 +4042,24 @@ static int cos_cache_cos_2_slapi_valueset(cosAttributes *pAttr, Slapi_ValueSet *
 		if(!add_mode)
 			slapi_valueset_init(*out_vs);
 
+		if(pAttr->pValueSet)
+		{
+			Slapi_Value *val = 0;
+
+			if(!add_mode)
+			{
+				slapi_valueset_set_valueset(*out_vs, pAttr->pValueSet);
+				goto bail;
+			}
+			for(index = slapi_valueset_first_value(pAttr->pValueSet, &val); val;
+				index = slapi_valueset_next_value(pAttr->pValueSet, index, &val))
+			{
+				if(!slapi_valueset_find(attr, *out_vs, val))
+					slapi_valueset_add_value(*out_vs, val);
+			}
+			goto bail;
+		}
+
 		while( pAttrVal )
 		{
 			Slapi_Value *val = slapi_value_new_string(pAttrVal->val);
@@ -3268,7 +4099,7 @@ bail:
 	cos_cache_change_notify
 	-----------------------
 	determines if the change effects the cache and if so
-	signals a rebuild.
+	records the changed entry and signals the cache thread.
 
 	XXXrbyrne This whole mechanism needs to be revisited--it means that
 	the modifying client gets his LDAP response, and an unspecified and
@@ -3276,21 +4107,19 @@ bail:
 	period of time later, his mods get taken into account in the cos cache.
 	This makes it hard to program reliable admin tools for COS--DSAME
 	has already indicated this is an issue for them.
-	Additionally, it regenerates the _whole_ cache even for eeny weeny mods--
-	does it really neeed to ?  Additionally, in order to ensure we
-	do not miss any mods, we may tend to regen the cache, even if we've already
-	taken a mod into account in an earlier regeneration--currently there is no
-	way to know we've already dealt with the mod.
-	The right thing is something like: figure out what's being changed
-	and change only that in the cos cache and do it _before_ the response
-	goes to the client....or do a task that he can poll.
+	Only the changed definitions and templates are read again now, see
+	cos_cache_apply_deltas(), so the period is short--but it is still
+	not done _before_ the response goes to the client.
 */
 void cos_cache_change_notify(Slapi_PBlock *pb)
 {
 	const char *dn;
 	Slapi_DN *sdn = NULL;
 	int do_update = 0;
-	struct slapi_entry *e;
+	int pre_types = 0;
+	int post_types = 0;
+	struct slapi_entry *pre_e = NULL;
+	struct slapi_entry *post_e = NULL;
         Slapi_Backend *be=NULL;
 	int rc = 0;
 	int optype = -1;
@@ -3322,28 +4151,27 @@ void cos_cache_change_notify(Slapi_PBlock *pb)
 	 * For DELETE, MODIFY, MODRDN: see if the pre-op entry was cos significant.
 	 * For ADD, MODIFY, MODRDN: see if the post-op was cos significant.
 	 * Touching a cos significant entry triggers the update
-	 * of the whole cache.
+	 * of the definitions or templates it was or is: both entries are
+	 * looked at, a modrdn changes the dn.
 	*/
 	slapi_pblock_get ( pb, SLAPI_OPERATION_TYPE, &optype );	
 	if ( optype == SLAPI_OPERATION_DELETE ||
 		 optype == SLAPI_OPERATION_MODIFY ||
 		 optype == SLAPI_OPERATION_MODRDN ) {
 	       
-		slapi_pblock_get(pb, SLAPI_ENTRY_PRE_OP, &e);
-		if ( cos_cache_entry_is_cos_related(e)) {
-			do_update = 1;
-		}
+		slapi_pblock_get(pb, SLAPI_ENTRY_PRE_OP, &pre_e);
+		pre_types = cos_cache_entry_is_cos_related(pre_e);
     }
-	if ( !do_update && 
-		(optype == SLAPI_OPERATION_ADD ||
+	if ( optype == SLAPI_OPERATION_ADD ||
 		 optype == SLAPI_OPERATION_MODIFY ||
-		 optype == SLAPI_OPERATION_MODRDN )) {
+		 optype == SLAPI_OPERATION_MODRDN ) {
         
 		/* Adds have null pre-op entries */
-		slapi_pblock_get(pb, SLAPI_ENTRY_POST_OP, &e);
-		if ( cos_cache_entry_is_cos_related(e)) {
-				do_update = 1;
-		}			
+		slapi_pblock_get(pb, SLAPI_ENTRY_POST_OP, &post_e);
+		post_types = cos_cache_entry_is_cos_related(post_e);
+	}
+	if ( pre_types || post_types ) {
+		do_update = 1;
 	}
 
 	/*
@@ -3358,11 +4186,13 @@ void cos_cache_change_notify(Slapi_PBlock *pb)
 	 * triggering an update here is that
 	 * we can maintain the invariant that we only ever cache
 	 * definitions that have _valid_ templates--the active cache
-	 * stays lean in the face of errors.
+	 * stays lean in the face of errors.  Reading the entry again
+	 * as a template is cheap, and changes nothing if it is none.
 	*/
 	if( !do_update && cos_cache_template_index_bsearch(dn)) {
 			LDAPDebug1Arg(LDAP_DEBUG_PLUGIN, "cos_cache_change_notify: "
 			              "updating due to indirect template change(%s)\n", dn);
+		post_types = COS_DELTA_TEMPLATE;
 		do_update = 1;
 	}
 
@@ -3370,6 +4200,10 @@ void cos_cache_change_notify(Slapi_PBlock *pb)
 	if(do_update)
 	{
 		slapi_lock_mutex(change_lock);
+		if(pre_types)
+			cos_cache_add_delta(pre_types, pre_e ? slapi_entry_get_dn_const(pre_e) : NULL);
+		if(post_types)
+			cos_cache_add_delta(post_types, post_e ? slapi_entry_get_dn_const(post_e) : dn);
 		slapi_notify_condvar( something_changed, 1 );
 		cos_cache_notify_flag = 1;
 		slapi_unlock_mutex(change_lock);
@@ -3393,6 +4227,8 @@ void cos_cache_stop()
 
 	slapi_lock_mutex(change_lock);
 	keeprunning = 0;
+	cos_cache_del_deltas(&cos_cache_deltas);
+	cos_cache_delta_count = 0;
 	slapi_notify_condvar( something_changed, 1 );
 	slapi_unlock_mutex(change_lock);
 
@@ -3546,20 +4382,24 @@ static int cos_cache_follow_pointer( vattr_context *c, const char *dn, char *typ
  * cos_cache_backend_state_change()
  * --------------------------------
  * This is called when a backend changes state
- * We simply signal to rebuild the cos cache in this case
+ * We simply signal to rebuild the whole cos cache in this case
  *
  */
 void cos_cache_backend_state_change(void *handle, char *be_name, 
      int old_be_state, int new_be_state) 
 {
 	slapi_lock_mutex(change_lock);
+	cos_cache_add_delta(COS_DELTA_REBUILD, NULL);
 	slapi_notify_condvar( something_changed, 1 );
+	cos_cache_notify_flag = 1;
 	slapi_unlock_mutex(change_lock);
 }
 
 /*
  * returns non-zero: entry is cos significant (note does not detect indirect
- *					template entries).
+ *					template entries): COS_DELTA_DEFINITION and/or
+ *					COS_DELTA_TEMPLATE, or COS_DELTA_REBUILD when
+ *					there is no way to tell.
  * 			0	   : entry is not cos significant.
  */
 static int cos_cache_entry_is_cos_related( Slapi_Entry *e) {
@@ -3570,7 +4410,7 @@ static int cos_cache_entry_is_cos_related( Slapi_Entry *e) {
 	if ( e == NULL ) {
 		LDAPDebug0Args(LDAP_DEBUG_ANY, "cos_cache_change_notify: "
 		               "modified entry is NULL--updating cache just in case\n");
-		rc = 1;
+		rc = COS_DELTA_REBUILD;
 	} else {
 
 		if(slapi_entry_attr_find( e, "objectclass", &pObjclasses ))
@@ -3588,15 +4428,18 @@ static int cos_cache_entry_is_cos_related( Slapi_Entry *e) {
 			/* check out the object classes to see if this was a cosDefinition */		
 
 			index = slapi_attr_first_value( pObjclasses, &val );
-			while(!rc && val)
+			while(val)
 			{
 				pObj = (char*)slapi_value_get_string(val);
 
 				if(!strcasecmp(pObj, "cosdefinition") ||
-				   !strcasecmp(pObj, "cossuperdefinition") ||
-				   !strcasecmp(pObj, "costemplate"))
+				   !strcasecmp(pObj, "cossuperdefinition"))
+				{
+					rc |= COS_DELTA_DEFINITION;
+				}
+				else if(!strcasecmp(pObj, "costemplate"))
 				{
-					rc = 1;
+					rc |= COS_DELTA_TEMPLATE;
 				}
 
 				index = slapi_attr_next_value( pObjclasses, index, &val );
@@ -71,6 +71,7 @@ typedef struct _memberof_get_groups_data
 int memberof_postop_init(Slapi_PBlock *pb );
 static int memberof_internal_postop_init(Slapi_PBlock *pb);
 static int memberof_preop_init(Slapi_PBlock *pb);
+static int memberof_graph_postop_init(Slapi_PBlock *pb);
 
 /* plugin callbacks */ 
 static int memberof_postop_del(Slapi_PBlock *pb ); 
@@ -79,6 +80,7 @@ static int memberof_postop_modify(Slapi_PBlock *pb );
 static int memberof_postop_add(Slapi_PBlock *pb ); 
 static int memberof_postop_start(Slapi_PBlock *pb);
 static int memberof_postop_close(Slapi_PBlock *pb);
+static int memberof_graph_postop(Slapi_PBlock *pb);
 
 /* supporting cast */
 static int memberof_oktodo(Slapi_PBlock *pb);
@@ -116,12 +118,13 @@ static int memberof_compare(MemberOfConfig *config, const void *a, const void *b
 static int memberof_qsort_compare(const void *a, const void *b);
 static void memberof_load_array(Slapi_Value **array, Slapi_Attr *attr);
 static int memberof_del_dn_from_groups(Slapi_PBlock *pb, MemberOfConfig *config, Slapi_DN *sdn);
-static int memberof_call_foreach_dn(Slapi_PBlock *pb, Slapi_DN *sdn, MemberOfConfig *config,
-	char **types, plugin_search_entry_callback callback,  void *callback_data);
 static int memberof_is_direct_member(MemberOfConfig *config, Slapi_Value *groupdn,
 	Slapi_Value *memberdn);
 static int memberof_is_grouping_attr(char *type, MemberOfConfig *config);
 static Slapi_ValueSet *memberof_get_groups(MemberOfConfig *config, Slapi_DN *member_sdn);
+static int memberof_get_groups_from_graph(MemberOfConfig *config, Slapi_DN *member_sdn,
+	Slapi_ValueSet *groupvals, Slapi_ValueSet *group_norm_vals);
+static int memberof_get_direct_groups_callback(Slapi_Entry *e, void *callback_data);
 static int memberof_get_groups_r(MemberOfConfig *config, Slapi_DN *member_sdn,
 	memberof_get_groups_data *data);
 static int memberof_get_groups_callback(Slapi_Entry *e, void *callback_data);
@@ -144,9 +147,15 @@ static const char *fetch_attr(Slapi_Entry *e, const char *attrname,
 static void memberof_fixup_task_thread(void *arg);
 static int memberof_fix_memberof(MemberOfConfig *config, char *dn, char *filter_str);
 static int memberof_fix_memberof_callback(Slapi_Entry *e, void *callback_data);
-static int memberof_entry_in_scope(MemberOfConfig *config, Slapi_DN *sdn);
+static int memberof_fix_memberof_values(MemberOfConfig *config, Slapi_Entry *e,
+	Slapi_ValueSet *groups);
 static int memberof_add_objectclass(char *auto_add_oc, const char *dn);
 static int memberof_add_memberof_attr(LDAPMod **mods, const char *dn, char *add_oc);
+static int memberof_has_same_groups(Slapi_Entry *e, MemberOfConfig *config,
+	Slapi_ValueSet *groups);
+static int memberof_add_groups_delta(Slapi_Entry *e, MemberOfConfig *config,
+	Slapi_DN *group_sdn, int *done);
+static int memberof_test_visited(MemberOfConfig *config, const char *ndn, int mod_op);
 
 /*** implementation ***/
 
@@ -237,6 +246,31 @@ memberof_postop_init(Slapi_PBlock *pb)
 			"memberof_postop_init failed\n" );
 		ret = -1;
 	}
+	/*
+	 * With betxn, the group graph is updated before the transaction is
+	 * committed: these publish the changes once it is, or drop them if
+	 * the operation fails.
+	 */
+	if (!ret && usetxn &&
+	    (slapi_register_plugin("postoperation",  /* op type */
+			1,        /* Enabled */
+			"memberof_graph_postop_init",   /* this function desc */
+			memberof_graph_postop_init,  /* init func */
+			MEMBEROF_GRAPH_POSTOP_DESC,      /* plugin desc */
+			NULL,     /* ? */
+			memberof_plugin_identity   /* access control */) ||
+	     slapi_register_plugin("internalpostoperation",  /* op type */
+			1,        /* Enabled */
+			"memberof_graph_postop_init",   /* this function desc */
+			memberof_graph_postop_init,  /* init func */
+			MEMBEROF_GRAPH_POSTOP_DESC,      /* plugin desc */
+			NULL,     /* ? */
+			memberof_plugin_identity   /* access control */)))
+	{
+		slapi_log_error( SLAPI_LOG_FATAL, MEMBEROF_PLUGIN_SUBSYSTEM,
+			"memberof_graph_postop_init failed\n" );
+		ret = -1;
+	}
 	/*
 	 * Setup the preop plugin for shared config updates
 	 */
@@ -307,6 +341,51 @@ memberof_internal_postop_init(Slapi_PBlock *pb)
 	return status;
 }
 
+static int
+memberof_graph_postop_init(Slapi_PBlock *pb)
+{
+	int status = 0;
+
+	if (slapi_pblock_set(pb, SLAPI_PLUGIN_VERSION, SLAPI_PLUGIN_VERSION_01) != 0 ||
+		slapi_pblock_set(pb, SLAPI_PLUGIN_DESCRIPTION, (void *) &pdesc) != 0 ||
+		slapi_pblock_set(pb, SLAPI_PLUGIN_POST_DELETE_FN, (void *) memberof_graph_postop) != 0 ||
+		slapi_pblock_set(pb, SLAPI_PLUGIN_POST_MODRDN_FN, (void *) memberof_graph_postop) != 0 ||
+		slapi_pblock_set(pb, SLAPI_PLUGIN_POST_MODIFY_FN, (void *) memberof_graph_postop) != 0 ||
+		slapi_pblock_set(pb, SLAPI_PLUGIN_POST_ADD_FN, (void *) memberof_graph_postop) != 0 ||
+		slapi_pblock_set(pb, SLAPI_PLUGIN_INTERNAL_POST_DELETE_FN, (void *) memberof_graph_postop) != 0 ||
+		slapi_pblock_set(pb, SLAPI_PLUGIN_INTERNAL_POST_MODRDN_FN, (void *) memberof_graph_postop) != 0 ||
+		slapi_pblock_set(pb, SLAPI_PLUGIN_INTERNAL_POST_MODIFY_FN, (void *) memberof_graph_postop) != 0 ||
+		slapi_pblock_set(pb, SLAPI_PLUGIN_INTERNAL_POST_ADD_FN, (void *) memberof_graph_postop) != 0)
+	{
+		slapi_log_error(SLAPI_LOG_FATAL, MEMBEROF_PLUGIN_SUBSYSTEM,
+			"memberof_graph_postop_init: failed to register plugin\n");
+		status = -1;
+	}
+
+	return status;
+}
+
+/*
+ * memberof_graph_postop()
+ *
+ * Runs once the transaction of the operation is over: the changes of the
+ * group graph become visible to the other threads if it was committed,
+ * and are dropped if it was aborted.  SLAPI_TXN is then the transaction
+ * of the operation this one is part of, if any.
+ */
+static int
+memberof_graph_postop(Slapi_PBlock *pb)
+{
+	void *txn = NULL;
+	int rc = 0;
+
+	slapi_pblock_get(pb, SLAPI_PLUGIN_OPRETURN, &rc);
+	slapi_pblock_get(pb, SLAPI_TXN, &txn);
+	memberof_graph_end_op(rc != 0, txn != NULL);
+
+	return SLAPI_PLUGIN_SUCCESS;
+}
+
 /*
  * memberof_postop_start()
  *
@@ -337,6 +416,10 @@ int memberof_postop_start(Slapi_PBlock *pb)
 			goto bail;
 		}
 	}
+	if(memberof_graph_init(usetxn)){
+		rc = -1;
+		goto bail;
+	}
 
 	/* Set the alternate config area if one is defined. */
 	slapi_pblock_get(pb, SLAPI_PLUGIN_CONFIG_AREA, &config_area);
@@ -424,6 +507,7 @@ int memberof_postop_close(Slapi_PBlock *pb)
 		     "--> memberof_postop_close\n" );
 
 	slapi_plugin_task_unregister_handler("memberof task", memberof_task_add);
+	memberof_graph_close();
 	memberof_release_config();
 	slapi_sdn_free(&_ConfigAreaDN);
 	slapi_sdn_free(&_pluginDN);
@@ -524,7 +608,10 @@ int memberof_postop_del(Slapi_PBlock *pb)
 
 		/* get the memberOf operation lock */
 		memberof_lock();
-		
+
+		/* its members must not see it anymore */
+		memberof_graph_del_group(&configCopy, sdn);
+
 		/* remove this DN from the
 		 * membership lists of groups
 		 */
@@ -825,6 +912,7 @@ int memberof_postop_modrdn(Slapi_PBlock *pb)
 		struct slapi_entry *post_e = NULL;
 		Slapi_DN *pre_sdn = 0;
 		Slapi_DN *post_sdn = 0;
+		int graph_renamed = 0;
 
 		slapi_pblock_get( pb, SLAPI_ENTRY_PRE_OP, &pre_e );
 		slapi_pblock_get( pb, SLAPI_ENTRY_POST_OP, &post_e );
@@ -850,6 +938,10 @@ int memberof_postop_modrdn(Slapi_PBlock *pb)
 
 		memberof_lock();
 
+		if(pre_sdn && post_sdn){
+			graph_renamed = memberof_graph_rename_group(&configCopy, pre_sdn, post_sdn);
+		}
+
 		/*  update any downstream members */
 		if(pre_sdn && post_sdn && configCopy.group_filter &&
 		   0 == slapi_filter_test_simple(post_e, configCopy.group_filter))
@@ -920,6 +1012,11 @@ int memberof_postop_modrdn(Slapi_PBlock *pb)
 				}
 			}
 		}
+		/* a group moved into the scope: now that the groups listing it
+		 * use the new DN, look for them */
+		if (ret == LDAP_SUCCESS && post_e && !graph_renamed) {
+			memberof_graph_add_group(&configCopy, post_e);
+		}
 		memberof_unlock();
 bail:
 		memberof_free_config(&configCopy);
@@ -1077,6 +1174,7 @@ int memberof_postop_modify(Slapi_PBlock *pb)
 	if(memberof_oktodo(pb))
 	{
 		int config_copied = 0;
+		int graph_updated = 0;
 		MemberOfConfig *mainConfig = 0;
 		MemberOfConfig configCopy = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
@@ -1127,6 +1225,20 @@ int memberof_postop_modify(Slapi_PBlock *pb)
 
 				memberof_lock();
 
+				/* bring the group graph up to date with all the mods
+				 * first, the entry already has them */
+				if (!graph_updated)
+				{
+					Slapi_Entry *post_e = NULL;
+
+					slapi_pblock_get(pb, SLAPI_ENTRY_POST_OP, &post_e);
+					if (post_e)
+					{
+						memberof_graph_modify_group(&configCopy, post_e, mods);
+					}
+					graph_updated = 1;
+				}
+
 				/* the modify op decides the function */
 				switch(op & ~LDAP_MOD_BVALUES)
 				{
@@ -1284,6 +1396,8 @@ int memberof_postop_add(Slapi_PBlock *pb)
 
 			memberof_lock();
 
+			memberof_graph_add_group(&configCopy, e);
+
 			for (i = 0; configCopy.groupattrs && configCopy.groupattrs[i]; i++)
 			{
 				if(0 == slapi_entry_attr_find(e, configCopy.groupattrs[i], &attr))
@@ -1365,7 +1479,7 @@ bail:
  * and postop entries.  If we are moving out of, or
  * into scope, we should process it.
  */
-static int
+int
 memberof_entry_in_scope(MemberOfConfig *config, Slapi_DN *sdn)
 {
     if (config->entryScopeExcludeSubtrees){
@@ -1457,6 +1571,7 @@ memberof_modop_one_replace_r(Slapi_PBlock *pb, MemberOfConfig *config,
 	const char *op_this;
 	Slapi_Value *to_dn_val = NULL;
 	Slapi_Value *this_dn_val = NULL;
+	char **attrs = NULL;
 
 	op_to = slapi_sdn_get_ndn(op_to_sdn);
 	op_this = slapi_sdn_get_ndn(op_this_sdn);
@@ -1490,8 +1605,20 @@ memberof_modop_one_replace_r(Slapi_PBlock *pb, MemberOfConfig *config,
 		goto bail;
 	}
 
-	/* determine if this is a group op or single entry */
-	slapi_search_internal_get_entry( op_to_sdn, config->groupattrs,
+	/* reached already through another member? */
+	if((LDAP_MOD_DELETE == mod_op || LDAP_MOD_ADD == mod_op) &&
+	   memberof_test_visited(config, op_to, mod_op))
+	{
+		slapi_log_error( SLAPI_LOG_PLUGIN, MEMBEROF_PLUGIN_SUBSYSTEM,
+			"memberof_modop_one_replace_r: %s already updated\n", op_to);
+		goto bail;
+	}
+
+	/* determine if this is a group op or single entry, and
+	 * get the current memberOf values */
+	attrs = slapi_ch_array_dup(config->groupattrs);
+	slapi_ch_array_add(&attrs, slapi_ch_strdup(config->memberof_attr));
+	slapi_search_internal_get_entry( op_to_sdn, attrs,
 		&e, memberof_get_plugin_id());
 	if(!e)
 	{
@@ -1683,11 +1810,21 @@ memberof_modop_one_replace_r(Slapi_PBlock *pb, MemberOfConfig *config,
 		}
 
 		/* For add and del modify operations, we just regenerate the
-		 * memberOf attribute. */
+		 * memberOf attribute, unless the group graph gives what
+		 * an add brings in. */
 		if(LDAP_MOD_DELETE == mod_op || LDAP_MOD_ADD == mod_op)
 		{
-			/* find parent groups and replace our member attr */
-			rc = memberof_fix_memberof_callback(e, config);
+			int done = 0;
+
+			if(LDAP_MOD_ADD == mod_op)
+			{
+				rc = memberof_add_groups_delta(e, config, group_sdn, &done);
+			}
+			if(!done)
+			{
+				/* find parent groups and replace our member attr */
+				rc = memberof_fix_memberof_callback(e, config);
+			}
 		} else {
 			/* single entry - do mod */
 			mods[0] = &mod;
@@ -1723,10 +1860,54 @@ memberof_modop_one_replace_r(Slapi_PBlock *pb, MemberOfConfig *config,
 bail:
 	slapi_value_free(&to_dn_val);
 	slapi_value_free(&this_dn_val);
+	slapi_ch_array_free(attrs);
 	slapi_entry_free(e);
 	return rc;
 }
 
+/*
+ * memberof_test_visited()
+ *
+ * An operation may reach the same entry through several members: its
+ * memberOf values only need to be updated once.  As a delete recomputes
+ * all the values, it also covers an add.
+ * Returns 1 if ndn was already updated for mod_op, otherwise records it
+ * and returns 0.
+ */
+static int
+memberof_test_visited(MemberOfConfig *config, const char *ndn, int mod_op)
+{
+	PRUword flag = (LDAP_MOD_ADD == mod_op) ? 0x1 : 0x2;
+	PRUword visited;
+
+	if (NULL == config->visited)
+	{
+		config->visited = PL_NewHashTable(64, PL_HashString, PL_CompareStrings,
+			PL_CompareValues, NULL, NULL);
+		if (NULL == config->visited)
+		{
+			return 0;
+		}
+	}
+
+	visited = (PRUword)PL_HashTableLookup(config->visited, ndn);
+	if (visited & (flag | 0x2))
+	{
+		return 1;
+	}
+	if (visited)
+	{
+		/* the key is kept */
+		PL_HashTableAdd(config->visited, ndn, (void *)(visited | flag));
+	}
+	else
+	{
+		PL_HashTableAdd(config->visited, slapi_ch_strdup(ndn), (void *)flag);
+	}
+
+	return 0;
+}
+
 
 /*
  * memberof_add_one()
@@ -2033,7 +2214,11 @@ memberof_get_groups(MemberOfConfig *config, Slapi_DN *member_sdn)
 
 	memberof_get_groups_data data = {config, memberdn_val, &groupvals, &group_norm_vals};
 
-	memberof_get_groups_r(config, member_sdn, &data);
+	if (memberof_get_groups_from_graph(config, member_sdn, groupvals, group_norm_vals))
+	{
+		/* walk up with the searches */
+		memberof_get_groups_r(config, member_sdn, &data);
+	}
 
 	slapi_value_free(&memberdn_val);
 	slapi_valueset_free(group_norm_vals);
@@ -2041,6 +2226,66 @@ memberof_get_groups(MemberOfConfig *config, Slapi_DN *member_sdn)
 	return groupvals;
 }
 
+/*
+ * memberof_get_groups_from_graph()
+ *
+ * If member_sdn is a group, the group graph knows its parents, otherwise
+ * they are found with one search.  The graph then gives the groups
+ * these are nested in.
+ * Returns 0, or -1 if the graph can't tell.
+ */
+static int
+memberof_get_groups_from_graph(MemberOfConfig *config, Slapi_DN *member_sdn,
+	Slapi_ValueSet *groupvals, Slapi_ValueSet *group_norm_vals)
+{
+	memberof_get_groups_data data = {config, NULL, NULL, NULL};
+	Slapi_ValueSet *direct = NULL;
+	int rc;
+
+	rc = memberof_graph_is_group(config, member_sdn);
+	if (rc < 0)
+	{
+		return -1;
+	}
+	if (0 == rc)
+	{
+		direct = slapi_valueset_new();
+		data.groupvals = &direct;
+		rc = memberof_call_foreach_dn(NULL, member_sdn, config, config->groupattrs,
+			memberof_get_direct_groups_callback, &data);
+	}
+	if (0 == rc)
+	{
+		rc = memberof_graph_get_groups(config, member_sdn, direct,
+			!config->skip_nested || config->fixup_task, groupvals, group_norm_vals);
+	}
+	slapi_valueset_free(direct);
+
+	return rc ? -1 : 0;
+}
+
+/* Collects the normalized DN of the groups listing an entry */
+static int
+memberof_get_direct_groups_callback(Slapi_Entry *e, void *callback_data)
+{
+	memberof_get_groups_data *data = (memberof_get_groups_data *)callback_data;
+	Slapi_Value *group_ndn_val;
+
+	if (slapi_is_shutting_down())
+	{
+		return -1;
+	}
+	/* groups in an excluded subtree don't count */
+	if (memberof_entry_in_scope(data->config, slapi_entry_get_sdn(e)))
+	{
+		group_ndn_val = slapi_value_new_string(slapi_entry_get_ndn(e));
+		slapi_value_set_flags(group_ndn_val, SLAPI_ATTR_FLAG_NORMALIZED_CIS);
+		slapi_valueset_add_value_ext(*data->groupvals, group_ndn_val, SLAPI_VALUE_FLAG_PASSIN);
+	}
+
+	return 0;
+}
+
 int
 memberof_get_groups_r(MemberOfConfig *config, Slapi_DN *member_sdn,
                       memberof_get_groups_data *data)
@@ -2625,13 +2870,51 @@ void memberof_unlock()
 	}
 }
 
+#define MEMBEROF_FIXUP_MAX_THREADS 64
+#define MEMBEROF_FIXUP_BATCH_SIZE 100   /* entries per queue batch */
+
 typedef struct _task_data
 {
 	char *dn;
 	char *bind_dn;
 	char *filter_str;
+	int threads;
 } task_data;
 
+/* the entries to fix, from the search to the worker threads */
+typedef struct _memberof_fixup_queue
+{
+	MemberOfConfig *config;
+	memberof_graph_snapshot *snap;
+	Slapi_Backend *be;          /* of the per entry transactions, NULL without */
+	char *bind_dn;
+	PRLock *lock;
+	PRCondVar *not_empty;
+	PRCondVar *not_full;
+	Slapi_Entry **entries;      /* ring of size entries */
+	int size;
+	int first;
+	int count;
+	int done;                   /* the search is over */
+	int rc;                     /* first failure */
+	PRInt32 nentries;           /* fixed up so far */
+} memberof_fixup_queue;
+
+typedef struct _memberof_fixup_worker
+{
+	memberof_fixup_queue *queue;
+	int index;                  /* reader of the snapshot */
+	PRThread *thread;
+} memberof_fixup_worker;
+
+static int memberof_fix_memberof_parallel(MemberOfConfig *config, task_data *td);
+static int memberof_fixup_queue_entry_callback(Slapi_Entry *e, void *callback_data);
+static int memberof_fixup_queue_get(memberof_fixup_queue *queue, Slapi_Entry **batch, int max);
+static void memberof_fixup_queue_fail(memberof_fixup_queue *queue, int rc);
+static void memberof_fixup_worker_thread(void *arg);
+static int memberof_fixup_batch(memberof_fixup_queue *queue, int reader, Slapi_Entry **batch,
+	int n, Slapi_Backend *be);
+
 void memberof_fixup_task_thread(void *arg)
 {
 	MemberOfConfig configCopy = {0, 0, 0, 0};
@@ -2669,7 +2952,8 @@ void memberof_fixup_task_thread(void *arg)
 	/* Mark this as a task operation */
 	configCopy.fixup_task = 1;
 
-	if (usetxn) {
+	/* the workers of a parallel fixup have their own transactions */
+	if (usetxn && td->threads <= 1) {
 		Slapi_DN *sdn = slapi_sdn_new_dn_byref(td->dn);
 		Slapi_Backend *be = slapi_be_select(sdn);
 		slapi_sdn_free(&sdn);
@@ -2691,8 +2975,16 @@ void memberof_fixup_task_thread(void *arg)
 	/* get the memberOf operation lock */
 	memberof_lock();
 
+	/* the task usually follows changes the plugin did not see, such
+	 * as an import: start over with a fresh group graph */
+	memberof_graph_invalidate();
+
 	/* do real work */
-	rc = memberof_fix_memberof(&configCopy, td->dn, td->filter_str);
+	if (td->threads > 1) {
+		rc = memberof_fix_memberof_parallel(&configCopy, td);
+	} else {
+		rc = memberof_fix_memberof(&configCopy, td->dn, td->filter_str);
+	}
  
 	/* release the memberOf operation lock */
 	memberof_unlock();
@@ -2705,6 +2997,8 @@ void memberof_fixup_task_thread(void *arg)
 		}
 		slapi_pblock_destroy(fixup_pb);
 	}
+	/* the graph built by the task is visible once its changes are */
+	memberof_graph_end_op(rc != 0, 0);
 	memberof_free_config(&configCopy);
 
 	slapi_task_log_notice(task, "Memberof task finished.");
@@ -2747,6 +3041,7 @@ int memberof_task_add(Slapi_PBlock *pb, Slapi_Entry *e,
 	char *bind_dn;
 	const char *filter;
 	const char *dn = 0;
+	int threads;
 
 	*returncode = LDAP_SUCCESS;
 
@@ -2765,6 +3060,17 @@ int memberof_task_add(Slapi_PBlock *pb, Slapi_Entry *e,
 		goto out;
 	}
 
+	/* more than one thread for the parallel fixup */
+	threads = atoi(fetch_attr(e, "threads", "1"));
+	if (threads < 1 || threads > MEMBEROF_FIXUP_MAX_THREADS)
+	{
+		PR_snprintf(returntext, SLAPI_DSE_RETURNTEXT_SIZE,
+			"threads must be between 1 and %d", MEMBEROF_FIXUP_MAX_THREADS);
+		*returncode = LDAP_UNWILLING_TO_PERFORM;
+		rv = SLAPI_DSE_CALLBACK_ERROR;
+		goto out;
+	}
+
 	/* setup our task data */
 	slapi_pblock_get(pb, SLAPI_REQUESTOR_DN, &bind_dn);
 	mytaskdata = (task_data*)slapi_ch_malloc(sizeof(task_data));
@@ -2777,6 +3083,7 @@ int memberof_task_add(Slapi_PBlock *pb, Slapi_Entry *e,
 	mytaskdata->dn = slapi_ch_strdup(dn);
 	mytaskdata->filter_str = slapi_ch_strdup(filter);
 	mytaskdata->bind_dn = slapi_ch_strdup(bind_dn);
+	mytaskdata->threads = threads;
 
 	/* allocate new task now */
 	task = slapi_plugin_new_task(slapi_entry_get_ndn(e), arg);
@@ -2862,7 +3169,6 @@ int memberof_fix_memberof_callback(Slapi_Entry *e, void *callback_data)
 	int rc = 0;
 	Slapi_DN *sdn = slapi_entry_get_sdn(e);
 	MemberOfConfig *config = (MemberOfConfig *)callback_data;
-	memberof_del_dn_data del_data = {0, config->memberof_attr};
 	Slapi_ValueSet *groups = 0;
 
 	/* 
@@ -2874,10 +3180,34 @@ int memberof_fix_memberof_callback(Slapi_Entry *e, void *callback_data)
 	}
 	/* get a list of all of the groups this user belongs to */
 	groups = memberof_get_groups(config, sdn);
+	rc = memberof_fix_memberof_values(config, e, groups);
+	slapi_valueset_free(groups);
+bail:
+	return rc;
+}
+
+/*
+ * memberof_fix_memberof_values()
+ *
+ * Make groups the memberOf values of e, which holds the current ones.
+ */
+static int
+memberof_fix_memberof_values(MemberOfConfig *config, Slapi_Entry *e,
+	Slapi_ValueSet *groups)
+{
+	int rc = 0;
+	Slapi_DN *sdn = slapi_entry_get_sdn(e);
+	memberof_del_dn_data del_data = {0, config->memberof_attr};
 
 	/* If we found some groups, replace the existing memberOf attribute
-	 * with the found values.  */
-	if (groups && slapi_valueset_count(groups))
+	 * with the found values, unless the entry has them already.  */
+	if (memberof_has_same_groups(e, config, groups))
+	{
+		slapi_log_error( SLAPI_LOG_PLUGIN, MEMBEROF_PLUGIN_SUBSYSTEM,
+			"memberof_fix_memberof_callback: %s is up to date\n",
+			slapi_sdn_get_dn(sdn));
+	}
+	else if (groups && slapi_valueset_count(groups))
 	{
 		Slapi_Value *val = 0;
 		Slapi_Mod *smod;
@@ -2911,8 +3241,456 @@ int memberof_fix_memberof_callback(Slapi_Entry *e, void *callback_data)
 		memberof_del_dn_type_callback(e, &del_data);
 	}
 
-	slapi_valueset_free(groups);
+	return rc;
+}
+
+/*
+ * memberof_fix_memberof_parallel()
+ *
+ * The fixup with several threads.  The groups are read in one pass into
+ * a snapshot of the group graph, which knows the groups of every member.
+ * The entries to fix are then searched and handed over to the workers,
+ * which take them by batches and write the memberOf values, each entry
+ * in its own transaction.
+ */
+static int
+memberof_fix_memberof_parallel(MemberOfConfig *config, task_data *td)
+{
+	memberof_fixup_queue queue;
+	memberof_fixup_worker *workers = NULL;
+	Slapi_PBlock *search_pb = NULL;
+	char *attrs[2] = {config->memberof_attr, NULL};
+	int nworkers = 0;
+	int rc = 0;
+	int i;
+
+	memset(&queue, 0, sizeof(queue));
+	queue.config = config;
+	if ((queue.snap = memberof_graph_take_snapshot(config, td->threads)) == NULL)
+	{
+		slapi_log_error(SLAPI_LOG_FATAL, MEMBEROF_PLUGIN_SUBSYSTEM,
+			"memberof_fix_memberof_parallel: no group graph, fixing up %s "
+			"with a single thread\n", td->dn);
+		return memberof_fix_memberof(config, td->dn, td->filter_str);
+	}
+	if (usetxn)
+	{
+		Slapi_DN *sdn = slapi_sdn_new_dn_byref(td->dn);
+
+		queue.be = slapi_be_select(sdn);
+		slapi_sdn_free(&sdn);
+	}
+	queue.bind_dn = td->bind_dn;
+	queue.size = 2 * td->threads * MEMBEROF_FIXUP_BATCH_SIZE;
+	queue.entries = (Slapi_Entry **)slapi_ch_calloc(queue.size, sizeof(Slapi_Entry *));
+	if ((queue.lock = PR_NewLock()) == NULL ||
+	    (queue.not_empty = PR_NewCondVar(queue.lock)) == NULL ||
+	    (queue.not_full = PR_NewCondVar(queue.lock)) == NULL)
+	{
+		rc = -1;
+		goto bail;
+	}
+
+	workers = (memberof_fixup_worker *)slapi_ch_calloc(td->threads,
+		sizeof(memberof_fixup_worker));
+	for (i = 0; i < td->threads; i++)
+	{
+		workers[nworkers].queue = &queue;
+		workers[nworkers].index = nworkers;
+		workers[nworkers].thread = PR_CreateThread(PR_USER_THREAD,
+			memberof_fixup_worker_thread, (void *)&workers[nworkers],
+			PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD, PR_JOINABLE_THREAD,
+			SLAPD_DEFAULT_THREAD_STACKSIZE);
+		if (workers[nworkers].thread == NULL)
+		{
+			slapi_log_error(SLAPI_LOG_FATAL, MEMBEROF_PLUGIN_SUBSYSTEM,
+				"memberof_fix_memberof_parallel: unable to create worker thread %d\n", i);
+			continue;
+		}
+		nworkers++;
+	}
+	if (nworkers == 0)
+	{
+		rc = -1;
+		goto bail;
+	}
+
+	/* only the DN and the current values are needed */
+	search_pb = slapi_pblock_new();
+	slapi_search_internal_set_pb(search_pb, td->dn,
+		LDAP_SCOPE_SUBTREE, td->filter_str, attrs, 0,
+		0, 0,
+		memberof_get_plugin_id(),
+		0);
+	rc = slapi_search_internal_callback_pb(search_pb,
+		&queue,
+		0, memberof_fixup_queue_entry_callback,
+		0);
+	slapi_pblock_destroy(search_pb);
+
+	/* let the workers empty the queue */
+	PR_Lock(queue.lock);
+	queue.done = 1;
+	PR_NotifyAllCondVar(queue.not_empty);
+	PR_Unlock(queue.lock);
+	for (i = 0; i < nworkers; i++)
+	{
+		PR_JoinThread(workers[i].thread);
+	}
+	if (queue.rc)
+	{
+		rc = queue.rc;
+	}
+	slapi_log_error(SLAPI_LOG_PLUGIN, MEMBEROF_PLUGIN_SUBSYSTEM,
+		"memberof_fix_memberof_parallel: %d entries fixed up by %d threads (%d)\n",
+		queue.nentries, nworkers, rc);
+
 bail:
+	for (i = 0; i < queue.count; i++)
+	{
+		slapi_entry_free(queue.entries[(queue.first + i) % queue.size]);
+	}
+	slapi_ch_free((void **)&queue.entries);
+	if (queue.not_full)
+	{
+		PR_DestroyCondVar(queue.not_full);
+	}
+	if (queue.not_empty)
+	{
+		PR_DestroyCondVar(queue.not_empty);
+	}
+	if (queue.lock)
+	{
+		PR_DestroyLock(queue.lock);
+	}
+	slapi_ch_free((void **)&workers);
+	memberof_graph_free_snapshot(&queue.snap);
+
+	return rc;
+}
+
+/* Queue a copy of e, holding only what the workers need */
+static int
+memberof_fixup_queue_entry_callback(Slapi_Entry *e, void *callback_data)
+{
+	memberof_fixup_queue *queue = (memberof_fixup_queue *)callback_data;
+	Slapi_Entry *copy = NULL;
+	Slapi_Attr *attr = NULL;
+	int rc = 0;
+
+	if (slapi_is_shutting_down())
+	{
+		return -1;
+	}
+
+	copy = slapi_entry_alloc();
+	slapi_entry_init_ext(copy, slapi_entry_get_sdn(e), NULL);
+	if (slapi_entry_attr_find(e, queue->config->memberof_attr, &attr) == 0)
+	{
+		Slapi_ValueSet *vs = NULL;
+
+		slapi_attr_get_valueset(attr, &vs);
+		slapi_entry_add_valueset(copy, queue->config->memberof_attr, vs);
+		slapi_valueset_free(vs);
+	}
+
+	PR_Lock(queue->lock);
+	while (queue->count == queue->size && queue->rc == 0 && !slapi_is_shutting_down())
+	{
+		PR_WaitCondVar(queue->not_full, PR_SecondsToInterval(1));
+	}
+	if (queue->rc || slapi_is_shutting_down())
+	{
+		/* a worker failed: stop the search */
+		rc = -1;
+	}
+	else
+	{
+		queue->entries[(queue->first + queue->count) % queue->size] = copy;
+		copy = NULL;
+		if (++queue->count >= MEMBEROF_FIXUP_BATCH_SIZE)
+		{
+			PR_NotifyCondVar(queue->not_empty);
+		}
+	}
+	PR_Unlock(queue->lock);
+	slapi_entry_free(copy);
+
+	return rc;
+}
+
+/*
+ * Take up to max entries from the queue.  Waits for a full batch, unless
+ * the search is over.  Returns 0 when there is nothing left to do.
+ */
+static int
+memberof_fixup_queue_get(memberof_fixup_queue *queue, Slapi_Entry **batch, int max)
+{
+	int n = 0;
+
+	PR_Lock(queue->lock);
+	while (queue->count < max && !queue->done && queue->rc == 0)
+	{
+		PR_WaitCondVar(queue->not_empty, PR_INTERVAL_NO_TIMEOUT);
+	}
+	while (queue->rc == 0 && n < max && queue->count)
+	{
+		batch[n++] = queue->entries[queue->first];
+		queue->first = (queue->first + 1) % queue->size;
+		queue->count--;
+	}
+	PR_NotifyCondVar(queue->not_full);
+	PR_Unlock(queue->lock);
+
+	return n;
+}
+
+static void
+memberof_fixup_queue_fail(memberof_fixup_queue *queue, int rc)
+{
+	PR_Lock(queue->lock);
+	if (queue->rc == 0)
+	{
+		queue->rc = rc;
+	}
+	PR_NotifyAllCondVar(queue->not_empty);
+	PR_NotifyAllCondVar(queue->not_full);
+	PR_Unlock(queue->lock);
+}
+
+static void
+memberof_fixup_worker_thread(void *arg)
+{
+	memberof_fixup_worker *worker = (memberof_fixup_worker *)arg;
+	memberof_fixup_queue *queue = worker->queue;
+	Slapi_Entry **batch;
+	int rc = 0;
+	int n, i;
+
+	/* set bind DN in the thread data */
+	slapi_td_set_dn(slapi_ch_strdup(queue->bind_dn));
+
+	batch = (Slapi_Entry **)slapi_ch_calloc(MEMBEROF_FIXUP_BATCH_SIZE, sizeof(Slapi_Entry *));
+	while (rc == 0 &&
+	       (n = memberof_fixup_queue_get(queue, batch, MEMBEROF_FIXUP_BATCH_SIZE)) > 0)
+	{
+		rc = memberof_fixup_batch(queue, worker->index, batch, n, queue->be);
+		for (i = 0; i < n; i++)
+		{
+			slapi_entry_free(batch[i]);
+		}
+		if (rc)
+		{
+			memberof_fixup_queue_fail(queue, rc);
+		}
+	}
+	slapi_ch_free((void **)&batch);
+}
+
+/*
+ * Fix up the entries of a batch.  The memberOf values come from the
+ * snapshot of the group graph, and are all computed before any write.
+ * Each entry that needs a change is then fixed in its own transaction
+ * of be, unless it is NULL, so that no transaction is held while the
+ * graph is read and a failure does not leave the entry cache ahead of
+ * the database for the rest of the batch.
+ */
+static int
+memberof_fixup_batch(memberof_fixup_queue *queue, int reader, Slapi_Entry **batch,
+	int n, Slapi_Backend *be)
+{
+	Slapi_ValueSet **groups;
+	int rc = 0;
+	int i;
+
+	groups = (Slapi_ValueSet **)slapi_ch_calloc(n, sizeof(Slapi_ValueSet *));
+	for (i = 0; i < n; i++)
+	{
+		groups[i] = slapi_valueset_new();
+		memberof_graph_snapshot_get_groups(queue->snap, reader, queue->config,
+			slapi_entry_get_sdn(batch[i]), groups[i]);
+	}
+
+	for (i = 0; i < n && rc == 0; i++)
+	{
+		Slapi_PBlock *txn_pb = NULL;
+
+		if (slapi_is_shutting_down())
+		{
+			rc = -1;
+			break;
+		}
+		if (memberof_has_same_groups(batch[i], queue->config, groups[i]))
+		{
+			continue;
+		}
+		if (be)
+		{
+			txn_pb = slapi_pblock_new();
+			slapi_pblock_set(txn_pb, SLAPI_BACKEND, be);
+			if ((rc = slapi_back_transaction_begin(txn_pb)))
+			{
+				slapi_log_error(SLAPI_LOG_FATAL, MEMBEROF_PLUGIN_SUBSYSTEM,
+					"memberof_fixup_batch: failed to start transaction\n");
+				slapi_pblock_destroy(txn_pb);
+				break;
+			}
+		}
+		rc = memberof_fix_memberof_values(queue->config, batch[i], groups[i]);
+		if (txn_pb)
+		{
+			if (rc)
+			{
+				slapi_back_transaction_abort(txn_pb);
+			}
+			else
+			{
+				rc = slapi_back_transaction_commit(txn_pb);
+			}
+			slapi_pblock_destroy(txn_pb);
+		}
+		if (rc)
+		{
+			slapi_log_error(SLAPI_LOG_FATAL, MEMBEROF_PLUGIN_SUBSYSTEM,
+				"memberof_fixup_batch: failed to fix up %s (%d)\n",
+				slapi_entry_get_dn_const(batch[i]), rc);
+		}
+	}
+	if (rc == 0)
+	{
+		PR_AtomicAdd(&queue->nentries, n);
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		slapi_valueset_free(groups[i]);
+	}
+	slapi_ch_free((void **)&groups);
+
+	return rc;
+}
+
+/*
+ * memberof_has_same_groups()
+ *
+ * Returns 1 if e holds exactly the groups as memberOf values.  The entry
+ * may have been read without them: an absent attribute is never taken
+ * as up to date.
+ */
+static int
+memberof_has_same_groups(Slapi_Entry *e, MemberOfConfig *config,
+	Slapi_ValueSet *groups)
+{
+	Slapi_Attr *attr = NULL;
+	Slapi_Value *val = NULL;
+	int numvals = 0;
+	int hint = 0;
+
+	if (slapi_entry_attr_find(e, config->memberof_attr, &attr) ||
+	    slapi_attr_get_numvalues(attr, &numvals) ||
+	    numvals != (groups ? slapi_valueset_count(groups) : 0))
+	{
+		return 0;
+	}
+	for (hint = groups ? slapi_valueset_first_value(groups, &val) : -1; val;
+	     hint = slapi_valueset_next_value(groups, hint, &val))
+	{
+		if (slapi_attr_value_find(attr, slapi_value_get_berval(val)))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * memberof_add_groups_delta()
+ *
+ * e just became a member of group_sdn, directly or through nested
+ * groups: add group_sdn and the groups it is nested in to the memberOf
+ * values of e, in a single modify holding only the missing values.
+ * done is left to 0 when the group graph can't tell, the caller then
+ * recomputes all the values.
+ */
+static int
+memberof_add_groups_delta(Slapi_Entry *e, MemberOfConfig *config,
+	Slapi_DN *group_sdn, int *done)
+{
+	Slapi_DN *sdn = slapi_entry_get_sdn(e);
+	Slapi_ValueSet *groupvals = NULL;
+	Slapi_ValueSet *group_norm_vals = NULL;
+	Slapi_Attr *memberof_attr = NULL;
+	Slapi_Value *val = NULL;
+	Slapi_Value *ndn_val = NULL;
+	Slapi_Mod *smod = NULL;
+	int hint = 0;
+	int rc = 0;
+
+	*done = 0;
+	/* the searches of memberof_get_groups() only look at the backend of e */
+	if ((config->skip_nested && !config->fixup_task) ||
+	    !memberof_entry_in_scope(config, sdn) ||
+	    (!config->allBackends && slapi_be_select(sdn) != slapi_be_select(group_sdn)))
+	{
+		return rc;
+	}
+
+	groupvals = slapi_valueset_new();
+	group_norm_vals = slapi_valueset_new();
+	if (memberof_graph_get_groups(config, group_sdn, NULL, 1, groupvals, group_norm_vals))
+	{
+		goto bail;
+	}
+	ndn_val = slapi_value_new_string(slapi_sdn_get_ndn(group_sdn));
+	slapi_value_set_flags(ndn_val, SLAPI_ATTR_FLAG_NORMALIZED_CIS);
+	if (memberof_entry_in_scope(config, group_sdn) &&
+	    !slapi_valueset_find(config->group_slapiattrs[0], group_norm_vals, ndn_val))
+	{
+		slapi_valueset_add_value_ext(groupvals,
+			slapi_value_new_string(slapi_sdn_get_dn(group_sdn)), SLAPI_VALUE_FLAG_PASSIN);
+	}
+	slapi_value_free(&ndn_val);
+
+	smod = slapi_mod_new();
+	slapi_mod_init(smod, 0);
+	slapi_mod_set_operation(smod, LDAP_MOD_ADD | LDAP_MOD_BVALUES);
+	slapi_mod_set_type(smod, config->memberof_attr);
+
+	slapi_entry_attr_find(e, config->memberof_attr, &memberof_attr);
+	ndn_val = slapi_value_new_string(slapi_sdn_get_ndn(sdn));
+	slapi_value_set_flags(ndn_val, SLAPI_ATTR_FLAG_NORMALIZED_CIS);
+	for (hint = slapi_valueset_first_value(groupvals, &val); val;
+	     hint = slapi_valueset_next_value(groupvals, hint, &val))
+	{
+		/* not a member of itself through a circular grouping,
+		 * and nothing the entry has already */
+		if (0 == memberof_compare(config, &val, &ndn_val) ||
+		    (memberof_attr && 0 == slapi_attr_value_find(memberof_attr,
+		                                              slapi_value_get_berval(val))))
+		{
+			continue;
+		}
+		/* this makes a copy of the berval */
+		slapi_mod_add_value(smod, slapi_value_get_berval(val));
+	}
+	slapi_value_free(&ndn_val);
+
+	if (slapi_mod_get_num_values(smod))
+	{
+		LDAPMod *mods[2];
+
+		mods[0] = (LDAPMod *)slapi_mod_get_ldapmod_byref(smod);
+		mods[1] = 0;
+		rc = memberof_add_memberof_attr(mods, slapi_sdn_get_dn(sdn), config->auto_add_oc);
+	}
+	*done = 1;
+
+bail:
+	slapi_mod_free(&smod);
+	slapi_valueset_free(groupvals);
+	slapi_valueset_free(group_norm_vals);
+
 	return rc;
 }
 
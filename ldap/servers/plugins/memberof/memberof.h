@@ -25,6 +25,7 @@
 #include "portable.h"
 #include "slapi-plugin.h"
 #include <nspr.h>
+#include <plhash.h>
 
 /* Private API: to get SLAPI_DSE_RETURNTEXT_SIZE, DSE_FLAG_PREOP, and DSE_FLAG_POSTOP */
 #include "slapi-private.h"
@@ -35,6 +36,7 @@
 #define MEMBEROF_PLUGIN_SUBSYSTEM   "memberof-plugin"   /* used for logging */
 #define MEMBEROF_INT_PREOP_DESC "memberOf internal postop plugin"
 #define MEMBEROF_PREOP_DESC "memberof preop plugin"
+#define MEMBEROF_GRAPH_POSTOP_DESC "memberOf group graph postop plugin"
 #define MEMBEROF_GROUP_ATTR "memberOfGroupAttr"
 #define MEMBEROF_ATTR "memberOfAttr"
 #define MEMBEROF_BACKEND_ATTR "memberOfAllBackends"
@@ -62,6 +64,7 @@ typedef struct memberofconfig {
 	int skip_nested;
 	int fixup_task;
 	char *auto_add_oc;
+	PLHashTable *visited; /* entries already updated by the operation */
 } MemberOfConfig;
 
 
@@ -88,5 +91,31 @@ int memberof_apply_config (Slapi_PBlock *pb, Slapi_Entry* entryBefore, Slapi_Ent
 void *memberof_get_plugin_id();
 void memberof_release_config();
 PRUint64 get_plugin_started();
+int memberof_entry_in_scope(MemberOfConfig *config, Slapi_DN *sdn);
+int memberof_call_foreach_dn(Slapi_PBlock *pb, Slapi_DN *sdn, MemberOfConfig *config,
+	char **types, plugin_search_entry_callback callback, void *callback_data);
+
+/*
+ * memberof_graph.c
+ */
+int memberof_graph_init(int usetxn);
+void memberof_graph_close();
+void memberof_graph_invalidate();
+void memberof_graph_end_op(int failed, int nested);
+int memberof_graph_is_group(MemberOfConfig *config, Slapi_DN *sdn);
+int memberof_graph_get_groups(MemberOfConfig *config, Slapi_DN *member_sdn,
+	Slapi_ValueSet *direct, int nested, Slapi_ValueSet *groupvals,
+	Slapi_ValueSet *group_norm_vals);
+void memberof_graph_add_group(MemberOfConfig *config, Slapi_Entry *e);
+void memberof_graph_del_group(MemberOfConfig *config, Slapi_DN *sdn);
+int memberof_graph_rename_group(MemberOfConfig *config, Slapi_DN *pre_sdn,
+	Slapi_DN *post_sdn);
+void memberof_graph_modify_group(MemberOfConfig *config, Slapi_Entry *post_e,
+	LDAPMod **mods);
+typedef struct _memberof_graph_snapshot memberof_graph_snapshot;
+memberof_graph_snapshot *memberof_graph_take_snapshot(MemberOfConfig *config, int nreaders);
+void memberof_graph_free_snapshot(memberof_graph_snapshot **snap);
+void memberof_graph_snapshot_get_groups(memberof_graph_snapshot *snap, int reader,
+	MemberOfConfig *config, Slapi_DN *sdn, Slapi_ValueSet *groupvals);
 
 #endif	/* _MEMBEROF_H_ */
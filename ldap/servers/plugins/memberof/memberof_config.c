@@ -662,6 +662,9 @@ memberof_apply_config (Slapi_PBlock *pb, Slapi_Entry* entryBefore, Slapi_Entry*
 	/* release the lock */
 	memberof_unlock_config();
 
+	/* the scope or the grouping attributes may have changed */
+	memberof_graph_invalidate();
+
 done:
 	slapi_sdn_free(&config_sdn);
 	slapi_entry_free(config_entry);
@@ -775,6 +778,15 @@ memberof_copy_config(MemberOfConfig *dest, MemberOfConfig *src)
 	}
 }
 
+static PRIntn
+memberof_free_visited_entry(PLHashEntry *he, PRIntn i, void *arg)
+{
+	char *ndn = (char *)he->key;
+
+	slapi_ch_free_string(&ndn);
+	return HT_ENUMERATE_REMOVE | HT_ENUMERATE_NEXT;
+}
+
 /*
  * memberof_free_config()
  *
@@ -799,6 +811,11 @@ memberof_free_config(MemberOfConfig *config)
 		slapi_ch_free_string(&config->memberof_attr);
 		memberof_free_scope(config->entryScopes, &config->entryScopeCount);
 		memberof_free_scope(config->entryScopeExcludeSubtrees, &config->entryExcludeScopeCount);
+		if (config->visited) {
+			PL_HashTableEnumerateEntries(config->visited, memberof_free_visited_entry, NULL);
+			PL_HashTableDestroy(config->visited);
+			config->visited = NULL;
+		}
 	}
 }
 
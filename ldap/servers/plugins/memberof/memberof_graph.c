@@ -0,0 +1,1252 @@
+/** BEGIN COPYRIGHT BLOCK
+ * Copyright (C) 2015 Red Hat, Inc.
+ * All rights reserved.
+ *
+ * License: GPL (version 3 or any later version).
+ * See LICENSE for details.
+ * END COPYRIGHT BLOCK **/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+/*
+ * memberof_graph.c - in memory graph of the nested groups
+ *
+ * The graph has one node per group in the memberOf scope (an entry
+ * matching the group filter), linked to the groups listing it as a member
+ * (its parents) and to its members which are groups themselves (its
+ * children).  Users are not stored: their direct groups are found with a
+ * single search, the groups these are nested in come from the graph.
+ *
+ * The groups a node is nested in (its closure) are computed on demand and
+ * cached in the node, stamped with the generation of the graph.  Any change
+ * of an edge moves the generation forward so that stale closures get
+ * recomputed on next use; adding or removing a user does not change any
+ * edge.
+ *
+ * The graph is built on first use with two searches over the groups, then
+ * updated in place by the post operation callbacks.  It is dropped, and
+ * rebuilt when needed, whenever it may have missed a change: the config
+ * changed, a backend changed state, a fixup task started, or an operation
+ * which changed it failed (its transaction was aborted).
+ *
+ * With betxn, the callbacks run before the transaction is committed.  The
+ * thread which changes the graph then owns it until its operation is
+ * over: the other threads do not see the changes which are not committed
+ * yet, and fall back to the searches meanwhile.  A thread changing the
+ * graph while another one owns it drops it, as the changes of the two
+ * transactions could not be told apart.
+ *
+ * Everything is done under graph_lock.  When the graph can't answer, the
+ * callers fall back to the internal searches.
+ *
+ * The fixup task takes a snapshot instead: a private graph built with a
+ * single search over the groups, which also records the direct groups of
+ * every other member.  All the closures are computed upfront, after which
+ * the snapshot is read only and its readers need no lock.
+ */
+
+#include "memberof.h"
+
+#define MEMBEROF_GRAPH_INCR_LIST 4
+
+typedef struct _memberof_graph_node
+{
+	Slapi_DN *sdn;                          /* also holds the hash key */
+	Slapi_Backend *be;
+	struct _memberof_graph_node **parents;  /* groups listing this one */
+	int nparents;
+	int maxparents;
+	struct _memberof_graph_node **children; /* members which are groups */
+	int nchildren;
+	int maxchildren;
+	struct _memberof_graph_node **closure;  /* all the groups this one is nested in */
+	int nclosure;
+	PRUint64 closure_gen;
+	PRUint32 mark;                          /* closure traversal */
+	PRUint32 out_mark;                      /* memberof_graph_get_groups() */
+	int index;                              /* in a snapshot */
+} memberof_graph_node;
+
+/* a member which is not a group, in a snapshot */
+typedef struct _memberof_graph_member
+{
+	char *ndn;                              /* the hash key */
+	memberof_graph_node **parents;
+	int nparents;
+	int maxparents;
+} memberof_graph_member;
+
+struct _memberof_graph_snapshot
+{
+	PLHashTable *nodes;                     /* ndn -> node */
+	PLHashTable *members;                   /* ndn -> member */
+	int nnodes;
+	int nreaders;
+	PRUint32 *marks;                        /* nnodes marks per reader */
+	PRUint32 *reader_mark;
+};
+
+typedef struct _memberof_graph_snapshot_data
+{
+	MemberOfConfig *config;
+	PLHashTable *members;
+	int nnodes;
+} memberof_graph_snapshot_data;
+
+static PRLock *graph_lock = NULL;
+static PLHashTable *graph_nodes = NULL;  /* ndn -> node, NULL when not built */
+static PRUint64 graph_gen = 1;
+static PRUint32 graph_mark = 0;
+static PRUintn graph_touched_index;
+static PRCallOnceType graph_callonce;
+static int graph_usetxn = 0;
+static PRThread *graph_owner = NULL;     /* has changes not committed yet */
+
+static memberof_graph_node *memberof_graph_lookup(const char *ndn);
+static memberof_graph_node *memberof_graph_new_node(Slapi_DN *sdn);
+static void memberof_graph_drop_node(memberof_graph_node *node);
+static int memberof_graph_link(memberof_graph_node *parent, memberof_graph_node *child);
+static int memberof_graph_unlink(memberof_graph_node *parent, memberof_graph_node *child);
+static int memberof_graph_reset_children(MemberOfConfig *config,
+	memberof_graph_node *node, Slapi_Entry *e);
+static void memberof_graph_free_table(void);
+static PRIntn memberof_graph_free_node_entry(PLHashEntry *he, PRIntn i, void *arg);
+static int memberof_graph_ready(MemberOfConfig *config);
+static int memberof_graph_build(MemberOfConfig *config);
+static int memberof_graph_search_groups(MemberOfConfig *config, char **attrs,
+	plugin_search_entry_callback callback, void *callback_data);
+static int memberof_graph_add_node_callback(Slapi_Entry *e, void *callback_data);
+static int memberof_graph_add_edges_callback(Slapi_Entry *e, void *callback_data);
+static int memberof_graph_add_parent_callback(Slapi_Entry *e, void *callback_data);
+static int memberof_graph_snapshot_callback(Slapi_Entry *e, void *callback_data);
+static PRIntn memberof_graph_snapshot_prepare(PLHashEntry *he, PRIntn i, void *arg);
+static void memberof_graph_free_member(memberof_graph_member *member);
+static void memberof_graph_free_members(PLHashTable *members);
+static void memberof_graph_compute_closure(MemberOfConfig *config, memberof_graph_node *node);
+static PRUint32 memberof_graph_next_mark(void);
+static void memberof_graph_touch(void);
+static int memberof_graph_hidden(void);
+static void memberof_graph_claim(void);
+static void memberof_graph_be_state_change(void *handle, char *be_name,
+	int old_be_state, int new_be_state);
+
+static PRStatus
+memberof_graph_callonce(void)
+{
+	return PR_NewThreadPrivateIndex(&graph_touched_index, NULL);
+}
+
+int
+memberof_graph_init(int usetxn)
+{
+	graph_usetxn = usetxn;
+	if (PR_SUCCESS != PR_CallOnce(&graph_callonce, memberof_graph_callonce)) {
+		return -1;
+	}
+	if ((graph_lock = PR_NewLock()) == NULL) {
+		return -1;
+	}
+	slapi_register_backend_state_change((void *)memberof_graph_be_state_change,
+		memberof_graph_be_state_change);
+
+	return 0;
+}
+
+void
+memberof_graph_close()
+{
+	slapi_unregister_backend_state_change((void *)memberof_graph_be_state_change);
+	if (graph_lock) {
+		PR_Lock(graph_lock);
+		memberof_graph_free_table();
+		PR_Unlock(graph_lock);
+		PR_DestroyLock(graph_lock);
+		graph_lock = NULL;
+	}
+}
+
+/*
+ * memberof_graph_invalidate()
+ *
+ * Drop the graph, it is rebuilt on next use.
+ */
+void
+memberof_graph_invalidate()
+{
+	if (graph_lock) {
+		PR_Lock(graph_lock);
+		if (graph_nodes) {
+			slapi_log_error(SLAPI_LOG_PLUGIN, MEMBEROF_PLUGIN_SUBSYSTEM,
+				"memberof_graph_invalidate: dropping the group graph\n");
+		}
+		memberof_graph_free_table();
+		PR_Unlock(graph_lock);
+	}
+}
+
+/*
+ * memberof_graph_end_op()
+ *
+ * Called once the operation is over, after its transaction was committed
+ * or aborted.  If it failed, the graph may hold changes which never made
+ * it to the database: drop it.  An operation which succeeded within the
+ * transaction of another one may still be rolled back with it, so only
+ * the end of the outermost transaction makes the changes visible.
+ */
+void
+memberof_graph_end_op(int failed, int nested)
+{
+	if (NULL == graph_lock || NULL == PR_GetThreadPrivate(graph_touched_index)) {
+		return;
+	}
+	if (failed) {
+		memberof_graph_invalidate();
+	}
+	if (failed || !nested) {
+		PR_Lock(graph_lock);
+		if (graph_owner == PR_GetCurrentThread()) {
+			graph_owner = NULL;
+		}
+		PR_Unlock(graph_lock);
+		PR_SetThreadPrivate(graph_touched_index, NULL);
+	}
+}
+
+/*
+ * memberof_graph_is_group()
+ *
+ * Returns 1 if sdn is a group of the graph, 0 if it is not, and -1 if
+ * the graph is not available.
+ */
+int
+memberof_graph_is_group(MemberOfConfig *config, Slapi_DN *sdn)
+{
+	int rc = -1;
+
+	PR_Lock(graph_lock);
+	if (0 == memberof_graph_ready(config)) {
+		rc = memberof_graph_lookup(slapi_sdn_get_ndn(sdn)) ? 1 : 0;
+	}
+	PR_Unlock(graph_lock);
+
+	return rc;
+}
+
+/*
+ * memberof_graph_get_groups()
+ *
+ * Adds the groups member_sdn belongs to to groupvals (their DN) and to
+ * group_norm_vals (their normalized DN).  If member_sdn is a group of the
+ * graph, its parents are known.  Otherwise direct holds the normalized DNs
+ * of the groups listing member_sdn.  Unless nested is set, only these
+ * direct groups are returned.
+ *
+ * Returns 0, or -1 if the graph can't tell: it is not available, one of
+ * the direct groups is unknown to it, or member_sdn is not a group and
+ * direct is NULL.  Nothing is added then.
+ */
+int
+memberof_graph_get_groups(MemberOfConfig *config, Slapi_DN *member_sdn,
+	Slapi_ValueSet *direct, int nested, Slapi_ValueSet *groupvals,
+	Slapi_ValueSet *group_norm_vals)
+{
+	memberof_graph_node **found = NULL;
+	memberof_graph_node **sources = NULL;
+	memberof_graph_node *node = NULL;
+	int nfound = 0;
+	int maxfound = 0;
+	int nsources = 0;
+	PRUint32 mark;
+	int rc = 0;
+	int i, j;
+
+	PR_Lock(graph_lock);
+	if (memberof_graph_ready(config)) {
+		rc = -1;
+		goto bail;
+	}
+
+	/* the direct groups */
+	if ((node = memberof_graph_lookup(slapi_sdn_get_ndn(member_sdn)))) {
+		sources = (memberof_graph_node **)slapi_ch_calloc(node->nparents + 1,
+			sizeof(memberof_graph_node *));
+		for (i = 0; i < node->nparents; i++) {
+			/* without all backends, only the groups of the backend of the
+			 * member are searched */
+			if (config->allBackends || node->parents[i]->be == node->be) {
+				sources[nsources++] = node->parents[i];
+			}
+		}
+	} else if (direct) {
+		Slapi_Value *val = NULL;
+		int hint;
+
+		sources = (memberof_graph_node **)slapi_ch_calloc(
+			slapi_valueset_count(direct) + 1, sizeof(memberof_graph_node *));
+		for (hint = slapi_valueset_first_value(direct, &val); val;
+		     hint = slapi_valueset_next_value(direct, hint, &val)) {
+			memberof_graph_node *parent = memberof_graph_lookup(slapi_value_get_string(val));
+
+			if (NULL == parent) {
+				/* the graph missed a change: start over */
+				slapi_log_error(SLAPI_LOG_PLUGIN, MEMBEROF_PLUGIN_SUBSYSTEM,
+					"memberof_graph_get_groups: group %s is not in the graph\n",
+					slapi_value_get_string(val));
+				memberof_graph_free_table();
+				rc = -1;
+				goto bail;
+			}
+			sources[nsources++] = parent;
+		}
+	} else {
+		rc = -1;
+		goto bail;
+	}
+
+	/* and the groups they are nested in, each one once */
+	mark = memberof_graph_next_mark();
+	for (i = 0; i < nsources; i++) {
+		memberof_graph_node *source = sources[i];
+		int ncandidates = 1;
+
+		if (nested) {
+			if (source->closure_gen != graph_gen) {
+				memberof_graph_compute_closure(config, source);
+			}
+			ncandidates += source->nclosure;
+		}
+		for (j = 0; j < ncandidates; j++) {
+			memberof_graph_node *group = j ? source->closure[j - 1] : source;
+
+			if (group == node || group->out_mark == mark) {
+				continue;
+			}
+			group->out_mark = mark;
+			if (nfound == maxfound) {
+				maxfound += MEMBEROF_GRAPH_INCR_LIST + maxfound;
+				found = (memberof_graph_node **)slapi_ch_realloc((char *)found,
+					maxfound * sizeof(memberof_graph_node *));
+			}
+			found[nfound++] = group;
+		}
+	}
+
+	for (i = 0; i < nfound; i++) {
+		Slapi_Value *ndn_val = slapi_value_new_string(slapi_sdn_get_ndn(found[i]->sdn));
+
+		slapi_value_set_flags(ndn_val, SLAPI_ATTR_FLAG_NORMALIZED_CIS);
+		slapi_valueset_add_value_ext(groupvals,
+			slapi_value_new_string(slapi_sdn_get_dn(found[i]->sdn)), SLAPI_VALUE_FLAG_PASSIN);
+		slapi_valueset_add_value_ext(group_norm_vals, ndn_val, SLAPI_VALUE_FLAG_PASSIN);
+	}
+
+bail:
+	PR_Unlock(graph_lock);
+	slapi_ch_free((void **)&sources);
+	slapi_ch_free((void **)&found);
+
+	return rc;
+}
+
+/*
+ * memberof_graph_add_group()
+ *
+ * e was added, renamed into the scope or got its first member: if it is a
+ * group, add it to the graph.  Its parents are found with one search.
+ */
+void
+memberof_graph_add_group(MemberOfConfig *config, Slapi_Entry *e)
+{
+	Slapi_DN *sdn = slapi_entry_get_sdn(e);
+	memberof_graph_node *node;
+
+	if (NULL == config->group_filter ||
+	    slapi_filter_test_simple(e, config->group_filter) ||
+	    !memberof_entry_in_scope(config, sdn)) {
+		return;
+	}
+
+	PR_Lock(graph_lock);
+	memberof_graph_claim();
+	if (graph_nodes && NULL == memberof_graph_lookup(slapi_sdn_get_ndn(sdn))) {
+		memberof_graph_touch();
+		node = memberof_graph_new_node(sdn);
+		if (memberof_call_foreach_dn(NULL, sdn, config, config->groupattrs,
+		                             memberof_graph_add_parent_callback, node)) {
+			memberof_graph_free_table();
+		} else {
+			memberof_graph_reset_children(config, node, e);
+			graph_gen++;
+		}
+	}
+	PR_Unlock(graph_lock);
+}
+
+/*
+ * memberof_graph_del_group()
+ *
+ * sdn was deleted, or moved out of the scope.
+ */
+void
+memberof_graph_del_group(MemberOfConfig *config, Slapi_DN *sdn)
+{
+	memberof_graph_node *node;
+
+	PR_Lock(graph_lock);
+	memberof_graph_claim();
+	if (graph_nodes && (node = memberof_graph_lookup(slapi_sdn_get_ndn(sdn)))) {
+		memberof_graph_touch();
+		memberof_graph_drop_node(node);
+		graph_gen++;
+	}
+	PR_Unlock(graph_lock);
+}
+
+/*
+ * memberof_graph_rename_group()
+ *
+ * pre_sdn was renamed to post_sdn.  The edges are kept, as the groups
+ * listing the entry are updated to the new DN.
+ * Returns 1 if pre_sdn was in the graph, 0 otherwise.
+ */
+int
+memberof_graph_rename_group(MemberOfConfig *config, Slapi_DN *pre_sdn,
+	Slapi_DN *post_sdn)
+{
+	memberof_graph_node *node;
+	int rc = 0;
+
+	PR_Lock(graph_lock);
+	memberof_graph_claim();
+	if (graph_nodes && (node = memberof_graph_lookup(slapi_sdn_get_ndn(pre_sdn)))) {
+		memberof_graph_touch();
+		if (memberof_entry_in_scope(config, post_sdn)) {
+			PL_HashTableRemove(graph_nodes, slapi_sdn_get_ndn(node->sdn));
+			slapi_sdn_copy(post_sdn, node->sdn);
+			node->be = slapi_be_select(node->sdn);
+			PL_HashTableAdd(graph_nodes, slapi_sdn_get_ndn(node->sdn), node);
+		} else {
+			memberof_graph_drop_node(node);
+		}
+		graph_gen++;
+		rc = 1;
+	}
+	PR_Unlock(graph_lock);
+
+	return rc;
+}
+
+/*
+ * memberof_graph_modify_group()
+ *
+ * The grouping attributes of post_e were modified by mods.  Only the
+ * members which are groups matter: a user joining or leaving a group
+ * leaves the graph untouched.
+ */
+void
+memberof_graph_modify_group(MemberOfConfig *config, Slapi_Entry *post_e,
+	LDAPMod **mods)
+{
+	Slapi_DN *sdn = slapi_entry_get_sdn(post_e);
+	memberof_graph_node *node;
+	Slapi_Mods *smods;
+	Slapi_Mod *smod;
+	Slapi_Mod *next_mod;
+	Slapi_DN *member_sdn;
+	int changed = 0;
+	int reset = 0;
+
+	PR_Lock(graph_lock);
+	memberof_graph_claim();
+	if (NULL == graph_nodes) {
+		PR_Unlock(graph_lock);
+		return;
+	}
+	if (NULL == (node = memberof_graph_lookup(slapi_sdn_get_ndn(sdn)))) {
+		PR_Unlock(graph_lock);
+		memberof_graph_add_group(config, post_e);
+		return;
+	}
+
+	memberof_graph_touch();
+	member_sdn = slapi_sdn_new();
+	smods = slapi_mods_new();
+	slapi_mods_init_byref(smods, mods);
+	next_mod = slapi_mod_new();
+	for (smod = slapi_mods_get_first_smod(smods, next_mod); smod && !reset;
+	     smod = slapi_mods_get_next_smod(smods, next_mod)) {
+		int op = slapi_mod_get_operation(smod) & ~LDAP_MOD_BVALUES;
+		struct berval *bv;
+		int i;
+
+		for (i = 0; config->groupattrs[i]; i++) {
+			if (0 == slapi_attr_type_cmp(config->groupattrs[i],
+			                             slapi_mod_get_type(smod), SLAPI_TYPE_CMP_BASE)) {
+				break;
+			}
+		}
+		if (NULL == config->groupattrs[i]) {
+			slapi_mod_done(next_mod);
+			continue;
+		}
+
+		if (LDAP_MOD_REPLACE == op ||
+		    (LDAP_MOD_DELETE == op && 0 == slapi_mod_get_num_values(smod))) {
+			/* the entry has the resulting members */
+			changed |= memberof_graph_reset_children(config, node, post_e);
+			reset = 1;
+		}
+		for (bv = reset ? NULL : slapi_mod_get_first_value(smod); bv;
+		     bv = slapi_mod_get_next_value(smod)) {
+			memberof_graph_node *child;
+			char *dn = slapi_ch_malloc(bv->bv_len + 1);
+
+			memcpy(dn, bv->bv_val, bv->bv_len);
+			dn[bv->bv_len] = '\0';
+			slapi_sdn_set_dn_passin(member_sdn, dn);
+			child = memberof_graph_lookup(slapi_sdn_get_ndn(member_sdn));
+			if (NULL == child || child == node) {
+				continue;
+			}
+			if (LDAP_MOD_ADD == op) {
+				changed |= memberof_graph_link(node, child);
+			} else if (LDAP_MOD_DELETE == op) {
+				/* it may still be listed by another grouping attribute */
+				Slapi_Value *child_val = slapi_value_new_string(slapi_sdn_get_dn(child->sdn));
+				int still_member = 0;
+
+				for (i = 0; config->groupattrs[i] && !still_member; i++) {
+					still_member = slapi_entry_attr_has_syntax_value(post_e,
+						config->groupattrs[i], child_val);
+				}
+				slapi_value_free(&child_val);
+				if (!still_member) {
+					changed |= memberof_graph_unlink(node, child);
+				}
+			}
+		}
+		slapi_mod_done(next_mod);
+	}
+	slapi_mod_free(&next_mod);
+	slapi_mods_free(&smods);
+	slapi_sdn_free(&member_sdn);
+
+	if (changed) {
+		graph_gen++;
+	}
+	PR_Unlock(graph_lock);
+}
+
+/*
+ * memberof_graph_take_snapshot()
+ *
+ * Build a private graph for the fixup task, to be read concurrently by
+ * nreaders threads, and drop the shared one.  Besides the groups, it
+ * holds the direct groups of every other member, so its size grows with
+ * the number of memberships.
+ * Returns NULL if the graph could not be built.
+ */
+memberof_graph_snapshot *
+memberof_graph_take_snapshot(MemberOfConfig *config, int nreaders)
+{
+	memberof_graph_snapshot_data data = {config, NULL, 0};
+	memberof_graph_snapshot *snap = NULL;
+	int rc = -1;
+
+	if (NULL == config->groupattrs || NULL == config->group_filter) {
+		return NULL;
+	}
+	data.members = PL_NewHashTable(1024, PL_HashString, PL_CompareStrings,
+		PL_CompareValues, NULL, NULL);
+	if (NULL == data.members) {
+		return NULL;
+	}
+
+	PR_Lock(graph_lock);
+	memberof_graph_free_table();
+	graph_nodes = PL_NewHashTable(64, PL_HashString, PL_CompareStrings,
+		PL_CompareValues, NULL, NULL);
+	if (graph_nodes) {
+		/* the groups and all their members in one pass */
+		rc = memberof_graph_search_groups(config, config->groupattrs,
+			memberof_graph_snapshot_callback, &data);
+	}
+	if (rc) {
+		slapi_log_error(SLAPI_LOG_FATAL, MEMBEROF_PLUGIN_SUBSYSTEM,
+			"memberof_graph_take_snapshot: failed to build the group graph (%d)\n", rc);
+		memberof_graph_free_table();
+		PR_Unlock(graph_lock);
+		memberof_graph_free_members(data.members);
+		return NULL;
+	}
+
+	/* then every closure, once */
+	graph_gen++;
+	PL_HashTableEnumerateEntries(graph_nodes, memberof_graph_snapshot_prepare, &data);
+
+	snap = (memberof_graph_snapshot *)slapi_ch_calloc(1, sizeof(memberof_graph_snapshot));
+	snap->nodes = graph_nodes;
+	snap->members = data.members;
+	snap->nnodes = data.nnodes;
+	graph_nodes = NULL;
+	graph_gen++;
+	PR_Unlock(graph_lock);
+
+	snap->nreaders = nreaders;
+	snap->marks = (PRUint32 *)slapi_ch_calloc(snap->nnodes * nreaders + 1, sizeof(PRUint32));
+	snap->reader_mark = (PRUint32 *)slapi_ch_calloc(nreaders, sizeof(PRUint32));
+	slapi_log_error(SLAPI_LOG_PLUGIN, MEMBEROF_PLUGIN_SUBSYSTEM,
+		"memberof_graph_take_snapshot: %d groups, %d other members\n",
+		snap->nnodes, snap->members->nentries);
+
+	return snap;
+}
+
+void
+memberof_graph_free_snapshot(memberof_graph_snapshot **snap)
+{
+	if (NULL == snap || NULL == *snap) {
+		return;
+	}
+	PL_HashTableEnumerateEntries((*snap)->nodes, memberof_graph_free_node_entry, NULL);
+	PL_HashTableDestroy((*snap)->nodes);
+	memberof_graph_free_members((*snap)->members);
+	slapi_ch_free((void **)&(*snap)->marks);
+	slapi_ch_free((void **)&(*snap)->reader_mark);
+	slapi_ch_free((void **)snap);
+}
+
+/*
+ * memberof_graph_snapshot_get_groups()
+ *
+ * Adds the DN of the groups sdn belongs to, directly or not, to
+ * groupvals.  reader is the index of the calling thread, below the
+ * nreaders given to memberof_graph_take_snapshot().
+ */
+void
+memberof_graph_snapshot_get_groups(memberof_graph_snapshot *snap, int reader,
+	MemberOfConfig *config, Slapi_DN *sdn, Slapi_ValueSet *groupvals)
+{
+	const char *ndn = slapi_sdn_get_ndn(sdn);
+	PRUint32 *marks = snap->marks + reader * snap->nnodes;
+	memberof_graph_node **parents = NULL;
+	memberof_graph_node *node = NULL;
+	memberof_graph_member *member = NULL;
+	Slapi_Backend *be = NULL;
+	PRUint32 mark;
+	int nparents = 0;
+	int i, j;
+
+	/* PL_HashTableLookup() reorders the buckets, it is not for readers */
+	if ((node = (memberof_graph_node *)PL_HashTableLookupConst(snap->nodes, ndn))) {
+		parents = node->parents;
+		nparents = node->nparents;
+		be = node->be;
+	} else if ((member = (memberof_graph_member *)PL_HashTableLookupConst(snap->members, ndn))) {
+		parents = member->parents;
+		nparents = member->nparents;
+		be = slapi_be_select(sdn);
+	}
+
+	if (0 == ++snap->reader_mark[reader]) {
+		++snap->reader_mark[reader];
+	}
+	mark = snap->reader_mark[reader];
+	for (i = 0; i < nparents; i++) {
+		memberof_graph_node *source = parents[i];
+
+		/* without all backends, only the groups of the backend of the
+		 * member are searched */
+		if (!config->allBackends && source->be != be) {
+			continue;
+		}
+		for (j = 0; j <= source->nclosure; j++) {
+			memberof_graph_node *group = j ? source->closure[j - 1] : source;
+
+			if (group == node || marks[group->index] == mark) {
+				continue;
+			}
+			marks[group->index] = mark;
+			slapi_valueset_add_value_ext(groupvals,
+				slapi_value_new_string(slapi_sdn_get_dn(group->sdn)), SLAPI_VALUE_FLAG_PASSIN);
+		}
+	}
+}
+
+static void
+memberof_graph_free_member(memberof_graph_member *member)
+{
+	slapi_ch_free_string(&member->ndn);
+	slapi_ch_free((void **)&member->parents);
+	slapi_ch_free((void **)&member);
+}
+
+static PRIntn
+memberof_graph_free_member_entry(PLHashEntry *he, PRIntn i, void *arg)
+{
+	memberof_graph_free_member((memberof_graph_member *)he->value);
+	return HT_ENUMERATE_REMOVE | HT_ENUMERATE_NEXT;
+}
+
+static void
+memberof_graph_free_members(PLHashTable *members)
+{
+	if (members) {
+		PL_HashTableEnumerateEntries(members, memberof_graph_free_member_entry, NULL);
+		PL_HashTableDestroy(members);
+	}
+}
+
+/*
+ * Everything below expects graph_lock to be held.
+ */
+
+static memberof_graph_node *
+memberof_graph_lookup(const char *ndn)
+{
+	if (NULL == graph_nodes || NULL == ndn) {
+		return NULL;
+	}
+	return (memberof_graph_node *)PL_HashTableLookup(graph_nodes, ndn);
+}
+
+static memberof_graph_node *
+memberof_graph_new_node(Slapi_DN *sdn)
+{
+	memberof_graph_node *node;
+
+	node = (memberof_graph_node *)slapi_ch_calloc(1, sizeof(memberof_graph_node));
+	node->sdn = slapi_sdn_dup(sdn);
+	node->be = slapi_be_select(sdn);
+	PL_HashTableAdd(graph_nodes, slapi_sdn_get_ndn(node->sdn), node);
+
+	return node;
+}
+
+static void
+memberof_graph_free_node(memberof_graph_node *node)
+{
+	slapi_sdn_free(&node->sdn);
+	slapi_ch_free((void **)&node->parents);
+	slapi_ch_free((void **)&node->children);
+	slapi_ch_free((void **)&node->closure);
+	slapi_ch_free((void **)&node);
+}
+
+static void
+memberof_graph_drop_node(memberof_graph_node *node)
+{
+	while (node->nparents) {
+		memberof_graph_unlink(node->parents[0], node);
+	}
+	while (node->nchildren) {
+		memberof_graph_unlink(node, node->children[0]);
+	}
+	PL_HashTableRemove(graph_nodes, slapi_sdn_get_ndn(node->sdn));
+	memberof_graph_free_node(node);
+}
+
+static void
+memberof_graph_add_ptr(memberof_graph_node ***list, int *num, int *max,
+	memberof_graph_node *node)
+{
+	if (*num == *max) {
+		*max += MEMBEROF_GRAPH_INCR_LIST;
+		*list = (memberof_graph_node **)slapi_ch_realloc((char *)*list,
+			*max * sizeof(memberof_graph_node *));
+	}
+	(*list)[(*num)++] = node;
+}
+
+static int
+memberof_graph_remove_ptr(memberof_graph_node **list, int *num,
+	memberof_graph_node *node)
+{
+	int i;
+
+	for (i = 0; i < *num; i++) {
+		if (list[i] == node) {
+			list[i] = list[--(*num)];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* returns 1 if the edge was added, 0 if it was there already */
+static int
+memberof_graph_link(memberof_graph_node *parent, memberof_graph_node *child)
+{
+	int i;
+
+	for (i = 0; i < parent->nchildren; i++) {
+		if (parent->children[i] == child) {
+			return 0;
+		}
+	}
+	memberof_graph_add_ptr(&parent->children, &parent->nchildren,
+		&parent->maxchildren, child);
+	memberof_graph_add_ptr(&child->parents, &child->nparents,
+		&child->maxparents, parent);
+	return 1;
+}
+
+/* returns 1 if the edge was removed, 0 if there was none */
+static int
+memberof_graph_unlink(memberof_graph_node *parent, memberof_graph_node *child)
+{
+	if (memberof_graph_remove_ptr(parent->children, &parent->nchildren, child)) {
+		memberof_graph_remove_ptr(child->parents, &child->nparents, parent);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Make the members of e which are groups the children of node.
+ * Returns 1 if anything changed.
+ */
+static int
+memberof_graph_reset_children(MemberOfConfig *config, memberof_graph_node *node,
+	Slapi_Entry *e)
+{
+	memberof_graph_node **old_children = node->children;
+	int nold_children = node->nchildren;
+	Slapi_DN *member_sdn = slapi_sdn_new();
+	int changed = 0;
+	int i, j;
+
+	node->children = NULL;
+	node->nchildren = node->maxchildren = 0;
+	for (i = 0; i < nold_children; i++) {
+		memberof_graph_remove_ptr(old_children[i]->parents,
+			&old_children[i]->nparents, node);
+	}
+
+	for (i = 0; config->groupattrs[i]; i++) {
+		Slapi_Attr *attr = NULL;
+		Slapi_Value *val = NULL;
+		int hint;
+
+		if (slapi_entry_attr_find(e, config->groupattrs[i], &attr)) {
+			continue;
+		}
+		for (hint = slapi_attr_first_value(attr, &val); val;
+		     hint = slapi_attr_next_value(attr, hint, &val)) {
+			memberof_graph_node *child;
+
+			/* values of DN syntax are normalized */
+			slapi_sdn_set_normdn_byref(member_sdn, slapi_value_get_string(val));
+			child = memberof_graph_lookup(slapi_sdn_get_ndn(member_sdn));
+			if (child && child != node) {
+				memberof_graph_link(node, child);
+			}
+		}
+	}
+	slapi_sdn_free(&member_sdn);
+
+	if (nold_children != node->nchildren) {
+		changed = 1;
+	} else {
+		for (i = 0; i < nold_children && !changed; i++) {
+			changed = 1;
+			for (j = 0; j < node->nchildren; j++) {
+				if (node->children[j] == old_children[i]) {
+					changed = 0;
+					break;
+				}
+			}
+		}
+	}
+	slapi_ch_free((void **)&old_children);
+
+	return changed;
+}
+
+static PRIntn
+memberof_graph_free_node_entry(PLHashEntry *he, PRIntn i, void *arg)
+{
+	memberof_graph_free_node((memberof_graph_node *)he->value);
+	return HT_ENUMERATE_REMOVE | HT_ENUMERATE_NEXT;
+}
+
+static void
+memberof_graph_free_table()
+{
+	if (graph_nodes) {
+		PL_HashTableEnumerateEntries(graph_nodes, memberof_graph_free_node_entry, NULL);
+		PL_HashTableDestroy(graph_nodes);
+		graph_nodes = NULL;
+	}
+	graph_owner = NULL;
+	graph_gen++;
+}
+
+/*
+ * Build the graph if needed.  Returns 0 if it is usable: not while
+ * another thread has changes in it which are not committed yet.
+ */
+static int
+memberof_graph_ready(MemberOfConfig *config)
+{
+	if (memberof_graph_hidden()) {
+		return -1;
+	}
+	if (graph_nodes) {
+		return 0;
+	}
+	return memberof_graph_build(config);
+}
+
+static int
+memberof_graph_build(MemberOfConfig *config)
+{
+	char *no_attrs[] = {LDAP_NO_ATTRS, NULL};
+	int rc;
+
+	if (NULL == config->groupattrs || NULL == config->group_filter) {
+		return -1;
+	}
+	memberof_graph_touch();
+	graph_nodes = PL_NewHashTable(64, PL_HashString, PL_CompareStrings,
+		PL_CompareValues, NULL, NULL);
+	if (NULL == graph_nodes) {
+		return -1;
+	}
+
+	/* first the groups, then the edges between them */
+	rc = memberof_graph_search_groups(config, no_attrs,
+		memberof_graph_add_node_callback, config);
+	if (0 == rc) {
+		rc = memberof_graph_search_groups(config, config->groupattrs,
+			memberof_graph_add_edges_callback, config);
+	}
+	if (rc) {
+		slapi_log_error(SLAPI_LOG_FATAL, MEMBEROF_PLUGIN_SUBSYSTEM,
+			"memberof_graph_build: failed to build the group graph (%d)\n", rc);
+		memberof_graph_free_table();
+		return -1;
+	}
+	graph_gen++;
+	slapi_log_error(SLAPI_LOG_PLUGIN, MEMBEROF_PLUGIN_SUBSYSTEM,
+		"memberof_graph_build: %d groups\n", graph_nodes->nentries);
+
+	return 0;
+}
+
+static int
+memberof_graph_search_base(Slapi_PBlock *search_pb, const Slapi_DN *base_sdn,
+	char *filter_str, char **attrs, plugin_search_entry_callback callback,
+	void *callback_data)
+{
+	int rc = 0;
+
+	slapi_search_internal_set_pb(search_pb, slapi_sdn_get_dn(base_sdn),
+		LDAP_SCOPE_SUBTREE, filter_str, attrs, 0, 0, 0,
+		memberof_get_plugin_id(), 0);
+	slapi_search_internal_callback_pb(search_pb, callback_data, 0, callback, 0);
+	slapi_pblock_get(search_pb, SLAPI_PLUGIN_INTOP_RESULT, &rc);
+	slapi_pblock_init(search_pb);
+	if (0 == rc && slapi_is_shutting_down()) {
+		rc = -1;
+	}
+
+	return rc;
+}
+
+/*
+ * Search every backend for the groups in the scope, as
+ * memberof_call_foreach_dn() does with all backends.
+ */
+static int
+memberof_graph_search_groups(MemberOfConfig *config, char **attrs,
+	plugin_search_entry_callback callback, void *callback_data)
+{
+	Slapi_PBlock *search_pb = slapi_pblock_new();
+	Slapi_Backend *be;
+	char *filter_str = NULL;
+	char *cookie = NULL;
+	int rc = 0;
+	int i;
+
+	for (i = 0; config->groupattrs[i]; i++) {
+		char *tmp = filter_str;
+
+		filter_str = slapi_ch_smprintf("%s(%s=*)", tmp ? tmp : "", config->groupattrs[i]);
+		slapi_ch_free_string(&tmp);
+	}
+	{
+		char *tmp = filter_str;
+
+		filter_str = slapi_ch_smprintf("(|%s)", tmp);
+		slapi_ch_free_string(&tmp);
+	}
+
+	for (be = slapi_get_first_backend(&cookie); be && 0 == rc;
+	     be = slapi_get_next_backend(cookie)) {
+		const Slapi_DN *suffix = slapi_be_getsuffix(be, 0);
+
+		if (NULL == suffix || slapi_be_private(be)) {
+			continue;
+		}
+		if (NULL == config->entryScopes ||
+		    memberof_entry_in_scope(config, (Slapi_DN *)suffix)) {
+			rc = memberof_graph_search_base(search_pb, suffix, filter_str,
+				attrs, callback, callback_data);
+			continue;
+		}
+		/* only the scopes below the suffix */
+		for (i = 0; config->entryScopes[i] && 0 == rc; i++) {
+			if (slapi_sdn_issuffix(config->entryScopes[i], suffix)) {
+				rc = memberof_graph_search_base(search_pb, config->entryScopes[i],
+					filter_str, attrs, callback, callback_data);
+			}
+		}
+	}
+
+	slapi_pblock_destroy(search_pb);
+	slapi_ch_free((void **)&cookie);
+	slapi_ch_free_string(&filter_str);
+
+	return rc;
+}
+
+static int
+memberof_graph_add_node_callback(Slapi_Entry *e, void *callback_data)
+{
+	MemberOfConfig *config = (MemberOfConfig *)callback_data;
+	Slapi_DN *sdn = slapi_entry_get_sdn(e);
+
+	if (slapi_is_shutting_down()) {
+		return -1;
+	}
+	/* nested scopes may return an entry twice */
+	if (memberof_entry_in_scope(config, sdn) &&
+	    NULL == memberof_graph_lookup(slapi_sdn_get_ndn(sdn))) {
+		memberof_graph_new_node(sdn);
+	}
+	return 0;
+}
+
+static int
+memberof_graph_add_edges_callback(Slapi_Entry *e, void *callback_data)
+{
+	MemberOfConfig *config = (MemberOfConfig *)callback_data;
+	memberof_graph_node *node;
+	Slapi_DN *member_sdn;
+	int i;
+
+	if (slapi_is_shutting_down()) {
+		return -1;
+	}
+	if (NULL == (node = memberof_graph_lookup(slapi_entry_get_ndn(e)))) {
+		return 0;
+	}
+
+	member_sdn = slapi_sdn_new();
+	for (i = 0; config->groupattrs[i]; i++) {
+		Slapi_Attr *attr = NULL;
+		Slapi_Value *val = NULL;
+		int hint;
+
+		if (slapi_entry_attr_find(e, config->groupattrs[i], &attr)) {
+			continue;
+		}
+		for (hint = slapi_attr_first_value(attr, &val); val;
+		     hint = slapi_attr_next_value(attr, hint, &val)) {
+			memberof_graph_node *child;
+
+			slapi_sdn_set_normdn_byref(member_sdn, slapi_value_get_string(val));
+			child = memberof_graph_lookup(slapi_sdn_get_ndn(member_sdn));
+			if (child && child != node) {
+				memberof_graph_link(node, child);
+			}
+		}
+	}
+	slapi_sdn_free(&member_sdn);
+
+	return 0;
+}
+
+static int
+memberof_graph_add_parent_callback(Slapi_Entry *e, void *callback_data)
+{
+	memberof_graph_node *node = (memberof_graph_node *)callback_data;
+	memberof_graph_node *parent = memberof_graph_lookup(slapi_entry_get_ndn(e));
+
+	if (parent && parent != node) {
+		memberof_graph_link(parent, node);
+	}
+	return 0;
+}
+
+/*
+ * A group of the snapshot: add it, and take the parents it got while it
+ * was only known as a member.  Its members which are not groups yet are
+ * recorded with their parents, and linked if they turn out to be groups.
+ */
+static int
+memberof_graph_snapshot_callback(Slapi_Entry *e, void *callback_data)
+{
+	memberof_graph_snapshot_data *data = (memberof_graph_snapshot_data *)callback_data;
+	MemberOfConfig *config = data->config;
+	Slapi_DN *sdn = slapi_entry_get_sdn(e);
+	memberof_graph_member *member;
+	memberof_graph_node *node;
+	Slapi_DN *member_sdn;
+	int i;
+
+	if (slapi_is_shutting_down()) {
+		return -1;
+	}
+	/* nested scopes may return an entry twice */
+	if (!memberof_entry_in_scope(config, sdn) ||
+	    memberof_graph_lookup(slapi_sdn_get_ndn(sdn))) {
+		return 0;
+	}
+	node = memberof_graph_new_node(sdn);
+	if ((member = (memberof_graph_member *)PL_HashTableLookup(data->members,
+	                                                          slapi_sdn_get_ndn(sdn)))) {
+		PL_HashTableRemove(data->members, member->ndn);
+		for (i = 0; i < member->nparents; i++) {
+			memberof_graph_link(member->parents[i], node);
+		}
+		memberof_graph_free_member(member);
+	}
+
+	member_sdn = slapi_sdn_new();
+	for (i = 0; config->groupattrs[i]; i++) {
+		Slapi_Attr *attr = NULL;
+		Slapi_Value *val = NULL;
+		int hint;
+
+		if (slapi_entry_attr_find(e, config->groupattrs[i], &attr)) {
+			continue;
+		}
+		for (hint = slapi_attr_first_value(attr, &val); val;
+		     hint = slapi_attr_next_value(attr, hint, &val)) {
+			memberof_graph_node *child;
+			const char *ndn;
+
+			slapi_sdn_set_normdn_byref(member_sdn, slapi_value_get_string(val));
+			ndn = slapi_sdn_get_ndn(member_sdn);
+			if ((child = memberof_graph_lookup(ndn))) {
+				if (child != node) {
+					memberof_graph_link(node, child);
+				}
+				continue;
+			}
+			if (NULL == (member = (memberof_graph_member *)PL_HashTableLookup(data->members, ndn))) {
+				member = (memberof_graph_member *)slapi_ch_calloc(1, sizeof(memberof_graph_member));
+				member->ndn = slapi_ch_strdup(ndn);
+				PL_HashTableAdd(data->members, member->ndn, member);
+			}
+			/* listed by another grouping attribute of the same group */
+			if (member->nparents && member->parents[member->nparents - 1] == node) {
+				continue;
+			}
+			memberof_graph_add_ptr(&member->parents, &member->nparents,
+				&member->maxparents, node);
+		}
+	}
+	slapi_sdn_free(&member_sdn);
+
+	return 0;
+}
+
+static PRIntn
+memberof_graph_snapshot_prepare(PLHashEntry *he, PRIntn i, void *arg)
+{
+	memberof_graph_snapshot_data *data = (memberof_graph_snapshot_data *)arg;
+	memberof_graph_node *node = (memberof_graph_node *)he->value;
+
+	node->index = data->nnodes++;
+	memberof_graph_compute_closure(data->config, node);
+	return HT_ENUMERATE_NEXT;
+}
+
+/*
+ * Walk up from node and cache the groups found.  Without all backends, a
+ * group only gets the parents from its own backend, as the internal
+ * searches would.
+ */
+static void
+memberof_graph_compute_closure(MemberOfConfig *config, memberof_graph_node *node)
+{
+	memberof_graph_node **stack = NULL;
+	int nstack = 0;
+	int maxstack = 0;
+	int maxclosure = 0;
+	PRUint32 mark = memberof_graph_next_mark();
+	int i;
+
+	slapi_ch_free((void **)&node->closure);
+	node->nclosure = 0;
+	node->mark = mark;
+	memberof_graph_add_ptr(&stack, &nstack, &maxstack, node);
+	while (nstack) {
+		memberof_graph_node *cur = stack[--nstack];
+
+		for (i = 0; i < cur->nparents; i++) {
+			memberof_graph_node *parent = cur->parents[i];
+
+			if (parent->mark == mark ||
+			    (!config->allBackends && parent->be != cur->be)) {
+				continue;
+			}
+			parent->mark = mark;
+			memberof_graph_add_ptr(&node->closure, &node->nclosure, &maxclosure, parent);
+			memberof_graph_add_ptr(&stack, &nstack, &maxstack, parent);
+		}
+	}
+	slapi_ch_free((void **)&stack);
+	node->closure_gen = graph_gen;
+}
+
+static PRUint32
+memberof_graph_next_mark()
+{
+	if (0 == ++graph_mark) {
+		/* the nodes start with 0 */
+		++graph_mark;
+	}
+	return graph_mark;
+}
+
+/* graph_lock must be held */
+static void
+memberof_graph_touch()
+{
+	PR_SetThreadPrivate(graph_touched_index, (void *)1);
+	if (graph_usetxn) {
+		graph_owner = PR_GetCurrentThread();
+	}
+}
+
+static int
+memberof_graph_hidden()
+{
+	return graph_owner && graph_owner != PR_GetCurrentThread();
+}
+
+/* graph_lock must be held */
+static void
+memberof_graph_claim()
+{
+	if (memberof_graph_hidden()) {
+		slapi_log_error(SLAPI_LOG_PLUGIN, MEMBEROF_PLUGIN_SUBSYSTEM,
+			"memberof_graph_claim: the group graph has changes of another "
+			"transaction, dropping it\n");
+		memberof_graph_free_table();
+	}
+}
+
+static void
+memberof_graph_be_state_change(void *handle, char *be_name, int old_be_state,
+	int new_be_state)
+{
+	/* e.g. an import replaced the content of the backend */
+	memberof_graph_invalidate();
+}
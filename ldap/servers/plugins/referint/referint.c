@@ -30,6 +30,12 @@
 #define REFERINT_ATTR_LOGCHANGES "referint-logchanges"
 #define REFERINT_ATTR_LOGFILE "referint-logfile"
 #define REFERINT_ATTR_MEMBERSHIP "referint-membership-attr"
+#define REFERINT_ATTR_BATCHSIZE "referint-batch-size"
+#define REFERINT_DEFAULT_BATCHSIZE 500
+#define REFERINT_WORKFILE_SUFFIX ".work"
+#define REFERINT_FILTER_DNS 32   /* deleted DNs per search filter */
+#define REFERINT_MAX_MODS 128    /* changed values per modify */
+#define REFERINT_BACKLOG_WARN 10 /* batches waiting before a warning */
 #define MAX_LINE 2048
 #define READ_BUFSIZE  4096
 #define MY_EOF   0 
@@ -39,6 +45,7 @@ typedef struct referint_config {
     int delay;
     char *logfile;
     int logchanges;
+    int batchsize;
     char **attrs;
 } referint_config;
 
@@ -54,15 +61,17 @@ int update_integrity(Slapi_DN *sDN, char *newrDN, Slapi_DN *newsuperior, int log
 int GetNextLine(char *dest, int size_dest, PRFileDesc *stream);
 int my_fgetc(PRFileDesc *stream);
 void referint_thread_func(void *arg);
-void writeintegritylog(Slapi_PBlock *pb, char *logfilename, Slapi_DN *sdn, char *newrdn, Slapi_DN *newsuperior, Slapi_DN *requestorsdn);
+int writeintegritylog(Slapi_PBlock *pb, char *logfilename, Slapi_DN *sdn, char *newrdn, Slapi_DN *newsuperior, Slapi_DN *requestorsdn);
 int load_config(Slapi_PBlock *pb, Slapi_Entry *config_entry, int apply);
 int referint_get_delay();
 int referint_get_logchanges();
+int referint_get_batchsize();
 char *referint_get_logfile();
 char **referint_get_attrs();
 int referint_postop_modify(Slapi_PBlock *pb);
 int referint_validate_config(Slapi_PBlock *pb);
 static int referint_preop_init(Slapi_PBlock *pb);
+static void referint_queued();
 void referint_set_config_area(Slapi_DN *dn);
 Slapi_DN *referint_get_config_area();
 void referint_set_plugin_area(Slapi_DN *sdn);
@@ -76,6 +85,23 @@ static PRThread		*referint_tid = NULL;
 static PRLock 		*keeprunning_mutex = NULL;
 static PRCondVar    *keeprunning_cv = NULL;
 static int keeprunning = 0;
+/*
+ * Backpressure counters of the delayed updates, under keeprunning_mutex.
+ * pending records are in the integrity log, inflight ones in the work
+ * file being replayed.
+ */
+static struct referint_stats {
+    PRUint64 queued;    /* records written to the integrity log */
+    PRUint64 coalesced; /* records folded into other updates */
+    PRUint64 applied;   /* entries updated */
+    PRUint64 failed;    /* entries which could not be updated */
+    PRUint64 batches;
+    int pending;
+    int inflight;
+    int highwater;      /* largest backlog seen */
+    int warned;
+} referint_stats;
+
 static referint_config *config = NULL;
 static Slapi_DN* _ConfigAreaDN = NULL;
 static Slapi_DN* _pluginDN = NULL;
@@ -90,12 +116,14 @@ static int use_txn = 0;
 static int premodfn = SLAPI_PLUGIN_PRE_MODIFY_FN;
 
 
+/*
+ * Protects the integrity log file.  The worker only holds it to take the
+ * file over, never while applying the updates, so it is safe with betxn
+ * too.
+ */
 static void
 referint_lock()
 {
-    if (use_txn) { /* no lock if betxn is enabled */
-        return;
-    }
     if (NULL == referint_mutex) {
         referint_mutex = PR_NewLock();
     }
@@ -107,14 +135,23 @@ referint_lock()
 static void
 referint_unlock()
 {
-    if (use_txn) { /* no lock if betxn is enabled */
-        return;
-    }
     if (referint_mutex) {
         PR_Unlock(referint_mutex);
     }
 }
 
+static int
+referint_keeprunning()
+{
+    int running;
+
+    PR_Lock(keeprunning_mutex);
+    running = keeprunning;
+    PR_Unlock(keeprunning_mutex);
+
+    return running;
+}
+
 void
 referint_set_config_area(Slapi_DN *dn)
 {
@@ -314,6 +351,18 @@ load_config(Slapi_PBlock *pb, Slapi_Entry *config_entry, int apply)
         /* set these to -1 for config validation */
         tmp_config->delay = -1;
         tmp_config->logchanges = -1;
+        tmp_config->batchsize = REFERINT_DEFAULT_BATCHSIZE;
+    }
+
+    /* optional with either configuration style */
+    if((value = slapi_entry_attr_get_charptr(config_entry, REFERINT_ATTR_BATCHSIZE))){
+        tmp_config->batchsize = atoi(value);
+        slapi_ch_free_string(&value);
+        if(tmp_config->batchsize <= 0){
+            slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM, "Plugin configuration has an invalid %s\n",
+                             REFERINT_ATTR_BATCHSIZE);
+            rc = SLAPI_PLUGIN_FAILURE;
+        }
     }
 
     if((value = slapi_entry_attr_get_charptr(config_entry, REFERINT_ATTR_DELAY))){
@@ -499,6 +548,18 @@ referint_get_delay()
     return delay;
 }
 
+int
+referint_get_batchsize()
+{
+    int batchsize;
+
+    slapi_rwlock_rdlock(config_rwlock);
+    batchsize = config->batchsize;
+    slapi_rwlock_unlock(config_rwlock);
+
+    return batchsize;
+}
+
 int
 referint_get_logchanges()
 {
@@ -642,7 +703,9 @@ referint_postop_del( Slapi_PBlock *pb )
     } else {
         /* write the entry to integrity log */
         logfile = referint_get_logfile();
-        writeintegritylog(pb, logfile, sdn, NULL, NULL, NULL /* slapi_get_requestor_sdn(pb) */);
+        if (writeintegritylog(pb, logfile, sdn, NULL, NULL, NULL /* slapi_get_requestor_sdn(pb) */) == 0) {
+            referint_queued();
+        }
         rc = SLAPI_PLUGIN_SUCCESS;
     }
 
@@ -710,7 +773,9 @@ referint_postop_modrdn( Slapi_PBlock *pb )
     } else {
         /* write the entry to integrity log */
         logfile = referint_get_logfile();
-        writeintegritylog(pb, logfile, sdn, newrdn, newsuperior, NULL /* slapi_get_requestor_sdn(pb) */);
+        if (writeintegritylog(pb, logfile, sdn, newrdn, newsuperior, NULL /* slapi_get_requestor_sdn(pb) */) == 0) {
+            referint_queued();
+        }
         rc = SLAPI_PLUGIN_SUCCESS;
     }
     slapi_ch_free_string(&logfile);
@@ -755,502 +820,600 @@ _do_modify(Slapi_PBlock *mod_pb, Slapi_DN *entrySDN, LDAPMod **mods)
 }
 
 /*
- * update one attribute value per _do_modify
+ * One delete or rename to propagate.  newndn is the DN the entry was
+ * renamed to, NULL for a delete.
  */
-static int
-_update_one_per_mod(Slapi_DN *entrySDN,      /* DN of the searched entry */
-                    Slapi_Attr *attr,        /* referred attribute */
-                    char *attrName,
-                    Slapi_DN *origDN,        /* original DN that was modified */
-                    char *newRDN,            /* new RDN from modrdn */
-                    const char *newsuperior, /* new superior from modrdn */
-                    Slapi_PBlock *mod_pb)
+typedef struct referint_update {
+    char *ndn;
+    char *newndn;
+    char *requestor;        /* bind DN of the operation, or NULL */
+    struct referint_update *next;
+} referint_update;
+
+/*
+ * The updates read from the integrity log, in log order.  Repeated
+ * deletes or renames of a DN are coalesced as the records are added.
+ */
+typedef struct referint_batch {
+    referint_update *head;
+    referint_update *tail;
+    PLHashTable *by_ndn;    /* ndn -> last update of that DN */
+    PLHashTable *by_newndn; /* newndn -> last rename to that DN */
+    int nrecords;           /* log records read */
+    int nupdates;           /* updates left after coalescing */
+} referint_batch;
+
+/* an entry referring to some of the updated DNs */
+typedef struct referint_target {
+    Slapi_Entry *e;
+    struct referint_target *next;
+} referint_target;
+
+static char *
+referint_new_ndn(const char *ndn, const char *newrdn, const char *newsuperior)
 {
-    LDAPMod attribute1, attribute2;
-    LDAPMod *list_of_mods[3];
-    char *values_del[2];
-    char *values_add[2];
-    char *newDN = NULL;
-    char **dnParts = NULL;
-    char *sval = NULL;
-    char *newvalue = NULL;
-    char *p = NULL;
-    size_t dnlen = 0;
-    int rc = 0;
+    const char *superior = newsuperior;
+    char *newndn = NULL;
 
-    if (NULL == newRDN && NULL == newsuperior) {
-        /* in delete mode */
-        /* delete old dn so set that up */
-        values_del[0] = (char *)slapi_sdn_get_dn(origDN);
-        values_del[1] = NULL;
-        attribute1.mod_type = attrName;
-        attribute1.mod_op = LDAP_MOD_DELETE;
-        attribute1.mod_values = values_del;
-        list_of_mods[0] = &attribute1;
-        /* terminate list of mods. */
-        list_of_mods[1] = NULL;
-        rc = _do_modify(mod_pb, entrySDN, list_of_mods);
-        if (rc) {
-            slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                "_update_one_value: entry %s: deleting \"%s: %s\" failed (%d)"
-                "\n", slapi_sdn_get_dn(entrySDN), attrName, slapi_sdn_get_dn(origDN), rc);
-        }
+    if (NULL == superior) {
+        /* do not free superior */
+        superior = slapi_dn_find_parent(ndn);
+    }
+    /* newrdn and superior are already normalized. */
+    if (superior && *superior) {
+        newndn = slapi_ch_smprintf("%s,%s", newrdn, superior);
     } else {
-        /* in modrdn mode */
-        const char *superior = NULL;
-        int nval = 0;
-        Slapi_Value *v = NULL;
+        newndn = slapi_ch_strdup(newrdn);
+    }
+    slapi_dn_ignore_case(newndn);
 
-        if (NULL == origDN) {
-            slapi_log_error(SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                            "_update_one_value: NULL dn was passed\n");
-            goto bail;
-        }
-        /* need to put together rdn into a dn */
-        dnParts = slapi_ldap_explode_dn( slapi_sdn_get_dn(origDN), 0 );
+    return newndn;
+}
+
+static referint_update *
+referint_update_new(const char *dn, const char *newrdn, const char *newsuperior,
+                    const char *requestor)
+{
+    referint_update *u = NULL;
+    char **dnParts = NULL;
+
+    if (NULL == dn) {
+        slapi_log_error(SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
+                        "referint_update_new: NULL dn was passed\n");
+        return NULL;
+    }
+    if (NULL == newrdn && newsuperior) {
+        /* a move keeping the rdn */
+        dnParts = slapi_ldap_explode_dn(dn, 0);
         if (NULL == dnParts) {
             slapi_log_error(SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                            "_update_one_value: failed to explode dn %s\n",
-                            slapi_sdn_get_dn(origDN));
-            goto bail;
+                            "referint_update_new: failed to explode dn %s\n", dn);
+            return NULL;
         }
-        if (NULL == newRDN) {
-            newRDN = dnParts[0];
+        newrdn = dnParts[0];
+    }
+
+    u = (referint_update *)slapi_ch_calloc(1, sizeof(referint_update));
+    u->ndn = slapi_ch_strdup(dn);
+    slapi_dn_ignore_case(u->ndn);
+    if (newrdn) {
+        u->newndn = referint_new_ndn(u->ndn, newrdn, newsuperior);
+    }
+    u->requestor = slapi_ch_strdup(requestor);
+
+    if (dnParts) {
+        slapi_ldap_value_free(dnParts);
+    }
+    return u;
+}
+
+static void
+referint_update_free(referint_update **u)
+{
+    if (u && *u) {
+        slapi_ch_free_string(&(*u)->ndn);
+        slapi_ch_free_string(&(*u)->newndn);
+        slapi_ch_free_string(&(*u)->requestor);
+        slapi_ch_free((void **)u);
+    }
+}
+
+static int
+referint_update_same(referint_update *a, referint_update *b)
+{
+    if (a->newndn == NULL || b->newndn == NULL) {
+        return (a->newndn == b->newndn);
+    }
+    return (strcmp(a->newndn, b->newndn) == 0);
+}
+
+static int
+referint_same_requestor(referint_update *a, referint_update *b)
+{
+    if (a->requestor == NULL || b->requestor == NULL) {
+        return (a->requestor == b->requestor);
+    }
+    return (strcasecmp(a->requestor, b->requestor) == 0);
+}
+
+static referint_batch *
+referint_batch_new()
+{
+    referint_batch *batch = (referint_batch *)slapi_ch_calloc(1, sizeof(referint_batch));
+
+    batch->by_ndn = PL_NewHashTable(64, PL_HashString, PL_CompareStrings,
+                                    PL_CompareValues, NULL, NULL);
+    batch->by_newndn = PL_NewHashTable(64, PL_HashString, PL_CompareStrings,
+                                       PL_CompareValues, NULL, NULL);
+    return batch;
+}
+
+static void
+referint_batch_free(referint_batch **batch)
+{
+    referint_update *u, *next;
+
+    if (batch == NULL || *batch == NULL) {
+        return;
+    }
+    /* the tables do not own their keys */
+    PL_HashTableDestroy((*batch)->by_ndn);
+    PL_HashTableDestroy((*batch)->by_newndn);
+    for (u = (*batch)->head; u; u = next) {
+        next = u->next;
+        referint_update_free(&u);
+    }
+    slapi_ch_free((void **)batch);
+}
+
+/*
+ * Append u to the batch, coalescing it with the updates already there:
+ *
+ * - a DN deleted, or renamed to the same DN, again is dropped;
+ * - when an earlier update renamed X to the DN u deletes or renames, that
+ *   update now takes X straight to the final DN, so the entries referring
+ *   to X are modified once.  u is still kept for the references added to
+ *   the intermediate DN meanwhile.
+ */
+static void
+referint_batch_add(referint_batch *batch, referint_update *u)
+{
+    referint_update *last = NULL;
+    referint_update *prev = NULL;
+
+    batch->nrecords++;
+
+    last = (referint_update *)PL_HashTableLookup(batch->by_ndn, u->ndn);
+    if (last && referint_update_same(last, u)) {
+        referint_update_free(&u);
+        return;
+    }
+
+    prev = (referint_update *)PL_HashTableLookup(batch->by_newndn, u->ndn);
+    if (prev && prev == PL_HashTableLookup(batch->by_ndn, prev->ndn)) {
+        PL_HashTableRemove(batch->by_newndn, prev->newndn);
+        slapi_ch_free_string(&prev->newndn);
+        if (u->newndn && strcmp(u->newndn, prev->ndn)) {
+            prev->newndn = slapi_ch_strdup(u->newndn);
+            PL_HashTableAdd(batch->by_newndn, prev->newndn, prev);
+        } else if (u->newndn) {
+            /* renamed back: nothing left to do for X */
+            prev->newndn = slapi_ch_strdup(prev->ndn);
         }
-        if (newsuperior) {
-            superior = newsuperior;
+    }
+
+    if (batch->tail) {
+        batch->tail->next = u;
+    } else {
+        batch->head = u;
+    }
+    batch->tail = u;
+    batch->nupdates++;
+    /* the tables keep pointing to keys owned by the updates they map to */
+    PL_HashTableRemove(batch->by_ndn, u->ndn);
+    PL_HashTableAdd(batch->by_ndn, u->ndn, u);
+    if (u->newndn) {
+        PL_HashTableRemove(batch->by_newndn, u->newndn);
+        PL_HashTableAdd(batch->by_newndn, u->newndn, u);
+    }
+}
+
+/*
+ * Append to filter the components matching dn in any of the membership
+ * attributes, or any DN below it when subtree is set.
+ */
+static char *
+referint_filter_add(char *filter, char **attrs, const char *dn, int subtree)
+{
+    char *component = NULL;
+    char *tmp = NULL;
+    int i;
+
+    for (i = 0; attrs[i] != NULL; i++) {
+        if (subtree) {
+            /* we need to check the children of the old dn, so use a wildcard */
+            component = slapi_filter_sprintf("(%s=*%s%s)", attrs[i], ESC_NEXT_VAL, dn);
         } else {
-            /* do not free superior */
-            superior = slapi_dn_find_parent(slapi_sdn_get_dn(origDN));
+            component = slapi_filter_sprintf("(%s=%s%s)", attrs[i], ESC_NEXT_VAL, dn);
         }
-        /* newRDN and superior are already normalized. */
-        newDN = slapi_ch_smprintf("%s,%s", newRDN, superior);
-        slapi_dn_ignore_case(newDN);
-        /* 
-         * Compare the modified dn with the value of 
-         * the target attribute of referint to find out
-         * the modified dn is the ancestor (case 2) or
-         * the value itself (case 1).
-         *
-         * E.g., 
-         * (case 1) 
-         * modrdn: uid=A,ou=B,o=C --> uid=A',ou=B',o=C
-         *            (origDN)             (newDN)
-         * member: uid=A,ou=B,ou=C --> uid=A',ou=B',ou=C
-         *            (sval)               (newDN)
-         *
-         * (case 2) 
-         * modrdn: ou=B,o=C --> ou=B',o=C
-         *         (origDN)      (newDN)
-         * member: uid=A,ou=B,ou=C --> uid=A,ou=B',ou=C
-         *         (sval)              (sval' + newDN)
-         */
-        for (nval = slapi_attr_first_value(attr, &v); nval != -1;
-             nval = slapi_attr_next_value(attr, nval, &v)) {
-            p = NULL;
-            dnlen = 0;
+        if (component) {
+            tmp = slapi_ch_smprintf("%s%s", filter ? filter : "", component);
+            slapi_ch_free_string(&filter);
+            slapi_ch_free_string(&component);
+            filter = tmp;
+        }
+    }
 
-            /* DN syntax, which should be a string */
-            sval = slapi_ch_strdup(slapi_value_get_string(v));
-            rc = slapi_dn_normalize_case_ext(sval, 0,  &p, &dnlen);
-            if (rc == 0) { /* sval is passed in; not terminated */
-                *(p + dnlen) = '\0';
-                sval = p;
-            } else if (rc > 0) {
-                slapi_ch_free_string(&sval);
-                sval = p;
-            }
-            /* else: (rc < 0) Ignore the DN normalization error for now. */
-
-            p = PL_strstr(sval, slapi_sdn_get_ndn(origDN));
-            if (p == sval) {
-                /* (case 1) */
-                values_del[0] = sval;
-                values_del[1] = NULL;
-                attribute1.mod_type = attrName;
-                attribute1.mod_op = LDAP_MOD_DELETE;
-                attribute1.mod_values = values_del;
-                list_of_mods[0] = &attribute1;
-
-                values_add[0] = newDN;
-                values_add[1] = NULL;
-                attribute2.mod_type = attrName;
-                attribute2.mod_op = LDAP_MOD_ADD;
-                attribute2.mod_values = values_add;
-                list_of_mods[1] = &attribute2;
-                list_of_mods[2] = NULL;
-                rc = _do_modify(mod_pb, entrySDN, list_of_mods);
-                if (rc) {
-                    slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                        "_update_one_value: entry %s: replacing \"%s: %s\" "
-                        "with \"%s: %s\" failed (%d)\n",
-                        slapi_sdn_get_dn(entrySDN), attrName, 
-                        slapi_sdn_get_dn(origDN), attrName, newDN, rc);
+    return filter;
+}
+
+/*
+ * Search each namingContext in turn, or the defined scope, for the
+ * entries matching the OR of the filter components, and append those
+ * not seen yet to the targets.
+ */
+static int
+referint_find_targets(const char *components, char **attrs, PLHashTable *seen,
+                      referint_target **targets, referint_target **tail)
+{
+    Slapi_PBlock *search_result_pb = NULL;
+    Slapi_Entry **search_entries = NULL;
+    Slapi_DN *sdn = NULL;
+    referint_target *t = NULL;
+    void *node = NULL;
+    const char *search_base = NULL;
+    char *filter = NULL;
+    int search_result;
+    int j;
+    int rc = SLAPI_PLUGIN_SUCCESS;
+
+    filter = slapi_ch_smprintf("(|%s)", components);
+    search_result_pb = slapi_pblock_new();
+
+    if (plugin_ContainerScope) {
+        sdn = plugin_ContainerScope;
+    } else {
+        sdn = slapi_get_first_suffix( &node, 0 );
+    }
+    while (sdn)
+    {
+        Slapi_Backend *be = slapi_be_select(sdn);
+        search_base = slapi_sdn_get_dn( sdn );
+
+        /* Need only the membership attributes and their subtypes */
+        slapi_pblock_init(search_result_pb);
+        slapi_pblock_set(search_result_pb, SLAPI_BACKEND, be);
+        slapi_search_internal_set_pb(search_result_pb, search_base,
+            LDAP_SCOPE_SUBTREE, filter, attrs, 0 /* attrs only */,
+            NULL, NULL, referint_plugin_identity, 0);
+        slapi_search_internal_pb(search_result_pb);
+
+        slapi_pblock_get( search_result_pb, SLAPI_PLUGIN_INTOP_RESULT, &search_result);
+        if (search_result == LDAP_SUCCESS) {
+            slapi_pblock_get(search_result_pb, SLAPI_PLUGIN_INTOP_SEARCH_ENTRIES,
+                             &search_entries);
+            for (j = 0; search_entries && search_entries[j] != NULL; j++) {
+                if (PL_HashTableLookup(seen, slapi_entry_get_ndn(search_entries[j]))) {
+                    continue;
                 }
-            } else if (p) {
-                char bak;
-                /* (case 2) */
-                values_del[0] = sval;
-                values_del[1] = NULL;
-                attribute1.mod_type = attrName;
-                attribute1.mod_op = LDAP_MOD_DELETE;
-                attribute1.mod_values = values_del;
-                list_of_mods[0] = &attribute1;
-
-                bak = *p;
-                *p = '\0';
-                /* newRDN and superior are already normalized. */
-                newvalue = slapi_ch_smprintf("%s%s", sval, newDN);
-                *p = bak;
-                values_add[0]=newvalue;
-                values_add[1]=NULL;
-                attribute2.mod_type = attrName;
-                attribute2.mod_op = LDAP_MOD_ADD;
-                attribute2.mod_values = values_add;
-                list_of_mods[1] = &attribute2;
-                list_of_mods[2] = NULL;
-                rc = _do_modify(mod_pb, entrySDN, list_of_mods);
-                if (rc) {
-                    slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                        "_update_one_value: entry %s: replacing \"%s: %s\" "
-                        "with \"%s: %s\" failed (%d)\n",
-                        slapi_sdn_get_dn(entrySDN), attrName, sval, attrName, newvalue, rc);
+                t = (referint_target *)slapi_ch_calloc(1, sizeof(referint_target));
+                t->e = slapi_entry_dup(search_entries[j]);
+                PL_HashTableAdd(seen, slapi_entry_get_ndn(t->e), t);
+                if (*tail) {
+                    (*tail)->next = t;
+                } else {
+                    *targets = t;
                 }
-                slapi_ch_free_string(&newvalue);
-            } 
-            /* else: value does not include the modified DN.  Ignore it. */
-            slapi_ch_free_string(&sval);
+                *tail = t;
+            }
+        } else if (isFatalSearchError(search_result)) {
+            slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
+                "update_integrity search (base=%s filter=%s) returned "
+                "error %d\n", search_base, filter, search_result);
+            rc = SLAPI_PLUGIN_FAILURE;
+            break;
         }
+        slapi_free_search_results_internal(search_result_pb);
 
-        /* cleanup memory allocated for dnParts and newDN */
-        if (dnParts){
-            slapi_ldap_value_free(dnParts);
-            dnParts = NULL;
+        if (plugin_ContainerScope) {
+            /* at the moment only a single scope is supported
+             * so the loop ends after the first iteration
+             */
+            sdn = NULL;
+        } else {
+            sdn = slapi_get_next_suffix( &node, 0 );
         }
-        slapi_ch_free_string(&newDN);
     }
-bail:
+
+    slapi_free_search_results_internal(search_result_pb);
+    slapi_pblock_destroy(search_result_pb);
+    slapi_ch_free_string(&filter);
+
     return rc;
 }
 
 /*
- * update multiple attribute values per _do_modify
+ * Update the membership values of e, for the deleted DNs or for the
+ * rename u.  All the changes go in one modify, unless an entry holds
+ * 1000s of the values (e.g., a big static group): we want to avoid
+ * allocating too many mods in one "modify" call, so they are split every
+ * REFERINT_MAX_MODS values.
  */
 static int
-_update_all_per_mod(Slapi_DN *entrySDN,      /* DN of the searched entry */
-                    Slapi_Attr *attr,        /* referred attribute */
-                    char *attrName,
-                    Slapi_DN *origDN,        /* original DN that was modified */
-                    char *newRDN,            /* new RDN from modrdn */
-                    const char *newsuperior, /* new superior from modrdn */
-                    Slapi_PBlock *mod_pb)
+referint_update_entry(Slapi_Entry *e, char **attrs, PLHashTable *deleted,
+                      referint_update *u, Slapi_PBlock *mod_pb)
 {
-    Slapi_Mods *smods = NULL;
-    char *newDN = NULL;
-    char **dnParts = NULL;
+    Slapi_Mods *smods = slapi_mods_new();
+    Slapi_Attr *attr = NULL;
+    Slapi_Value *v = NULL;
+    char *attrName = NULL;
     char *sval = NULL;
     char *newvalue = NULL;
     char *p = NULL;
     size_t dnlen = 0;
+    size_t ndnlen = u ? strlen(u->ndn) : 0;
+    size_t len;
+    int nval;
+    int nrc;
     int rc = 0;
-    int nval = 0;
-
-    slapi_attr_get_numvalues(attr, &nval);
-
-    if (NULL == newRDN && NULL == newsuperior) {
-        /* in delete mode */
-        LDAPMod *mods[2];
-        char *values_del[2];
-        LDAPMod attribute1;
-
-        /* delete old dn so set that up */
-        values_del[0] = (char *)slapi_sdn_get_dn(origDN);
-        values_del[1] = NULL;
-        attribute1.mod_type = attrName;
-        attribute1.mod_op = LDAP_MOD_DELETE;
-        attribute1.mod_values = values_del;
-        mods[0] = &attribute1;
-        /* terminate list of mods. */
-        mods[1] = NULL;
-        rc = _do_modify(mod_pb, entrySDN, mods);
-        if (rc) {
-            slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                "_update_all_per_mod: entry %s: deleting \"%s: %s\" failed (%d)"
-                "\n", slapi_sdn_get_dn(entrySDN), attrName, slapi_sdn_get_dn(origDN), rc);
-        }
-    } else {
-        /* in modrdn mode */
-        const char *superior = NULL;
-        int nval = 0;
-        Slapi_Value *v = NULL;
+    int i;
 
-        if (NULL == origDN) {
-            slapi_log_error(SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                            "_update_all_per_mod: NULL dn was passed\n");
-            goto bail;
-        }
-        /* need to put together rdn into a dn */
-        dnParts = slapi_ldap_explode_dn( slapi_sdn_get_dn(origDN), 0 );
-        if (NULL == dnParts) {
-            slapi_log_error(SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                            "_update_all_per_mod: failed to explode dn %s\n",
-                            slapi_sdn_get_dn(origDN));
-            goto bail;
-        }
-        if (NULL == newRDN) {
-            newRDN = dnParts[0];
+    for (slapi_entry_first_attr(e, &attr); attr && rc == 0;
+         slapi_entry_next_attr(e, attr, &attr))
+    {
+        /*
+         *  Take into account only the membership attributes
+         *  and their subtypes
+         */
+        slapi_attr_get_type(attr, &attrName);
+        for (i = 0; attrs[i] != NULL; i++) {
+            if (slapi_attr_type_cmp(attrs[i], attrName, SLAPI_TYPE_CMP_SUBTYPE) == 0) {
+                break;
+            }
         }
-        if (newsuperior) {
-            superior = newsuperior;
-        } else {
-            /* do not free superior */
-            superior = slapi_dn_find_parent(slapi_sdn_get_dn(origDN));
+        if (attrs[i] == NULL) {
+            continue;
         }
-        /* newRDN and superior are already normalized. */
-        newDN = slapi_ch_smprintf("%s,%s", newRDN, superior);
-        slapi_dn_ignore_case(newDN);
-        /* 
-         * Compare the modified dn with the value of 
-         * the target attribute of referint to find out
-         * the modified dn is the ancestor (case 2) or
-         * the value itself (case 1).
-         *
-         * E.g., 
-         * (case 1) 
-         * modrdn: uid=A,ou=B,o=C --> uid=A',ou=B',o=C
-         *            (origDN)             (newDN)
-         * member: uid=A,ou=B,ou=C --> uid=A',ou=B',ou=C
-         *            (sval)               (newDN)
-         *
-         * (case 2) 
-         * modrdn: ou=B,o=C --> ou=B',o=C
-         *         (origDN)      (newDN)
-         * member: uid=A,ou=B,ou=C --> uid=A,ou=B',ou=C
-         *         (sval)              (sval' + newDN)
-         */
-        slapi_attr_get_numvalues(attr, &nval);
-        smods = slapi_mods_new();
-        slapi_mods_init(smods, 2 * nval + 1);
 
-        for (nval = slapi_attr_first_value(attr, &v);
-             nval != -1;
+        for (nval = slapi_attr_first_value(attr, &v); nval != -1 && rc == 0;
              nval = slapi_attr_next_value(attr, nval, &v)) {
             p = NULL;
             dnlen = 0;
 
             /* DN syntax, which should be a string */
             sval = slapi_ch_strdup(slapi_value_get_string(v));
-            rc = slapi_dn_normalize_case_ext(sval, 0,  &p, &dnlen);
-            if (rc == 0) { /* sval is passed in; not terminated */
+            nrc = slapi_dn_normalize_case_ext(sval, 0,  &p, &dnlen);
+            if (nrc == 0) { /* sval is passed in; not terminated */
                 *(p + dnlen) = '\0';
                 sval = p;
-            } else if (rc > 0) {
+            } else if (nrc > 0) {
                 slapi_ch_free_string(&sval);
                 sval = p;
             }
-            /* else: (rc < 0) Ignore the DN normalization error for now. */
-
-            p = PL_strstr(sval, slapi_sdn_get_ndn(origDN));
-            if (p == sval) {
-                /* (case 1) */
-                slapi_mods_add_string(smods, LDAP_MOD_DELETE, attrName, sval);
-                slapi_mods_add_string(smods, LDAP_MOD_ADD, attrName, newDN);
-
-            } else if (p) {
-                /* (case 2) */
-                slapi_mods_add_string(smods, LDAP_MOD_DELETE, attrName, sval);
-                *p = '\0';
-                newvalue = slapi_ch_smprintf("%s%s", sval, newDN);
-                slapi_mods_add_string(smods, LDAP_MOD_ADD, attrName, newvalue);
-                slapi_ch_free_string(&newvalue);
-            } 
-            /* else: value does not include the modified DN.  Ignore it. */
+            /* else: (nrc < 0) Ignore the DN normalization error for now. */
+
+            if (deleted) {
+                if (PL_HashTableLookup(deleted, sval)) {
+                    slapi_mods_add_string(smods, LDAP_MOD_DELETE, attrName,
+                                          slapi_value_get_string(v));
+                }
+            } else {
+                /*
+                 * Compare the renamed dn with the value to find out
+                 * if it is the value itself (case 1) or an ancestor
+                 * (case 2).
+                 *
+                 * E.g.,
+                 * (case 1)
+                 * modrdn: uid=A,ou=B,o=C --> uid=A',ou=B',o=C
+                 *            (ndn)                (newndn)
+                 * member: uid=A,ou=B,ou=C --> uid=A',ou=B',ou=C
+                 *            (sval)               (newndn)
+                 *
+                 * (case 2)
+                 * modrdn: ou=B,o=C --> ou=B',o=C
+                 *         (ndn)         (newndn)
+                 * member: uid=A,ou=B,ou=C --> uid=A,ou=B',ou=C
+                 *         (sval)              (sval' + newndn)
+                 */
+                len = strlen(sval);
+                if (len == ndnlen && strcmp(sval, u->ndn) == 0) {
+                    /* (case 1) */
+                    slapi_mods_add_string(smods, LDAP_MOD_DELETE, attrName,
+                                          slapi_value_get_string(v));
+                    slapi_mods_add_string(smods, LDAP_MOD_ADD, attrName, u->newndn);
+                } else if (len > ndnlen && sval[len - ndnlen - 1] == ',' &&
+                           strcmp(sval + len - ndnlen, u->ndn) == 0) {
+                    /* (case 2) */
+                    sval[len - ndnlen] = '\0';
+                    newvalue = slapi_ch_smprintf("%s%s", sval, u->newndn);
+                    slapi_mods_add_string(smods, LDAP_MOD_DELETE, attrName,
+                                          slapi_value_get_string(v));
+                    slapi_mods_add_string(smods, LDAP_MOD_ADD, attrName, newvalue);
+                    slapi_ch_free_string(&newvalue);
+                }
+                /* else: value does not include the modified DN.  Ignore it. */
+            }
             slapi_ch_free_string(&sval);
-        }
-        rc = _do_modify(mod_pb, entrySDN, slapi_mods_get_ldapmods_byref(smods));
-        if (rc) {
-            slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                        "_update_all_per_mod: entry %s failed (%d)\n",
-                        slapi_sdn_get_dn(entrySDN), rc);
-        }
 
-        /* cleanup memory allocated for dnParts and newDN */
-        if (dnParts){
-            slapi_ldap_value_free(dnParts);
-            dnParts = NULL;
+            if (slapi_mods_get_num_mods(smods) >= REFERINT_MAX_MODS) {
+                rc = _do_modify(mod_pb, slapi_entry_get_sdn(e),
+                                slapi_mods_get_ldapmods_byref(smods));
+                slapi_mods_free(&smods);
+                smods = slapi_mods_new();
+            }
         }
-        slapi_ch_free_string(&newDN);
-        slapi_mods_free(&smods);
     }
+    if (rc == 0 && slapi_mods_get_num_mods(smods) > 0) {
+        rc = _do_modify(mod_pb, slapi_entry_get_sdn(e),
+                        slapi_mods_get_ldapmods_byref(smods));
+    }
+    if (rc) {
+        slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
+                         "referint_update_entry: entry %s failed (%d)\n",
+                         slapi_entry_get_dn_const(e), rc);
+    }
+    slapi_mods_free(&smods);
 
-bail:
     return rc;
 }
 
-int
-update_integrity(Slapi_DN *origSDN,
-                 char *newrDN, Slapi_DN *newsuperior, 
-                 int logChanges)
+/*
+ * Update the targets, one modify each: every modify is its own backend
+ * transaction, so that a failed entry does not hold back the others.
+ */
+static int
+referint_update_targets(referint_target *targets, char **attrs, PLHashTable *deleted,
+                        referint_update *u, int grouped, int *nentries, int *nfailed)
 {
-    Slapi_PBlock *search_result_pb = NULL;
     Slapi_PBlock *mod_pb = slapi_pblock_new();
-    Slapi_Entry  **search_entries = NULL;
-    Slapi_DN *sdn = NULL;
-    Slapi_Attr *attr = NULL;
-    void *node = NULL;
-    const char *origDN = slapi_sdn_get_dn(origSDN);
-    const char *search_base = NULL;
-    char *attrName = NULL;
-    char *filter = NULL;
-    char *attrs[2];
-    char **membership_attrs = NULL;
-    int search_result;
-    int nval = 0;
-    int i, j;
+    referint_target *t = NULL;
     int rc = SLAPI_PLUGIN_SUCCESS;
 
-    membership_attrs = referint_get_attrs();
-    /*
-     *  For now, just putting attributes to keep integrity on in conf file,
-     *  until resolve the other timing mode issue
-     */
-    search_result_pb = slapi_pblock_new();
+    for (t = targets; t; t = t->next) {
+        if (referint_update_entry(t->e, attrs, deleted, u, mod_pb) == 0) {
+            (*nentries)++;
+        } else {
+            (*nfailed)++;
+            if (!grouped && use_txn) {
+                /*
+                 * We're using backend transactions,
+                 * so we need to stop on failure.
+                 */
+                rc = SLAPI_PLUGIN_FAILURE;
+                break;
+            }
+        }
+    }
+    slapi_pblock_destroy(mod_pb);
 
-    /* Search each namingContext in turn
-     * or use the defined scope(s)
-     */
-    if (plugin_ContainerScope) {
-	sdn = plugin_ContainerScope;
-    } else {
-    	sdn = slapi_get_first_suffix( &node, 0 );
+    return rc;
+}
+
+/*
+ * Apply the updates from first up to end: either one rename, or deletes
+ * sharing their searches, REFERINT_FILTER_DNS DNs per filter, so that an
+ * entry referring to several of the deleted DNs is modified once.
+ */
+static int
+referint_apply_run(referint_update *first, referint_update *end, char **attrs,
+                   int grouped, int *nentries, int *nfailed)
+{
+    PLHashTable *seen = NULL;
+    PLHashTable *deleted = NULL;
+    referint_target *targets = NULL;
+    referint_target *tail = NULL;
+    referint_target *next = NULL;
+    referint_update *u = NULL;
+    char *components = NULL;
+    int n = 0;
+    int rc = SLAPI_PLUGIN_SUCCESS;
+
+    seen = PL_NewHashTable(64, PL_HashString, PL_CompareStrings,
+                           PL_CompareValues, NULL, NULL);
+    if (NULL == first->newndn) {
+        deleted = PL_NewHashTable(64, PL_HashString, PL_CompareStrings,
+                                  PL_CompareValues, NULL, NULL);
     }
-    while (sdn)
-    {
-        Slapi_Backend *be = slapi_be_select(sdn);
-        search_base = slapi_sdn_get_dn( sdn );
 
-        for(i = 0; membership_attrs[i] != NULL; i++){
-            if(newrDN){
-                /* we need to check the children of the old dn, so use a wildcard */
-                filter = slapi_filter_sprintf("(%s=*%s%s)", membership_attrs[i], ESC_NEXT_VAL, origDN);
-            } else {
-                filter = slapi_filter_sprintf("(%s=%s%s)", membership_attrs[i], ESC_NEXT_VAL, origDN);
+    for (u = first; u != end && rc == SLAPI_PLUGIN_SUCCESS; u = u->next) {
+        if (deleted) {
+            PL_HashTableAdd(deleted, u->ndn, u);
+        }
+        components = referint_filter_add(components, attrs, u->ndn, u->newndn != NULL);
+        if (++n == REFERINT_FILTER_DNS || u->next == end) {
+            if (components) {
+                rc = referint_find_targets(components, attrs, seen, &targets, &tail);
             }
-            if ( filter ) {
-                /* Need only the current attribute and its subtypes */
-                attrs[0] = membership_attrs[i];
-                attrs[1] = NULL;
-
-                /* Use new search API */
-                slapi_pblock_init(search_result_pb);
-                slapi_pblock_set(search_result_pb, SLAPI_BACKEND, be);
-                slapi_search_internal_set_pb(search_result_pb, search_base, 
-                    LDAP_SCOPE_SUBTREE, filter, attrs, 0 /* attrs only */,
-                    NULL, NULL, referint_plugin_identity, 0);
-                slapi_search_internal_pb(search_result_pb);
-  
-                slapi_pblock_get( search_result_pb, SLAPI_PLUGIN_INTOP_RESULT, &search_result);
-
-                /* if search successfull then do integrity update */
-                if(search_result == LDAP_SUCCESS)
-                {
-                    slapi_pblock_get(search_result_pb, SLAPI_PLUGIN_INTOP_SEARCH_ENTRIES,
-                                     &search_entries);
-
-                    for(j = 0; search_entries[j] != NULL; j++){
-                        attr = NULL;
-                        attrName = NULL;
-                        /*
-                         *  Loop over all the attributes of the entry and search
-                         *  for the integrity attribute and its subtypes
-                         */
-                        for (slapi_entry_first_attr(search_entries[j], &attr); attr; 
-                             slapi_entry_next_attr(search_entries[j], attr, &attr))
-                        {
-                            /*
-                             *  Take into account only the subtypes of the attribute
-                             *  in argv[i] having the necessary value  - origDN
-                             */
-                            slapi_attr_get_type(attr, &attrName);
-                            if (slapi_attr_type_cmp(membership_attrs[i], attrName,
-                                                    SLAPI_TYPE_CMP_SUBTYPE) == 0)
-                            {
-                                nval = 0;
-                                slapi_attr_get_numvalues(attr, &nval);
-                                /* 
-                                 * We want to reduce the "modify" call as much as
-                                 * possible. But if an entry contains 1000s of 
-                                 * attributes which need to be updated by the 
-                                 * referint plugin (e.g., a group containing 1000s 
-                                 * of members), we want to avoid to allocate too 
-                                 * many mods * in one "modify" call.
-                                 * This is a compromise: If an attribute type has
-                                 * more than 128 values, we update the attribute 
-                                 * value one by one. Otherwise, update all values
-                                 * in one "modify" call.
-                                 */
-                                if (nval > 128) {
-                                    rc = _update_one_per_mod(
-                                         slapi_entry_get_sdn(search_entries[j]),
-                                         attr, attrName, origSDN, newrDN, 
-                                         slapi_sdn_get_dn(newsuperior),
-                                         mod_pb);
-                                } else {
-                                    rc = _update_all_per_mod(
-                                         slapi_entry_get_sdn(search_entries[j]),
-                                         attr, attrName, origSDN, newrDN, 
-                                         slapi_sdn_get_dn(newsuperior),
-                                         mod_pb);
-                                }
-                                if (rc) {
-                                    if (use_txn) {
-                                        /*
-                                         * We're using backend transactions,
-                                         * so we need to stop on failure.
-                                         */
-                                        rc = SLAPI_PLUGIN_FAILURE;
-                                        goto free_and_return;
-                                    } else {
-                                        rc = SLAPI_PLUGIN_SUCCESS;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                } else {
-                    if (isFatalSearchError(search_result)){
-                        slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                            "update_integrity search (base=%s filter=%s) returned "
-                            "error %d\n", search_base, filter, search_result);
-                        rc = SLAPI_PLUGIN_FAILURE;
-                        goto free_and_return;
-                    }
-                }
-                slapi_ch_free_string(&filter);
+            slapi_ch_free_string(&components);
+            n = 0;
+        }
+    }
+
+    if (rc == SLAPI_PLUGIN_SUCCESS && targets) {
+        rc = referint_update_targets(targets, attrs, deleted, deleted ? NULL : first,
+                                     grouped, nentries, nfailed);
+    }
+
+    for (; targets; targets = next) {
+        next = targets->next;
+        slapi_entry_free(targets->e);
+        slapi_ch_free((void **)&targets);
+    }
+    slapi_ch_free_string(&components);
+    PL_HashTableDestroy(seen);
+    if (deleted) {
+        PL_HashTableDestroy(deleted);
+    }
+
+    return rc;
+}
+
+/*
+ * Apply a list of updates in order.  Consecutive deletes requested by
+ * the same bind DN are applied together.
+ */
+static int
+referint_apply_updates(referint_update *updates, char **attrs, int grouped,
+                       int *nentries, int *nfailed)
+{
+    referint_update *u = updates;
+    referint_update *end = NULL;
+    int rc = SLAPI_PLUGIN_SUCCESS;
+
+    while (u && rc == SLAPI_PLUGIN_SUCCESS) {
+        if (grouped && u->requestor) {
+            /* Set the bind DN in the thread data */
+            if(slapi_td_set_dn(slapi_ch_strdup(u->requestor))){
+                slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,"Failed to set thread data\n");
             }
-            slapi_free_search_results_internal(search_result_pb);
         }
-        if (plugin_ContainerScope) {
-            /* at the moment only a single scope is supported
-             * so the loop ends after the first iteration
-             */
-            sdn = NULL;
+        end = u->next;
+        if (u->newndn) {
+            if (strcmp(u->ndn, u->newndn) == 0) {
+                /* renamed back to where it was */
+                u = end;
+                continue;
+            }
         } else {
-            sdn = slapi_get_next_suffix( &node, 0 );
+            while (end && end->newndn == NULL && referint_same_requestor(u, end)) {
+                end = end->next;
+            }
+        }
+        rc = referint_apply_run(u, end, attrs, grouped, nentries, nfailed);
+        if (rc && grouped) {
+            /* a failed search: go on with the rest of the batch */
+            rc = SLAPI_PLUGIN_SUCCESS;
         }
+        u = end;
     }
 
+    return rc;
+}
 
-free_and_return:
-    /* free filter and search_results_pb */
-    slapi_ch_free_string(&filter);
-    slapi_ch_array_free(membership_attrs);
+int
+update_integrity(Slapi_DN *origSDN,
+                 char *newrDN, Slapi_DN *newsuperior, 
+                 int logChanges)
+{
+    referint_update *u = NULL;
+    char **membership_attrs = NULL;
+    int nentries = 0;
+    int nfailed = 0;
+    int rc = SLAPI_PLUGIN_SUCCESS;
 
-    slapi_pblock_destroy(mod_pb);
-    if (search_result_pb) {
-        slapi_free_search_results_internal(search_result_pb);
-        slapi_pblock_destroy(search_result_pb);
+    u = referint_update_new(slapi_sdn_get_ndn(origSDN), newrDN,
+                            slapi_sdn_get_dn(newsuperior), NULL);
+    if (NULL == u) {
+        return SLAPI_PLUGIN_FAILURE;
+    }
+    membership_attrs = referint_get_attrs();
+    if (membership_attrs) {
+        rc = referint_apply_updates(u, membership_attrs, 0, &nentries, &nfailed);
     }
+
+    slapi_ch_array_free(membership_attrs);
+    referint_update_free(&u);
  
     return(rc);
 }
@@ -1323,7 +1486,7 @@ int referint_postop_start( Slapi_PBlock *pb)
      */
     if(referint_get_delay() > 0){
         /* initialize the cv and lock */
-        if (!use_txn && (NULL == referint_mutex)) {
+        if (NULL == referint_mutex) {
             referint_mutex = PR_NewLock();
         }
         keeprunning_mutex = PR_NewLock();
@@ -1376,113 +1539,207 @@ int referint_postop_close( Slapi_PBlock *pb)
     return(0);
 }
 
-void
-referint_thread_func(void *arg)
+/*
+ * Account for a record written to the integrity log.  The worker is woken
+ * up as soon as a full batch is waiting rather than at the end of the
+ * delay, and a warning is logged once when the backlog keeps growing.
+ */
+static void
+referint_queued()
 {
-    PRFileDesc *prfd = NULL;
-    char *logfilename = NULL;
+    int batchsize = referint_get_batchsize();
+    int backlog;
+
+    if (NULL == keeprunning_mutex) {
+        /* the worker is not running */
+        return;
+    }
+    PR_Lock(keeprunning_mutex);
+    referint_stats.queued++;
+    referint_stats.pending++;
+    backlog = referint_stats.pending + referint_stats.inflight;
+    if (backlog > referint_stats.highwater) {
+        referint_stats.highwater = backlog;
+    }
+    if (!referint_stats.warned && backlog >= REFERINT_BACKLOG_WARN * batchsize) {
+        referint_stats.warned = 1;
+        slapi_log_error(SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
+            "referint_postop: %d updates are waiting to be applied\n", backlog);
+    }
+    if (referint_stats.pending >= batchsize && keeprunning_cv) {
+        PR_NotifyCondVar(keeprunning_cv);
+    }
+    PR_Unlock(keeprunning_mutex);
+}
+
+/*
+ * Hand the integrity log over to the worker: it is renamed to the work
+ * file, which the postops never write, so they do not wait while the
+ * updates are applied.  A work file left by a previous run is replayed
+ * first.
+ */
+static PRFileDesc *
+referint_take_log(const char *logfilename, const char *workfilename)
+{
+    int taken = 0;
+
+    referint_lock();
+    if (PR_Access(workfilename, PR_ACCESS_EXISTS) != PR_SUCCESS) {
+        if (PR_Access(logfilename, PR_ACCESS_EXISTS) == PR_SUCCESS &&
+            PR_Rename(logfilename, workfilename) != PR_SUCCESS)
+        {
+            slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
+                "referint_thread_func could not rename \"%s\" to \"%s\" "
+                SLAPI_COMPONENT_NAME_NSPR " %d (%s)\n",
+                logfilename, workfilename, PR_GetError(), slapd_pr_strerror(PR_GetError()) );
+        } else {
+            taken = 1;
+        }
+    }
+    if (taken) {
+        PR_Lock(keeprunning_mutex);
+        referint_stats.inflight += referint_stats.pending;
+        referint_stats.pending = 0;
+        PR_Unlock(keeprunning_mutex);
+    }
+    referint_unlock();
+
+    return PR_Open(workfilename, PR_RDONLY, REFERINT_DEFAULT_FILE_MODE);
+}
+
+/*
+ * Apply the updates of the work file, batchsize records at a time.
+ * Returns 0 when the worker was stopped before the end of the file: the
+ * file is kept and replayed from its start on the next run, which is
+ * harmless as the changes are computed from the referring entries.
+ */
+static int
+referint_replay_log(PRFileDesc *prfd, int batchsize)
+{
+    referint_batch *batch = NULL;
+    referint_update *u = NULL;
+    char **membership_attrs = NULL;
     char thisline[MAX_LINE];
     char delimiter[]="\t\n";
-    char *ptoken;
-    char *tmprdn;
+    char *dn, *newrdn, *newsuperior, *requestor;
     char *iter = NULL;
-    Slapi_DN *sdn = NULL;
-    Slapi_DN *tmpsuperior = NULL;
-    int logChanges = 0;
-    int delay;
-    int no_changes;
-
-    /*
-     * keep running this thread until plugin is signaled to close
-     */
-    while(1){ 
-        /* refresh the config */
-        slapi_ch_free_string(&logfilename);
-        referint_get_config(&delay, &logChanges, &logfilename);
-
-        no_changes=1;
-        while(no_changes){
+    int nentries, nfailed;
+    int eof = 0;
 
-            PR_Lock(keeprunning_mutex);
-            if(keeprunning == 0){
-                PR_Unlock(keeprunning_mutex);
+    membership_attrs = referint_get_attrs();
+    while (!eof && membership_attrs) {
+        if (!referint_keeprunning()) {
+            break;
+        }
+        batch = referint_batch_new();
+        while (batch->nrecords < batchsize) {
+            if (GetNextLine(thisline, MAX_LINE, prfd) == 0) {
+                eof = 1;
                 break;
             }
-            PR_Unlock(keeprunning_mutex);
-
-            referint_lock();
-            if (( prfd = PR_Open( logfilename, PR_RDONLY, REFERINT_DEFAULT_FILE_MODE )) == NULL ){
-                referint_unlock();
-                /* go back to sleep and wait for this file */
-                PR_Lock(keeprunning_mutex);
-                PR_WaitCondVar(keeprunning_cv, PR_SecondsToInterval(delay));
-                PR_Unlock(keeprunning_mutex);
-            } else {
-                no_changes = 0;
+            iter = NULL;
+            dn = ldap_utf8strtok_r(thisline, delimiter, &iter);
+            newrdn = ldap_utf8strtok_r(NULL, delimiter, &iter);
+            newsuperior = ldap_utf8strtok_r(NULL, delimiter, &iter);
+            requestor = ldap_utf8strtok_r(NULL, delimiter, &iter);
+            if (NULL == requestor) {
+                slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
+                    "referint_thread_func: skipping malformed integrity log record\n");
+                continue;
+            }
+            u = referint_update_new(dn, strcasecmp(newrdn, "NULL") ? newrdn : NULL,
+                                    strcasecmp(newsuperior, "NULL") ? newsuperior : NULL,
+                                    strcasecmp(requestor, "NULL") ? requestor : NULL);
+            if (u) {
+                referint_batch_add(batch, u);
             }
         }
-        /*
-         *  Check keep running here, because after break out of no
-         *  changes loop on shutdown, also need to break out of this
-         *  loop before trying to do the changes. The server
-         *  will pick them up on next startup as file still exists
-         */
-        PR_Lock(keeprunning_mutex);
-        if(keeprunning == 0){
-            PR_Unlock(keeprunning_mutex);
+
+        if (batch->nrecords == 0) {
+            referint_batch_free(&batch);
             break;
         }
-        PR_Unlock(keeprunning_mutex);  
+        nentries = nfailed = 0;
+        referint_apply_updates(batch->head, membership_attrs, 1, &nentries, &nfailed);
 
-        while( GetNextLine(thisline, MAX_LINE, prfd) ){
-            ptoken = ldap_utf8strtok_r(thisline, delimiter, &iter);
-            sdn = slapi_sdn_new_normdn_byref(ptoken);
-            ptoken = ldap_utf8strtok_r (NULL, delimiter, &iter);
+        PR_Lock(keeprunning_mutex);
+        referint_stats.batches++;
+        referint_stats.coalesced += batch->nrecords - batch->nupdates;
+        referint_stats.applied += nentries;
+        referint_stats.failed += nfailed;
+        referint_stats.inflight -= batch->nrecords;
+        if (referint_stats.inflight < 0) {
+            /* records left by a previous run */
+            referint_stats.inflight = 0;
+        }
+        if (referint_stats.pending + referint_stats.inflight < batchsize) {
+            referint_stats.warned = 0;
+        }
+        slapi_log_error(SLAPI_LOG_PLUGIN, REFERINT_PLUGIN_SUBSYSTEM,
+            "referint_thread_func: %d records coalesced to %d updates, "
+            "%d entries updated, %d failed; backlog %d (highwater %d)\n",
+            batch->nrecords, batch->nupdates, nentries, nfailed,
+            referint_stats.pending + referint_stats.inflight,
+            referint_stats.highwater);
+        PR_Unlock(keeprunning_mutex);
 
-            if(!strcasecmp(ptoken, "NULL")) {
-                tmprdn = NULL;
-            } else {
-                tmprdn = slapi_ch_smprintf("%s", ptoken);
-            }
+        referint_batch_free(&batch);
+    }
+    slapi_ch_array_free(membership_attrs);
 
-            ptoken = ldap_utf8strtok_r (NULL, delimiter, &iter);
-            if (!strcasecmp(ptoken, "NULL")) {
-                tmpsuperior = NULL;
-            } else {
-                tmpsuperior = slapi_sdn_new_normdn_byref(ptoken);
-            }
-            ptoken = ldap_utf8strtok_r (NULL, delimiter, &iter);
-            if (strcasecmp(ptoken, "NULL") != 0) {
-                /* Set the bind DN in the thread data */
-                if(slapi_td_set_dn(slapi_ch_strdup(ptoken))){
-                    slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,"Failed to set thread data\n");
-                }
-            }
+    return eof;
+}
 
-            update_integrity(sdn, tmprdn, tmpsuperior, logChanges);
+void
+referint_thread_func(void *arg)
+{
+    PRFileDesc *prfd = NULL;
+    char *logfilename = NULL;
+    char *workfilename = NULL;
+    int logChanges = 0;
+    int batchsize;
+    int delay;
+    int done;
 
-            slapi_sdn_free(&sdn);
-            slapi_ch_free_string(&tmprdn);
-            slapi_sdn_free(&tmpsuperior);
-        }
+    /*
+     * keep running this thread until plugin is signaled to close
+     */
+    while(referint_keeprunning()){
+        /* refresh the config */
+        slapi_ch_free_string(&logfilename);
+        slapi_ch_free_string(&workfilename);
+        referint_get_config(&delay, &logChanges, &logfilename);
+        batchsize = referint_get_batchsize();
+        workfilename = slapi_ch_smprintf("%s%s", logfilename, REFERINT_WORKFILE_SUFFIX);
 
-        PR_Close(prfd);
+        if ((prfd = referint_take_log(logfilename, workfilename))) {
+            done = referint_replay_log(prfd, batchsize);
+            PR_Close(prfd);
 
-        /* remove the original file */
-        if( PR_SUCCESS != PR_Delete(logfilename) ){
-            slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
-                "referint_postop_close could not delete \"%s\"\n", logfilename );
+            /*
+             * On shutdown the server picks the rest of the changes up
+             * on next startup as the file still exists
+             */
+            if (done && PR_SUCCESS != PR_Delete(workfilename)) {
+                slapi_log_error( SLAPI_LOG_FATAL, REFERINT_PLUGIN_SUBSYSTEM,
+                    "referint_thread_func could not delete \"%s\"\n", workfilename );
+            }
         }
 
-        /* unlock and let other writers back at the file */
-        referint_unlock();
-
-        /* wait on condition here */
+        /* wait on condition here, unless a full batch is already waiting */
         PR_Lock(keeprunning_mutex);
-        PR_WaitCondVar(keeprunning_cv, PR_SecondsToInterval(delay));
+        if (keeprunning && referint_stats.pending < batchsize) {
+            PR_WaitCondVar(keeprunning_cv, PR_SecondsToInterval(delay));
+        }
         PR_Unlock(keeprunning_mutex);
     }
 
+    slapi_log_error(SLAPI_LOG_PLUGIN, REFERINT_PLUGIN_SUBSYSTEM,
+        "referint_thread_func: %" NSPRIu64 " records queued, %" NSPRIu64 " coalesced, "
+        "%" NSPRIu64 " entries updated, %" NSPRIu64 " failed in %" NSPRIu64 " batches\n",
+        referint_stats.queued, referint_stats.coalesced, referint_stats.applied,
+        referint_stats.failed, referint_stats.batches);
+
     /* cleanup resources allocated in start  */
     if (NULL != keeprunning_mutex) {
         PR_DestroyLock(keeprunning_mutex);
@@ -1494,6 +1751,7 @@ referint_thread_func(void *arg)
         PR_DestroyCondVar(keeprunning_cv);
     }
     slapi_ch_free_string(&logfilename);
+    slapi_ch_free_string(&workfilename);
 }
 
 int my_fgetc(PRFileDesc *stream)
@@ -1563,9 +1821,9 @@ GetNextLine(char *dest, int size_dest, PRFileDesc *stream) {
 }
 
 /*
- *  Write this record to the log file
+ *  Write this record to the log file, returns 0 if it was written
  */
-void
+int
 writeintegritylog(Slapi_PBlock *pb, char *logfilename, Slapi_DN *sdn,
                   char *newrdn, Slapi_DN *newsuperior, Slapi_DN *requestorsdn)
 {
@@ -1576,15 +1834,15 @@ writeintegritylog(Slapi_PBlock *pb, char *logfilename, Slapi_DN *sdn,
     const char *requestordn = NULL;
     const char *newsuperiordn = NULL;
     size_t reqdn_len = 0;
+    int written = -1;
     
 	if (!(referint_sdn_in_entry_scope(sdn) ||
 		(newsuperior && referint_sdn_in_entry_scope(newsuperior)))) {
-		return;
+		return written;
 	}
     /*
-     * Use this lock to protect file data when update integrity is occuring.
-     * If betxn is enabled, this mutex is ignored; transaction itself takes
-     * the role.
+     * Use this lock to protect file data while the worker takes the
+     * file over.
      */
     referint_lock();
     if (( prfd = PR_Open( logfilename, PR_WRONLY | PR_CREATE_FILE | PR_APPEND,
@@ -1595,9 +1853,8 @@ writeintegritylog(Slapi_PBlock *pb, char *logfilename, Slapi_DN *sdn,
         SLAPI_COMPONENT_NAME_NSPR " %d (%s)\n",
             logfilename, PR_GetError(), slapd_pr_strerror(PR_GetError()) );
 
-        PR_Unlock(referint_mutex);
         referint_unlock();
-        return;
+        return written;
     }
     /*
      *  Make sure we have enough room in our buffer before trying to write it.
@@ -1650,6 +1907,8 @@ writeintegritylog(Slapi_PBlock *pb, char *logfilename, Slapi_DN *sdn,
                 " writeintegritylog: PR_Write failed : The disk"
                 " may be full or the file is unwritable :: NSPR error - %d\n",
             PR_GetError());
+        } else {
+            written = 0;
         }
     }
 
@@ -1661,6 +1920,8 @@ writeintegritylog(Slapi_PBlock *pb, char *logfilename, Slapi_DN *sdn,
             PR_GetError());
     }
     referint_unlock();
+
+    return written;
 }
 
 static int
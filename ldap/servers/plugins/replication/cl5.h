@@ -29,6 +29,7 @@ typedef struct changelog5Config
 	char *symmetricKey;
 	long compactInterval;
 	long trimInterval;
+	int  trimRate;
 }changelog5Config;
 
 /* initializes changelog*/
@@ -39,6 +39,9 @@
 #define GUARDIAN_FILE		"guardian"		/* name of the guardian file */
 #define VERSION_FILE		"DBVERSION"		/* name of the version file  */
 #define V_5					5				/* changelog entry version */
+#define V_6					6				/* compact changelog entry version */
+#define CL5_VARINT_MAX		5				/* longest varint encoding of a 32 bit value */
+#define CL5_CSN_SIZE		10				/* binary csn in V_6 records */
 #define CHUNK_SIZE			64*1024
 #define DBID_SIZE			64
 #define FILE_SEP            "_"             /* separates parts of the db file name */
@@ -208,7 +211,14 @@ typedef struct cl5trim
 	int			maxEntries;	/* maximum number of entries across all changelog files	*/
 	int			compactInterval;	/* interval to compact changelog db */
 	int			trimInterval;	/* trimming interval */
+	int			trimRate;	/* maximum number of changes trimmed per second, 0 if unlimited */
+	PRBool		backlog;	/* the last pass ran out of budget with changes left to trim */
 	PRLock*		lock;		/* controls access to trimming configuration			*/
+	PRLock*		statLock;	/* protects the trimming statistics below				*/
+	PRUint64	trimmed;	/* changes trimmed since startup						*/
+	long		lastRate;	/* changes per second during the last pass that trimmed	*/
+	long		lag;		/* age of the oldest change left by the trim budget		*/
+	PRUint64	reclaimed;	/* bytes returned to the filesystem by compaction		*/
 } CL5Trim;
 
 /* this structure defines 5.0 changelog internals */
@@ -240,6 +250,41 @@ typedef void (*VFP)(void *);
 /***** Global Variables *****/
 static CL5Desc s_cl5Desc;
 
+/* attribute types V_6 records refer to by index. The index is stored in the
+   changelog: only ever append to this list */
+static const char *s_cl5InternedTypes[] = {
+	"objectClass",
+	"modifiersName",
+	"modifyTimestamp",
+	"creatorsName",
+	"createTimestamp",
+	PSEUDO_ATTR_UNHASHEDUSERPASSWORD,
+	"userPassword",
+	"cn",
+	"sn",
+	"uid",
+	"givenName",
+	"mail",
+	"description",
+	"telephoneNumber",
+	"member",
+	"uniqueMember",
+	"memberOf",
+	"ou",
+	"displayName",
+	"nsAccountLock",
+	"nsRoleDN",
+	"passwordRetryCount",
+	"retryCountResetTime",
+	"accountUnlockTime",
+	"passwordExpirationTime",
+	"passwordHistory",
+	"passwordAllowChangeTime",
+	"passwordExpWarned",
+	"passwordGraceUserTime",
+	NULL
+};
+
 /***** Forward Declarations *****/
 
 /* changelog initialization and cleanup */
@@ -292,12 +337,27 @@ static PRBool _cl5IsValidIterator (const CL5Iterator *iterator);
 static int _cl5GetOperation (Object *replica, slapi_operation_parameters *op);
 static const char* _cl5OperationType2Str (int type);
 static int _cl5Str2OperationType (const char *str);
+static int _cl5DBData2EntryV6 (const char *data, PRUint32 len, CL5Entry *entry);
+static int _cl5VarintSize (PRUint32 val);
+static void _cl5WriteVarint (PRUint32 val, char **buff);
+static int _cl5ReadVarint (PRUint32 *val, const char **buff, const char *end);
+static int _cl5GetStringSize (const char *str);
 static void _cl5WriteString (const char *str, char **buff);
+static int _cl5ReadStringRef (const char **str, const char **buff, const char *end);
 static void _cl5ReadString (char **str, char **buff);
+static void _cl5WriteCSN (const CSN *csn, char **buff);
+static int _cl5ReadCSN (CSN **csn, const char **buff, const char *end);
+static int _cl5InternedTypeIndex (const char *type);
+static void _cl5WriteType (const char *type, char **buff);
+static int _cl5ReadType (const char **type, const char **buff, const char *end);
+static void _cl5WriteValue (const struct berval *bv, char **buff);
 static void _cl5WriteMods (LDAPMod **mods, char **buff);
 static int _cl5WriteMod (LDAPMod *mod, char **buff);
 static int _cl5ReadMods (LDAPMod ***mods, char **buff);
 static int _cl5ReadMod (Slapi_Mod *mod, char **buff);
+static int _cl5ReadModsV6 (LDAPMod ***mods, const char **buff, const char *end);
+static int _cl5ReadModV6 (Slapi_Mod *smod, const char **buff, const char *end);
+static void _cl5AddDecryptedValue (Slapi_Mod *smod, struct berval *bv);
 static int _cl5GetModsSize (LDAPMod **mods);
 static int _cl5GetModSize (LDAPMod *mod);
 static void _cl5ReadBerval (struct berval *bv, char** buff);
@@ -322,7 +382,7 @@ static void _cl5CompactDBs();
 static void _cl5PurgeRID(Object *obj,  ReplicaId cleaned_rid);
 static int _cl5PurgeGetFirstEntry (Object *obj, CL5Entry *entry, void **iterator, DB_TXN *txnid, int rid, DBT *key);
 static int _cl5PurgeGetNextEntry (CL5Entry *entry, void *iterator, DBT *key);
-static void _cl5TrimFile (Object *obj, long *numToTrim);
+static int _cl5TrimFile (Object *obj, long *numToTrim, long *budget, long *lag);
 static PRBool _cl5CanTrim (time_t time, long *numToTrim);
 static int  _cl5ReadRUV (const char *replGen, Object *obj, PRBool purge);
 static int  _cl5WriteRUV (CL5DBFile *file, PRBool purge);
@@ -1148,12 +1208,14 @@ int cl5GetState ()
    Parameters:  maxEntries - maximum number of entries in the chnagelog (in all files);
 				maxAge - maximum entry age;
 				compactInterval - interval to compact changelog db;
-				trimInterval - changelog trimming interval.
+				trimInterval - changelog trimming interval;
+				trimRate - maximum number of changes trimmed per second, 0 if unlimited.
    Return:		CL5_SUCCESS if successful;
 				CL5_BAD_STATE if changelog is not open
  */
 int
-cl5ConfigTrimming (int maxEntries, const char *maxAge, int compactInterval, int trimInterval)
+cl5ConfigTrimming (int maxEntries, const char *maxAge, int compactInterval, int trimInterval,
+                   int trimRate)
 {
 	if (s_cl5Desc.dbState == CL5_STATE_NONE)
 	{
@@ -1201,6 +1263,11 @@ cl5ConfigTrimming (int maxEntries, const char *maxAge, int compactInterval, int
 		s_cl5Desc.dbTrim.trimInterval = trimInterval;
 	}
 
+	if (trimRate != CL5_NUM_IGNORE)
+	{
+		s_cl5Desc.dbTrim.trimRate = trimRate;
+	}
+
 	/* The config was updated, notify the changelog trimming thread */
 	PR_Lock(s_cl5Desc.clLock);
 	PR_NotifyCondVar(s_cl5Desc.clCvar);
@@ -1213,6 +1280,34 @@ cl5ConfigTrimming (int maxEntries, const char *maxAge, int compactInterval, int
 	return CL5_SUCCESS;	
 }
 
+/* Name:		cl5GetTrimStats
+   Description:	returns the changelog trimming statistics
+   Parameters:  trimmed - number of changes trimmed since startup;
+				rate - changes trimmed per second during the last pass;
+				lag - age in seconds of the oldest change that could be trimmed
+				      but was left for the next pass by the trimming rate;
+				reclaimed - bytes returned to the filesystem by compaction.
+   Return:		none
+ */
+void
+cl5GetTrimStats (PRUint64 *trimmed, long *rate, long *lag, PRUint64 *reclaimed)
+{
+	*trimmed = 0;
+	*rate = 0;
+	*lag = 0;
+	*reclaimed = 0;
+	if (s_cl5Desc.dbTrim.statLock == NULL)
+	{
+		return;
+	}
+	PR_Lock (s_cl5Desc.dbTrim.statLock);
+	*trimmed = s_cl5Desc.dbTrim.trimmed;
+	*rate = s_cl5Desc.dbTrim.lastRate;
+	*lag = s_cl5Desc.dbTrim.lag;
+	*reclaimed = s_cl5Desc.dbTrim.reclaimed;
+	PR_Unlock (s_cl5Desc.dbTrim.statLock);
+}
+
 /* Name:		cl5GetOperation
    Description:	retireves operation specified by its csn and databaseid
    Parameters:  op - must contain csn and databaseid; the rest of data is
@@ -2116,43 +2211,56 @@ static int _cl5DBOpen ()
 /* this function assumes that the entry was validated
    using IsValidOperation 
 
-   Data in db format:
-   ------------------
-   <1 byte version><1 byte change_type><sizeof time_t time><null terminated csn>
-   <null terminated uniqueid><null terminated targetdn>
-   [<null terminated newrdn><1 byte deleteoldrdn>][<4 byte mod count><mod1><mod2>....]
-   
+   Data in db format (V_6):
+   ------------------------
+   <1 byte version><1 byte flags><1 byte change_type><varint time><10 byte csn>
+   <string uniqueid><string targetdn>
+   [<string newrdn><1 byte deleteoldrdn>][<varint mod count><mod1><mod2>....]
+
+   varints are stored 7 bits per byte, least significant group first, with
+   the high bit set on every byte but the last one.
+
+   csn format:
+   -----------
+   <4 byte time><2 byte seqnum><2 byte replica id><2 byte subseqnum>
+   all in network byte order.
+
+   string format:
+   --------------
+   <varint size><value><null char>; size includes the null char and a 0 size
+   (no value, no null char) stands for a NULL or empty string. Strings are
+   null terminated so that they can be used in place when read back.
+
    mod format:
    -----------
-   <1 byte modop><null terminated attr name><4 byte value count>
-   <4 byte value size><value1><4 byte value size><value2>
+   <1 byte modop><varint attr type><varint value count>
+   <varint value size><value1><varint value size><value2>...
+   attr type is an index into s_cl5InternedTypes plus 1, or 0 followed by
+   the attribute name as a string.
+
+   Records written before V_6 are still read, see cl5DBData2Entry.
 */
 static int _cl5Entry2DBData (const CL5Entry *entry, char **data, PRUint32 *len)
 {
-	int size = 1 /* version */ + 1 /* operation type */ + sizeof (time_t);
+	int size = 1 /* version */ + 1 /* flags */ + 1 /* operation type */ + CL5_VARINT_MAX /* time */;
 	char *pos;
-	PRUint32 t;
 	slapi_operation_parameters *op;
 	LDAPMod **add_mods = NULL;
 	char *rawDN = NULL;
-	char s[CSN_STRSIZE];		
 
 	PR_ASSERT (entry && entry->op && data && len);
 	op = entry->op;
 	PR_ASSERT (op->target_address.uniqueid);
 
 	/* compute size of the buffer needed to hold the data */
-	size += CSN_STRSIZE;
-	size += strlen (op->target_address.uniqueid) + 1;
+	size += CL5_CSN_SIZE;
+	size += _cl5GetStringSize (op->target_address.uniqueid);
 
 	switch (op->operation_type)
 	{
-		case SLAPI_OPERATION_ADD:		if (op->p.p_add.parentuniqueid)
-											size += strlen (op->p.p_add.parentuniqueid) + 1;
-										else
-											size ++; /* we just store NULL char */
+		case SLAPI_OPERATION_ADD:		size += _cl5GetStringSize (op->p.p_add.parentuniqueid);
 										slapi_entry2mods (op->p.p_add.target_entry, &rawDN/* dn */, &add_mods);										
-										size += strlen (rawDN) + 1;
+										size += _cl5GetStringSize (rawDN);
 										/* Need larger buffer for the encrypted changelog */
 										if (s_cl5Desc.clcrypt_handle) {
 											size += (_cl5GetModsSize (add_mods) * (1 + BACK_CRYPT_OUTBUFF_EXTLEN));
@@ -2161,7 +2269,7 @@ static int _cl5Entry2DBData (const CL5Entry *entry, char **data, PRUint32 *len)
 										}
 										break;
 
-		case SLAPI_OPERATION_MODIFY:	size += REPL_GET_DN_LEN(&op->target_address) + 1;
+		case SLAPI_OPERATION_MODIFY:	size += _cl5GetStringSize (REPL_GET_DN(&op->target_address));
 										/* Need larger buffer for the encrypted changelog */
 										if (s_cl5Desc.clcrypt_handle) {
 											size += (_cl5GetModsSize (op->p.p_modify.modify_mods) * (1 + BACK_CRYPT_OUTBUFF_EXTLEN));
@@ -2170,17 +2278,11 @@ static int _cl5Entry2DBData (const CL5Entry *entry, char **data, PRUint32 *len)
 										}
 										break;
 
-		case SLAPI_OPERATION_MODRDN:	size += REPL_GET_DN_LEN(&op->target_address) + 1;
+		case SLAPI_OPERATION_MODRDN:	size += _cl5GetStringSize (REPL_GET_DN(&op->target_address));
 										/* 1 for deleteoldrdn */
-										size += strlen (op->p.p_modrdn.modrdn_newrdn) + 2; 
-										if (REPL_GET_DN(&op->p.p_modrdn.modrdn_newsuperior_address))
-											size += REPL_GET_DN_LEN(&op->p.p_modrdn.modrdn_newsuperior_address) + 1;
-										else
-											size ++; /* for NULL char */
-										if (op->p.p_modrdn.modrdn_newsuperior_address.uniqueid)
-											size += strlen (op->p.p_modrdn.modrdn_newsuperior_address.uniqueid) + 1;
-										else
-											size ++; /* for NULL char */
+										size += _cl5GetStringSize (op->p.p_modrdn.modrdn_newrdn) + 1; 
+										size += _cl5GetStringSize (REPL_GET_DN(&op->p.p_modrdn.modrdn_newsuperior_address));
+										size += _cl5GetStringSize (op->p.p_modrdn.modrdn_newsuperior_address.uniqueid);
 										/* Need larger buffer for the encrypted changelog */
 										if (s_cl5Desc.clcrypt_handle) {
 											size += (_cl5GetModsSize (op->p.p_modrdn.modrdn_mods) * (1 + BACK_CRYPT_OUTBUFF_EXTLEN));
@@ -2189,7 +2291,7 @@ static int _cl5Entry2DBData (const CL5Entry *entry, char **data, PRUint32 *len)
 										}
 										break;
 
-		case SLAPI_OPERATION_DELETE:	size += REPL_GET_DN_LEN(&op->target_address) + 1;
+		case SLAPI_OPERATION_DELETE:	size += _cl5GetStringSize (REPL_GET_DN(&op->target_address));
 										break;
 	}	
 
@@ -2205,17 +2307,18 @@ static int _cl5Entry2DBData (const CL5Entry *entry, char **data, PRUint32 *len)
 	/* fill in the data buffer */
 	pos = *data;
 	/* write a byte of version */
-	(*pos) = V_5;
+	(*pos) = V_6;
+	pos ++;
+	/* write record flags */
+	(*pos) = 0;
 	pos ++;
 	/* write change type */																			 
 	(*pos) = (unsigned char)op->operation_type;
 	pos ++;
 	/* write time */
-	t = PR_htonl((PRUint32)entry->time);
-	memcpy (pos, &t, sizeof (t)); 
-	pos += sizeof (t);
+	_cl5WriteVarint ((PRUint32)entry->time, &pos);
 	/* write csn */
-	_cl5WriteString (csn_as_string(op->csn,PR_FALSE,s), &pos);
+	_cl5WriteCSN (op->csn, &pos);
 	/* write UniqueID */
 	_cl5WriteString (op->target_address.uniqueid, &pos);
 	
@@ -2260,8 +2363,12 @@ static int _cl5Entry2DBData (const CL5Entry *entry, char **data, PRUint32 *len)
 }
 
 /* 
-   Data in db format:
-   ------------------
+   Reads both the current (V_6, see _cl5Entry2DBData) and the previous
+   record format, so that changelogs written by older servers stay usable
+   until their records are trimmed.
+
+   V_5 data in db format:
+   ----------------------
    <1 byte version><1 byte change_type><sizeof time_t time><null terminated dbid>
    <null terminated csn><null terminated uniqueid><null terminated targetdn>
    [<null terminated newrdn><1 byte deleteoldrdn>][<4 byte mod count><mod1><mod2>....]
@@ -2288,10 +2395,14 @@ cl5DBData2Entry (const char *data, PRUint32 len, CL5Entry *entry)
 
 	PR_ASSERT (data && entry && entry->op);
 
-	/* ONREPL - check that we do not go beyond the end of the buffer */
-
 	/* read byte of version */
 	version = (PRUint8)(*pos);
+	if (version == V_6)
+	{
+		return _cl5DBData2EntryV6 (data, len, entry);
+	}
+
+	/* ONREPL - check that we do not go beyond the end of the buffer */
 	if (version != V_5)
 	{
 		slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
@@ -2368,6 +2479,111 @@ cl5DBData2Entry (const char *data, PRUint32 len, CL5Entry *entry)
 	return rc;
 }
 
+/* V_6 records are decoded in place: strings, attribute types and values are
+   referenced from the record buffer, and only what the operation keeps is
+   copied out of it */
+static int
+_cl5DBData2EntryV6 (const char *data, PRUint32 len, CL5Entry *entry)
+{
+	int rc = CL5_SUCCESS;
+	const char *pos = data;
+	const char *end = data + len;
+	const char *str = NULL;
+	PRUint32 thetime;
+	slapi_operation_parameters *op = entry->op;
+	LDAPMod **add_mods = NULL;
+
+	if (len < 3)
+	{
+		goto bad_format;
+	}
+
+	/* skip version, no record flags are defined yet */
+	pos ++;
+	if (*pos != 0)
+	{
+		slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
+						"cl5DBData2Entry: unsupported record flags 0x%x\n",
+						(*pos) & 0xFF);
+		return CL5_BAD_FORMAT;
+	}
+	pos ++;
+
+	/* read change type */
+	op->operation_type = (PRUint8)(*pos);
+	pos ++;
+
+	if (_cl5ReadVarint (&thetime, &pos, end) != CL5_SUCCESS ||
+		_cl5ReadCSN (&op->csn, &pos, end) != CL5_SUCCESS ||
+		_cl5ReadStringRef (&str, &pos, end) != CL5_SUCCESS)
+	{
+		goto bad_format;
+	}
+	entry->time = (time_t)thetime;
+	op->target_address.uniqueid = slapi_ch_strdup (str);
+
+	/* figure out what else we need to read depending on the operation type */
+	switch (op->operation_type)
+	{
+		case SLAPI_OPERATION_ADD:		if (_cl5ReadStringRef (&str, &pos, end) != CL5_SUCCESS)
+											goto bad_format;
+										op->p.p_add.parentuniqueid = slapi_ch_strdup (str);
+										if (_cl5ReadStringRef (&str, &pos, end) != CL5_SUCCESS)
+											goto bad_format;
+										op->target_address.sdn = slapi_sdn_new_dn_byval (str);
+										/* convert mods to entry */
+										rc = _cl5ReadModsV6 (&add_mods, &pos, end);
+										if (rc == CL5_SUCCESS)
+										{
+											slapi_mods2entry (&(op->p.p_add.target_entry), str, add_mods);
+											ldap_mods_free (add_mods, 1);
+										}
+										break;
+
+		case SLAPI_OPERATION_MODIFY:	if (_cl5ReadStringRef (&str, &pos, end) != CL5_SUCCESS)
+											goto bad_format;
+										op->target_address.sdn = slapi_sdn_new_dn_byval (str);
+										rc = _cl5ReadModsV6 (&op->p.p_modify.modify_mods, &pos, end);
+										break;
+
+		case SLAPI_OPERATION_MODRDN:	if (_cl5ReadStringRef (&str, &pos, end) != CL5_SUCCESS)
+											goto bad_format;
+										op->target_address.sdn = slapi_sdn_new_dn_byval (str);
+										if (_cl5ReadStringRef (&str, &pos, end) != CL5_SUCCESS || pos >= end)
+											goto bad_format;
+										op->p.p_modrdn.modrdn_newrdn = slapi_ch_strdup (str);
+										op->p.p_modrdn.modrdn_deloldrdn = *pos;	 
+										pos ++;
+										if (_cl5ReadStringRef (&str, &pos, end) != CL5_SUCCESS)
+											goto bad_format;
+										op->p.p_modrdn.modrdn_newsuperior_address.sdn = slapi_sdn_new_dn_byval (str);
+										if (_cl5ReadStringRef (&str, &pos, end) != CL5_SUCCESS)
+											goto bad_format;
+										op->p.p_modrdn.modrdn_newsuperior_address.uniqueid = slapi_ch_strdup (str);
+										rc = _cl5ReadModsV6 (&op->p.p_modrdn.modrdn_mods, &pos, end);
+										break;
+
+		case SLAPI_OPERATION_DELETE:	if (_cl5ReadStringRef (&str, &pos, end) != CL5_SUCCESS)
+											goto bad_format;
+										op->target_address.sdn = slapi_sdn_new_dn_byval (str);
+										break;
+
+		default:						goto bad_format;
+	}
+
+	if (rc != CL5_SUCCESS)
+	{
+		goto bad_format;
+	}
+
+	return CL5_SUCCESS;
+
+bad_format:
+	slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
+					"cl5DBData2Entry: failed to format entry\n");
+	return CL5_BAD_FORMAT;
+}
+
 /* thread management functions */
 static int _cl5DispatchDBThreads ()
 {
@@ -2419,20 +2635,307 @@ static void _cl5RemoveThread ()
 }
 
 /* data conversion functions */
+/* compact (V_6) encoding helpers */
+static int _cl5VarintSize (PRUint32 val)
+{
+	int size = 1;
+
+	while (val >= 0x80)
+	{
+		val >>= 7;
+		size ++;
+	}
+
+	return size;
+}
+
+static void _cl5WriteVarint (PRUint32 val, char **buff)
+{
+	char *pos = *buff;
+
+	while (val >= 0x80)
+	{
+		*pos = (char)((val & 0x7F) | 0x80);
+		pos ++;
+		val >>= 7;
+	}
+	*pos = (char)val;
+	pos ++;
+
+	*buff = pos;
+}
+
+static int _cl5ReadVarint (PRUint32 *val, const char **buff, const char *end)
+{
+	const char *pos = *buff;
+	PRUint32 v = 0;
+	int shift;
+
+	for (shift = 0; shift < 7 * CL5_VARINT_MAX && pos < end; shift += 7)
+	{
+		PRUint8 b = (PRUint8)(*pos);
+
+		pos ++;
+		v |= (PRUint32)(b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+		{
+			*val = v;
+			*buff = pos;
+			return CL5_SUCCESS;
+		}
+	}
+
+	return CL5_BAD_FORMAT;
+}
+
+/* a string takes at most a varint size, its characters and a null char */
+static int _cl5GetStringSize (const char *str)
+{
+	return CL5_VARINT_MAX + (str ? strlen (str) + 1 : 0);
+}
+
 static void _cl5WriteString (const char *str, char **buff)
 {
-	if (str)
+	PRUint32 size = (str && *str) ? strlen (str) + 1 : 0;
+
+	_cl5WriteVarint (size, buff);
+	if (size)
+	{
+		memcpy (*buff, str, size);
+		(*buff) += size;
+	}
+}
+
+/* returns a pointer into the record buffer, or NULL for an empty string */
+static int _cl5ReadStringRef (const char **str, const char **buff, const char *end)
+{
+	PRUint32 size;
+
+	if (_cl5ReadVarint (&size, buff, end) != CL5_SUCCESS ||
+		size > (PRUint32)(end - *buff) ||
+		(size && (*buff)[size - 1] != '\0'))
 	{
-		strcpy (*buff, str); 
-		(*buff) += strlen (str) + 1;
+		return CL5_BAD_FORMAT;
 	}
-	else /* just write NULL char */
+
+	*str = size ? *buff : NULL;
+	(*buff) += size;
+
+	return CL5_SUCCESS;
+}
+
+static void _cl5WriteCSN (const CSN *csn, char **buff)
+{
+	PRUint32 t = PR_htonl ((PRUint32)csn_get_time (csn));
+	PRUint16 seqnum = PR_htons (csn_get_seqnum (csn));
+	PRUint16 rid = PR_htons (csn_get_replicaid (csn));
+	PRUint16 subseqnum = PR_htons (csn_get_subseqnum (csn));
+	char *pos = *buff;
+
+	memcpy (pos, &t, sizeof (t));
+	pos += sizeof (t);
+	memcpy (pos, &seqnum, sizeof (seqnum));
+	pos += sizeof (seqnum);
+	memcpy (pos, &rid, sizeof (rid));
+	pos += sizeof (rid);
+	memcpy (pos, &subseqnum, sizeof (subseqnum));
+	pos += sizeof (subseqnum);
+
+	*buff = pos;
+}
+
+/* as for V_5 records, a csn the caller passes in is only replaced, never
+   freed, when the record holds a different one */
+static int _cl5ReadCSN (CSN **csn, const char **buff, const char *end)
+{
+	PRUint32 t;
+	PRUint16 seqnum, rid, subseqnum;
+	const char *pos = *buff;
+
+	if (end - pos < CL5_CSN_SIZE)
 	{
-		(**buff) = '\0';
-		(*buff) ++;
+		return CL5_BAD_FORMAT;
 	}
+
+	/* copy first, to skirt around alignment problems on certain architectures */
+	memcpy (&t, pos, sizeof (t));
+	pos += sizeof (t);
+	memcpy (&seqnum, pos, sizeof (seqnum));
+	pos += sizeof (seqnum);
+	memcpy (&rid, pos, sizeof (rid));
+	pos += sizeof (rid);
+	memcpy (&subseqnum, pos, sizeof (subseqnum));
+	pos += sizeof (subseqnum);
+	t = PR_ntohl (t);
+	seqnum = PR_ntohs (seqnum);
+	rid = PR_ntohs (rid);
+	subseqnum = PR_ntohs (subseqnum);
+
+	if (*csn == NULL ||
+		csn_get_time (*csn) != (time_t)t ||
+		csn_get_seqnum (*csn) != seqnum ||
+		csn_get_replicaid (*csn) != rid ||
+		csn_get_subseqnum (*csn) != subseqnum)
+	{
+		*csn = csn_new ();
+		csn_set_time (*csn, (time_t)t);
+		csn_set_seqnum (*csn, seqnum);
+		csn_set_replicaid (*csn, rid);
+		csn_set_subseqnum (*csn, subseqnum);
+	}
+
+	*buff = pos;
+	return CL5_SUCCESS;
+}
+
+static int _cl5InternedTypeIndex (const char *type)
+{
+	int i;
+
+	for (i = 0; s_cl5InternedTypes[i]; i++)
+	{
+		if (strcasecmp (type, s_cl5InternedTypes[i]) == 0)
+		{
+			return i;
+		}
+	}
+
+	return -1;
 }
 
+static void _cl5WriteType (const char *type, char **buff)
+{
+	int i = _cl5InternedTypeIndex (type);
+
+	if (i >= 0)
+	{
+		_cl5WriteVarint ((PRUint32)i + 1, buff);
+	}
+	else
+	{
+		_cl5WriteVarint (0, buff);
+		_cl5WriteString (type, buff);
+	}
+}
+
+static int _cl5ReadType (const char **type, const char **buff, const char *end)
+{
+	PRUint32 i;
+
+	if (_cl5ReadVarint (&i, buff, end) != CL5_SUCCESS)
+	{
+		return CL5_BAD_FORMAT;
+	}
+
+	if (i == 0)
+	{
+		return _cl5ReadStringRef (type, buff, end);
+	}
+
+	if (i > sizeof (s_cl5InternedTypes) / sizeof (s_cl5InternedTypes[0]) - 1)
+	{
+		return CL5_BAD_FORMAT;
+	}
+
+	*type = s_cl5InternedTypes[i - 1];
+	return CL5_SUCCESS;
+}
+
+static void _cl5WriteValue (const struct berval *bv, char **buff)
+{
+	_cl5WriteVarint ((PRUint32)bv->bv_len, buff);
+	if (bv->bv_len)
+	{
+		memcpy (*buff, bv->bv_val, bv->bv_len);
+		(*buff) += bv->bv_len;
+	}
+}
+
+static int _cl5ReadModsV6 (LDAPMod ***mods, const char **buff, const char *end)
+{
+	PRUint32 i;
+	PRUint32 mod_count;
+	int rc;
+	Slapi_Mods smods;
+	Slapi_Mod smod;
+
+	/* a mod takes at least 3 bytes, which bounds the count we preallocate for */
+	if (_cl5ReadVarint (&mod_count, buff, end) != CL5_SUCCESS ||
+		mod_count > (PRUint32)(end - *buff) / 3)
+	{
+		return CL5_BAD_FORMAT;
+	}
+
+	slapi_mods_init (&smods, mod_count);
+
+	for (i = 0; i < mod_count; i++)
+	{
+		rc = _cl5ReadModV6 (&smod, buff, end);
+		if (rc != CL5_SUCCESS)
+		{
+			slapi_mods_done (&smods);
+			return rc;
+		}
+
+		slapi_mods_add_smod (&smods, &smod);
+	}
+
+	*mods = slapi_mods_get_ldapmods_passout (&smods);
+	slapi_mods_done (&smods);
+
+	return CL5_SUCCESS;
+}
+
+static int _cl5ReadModV6 (Slapi_Mod *smod, const char **buff, const char *end)
+{
+	const char *pos = *buff;
+	const char *type = NULL;
+	PRUint32 i;
+	PRUint32 val_count;
+	PRUint32 val_len;
+	int op;
+	struct berval bv;
+
+	if (pos >= end)
+	{
+		return CL5_BAD_FORMAT;
+	}
+	op = (*pos) & 0x000000FF;
+	pos ++;
+
+	/* every value takes at least a byte */
+	if (_cl5ReadType (&type, &pos, end) != CL5_SUCCESS || type == NULL ||
+		_cl5ReadVarint (&val_count, &pos, end) != CL5_SUCCESS ||
+		val_count > (PRUint32)(end - pos))
+	{
+		return CL5_BAD_FORMAT;
+	}
+
+	slapi_mod_init (smod, val_count);
+	slapi_mod_set_operation (smod, op|LDAP_MOD_BVALUES); 
+	slapi_mod_set_type (smod, type);
+
+	for (i = 0; i < val_count; i++)
+	{
+		if (_cl5ReadVarint (&val_len, &pos, end) != CL5_SUCCESS ||
+			val_len > (PRUint32)(end - pos))
+		{
+			slapi_mod_done (smod);
+			return CL5_BAD_FORMAT;
+		}
+		bv.bv_len = val_len;
+		bv.bv_val = val_len ? (char *)pos : NULL;
+		pos += val_len;
+
+		_cl5AddDecryptedValue (smod, &bv);
+	}
+
+	(*buff) = pos;
+
+	return CL5_SUCCESS;
+}
+
+/* V_5 strings are null terminated */
 static void _cl5ReadString (char **str, char **buff)
 {
 	if (str)
@@ -2458,36 +2961,37 @@ static void _cl5ReadString (char **str, char **buff)
 
 /* mods format:
    -----------
-   <4 byte mods count><mod1><mod2>...
+   <varint mods count><mod1><mod2>...
 
    mod format:
    -----------
-   <1 byte modop><null terminated attr name><4 byte count>
-   <4 byte size><value1><4 byte size><value2>... 
+   <1 byte modop><varint attr type><varint count>
+   <varint size><value1><varint size><value2>... 
  */
 static void _cl5WriteMods (LDAPMod **mods, char **buff)
 {	
 	PRInt32 i;
+	char *mods_start;
 	char *mod_start;
-	PRInt32 count = 0;
+	PRUint32 count = 0;
+	int count_size;
 
-	if (mods == NULL)
-		return;
-	
-	/* skip mods count */
-	mod_start = (*buff) + sizeof (count);
+	/* the count is only known once the mods are written: write them after
+	   the largest possible count and move them next to it afterwards */
+	mods_start = mod_start = (*buff) + CL5_VARINT_MAX;
 
 	/* write mods*/
-	for (i = 0; mods[i]; i++) {
+	for (i = 0; mods && mods[i]; i++) {
 		if (0 <= _cl5WriteMod (mods[i], &mod_start)) {
 			count++;
 		}
 	}
 
-	count = PR_htonl(count);
-	memcpy (*buff, &count, sizeof (count));	
+	count_size = _cl5VarintSize (count);
+	memmove ((*buff) + count_size, mods_start, mod_start - mods_start);
+	_cl5WriteVarint (count, buff);
 	
-	(*buff) = mod_start;
+	(*buff) += mod_start - mods_start;
 }
 
 /*
@@ -2501,7 +3005,6 @@ _cl5WriteMod (LDAPMod *mod, char **buff)
 {
 	char *orig_pos;
 	char *pos;
-	PRInt32 count;
 	struct berval *bv;
 	struct berval *encbv;
 	struct berval *bv_to_use;
@@ -2524,13 +3027,11 @@ _cl5WriteMod (LDAPMod *mod, char **buff)
 	/* write mod op */
 	*pos = (PRUint8)slapi_mod_get_operation (&smod);
 	pos ++;
-	/* write attribute name	*/
-	_cl5WriteString (slapi_mod_get_type (&smod), &pos);
+	/* write attribute type */
+	_cl5WriteType (slapi_mod_get_type (&smod), &pos);
 	
 	/* write value count */
-	count = PR_htonl(slapi_mod_get_num_values(&smod));
-	memcpy (pos, &count, sizeof (count));
-	pos += sizeof (PRInt32);
+	_cl5WriteVarint ((PRUint32)slapi_mod_get_num_values(&smod), &pos);
 
 	/* if the mod has no values, eg delete attr or replace attr without values 
 	 * do not reset buffer
@@ -2558,7 +3059,7 @@ _cl5WriteMod (LDAPMod *mod, char **buff)
 			break;
 		}
 		if (bv_to_use) {
-			_cl5WriteBerval (bv_to_use, &pos);
+			_cl5WriteValue (bv_to_use, &pos);
 		}
 		slapi_ch_bvfree(&encbv);
 		bv = slapi_mod_get_next_value (&smod);
@@ -2630,9 +3131,6 @@ static int _cl5ReadMod (Slapi_Mod *smod, char **buff)
 	char *type;
 	int op;
 	struct berval bv;
-	struct berval *decbv;
-	struct berval *bv_to_use;
-	int rc = 0;
 
 	op = (*pos) & 0x000000FF;
 	pos ++;
@@ -2652,39 +3150,7 @@ static int _cl5ReadMod (Slapi_Mod *smod, char **buff)
 	for (i = 0; i < val_count; i++)
 	{
 		_cl5ReadBerval (&bv, &pos);
-		decbv = NULL;
-		rc = 0;
-		rc = clcrypt_decrypt_value(s_cl5Desc.clcrypt_handle,
-		                           &bv, &decbv);
-		if (rc > 0) {
-			/* not encrypted. use the original bv */
-			bv_to_use = &bv;
-		} else if ((0 == rc) && decbv) {
-			/* successfully decrypted. use the decrypted bv */
-			bv_to_use = decbv;
-		} else { /* failed */
-			char encstr[128];
-			char *encend = encstr + 128;
-			char *ptr;
-			int i;
-			for (i = 0, ptr = encstr; (i < bv.bv_len) && (ptr < encend - 4);
-				 i++, ptr += 3) {
-				sprintf(ptr, "%x", 0xff & bv.bv_val[i]);
-			}
-			if (ptr >= encend - 4) {
-				sprintf(ptr, "...");
-				ptr += 3;
-			}
-			*ptr = '\0';
-			slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
-						"_cl5ReadMod: decrypting \"%s: %s\" failed\n",
-						slapi_mod_get_type(smod), encstr);
-			bv_to_use = NULL;
-		}
-		if (bv_to_use) {
-			slapi_mod_add_value (smod, bv_to_use);
-		}
-		slapi_ch_bvfree(&decbv);
+		_cl5AddDecryptedValue (smod, &bv);
 		slapi_ch_free((void **) &bv.bv_val);
 	}
 
@@ -2693,16 +3159,55 @@ static int _cl5ReadMod (Slapi_Mod *smod, char **buff)
 	return CL5_SUCCESS;
 }
 
+/* adds a copy of the value read from the changelog to the mod, decrypting
+   it first if the changelog is encrypted */
+static void _cl5AddDecryptedValue (Slapi_Mod *smod, struct berval *bv)
+{
+	struct berval *decbv = NULL;
+	struct berval *bv_to_use;
+	int rc;
+
+	rc = clcrypt_decrypt_value(s_cl5Desc.clcrypt_handle,
+	                           bv, &decbv);
+	if (rc > 0) {
+		/* not encrypted. use the original bv */
+		bv_to_use = bv;
+	} else if ((0 == rc) && decbv) {
+		/* successfully decrypted. use the decrypted bv */
+		bv_to_use = decbv;
+	} else { /* failed */
+		char encstr[128];
+		char *encend = encstr + 128;
+		char *ptr;
+		int i;
+		for (i = 0, ptr = encstr; (i < bv->bv_len) && (ptr < encend - 4);
+			 i++, ptr += 3) {
+			sprintf(ptr, "%x", 0xff & bv->bv_val[i]);
+		}
+		if (ptr >= encend - 4) {
+			sprintf(ptr, "...");
+			ptr += 3;
+		}
+		*ptr = '\0';
+		slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
+					"_cl5ReadMod: decrypting \"%s: %s\" failed\n",
+					slapi_mod_get_type(smod), encstr);
+		bv_to_use = NULL;
+	}
+	if (bv_to_use) {
+		slapi_mod_add_value (smod, bv_to_use);
+	}
+	slapi_ch_bvfree(&decbv);
+}
+
 static int _cl5GetModsSize (LDAPMod **mods)
 {
 	int size;
 	int i;
 
-	if (mods == NULL)
-		return 0;
-
-	size = sizeof (PRInt32);
-	for (i=0; mods[i]; i++)
+	/* the count is written even when there are no mods */
+	size = CL5_VARINT_MAX;
+	for (i=0; mods && mods[i]; i++)
 	{
 		size += _cl5GetModSize (mods[i]);
 	}
@@ -2715,13 +3220,14 @@ static int _cl5GetModSize (LDAPMod *mod)
 	int size;
 	int i;
 
-	size = 1 + strlen (mod->mod_type) + 1 + sizeof (mod->mod_op);
+	/* modop, attr type tag (and name if not interned), value count */
+	size = 1 + 1 + _cl5GetStringSize (mod->mod_type) + CL5_VARINT_MAX;
 	i = 0;
 	if (mod->mod_op & LDAP_MOD_BVALUES) /* values are in binary form */
 	{
 		while (mod->mod_bvalues != NULL && mod->mod_bvalues[i] != NULL)
 		{
-			size += (PRInt32)mod->mod_bvalues[i]->bv_len + sizeof (PRInt32);
+			size += (PRInt32)mod->mod_bvalues[i]->bv_len + CL5_VARINT_MAX;
 			i++;
 		}
 	}
@@ -3384,8 +3890,9 @@ static int _cl5TrimInit ()
 {
 	/* just create the lock while we are singlethreaded */
 	s_cl5Desc.dbTrim.lock = PR_NewLock();
+	s_cl5Desc.dbTrim.statLock = PR_NewLock();
 
-	if (s_cl5Desc.dbTrim.lock == NULL)
+	if (s_cl5Desc.dbTrim.lock == NULL || s_cl5Desc.dbTrim.statLock == NULL)
 	{
 		slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name_cl, 
 						"_cl5InitTrimming: failed to create lock; NSPR error - %d\n",
@@ -3402,6 +3909,8 @@ static void _cl5TrimCleanup ()
 {
 	if (s_cl5Desc.dbTrim.lock)
 		PR_DestroyLock (s_cl5Desc.dbTrim.lock);
+	if (s_cl5Desc.dbTrim.statLock)
+		PR_DestroyLock (s_cl5Desc.dbTrim.statLock);
 
 	memset (&s_cl5Desc.dbTrim, 0, sizeof (s_cl5Desc.dbTrim));
 }
@@ -3411,13 +3920,16 @@ static int _cl5TrimMain (void *param)
 	time_t timePrev = current_time ();
 	time_t timeCompactPrev = current_time ();
 	time_t timeNow;
+	PRIntervalTime passStart, spent, wait;
 
 	PR_AtomicIncrement (&s_cl5Desc.threadCount);
 
 	while (s_cl5Desc.dbState != CL5_STATE_CLOSING)
 	{
 		timeNow = current_time ();
-		if (timeNow - timePrev >= s_cl5Desc.dbTrim.trimInterval)
+		passStart = PR_IntervalNow ();
+		if (s_cl5Desc.dbTrim.backlog ||
+		    (timeNow - timePrev >= s_cl5Desc.dbTrim.trimInterval))
 		{
 			/* time to trim */
 			timePrev = timeNow; 
@@ -3436,8 +3948,20 @@ static int _cl5TrimMain (void *param)
 			break;
 		}
 		
+		/* with a trimming rate, come back at the next second as long
+		 * as changes are waiting for the budget */
+		if (s_cl5Desc.dbTrim.backlog)
+		{
+			spent = PR_IntervalNow () - passStart;
+			wait = PR_SecondsToInterval (1);
+			wait = (spent < wait) ? wait - spent : PR_INTERVAL_NO_WAIT;
+		}
+		else
+		{
+			wait = PR_SecondsToInterval (s_cl5Desc.dbTrim.trimInterval);
+		}
 		PR_Lock(s_cl5Desc.clLock);
-		PR_WaitCondVar(s_cl5Desc.clCvar, PR_SecondsToInterval(s_cl5Desc.dbTrim.trimInterval));
+		PR_WaitCondVar(s_cl5Desc.clCvar, wait);
 		PR_Unlock(s_cl5Desc.clLock);
 	}
 
@@ -3459,16 +3983,24 @@ static int _cl5TrimMain (void *param)
    To update the consumer, the supplier would attempt to locate
    the last change sent to the consumer in the changelog and will
    fail because the change was removed.
-    
+
+   When a trimming rate is configured, a pass trims at most one second
+   worth of changes, spread over that second; the trimming thread comes
+   back a second later as long as changes are left behind.
  */
 
 static void _cl5DoTrimming (ReplicaId rid)
 {
 	Object *obj;
 	long numToTrim;
+	long budget, lag = 0;
+	PRUint64 trimmed = 0;
+	time_t start = current_time ();
 
 	PR_Lock (s_cl5Desc.dbTrim.lock);
 
+	budget = (s_cl5Desc.dbTrim.trimRate > 0 && !rid) ? s_cl5Desc.dbTrim.trimRate : -1;
+
 	/* ONREPL We trim file by file which means that some files will be 
 	   trimmed more often than other. We might have to fix that by, for 
 	   example, randomizing starting point */
@@ -3482,7 +4014,7 @@ static void _cl5DoTrimming (ReplicaId rid)
 			 */
 			_cl5PurgeRID (obj, rid);
 		} else {
-			_cl5TrimFile (obj, &numToTrim);
+			trimmed += _cl5TrimFile (obj, &numToTrim, &budget, &lag);
 		}
 		obj = objset_next_obj (s_cl5Desc.dbFiles, obj);
 	}
@@ -3490,31 +4022,41 @@ static void _cl5DoTrimming (ReplicaId rid)
 	if (obj)
 		object_release (obj);
 
+	if (!rid)
+	{
+		s_cl5Desc.dbTrim.backlog = (lag > 0);
+		PR_Lock (s_cl5Desc.dbTrim.statLock);
+		s_cl5Desc.dbTrim.lag = lag;
+		if (trimmed > 0)
+		{
+			time_t elapsed = current_time () - start;
+			s_cl5Desc.dbTrim.trimmed += trimmed;
+			s_cl5Desc.dbTrim.lastRate = (long)(trimmed / (elapsed > 0 ? elapsed : 1));
+		}
+		PR_Unlock (s_cl5Desc.dbTrim.statLock);
+	}
+
 	PR_Unlock (s_cl5Desc.dbTrim.lock);
 
 	return;
 }
 
-/* clear free page files to reduce changelog */
+/* clear free page files to reduce changelog
+ * Each file is compacted in its own transaction, so that the pages of
+ * one replicated area are not locked while the others are compacted. */
 static void
 _cl5CompactDBs()
 {
 #if 1000*DB_VERSION_MAJOR + 100*DB_VERSION_MINOR >= 4400
-	int rc;
+	int rc = 0;
 	Object *fileObj = NULL;
 	CL5DBFile *dbFile = NULL;
 	DB *db = NULL;
 	DB_TXN *txnid = NULL;
-	DB_COMPACT c_data = {0};
+	DB_COMPACT c_data;
+	u_int32_t pagesize;
 
 	PR_Lock (s_cl5Desc.dbTrim.lock);
-	rc = TXN_BEGIN(s_cl5Desc.dbEnv, NULL, &txnid, 0);
-	if (rc) {
-		slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
-		    "_cl5CompactDBs: failed to begin transaction; db error - %d %s\n", 
-		    rc, db_strerror(rc));
-		goto bail;
-	}
 	for (fileObj = objset_first_obj(s_cl5Desc.dbFiles);
 	     fileObj;
 	     fileObj = objset_next_obj(s_cl5Desc.dbFiles, fileObj)) {
@@ -3523,36 +4065,47 @@ _cl5CompactDBs()
 			continue;
 		}
 		db = dbFile->db;
+		memset(&c_data, 0, sizeof(c_data));
+		rc = TXN_BEGIN(s_cl5Desc.dbEnv, NULL, &txnid, 0);
+		if (rc) {
+			slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
+			    "_cl5CompactDBs: failed to begin transaction; db error - %d %s\n", 
+			    rc, db_strerror(rc));
+			break;
+		}
 		rc = db->compact(db, txnid, NULL/*start*/, NULL/*stop*/, 
 		                 &c_data, DB_FREE_SPACE, NULL/*end*/); 
 		if (rc) {
 			slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
 			    "_cl5CompactDBs: failed to compact %s; db error - %d %s\n", 
 			    dbFile->replName, rc, db_strerror(rc));
-			goto bail;
-		}
-		slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name_cl, 
-		        "_cl5CompactDBs: %s - %d pages freed\n", 
-		        dbFile->replName, c_data.compact_pages_free);
-	}
-bail:
-	if (fileObj) {
-		object_release(fileObj);
-	}
-	if (rc) {
-		rc = TXN_ABORT (txnid);
-		if (rc) {
-			slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
-			    "_cl5CompactDBs: failed to abort transaction; db error - %d %s\n",
-			    rc, db_strerror(rc));
+			rc = TXN_ABORT (txnid);
+			if (rc) {
+				slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
+				    "_cl5CompactDBs: failed to abort transaction; db error - %d %s\n",
+				    rc, db_strerror(rc));
+			}
+			break;
 		}
-	} else {
 		rc = TXN_COMMIT (txnid, 0);
 		if (rc) {
 			slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl, 
 			    "_cl5CompactDBs: failed to commit transaction; db error - %d %s\n",
 			    rc, db_strerror(rc));
+			break;
+		}
+		if (db->get_pagesize(db, &pagesize)) {
+			pagesize = 0;
 		}
+		PR_Lock (s_cl5Desc.dbTrim.statLock);
+		s_cl5Desc.dbTrim.reclaimed += (PRUint64)c_data.compact_pages_truncated * pagesize;
+		PR_Unlock (s_cl5Desc.dbTrim.statLock);
+		slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name_cl, 
+		        "_cl5CompactDBs: %s - %d pages freed, %d pages returned to the filesystem\n", 
+		        dbFile->replName, c_data.compact_pages_free, c_data.compact_pages_truncated);
+	}
+	if (fileObj) {
+		object_release(fileObj);
 	}
 	PR_Unlock (s_cl5Desc.dbTrim.lock);
 
@@ -3901,10 +4454,16 @@ _cl5PurgeRID(Object *obj,  ReplicaId cleaned_rid)
 
 /* Note that each file contains changes for a single replicated area.
    trimming algorithm:
+   budget is the number of changes this pass may still trim, or negative
+   for no limit. When it runs out before the end of the trimmable changes,
+   lag is set to the age of the first change left behind.
+   Called with dbTrim.lock held; the lock is dropped while a rate limited
+   pass pauses between transactions.
+   Returns the number of changes trimmed.
 */
 #define CL5_TRIM_MAX_PER_TRANSACTION 10
 
-static void _cl5TrimFile (Object *obj, long *numToTrim)
+static int _cl5TrimFile (Object *obj, long *numToTrim, long *budget, long *lag)
 {
 	DB_TXN *txnid;
 	RUV *ruv = NULL;
@@ -3923,7 +4482,7 @@ static void _cl5TrimFile (Object *obj, long *numToTrim)
 	rc = _cl5GetRUV2Purge2 (obj, &ruv);
 	if (rc != CL5_SUCCESS || ruv == NULL)
 	{
-		return;
+		return 0;
 	}
 
 	entry.op = &op;
@@ -3965,6 +4524,22 @@ static void _cl5TrimFile (Object *obj, long *numToTrim)
 			if ( (*numToTrim > 0 || _cl5CanTrim (entry.time, numToTrim)) &&
 				 ruv_covers_csn_strict (ruv, op.csn) )
 			{
+				if (*budget == 0)
+				{
+					/* out of budget - leave it for the next pass */
+					time_t age = current_time () - entry.time;
+					if (age > *lag)
+					{
+						*lag = age;
+					}
+					if (*lag <= 0)
+					{
+						*lag = 1;
+					}
+					finished = 1;
+					cl5_operation_parameters_done (&op);
+					break;
+				}
 				rc = _cl5CurrentDeleteEntry (it);
 				if ( rc == CL5_SUCCESS)
 				{
@@ -3973,6 +4548,7 @@ static void _cl5TrimFile (Object *obj, long *numToTrim)
 				if ( rc == CL5_SUCCESS)
 				{
 					if (*numToTrim > 0) (*numToTrim)--;
+					if (*budget > 0) (*budget)--;
 					count++;
 				}
 				else
@@ -4054,6 +4630,17 @@ static void _cl5TrimFile (Object *obj, long *numToTrim)
 			else
 			{
 				totalTrimmed += count;
+				/* spread a rate limited pass over its second; the trimming
+				 * lock is released meanwhile so that the configuration can
+				 * be changed and the changelog purged */
+				if (!finished && count > 0 && *budget > 0 && s_cl5Desc.dbTrim.trimRate > 0)
+				{
+					PRIntervalTime pause = PR_MillisecondsToInterval (count * 1000 / s_cl5Desc.dbTrim.trimRate);
+
+					PR_Unlock (s_cl5Desc.dbTrim.lock);
+					DS_Sleep (pause);
+					PR_Lock (s_cl5Desc.dbTrim.lock);
+				}
 			}
 		}
 
@@ -4066,6 +4653,7 @@ static void _cl5TrimFile (Object *obj, long *numToTrim)
 	{
 		slapi_log_error (SLAPI_LOG_REPL, NULL, "Trimmed %d changes from the changelog\n", totalTrimmed);
 	}
+	return totalTrimmed;
 }
 
 static PRBool _cl5CanTrim (time_t time, long *numToTrim)
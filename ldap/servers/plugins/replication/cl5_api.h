@@ -245,11 +245,24 @@ int cl5GetState ();
    Parameters:  maxEntries - maximum number of entries in the log;
 				maxAge - maximum entry age;
 				compactInterval - interval to compact changelog db;
-				trimInterval - interval for changelog trimming.
+				trimInterval - interval for changelog trimming;
+				trimRate - maximum number of changes trimmed per second, 0 if unlimited.
    Return:		CL5_SUCCESS if successful;
 				CL5_BAD_STATE if changelog has not been open
  */
-int cl5ConfigTrimming (int maxEntries, const char *maxAge, int compactInterval, int trimInterval);
+int cl5ConfigTrimming (int maxEntries, const char *maxAge, int compactInterval, int trimInterval,
+                       int trimRate);
+
+/* Name:		cl5GetTrimStats
+   Description:	returns the changelog trimming statistics
+   Parameters:  trimmed - number of changes trimmed since startup;
+				rate - changes trimmed per second during the last pass;
+				lag - age in seconds of the oldest change left for the next pass
+				      by the trimming rate;
+				reclaimed - bytes returned to the filesystem by compaction.
+   Return:		none
+ */
+void cl5GetTrimStats (PRUint64 *trimmed, long *rate, long *lag, PRUint64 *reclaimed);
 
 /* Name:		cl5GetOperation
    Description:	retrieves operation specified by its csn and databaseid
@@ -37,6 +37,7 @@ static int changelog5_config_add (Slapi_PBlock *pb, Slapi_Entry* e, Slapi_Entry*
 static int changelog5_config_modify (Slapi_PBlock *pb, Slapi_Entry* e, Slapi_Entry* entryAfter, int *returncode, char *returntext, void *arg);
 static int changelog5_config_delete (Slapi_PBlock *pb, Slapi_Entry* e, Slapi_Entry* entryAfter, int *returncode, char *returntext, void *arg);
 static int dont_allow_that(Slapi_PBlock *pb, Slapi_Entry* entryBefore, Slapi_Entry* e, int *returncode, char *returntext, void *arg);
+static int changelog5_config_search (Slapi_PBlock *pb, Slapi_Entry* e, Slapi_Entry* entryAfter, int *returncode, char *returntext, void *arg);
 
 static void changelog5_extract_config(Slapi_Entry* entry, changelog5Config *config);
 static changelog5Config * changelog5_dup_config(changelog5Config *config);
@@ -69,6 +70,8 @@ int changelog5_config_init()
 								   CONFIG_FILTER, dont_allow_that, NULL);
     slapi_config_register_callback(SLAPI_OPERATION_DELETE, DSE_FLAG_PREOP, CONFIG_BASE, LDAP_SCOPE_BASE, 
 								   CONFIG_FILTER, changelog5_config_delete, NULL); 
+    slapi_config_register_callback(SLAPI_OPERATION_SEARCH, DSE_FLAG_PREOP, CONFIG_BASE, LDAP_SCOPE_BASE, 
+								   CONFIG_FILTER, changelog5_config_search, NULL); 
 
     return 0;
 }
@@ -83,6 +86,8 @@ void changelog5_config_cleanup()
 								   CONFIG_FILTER, dont_allow_that);
     slapi_config_remove_callback(SLAPI_OPERATION_DELETE, DSE_FLAG_PREOP, CONFIG_BASE, LDAP_SCOPE_BASE, 
 								   CONFIG_FILTER, changelog5_config_delete);
+    slapi_config_remove_callback(SLAPI_OPERATION_SEARCH, DSE_FLAG_PREOP, CONFIG_BASE, LDAP_SCOPE_BASE, 
+								   CONFIG_FILTER, changelog5_config_search);
 
 	if (s_configLock)
 	{
@@ -215,7 +220,8 @@ changelog5_config_add (Slapi_PBlock *pb, Slapi_Entry* e, Slapi_Entry* entryAfter
 	}
 
 	/* set trimming parameters */
-	rc = cl5ConfigTrimming (config.maxEntries, config.maxAge, config.compactInterval, config.trimInterval);
+	rc = cl5ConfigTrimming (config.maxEntries, config.maxAge, config.compactInterval, config.trimInterval,
+	                        config.trimRate);
 	if (rc != CL5_SUCCESS)
 	{
 		*returncode = 1;
@@ -311,6 +317,7 @@ changelog5_config_modify (Slapi_PBlock *pb, Slapi_Entry* entryBefore, Slapi_Entr
 	slapi_ch_free_string(&config.maxAge);
 	config.maxAge = slapi_ch_strdup(CL5_STR_IGNORE);
 	config.trimInterval = CL5_NUM_IGNORE;
+	config.trimRate = CL5_NUM_IGNORE;
 
 	slapi_pblock_get( pb, SLAPI_MODIFY_MODS, &mods );
     for (i = 0; mods && mods[i] != NULL; i++)
@@ -411,6 +418,24 @@ changelog5_config_modify (Slapi_PBlock *pb, Slapi_Entry* entryBefore, Slapi_Entr
                         goto done;
                     }
                 }
+                else if ( strcasecmp ( config_attr, CONFIG_CHANGELOG_TRIM_RATE_ATTRIBUTE ) == 0 )
+                {
+                    if (config_attr_value && config_attr_value[0] != '\0') {
+                        config.trimRate = atoi (config_attr_value);
+                    } else {
+                        config.trimRate = 0;
+                    }
+                    if (config.trimRate < 0) {
+                        if (returntext) {
+                            PR_snprintf(returntext, SLAPI_DSE_RETURNTEXT_SIZE,
+                                        "%s: invalid value \"%s\", %s must be 0 (unlimited) or a positive number of changes per second",
+                                        CONFIG_CHANGELOG_TRIM_RATE_ATTRIBUTE, config_attr_value,
+                                        CONFIG_CHANGELOG_TRIM_RATE_ATTRIBUTE);
+                        }
+                        *returncode = LDAP_UNWILLING_TO_PERFORM;
+                        goto done;
+                    }
+                }
                 else if ( strcasecmp ( config_attr, CONFIG_CHANGELOG_SYMMETRIC_KEY ) == 0 )
                 {
                     slapi_ch_free_string(&config.symmetricKey);
@@ -440,6 +465,8 @@ changelog5_config_modify (Slapi_PBlock *pb, Slapi_Entry* entryBefore, Slapi_Entr
 		config.compactInterval = originalConfig->compactInterval;
 	if (config.trimInterval == CL5_NUM_IGNORE)
 		config.trimInterval = originalConfig->trimInterval;
+	if (config.trimRate == CL5_NUM_IGNORE)
+		config.trimRate = originalConfig->trimRate;
 	if (strcmp (config.maxAge, CL5_STR_IGNORE) == 0) {
 		slapi_ch_free_string(&config.maxAge);
 		if (originalConfig->maxAge)
@@ -559,9 +586,11 @@ changelog5_config_modify (Slapi_PBlock *pb, Slapi_Entry* entryBefore, Slapi_Entr
 	/* one of the changelog parameters is modified */
 	if (config.maxEntries != CL5_NUM_IGNORE || 
 		config.trimInterval != CL5_NUM_IGNORE ||
+		config.trimRate != CL5_NUM_IGNORE ||
 		strcmp (config.maxAge, CL5_STR_IGNORE) != 0)
 	{
-		rc = cl5ConfigTrimming (config.maxEntries, config.maxAge, config.compactInterval, config.trimInterval);
+		rc = cl5ConfigTrimming (config.maxEntries, config.maxAge, config.compactInterval, config.trimInterval,
+	                        config.trimRate);
 		if (rc != CL5_SUCCESS)
 		{
 			*returncode = 1;
@@ -702,6 +731,26 @@ done:;
 	return SLAPI_DSE_CALLBACK_ERROR;
 }
 
+/*
+ * Add the changelog trimming statistics to the changelog entry
+ */
+static int
+changelog5_config_search (Slapi_PBlock *pb, Slapi_Entry* e, Slapi_Entry* entryAfter,
+						  int *returncode, char *returntext, void *arg)
+{
+	PRUint64 trimmed, reclaimed;
+	long rate, lag;
+
+	cl5GetTrimStats (&trimmed, &rate, &lag, &reclaimed);
+	slapi_entry_attr_set_longlong (e, "nsds5ChangelogTrimmedChanges", (long long)trimmed);
+	slapi_entry_attr_set_long (e, "nsds5ChangelogTrimRate", rate);
+	slapi_entry_attr_set_long (e, "nsds5ChangelogTrimLag", lag);
+	slapi_entry_attr_set_longlong (e, "nsds5ChangelogReclaimedBytes", (long long)reclaimed);
+
+	*returncode = LDAP_SUCCESS;
+	return SLAPI_DSE_CALLBACK_OK;
+}
+
 static int dont_allow_that(Slapi_PBlock *pb, Slapi_Entry* entryBefore, Slapi_Entry* e, 
 						   int *returncode, char *returntext, void *arg)
 {
@@ -721,6 +770,7 @@ static changelog5Config * changelog5_dup_config(changelog5Config *config)
 	dup->maxEntries = config->maxEntries;
 	dup->compactInterval = config->compactInterval;
 	dup->trimInterval = config->trimInterval;
+	dup->trimRate = config->trimRate;
 
 	dup->dbconfig.pageSize = config->dbconfig.pageSize;
 	dup->dbconfig.fileMode = config->dbconfig.fileMode;
@@ -782,6 +832,19 @@ static void changelog5_extract_config(Slapi_Entry* entry, changelog5Config *conf
 		config->trimInterval = CHANGELOGDB_TRIM_INTERVAL;
 	}
 
+	arg = slapi_entry_attr_get_charptr(entry, CONFIG_CHANGELOG_TRIM_RATE_ATTRIBUTE);
+	if (arg)
+	{
+		config->trimRate = atoi (arg);
+		if (config->trimRate < 0) {
+			slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name_cl,
+				"changelog5_extract_config: %s: invalid value \"%s\", trimming is not rate limited.\n",
+				CONFIG_CHANGELOG_TRIM_RATE_ATTRIBUTE, arg);
+			config->trimRate = 0;
+		}
+		slapi_ch_free_string(&arg);
+	}
+
 	arg = slapi_entry_attr_get_charptr(entry, CONFIG_CHANGELOG_MAXAGE_ATTRIBUTE);
 	if (arg) {
 		if (slapi_is_duration_valid(arg)) {
@@ -64,6 +64,15 @@
  * new set of start and response extops. */
 #define REPL_START_NSDS90_REPLICATION_REQUEST_OID "2.16.840.1.113730.3.5.12"
 #define REPL_NSDS90_REPLICATION_RESPONSE_OID "2.16.840.1.113730.3.5.13"
+/* Batched incremental update: a single extop carries several changes that
+ * the consumer applies in one backend transaction, and acknowledges with
+ * one response */
+#define REPL_NSDS95_REPLICATION_BATCH_REQUEST_OID "2.16.840.1.113730.3.5.14"
+#define REPL_NSDS95_REPLICATION_BATCH_RESPONSE_OID "2.16.840.1.113730.3.5.15"
+/* Parallel total update: same as the NSDS50 entry request, with a sequence
+ * number so that the consumer can put back in order the entries received
+ * on several connections */
+#define REPL_NSDS95_REPLICATION_ENTRY_STREAM_REQUEST_OID "2.16.840.1.113730.3.5.16"
 /* cleanallruv extended ops */
 #define REPL_CLEANRUV_OID "2.16.840.1.113730.3.6.5"
 #define REPL_ABORT_CLEANRUV_OID "2.16.840.1.113730.3.6.6"
@@ -140,6 +149,9 @@ extern const char *type_nsds5ReplicaEnabled;
 extern const char *type_nsds5ReplicaStripAttrs;
 extern const char *type_nsds5ReplicaFlowControlWindow;
 extern const char *type_nsds5ReplicaFlowControlPause;
+extern const char *type_nsds5ReplicaFlowControlAdaptive;
+extern const char *type_nsds5ReplicaUpdateBatchSize;
+extern const char *type_nsds5ReplicaTotalUpdateStreams;
 extern const char *type_replicaProtocolTimeout;
 extern const char *type_replicaBackoffMin;
 extern const char *type_replicaBackoffMax;
@@ -223,6 +235,19 @@ char* get_thread_private_agmtname ();
 void  set_thread_private_agmtname (const char *agmtname);
 void* get_thread_private_cache ();
 void  set_thread_private_cache (void *buf);
+/*
+ * A batched update being applied by the consumer. The RUV is not updated
+ * as each change is applied but once the batch transaction is committed:
+ * the changes leave their CSNs here.
+ */
+typedef struct repl_batch_context {
+	void *connext;	/* consumer_connection_extension* of the session */
+	CSN **csns;
+	int ncsns;
+	int maxcsns;
+} repl_batch_context;
+repl_batch_context* get_thread_private_batch ();
+void  set_thread_private_batch (repl_batch_context *batch);
 char* get_repl_session_id (Slapi_PBlock *pb, char *id, CSN **opcsn);
 
 /* In repl_extop.c */
@@ -241,9 +266,19 @@ int decode_repl_ext_response(struct berval *bvdata, int *response_code,
 struct berval *NSDS90StartReplicationRequest_new(const char *protocol_oid,
         const char *repl_root, char **extra_referrals, CSN *csn,
 	const char *data_guid, const struct berval *data);
+int multimaster_extop_NSDS95ReplicationBatch(Slapi_PBlock *pb);
+BerElement *NSDS95ReplicationBatch_new(const char *repl_root);
+int NSDS95ReplicationBatch_add(BerElement *batch, unsigned long operation_type,
+	const char *dn, LDAPControl *update_control, LDAPMod **mods,
+	const char *newrdn, const char *newsuperior, int deleteoldrdn);
+struct berval *NSDS95ReplicationBatch_done(BerElement **batch);
+int decode_repl_batch_response(struct berval *bvdata, int *response_code,
+	int **results, int *nresults);
 
 /* In repl5_total.c */
 int multimaster_extop_NSDS50ReplicationEntry(Slapi_PBlock *pb);
+int repl_total_stream_begin(Slapi_PBlock *pb, const Slapi_DN *repl_root);
+void repl_total_stream_end(void *conn);
 
 /* In repl_controls.c */
 int create_NSDS50ReplUpdateInfoControl(const char *uuid,
@@ -307,6 +342,9 @@ long agmt_get_busywaittime(const Repl_Agmt *ra);
 long agmt_get_pausetime(const Repl_Agmt *ra);
 long agmt_get_flowcontrolwindow(const Repl_Agmt *ra);
 long agmt_get_flowcontrolpause(const Repl_Agmt *ra);
+int agmt_get_flowcontroladaptive(const Repl_Agmt *ra);
+long agmt_get_updatebatchsize(const Repl_Agmt *ra);
+long agmt_get_totalupdatestreams(const Repl_Agmt *ra);
 int agmt_start(Repl_Agmt *ra);
 int windows_agmt_start(Repl_Agmt *ra); 
 int agmt_stop(Repl_Agmt *ra);
@@ -329,6 +367,10 @@ int agmt_set_schedule_from_entry( Repl_Agmt *ra, const Slapi_Entry *e );
 int agmt_set_timeout_from_entry( Repl_Agmt *ra, const Slapi_Entry *e );
 int agmt_set_flowcontrolwindow_from_entry(Repl_Agmt *ra, const Slapi_Entry *e);
 int agmt_set_flowcontrolpause_from_entry(Repl_Agmt *ra, const Slapi_Entry *e);
+int agmt_set_flowcontroladaptive_from_entry(Repl_Agmt *ra, const Slapi_Entry *e);
+int agmt_set_updatebatchsize_from_entry(Repl_Agmt *ra, const Slapi_Entry *e);
+int agmt_set_totalupdatestreams_from_entry(Repl_Agmt *ra, const Slapi_Entry *e);
+void agmt_set_window_stats(Repl_Agmt *ra, long window, long in_flight, long peak, PRUint64 full_count, long rtt);
 int agmt_set_busywaittime_from_entry( Repl_Agmt *ra, const Slapi_Entry *e );
 int agmt_set_pausetime_from_entry( Repl_Agmt *ra, const Slapi_Entry *e );
 int agmt_set_credentials_from_entry( Repl_Agmt *ra, const Slapi_Entry *e );
@@ -429,7 +471,11 @@ typedef enum
 	CONN_IS_WIN2K3,
 	CONN_NOT_WIN2K3,
 	CONN_SUPPORTS_DS90_REPL,
-	CONN_DOES_NOT_SUPPORT_DS90_REPL
+	CONN_DOES_NOT_SUPPORT_DS90_REPL,
+	CONN_SUPPORTS_BATCH_REPL,
+	CONN_DOES_NOT_SUPPORT_BATCH_REPL,
+	CONN_SUPPORTS_TOTAL_STREAMS,
+	CONN_DOES_NOT_SUPPORT_TOTAL_STREAMS
 } ConnResult;
 
 char *conn_result2string (int result);
@@ -456,6 +502,8 @@ void conn_cancel_linger(Repl_Connection *conn);
 ConnResult conn_replica_supports_ds5_repl(Repl_Connection *conn);
 ConnResult conn_replica_supports_ds71_repl(Repl_Connection *conn);
 ConnResult conn_replica_supports_ds90_repl(Repl_Connection *conn);
+ConnResult conn_replica_supports_batch_repl(Repl_Connection *conn);
+ConnResult conn_replica_supports_total_streams(Repl_Connection *conn);
 ConnResult conn_replica_is_readonly(Repl_Connection *conn);
 
 ConnResult conn_read_entry_attribute(Repl_Connection *conn, const char *dn, char *type,
@@ -127,6 +127,22 @@ typedef struct repl5agmt {
 	Slapi_RWLock *attr_lock; /* RW lock for all the stripped attrs */
 	int WaitForAsyncResults; /* Pass to DS_Sleep(PR_MillisecondsToInterval(WaitForAsyncResults))
 	                          * in repl5_inc_waitfor_async_results */
+	int flowControlAdaptive; /* When set, the incremental protocol resizes its window of
+	                          * unacknowledged operations (up to flowControlWindow)
+	                          * from the measured consumer round trip time and result rate
+	                          */
+	long updateBatchSize; /* Maximum number of changes sent in one batched update
+	                       * extended operation, 0 or 1 to send each change
+	                       * as its own LDAP operation
+	                       */
+	long totalUpdateStreams; /* Number of connections used to send the entries
+	                          * of a total update
+	                          */
+	long window_size; /* current size of the incremental update window */
+	long window_in_flight; /* operations sent but not yet acknowledged */
+	long window_peak; /* highest number of operations in flight during the last session */
+	PRUint64 window_full_count; /* number of times the sender waited on a full window during the last session */
+	long window_rtt; /* smoothed consumer round trip time (msec) */
 } repl5agmt;
 
 /* Forward declarations */
@@ -349,6 +365,39 @@ agmt_new_from_entry(Slapi_Entry *e)
 		}
 	}
 
+	/* flow control adaptive window. */
+	ra->flowControlAdaptive = 0;
+	tmpstr = slapi_entry_attr_get_charptr(e, type_nsds5ReplicaFlowControlAdaptive);
+	if (tmpstr && (strcasecmp(tmpstr, "on") == 0)) {
+		ra->flowControlAdaptive = 1;
+	}
+	slapi_ch_free_string(&tmpstr);
+
+	/* batched incremental updates. */
+	ra->updateBatchSize = 0;
+	if (slapi_entry_attr_find(e, type_nsds5ReplicaUpdateBatchSize, &sattr) == 0)
+	{
+		Slapi_Value *sval;
+		if (slapi_attr_first_value(sattr, &sval) == 0)
+		{
+			ra->updateBatchSize = slapi_value_get_long(sval);
+		}
+	}
+
+	/* parallel total update. */
+	ra->totalUpdateStreams = 1;
+	if (slapi_entry_attr_find(e, type_nsds5ReplicaTotalUpdateStreams, &sattr) == 0)
+	{
+		Slapi_Value *sval;
+		if (slapi_attr_first_value(sattr, &sval) == 0)
+		{
+			long tmpval = slapi_value_get_long(sval);
+			if (tmpval > 0) {
+				ra->totalUpdateStreams = tmpval;
+			}
+		}
+	}
+
 	/* DN of entry at root of replicated area */
 	tmpstr = slapi_entry_attr_get_charptr(e, type_nsds5ReplicaRoot);
 	if (NULL != tmpstr)
@@ -1131,6 +1180,36 @@ agmt_get_flowcontrolpause(const Repl_Agmt *ra)
 	PR_Unlock(ra->lock);
 	return return_value;
 }
+int
+agmt_get_flowcontroladaptive(const Repl_Agmt *ra)
+{
+	int return_value;
+	PR_ASSERT(NULL != ra);
+	PR_Lock(ra->lock);
+	return_value = ra->flowControlAdaptive;
+	PR_Unlock(ra->lock);
+	return return_value;
+}
+long
+agmt_get_updatebatchsize(const Repl_Agmt *ra)
+{
+	long return_value;
+	PR_ASSERT(NULL != ra);
+	PR_Lock(ra->lock);
+	return_value = ra->updateBatchSize;
+	PR_Unlock(ra->lock);
+	return return_value;
+}
+long
+agmt_get_totalupdatestreams(const Repl_Agmt *ra)
+{
+	long return_value;
+	PR_ASSERT(NULL != ra);
+	PR_Lock(ra->lock);
+	return_value = ra->totalUpdateStreams;
+	PR_Unlock(ra->lock);
+	return return_value;
+}
 /*
  * Warning - reference to the long name of the agreement is returned.
  * The long name of an agreement is the DN of the agreement entry,
@@ -1997,6 +2076,153 @@ agmt_set_flowcontrolpause_from_entry(Repl_Agmt *ra, const Slapi_Entry *e)
 	return return_value;
 }
 
+/*
+ * Enable or disable the adaptive sizing of the incremental update window.
+ * A missing attribute disables it.
+ *
+ * Returns 0 if the setting was applied, or -1 if an error occurred.
+ */
+int
+agmt_set_flowcontroladaptive_from_entry(Repl_Agmt *ra, const Slapi_Entry *e)
+{
+	char *tmpstr = NULL;
+	int return_value = 0;
+
+	PR_ASSERT(NULL != ra);
+	PR_Lock(ra->lock);
+	if (ra->stop_in_progress)
+	{
+		PR_Unlock(ra->lock);
+		return -1;
+	}
+
+	tmpstr = slapi_entry_attr_get_charptr(e, type_nsds5ReplicaFlowControlAdaptive);
+	if (NULL == tmpstr || strcasecmp(tmpstr, "off") == 0) {
+		ra->flowControlAdaptive = 0;
+	} else if (strcasecmp(tmpstr, "on") == 0) {
+		ra->flowControlAdaptive = 1;
+	} else {
+		slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name, "agmt_set_flowcontroladaptive_from_entry: "
+		                "invalid value for %s (%s), value must be \"on\" or \"off\".\n",
+		                type_nsds5ReplicaFlowControlAdaptive, tmpstr);
+		return_value = -1;
+	}
+	PR_Unlock(ra->lock);
+	slapi_ch_free_string(&tmpstr);
+	if (return_value == 0)
+	{
+		prot_notify_agmt_changed(ra->protocol, ra->long_name);
+	}
+	return return_value;
+}
+
+/*
+ * Set or reset the maximum number of changes sent in one batched update.
+ * A missing attribute disables batching.
+ *
+ * Returns 0 if the batch size was set, or -1 if an error occurred.
+ */
+int
+agmt_set_updatebatchsize_from_entry(Repl_Agmt *ra, const Slapi_Entry *e)
+{
+	Slapi_Attr *sattr = NULL;
+	int return_value = -1;
+
+	PR_ASSERT(NULL != ra);
+	PR_Lock(ra->lock);
+	if (ra->stop_in_progress)
+	{
+		PR_Unlock(ra->lock);
+		return return_value;
+	}
+
+	slapi_entry_attr_find(e, type_nsds5ReplicaUpdateBatchSize, &sattr);
+	if (NULL != sattr)
+	{
+		Slapi_Value *sval = NULL;
+		slapi_attr_first_value(sattr, &sval);
+		if (NULL != sval)
+		{
+			long tmpval = slapi_value_get_long(sval);
+			if (tmpval >= 0) {
+				ra->updateBatchSize = tmpval;
+				return_value = 0; /* success! */
+			}
+		}
+	}
+	else
+	{
+		ra->updateBatchSize = 0;
+		return_value = 0;
+	}
+	PR_Unlock(ra->lock);
+	if (return_value == 0)
+	{
+		prot_notify_agmt_changed(ra->protocol, ra->long_name);
+	}
+	return return_value;
+}
+
+/*
+ * Set or reset the number of connections used by a total update.
+ * A missing attribute goes back to a single connection.
+ *
+ * Returns 0 if the number of streams was set, or -1 if an error occurred.
+ */
+int
+agmt_set_totalupdatestreams_from_entry(Repl_Agmt *ra, const Slapi_Entry *e)
+{
+	Slapi_Attr *sattr = NULL;
+	int return_value = -1;
+
+	PR_ASSERT(NULL != ra);
+	PR_Lock(ra->lock);
+	if (ra->stop_in_progress)
+	{
+		PR_Unlock(ra->lock);
+		return return_value;
+	}
+
+	slapi_entry_attr_find(e, type_nsds5ReplicaTotalUpdateStreams, &sattr);
+	if (NULL != sattr)
+	{
+		Slapi_Value *sval = NULL;
+		slapi_attr_first_value(sattr, &sval);
+		if (NULL != sval)
+		{
+			long tmpval = slapi_value_get_long(sval);
+			if (tmpval > 0) {
+				ra->totalUpdateStreams = tmpval;
+				return_value = 0; /* success! */
+			}
+		}
+	}
+	else
+	{
+		ra->totalUpdateStreams = 1;
+		return_value = 0;
+	}
+	PR_Unlock(ra->lock);
+	return return_value;
+}
+
+/*
+ * Record the state of the incremental update window, so that it
+ * can be reported in the agreement status.
+ */
+void
+agmt_set_window_stats(Repl_Agmt *ra, long window, long in_flight, long peak, PRUint64 full_count, long rtt)
+{
+	PR_ASSERT(NULL != ra);
+	PR_Lock(ra->lock);
+	ra->window_size = window;
+	ra->window_in_flight = in_flight;
+	ra->window_peak = peak;
+	ra->window_full_count = full_count;
+	ra->window_rtt = rtt;
+	PR_Unlock(ra->lock);
+}
+
 int
 agmt_set_timeout(Repl_Agmt *ra, long timeout)
 {
@@ -2759,6 +2985,15 @@ get_agmt_status(Slapi_PBlock *pb, Slapi_Entry* e, Slapi_Entry* entryAfter,
 		{
 			slapi_entry_add_string(e, "nsds5replicaLastInitStatus", ra->last_init_status);
 		}
+
+		/* incremental update window occupancy */
+		PR_Lock(ra->lock);
+		slapi_entry_attr_set_long(e, "nsds5replicaUpdateWindowSize", ra->window_size);
+		slapi_entry_attr_set_long(e, "nsds5replicaUpdateWindowInFlight", ra->window_in_flight);
+		slapi_entry_attr_set_long(e, "nsds5replicaUpdateWindowPeak", ra->window_peak);
+		slapi_entry_attr_set_ulong(e, "nsds5replicaUpdateWindowFullCount", (unsigned long)ra->window_full_count);
+		slapi_entry_attr_set_long(e, "nsds5replicaUpdateWindowRTT", ra->window_rtt);
+		PR_Unlock(ra->lock);
 	}
 bail:
 	return SLAPI_DSE_CALLBACK_OK;
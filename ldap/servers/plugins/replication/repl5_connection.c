@@ -53,6 +53,8 @@ typedef struct repl_connection
 	int supports_ds40_repl; /* 1 if does, 0 if doesn't, -1 if not determined */
 	int supports_ds71_repl; /* 1 if does, 0 if doesn't, -1 if not determined */
 	int supports_ds90_repl; /* 1 if does, 0 if doesn't, -1 if not determined */
+	int supports_batch_repl; /* 1 if does, 0 if doesn't, -1 if not determined */
+	int supports_total_streams; /* 1 if does, 0 if doesn't, -1 if not determined */
 	int linger_time; /* time in seconds to leave an idle connection open */
 	PRBool linger_active;
 	Slapi_Eq_Context *linger_event;
@@ -146,6 +148,10 @@ conn_result2string (int result)
         case CONN_NOT_WIN2K3:                   return "consumer is before W2K3";
         case CONN_SUPPORTS_DS90_REPL:           return "consumer supports all DS90 extop";
         case CONN_DOES_NOT_SUPPORT_DS90_REPL:   return "consumer does not support all DS90 extop";
+        case CONN_SUPPORTS_BATCH_REPL:          return "consumer supports batched updates";
+        case CONN_DOES_NOT_SUPPORT_BATCH_REPL:  return "consumer does not support batched updates";
+        case CONN_SUPPORTS_TOTAL_STREAMS:       return "consumer supports parallel total updates";
+        case CONN_DOES_NOT_SUPPORT_TOTAL_STREAMS: return "consumer does not support parallel total updates";
         default:                                return NULL;
     }
 }
@@ -178,6 +184,8 @@ conn_new(Repl_Agmt *agmt)
 	rpc->supports_ds50_repl = -1;
 	rpc->supports_ds71_repl = -1;
 	rpc->supports_ds90_repl = -1;
+	rpc->supports_batch_repl = -1;
+	rpc->supports_total_streams = -1;
 
 	rpc->linger_active = PR_FALSE;
 	rpc->delete_after_linger = PR_FALSE;
@@ -686,7 +694,8 @@ check_flow_control_tot_init(Repl_Connection *conn, int optype, const char *extop
     int rcv_msgid;
     int once;
     
-    if ((sent_msgid != 0) && (optype == CONN_EXTENDED_OPERATION) && (strcmp(extop_oid, REPL_NSDS50_REPLICATION_ENTRY_REQUEST_OID) == 0)) {
+    if ((sent_msgid != 0) && (optype == CONN_EXTENDED_OPERATION) && ((strcmp(extop_oid, REPL_NSDS50_REPLICATION_ENTRY_REQUEST_OID) == 0) ||
+         (strcmp(extop_oid, REPL_NSDS95_REPLICATION_ENTRY_STREAM_REQUEST_OID) == 0))) {
         /* We are sending entries part of the total update of a consumer
          * Wait a bit if the consumer needs to catchup from the current sent entries
          */
@@ -1360,6 +1369,8 @@ close_connection_internal(Repl_Connection *conn)
 	conn->supports_ds50_repl = -1;
 	conn->supports_ds71_repl = -1;
 	conn->supports_ds90_repl = -1;
+	conn->supports_batch_repl = -1;
+	conn->supports_total_streams = -1;
 	/* do this last, to minimize the chance that another thread
 	   might read conn->state as not disconnected and attempt
 	   to use conn->ld */
@@ -1577,6 +1588,11 @@ conn_replica_supports_ds90_repl(Repl_Connection *conn)
 			{
 				conn->supports_ds90_repl = 0;
 				entry = ldap_first_entry(conn->ld, res);
+				/* the batched update extop is looked up at the same time */
+				conn->supports_batch_repl = attribute_string_value_present(conn->ld, entry,
+						"supportedextension", REPL_NSDS95_REPLICATION_BATCH_REQUEST_OID) ? 1 : 0;
+				conn->supports_total_streams = attribute_string_value_present(conn->ld, entry,
+						"supportedextension", REPL_NSDS95_REPLICATION_ENTRY_STREAM_REQUEST_OID) ? 1 : 0;
 				if (!attribute_string_value_present(conn->ld, entry, "supportedextension", REPL_START_NSDS90_REPLICATION_REQUEST_OID))
 				{
 					return_value = CONN_DOES_NOT_SUPPORT_DS90_REPL;
@@ -1618,6 +1634,47 @@ conn_replica_supports_ds90_repl(Repl_Connection *conn)
 	return return_value;
 }
 
+/*
+ * Determine if the remote replica supports the batched update extended
+ * operation. The root DSE is read by conn_replica_supports_ds90_repl().
+ */
+ConnResult
+conn_replica_supports_batch_repl(Repl_Connection *conn)
+{
+	ConnResult return_value = conn_replica_supports_ds90_repl(conn);
+
+	if ((CONN_SUPPORTS_DS90_REPL == return_value) ||
+	    (CONN_DOES_NOT_SUPPORT_DS90_REPL == return_value))
+	{
+		PR_Lock(conn->lock);
+		return_value = (conn->supports_batch_repl == 1) ?
+			CONN_SUPPORTS_BATCH_REPL : CONN_DOES_NOT_SUPPORT_BATCH_REPL;
+		PR_Unlock(conn->lock);
+	}
+	return return_value;
+}
+
+/*
+ * Determine if the remote replica accepts the entries of a total update
+ * on several connections. The root DSE is read by
+ * conn_replica_supports_ds90_repl().
+ */
+ConnResult
+conn_replica_supports_total_streams(Repl_Connection *conn)
+{
+	ConnResult return_value = conn_replica_supports_ds90_repl(conn);
+
+	if ((CONN_SUPPORTS_DS90_REPL == return_value) ||
+	    (CONN_DOES_NOT_SUPPORT_DS90_REPL == return_value))
+	{
+		PR_Lock(conn->lock);
+		return_value = (conn->supports_total_streams == 1) ?
+			CONN_SUPPORTS_TOTAL_STREAMS : CONN_DOES_NOT_SUPPORT_TOTAL_STREAMS;
+		PR_Unlock(conn->lock);
+	}
+	return return_value;
+}
+
 /* Determine if the replica is read-only */
 ConnResult
 conn_replica_is_readonly(Repl_Connection *conn)
@@ -63,6 +63,8 @@ typedef struct repl5_inc_operation
 	char csn_str[CSN_STRSIZE];
 	char uniqueid[UIDSTR_SIZE+1];
 	ReplicaId  replica_id;
+	PRIntervalTime sent_time; /* used to measure the consumer round trip time */
+	int batch_count; /* Number of changes of the batch this operation starts, 0 if sent on its own */
 	struct repl5_inc_operation *next;
 } repl5_inc_operation;
 
@@ -82,6 +84,23 @@ typedef struct result_data
 	int flowcontrol_detection;
 	int result; /* The UPDATE_TRANSIENT_ERROR etc */
 	int WaitForAsyncResults;
+	int batch; /* Changes are sent in NSDS95ReplicationBatch requests */
+	/*
+	 * Sliding window of operations sent but not yet acknowledged.
+	 * Operations are queued and acknowledged in order on a single connection,
+	 * so the changes of each replica ID keep their CSN order on the consumer.
+	 */
+	PRCondVar *window_cv; /* Signaled (under lock) each time an operation leaves the window */
+	long window; /* Current number of operations allowed in flight */
+	long window_max; /* Upper bound of the window (nsds5ReplicaFlowControlWindow) */
+	long in_flight; /* Number of operations currently in flight */
+	long in_flight_peak; /* Highest number of operations in flight during this session */
+	PRUint64 window_full_count; /* Number of times the sender waited for room in the window */
+	int adaptive; /* Resize the window from the consumer round trip time and result rate */
+	PRUint32 rtt_avg; /* Smoothed round trip time (msec) */
+	PRUint32 rtt_min; /* Lowest round trip time seen during this session (msec) */
+	PRIntervalTime rate_start; /* Start of the current result rate sampling interval */
+	PRUint32 rate_results; /* Results received during the current sampling interval */
 } result_data;
 
 /* Various states the incremental protocol can pass through */
@@ -121,6 +140,12 @@ typedef struct result_data
 #define EXAMINE_RUV_PARAM_ERROR 405
 
 #define MAX_CHANGES_PER_SESSION	10000
+/*
+ * Adaptive window tuning: the smallest window we shrink to, and how often
+ * (msec) the window is resized from the measured result rate.
+ */
+#define REPL5_INC_WINDOW_MIN 8
+#define REPL5_INC_WINDOW_ADJUST_INTERVAL 500
 /*
  * Maximum time to wait between replication sessions. If we
  * don't see any updates for a period equal to this interval,
@@ -151,6 +176,8 @@ static const char* state2name (int state);
 static const char* event2name (int event);
 static const char* op2string (int op);
 static int repl5_inc_update_from_op_result(Private_Repl_Protocol *prp, ConnResult replay_crc, int connection_error, char *csn_str, char *uniqueid, ReplicaId replica_id, int* finished, PRUint32 *num_changes_sent);
+static void repl5_inc_window_update(result_data *rd, PRIntervalTime sent_time);
+static int repl5_inc_batch_results(result_data *rd, repl5_inc_operation *op, ConnResult conres, int connection_error, struct berval *retdata, int *finished);
 
 /* Push a newly sent operation onto the tail of the list */
 static void repl5_int_push_operation(result_data *rd, repl5_inc_operation *it)
@@ -167,6 +194,11 @@ static void repl5_int_push_operation(result_data *rd, repl5_inc_operation *it)
 		rd->operation_list_head = it;
 	}
 	rd->operation_list_tail = it;
+	rd->in_flight++;
+	if (rd->in_flight > rd->in_flight_peak)
+	{
+		rd->in_flight_peak = rd->in_flight;
+	}
 	PR_Unlock(rd->lock);
 }
 
@@ -186,6 +218,10 @@ static repl5_inc_operation *repl5_inc_pop_operation(result_data *rd)
 		{
 			rd->operation_list_tail = NULL;
 		}
+		rd->in_flight--;
+		repl5_inc_window_update(rd, head->sent_time);
+		/* wake up the sender waiting for room in the window */
+		PR_NotifyAllCondVar(rd->window_cv);
 	}
 	PR_Unlock(rd->lock);
 	return ret;
@@ -252,6 +288,8 @@ repl5_inc_result_threadmain(void *param)
 		ReplicaId replica_id = 0;
 		int operation_code = 0;
 		char *ldap_error_string = NULL;
+		char *retoid = NULL;
+		struct berval *retdata = NULL;
 		time_t time_now = 0;
 		time_t start_time = time( NULL );
 		int backoff_time = 1;
@@ -265,7 +303,10 @@ repl5_inc_result_threadmain(void *param)
 
 		while (!finished)
 		{
-			conres = conn_read_result_ex(conn, NULL, NULL, NULL, LDAP_RES_ANY, &message_id, 0);
+			/* In batch mode, every result is an extended response */
+			conres = conn_read_result_ex(conn, rd->batch ? &retoid : NULL,
+			                             rd->batch ? &retdata : NULL, NULL,
+			                             LDAP_RES_ANY, &message_id, 0);
 			slapi_log_error(SLAPI_LOG_REPL, NULL, "repl5_inc_result_threadmain: read result for message_id %d\n", message_id);
 			/* Timeout here means that we didn't block, not a real timeout */
 			if (CONN_TIMEOUT == conres)
@@ -320,7 +361,14 @@ repl5_inc_result_threadmain(void *param)
 
 			conn_get_error_ex(conn, &operation_code, &connection_error, &ldap_error_string);
 			slapi_log_error(SLAPI_LOG_REPL, NULL, "repl5_inc_result_threadmain: result %d, %d, %d, %d, %s\n", operation_code,connection_error,conres,message_id,ldap_error_string);
-			return_value = repl5_inc_update_from_op_result(rd->prp, conres, connection_error, csn_str, uniqueid, replica_id, &should_finish, &(rd->num_changes_sent));
+			if (op && op->batch_count > 0)
+			{
+				return_value = repl5_inc_batch_results(rd, op, conres, connection_error, retdata, &should_finish);
+			}
+			else
+			{
+				return_value = repl5_inc_update_from_op_result(rd->prp, conres, connection_error, csn_str, uniqueid, replica_id, &should_finish, &(rd->num_changes_sent));
+			}
 			if (return_value || should_finish)
 			{
 				slapi_log_error(SLAPI_LOG_REPL, NULL, "repl5_inc_result_threadmain: got op result %d should finish %d\n", return_value, should_finish);
@@ -353,6 +401,14 @@ repl5_inc_result_threadmain(void *param)
 		{
 			repl5_inc_op_free(op);
 		}
+		if (NULL != retoid)
+		{
+			ldap_memfree(retoid);
+		}
+		if (NULL != retdata)
+		{
+			ber_bvfree(retdata);
+		}
 	}
 	slapi_log_error(SLAPI_LOG_REPL, NULL, "repl5_inc_result_threadmain exiting\n");
 }
@@ -368,6 +424,10 @@ repl5_inc_rd_new(Private_Repl_Protocol *prp)
 		if (NULL == res->lock) {
 			slapi_ch_free((void **)&res);
 			res = NULL;
+		} else if (NULL == (res->window_cv = PR_NewCondVar(res->lock))) {
+			PR_DestroyLock(res->lock);
+			slapi_ch_free((void **)&res);
+			res = NULL;
 		}
 	}
 	return res;
@@ -387,6 +447,9 @@ static void
 repl5_inc_rd_destroy(result_data **pres)
 {
 	result_data *res = *pres;
+	if (res->window_cv) {
+		PR_DestroyCondVar(res->window_cv);
+	}
 	if (res->lock) {
 		PR_DestroyLock(res->lock);
 	}
@@ -433,19 +496,121 @@ repl5_inc_destroy_async_result_thread(result_data *rd)
 	return retval;
 }
 
+/* Size the window at the beginning of a session */
+static void
+repl5_inc_window_init(Repl_Agmt *agmt, result_data *rd)
+{
+	PR_Lock(rd->lock);
+	rd->window_max = agmt_get_flowcontrolwindow(agmt);
+	if (rd->window_max < 1) {
+		rd->window_max = 1;
+	}
+	rd->adaptive = agmt_get_flowcontroladaptive(agmt);
+	if (rd->adaptive && rd->window_max > REPL5_INC_WINDOW_MIN) {
+		/* start small and let the measured rate open the window */
+		rd->window = REPL5_INC_WINDOW_MIN;
+	} else {
+		rd->window = rd->window_max;
+	}
+	rd->rate_start = PR_IntervalNow();
+	PR_Unlock(rd->lock);
+	agmt_set_window_stats(agmt, rd->window, 0, 0, 0, 0);
+}
+
+/*
+ * Called with rd->lock held each time a result is received.
+ *
+ * Maintains the round trip time estimates and, if the window is adaptive,
+ * resizes it every REPL5_INC_WINDOW_ADJUST_INTERVAL. The window is sized
+ * to the number of operations the consumer acknowledges during one round
+ * trip (rate * rtt), with headroom to grow. When the round trip time gets
+ * well above the lowest one observed, the operations are queueing on the
+ * consumer rather than on the wire, so the window is reduced.
+ */
+static void
+repl5_inc_window_update(result_data *rd, PRIntervalTime sent_time)
+{
+	PRIntervalTime now = PR_IntervalNow();
+	PRUint32 rtt = PR_IntervalToMilliseconds(now - sent_time);
+	PRUint32 elapsed;
+	long target;
+
+	if (rtt == 0) {
+		rtt = 1;
+	}
+	if (rd->rtt_avg == 0) {
+		rd->rtt_avg = rtt;
+	} else {
+		rd->rtt_avg = (7 * rd->rtt_avg + rtt) / 8;
+	}
+	if (rd->rtt_min == 0 || rtt < rd->rtt_min) {
+		rd->rtt_min = rtt;
+	}
+	rd->rate_results++;
+
+	elapsed = PR_IntervalToMilliseconds(now - rd->rate_start);
+	if (elapsed < REPL5_INC_WINDOW_ADJUST_INTERVAL) {
+		return;
+	}
+	if (rd->adaptive) {
+		if (rd->rtt_avg > 2 * rd->rtt_min) {
+			target = rd->window / 2;
+		} else {
+			PRUint64 per_rtt = ((PRUint64)rd->rate_results * rd->rtt_avg) / elapsed;
+			target = (long)(2 * per_rtt);
+			if (target <= rd->window && rd->in_flight_peak >= rd->window) {
+				/* the window was the bottleneck, keep opening it */
+				target = rd->window + rd->window / 4 + 1;
+			}
+		}
+		if (target < REPL5_INC_WINDOW_MIN) {
+			target = REPL5_INC_WINDOW_MIN;
+		}
+		if (target > rd->window_max) {
+			target = rd->window_max;
+		}
+		if (target != rd->window) {
+			slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name,
+				"%s: update window resized from %ld to %ld (rtt %u ms, min rtt %u ms, %u results in %u ms)\n",
+				agmt_get_long_name(rd->prp->agmt), rd->window, target,
+				rd->rtt_avg, rd->rtt_min, rd->rate_results, elapsed);
+			rd->window = target;
+		}
+	}
+	rd->rate_start = now;
+	rd->rate_results = 0;
+	agmt_set_window_stats(rd->prp->agmt, rd->window, rd->in_flight, rd->in_flight_peak,
+		rd->window_full_count, rd->rtt_avg);
+}
+
 /* The interest of this routine is to give time to the consumer
  * to apply the sent updates and return the acks.
  * So the caller should not hold the replication connection lock
  * to let the RA.reader receives the acks.
+ *
+ * When the window of unacknowledged operations is full, wait until the
+ * result thread acknowledges one of them (or for at most the flow control
+ * pause), so that the window slides instead of draining completely.
  */
 static void
 repl5_inc_flow_control_results(Repl_Agmt *agmt, result_data *rd)
 {
+    PRIntervalTime pause = PR_MillisecondsToInterval(agmt_get_flowcontrolpause(agmt));
+    PRIntervalTime start;
+    PRIntervalTime elapsed;
+
     PR_Lock(rd->lock);
-    if ((rd->last_message_id_received <= rd->last_message_id_sent) &&
-        ((rd->last_message_id_sent - rd->last_message_id_received) >= agmt_get_flowcontrolwindow(agmt))) {
+    if (rd->in_flight >= rd->window) {
         rd->flowcontrol_detection++;
-        DS_Sleep(PR_MillisecondsToInterval(agmt_get_flowcontrolpause(agmt)));
+        rd->window_full_count++;
+        start = PR_IntervalNow();
+        while ((rd->in_flight >= rd->window) && !rd->abort && !rd->stop_result_thread) {
+            elapsed = PR_IntervalNow() - start;
+            if (elapsed >= pause) {
+                break;
+            }
+            PR_WaitCondVar(rd->window_cv, pause - elapsed);
+        }
     }
     PR_Unlock(rd->lock);
 }
@@ -489,6 +654,130 @@ repl5_inc_waitfor_async_results(result_data *rd)
 	}
 }
 
+/*
+ * Send the changes accumulated in the batch as a single
+ * NSDS95ReplicationBatch request. The records of the changes are queued
+ * for the result thread before the request goes out, the first one
+ * carrying the number of changes answered by the response.
+ */
+static ConnResult
+repl5_inc_flush_batch(Private_Repl_Protocol *prp, result_data *rd, BerElement **batch,
+	repl5_inc_operation **batch_head, int *batch_count)
+{
+	struct berval *payload = NULL;
+	repl5_inc_operation *sop = NULL;
+	PRIntervalTime now = PR_IntervalNow();
+	int message_id = 0;
+	ConnResult crc;
+
+	payload = NSDS95ReplicationBatch_done(batch);
+	if (NULL == payload)
+	{
+		slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name,
+			"%s: Unable to encode a batch of %d updates\n",
+			agmt_get_long_name(prp->agmt), *batch_count);
+		repl5_inc_rd_list_destroy(*batch_head);
+		*batch_head = NULL;
+		*batch_count = 0;
+		return CONN_LOCAL_ERROR;
+	}
+	slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name,
+		"%s: Sending a batch of %d updates\n",
+		agmt_get_long_name(prp->agmt), *batch_count);
+	(*batch_head)->batch_count = *batch_count;
+	while ((sop = *batch_head))
+	{
+		*batch_head = sop->next;
+		sop->next = NULL;
+		sop->sent_time = now;
+		repl5_int_push_operation(rd, sop);
+	}
+	*batch_count = 0;
+
+	crc = conn_send_extended_operation(prp->conn, REPL_NSDS95_REPLICATION_BATCH_REQUEST_OID,
+		payload, NULL /* update control */, &message_id);
+	ber_bvfree(payload);
+	if (message_id)
+	{
+		rd->last_message_id_sent = message_id;
+	}
+	if (CONN_OPERATION_SUCCESS == crc)
+	{
+		repl5_inc_flow_control_results(prp->agmt, rd);
+	}
+	return crc;
+}
+
+/*
+ * Process the response to a batch. Each change of the batch gets the
+ * result the consumer returned for it, exactly as if it had been sent on
+ * its own. op is the first change of the batch; the others are taken
+ * from the list of outstanding operations.
+ */
+static int
+repl5_inc_batch_results(result_data *rd, repl5_inc_operation *op, ConnResult conres,
+	int connection_error, struct berval *retdata, int *finished)
+{
+	int *results = NULL;
+	int nresults = 0;
+	int response_code = 0;
+	int return_value = 0;
+	int count = op->batch_count;
+	int i;
+
+	if (CONN_OPERATION_SUCCESS == conres)
+	{
+		if (decode_repl_batch_response(retdata, &response_code, &results, &nresults))
+		{
+			slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name,
+				"%s: Unable to decode the response to a batch of %d updates\n",
+				agmt_get_long_name(rd->prp->agmt), count);
+			conres = CONN_OPERATION_FAILED;
+			connection_error = LDAP_PROTOCOL_ERROR;
+		}
+		else if (NSDS50_REPL_REPLICA_READY != response_code)
+		{
+			slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name,
+				"%s: Consumer applied %d of a batch of %d updates: %s\n",
+				agmt_get_long_name(rd->prp->agmt), nresults, count,
+				protocol_response2string(response_code));
+		}
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		repl5_inc_operation *next = (0 == i) ? op : repl5_inc_pop_operation(rd);
+		ConnResult change_conres = conres;
+		int change_error = connection_error;
+		int rc;
+
+		if (NULL == next)
+		{
+			break;
+		}
+		if (CONN_OPERATION_SUCCESS == conres)
+		{
+			/* changes the consumer did not get to are retried */
+			change_error = (i < nresults) ? results[i] : LDAP_OPERATIONS_ERROR;
+			change_conres = (LDAP_SUCCESS == change_error) ?
+				CONN_OPERATION_SUCCESS : CONN_OPERATION_FAILED;
+		}
+		rc = repl5_inc_update_from_op_result(rd->prp, change_conres, change_error,
+			next->csn_str, next->uniqueid, next->replica_id, finished,
+			&(rd->num_changes_sent));
+		if (rc && !return_value)
+		{
+			return_value = rc;
+		}
+		if (next != op)
+		{
+			repl5_inc_op_free(next);
+		}
+	}
+	slapi_ch_free((void **)&results);
+	return return_value;
+}
+
 /*
  * It's specifically ok to delete a protocol instance that
  * is currently running. The instance will be shut down, and
@@ -1255,13 +1544,48 @@ reset_events (Private_Repl_Protocol *prp)
 	PR_Unlock(prp->lock);
 }
 
+/*
+ * Append an update to the pending batch instead of sending it on its own.
+ */
+static ConnResult
+replay_update_batch(Private_Repl_Protocol *prp, BerElement *batch,
+	slapi_operation_parameters *op, LDAPMod **mods, LDAPControl *update_control,
+	int *batched)
+{
+	const char *newrdn = NULL;
+	const char *newsuperior = NULL;
+	int deleteoldrdn = 0;
+
+	if (SLAPI_OPERATION_MODRDN == op->operation_type)
+	{
+		newrdn = op->p.p_modrdn.modrdn_newrdn;
+		newsuperior = REPL_GET_DN(&op->p.p_modrdn.modrdn_newsuperior_address);
+		deleteoldrdn = op->p.p_modrdn.modrdn_deloldrdn;
+	}
+	if (NSDS95ReplicationBatch_add(batch, op->operation_type,
+		REPL_GET_DN(&op->target_address), update_control, mods,
+		newrdn, newsuperior, deleteoldrdn))
+	{
+		slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name,
+			"%s: replay_update: Unable to add %s operation (dn=\"%s\") to the batch\n",
+			agmt_get_long_name(prp->agmt), op2string(op->operation_type),
+			REPL_GET_DN(&op->target_address));
+		return CONN_LOCAL_ERROR;
+	}
+	*batched = 1;
+	return CONN_OPERATION_SUCCESS;
+}
+
 /*
  * Replay the actual update to the consumer. Construct an appropriate LDAP
  * operation, attach the baggage LDAPv3 control that contains the CSN, etc.,
  * and send the operation to the consumer. 
+ * If batch is not NULL, the update is appended to it instead of being
+ * sent, and *batched is set.
  */
 ConnResult
-replay_update(Private_Repl_Protocol *prp, slapi_operation_parameters *op, int *message_id)
+replay_update(Private_Repl_Protocol *prp, slapi_operation_parameters *op,
+	BerElement *batch, int *batched, int *message_id)
 {
 	ConnResult return_value = CONN_OPERATION_FAILED;
 	LDAPControl *update_control;
@@ -1274,6 +1598,9 @@ replay_update(Private_Repl_Protocol *prp, slapi_operation_parameters *op, int *m
 		   we didn't send an op, so no result needs to be processed */
 		*message_id = 0;
 	}
+	if (batched) {
+		*batched = 0;
+	}
 
 	/* Construct the replication info control that accompanies the operation */
 	if (SLAPI_OPERATION_ADD == op->operation_type)
@@ -1346,6 +1673,9 @@ replay_update(Private_Repl_Protocol *prp, slapi_operation_parameters *op, int *m
 										csn_as_string(op->csn, PR_FALSE, csn_str));
 					}
 					return_value = CONN_OPERATION_SUCCESS;
+				} else if (batch) {
+					return_value = replay_update_batch(prp, batch, op, entryattrs,
+						update_control, batched);
 				} else {
 					return_value = conn_send_add(prp->conn, REPL_GET_DN(&op->target_address),
 						entryattrs, update_control, message_id);
@@ -1371,16 +1701,29 @@ replay_update(Private_Repl_Protocol *prp, slapi_operation_parameters *op, int *m
 									csn_as_string(op->csn, PR_FALSE, csn_str));
 				}
 				return_value = CONN_OPERATION_SUCCESS;
+			} else if (batch) {
+				return_value = replay_update_batch(prp, batch, op,
+					op->p.p_modify.modify_mods, update_control, batched);
 			} else {
 				return_value = conn_send_modify(prp->conn, REPL_GET_DN(&op->target_address),
 					op->p.p_modify.modify_mods, update_control, message_id);
 			}
 			break;
 		case SLAPI_OPERATION_DELETE:
+			if (batch) {
+				return_value = replay_update_batch(prp, batch, op, NULL,
+					update_control, batched);
+				break;
+			}
 			return_value = conn_send_delete(prp->conn, REPL_GET_DN(&op->target_address),
 				update_control, message_id);
 			break;
 		case SLAPI_OPERATION_MODRDN:
+			if (batch) {
+				return_value = replay_update_batch(prp, batch, op, NULL,
+					update_control, batched);
+				break;
+			}
 			/* XXXggood need to pass modrdn mods in update control! */
 			return_value = conn_send_rename(prp->conn, REPL_GET_DN(&op->target_address),
 				op->p.p_modrdn.modrdn_newrdn,
@@ -1561,6 +1904,12 @@ send_updates(Private_Repl_Protocol *prp, RUV *remote_update_vector, PRUint32 *nu
 	CL5ReplayIterator *changelog_iterator;
 	int message_id = 0;
 	result_data *rd = NULL;
+	BerElement *batch = NULL; /* changes not sent yet, in batch mode */
+	repl5_inc_operation *batch_head = NULL; /* their records */
+	repl5_inc_operation *batch_tail = NULL;
+	int batch_count = 0;
+	long batch_size = 0;
+	Slapi_DN *batch_root = NULL;
 
 	*num_changes_sent = 0;
 	/*
@@ -1674,11 +2023,36 @@ send_updates(Private_Repl_Protocol *prp, RUV *remote_update_vector, PRUint32 *nu
 		char csn_str[CSN_STRSIZE];
 		PRBool subentry_update_needed = PR_FALSE;
 		int skipped_updates = 0;
+		int batched = 0;
 		int fractional_repl;
 #define FRACTIONAL_SKIPPED_THRESHOLD 100
 
 		/* Start the results reading thread */
 		rd = repl5_inc_rd_new(prp);
+		if (NULL == rd)
+		{
+			slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name,
+				"%s: Unable to allocate the result data of the update session\n",
+				agmt_get_long_name(prp->agmt));
+			cl5DestroyReplayIterator(&changelog_iterator);
+			return UPDATE_TRANSIENT_ERROR;
+		}
+		repl5_inc_window_init(prp->agmt, rd);
+		/*
+		 * Group the changes in NSDS95ReplicationBatch requests if the
+		 * agreement asks for it and the consumer supports it. This must be
+		 * decided before the result thread starts reading.
+		 */
+		batch_size = agmt_get_updatebatchsize(prp->agmt);
+		if (!prp->repl50consumer && batch_size > 1 &&
+		    CONN_SUPPORTS_BATCH_REPL == conn_replica_supports_batch_repl(prp->conn) &&
+		    NULL != (batch_root = agmt_get_replarea(prp->agmt)))
+		{
+			rd->batch = 1;
+			slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name,
+				"%s: Sending updates in batches of %ld\n",
+				agmt_get_long_name(prp->agmt), batch_size);
+		}
 		if (!prp->repl50consumer) 
 		{
 			rc = repl5_inc_create_async_result_thread(rd);
@@ -1709,7 +2083,21 @@ send_updates(Private_Repl_Protocol *prp, RUV *remote_update_vector, PRUint32 *nu
 						agmt_get_long_name(prp->agmt), csn_as_string(entry.op->csn, PR_FALSE, csn_str));
 					continue;
 				}
-				replay_crc = replay_update(prp, entry.op, &message_id);
+				if (rd->batch && NULL == batch)
+				{
+					batch = NSDS95ReplicationBatch_new(slapi_sdn_get_dn(batch_root));
+					if (NULL == batch)
+					{
+						slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name,
+							"%s: Unable to create a batch of updates\n",
+							agmt_get_long_name(prp->agmt));
+						return_value = UPDATE_TRANSIENT_ERROR;
+						finished = 1;
+						break;
+					}
+				}
+				batched = 0;
+				replay_crc = replay_update(prp, entry.op, batch, &batched, &message_id);
 				if (message_id) 
 				{
 					rd->last_message_id_sent = message_id;
@@ -1798,7 +2186,40 @@ send_updates(Private_Repl_Protocol *prp, RUV *remote_update_vector, PRUint32 *nu
 						skipped_updates = 0;
 					}
 
-					if (prp->repl50consumer && message_id) 
+					if (batched)
+					{
+						/* Keep the details until the batch is sent */
+						repl5_inc_operation *sop = NULL;
+						sop = repl5_inc_operation_new();
+						PL_strncpyz(sop->csn_str, csn_str, sizeof(sop->csn_str));
+						sop->operation_type = entry.op->operation_type;
+						sop->replica_id = replica_id;
+						PL_strncpyz(sop->uniqueid, uniqueid, sizeof(sop->uniqueid));
+						if (batch_tail)
+						{
+							batch_tail->next = sop;
+						}
+						else
+						{
+							batch_head = sop;
+						}
+						batch_tail = sop;
+						batch_count++;
+						subentry_update_needed = PR_FALSE;
+						skipped_updates = 0;
+						if (batch_count >= batch_size)
+						{
+							replay_crc = repl5_inc_flush_batch(prp, rd, &batch, &batch_head, &batch_count);
+							batch_tail = NULL;
+							if (CONN_OPERATION_SUCCESS != replay_crc)
+							{
+								return_value = (CONN_NOT_CONNECTED == replay_crc) ?
+									UPDATE_CONNECTION_LOST : UPDATE_TRANSIENT_ERROR;
+								finished = 1;
+							}
+						}
+					}
+					else if (prp->repl50consumer && message_id) 
 					{
 						int operation, error = 0;
 
@@ -1818,6 +2239,7 @@ send_updates(Private_Repl_Protocol *prp, RUV *remote_update_vector, PRUint32 *nu
 						sop->ldap_message_id = message_id;
 						sop->operation_type = entry.op->operation_type;
 						sop->replica_id = replica_id;
+						sop->sent_time = PR_IntervalNow();
 						PL_strncpyz(sop->uniqueid, uniqueid, sizeof(sop->uniqueid));
 						repl5_int_push_operation(rd,sop);
 						repl5_inc_flow_control_results(prp->agmt, rd);
@@ -1902,6 +2324,36 @@ send_updates(Private_Repl_Protocol *prp, RUV *remote_update_vector, PRUint32 *nu
 			PR_Unlock(rd->lock);
 		} while (!finished);
 
+		/*
+		 * Send what is left in the batch, unless the session is ending on
+		 * an error: those changes will be sent again by the next session.
+		 */
+		if (batch_count > 0)
+		{
+			if (UPDATE_NO_MORE_UPDATES == return_value || UPDATE_YIELD == return_value)
+			{
+				replay_crc = repl5_inc_flush_batch(prp, rd, &batch, &batch_head, &batch_count);
+				if (CONN_OPERATION_SUCCESS != replay_crc)
+				{
+					return_value = (CONN_NOT_CONNECTED == replay_crc) ?
+						UPDATE_CONNECTION_LOST : UPDATE_TRANSIENT_ERROR;
+				}
+			}
+			else
+			{
+				repl5_inc_rd_list_destroy(batch_head);
+				batch_head = NULL;
+				batch_count = 0;
+			}
+			batch_tail = NULL;
+		}
+		if (NULL != batch)
+		{
+			ber_free(batch, 1);
+			batch = NULL;
+		}
+		slapi_sdn_free(&batch_root);
+
 		if (fractional_repl && subentry_update_needed)
 		{
 			Replica *replica;
@@ -1952,6 +2404,12 @@ send_updates(Private_Repl_Protocol *prp, RUV *remote_update_vector, PRUint32 *nu
 					type_nsds5ReplicaFlowControlPause,
 					type_nsds5ReplicaFlowControlWindow);             
 		}
+		slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name,
+				"%s: Incremental update window: size %ld, peak in flight %ld, full %" NSPRIu64 " times, rtt %u ms\n",
+				agmt_get_long_name(prp->agmt), rd->window, rd->in_flight_peak,
+				rd->window_full_count, rd->rtt_avg);
+		agmt_set_window_stats(prp->agmt, rd->window, 0, rd->in_flight_peak,
+				rd->window_full_count, rd->rtt_avg);
 		PR_Unlock(rd->lock);
 		repl5_inc_rd_destroy(&rd);
 
@@ -65,12 +65,21 @@ static char *end_name_list[] = {
 static char *total_oid_list[] = {
 		REPL_NSDS50_REPLICATION_ENTRY_REQUEST_OID,
 		REPL_NSDS71_REPLICATION_ENTRY_REQUEST_OID,
+		REPL_NSDS95_REPLICATION_ENTRY_STREAM_REQUEST_OID,
 		NULL
 };
 static char *total_name_list[] = {
 		NSDS_REPL_NAME_PREFIX " Total Update Entry",
 		NULL
 };
+static char *batch_oid_list[] = {
+		REPL_NSDS95_REPLICATION_BATCH_REQUEST_OID,
+		NULL
+};
+static char *batch_name_list[] = {
+		NSDS_REPL_NAME_PREFIX " Batched Update",
+		NULL
+};
 static char *response_oid_list[] = {
 		REPL_NSDS50_REPLICATION_RESPONSE_OID,
 		NULL
@@ -136,6 +145,7 @@ static int multimaster_started_flag = 0;
 /* Thread private data and interface */
 static PRUintn thread_private_agmtname;	/* thread private index for logging*/
 static PRUintn thread_private_cache;
+static PRUintn thread_private_batch; /* batched update being applied */
 
 char*
 get_thread_private_agmtname()
@@ -169,6 +179,28 @@ set_thread_private_cache ( void *buf )
 		PR_SetThreadPrivate ( thread_private_cache, buf );
 }
 
+/*
+ * The changes of a batched update are applied as internal operations,
+ * which have no connection. The batch context, holding the consumer
+ * connection extension of the session, is made available to them
+ * through this thread private data.
+ */
+repl_batch_context*
+get_thread_private_batch ()
+{
+	repl_batch_context *batch = NULL;
+	if ( thread_private_batch )
+		batch = (repl_batch_context *)PR_GetThreadPrivate ( thread_private_batch );
+	return batch;
+}
+
+void
+set_thread_private_batch ( repl_batch_context *batch )
+{
+	if ( thread_private_batch )
+		PR_SetThreadPrivate ( thread_private_batch, batch );
+}
+
 char*
 get_repl_session_id (Slapi_PBlock *pb, char *idstr, CSN **csn)
 {
@@ -516,6 +548,24 @@ multimaster_total_extop_init( Slapi_PBlock *pb )
     return rc;
 }
 
+int
+multimaster_batch_extop_init( Slapi_PBlock *pb )
+{
+	int rc= 0; /* OK */
+
+	if ( slapi_pblock_set( pb, SLAPI_PLUGIN_VERSION, SLAPI_PLUGIN_VERSION_01 ) != 0 ||
+		 slapi_pblock_set( pb, SLAPI_PLUGIN_DESCRIPTION, (void *)&multimasterextopdesc ) != 0 ||
+		 slapi_pblock_set( pb, SLAPI_PLUGIN_EXT_OP_OIDLIST, (void *)batch_oid_list ) != 0  ||
+		 slapi_pblock_set( pb, SLAPI_PLUGIN_EXT_OP_NAMELIST, (void *)batch_name_list ) != 0  ||
+		 slapi_pblock_set( pb, SLAPI_PLUGIN_EXT_OP_FN, (void *)multimaster_extop_NSDS95ReplicationBatch ))
+	{
+		slapi_log_error( SLAPI_LOG_PLUGIN, repl_plugin_name, "multimaster_batch_extop_init (NSDS95ReplicationBatch) failed\n" );
+		rc= -1;
+	}
+
+	return rc;
+}
+
 int
 multimaster_response_extop_init( Slapi_PBlock *pb )
 {
@@ -721,6 +771,7 @@ multimaster_start( Slapi_PBlock *pb )
 		/* Initialize thread private data for logging. Ignore if fails */
 		PR_NewThreadPrivateIndex (&thread_private_agmtname, NULL);
 		PR_NewThreadPrivateIndex (&thread_private_cache, NULL);
+		PR_NewThreadPrivateIndex (&thread_private_batch, NULL);
 
 		/* Decode the command line args to see if we're dumping to LDIF */
 		is_ldif_dump = check_for_ldif_dump(pb);
@@ -927,6 +978,7 @@ int replication_multimaster_plugin_init(Slapi_PBlock *pb)
 		rc = slapi_register_plugin("extendedop", 1 /* Enabled */, "multimaster_start_extop_init", multimaster_start_extop_init, "Multimaster replication start extended operation plugin", NULL, identity);
 		rc= slapi_register_plugin("extendedop", 1 /* Enabled */, "multimaster_end_extop_init", multimaster_end_extop_init, "Multimaster replication end extended operation plugin", NULL, identity);
 		rc= slapi_register_plugin("extendedop", 1 /* Enabled */, "multimaster_total_extop_init", multimaster_total_extop_init, "Multimaster replication total update extended operation plugin", NULL, identity);
+		rc= slapi_register_plugin("extendedop", 1 /* Enabled */, "multimaster_batch_extop_init", multimaster_batch_extop_init, "Multimaster replication batched update extended operation plugin", NULL, identity);
 		rc= slapi_register_plugin("extendedop", 1 /* Enabled */, "multimaster_response_extop_init", multimaster_response_extop_init, "Multimaster replication extended response plugin", NULL, identity);
 		rc= slapi_register_plugin("extendedop", 1 /* Enabled */, "multimaster_cleanruv_extop_init", multimaster_cleanruv_extop_init, "Multimaster replication cleanruv extended operation plugin", NULL, identity);
 		rc= slapi_register_plugin("extendedop", 1 /* Enabled */, "multimaster_cleanruv_abort_extop_init", multimaster_cleanruv_abort_extop_init, "Multimaster replication cleanruv abort extended operation plugin", NULL, identity);
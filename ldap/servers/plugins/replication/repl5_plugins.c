@@ -1194,6 +1194,7 @@ write_changelog_and_ruv (Slapi_PBlock *pb)
 		unsigned long optype = op_params ? op_params->operation_type : 0;
 		CSN *oppcsn = op_params ? op_params->csn : NULL;
 		LDAPMod **mods = op_params ? op_params->p.p_modify.modify_mods : NULL;
+		repl_batch_context *batch = NULL;
 
 		slapi_pblock_get( pb, SLAPI_OPERATION, &op );
 		opcsn = operation_get_csn(op);
@@ -1202,7 +1203,22 @@ write_changelog_and_ruv (Slapi_PBlock *pb)
 		if(op_params && sdn){
 			agmt_update_maxcsn(r, sdn, op_params->operation_type, mods, opcsn);
 		}
-		rc = update_ruv_component(r, opcsn, pb);
+		if (is_replicated_operation && opcsn && (batch = get_thread_private_batch()))
+		{
+			/* a change of a batched update: the RUV moves once the change commits */
+			if (batch->ncsns == batch->maxcsns)
+			{
+				batch->maxcsns = batch->maxcsns ? batch->maxcsns * 2 : 64;
+				batch->csns = (CSN **)slapi_ch_realloc((char *)batch->csns,
+					batch->maxcsns * sizeof(CSN *));
+			}
+			batch->csns[batch->ncsns++] = csn_dup(opcsn);
+			rc = RUV_SUCCESS;
+		}
+		else
+		{
+			rc = update_ruv_component(r, opcsn, pb);
+		}
 		if (RUV_COVERS_CSN == rc) {
 			slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name,
 					"write_changelog_and_ruv: RUV already covers csn for "
@@ -1477,8 +1493,14 @@ static const char *replica_get_purl_for_op (const Replica *r, Slapi_PBlock *pb,
 		/* TEL 20120531: There is a slim chance we want to take exclusive access
 		 * to this instead.  However, it isn't clear to me that it is worth the 
 		 * risk of changing this working code. */
-		connext = (consumer_connection_extension *)repl_con_get_ext(
-			REPL_CON_EXT_CONN, conn);
+		if (conn) {
+			connext = (consumer_connection_extension *)repl_con_get_ext(
+				REPL_CON_EXT_CONN, conn);
+		} else {
+			/* internal operation applying a batched update */
+			repl_batch_context *batch = get_thread_private_batch();
+			connext = batch ? (consumer_connection_extension *)batch->connext : NULL;
+		}
 		if (NULL == connext || NULL == connext->supplier_ruv)
 		{
 			char sessionid[REPL_SESSION_ID_SIZE];
@@ -42,6 +42,7 @@ typedef struct operation_id_list_item
 typedef struct callback_data
 {
     Private_Repl_Protocol *prp;
+    Repl_Connection *conn; /* Connection the entries of this stream are sent on */
     int rc;    
 	unsigned long num_entries;
     time_t sleep_on_busy;
@@ -54,6 +55,9 @@ typedef struct callback_data
 	int last_message_id_sent;
 	int last_message_id_received;
 	int flowcontrol_detection;
+	struct callback_data *streams; /* Additional streams of a parallel total update */
+	int nstreams; /* Number of streams, including this one, 1 if not parallel */
+	int next_seq; /* Sequence number of the next entry of a parallel total update */
 } callback_data;
 
 /* 
@@ -103,7 +107,7 @@ static void repl5_tot_result_threadmain(void *param)
 {
 	callback_data *cb = (callback_data*) param;
 	ConnResult conres = 0;
-	Repl_Connection *conn = cb->prp->conn;
+	Repl_Connection *conn = cb->conn;
 	int finished = 0;
 	int connection_error = 0;
 	char *ldap_error_string = NULL;
@@ -239,8 +243,8 @@ repl5_tot_get_next_result(callback_data *cb_data)
 	char *ldap_error_string = NULL;
 	int operation_code = 0;
 	/* Wait on the next result */
-	conres = conn_read_result(cb_data->prp->conn, &message_id);
-	conn_get_error_ex(cb_data->prp->conn, &operation_code, &connection_error, &ldap_error_string);
+	conres = conn_read_result(cb_data->conn, &message_id);
+	conn_get_error_ex(cb_data->conn, &operation_code, &connection_error, &ldap_error_string);
 	if (connection_error)
 	{
 		repl5_tot_log_operation_failure(connection_error,ldap_error_string,agmt_get_long_name(cb_data->prp->agmt));
@@ -298,6 +302,101 @@ repl5_tot_waitfor_async_results(callback_data *cb_data)
 	}
 }
 
+/*
+ * Parallel total update: open the additional connections the agreement
+ * asks for, each one with its own result thread. The entries are then
+ * dealt round-robin over all the streams by send_entry(), numbered so
+ * that the consumer imports them in the order of the search.
+ * Running with fewer streams, or only the main connection, is not an error.
+ */
+static void
+repl5_tot_open_streams(callback_data *cb_data)
+{
+	Private_Repl_Protocol *prp = cb_data->prp;
+	long nstreams = agmt_get_totalupdatestreams(prp->agmt);
+	int i;
+
+	cb_data->nstreams = 1;
+	if (nstreams <= 1 || prp->repl50consumer)
+	{
+		return;
+	}
+	if (conn_replica_supports_total_streams(prp->conn) != CONN_SUPPORTS_TOTAL_STREAMS)
+	{
+		slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name, "%s: repl5_tot_run: "
+				"consumer does not support parallel total update, using a single connection\n",
+				agmt_get_long_name(prp->agmt));
+		return;
+	}
+
+	cb_data->streams = (callback_data *)slapi_ch_calloc(nstreams - 1, sizeof(callback_data));
+	for (i = 0; i < nstreams - 1; i++)
+	{
+		callback_data *stream = &cb_data->streams[i];
+
+		stream->prp = prp;
+		if ((stream->conn = conn_new(prp->agmt)) == NULL)
+		{
+			break;
+		}
+		if (conn_connect(stream->conn) != CONN_OPERATION_SUCCESS ||
+		    (stream->lock = PR_NewLock()) == NULL)
+		{
+			conn_delete_internal_ext(stream->conn);
+			stream->conn = NULL;
+			break;
+		}
+		conn_set_timeout(stream->conn, agmt_get_timeout(prp->agmt));
+		conn_set_tot_update_cb(stream->conn, (void *) stream);
+		if (repl5_tot_create_async_result_thread(stream))
+		{
+			conn_set_tot_update_cb(stream->conn, NULL);
+			conn_delete_internal_ext(stream->conn);
+			stream->conn = NULL;
+			PR_DestroyLock(stream->lock);
+			stream->lock = NULL;
+			break;
+		}
+		cb_data->nstreams++;
+	}
+	slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name, "%s: repl5_tot_run: "
+			"sending entries over %d connections\n",
+			agmt_get_long_name(prp->agmt), cb_data->nstreams);
+}
+
+/*
+ * Wait for the results of the additional streams, stop their result
+ * threads and close them. The first error, if any, becomes the result
+ * of the total update.
+ */
+static void
+repl5_tot_close_streams(callback_data *cb_data)
+{
+	int i;
+
+	for (i = 0; i < cb_data->nstreams - 1; i++)
+	{
+		callback_data *stream = &cb_data->streams[i];
+
+		if (cb_data->rc == CONN_OPERATION_SUCCESS)
+		{
+			repl5_tot_waitfor_async_results(stream);
+		}
+		repl5_tot_destroy_async_result_thread(stream);
+		PR_Lock(stream->lock);
+		if (cb_data->rc == CONN_OPERATION_SUCCESS && stream->abort)
+		{
+			cb_data->rc = stream->rc ? stream->rc : -1;
+		}
+		PR_Unlock(stream->lock);
+		cb_data->flowcontrol_detection += stream->flowcontrol_detection;
+		conn_set_tot_update_cb(stream->conn, NULL);
+		conn_delete_internal_ext(stream->conn);
+		PR_DestroyLock(stream->lock);
+	}
+	slapi_ch_free((void **)&cb_data->streams);
+	cb_data->nstreams = 1;
+}
 
 /*
  * Completely refresh a replica. The basic protocol interaction goes
@@ -435,6 +534,7 @@ retry:
                                   repl_get_plugin_identity (PLUGIN_MULTIMASTER_REPLICATION), 0);
 
 	cb_data.prp = prp;
+	cb_data.conn = prp->conn;
 	cb_data.rc = 0;
 	cb_data.num_entries = 0UL;
 	cb_data.sleep_on_busy = 0UL;
@@ -450,8 +550,9 @@ retry:
 	/* Before we get started on sending entries to the replica, we need to 
 	 * setup things for async propagation: 
 	 * 1. Create a thread that will read the LDAP results from the connection.
-	 * 2. Anything else ?
+	 * 2. Open the additional connections of a parallel total update, if any.
 	 */
+	repl5_tot_open_streams(&cb_data);
 	if (!prp->repl50consumer) 
 	{
 		rc = repl5_tot_create_async_result_thread(&cb_data);
@@ -459,6 +560,7 @@ retry:
 			slapi_log_error (SLAPI_LOG_FATAL, repl_plugin_name, "%s: repl5_tot_run: "
 							 "repl5_tot_create_async_result_thread failed; error - %d\n", 
 							 agmt_get_long_name(prp->agmt), rc);
+			repl5_tot_close_streams(&cb_data);
 			goto done;
 		}
 	}
@@ -490,6 +592,7 @@ retry:
 							 "repl5_tot_destroy_async_result_thread failed; error - %d\n", 
 							 agmt_get_long_name(prp->agmt), rc);
 		}
+		repl5_tot_close_streams(&cb_data);
 	}
 
 	/* From here on, things are the same as in the old sync code : 
@@ -714,6 +817,9 @@ int send_entry (Slapi_Entry *e, void *cb_data)
 	int message_id = 0;
 	int retval = 0;
 	char **frac_excluded_attrs = NULL;
+	callback_data *stream = (callback_data*)cb_data;
+	int seq = -1;
+	int i;
 
     PR_ASSERT (cb_data);
 
@@ -735,6 +841,13 @@ int send_entry (Slapi_Entry *e, void *cb_data)
     PR_Lock(((callback_data*)cb_data)->lock);
     rc = ((callback_data*)cb_data)->abort;
     PR_Unlock(((callback_data*)cb_data)->lock);
+    for (i = 0; !rc && i < ((callback_data*)cb_data)->nstreams - 1; i++)
+    {
+        callback_data *other = &((callback_data*)cb_data)->streams[i];
+        PR_Lock(other->lock);
+        rc = other->abort;
+        PR_Unlock(other->lock);
+    }
     if (rc)
     {
         conn_disconnect(prp->conn);
@@ -756,8 +869,19 @@ int send_entry (Slapi_Entry *e, void *cb_data)
 		frac_excluded_attrs = agmt_get_fractional_attrs_total(prp->agmt);
 	}
 
+	/* in a parallel total update, pick the stream of this entry */
+	if (((callback_data*)cb_data)->nstreams > 1)
+	{
+		seq = ((callback_data*)cb_data)->next_seq++;
+		i = seq % ((callback_data*)cb_data)->nstreams;
+		if (i > 0)
+		{
+			stream = &((callback_data*)cb_data)->streams[i - 1];
+		}
+	}
+
     /* convert the entry to the on the wire format */
-	bere = entry2bere(e,frac_excluded_attrs);
+	bere = entry2bere_ext(e, frac_excluded_attrs, seq);
 
 	if (frac_excluded_attrs)
 	{
@@ -784,12 +908,14 @@ int send_entry (Slapi_Entry *e, void *cb_data)
 
     do {
 	/* push the entry to the consumer */
-	rc = conn_send_extended_operation(prp->conn, REPL_NSDS50_REPLICATION_ENTRY_REQUEST_OID,
+	rc = conn_send_extended_operation(stream->conn,
+	                              (seq < 0) ? REPL_NSDS50_REPLICATION_ENTRY_REQUEST_OID :
+	                                          REPL_NSDS95_REPLICATION_ENTRY_STREAM_REQUEST_OID,
 	                              bv /* payload */, NULL /* update_control */, &message_id);   
 
 	if (message_id) 
 	{
-		((callback_data*)cb_data)->last_message_id_sent = message_id;
+		stream->last_message_id_sent = message_id;
 	}
 
 	/* If we are talking to a 5.0 type consumer, we need to wait here and retrieve the 
@@ -45,10 +45,26 @@
           } 
         CSN OCTET STRING,
     }
+
+ The NSDS95ReplicationEntryStream request, used when the supplier sends
+ the entries on several connections, appends the position of the entry
+ in the total update:
+
+     requestValue ::= SEQUENCE { 
+         uniqueid OCTET STRING, 
+         dn LDAPDN, 
+         annotatedAttributes AnnotatedAttributeList,
+         sequenceNumber INTEGER
+     } 
+
+ The consumer imports the entries in sequence number order, whatever
+ connection they came from, so that parents are still added before
+ their children.
 */
 
 #include "repl.h"
 #include "repl5.h"
+#include "repl5_prot_private.h"
 
 #define CSN_TYPE_VALUE_UPDATED_ON_WIRE 1
 #define CSN_TYPE_VALUE_DELETED_ON_WIRE 2
@@ -95,6 +111,17 @@ static int my_ber_scanf_value(BerElement *ber, Slapi_Value **value, PRBool *dele
  */
 BerElement *
 entry2bere(const Slapi_Entry *e, char **excluded_attrs)
+{
+	return entry2bere_ext(e, excluded_attrs, -1);
+}
+
+/*
+ * Same as entry2bere(), but when seq is not negative it is appended to
+ * the sequence as the position of the entry in a parallel total update
+ * (REPL_NSDS95_REPLICATION_ENTRY_STREAM_REQUEST_OID).
+ */
+BerElement *
+entry2bere_ext(const Slapi_Entry *e, char **excluded_attrs, int seq)
 {
 	BerElement *ber = NULL;
 	const char *str = NULL;
@@ -200,6 +227,14 @@ entry2bere(const Slapi_Entry *e, char **excluded_attrs)
 	{
 		goto loser;
 	}
+	if (seq >= 0)
+	{
+		BER_DEBUG("i(seq)");
+		if (ber_printf(ber, "i", seq) == -1)
+		{
+			goto loser;
+		}
+	}
 	BER_DEBUG("}");
 	if (ber_printf(ber, "}") == -1) /* End sequence for this entry */
 	{
@@ -677,7 +712,7 @@ loser:
  * entry to be added to the local database.
  */
 static int
-decode_total_update_extop(Slapi_PBlock *pb, Slapi_Entry **ep)
+decode_total_update_extop(Slapi_PBlock *pb, Slapi_Entry **ep, int *seqp)
 {
 	BerElement *tmp_bere = NULL;
 	Slapi_Entry *e = NULL;
@@ -693,13 +728,16 @@ decode_total_update_extop(Slapi_PBlock *pb, Slapi_Entry **ep)
 	
 	PR_ASSERT(NULL != pb);
 	PR_ASSERT(NULL != ep);
+	PR_ASSERT(NULL != seqp);
 
+	*seqp = -1;
 	slapi_pblock_get(pb, SLAPI_EXT_OP_REQ_OID, &extop_oid);
 	slapi_pblock_get(pb, SLAPI_EXT_OP_REQ_VALUE, &extop_value);
 
 	if ((NULL == extop_oid) || 
 		((strcmp(extop_oid, REPL_NSDS50_REPLICATION_ENTRY_REQUEST_OID) != 0) && 
-		 (strcmp(extop_oid, REPL_NSDS71_REPLICATION_ENTRY_REQUEST_OID) != 0)) ||
+		 (strcmp(extop_oid, REPL_NSDS71_REPLICATION_ENTRY_REQUEST_OID) != 0) &&
+		 (strcmp(extop_oid, REPL_NSDS95_REPLICATION_ENTRY_STREAM_REQUEST_OID) != 0)) ||
 		!BV_HAS_DATA(extop_value))
 	{
 		/* Bogus */
@@ -756,6 +794,17 @@ decode_total_update_extop(Slapi_PBlock *pb, Slapi_Entry **ep)
         attr = NULL;
 	}
 
+	/* The position of the entry in a parallel total update */
+	if (strcmp(extop_oid, REPL_NSDS95_REPLICATION_ENTRY_STREAM_REQUEST_OID) == 0)
+	{
+		ber_int_t seq;
+		if ((ber_scanf(tmp_bere, "i", &seq) == LBER_ERROR) || (seq < 0))
+		{
+			goto loser;
+		}
+		*seqp = seq;
+	}
+
     if (ber_scanf(tmp_bere, "}") == LBER_ERROR) /* End sequence for this entry */
 	{
 		goto loser;
@@ -810,6 +859,338 @@ free_and_return:
 	return rc;
 }
 
+/*
+ * Parallel total update.
+ *
+ * The supplier deals the entries of the total update over several
+ * connections, numbering them in the order of its search. The bulk
+ * import is attached to the connection that sent the start extop, so the
+ * entries coming from every connection are queued here and handed to
+ * slapi_import_entry() on behalf of that connection, in sequence order.
+ * Only TOTAL_STREAM_WINDOW entries may be received ahead of the next one
+ * to import; beyond that the operation waits for the others to catch up,
+ * and the total update fails if the stream makes no progress for
+ * TOTAL_STREAM_TIMEOUT seconds. The entries are imported by one operation
+ * at a time, without holding the stream lock.
+ */
+#define TOTAL_STREAM_WINDOW 1024
+#define TOTAL_STREAM_TIMEOUT 300
+#define TOTAL_STREAM_DRAIN 64
+
+typedef struct total_stream
+{
+	Slapi_DN *root;           /* root of the replicated area being initialized */
+	void *conn;               /* connection that owns the bulk import */
+	PRLock *lock;
+	PRCondVar *cv;
+	int next_seq;             /* sequence number of the next entry to import */
+	Slapi_Entry *pending[TOTAL_STREAM_WINDOW];
+	int failed;               /* an import failed or the total update ended */
+	int draining;             /* an operation is importing the queued entries */
+	int refcnt;               /* operations currently using this stream */
+	struct total_stream *next;
+} total_stream;
+
+static total_stream *total_streams = NULL;
+static PRLock *total_streams_lock = NULL;
+static PRCallOnceType total_streams_once;
+
+static PRStatus
+total_streams_init(void)
+{
+	total_streams_lock = PR_NewLock();
+	return (NULL == total_streams_lock) ? PR_FAILURE : PR_SUCCESS;
+}
+
+/*
+ * Called when a total update starts, once the bulk import has been
+ * started for the connection of pb. Returns 0 on success.
+ */
+int
+repl_total_stream_begin(Slapi_PBlock *pb, const Slapi_DN *repl_root)
+{
+	total_stream *ts;
+	void *conn = NULL;
+
+	if (PR_SUCCESS != PR_CallOnce(&total_streams_once, total_streams_init))
+	{
+		return -1;
+	}
+	slapi_pblock_get(pb, SLAPI_CONNECTION, &conn);
+	if (NULL == conn || NULL == repl_root)
+	{
+		return -1;
+	}
+
+	ts = (total_stream *)slapi_ch_calloc(1, sizeof(total_stream));
+	if ((ts->lock = PR_NewLock()) == NULL ||
+	    (ts->cv = PR_NewCondVar(ts->lock)) == NULL)
+	{
+		if (ts->lock)
+		{
+			PR_DestroyLock(ts->lock);
+		}
+		slapi_ch_free((void **)&ts);
+		return -1;
+	}
+	ts->root = slapi_sdn_dup(repl_root);
+	ts->conn = conn;
+
+	PR_Lock(total_streams_lock);
+	ts->next = total_streams;
+	total_streams = ts;
+	PR_Unlock(total_streams_lock);
+	return 0;
+}
+
+/*
+ * Called when the total update started by conn ends, normally or not,
+ * before the bulk import is stopped. Entries still waiting for a missing
+ * predecessor are dropped.
+ */
+void
+repl_total_stream_end(void *conn)
+{
+	total_stream *ts, **prev;
+	int i, dropped = 0;
+
+	if (NULL == total_streams_lock)
+	{
+		return;
+	}
+	PR_Lock(total_streams_lock);
+	for (prev = &total_streams; (ts = *prev) != NULL; prev = &ts->next)
+	{
+		if (ts->conn == conn)
+		{
+			*prev = ts->next;
+			break;
+		}
+	}
+	PR_Unlock(total_streams_lock);
+	if (NULL == ts)
+	{
+		return;
+	}
+
+	/* wake up and wait for the operations still holding the stream */
+	PR_Lock(ts->lock);
+	ts->failed = 1;
+	PR_NotifyAllCondVar(ts->cv);
+	while (ts->refcnt > 0)
+	{
+		PR_WaitCondVar(ts->cv, PR_SecondsToInterval(1));
+	}
+	PR_Unlock(ts->lock);
+
+	for (i = 0; i < TOTAL_STREAM_WINDOW; i++)
+	{
+		if (ts->pending[i])
+		{
+			slapi_entry_free(ts->pending[i]);
+			dropped++;
+		}
+	}
+	if (dropped)
+	{
+		slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name,
+				"repl_total_stream_end: total update of %s ended with %d entries "
+				"received out of order and not imported\n",
+				slapi_sdn_get_dn(ts->root), dropped);
+	}
+	PR_DestroyCondVar(ts->cv);
+	PR_DestroyLock(ts->lock);
+	slapi_sdn_free(&ts->root);
+	slapi_ch_free((void **)&ts);
+}
+
+/*
+ * Find the total update that entry e belongs to, and take a reference on
+ * it. An operation coming from another connection than the one that
+ * started the total update must be bound as a replication manager.
+ */
+static total_stream *
+total_stream_acquire(Slapi_PBlock *pb, const Slapi_Entry *e)
+{
+	total_stream *ts;
+	void *conn = NULL;
+	const Slapi_DN *sdn = slapi_entry_get_sdn_const(e);
+
+	if (NULL == total_streams_lock)
+	{
+		return NULL;
+	}
+	slapi_pblock_get(pb, SLAPI_CONNECTION, &conn);
+
+	PR_Lock(total_streams_lock);
+	for (ts = total_streams; ts != NULL; ts = ts->next)
+	{
+		if (slapi_sdn_issuffix(sdn, ts->root))
+		{
+			break;
+		}
+	}
+	if (ts && ts->conn != conn)
+	{
+		Object *repl_obj = replica_get_replica_from_dn(ts->root);
+		char *bind_dn = NULL;
+		Slapi_DN *bind_sdn;
+		PRBool authorized = PR_FALSE;
+
+		slapi_pblock_get(pb, SLAPI_CONN_DN, &bind_dn);
+		bind_sdn = slapi_sdn_new_dn_passin(bind_dn);
+		if (repl_obj)
+		{
+			authorized = replica_is_updatedn((Replica *)object_get_data(repl_obj), bind_sdn);
+			object_release(repl_obj);
+		}
+		slapi_sdn_free(&bind_sdn);
+		if (!authorized)
+		{
+			ts = NULL;
+		}
+	}
+	if (ts)
+	{
+		PR_Lock(ts->lock);
+		ts->refcnt++;
+		PR_Unlock(ts->lock);
+	}
+	PR_Unlock(total_streams_lock);
+	return ts;
+}
+
+static void
+total_stream_release(total_stream *ts)
+{
+	PR_Lock(ts->lock);
+	ts->refcnt--;
+	PR_NotifyAllCondVar(ts->cv);
+	PR_Unlock(ts->lock);
+}
+
+/*
+ * Queue entry e at position seq of the total update, and import all the
+ * entries that are now in order, unless another operation is already
+ * doing it. The entry is consumed in all cases. Returns an LDAP error code.
+ */
+static int
+total_stream_import(Slapi_PBlock *pb, Slapi_Entry *e, int seq)
+{
+	total_stream *ts;
+	Slapi_PBlock *import_pb;
+	Slapi_Entry *batch[TOTAL_STREAM_DRAIN];
+	PRIntervalTime timeout = PR_SecondsToInterval(TOTAL_STREAM_TIMEOUT);
+	PRIntervalTime start;
+	int waited_seq;
+	int nbatch, i;
+	int rc = LDAP_SUCCESS;
+
+	if ((ts = total_stream_acquire(pb, e)) == NULL)
+	{
+		slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name,
+				"total_stream_import: no total update in progress for entry %s\n",
+				slapi_entry_get_dn_const(e));
+		slapi_entry_free(e);
+		return LDAP_UNWILLING_TO_PERFORM;
+	}
+
+	PR_Lock(ts->lock);
+	start = PR_IntervalNow();
+	waited_seq = ts->next_seq;
+	while (!ts->failed && seq >= ts->next_seq + TOTAL_STREAM_WINDOW)
+	{
+		if (ts->next_seq != waited_seq)
+		{
+			/* the stream moved, restart the timeout */
+			start = PR_IntervalNow();
+			waited_seq = ts->next_seq;
+		}
+		else if ((PRIntervalTime)(PR_IntervalNow() - start) > timeout)
+		{
+			slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name,
+					"total_stream_import: entry #%d is still missing after %d seconds, "
+					"failing the total update of %s\n",
+					ts->next_seq, TOTAL_STREAM_TIMEOUT, slapi_sdn_get_dn(ts->root));
+			ts->failed = 1;
+			PR_NotifyAllCondVar(ts->cv);
+			break;
+		}
+		PR_WaitCondVar(ts->cv, PR_SecondsToInterval(1));
+	}
+	if (ts->failed || seq < ts->next_seq || ts->pending[seq % TOTAL_STREAM_WINDOW])
+	{
+		PR_Unlock(ts->lock);
+		slapi_entry_free(e);
+		total_stream_release(ts);
+		return LDAP_OPERATIONS_ERROR;
+	}
+	ts->pending[seq % TOTAL_STREAM_WINDOW] = e;
+	if (ts->draining)
+	{
+		/* the operation importing the stream will pick the entry up */
+		PR_Unlock(ts->lock);
+		total_stream_release(ts);
+		return LDAP_SUCCESS;
+	}
+	ts->draining = 1;
+
+	import_pb = slapi_pblock_new();
+	slapi_pblock_set(import_pb, SLAPI_CONNECTION, ts->conn);
+	while (!ts->failed)
+	{
+		for (nbatch = 0; nbatch < TOTAL_STREAM_DRAIN; nbatch++)
+		{
+			if ((e = ts->pending[ts->next_seq % TOTAL_STREAM_WINDOW]) == NULL)
+			{
+				break;
+			}
+			ts->pending[ts->next_seq % TOTAL_STREAM_WINDOW] = NULL;
+			batch[nbatch] = e;
+			ts->next_seq++;
+		}
+		if (nbatch == 0)
+		{
+			break;
+		}
+		/* let the operations waiting for the window go on */
+		PR_NotifyAllCondVar(ts->cv);
+		PR_Unlock(ts->lock);
+
+		for (i = 0; i < nbatch; i++)
+		{
+			slapi_pblock_set(import_pb, SLAPI_BACKEND, NULL);
+			rc = slapi_import_entry(import_pb, batch[i]);
+			if (rc != LDAP_SUCCESS)
+			{
+				slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name,
+						"Error %d: could not import entry dn %s (#%d) "
+						"for parallel total update\n",
+						rc, slapi_entry_get_dn_const(batch[i]),
+						ts->next_seq - nbatch + i);
+				break;
+			}
+		}
+
+		PR_Lock(ts->lock);
+		if (i < nbatch)
+		{
+			for (; i < nbatch; i++)
+			{
+				slapi_entry_free(batch[i]);
+			}
+			ts->failed = 1;
+		}
+	}
+	ts->draining = 0;
+	slapi_pblock_destroy(import_pb);
+	PR_NotifyAllCondVar(ts->cv);
+	PR_Unlock(ts->lock);
+
+	total_stream_release(ts);
+	return rc;
+}
+
 /*
  * This plugin entry point is called whenever an NSDS50ReplicationEntry
  * extended operation is received.
@@ -822,14 +1203,29 @@ multimaster_extop_NSDS50ReplicationEntry(Slapi_PBlock  *pb)
     Slapi_Connection *conn = NULL;
 	PRUint64 connid = 0;
 	int opid = 0;
+	int seq = -1;
 	
 	slapi_pblock_get(pb, SLAPI_CONN_ID, &connid);
 	slapi_pblock_get(pb, SLAPI_OPERATION_ID, &opid);
 
 	/* Decode the extended operation */
-	rc = decode_total_update_extop(pb, &e);
+	rc = decode_total_update_extop(pb, &e, &seq);
 
-	if (0 == rc)
+	if (0 == rc && seq >= 0)
+	{
+		/* parallel total update: the entry is consumed */
+		rc = total_stream_import(pb, e, seq);
+		e = NULL;
+		if (rc != LDAP_SUCCESS)
+		{
+			slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name,
+							"Error %d: could not queue entry #%d "
+							"for total update operation conn=%" NSPRIu64 " op=%d\n",
+							rc, seq, connid, opid);
+			rc = -1;
+		}
+	}
+	else if (0 == rc)
 	{
 #ifdef notdef
 		/*
@@ -83,6 +83,7 @@ void consumer_connection_extension_destructor (void *ext, void *object, void *pa
 									"Aborting total update in progress for replicated "
 									"area %s connid=%" NSPRIu64 "\n", slapi_sdn_get_dn(repl_root_sdn),
 									connid);
+					repl_total_stream_end(connext->connection);
 					slapi_stop_bulk_import(pb);
 				}
 				else
@@ -260,6 +260,155 @@ NSDS50EndReplicationRequest_new(char *repl_root)
 	return(create_ReplicationExtopPayload(NULL, repl_root, NULL, NULL, 1, 0, 0));
 }
 
+/*
+ * The NSDS95ReplicationBatch extended operation carries several changes
+ * of an incremental update session in a single request:
+ *
+ *     requestValue ::= SEQUENCE {
+ *         replicatedTree LDAPDN,
+ *         changes SEQUENCE OF SEQUENCE {
+ *             operationType ENUMERATED,
+ *             targetDN LDAPDN,
+ *             updateInfo OCTET STRING, -- NSDS50ReplUpdateInfoControl value
+ *             -- then, depending on the operation type:
+ *             -- add:    attributes SEQUENCE OF SEQUENCE { type, SET OF value }
+ *             -- modify: modifications SEQUENCE OF SEQUENCE { op, SEQUENCE { type, SET OF value } }
+ *             -- modrdn: newrdn, newsuperior ("" if none), deleteoldrdn BOOLEAN
+ *             -- delete: nothing
+ *         }
+ *     }
+ *
+ * The response holds a response code and the LDAP result code of each
+ * change, in the order they were sent:
+ *
+ *     responseValue ::= SEQUENCE {
+ *         responseCode ENUMERATED,
+ *         results SEQUENCE OF INTEGER
+ *     }
+ */
+BerElement *
+NSDS95ReplicationBatch_new(const char *repl_root)
+{
+	BerElement *batch = NULL;
+
+	if ((batch = der_alloc()) == NULL)
+	{
+		return NULL;
+	}
+	/* Begin the outer sequence and the sequence of changes */
+	if (ber_printf(batch, "{s{", repl_root) == -1)
+	{
+		ber_free(batch, 1);
+		batch = NULL;
+	}
+	return batch;
+}
+
+/*
+ * Append a change to a batch. mods are the attributes of the entry
+ * for an add, or the modifications for a modify; they must use
+ * LDAP_MOD_BVALUES. Returns 0 on success, -1 on encoding error.
+ */
+int
+NSDS95ReplicationBatch_add(BerElement *batch, unsigned long operation_type,
+	const char *dn, LDAPControl *update_control, LDAPMod **mods,
+	const char *newrdn, const char *newsuperior, int deleteoldrdn)
+{
+	int i;
+
+	if (NULL == batch || NULL == dn || NULL == update_control)
+	{
+		return -1;
+	}
+	if (ber_printf(batch, "{esO", (ber_int_t)operation_type, dn,
+	               &(update_control->ldctl_value)) == -1)
+	{
+		return -1;
+	}
+	switch (operation_type)
+	{
+	case SLAPI_OPERATION_ADD:
+		if (ber_printf(batch, "{") == -1)
+		{
+			return -1;
+		}
+		for (i = 0; mods && mods[i]; i++)
+		{
+			if (ber_printf(batch, "{s[V]}", mods[i]->mod_type,
+			               mods[i]->mod_bvalues) == -1)
+			{
+				return -1;
+			}
+		}
+		if (ber_printf(batch, "}") == -1)
+		{
+			return -1;
+		}
+		break;
+	case SLAPI_OPERATION_MODIFY:
+		if (ber_printf(batch, "{") == -1)
+		{
+			return -1;
+		}
+		for (i = 0; mods && mods[i]; i++)
+		{
+			if (ber_printf(batch, "{e{s[V]}}",
+			               (ber_int_t)(mods[i]->mod_op & ~LDAP_MOD_BVALUES),
+			               mods[i]->mod_type, mods[i]->mod_bvalues) == -1)
+			{
+				return -1;
+			}
+		}
+		if (ber_printf(batch, "}") == -1)
+		{
+			return -1;
+		}
+		break;
+	case SLAPI_OPERATION_MODRDN:
+		if (ber_printf(batch, "ssb", newrdn ? newrdn : "",
+		               newsuperior ? newsuperior : "", deleteoldrdn) == -1)
+		{
+			return -1;
+		}
+		break;
+	case SLAPI_OPERATION_DELETE:
+		break;
+	default:
+		return -1;
+	}
+	/* End the sequence for this change */
+	if (ber_printf(batch, "}") == -1)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Close the batch and return the payload of the extended operation.
+ * The batch is freed in all cases. Returns NULL on encoding error.
+ */
+struct berval *
+NSDS95ReplicationBatch_done(BerElement **batch)
+{
+	struct berval *req_data = NULL;
+
+	if (NULL == batch || NULL == *batch)
+	{
+		return NULL;
+	}
+	if (ber_printf(*batch, "}}") != -1)
+	{
+		if (ber_flatten(*batch, &req_data) != 0)
+		{
+			req_data = NULL;
+		}
+	}
+	ber_free(*batch, 1);
+	*batch = NULL;
+	return req_data;
+}
+
 static int 
 decode_ruv (BerElement *ber, RUV **ruv)
 {
@@ -570,6 +719,75 @@ decode_repl_ext_response(struct berval *bvdata, int *response_code,
 	return return_value;
 }
 
+/*
+ * Decode an NSDS95ReplicationBatch extended response. On success,
+ * results is an array of nresults LDAP result codes, one for each
+ * change of the batch, which the caller must free.
+ * Returns 0 on success, or -1 if the response could not be parsed.
+ */
+int
+decode_repl_batch_response(struct berval *bvdata, int *response_code,
+	int **results, int *nresults)
+{
+	BerElement *tmp_bere = NULL;
+	ber_int_t temp_response_code = 0;
+	ber_tag_t tag;
+	ber_len_t len;
+	char *last;
+	int count = 0;
+	int size = 0;
+	int return_value = 0;
+
+	if ((NULL == response_code) || (NULL == results) || (NULL == nresults) ||
+	    !BV_HAS_DATA(bvdata))
+	{
+		return -1;
+	}
+	*results = NULL;
+	*nresults = 0;
+	if ((tmp_bere = ber_init(bvdata)) == NULL)
+	{
+		return -1;
+	}
+	if (ber_scanf(tmp_bere, "{e", &temp_response_code) == LBER_ERROR)
+	{
+		return_value = -1;
+		goto free_and_return;
+	}
+	*response_code = (int)temp_response_code;
+	for (tag = ber_first_element(tmp_bere, &len, &last);
+	     tag != LBER_ERROR && tag != LBER_END_OF_SEQORSET;
+	     tag = ber_next_element(tmp_bere, &len, last))
+	{
+		ber_int_t result;
+		if (ber_scanf(tmp_bere, "i", &result) == LBER_ERROR)
+		{
+			return_value = -1;
+			goto free_and_return;
+		}
+		if (count == size)
+		{
+			size = size ? size * 2 : 64;
+			*results = (int *)slapi_ch_realloc((char *)*results, size * sizeof(int));
+		}
+		(*results)[count++] = (int)result;
+	}
+	if (ber_scanf(tmp_bere, "}") == LBER_ERROR)
+	{
+		return_value = -1;
+	}
+
+free_and_return:
+	if (0 != return_value)
+	{
+		slapi_ch_free((void **)results);
+		count = 0;
+	}
+	*nresults = count;
+	ber_free(tmp_bere, 1);
+	return return_value;
+}
+
 
 /*
  * This plugin entry point is called whenever a
@@ -968,6 +1186,14 @@ multimaster_extop_StartNSDS50ReplicationRequest(Slapi_PBlock *pb)
 			
 		    goto send_response;    
         }
+		/* let the supplier send the entries over several connections */
+		if (repl_total_stream_begin(pb, repl_root_sdn) != 0)
+		{
+			slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name,
+				"conn=%" NSPRIu64 " op=%d repl=\"%s\": "
+				"parallel total update is not available\n",
+				connid, opid, repl_root);
+		}
 		slapi_ch_free_string(&mtnstate);
 		charray_free(mtnreferral);
 		mtnreferral = NULL;
@@ -1254,6 +1480,7 @@ multimaster_extop_EndNSDS50ReplicationRequest(Slapi_PBlock *pb)
                 }
                 slapi_pblock_set (pb, SLAPI_TARGET_SDN, repl_root_sdn);
 
+                repl_total_stream_end (conn);
                 slapi_stop_bulk_import (pb); 
 
                 /* ONREPL - this is a bit of a hack. Once bulk import is finished,
@@ -1356,6 +1583,419 @@ free_and_return:
 	return return_value;
 }
 
+/*
+ * Decode the attribute list of a batched change, into the entry for
+ * an add, or into smods for a modify (with_op set).
+ * Returns 0 on success, -1 on decoding error.
+ */
+static int
+decode_batch_mods(BerElement *ber, int with_op, Slapi_Entry *e, Slapi_Mods *smods)
+{
+	ber_tag_t tag;
+	ber_len_t len;
+	char *last;
+
+	for (tag = ber_first_element(ber, &len, &last);
+	     tag != LBER_ERROR && tag != LBER_END_OF_SEQORSET;
+	     tag = ber_next_element(ber, &len, last))
+	{
+		ber_int_t op = LDAP_MOD_ADD;
+		char *type = NULL;
+		struct berval **vals = NULL;
+		int rc;
+
+		if (with_op)
+		{
+			rc = ber_scanf(ber, "{e{a[V]}}", &op, &type, &vals);
+		}
+		else
+		{
+			rc = ber_scanf(ber, "{a[V]}", &type, &vals);
+		}
+		if (LBER_ERROR == rc)
+		{
+			slapi_ch_free_string(&type);
+			ber_bvecfree(vals);
+			return -1;
+		}
+		if (e)
+		{
+			if (NULL == vals || slapi_entry_add_values(e, type, vals) != LDAP_SUCCESS)
+			{
+				slapi_ch_free_string(&type);
+				ber_bvecfree(vals);
+				return -1;
+			}
+			/* the replicated entry keeps its uniqueid */
+			if (strcasecmp(type, SLAPI_ATTR_UNIQUEID) == 0)
+			{
+				slapi_entry_set_uniqueid(e, slapi_ch_strdup(vals[0]->bv_val));
+			}
+		}
+		else
+		{
+			slapi_mods_add_modbvps(smods, op, type, vals);
+		}
+		slapi_ch_free_string(&type);
+		ber_bvecfree(vals);
+	}
+	return 0;
+}
+
+/* One decoded change of an NSDS95ReplicationBatch request */
+typedef struct batch_change {
+	ber_int_t optype;
+	char *dn;
+	struct berval update_info;
+	Slapi_Entry *e;           /* add */
+	Slapi_Mods smods;         /* modify */
+	char *newrdn;             /* modrdn */
+	char *newsuperior;
+	ber_int_t deleteoldrdn;
+} batch_change;
+
+static void
+batch_change_free(batch_change **change)
+{
+	if (NULL == change || NULL == *change)
+	{
+		return;
+	}
+	slapi_entry_free((*change)->e);
+	slapi_mods_done(&(*change)->smods);
+	slapi_ch_free_string(&(*change)->dn);
+	slapi_ch_free_string(&(*change)->newrdn);
+	slapi_ch_free_string(&(*change)->newsuperior);
+	if (NULL != (*change)->update_info.bv_val)
+	{
+		ldap_memfree((*change)->update_info.bv_val);
+	}
+	slapi_ch_free((void **)change);
+}
+
+/*
+ * Decode one change of an NSDS95ReplicationBatch request.
+ * Returns NULL on decoding error; the rest of the batch can't be trusted
+ * then.
+ */
+static batch_change *
+batch_decode_change(BerElement *ber)
+{
+	batch_change *change = (batch_change *)slapi_ch_calloc(1, sizeof(batch_change));
+
+	slapi_mods_init(&change->smods, 0);
+	if (ber_scanf(ber, "{eao", &change->optype, &change->dn, &change->update_info) == LBER_ERROR)
+	{
+		goto decoding_error;
+	}
+	switch (change->optype)
+	{
+	case SLAPI_OPERATION_ADD:
+		change->e = slapi_entry_alloc();
+		slapi_entry_init(change->e, slapi_ch_strdup(change->dn), NULL);
+		if (ber_scanf(ber, "{") == LBER_ERROR ||
+		    decode_batch_mods(ber, 0, change->e, NULL) ||
+		    ber_scanf(ber, "}") == LBER_ERROR)
+		{
+			goto decoding_error;
+		}
+		break;
+	case SLAPI_OPERATION_MODIFY:
+		if (ber_scanf(ber, "{") == LBER_ERROR ||
+		    decode_batch_mods(ber, 1, NULL, &change->smods) ||
+		    ber_scanf(ber, "}") == LBER_ERROR)
+		{
+			goto decoding_error;
+		}
+		break;
+	case SLAPI_OPERATION_MODRDN:
+		if (ber_scanf(ber, "aab", &change->newrdn, &change->newsuperior,
+		              &change->deleteoldrdn) == LBER_ERROR)
+		{
+			goto decoding_error;
+		}
+		break;
+	case SLAPI_OPERATION_DELETE:
+		break;
+	default:
+		goto decoding_error;
+	}
+	if (ber_scanf(ber, "}") == LBER_ERROR)
+	{
+		goto decoding_error;
+	}
+	return change;
+
+decoding_error:
+	batch_change_free(&change);
+	return NULL;
+}
+
+/*
+ * Apply a decoded change with an internal operation flagged as
+ * replicated, which goes through the same URP and changelog processing
+ * as an update received on its own. Returns the LDAP result of the change.
+ */
+static int
+batch_apply_change(batch_change *change)
+{
+	LDAPControl update_control;
+	LDAPControl *ctrls[2];
+	Slapi_PBlock *pb = NULL;
+	Slapi_DN *sdn = NULL;
+	Slapi_DN *newsuperior_sdn = NULL;
+	int flags = OP_FLAG_REPLICATED | SLAPI_OP_FLAG_BYPASS_REFERRALS;
+	int rc = LDAP_SUCCESS;
+
+	/* The update info control is the one a single update would carry */
+	update_control.ldctl_oid = (char *)REPL_NSDS50_UPDATE_INFO_CONTROL_OID;
+	update_control.ldctl_value = change->update_info;
+	update_control.ldctl_iscritical = 1;
+	ctrls[0] = &update_control;
+	ctrls[1] = NULL;
+
+	pb = slapi_pblock_new();
+	switch (change->optype)
+	{
+	case SLAPI_OPERATION_ADD:
+		slapi_add_entry_internal_set_pb(pb, change->e, ctrls,
+			repl_get_plugin_identity(PLUGIN_MULTIMASTER_REPLICATION), flags);
+		change->e = NULL; /* consumed by the operation */
+		slapi_add_internal_pb(pb);
+		break;
+	case SLAPI_OPERATION_MODIFY:
+		sdn = slapi_sdn_new_dn_byref(change->dn);
+		slapi_modify_internal_set_pb_ext(pb, sdn, slapi_mods_get_ldapmods_byref(&change->smods),
+			ctrls, NULL, repl_get_plugin_identity(PLUGIN_MULTIMASTER_REPLICATION), flags);
+		slapi_modify_internal_pb(pb);
+		break;
+	case SLAPI_OPERATION_MODRDN:
+		sdn = slapi_sdn_new_dn_byref(change->dn);
+		if (change->newsuperior && *change->newsuperior)
+		{
+			newsuperior_sdn = slapi_sdn_new_dn_byref(change->newsuperior);
+		}
+		slapi_rename_internal_set_pb_ext(pb, sdn, change->newrdn, newsuperior_sdn,
+			change->deleteoldrdn, ctrls, NULL,
+			repl_get_plugin_identity(PLUGIN_MULTIMASTER_REPLICATION), flags);
+		slapi_modrdn_internal_pb(pb);
+		break;
+	case SLAPI_OPERATION_DELETE:
+		slapi_delete_internal_set_pb(pb, change->dn, ctrls, NULL,
+			repl_get_plugin_identity(PLUGIN_MULTIMASTER_REPLICATION), flags);
+		slapi_delete_internal_pb(pb);
+		break;
+	}
+	slapi_pblock_get(pb, SLAPI_PLUGIN_INTOP_RESULT, &rc);
+
+	slapi_pblock_destroy(pb);
+	slapi_sdn_free(&sdn);
+	slapi_sdn_free(&newsuperior_sdn);
+	return rc;
+}
+
+/*
+ * Move the RUV past the changes of a committed change of the batch, or
+ * forget them if it failed.
+ */
+static void
+batch_update_ruv(Replica *r, repl_batch_context *batch, int committed)
+{
+	consumer_connection_extension *connext = (consumer_connection_extension *)batch->connext;
+	Object *ruv_obj = replica_get_ruv(r);
+	const char *purl;
+	int i;
+
+	for (i = 0; i < batch->ncsns; i++)
+	{
+		if (committed)
+		{
+			purl = ruv_get_purl_for_replica((RUV *)connext->supplier_ruv,
+				csn_get_replicaid(batch->csns[i]));
+			if (replica_update_ruv(r, batch->csns[i], purl) != RUV_SUCCESS)
+			{
+				char csn_str[CSN_STRSIZE];
+				slapi_log_error(SLAPI_LOG_REPL, repl_plugin_name,
+					"multimaster_extop_NSDS95ReplicationBatch: RUV not updated for csn %s\n",
+					csn_as_string(batch->csns[i], PR_FALSE, csn_str));
+			}
+		}
+		else if (ruv_obj)
+		{
+			ruv_cancel_csn_inprogress((RUV *)object_get_data(ruv_obj), batch->csns[i]);
+		}
+		csn_free(&batch->csns[i]);
+	}
+	batch->ncsns = 0;
+	if (ruv_obj)
+	{
+		object_release(ruv_obj);
+	}
+}
+
+/*
+ * This plugin entry point is called whenever an
+ * NSDS95ReplicationBatch request is received.
+ *
+ * The whole request is decoded first: a request that can't be decoded is
+ * rejected before anything is applied. The changes are then applied in
+ * order, each one in its own operation and backend transaction, and all
+ * their results go back in one response, so the consumer pays one round
+ * trip for the whole batch. A change that fails is reported in the
+ * response and does not abort the others; the supplier decides, as it
+ * does for single updates, whether the failure can be skipped. The
+ * consumer RUV only moves past a change once it is committed.
+ */
+int
+multimaster_extop_NSDS95ReplicationBatch(Slapi_PBlock *pb)
+{
+	int return_value = SLAPI_PLUGIN_EXTENDED_NOT_HANDLED;
+	char *extop_oid = NULL;
+	struct berval *extop_value = NULL;
+	BerElement *tmp_bere = NULL;
+	BerElement *resp_bere = NULL;
+	struct berval *resp_bval = NULL;
+	char *repl_root = NULL;
+	Slapi_DN *repl_root_sdn = NULL;
+	Replica *r = NULL;
+	void *conn = NULL;
+	consumer_connection_extension *connext = NULL;
+	repl_batch_context batch = {0};
+	batch_change **changes = NULL;
+	ber_int_t response = NSDS50_REPL_REPLICA_READY;
+	int *results = NULL;
+	int nchanges = 0;
+	int nresults = 0;
+	int size = 0;
+	int i;
+
+	slapi_pblock_get(pb, SLAPI_EXT_OP_REQ_OID, &extop_oid);
+	slapi_pblock_get(pb, SLAPI_EXT_OP_REQ_VALUE, &extop_value);
+	slapi_pblock_get(pb, SLAPI_CONNECTION, &conn);
+
+	if ((NULL == extop_oid) ||
+	    (strcmp(extop_oid, REPL_NSDS95_REPLICATION_BATCH_REQUEST_OID) != 0) ||
+	    !BV_HAS_DATA(extop_value) ||
+	    ((tmp_bere = ber_init(extop_value)) == NULL) ||
+	    (ber_scanf(tmp_bere, "{a", &repl_root) == LBER_ERROR))
+	{
+		response = NSDS50_REPL_DECODING_ERROR;
+		goto send_response;
+	}
+
+	/* Only accept a batch inside an incremental session holding the replica */
+	connext = (consumer_connection_extension *)repl_con_get_ext(REPL_CON_EXT_CONN, conn);
+	if (NULL == connext || !connext->isreplicationsession ||
+	    NULL == connext->replica_acquired ||
+	    connext->repl_protocol_version != REPL_PROTOCOL_50_INCREMENTAL)
+	{
+		response = NSDS50_REPL_PERMISSION_DENIED;
+		goto send_response;
+	}
+	repl_root_sdn = slapi_sdn_new_dn_byref(repl_root);
+	r = (Replica *)object_get_data((Object *)connext->replica_acquired);
+	if (slapi_sdn_compare(repl_root_sdn, replica_get_root(r)))
+	{
+		response = NSDS50_REPL_NO_SUCH_REPLICA;
+		goto send_response;
+	}
+	if (slapi_be_select(repl_root_sdn) == NULL)
+	{
+		response = NSDS50_REPL_INTERNAL_ERROR;
+		goto send_response;
+	}
+
+	{
+		ber_tag_t tag;
+		ber_len_t len;
+		char *last;
+
+		for (tag = ber_first_element(tmp_bere, &len, &last);
+		     tag != LBER_ERROR && tag != LBER_END_OF_SEQORSET;
+		     tag = ber_next_element(tmp_bere, &len, last))
+		{
+			batch_change *change = batch_decode_change(tmp_bere);
+			if (NULL == change)
+			{
+				slapi_log_error(SLAPI_LOG_FATAL, repl_plugin_name,
+					"multimaster_extop_NSDS95ReplicationBatch: unable to decode "
+					"change %d of the batch, none applied\n", nchanges + 1);
+				response = NSDS50_REPL_DECODING_ERROR;
+				goto send_response;
+			}
+			if (nchanges == size)
+			{
+				size = size ? size * 2 : 64;
+				changes = (batch_change **)slapi_ch_realloc((char *)changes,
+					size * sizeof(batch_change *));
+			}
+			changes[nchanges++] = change;
+		}
+	}
+
+	batch.connext = connext;
+	set_thread_private_batch(&batch);
+	results = (int *)slapi_ch_calloc(nchanges ? nchanges : 1, sizeof(int));
+	for (i = 0; i < nchanges; i++)
+	{
+		/* each change is its own operation and transaction */
+		results[nresults++] = batch_apply_change(changes[i]);
+		batch_update_ruv(r, &batch, results[i] == LDAP_SUCCESS);
+	}
+	set_thread_private_batch(NULL);
+
+send_response:
+	if ((resp_bere = der_alloc()) == NULL)
+	{
+		goto free_and_return;
+	}
+	if (ber_printf(resp_bere, "{e{", response) == -1)
+	{
+		goto free_and_return;
+	}
+	for (i = 0; i < nresults; i++)
+	{
+		if (ber_printf(resp_bere, "i", (ber_int_t)results[i]) == -1)
+		{
+			goto free_and_return;
+		}
+	}
+	if (ber_printf(resp_bere, "}}") == -1)
+	{
+		goto free_and_return;
+	}
+	ber_flatten(resp_bere, &resp_bval);
+	slapi_pblock_set(pb, SLAPI_EXT_OP_RET_OID, REPL_NSDS95_REPLICATION_BATCH_RESPONSE_OID);
+	slapi_pblock_set(pb, SLAPI_EXT_OP_RET_VALUE, resp_bval);
+	slapi_send_ldap_result(pb, LDAP_SUCCESS, NULL, NULL, 0, NULL);
+
+	return_value = SLAPI_PLUGIN_EXTENDED_SENT_RESULT;
+
+free_and_return:
+	slapi_ch_free_string(&repl_root);
+	slapi_sdn_free(&repl_root_sdn);
+	slapi_ch_free((void **)&results);
+	for (i = 0; i < nchanges; i++)
+	{
+		batch_change_free(&changes[i]);
+	}
+	slapi_ch_free((void **)&changes);
+	slapi_ch_free((void **)&batch.csns);
+	if (NULL != tmp_bere)
+	{
+		ber_free(tmp_bere, 1);
+	}
+	if (NULL != resp_bere)
+	{
+		ber_free(resp_bere, 1);
+	}
+	if (NULL != resp_bval)
+	{
+		ber_bvfree(resp_bval);
+	}
+	return return_value;
+}
+
 /*
  *  Return the mtnode extension of the dn
  */
@@ -112,6 +112,9 @@ const char *type_nsds5ReplicaEnabled = "nsds5ReplicaEnabled";
 const char *type_nsds5ReplicaStripAttrs = "nsds5ReplicaStripAttrs";
 const char* type_nsds5ReplicaFlowControlWindow = "nsds5ReplicaFlowControlWindow";
 const char* type_nsds5ReplicaFlowControlPause = "nsds5ReplicaFlowControlPause";
+const char* type_nsds5ReplicaFlowControlAdaptive = "nsds5ReplicaFlowControlAdaptive";
+const char* type_nsds5ReplicaUpdateBatchSize = "nsds5ReplicaUpdateBatchSize";
+const char* type_nsds5ReplicaTotalUpdateStreams = "nsds5ReplicaTotalUpdateStreams";
 const char *type_nsds5WaitForAsyncResults = "nsds5ReplicaWaitForAsyncResults";
 
 /* windows sync specific attributes */
@@ -31,6 +31,7 @@
 #include "vattr_spi.h"
 #include "roles_cache.h"
 #include "views.h"
+#include "index_subsys.h"
 
 #ifdef SOLARIS
 #include <tnf/probe.h>
@@ -40,29 +41,81 @@
 
 #define MAX_NESTED_ROLES 30
 
+/* Bitmaps of the member entry IDs */
+#define ROLE_MEMBERS_WORD_BITS 32
+#define ROLE_MEMBERS_INITIAL_WORDS 64
+
+#define ROLE_MEMBERS_PENDING 0	/* to be populated by the suffix thread */
+#define ROLE_MEMBERS_BUILDING 1	/* being populated */
+#define ROLE_MEMBERS_READY 2
+#define ROLE_MEMBERS_UNAVAILABLE 3	/* could not be populated */
+
+#define ROLE_ENTRYID_ATTR "entryid"
+#define ROLE_INDEX_PLUGIN_ID "roles"
+#define ROLE_INDEX_FILTER "(" NSROLEATTR "=**)"
+
 static char *allUserAttributes[] = {
     LDAP_ALL_USER_ATTRS,
     NULL
 };
 
+static char *entryidAttributes[] = {
+    ROLE_ENTRYID_ATTR,
+    NULL
+};
+
+/* Attributes which change without the entry being modified */
+static char *unstableAttributes[] = {
+    "numsubordinates",
+    "hassubordinates",
+    "tombstonenumsubordinates",
+    NULL
+};
+
 /* views scoping */
 static void **views_api;
 
 /* Service provider handler */
 static vattr_sp_handle *vattr_handle = NULL;
 
+/* Virtual index on nsRole: decoder registered, suffixes of the backends it serves */
+static int roles_index_registered = 0;
+static char **roles_index_suffixes = NULL;
+
 /* List of nested roles */
 typedef struct _role_object_nested {
 	Slapi_DN *dn;	/* value of attribute nsroledn in a nested role definition */
 } role_object_nested;
 
+/* Members of a managed or filtered role: the entry IDs of the entries of be below base.
+   Owned by the members_list of the suffix, the role and the thread populating it hold a reference */
+typedef struct _role_members {
+	struct _role_members *next;
+	struct _roles_cache_def *suffix_def;	/* NULL once unlinked */
+	int refcnt;
+	int state;		/* ROLE_MEMBERS_xxx */
+	Slapi_DN *dn;	/* dn of the role entry */
+	Slapi_DN *base;
+	Slapi_Backend *be;
+	char *search_filter;	/* finds the members below base */
+	Slapi_Filter *filter;	/* tells whether an entry is a member */
+	char **filter_types;	/* types tested by filter */
+	PRUint32 *ids;	/* bitmap of the member IDs */
+	PRUint32 ids_words;
+	PRUint32 *touched;	/* while building: IDs already set or cleared by the post operations */
+	PRUint32 touched_words;
+} role_members;
+
 /* Role object structure */
 typedef struct _role_object {
     Slapi_DN *dn;	/* dn of a role entry */
     Slapi_DN *rolescopedn; /* if set, this role will apply to any entry in the scope of this dn */
     int type;		/* ROLE_TYPE_MANAGED|ROLE_TYPE_FILTERED|ROLE_TYPE_NESTED */
     Slapi_Filter *filter; /* if ROLE_TYPE_FILTERED */
+    char *filter_str; /* if ROLE_TYPE_FILTERED: value of nsRoleFilter */
     Avlnode *avl_tree; /* if ROLE_TYPE_NESTED: tree of nested DNs (avl_data is a role_object_nested struct) */
+    Slapi_DN *member_base; /* parent of the scope: the members are below it */
+    role_members *members; /* if ROLE_TYPE_MANAGED|ROLE_TYPE_FILTERED: NULL if not maintained */
 } role_object;
 
 /* Structure containing the roles definitions for a given suffix */
@@ -98,6 +151,12 @@ typedef struct _roles_cache_def {
 	Slapi_Entry *notified_entry;
 	int notified_operation;
 
+	/* Member bitmaps of the roles (role_members structs) */
+	Slapi_RWLock *members_lock;
+	role_members *members_list;
+	/* Set when the thread must populate the member bitmaps (protected by change_lock) */
+	int members_rebuild;
+
 } roles_cache_def;
 
 
@@ -114,6 +173,8 @@ typedef struct _roles_cache_build_result
     int has_value;					/* flag to determine if a new value has been added to the result */
     int need_value;					/* flag to determine if we need the result */
 	vattr_context *context;			/* vattr context */
+	Slapi_Backend *be;				/* backend of requested_entry, NULL not to use the member bitmaps */
+	IndexEntryID entry_id;			/* its entry ID in be, 0 if not known yet */
 } roles_cache_build_result;
 
 /* Structure used to check if is_entry_member_of is part of a role defined in its suffix */
@@ -122,6 +183,8 @@ typedef struct _roles_cache_search_in_nested
     Slapi_Entry *is_entry_member_of;
     int present;		/* flag to know if the entry is part of a role */
     int hint;			/* to check the depth of the nested */
+    Slapi_Backend *be;		/* backend of is_entry_member_of */
+    IndexEntryID entry_id;	/* its entry ID in be, 0 if not known yet */
 } roles_cache_search_in_nested;
 
 /* Structure used to handle roles searches */
@@ -131,6 +194,27 @@ typedef struct _roles_cache_search_roles
     int rc;			/* to check the depth of the nested */
 } roles_cache_search_roles;
 
+/* Structure used to populate the member bitmap of a role */
+typedef struct _roles_cache_search_members
+{
+	roles_cache_def *suffix_def;
+	role_members *members;
+	int incomplete;		/* set if an entry had no ID */
+	int rc;
+} roles_cache_search_members;
+
+/* Structure used to build the candidate list of an nsRole filter */
+typedef struct _roles_cache_index_lookup
+{
+	roles_cache_def *suffix_def;
+	Slapi_Backend *be;
+	Slapi_DN *base;		/* the members must be below it */
+	PRUint32 *ids;		/* union of the member bitmaps */
+	PRUint32 words;
+	int hint;			/* to check the depth of the nested */
+	int rc;
+} roles_cache_index_lookup_arg;
+
 static roles_cache_def* roles_cache_create_suffix(Slapi_DN *sdn);
 static int roles_cache_add_roles_from_suffix(Slapi_DN *suffix_dn, roles_cache_def *suffix_def);
 static void roles_cache_wait_on_change(void * arg);
@@ -163,6 +247,31 @@ static int roles_cache_dump( caddr_t data, caddr_t arg );
 static int roles_cache_add_entry_cb(Slapi_Entry* e, void *callback_data);
 static void roles_cache_result_cb( int rc, void *callback_data);
 static Slapi_DN* roles_cache_get_top_suffix(Slapi_DN *suffix);
+static void roles_cache_register_index();
+static int roles_cache_index_lookup(Slapi_Filter *f, IndexEntryList **results, void *user_data);
+static int roles_cache_index_collect(role_object *this_role, roles_cache_index_lookup_arg *arg);
+static int roles_cache_index_collect_nested(caddr_t data, caddr_t arg);
+static int roles_cache_filter_type_cb(Slapi_Filter *f, void *arg);
+static role_members *roles_cache_members_new(role_object *this_role);
+static void roles_cache_members_link(roles_cache_def *suffix_def, role_members *members);
+static void roles_cache_members_free(role_members *members);
+static void roles_cache_members_unref(role_members *members);
+static void roles_cache_members_reset(role_members *members);
+static int roles_cache_members_virtual(role_members *members);
+static int roles_cache_members_valid(role_members *members, Slapi_Backend *be);
+static int roles_cache_stored_entries(vattr_context *c);
+static int roles_cache_members_probe(role_object *this_role, roles_cache_search_in_nested *get_nsrole);
+static int roles_cache_members_build(roles_cache_def *suffix_def, role_members *members);
+static int roles_cache_members_entry_cb(Slapi_Entry* e, void *callback_data);
+static void roles_cache_members_result_cb(int rc, void *callback_data);
+static void roles_cache_bitmap_set(PRUint32 **words, PRUint32 *count, IndexEntryID id);
+static void roles_cache_bitmap_clear(PRUint32 *words, PRUint32 count, IndexEntryID id);
+static int roles_cache_bitmap_test(PRUint32 *words, PRUint32 count, IndexEntryID id);
+static void roles_cache_update_members(Slapi_DN *top_suffix, Slapi_Backend *be, Slapi_Entry *pre, Slapi_Entry *post);
+static void roles_cache_undo_members(Slapi_PBlock *pb, Slapi_Backend *be);
+static void roles_cache_invalidate_members(Slapi_DN *top_suffix);
+static void roles_cache_schedule_members(roles_cache_def *suffix_def);
+static void roles_cache_rebuild_members(roles_cache_def *suffix_def);
 
 /* 	============== FUNCTIONS ================ */
 
@@ -248,6 +357,9 @@ int roles_cache_init()
 		return(-1);
 	}
 
+	/* Give the backends candidate lists for the nsRole filters */
+	roles_cache_register_index();
+
     slapi_log_error( SLAPI_LOG_PLUGIN, ROLES_PLUGIN_SUBSYSTEM, "<-- roles_cache_init\n");
     return rc;
 }
@@ -276,12 +388,14 @@ static roles_cache_def *roles_cache_create_suffix(Slapi_DN *sdn)
 	}
 
 	new_suffix->cache_lock = slapi_new_rwlock();
+	new_suffix->members_lock = slapi_new_rwlock();
 	new_suffix->change_lock = slapi_new_mutex();
 	new_suffix->stop_lock = slapi_new_mutex();
 	new_suffix->create_lock = slapi_new_mutex();
 	if (    new_suffix->stop_lock == NULL ||
 			new_suffix->change_lock == NULL ||
 			new_suffix->cache_lock == NULL || 
+			new_suffix->members_lock == NULL || 
 			new_suffix->create_lock == NULL )
 	{
 		slapi_log_error( SLAPI_LOG_FATAL, ROLES_PLUGIN_SUBSYSTEM,
@@ -401,13 +515,24 @@ static void roles_cache_wait_on_change(void * arg)
 			test roles_def->keeprunning before 
 			going to sleep.
 		*/
-		slapi_wait_condvar(roles_def->something_changed, NULL);
+		if ( !roles_def->members_rebuild && roles_def->keeprunning )
+		{
+			slapi_wait_condvar(roles_def->something_changed, NULL);
+		}
 
 		slapi_log_error( SLAPI_LOG_PLUGIN, ROLES_PLUGIN_SUBSYSTEM, "roles_cache_wait_on_change \n");
          
         if ( roles_def->keeprunning )  
 		{
             roles_cache_update(roles_def);  
+			if ( roles_def->members_rebuild )
+			{
+				/* the searches may be long: let the notifications go on meanwhile */
+				roles_def->members_rebuild = 0;
+				slapi_unlock_mutex(roles_def->change_lock);
+				roles_cache_rebuild_members(roles_def);
+				slapi_lock_mutex(roles_def->change_lock);
+			}
 		}
     }
 
@@ -512,6 +637,9 @@ static void roles_cache_trigger_update_suffix(void *handle, char *be_name, int o
     }
 
 	slapi_rwlock_unlock(global_lock);
+
+	/* The backend may be a new one */
+	roles_cache_register_index();
 }
 
 /* roles_cache_trigger_update_role
@@ -617,6 +745,12 @@ static int roles_cache_update(roles_cache_def *suffix_to_update)
 			 (operation ==SLAPI_OPERATION_ADD) )
 		{
 			rc = roles_cache_create_role_under(&suffix_to_update,entry);
+			if ( rc == 0 )
+			{
+				/* our caller holds change_lock: wake up the thread to populate the member bitmap */
+				suffix_to_update->members_rebuild = 1;
+				slapi_notify_condvar(suffix_to_update->something_changed, 1);
+			}
 		}
 		if ( entry != NULL )
 		{
@@ -766,7 +900,9 @@ void roles_cache_change_notify(Slapi_PBlock *pb)
 	struct slapi_entry *entry = NULL;
 	Slapi_Backend *be = NULL;
 	Slapi_Operation *pb_operation = NULL;
+	Slapi_DN *top_suffix = NULL;
 	int operation;
+	int is_modrdn = 0;
 	int do_update = 0;
 	int rc = -1;
 
@@ -779,19 +915,21 @@ void roles_cache_change_notify(Slapi_PBlock *pb)
 					ROLES_PLUGIN_SUBSYSTEM, 
 					"--> roles_cache_change_notify\n");
 
-	/* if the current operation has failed, don't even try the post operation */
-    slapi_pblock_get( pb, SLAPI_PLUGIN_OPRETURN, &rc );
-	if ( rc != LDAP_SUCCESS )
-	{
-		return;
-	}
-
 	/* Don't update local cache when remote entries are updated */
 	slapi_pblock_get(pb, SLAPI_BACKEND, &be);
 	if ((be == NULL) || (slapi_be_is_flag_set(be,SLAPI_BE_FLAG_REMOTE_DATA))) {
 		return;
 	}
 
+	/* if the current operation has failed, don't even try the post operation,
+	   but undo what a betxn call may already have done to the member bitmaps */
+    slapi_pblock_get( pb, SLAPI_PLUGIN_OPRETURN, &rc );
+	if ( rc != LDAP_SUCCESS )
+	{
+		roles_cache_undo_members(pb, be);
+		return;
+	}
+
 	slapi_pblock_get(pb, SLAPI_TARGET_SDN, &sdn);
 	if(sdn == NULL) {
 		return;
@@ -826,6 +964,7 @@ void roles_cache_change_notify(Slapi_PBlock *pb)
 		case SLAPI_OPERATION_MODRDN:
 			/* those operations are treated the same way and modify is a deletion followed by an addition.
 			   the only point to take care is that dn is the olddn */
+			is_modrdn = (operation == SLAPI_OPERATION_MODRDN);
 			operation = SLAPI_OPERATION_MODIFY;
 			slapi_pblock_get(pb, SLAPI_ENTRY_PRE_OP, &pre);
 			if( pre == NULL )
@@ -845,6 +984,26 @@ void roles_cache_change_notify(Slapi_PBlock *pb)
 			return;
 	}
 
+	/* Any entry may be a member: keep the member bitmaps up to date */
+	top_suffix = roles_cache_get_top_suffix((Slapi_DN *)slapi_be_getsuffix(be, 0));
+	if ( top_suffix != NULL )
+	{
+		if ( is_modrdn && (slapi_entry_attr_get_ulong(pre, "numsubordinates") > 0) )
+		{
+			/* the DNs of the whole subtree have changed */
+			roles_cache_invalidate_members(top_suffix);
+		}
+		else if ( operation == SLAPI_OPERATION_DELETE )
+		{
+			roles_cache_update_members(top_suffix, be, e, NULL);
+		}
+		else
+		{
+			roles_cache_update_members(top_suffix, be, pre, e);
+		}
+		slapi_sdn_free(&top_suffix);
+	}
+
 	if ( operation != SLAPI_OPERATION_MODIFY )
 	{
 		if ( roles_cache_is_role_entry(e) != 1 )
@@ -1010,6 +1169,9 @@ static int roles_cache_add_roles_from_suffix(Slapi_DN *suffix_dn, roles_cache_de
 		rc = 0;
 	}
 
+	/* The member bitmaps are populated by the suffix thread */
+	roles_cache_schedule_members(suffix_def);
+
     slapi_log_error( SLAPI_LOG_PLUGIN, ROLES_PLUGIN_SUBSYSTEM, "<-- roles_cache_add_roles_from_suffix\n");
 
 	return(rc);
@@ -1069,6 +1231,11 @@ static int roles_cache_create_role_under(roles_cache_def** roles_cache_suffix, S
 						ROLES_PLUGIN_SUBSYSTEM, "roles_cache_create_role_under:%s in tree %p rc: %d\n", 
 						(char*)slapi_sdn_get_ndn(new_role->dn),
 						(*roles_cache_suffix)->avl_tree, rc);
+		if ( (rc == 0) && new_role->members )
+		{
+			/* The suffix thread will populate it */
+			roles_cache_members_link(*roles_cache_suffix, new_role->members);
+		}
 	}
 	return(rc);
 }
@@ -1247,12 +1414,14 @@ static int roles_cache_create_object_from_entry(Slapi_Entry *role_entry, role_ob
 			slapi_pblock_destroy(pb);
 
 			/* Turn it into a slapi filter object */
+			this_role->filter_str = slapi_ch_strdup(filter_attr_value);
 			filter = slapi_str2filter(filter_attr_value);
 			slapi_ch_free_string(&filter_attr_value);
 
 			if ( filter == NULL ) 
 			{
 				/* An error has occured */
+				slapi_ch_free_string(&this_role->filter_str);
 				slapi_ch_free((void**)&this_role);
 				return SLAPI_ROLE_ERROR_FILTER_BAD;
 			}
@@ -1312,6 +1481,12 @@ static int roles_cache_create_object_from_entry(Slapi_Entry *role_entry, role_ob
 
     if ( rc == 0 ) 
 	{
+		/* The members are below the parent of the scope, see roles_is_inscope */
+		this_role->member_base = slapi_sdn_new();
+		slapi_sdn_get_parent(this_role->rolescopedn ? this_role->rolescopedn : this_role->dn,
+							 this_role->member_base);
+		this_role->members = roles_cache_members_new(this_role);
+
         *result = this_role;
     }
 
@@ -1537,6 +1712,8 @@ int roles_cache_listroles_ext(vattr_context *c, Slapi_Entry *entry, int return_v
 			arg.requested_entry = entry;
 			arg.has_value = 0;
 			arg.context = c;
+			arg.be = roles_cache_stored_entries(c) ? backend : NULL;
+			arg.entry_id = 0;
 
 			/* XXX really need a mutex for this read operation ? */
 			slapi_rwlock_rdlock(roles_cache->cache_lock);
@@ -1603,8 +1780,12 @@ static int roles_cache_build_nsrole( caddr_t data, caddr_t arg )
     get_nsrole.is_entry_member_of = result->requested_entry;
     get_nsrole.present = 0;
     get_nsrole.hint = 0;
+    get_nsrole.be = result->be;
+    get_nsrole.entry_id = result->entry_id;
 
     tmprc = roles_is_entry_member_of_object_ext(result->context, (caddr_t)this_role, (caddr_t)&get_nsrole); 
+    /* the next roles won't have to look the ID up again */
+    result->entry_id = get_nsrole.entry_id;
     if (SLAPI_VIRTUALATTRS_LOOP_DETECTED == tmprc)
     {
         /* all we want to detect and return is loop/stack overflow */
@@ -1669,6 +1850,7 @@ int roles_check(Slapi_Entry *entry_to_check, Slapi_DN *role_dn, int *present)
     }
     slapi_rwlock_unlock(global_lock);
 
+    slapi_rwlock_rdlock(roles_cache->cache_lock);
     this_role = (role_object *)avl_find(roles_cache->avl_tree, role_dn, (IFP)roles_cache_find_node);
 
     /* MAB: For some reason the assumption made by this function (the role exists and is in scope)
@@ -1678,6 +1860,7 @@ int roles_check(Slapi_Entry *entry_to_check, Slapi_DN *role_dn, int *present)
     /* Begin patch */
     if (!this_role) {
         /* Assume that the entry is not member of the role (*present=0) and leave... */
+        slapi_rwlock_unlock(roles_cache->cache_lock);
         return rc;
     }
     /* End patch */
@@ -1685,8 +1868,12 @@ int roles_check(Slapi_Entry *entry_to_check, Slapi_DN *role_dn, int *present)
     get_nsrole.is_entry_member_of = entry_to_check;
     get_nsrole.present = 0;
     get_nsrole.hint = 0;
+    /* the entry may be one being updated: don't use the member bitmaps */
+    get_nsrole.be = NULL;
+    get_nsrole.entry_id = 0;
 
     roles_is_entry_member_of_object((caddr_t)this_role, (caddr_t)&get_nsrole);
+    slapi_rwlock_unlock(roles_cache->cache_lock);
     *present = get_nsrole.present;
 
     slapi_log_error(SLAPI_LOG_PLUGIN, 
@@ -1804,9 +1991,19 @@ static int roles_is_entry_member_of_object_ext(vattr_context *c, caddr_t data, c
 		switch (this_role->type) 
 		{
 			case ROLE_TYPE_MANAGED:
+				if ( roles_cache_members_probe(this_role, get_nsrole) == 0 )
+				{
+					rc = 0;
+					break;
+				}
 				rc = roles_check_managed(entry_to_check,this_role,&get_nsrole->present);
 				break;
 			case ROLE_TYPE_FILTERED:
+				if ( roles_cache_members_probe(this_role, get_nsrole) == 0 )
+				{
+					rc = 0;
+					break;
+				}
 				rc = roles_check_filtered(c, entry_to_check,this_role,&get_nsrole->present);
 				break;
 			case ROLE_TYPE_NESTED:
@@ -2090,6 +2287,8 @@ static void roles_cache_role_def_free(roles_cache_def *role_def)
 	slapi_sdn_free(&(role_def->suffix_dn));
 	slapi_destroy_rwlock(role_def->cache_lock);
 	role_def->cache_lock = NULL;
+	slapi_destroy_rwlock(role_def->members_lock);
+	role_def->members_lock = NULL;
 	slapi_destroy_mutex(role_def->change_lock);
 	role_def->change_lock = NULL;
 	slapi_destroy_condvar(role_def->something_changed);
@@ -2131,7 +2330,7 @@ static void roles_cache_role_object_free(role_object *this_role)
 	switch (this_role->type) 
 	{
 		case ROLE_TYPE_MANAGED:
-			/* Nothing further needed */
+			roles_cache_members_free(this_role->members);
 			break;
 		case ROLE_TYPE_FILTERED:
 			/* Free the filter */
@@ -2140,6 +2339,8 @@ static void roles_cache_role_object_free(role_object *this_role)
 				slapi_filter_free(this_role->filter,1);
 				this_role->filter = NULL;
 			}
+			slapi_ch_free_string(&this_role->filter_str);
+			roles_cache_members_free(this_role->members);
 			break;
 		case ROLE_TYPE_NESTED:
 			/* Free the list of nested roles */
@@ -2151,6 +2352,7 @@ static void roles_cache_role_object_free(role_object *this_role)
 
 	slapi_sdn_free(&this_role->dn);
         slapi_sdn_free(&this_role->rolescopedn);
+	slapi_sdn_free(&this_role->member_base);
 
 	/* Free the object */
 	slapi_ch_free((void**)&this_role);
@@ -2191,3 +2393,995 @@ static int roles_cache_dump( caddr_t data, caddr_t arg )
 	
     return 0;
 }
+
+/* roles_cache_filter_type_cb
+   --------------------------
+   Collect the types tested by a role filter
+ */
+static int roles_cache_filter_type_cb(Slapi_Filter *f, void *arg)
+{
+	char ***types = (char ***)arg;
+	char *type = NULL;
+
+	if ( (slapi_filter_get_attribute_type(f, &type) != 0) || (type == NULL) )
+	{
+		/* extensible match without a type */
+		return SLAPI_FILTER_SCAN_STOP;
+	}
+	if ( !charray_inlist(*types, type) )
+	{
+		slapi_ch_array_add(types, slapi_ch_strdup(type));
+	}
+	return SLAPI_FILTER_SCAN_CONTINUE;
+}
+
+/* roles_cache_members_new
+   -----------------------
+   Prepare the member bitmap of a managed or filtered role: the suffix thread
+   populates it once linked to the suffix, the post operations keep it up to date.
+   Return NULL if the membership can't be maintained that way
+ */
+static role_members *roles_cache_members_new(role_object *this_role)
+{
+	role_members *members = NULL;
+	char **filter_types = NULL;
+	char *member_filter = NULL;
+	Slapi_Filter *filter = NULL;
+	int rc = 0;
+	int i;
+
+	switch (this_role->type)
+	{
+		case ROLE_TYPE_MANAGED:
+		{
+			char *tmp = NULL;
+
+			member_filter = slapi_filter_sprintf("(%s=%s%s)", ROLE_MANAGED_ATTR_NAME,
+												 ESC_NEXT_VAL, slapi_sdn_get_ndn(this_role->dn));
+			/* slapi_str2filter modifies its argument */
+			tmp = slapi_ch_strdup(member_filter);
+			filter = slapi_str2filter(tmp);
+			slapi_ch_free_string(&tmp);
+			slapi_ch_array_add(&filter_types, slapi_ch_strdup(ROLE_MANAGED_ATTR_NAME));
+			break;
+		}
+		case ROLE_TYPE_FILTERED:
+			if ( (this_role->filter_str == NULL) ||
+				 (slapi_filter_apply(this_role->filter, roles_cache_filter_type_cb,
+									 &filter_types, &rc) != SLAPI_FILTER_SCAN_NOMORE) )
+			{
+				slapi_ch_array_free(filter_types);
+				return NULL;
+			}
+			if ( (*this_role->filter_str == '(') &&
+				 (*(this_role->filter_str + strlen(this_role->filter_str) - 1) == ')') )
+			{
+				member_filter = slapi_ch_strdup(this_role->filter_str);
+			}
+			else
+			{
+				member_filter = slapi_ch_smprintf("(%s)", this_role->filter_str);
+			}
+			filter = slapi_filter_dup(this_role->filter);
+			break;
+		default:
+			return NULL;
+	}
+
+	/* These change without the entry being modified */
+	for ( i = 0; filter_types && filter_types[i]; i++ )
+	{
+		if ( charray_inlist(unstableAttributes, filter_types[i]) )
+		{
+			break;
+		}
+	}
+	if ( (filter == NULL) || (filter_types == NULL) || filter_types[i] )
+	{
+		slapi_ch_free_string(&member_filter);
+		slapi_filter_free(filter, 1);
+		slapi_ch_array_free(filter_types);
+		return NULL;
+	}
+
+	members = (role_members*)slapi_ch_calloc(1, sizeof(role_members));
+	members->refcnt = 1;
+	members->state = ROLE_MEMBERS_PENDING;
+	members->dn = slapi_sdn_dup(this_role->dn);
+	members->base = slapi_sdn_dup(this_role->member_base);
+	members->be = slapi_mapping_tree_find_backend_for_sdn(members->base);
+	members->search_filter = slapi_ch_smprintf("(&%s%s)", member_filter, OBJ_FILTER);
+	members->filter = filter;
+	members->filter_types = filter_types;
+	slapi_ch_free_string(&member_filter);
+
+	return members;
+}
+
+/* roles_cache_members_link
+   ------------------------
+   Make the member bitmap of a role known to its suffix
+ */
+static void roles_cache_members_link(roles_cache_def *suffix_def, role_members *members)
+{
+	slapi_rwlock_wrlock(suffix_def->members_lock);
+	members->suffix_def = suffix_def;
+	members->next = suffix_def->members_list;
+	suffix_def->members_list = members;
+	slapi_rwlock_unlock(suffix_def->members_lock);
+}
+
+/* roles_cache_members_free
+   ------------------------
+   The role is freed: unlink its member bitmap and drop its reference
+ */
+static void roles_cache_members_free(role_members *members)
+{
+	roles_cache_def *suffix_def = NULL;
+	role_members **prev = NULL;
+
+	if ( members == NULL )
+	{
+		return;
+	}
+
+	suffix_def = members->suffix_def;
+	if ( suffix_def == NULL )
+	{
+		roles_cache_members_unref(members);
+		return;
+	}
+
+	slapi_rwlock_wrlock(suffix_def->members_lock);
+	for ( prev = &suffix_def->members_list; *prev; prev = &(*prev)->next )
+	{
+		if ( *prev == members )
+		{
+			*prev = members->next;
+			break;
+		}
+	}
+	members->next = NULL;
+	members->suffix_def = NULL;
+	roles_cache_members_unref(members);
+	slapi_rwlock_unlock(suffix_def->members_lock);
+}
+
+/* roles_cache_members_unref
+   -------------------------
+   The caller holds members_lock if the member bitmap is linked
+ */
+static void roles_cache_members_unref(role_members *members)
+{
+	if ( --members->refcnt > 0 )
+	{
+		return;
+	}
+	slapi_sdn_free(&members->dn);
+	slapi_sdn_free(&members->base);
+	slapi_ch_free_string(&members->search_filter);
+	slapi_filter_free(members->filter, 1);
+	slapi_ch_array_free(members->filter_types);
+	slapi_ch_free((void**)&members->ids);
+	slapi_ch_free((void**)&members->touched);
+	slapi_ch_free((void**)&members);
+}
+
+/* roles_cache_members_reset
+   -------------------------
+   Forget the content of a member bitmap, the suffix thread will populate it again.
+   The caller holds members_lock for writing
+ */
+static void roles_cache_members_reset(role_members *members)
+{
+	slapi_ch_free((void**)&members->ids);
+	members->ids_words = 0;
+	slapi_ch_free((void**)&members->touched);
+	members->touched_words = 0;
+	members->state = ROLE_MEMBERS_PENDING;
+}
+
+/* roles_cache_members_virtual
+   ---------------------------
+   Tells if the membership depends on virtual attributes (e.g. generated by CoS),
+   the bitmap can't follow them. Checked on use as CoS may register its types later
+ */
+static int roles_cache_members_virtual(role_members *members)
+{
+	int i;
+
+	for ( i = 0; members->filter_types[i]; i++ )
+	{
+		if ( slapi_vattr_is_registered(members->filter_types[i]) )
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* roles_cache_members_valid
+   -------------------------
+   Tells if the bitmap may answer for the entries of be.
+   The caller holds members_lock
+ */
+static int roles_cache_members_valid(role_members *members, Slapi_Backend *be)
+{
+	return ( (members->state == ROLE_MEMBERS_READY) &&
+			 (be != NULL) && (members->be == be) &&
+			 !roles_cache_members_virtual(members) );
+}
+
+/* roles_cache_stored_entries
+   --------------------------
+   The bitmaps know about the entries as stored in the backend: only use them
+   for the entries read by a search, not for the ones being updated
+ */
+static int roles_cache_stored_entries(vattr_context *c)
+{
+	Slapi_PBlock *pb = slapi_vattr_get_pblock_from_context(c);
+	Slapi_Operation *op = NULL;
+
+	if ( pb == NULL )
+	{
+		return 0;
+	}
+	slapi_pblock_get(pb, SLAPI_OPERATION, &op);
+	return ( (op != NULL) && (operation_get_type(op) == SLAPI_OPERATION_SEARCH) );
+}
+
+/* roles_cache_members_probe
+   -------------------------
+   Check the membership of a managed or filtered role in its bitmap.
+   The caller holds the cache lock of the role suffix
+	return 0: answered, see present
+	return -1: the role must be checked on the entry
+ */
+static int roles_cache_members_probe(role_object *this_role, roles_cache_search_in_nested *get_nsrole)
+{
+	role_members *members = this_role->members;
+	Slapi_Entry *entry_to_check = get_nsrole->is_entry_member_of;
+	roles_cache_def *suffix_def = NULL;
+	int rc = -1;
+
+	if ( (members == NULL) || (get_nsrole->be == NULL) || (members->be != get_nsrole->be) ||
+		 ((suffix_def = members->suffix_def) == NULL) )
+	{
+		return rc;
+	}
+	/* in scope through a view */
+	if ( !slapi_sdn_issuffix(slapi_entry_get_sdn(entry_to_check), members->base) )
+	{
+		return rc;
+	}
+	if ( get_nsrole->entry_id == 0 )
+	{
+		get_nsrole->entry_id = (IndexEntryID)slapi_entry_attr_get_ulong(entry_to_check, ROLE_ENTRYID_ATTR);
+		if ( get_nsrole->entry_id == 0 )
+		{
+			/* not stored yet */
+			return rc;
+		}
+	}
+
+	slapi_rwlock_rdlock(suffix_def->members_lock);
+	if ( roles_cache_members_valid(members, get_nsrole->be) )
+	{
+		if ( roles_cache_bitmap_test(members->ids, members->ids_words, get_nsrole->entry_id) )
+		{
+			get_nsrole->present = 1;
+		}
+		rc = 0;
+	}
+	slapi_rwlock_unlock(suffix_def->members_lock);
+
+	return rc;
+}
+
+/* roles_cache_bitmap_set
+   ----------------------
+*/
+static void roles_cache_bitmap_set(PRUint32 **words, PRUint32 *count, IndexEntryID id)
+{
+	PRUint32 word = id / ROLE_MEMBERS_WORD_BITS;
+
+	if ( word >= *count )
+	{
+		PRUint32 new_count = *count ? *count : ROLE_MEMBERS_INITIAL_WORDS;
+
+		while ( new_count <= word )
+		{
+			new_count *= 2;
+		}
+		*words = (PRUint32*)slapi_ch_realloc((char*)*words, new_count * sizeof(PRUint32));
+		memset(*words + *count, 0, (new_count - *count) * sizeof(PRUint32));
+		*count = new_count;
+	}
+	(*words)[word] |= (PRUint32)1 << (id % ROLE_MEMBERS_WORD_BITS);
+}
+
+/* roles_cache_bitmap_clear
+   ------------------------
+*/
+static void roles_cache_bitmap_clear(PRUint32 *words, PRUint32 count, IndexEntryID id)
+{
+	PRUint32 word = id / ROLE_MEMBERS_WORD_BITS;
+
+	if ( word < count )
+	{
+		words[word] &= ~((PRUint32)1 << (id % ROLE_MEMBERS_WORD_BITS));
+	}
+}
+
+/* roles_cache_bitmap_test
+   -----------------------
+*/
+static int roles_cache_bitmap_test(PRUint32 *words, PRUint32 count, IndexEntryID id)
+{
+	PRUint32 word = id / ROLE_MEMBERS_WORD_BITS;
+
+	return ( (word < count) && (words[word] & ((PRUint32)1 << (id % ROLE_MEMBERS_WORD_BITS))) );
+}
+
+/* roles_cache_schedule_members
+   ----------------------------
+   Wake up the suffix thread to populate the pending member bitmaps
+ */
+static void roles_cache_schedule_members(roles_cache_def *suffix_def)
+{
+	slapi_lock_mutex(suffix_def->change_lock);
+	suffix_def->members_rebuild = 1;
+	slapi_notify_condvar(suffix_def->something_changed, 1);
+	slapi_unlock_mutex(suffix_def->change_lock);
+}
+
+/* roles_cache_rebuild_members
+   ---------------------------
+   Called by the suffix thread, without any lock held: populate the pending member bitmaps
+ */
+static void roles_cache_rebuild_members(roles_cache_def *suffix_def)
+{
+	role_members *members = NULL;
+
+	slapi_log_error(SLAPI_LOG_PLUGIN, 
+					ROLES_PLUGIN_SUBSYSTEM, "--> roles_cache_rebuild_members\n");
+
+	while ( suffix_def->keeprunning )
+	{
+		slapi_rwlock_wrlock(suffix_def->members_lock);
+		for ( members = suffix_def->members_list; members; members = members->next )
+		{
+			if ( members->state == ROLE_MEMBERS_PENDING )
+			{
+				/* the post operations update it from now on */
+				members->state = ROLE_MEMBERS_BUILDING;
+				members->refcnt++;
+				break;
+			}
+		}
+		slapi_rwlock_unlock(suffix_def->members_lock);
+
+		if ( members == NULL )
+		{
+			break;
+		}
+
+		roles_cache_members_build(suffix_def, members);
+
+		slapi_rwlock_wrlock(suffix_def->members_lock);
+		roles_cache_members_unref(members);
+		slapi_rwlock_unlock(suffix_def->members_lock);
+	}
+
+	slapi_log_error(SLAPI_LOG_PLUGIN, 
+					ROLES_PLUGIN_SUBSYSTEM, "<-- roles_cache_rebuild_members\n");
+}
+
+/* roles_cache_members_build
+   -------------------------
+   Search the members of a role to populate its bitmap
+	return 0: ok
+	return -1: fail
+ */
+static int roles_cache_members_build(roles_cache_def *suffix_def, role_members *members)
+{
+	roles_cache_search_members info;
+	Slapi_PBlock *int_search_pb = NULL;
+	int rc = -1;
+
+	info.suffix_def = suffix_def;
+	info.members = members;
+	info.incomplete = 0;
+	info.rc = LDAP_SUCCESS;
+
+	/* Useless as long as the filter tests virtual attributes */
+	if ( !roles_cache_members_virtual(members) )
+	{
+		info.rc = LDAP_NO_SUCH_OBJECT;
+		int_search_pb = slapi_pblock_new ();
+		slapi_search_internal_set_pb(int_search_pb,
+									(char*)slapi_sdn_get_ndn(members->base),
+									LDAP_SCOPE_SUBTREE,
+									members->search_filter,
+									entryidAttributes,
+									0 /* attrsonly */,
+									NULL /* controls */,
+									NULL /* uniqueid */,
+									roles_get_plugin_identity(),
+									SLAPI_OP_FLAG_NEVER_CHAIN /* actions : get local entries only */ );
+
+		slapi_search_internal_callback_pb(int_search_pb,
+										&info /* callback_data */,
+										roles_cache_members_result_cb,
+										roles_cache_members_entry_cb,
+										NULL /* referral_callback */);
+
+		slapi_pblock_destroy (int_search_pb);
+		int_search_pb = NULL;
+	}
+
+	slapi_rwlock_wrlock(suffix_def->members_lock);
+	/* Otherwise it has been reset meanwhile */
+	if ( members->state == ROLE_MEMBERS_BUILDING )
+	{
+		slapi_ch_free((void**)&members->touched);
+		members->touched_words = 0;
+		if ( (info.rc == LDAP_SUCCESS) && !info.incomplete )
+		{
+			members->state = ROLE_MEMBERS_READY;
+			rc = 0;
+		}
+		else
+		{
+			slapi_ch_free((void**)&members->ids);
+			members->ids_words = 0;
+			members->state = ROLE_MEMBERS_UNAVAILABLE;
+		}
+	}
+	slapi_rwlock_unlock(suffix_def->members_lock);
+
+	slapi_log_error(SLAPI_LOG_PLUGIN, 
+					ROLES_PLUGIN_SUBSYSTEM, "roles_cache_members_build: role %s search rc %d, bitmap %s\n",
+					(char*)slapi_sdn_get_ndn(members->dn), info.rc, rc ? "not available" : "ready");
+	return rc;
+}
+
+/* roles_cache_members_entry_cb
+   ----------------------------
+*/
+static int roles_cache_members_entry_cb(Slapi_Entry* e, void *callback_data)
+{
+	roles_cache_search_members *info = (roles_cache_search_members *)callback_data;
+	role_members *members = info->members;
+	IndexEntryID id;
+
+	/* The subtree may span several backends, the bitmap is for one of them */
+	if ( slapi_mapping_tree_find_backend_for_sdn(slapi_entry_get_sdn(e)) != members->be )
+	{
+		return 0;
+	}
+
+	id = (IndexEntryID)slapi_entry_attr_get_ulong(e, ROLE_ENTRYID_ATTR);
+	if ( id == 0 )
+	{
+		info->incomplete = 1;
+		return 0;
+	}
+
+	slapi_rwlock_wrlock(info->suffix_def->members_lock);
+	/* The post operations know better about the entries they have updated meanwhile */
+	if ( (members->state == ROLE_MEMBERS_BUILDING) &&
+		 !roles_cache_bitmap_test(members->touched, members->touched_words, id) )
+	{
+		roles_cache_bitmap_set(&members->ids, &members->ids_words, id);
+	}
+	slapi_rwlock_unlock(info->suffix_def->members_lock);
+
+	return 0;
+}
+
+/* roles_cache_members_result_cb
+   -----------------------------
+*/
+static void roles_cache_members_result_cb(int rc, void *callback_data)
+{
+	roles_cache_search_members *info = (roles_cache_search_members *)callback_data;
+
+	info->rc = rc;
+}
+
+/* roles_cache_update_members
+   --------------------------
+   An entry of be has been added (pre is NULL), deleted (post is NULL), modified
+   or renamed: update the member bitmaps of the roles of its suffix
+ */
+static void roles_cache_update_members(Slapi_DN *top_suffix, Slapi_Backend *be, Slapi_Entry *pre, Slapi_Entry *post)
+{
+	roles_cache_def *suffix_def = NULL;
+	role_members *members = NULL;
+	IndexEntryID pre_id = 0;
+	IndexEntryID post_id = 0;
+	int reset = 0;
+
+	if ( pre )
+	{
+		pre_id = (IndexEntryID)slapi_entry_attr_get_ulong(pre, ROLE_ENTRYID_ATTR);
+	}
+	if ( post )
+	{
+		post_id = (IndexEntryID)slapi_entry_attr_get_ulong(post, ROLE_ENTRYID_ATTR);
+	}
+
+	slapi_rwlock_rdlock(global_lock);
+
+	for ( suffix_def = roles_list; suffix_def; suffix_def = suffix_def->next )
+	{
+		if ( slapi_sdn_compare(suffix_def->suffix_dn, top_suffix) == 0 )
+		{
+			break;
+		}
+	}
+	if ( suffix_def == NULL )
+	{
+		slapi_rwlock_unlock(global_lock);
+		return;
+	}
+
+	slapi_rwlock_wrlock(suffix_def->members_lock);
+	for ( members = suffix_def->members_list; members; members = members->next )
+	{
+		if ( ((members->state != ROLE_MEMBERS_READY) && (members->state != ROLE_MEMBERS_BUILDING)) ||
+			 (members->be != be) )
+		{
+			continue;
+		}
+
+		if ( pre && slapi_sdn_issuffix(slapi_entry_get_sdn(pre), members->base) )
+		{
+			if ( pre_id == 0 )
+			{
+				roles_cache_members_reset(members);
+				reset = 1;
+				continue;
+			}
+			roles_cache_bitmap_clear(members->ids, members->ids_words, pre_id);
+			if ( members->state == ROLE_MEMBERS_BUILDING )
+			{
+				roles_cache_bitmap_set(&members->touched, &members->touched_words, pre_id);
+			}
+		}
+
+		if ( post && slapi_sdn_issuffix(slapi_entry_get_sdn(post), members->base) )
+		{
+			if ( post_id == 0 )
+			{
+				roles_cache_members_reset(members);
+				reset = 1;
+				continue;
+			}
+			if ( slapi_filter_test_simple(post, members->filter) == 0 )
+			{
+				roles_cache_bitmap_set(&members->ids, &members->ids_words, post_id);
+			}
+			if ( members->state == ROLE_MEMBERS_BUILDING )
+			{
+				roles_cache_bitmap_set(&members->touched, &members->touched_words, post_id);
+			}
+		}
+	}
+	slapi_rwlock_unlock(suffix_def->members_lock);
+
+	if ( reset )
+	{
+		roles_cache_schedule_members(suffix_def);
+	}
+
+	slapi_rwlock_unlock(global_lock);
+}
+
+/* roles_cache_undo_members
+   ------------------------
+   The operation has failed: with a betxn plugin, the member bitmaps may have
+   been updated before a later plugin or the backend aborted it.  Set the bit
+   of the entry again from the entry as it is still stored (none for an add)
+ */
+static void roles_cache_undo_members(Slapi_PBlock *pb, Slapi_Backend *be)
+{
+	Slapi_Operation *op = NULL;
+	Slapi_Entry *stored = NULL;
+	Slapi_Entry *e = NULL;
+	Slapi_DN *top_suffix = NULL;
+	roles_cache_def *suffix_def = NULL;
+	role_members *members = NULL;
+	IndexEntryID id = 0;
+	int reset = 0;
+
+	slapi_pblock_get(pb, SLAPI_OPERATION, &op);
+	if ( op == NULL )
+	{
+		return;
+	}
+	if ( operation_get_type(op) == SLAPI_OPERATION_ADD )
+	{
+		slapi_pblock_get(pb, SLAPI_ENTRY_POST_OP, &e);
+	}
+	else
+	{
+		slapi_pblock_get(pb, SLAPI_ENTRY_PRE_OP, &stored);
+		e = stored;
+	}
+	if ( e == NULL )
+	{
+		/* the backend did not get that far */
+		return;
+	}
+	if ( (top_suffix = roles_cache_get_top_suffix((Slapi_DN *)slapi_be_getsuffix(be, 0))) == NULL )
+	{
+		return;
+	}
+	if ( (operation_get_type(op) == SLAPI_OPERATION_MODRDN) &&
+		 (slapi_entry_attr_get_ulong(stored, "numsubordinates") > 0) )
+	{
+		roles_cache_invalidate_members(top_suffix);
+		slapi_sdn_free(&top_suffix);
+		return;
+	}
+	id = (IndexEntryID)slapi_entry_attr_get_ulong(e, ROLE_ENTRYID_ATTR);
+
+	slapi_rwlock_rdlock(global_lock);
+
+	for ( suffix_def = roles_list; suffix_def; suffix_def = suffix_def->next )
+	{
+		if ( slapi_sdn_compare(suffix_def->suffix_dn, top_suffix) == 0 )
+		{
+			break;
+		}
+	}
+	slapi_sdn_free(&top_suffix);
+	if ( suffix_def == NULL )
+	{
+		slapi_rwlock_unlock(global_lock);
+		return;
+	}
+
+	slapi_rwlock_wrlock(suffix_def->members_lock);
+	for ( members = suffix_def->members_list; members; members = members->next )
+	{
+		if ( ((members->state != ROLE_MEMBERS_READY) && (members->state != ROLE_MEMBERS_BUILDING)) ||
+			 (members->be != be) )
+		{
+			continue;
+		}
+		if ( id == 0 )
+		{
+			roles_cache_members_reset(members);
+			reset = 1;
+			continue;
+		}
+
+		if ( stored && slapi_sdn_issuffix(slapi_entry_get_sdn(stored), members->base) &&
+			 (slapi_filter_test_simple(stored, members->filter) == 0) )
+		{
+			roles_cache_bitmap_set(&members->ids, &members->ids_words, id);
+		}
+		else
+		{
+			roles_cache_bitmap_clear(members->ids, members->ids_words, id);
+		}
+		if ( members->state == ROLE_MEMBERS_BUILDING )
+		{
+			roles_cache_bitmap_set(&members->touched, &members->touched_words, id);
+		}
+	}
+	slapi_rwlock_unlock(suffix_def->members_lock);
+
+	if ( reset )
+	{
+		roles_cache_schedule_members(suffix_def);
+	}
+
+	slapi_rwlock_unlock(global_lock);
+}
+
+/* roles_cache_invalidate_members
+   ------------------------------
+   A subtree has been renamed: populate again all the member bitmaps of the suffix
+ */
+static void roles_cache_invalidate_members(Slapi_DN *top_suffix)
+{
+	roles_cache_def *suffix_def = NULL;
+	role_members *members = NULL;
+
+	slapi_rwlock_rdlock(global_lock);
+
+	for ( suffix_def = roles_list; suffix_def; suffix_def = suffix_def->next )
+	{
+		if ( slapi_sdn_compare(suffix_def->suffix_dn, top_suffix) == 0 )
+		{
+			break;
+		}
+	}
+	if ( suffix_def != NULL )
+	{
+		slapi_rwlock_wrlock(suffix_def->members_lock);
+		for ( members = suffix_def->members_list; members; members = members->next )
+		{
+			roles_cache_members_reset(members);
+		}
+		slapi_rwlock_unlock(suffix_def->members_lock);
+
+		roles_cache_schedule_members(suffix_def);
+	}
+
+	slapi_rwlock_unlock(global_lock);
+}
+
+/* roles_cache_register_index
+   --------------------------
+   Register a virtual index on nsRole for the local backends: the backends then
+   ask roles_cache_index_lookup for the candidates of an (nsRole=<role dn>) filter.
+   The registration takes the index subsystem lock, under which roles_cache_index_lookup
+   takes global_lock: the suffixes are claimed under global_lock, and registered
+   once it is released
+ */
+static void roles_cache_register_index()
+{
+	Slapi_Backend *be = NULL;
+	char *cookie = NULL;
+	const Slapi_DN *be_suffix = NULL;
+	Slapi_DN **suffixes = NULL;
+	int nsuffixes = 0;
+	int register_decoder = 0;
+	indexed_item item;
+	int i;
+
+	slapi_rwlock_wrlock(global_lock);
+
+	if ( !roles_index_registered )
+	{
+		roles_index_registered = 1;
+		register_decoder = 1;
+	}
+
+	for ( be = slapi_get_first_backend(&cookie); be; be = slapi_get_next_backend(cookie) )
+	{
+		if ( slapi_be_private(be) || slapi_be_is_flag_set(be, SLAPI_BE_FLAG_REMOTE_DATA) ||
+			 ((be_suffix = slapi_be_getsuffix(be, 0)) == NULL) ||
+			 charray_inlist(roles_index_suffixes, (char*)slapi_sdn_get_ndn(be_suffix)) )
+		{
+			continue;
+		}
+		slapi_ch_array_add(&roles_index_suffixes, slapi_ch_strdup(slapi_sdn_get_ndn(be_suffix)));
+		suffixes = (Slapi_DN **)slapi_ch_realloc((char *)suffixes, (nsuffixes + 1) * sizeof(Slapi_DN *));
+		suffixes[nsuffixes++] = slapi_sdn_dup(be_suffix);
+	}
+	slapi_ch_free_string(&cookie);
+
+	slapi_rwlock_unlock(global_lock);
+
+	if ( register_decoder && (slapi_index_register_decoder(ROLE_INDEX_PLUGIN_ID, NULL) != 0) )
+	{
+		slapi_log_error(SLAPI_LOG_FATAL, ROLES_PLUGIN_SUBSYSTEM,
+						"roles_cache_register_index: unable to register the %s index decoder\n",
+						NSROLEATTR);
+		slapi_rwlock_wrlock(global_lock);
+		roles_index_registered = 0;
+		for ( i = 0; i < nsuffixes; i++ )
+		{
+			charray_remove(roles_index_suffixes, slapi_sdn_get_ndn(suffixes[i]), 1);
+			slapi_sdn_free(&suffixes[i]);
+		}
+		slapi_rwlock_unlock(global_lock);
+		slapi_ch_free((void **)&suffixes);
+		return;
+	}
+
+	for ( i = 0; i < nsuffixes; i++ )
+	{
+		item.index_filter = ROLE_INDEX_FILTER;
+		item.search_op = roles_cache_index_lookup;
+		item.associated_attrs = NULL;
+		item.namespace_dn = suffixes[i];
+		/* the index keeps suffixes[i] as its user data */
+		if ( slapi_index_register_index(ROLE_INDEX_PLUGIN_ID, &item, suffixes[i]) != 0 )
+		{
+			slapi_rwlock_wrlock(global_lock);
+			charray_remove(roles_index_suffixes, slapi_sdn_get_ndn(suffixes[i]), 1);
+			slapi_rwlock_unlock(global_lock);
+			slapi_sdn_free(&suffixes[i]);
+		}
+	}
+	slapi_ch_free((void **)&suffixes);
+}
+
+/* roles_cache_index_lookup
+   ------------------------
+   Build the candidate list of an (nsRole=<role dn>) filter for the backend
+   whose suffix is user_data, from the member bitmaps
+	return INDEX_FILTER_EVALUTED: results is set
+	return INDEX_FILTER_UNEVALUATED: the backend must evaluate the filter itself
+ */
+static int roles_cache_index_lookup(Slapi_Filter *f, IndexEntryList **results, void *user_data)
+{
+	Slapi_DN *namespace_dn = (Slapi_DN *)user_data;
+	roles_cache_def *roles_cache = NULL;
+	role_object *this_role = NULL;
+	roles_cache_index_lookup_arg arg;
+	Slapi_DN *role_dn = NULL;
+	struct berval *bval = NULL;
+	char *type = NULL;
+	char *dn = NULL;
+	PRUint32 word;
+	PRUint32 bit;
+	int rc = INDEX_FILTER_UNEVALUATED;
+
+	if ( (slapi_filter_get_choice(f) != LDAP_FILTER_EQUALITY) ||
+		 (slapi_filter_get_ava(f, &type, &bval) != 0) || (bval == NULL) || (bval->bv_val == NULL) )
+	{
+		return rc;
+	}
+
+	dn = (char*)slapi_ch_malloc(bval->bv_len + 1);
+	memcpy(dn, bval->bv_val, bval->bv_len);
+	dn[bval->bv_len] = '\0';
+	role_dn = slapi_sdn_new_dn_passin(dn);
+
+	slapi_rwlock_rdlock(global_lock);
+	roles_cache_find_roles_in_suffix(role_dn, &roles_cache);
+	slapi_rwlock_unlock(global_lock);
+
+	if ( roles_cache == NULL )
+	{
+		slapi_sdn_free(&role_dn);
+		return rc;
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	arg.suffix_def = roles_cache;
+	arg.be = slapi_be_select(namespace_dn);
+	arg.rc = 0;
+
+	slapi_rwlock_rdlock(roles_cache->cache_lock);
+	this_role = (role_object *)avl_find(roles_cache->avl_tree, role_dn, (IFP)roles_cache_find_node);
+	if ( this_role != NULL )
+	{
+		slapi_rwlock_rdlock(roles_cache->members_lock);
+		if ( roles_cache_index_collect(this_role, &arg) == 0 )
+		{
+			rc = INDEX_FILTER_EVALUTED;
+		}
+		slapi_rwlock_unlock(roles_cache->members_lock);
+	}
+	slapi_rwlock_unlock(roles_cache->cache_lock);
+
+	if ( (rc == INDEX_FILTER_EVALUTED) && (slapi_index_entry_list_create(results) != 0) )
+	{
+		rc = INDEX_FILTER_UNEVALUATED;
+	}
+	if ( rc == INDEX_FILTER_EVALUTED )
+	{
+		/* in ascending order */
+		for ( word = 0; word < arg.words; word++ )
+		{
+			for ( bit = 0; arg.ids[word] && (bit < ROLE_MEMBERS_WORD_BITS); bit++ )
+			{
+				if ( arg.ids[word] & ((PRUint32)1 << bit) )
+				{
+					slapi_index_entry_list_add(results, word * ROLE_MEMBERS_WORD_BITS + bit);
+				}
+			}
+		}
+	}
+
+	slapi_log_error(SLAPI_LOG_PLUGIN, 
+					ROLES_PLUGIN_SUBSYSTEM, "roles_cache_index_lookup: role %s in %s: %s\n",
+					(char*)slapi_sdn_get_ndn(role_dn), (char*)slapi_sdn_get_ndn(namespace_dn),
+					(rc == INDEX_FILTER_EVALUTED) ? "evaluated" : "unevaluated");
+
+	slapi_ch_free((void**)&arg.ids);
+	slapi_sdn_free(&role_dn);
+	return rc;
+}
+
+/* roles_cache_index_collect
+   -------------------------
+   Add the members of a role to arg->ids.
+   The caller holds the cache lock and members_lock of the suffix
+	return 0: ok
+	return -1: the members can't be told from the bitmaps
+ */
+static int roles_cache_index_collect(role_object *this_role, roles_cache_index_lookup_arg *arg)
+{
+	Slapi_DN *base = arg->base;
+	PRUint32 i;
+
+	/* The bitmaps don't know about the entries in scope through a view */
+	if ( views_api && views_entry_dn_exists(views_api,
+											(char*)slapi_sdn_get_ndn(this_role->member_base),
+											(char*)slapi_sdn_get_ndn(this_role->member_base)) )
+	{
+		return -1;
+	}
+	/* Members of a nested role must be in the scope of the nesting ones too */
+	if ( base && !slapi_sdn_issuffix(this_role->member_base, base) )
+	{
+		return -1;
+	}
+
+	switch (this_role->type)
+	{
+		case ROLE_TYPE_MANAGED:
+		case ROLE_TYPE_FILTERED:
+		{
+			role_members *members = this_role->members;
+
+			if ( (members == NULL) || !roles_cache_members_valid(members, arg->be) )
+			{
+				return -1;
+			}
+			if ( members->ids_words > arg->words )
+			{
+				arg->ids = (PRUint32*)slapi_ch_realloc((char*)arg->ids, members->ids_words * sizeof(PRUint32));
+				memset(arg->ids + arg->words, 0, (members->ids_words - arg->words) * sizeof(PRUint32));
+				arg->words = members->ids_words;
+			}
+			for ( i = 0; i < members->ids_words; i++ )
+			{
+				arg->ids[i] |= members->ids[i];
+			}
+			return 0;
+		}
+		case ROLE_TYPE_NESTED:
+			if ( arg->hint >= MAX_NESTED_ROLES )
+			{
+				/* probable circular definition */
+				return -1;
+			}
+			arg->hint++;
+			arg->base = this_role->member_base;
+			avl_apply(this_role->avl_tree, (IFP)roles_cache_index_collect_nested, arg, -1, AVL_INORDER);
+			arg->base = base;
+			arg->hint--;
+			return arg->rc;
+		default:
+			return -1;
+	}
+}
+
+/* roles_cache_index_collect_nested
+   --------------------------------
+   Add the members of a role nested in another one
+	return 0: go on
+	return -1: stop, the members can't be told from the bitmaps (arg->rc is set)
+ */
+static int roles_cache_index_collect_nested(caddr_t data, caddr_t arg)
+{
+	role_object_nested *current_nested_role = (role_object_nested*)data;
+	roles_cache_index_lookup_arg *lookup = (roles_cache_index_lookup_arg*)arg;
+	roles_cache_def *roles_cache = NULL;
+	role_object *this_role = NULL;
+
+	/* Only the roles of the same suffix are covered by the locks held */
+	if ( (roles_cache_find_roles_in_suffix(current_nested_role->dn, &roles_cache) != 0) ||
+		 (roles_cache != lookup->suffix_def) )
+	{
+		lookup->rc = -1;
+		return -1;
+	}
+
+	this_role = (role_object *)avl_find(roles_cache->avl_tree,
+										current_nested_role->dn,
+										(IFP)roles_cache_find_node);
+	if ( this_role == NULL )
+	{
+		/* the nested role doesn't exist: no member */
+		return 0;
+	}
+
+	if ( roles_cache_index_collect(this_role, lookup) != 0 )
+	{
+		lookup->rc = -1;
+		return -1;
+	}
+	return 0;
+}
@@ -711,7 +711,10 @@ static void op_shared_add (Slapi_PBlock *pb)
 		
 		if (be->be_add != NULL)
 		{
+			PRUint64 start = slapi_op_phase_begin(pb->pb_op);
+
 			rc = (*be->be_add)(pb);
+			optiming_backend_end(pb->pb_op, be, start);
 			/* backend may change this if errors and not consumed */
 			slapi_pblock_get(pb, SLAPI_ADD_ENTRY, &save_e);
 			slapi_pblock_set(pb, SLAPI_ADD_ENTRY, ec);
@@ -136,12 +136,38 @@ struct int_stats_t
     char     dsURL[SNMP_FIELD_LENGTH];
 };
 
+/*
+ *   Latency of the operations by type (bind, unbind, search, modify, add,
+ *   delete, modrdn, compare, abandon, extended) and of their phases (queue,
+ *   parse, preop, backend, candidates, filter, fetch, acl, encode, send),
+ *   in microseconds.  See optiming.c.
+ */
+#define NUM_SNMP_LATENCY_OPS     10
+#define NUM_SNMP_LATENCY_PHASES  10
+
+struct latency_row_t
+{
+    PRUint64 count;
+    PRUint64 mean;
+    PRUint64 p50;
+    PRUint64 p90;
+    PRUint64 p99;
+    PRUint64 max;
+};
+
+struct latency_stats_t
+{
+    struct latency_row_t ops[NUM_SNMP_LATENCY_OPS];
+    struct latency_row_t phases[NUM_SNMP_LATENCY_PHASES];
+};
+
 struct agt_stats_t
 {
      struct hdr_stats_t hdr_stats;
      struct ops_stats_t ops_stats;
      struct entries_stats_t entries_stats;
      struct int_stats_t int_stats[NUM_SNMP_INT_TBL_ROWS];
+     struct latency_stats_t latency_stats;	/* last: older agents ignore it */
 } ;
 
 extern agt_mmap_context_t      	mmap_tbl[];
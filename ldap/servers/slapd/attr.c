@@ -285,6 +285,8 @@ slapi_attr_init_syntax(Slapi_Attr    *a)
 	asi = attr_syntax_get_by_name_with_default (basetype);
 	if (asi) {
 		rc = 0;
+		/* the default syntax is not the one of the type */
+		a->a_typeid = slapi_attr_type_id(basetype);
 		a->a_plugin = asi->asi_plugin;
 		a->a_flags = asi->asi_flags;
 		a->a_mr_eq_plugin = asi->asi_mr_eq_plugin;
@@ -321,6 +323,7 @@ slapi_attr_init_locking_optional(Slapi_Attr *a, const char *type, PRBool use_loc
 		if(NULL == asi)
 		{
 			a->a_type = attr_syntax_normalize_no_lookup( type );
+			a->a_typeid = 0;
 			/*
 			 * no syntax for this type... return Octet String
 			 * syntax.  we accomplish this by looking up a well known
@@ -333,6 +336,7 @@ slapi_attr_init_locking_optional(Slapi_Attr *a, const char *type, PRBool use_loc
 		{
 			char	*attroptions = NULL;
 
+			a->a_typeid = asi->asi_typeid;
 			if ( NULL != type ) {
 				attroptions = strchr( type, ';' );
 			}
@@ -391,6 +395,7 @@ slapi_attr_init_nosyntax(Slapi_Attr *a, const char *type)
 {
 
 	a->a_type = slapi_ch_strdup(type);
+	a->a_typeid = 0;
 	slapi_valueset_init(&a->a_present_values);
 	slapi_valueset_init(&a->a_deleted_values);
 	a->a_listtofree= NULL;
@@ -510,6 +515,12 @@ slapi_attr_get_type( Slapi_Attr *a, char **type )
 	return( 0 );
 }
 
+PRUint32
+slapi_attr_get_type_id( const Slapi_Attr *a )
+{
+	return( a->a_typeid );
+}
+
 
 /*
  * Fetch a copy of the values as an array of struct berval *'s.
@@ -823,6 +834,7 @@ slapi_attr_set_type(Slapi_Attr *a, const char *type)
 	} else {
 		slapi_ch_free_string(&a->a_type);
 		a->a_type = slapi_ch_strdup(type);
+		a->a_typeid = slapi_attr_type_id(type);
 	}
 	return rc;
 }
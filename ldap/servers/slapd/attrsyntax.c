@@ -56,6 +56,46 @@ static int asi_locking = 1;
 #define AS_UNLOCK_WRITE(l)	if (asi_locking) { slapi_rwlock_unlock(l); }
 
 
+/*
+ * Lock free read path.  The lookups done by attr_syntax_get_by_name() and
+ * attr_syntax_get_by_oid() use a read only copy of the two tables,
+ * published through asi_snapshot and read within an epoch section (see
+ * slapi_epoch.c).  A change to the tables unpublishes the snapshot first,
+ * so that the readers go back to the locks until one of them publishes a
+ * new copy: loading the schema does not rebuild it for every definition.
+ *
+ * An asyntaxinfo holds one reference on itself while it is in the tables.
+ * It is dropped once the asyntaxinfo has been removed from them and the
+ * readers of the snapshots have left; whoever drops the last reference
+ * frees it.
+ */
+struct asi_snapshot {
+	PLHashTable	*ss_oid2asi;
+	PLHashTable	*ss_name2asi;
+};
+static struct asi_snapshot *volatile asi_snapshot = NULL;
+static PRInt32 asi_snapshot_misses = 0;
+static PRInt32 asi_snapshot_building = 0;
+/* number of locked look ups before a snapshot is published again */
+#define ASI_SNAPSHOT_MISSES	64
+
+/*
+ * Interned attribute types.  The oid, name and aliases of every attribute
+ * type added to the schema map to the id of the definition, so that two
+ * base types can be compared with one integer comparison (see a_typeid and
+ * f_typeid).  The id is the one of the oid: two types have the same id only
+ * if they have the same oid.  The table only grows with the schema, the
+ * types which are not in it have no id (0).
+ *
+ * The attributes made before a name moved to another definition keep the
+ * old id, so from then on different ids do not prove that the types are
+ * different (see attr_syntax_type_ids_stable()).
+ */
+static PLHashTable *type2id = NULL;
+static Slapi_RWLock *type2id_lock = NULL;
+static PRUint32 type2id_next = 1;
+static PRInt32 type2id_remapped = 0;
+
 static struct asyntaxinfo *default_asi = NULL;
 
 static void *attr_syntax_get_plugin_by_name_with_default( const char *type );
@@ -71,6 +111,11 @@ static void attr_syntax_remove( struct asyntaxinfo *asip );
 static void attr_syntax_print();
 #endif
 static int attr_syntax_init(void);
+static int attr_syntax_snapshot_lookup( const char *key, PRBool by_name,
+		struct asyntaxinfo **asip );
+static void attr_syntax_snapshot_publish(void);
+static void attr_syntax_snapshot_unpublish(void);
+static void attr_syntax_intern( struct asyntaxinfo *asip );
 
 struct asyntaxinfo *
 attr_syntax_get_global_at()
@@ -244,6 +289,9 @@ attr_syntax_get_by_oid_locking_optional( const char *oid, PRBool use_lock, PRUin
 		using_tmp_ht = 1;
 		use_lock = 0;
 	}
+	if ( use_lock && attr_syntax_snapshot_lookup( oid, PR_FALSE, &asi )) {
+		return asi;
+	}
 	if (ht)
 	{
 		if ( use_lock ) {
@@ -263,6 +311,7 @@ attr_syntax_get_by_oid_locking_optional( const char *oid, PRBool use_lock, PRUin
 		}
 		if ( use_lock ) {
 			AS_UNLOCK_READ(oid2asi_lock);
+			attr_syntax_snapshot_publish();
 		}
 	}
 
@@ -289,6 +338,7 @@ attr_syntax_add_by_oid(const char *oid, struct asyntaxinfo *a, PRUint32 schema_f
 		}
 
 		PL_HashTableAdd(oid2asi, oid, a);
+		attr_syntax_snapshot_unpublish();
 
 		if (lock) {
 			AS_UNLOCK_WRITE(oid2asi_lock);
@@ -342,6 +392,9 @@ attr_syntax_get_by_name_locking_optional(const char *name, PRBool use_lock, PRUi
 		using_tmp_ht = 1;
 		use_lock = 0;
 	}
+	if ( use_lock && attr_syntax_snapshot_lookup( name, PR_TRUE, &asi )) {
+		return asi;
+	}
 	if (ht)
 	{
 		if ( use_lock ) {
@@ -360,6 +413,7 @@ attr_syntax_get_by_name_locking_optional(const char *name, PRBool use_lock, PRUi
 		}
 		if ( use_lock ) {
 			AS_UNLOCK_READ(name2asi_lock);
+			attr_syntax_snapshot_publish();
 		}
 	}
 	if (!asi) /* given name may be an OID */
@@ -371,9 +425,8 @@ attr_syntax_get_by_name_locking_optional(const char *name, PRBool use_lock, PRUi
 
 /*
  * Give up a reference to an asi.
- * If the asi has been marked for delete, free it.  This would be a bit
- * easier if we could upgrade a read lock to a write one... but NSPR does
- * not support that paradigm.
+ * If the asi has been marked for delete, the tables dropped their own
+ * reference already: the last one to give it up frees it.
  */
 void
 attr_syntax_return( struct asyntaxinfo *asi )
@@ -384,37 +437,19 @@ attr_syntax_return( struct asyntaxinfo *asi )
 void
 attr_syntax_return_locking_optional(struct asyntaxinfo *asi, PRBool use_lock)
 {
-	int locked = 0;
-	if(use_lock) {
-		AS_LOCK_READ(name2asi_lock);
-		locked = 1;
-	}
-	if ( NULL != asi ) {
-		PRBool		delete_it = PR_FALSE;
-		if ( 0 == PR_AtomicDecrement( &asi->asi_refcnt )) {
-			delete_it = asi->asi_marked_for_delete;
+	if ( NULL != asi && 0 == PR_AtomicDecrement( &asi->asi_refcnt ) &&
+			asi->asi_marked_for_delete ) {
+		/* ref count is 0 and it's flagged for
+		 * deletion, so it's safe to free now */
+		if(use_lock) {
+			AS_LOCK_WRITE(name2asi_lock);
 		}
-
-		if (delete_it) {
-			if ( asi->asi_marked_for_delete ) {	/* one final check */
-				if(use_lock) {
-					AS_UNLOCK_READ(name2asi_lock);
-					AS_LOCK_WRITE(name2asi_lock);
-				}
-				/* ref count is 0 and it's flagged for
-				 * deletion, so it's safe to free now */
-				attr_syntax_remove(asi);
-				attr_syntax_free(asi);
-				if(use_lock) {
-					AS_UNLOCK_WRITE(name2asi_lock);
-					locked = 0;
-				}
-			}
+		attr_syntax_remove(asi);
+		attr_syntax_free(asi);
+		if(use_lock) {
+			AS_UNLOCK_WRITE(name2asi_lock);
 		}
 	}
-	if(locked) {
-		AS_UNLOCK_READ(name2asi_lock);
-	}
 }
 
 /*
@@ -458,6 +493,7 @@ attr_syntax_add_by_name(struct asyntaxinfo *a, PRUint32 schema_flags, int lock)
 				PL_HashTableAdd(name2asi, a->asi_aliases[i], a);
 			}
 		}
+		attr_syntax_snapshot_unpublish();
 
 		if (lock) {
 			AS_UNLOCK_WRITE(name2asi_lock);
@@ -524,9 +560,16 @@ attr_syntax_delete_no_lock( struct asyntaxinfo *asi,
 				PL_HashTableRemove(ht, asi->asi_aliases[i]);
 			}
 		}
-		if ( asi->asi_refcnt > 0 ) {
-			asi->asi_marked_for_delete = PR_TRUE;
-		} else {
+		if (!using_tmp_ht) {
+			/* no reader may find it from now on */
+			attr_syntax_snapshot_unpublish();
+		}
+		if ( asi->asi_marked_for_delete ) {
+			return;		/* deleted already */
+		}
+		/* drop the reference of the tables */
+		asi->asi_marked_for_delete = PR_TRUE;
+		if ( 0 == PR_AtomicDecrement( &asi->asi_refcnt )) {
 			/* This is ok, but the correct thing is to call delete first, 
 			 * then to call return.  The last return will then take care of
 			 * the free.  The only way this free would happen here is if
@@ -562,6 +605,113 @@ slapi_attr_syntax_normalize( const char *s )
 	return r;
 }
 
+/*
+ * Give the id of the definition to a name, alias or oid, not caring
+ * for the one it had: the definition which is added is the current one.
+ */
+static void
+attr_syntax_intern_name( const char *name, PRUint32 id )
+{
+	PRUint32 oldid = (PRUint32)(uintptr_t)PL_HashTableLookup(type2id, name);
+
+	if (oldid == id) {
+		return;
+	}
+	if (oldid) {
+		PR_AtomicSet(&type2id_remapped, 1);
+		/* the key of the existing entry is kept */
+		PL_HashTableAdd(type2id, name, (void *)(uintptr_t)id);
+	} else {
+		PL_HashTableAdd(type2id, slapi_ch_strdup(name), (void *)(uintptr_t)id);
+	}
+}
+
+static void
+attr_syntax_intern( struct asyntaxinfo *asip )
+{
+	const char *oid = asip->asi_oid ? asip->asi_oid : asip->asi_name;
+	PRUint32 id;
+	int i;
+
+	if (NULL == type2id || NULL == oid) {
+		return;
+	}
+
+	AS_LOCK_WRITE(type2id_lock);
+	id = (PRUint32)(uintptr_t)PL_HashTableLookup(type2id, oid);
+	if (0 == id) {
+		id = type2id_next++;
+		attr_syntax_intern_name(oid, id);
+	}
+	if (asip->asi_name) {
+		attr_syntax_intern_name(asip->asi_name, id);
+	}
+	for (i = 0; asip->asi_aliases && asip->asi_aliases[i]; i++) {
+		attr_syntax_intern_name(asip->asi_aliases[i], id);
+	}
+	asip->asi_typeid = id;
+	AS_UNLOCK_WRITE(type2id_lock);
+}
+
+/*
+ * Returns non zero as long as different ids mean different base types.
+ */
+int
+attr_syntax_type_ids_stable(void)
+{
+	return 0 == PR_AtomicAdd(&type2id_remapped, 0);
+}
+
+/*
+ * The interned id of the base type of an attribute type, or 0 if it is
+ * not in the schema.
+ */
+PRUint32
+slapi_attr_type_id( const char *type )
+{
+	char buf[SLAPD_TYPICAL_ATTRIBUTE_NAME_MAX_LENGTH];
+	struct asi_snapshot *ss;
+	struct asyntaxinfo *asi = NULL;
+	const char *basetype = type;
+	char *tmp = NULL;
+	PRUint32 id = 0;
+
+	if (NULL == type || NULL == type2id) {
+		return 0;
+	}
+	if (strchr(type, ';')) {
+		basetype = buf;
+		if (NULL != (tmp = slapi_attr_basetype(type, buf, sizeof(buf)))) {
+			basetype = tmp;
+		}
+	}
+
+	/*
+	 * The asyntaxinfo of a snapshot is not freed before its readers have
+	 * left, no need for a reference to read its id.
+	 */
+	if (asi_locking && 0 == slapi_epoch_enter()) {
+		if (NULL != (ss = SLAPI_EPOCH_READ(asi_snapshot))) {
+			asi = (struct asyntaxinfo *)PL_HashTableLookup_const(ss->ss_name2asi, basetype);
+			if (NULL == asi) {
+				asi = (struct asyntaxinfo *)PL_HashTableLookup_const(ss->ss_oid2asi, basetype);
+			}
+			if (asi) {
+				id = asi->asi_typeid;
+			}
+		}
+		slapi_epoch_leave();
+	}
+	if (0 == id) {
+		AS_LOCK_READ(type2id_lock);
+		id = (PRUint32)(uintptr_t)PL_HashTableLookup_const(type2id, basetype);
+		AS_UNLOCK_READ(type2id_lock);
+	}
+
+	slapi_ch_free_string(&tmp);
+	return id;
+}
+
 /* 
  * flags: 
  * 0 -- same as slapi_attr_syntax_normalize
@@ -951,6 +1101,9 @@ attr_syntax_add( struct asyntaxinfo *asip, PRUint32 schema_flags )
 	/* ditto for the override one */
 	asip->asi_flags &= ~SLAPI_ATTR_FLAG_OVERRIDE;
 	
+	attr_syntax_intern( asip );
+	/* the reference of the tables, see attr_syntax_delete_no_lock() */
+	PR_AtomicIncrement( &asip->asi_refcnt );
 	attr_syntax_add_by_oid( asip->asi_oid, asip, schema_flags, !nolock);
 	attr_syntax_add_by_name( asip, schema_flags, !nolock);
 
@@ -1465,6 +1618,21 @@ attr_syntax_init(void)
 	int schema_modify_enabled = config_get_schemamod();
 	if (!schema_modify_enabled) asi_locking = 0;
 
+	if (!type2id)
+	{
+		type2id = PL_NewHashTable(2047, hashNocaseString,
+		                          hashNocaseCompare,
+		                          PL_CompareValues, 0, 0);
+		if ( asi_locking && NULL == ( type2id_lock = slapi_new_rwlock())) {
+			if(type2id) PL_HashTableDestroy(type2id);
+			type2id = NULL;
+
+			slapi_log_error( SLAPI_LOG_FATAL, "attr_syntax_init",
+					"slapi_new_rwlock() for type2id lock failed\n" );
+			return 1;
+		}
+	}
+
 	if (!oid2asi)
 	{
 		oid2asi = PL_NewHashTable(2047, hashNocaseString,
@@ -1659,6 +1827,9 @@ attr_syntax_swap_ht()
 {
 	struct asyntaxinfo *next;
 
+	/* The readers of the snapshot must be gone before we free anything */
+	attr_syntax_snapshot_unpublish();
+
 	/* Remove the old hash tables */
 	PL_HashTableDestroy(name2asi);
 	PL_HashTableDestroy(oid2asi);
@@ -1682,3 +1853,120 @@ attr_syntax_swap_ht()
 	global_at_tmp = NULL;
 }
 
+
+static PRIntn
+attr_syntax_snapshot_copy_entry(PLHashEntry *he, PRIntn i, void *arg)
+{
+	PL_HashTableAdd((PLHashTable *)arg, he->key, he->value);
+	return HT_ENUMERATE_NEXT;
+}
+
+static PLHashTable *
+attr_syntax_snapshot_copy_ht(PLHashTable *ht)
+{
+	PLHashTable *copy = PL_NewHashTable(2047, hashNocaseString,
+	                                    hashNocaseCompare,
+	                                    PL_CompareValues, 0, 0);
+
+	if (copy) {
+		PL_HashTableEnumerateEntries(ht, attr_syntax_snapshot_copy_entry, copy);
+	}
+	return copy;
+}
+
+static void
+attr_syntax_snapshot_free(struct asi_snapshot *ss)
+{
+	if (ss->ss_oid2asi) {
+		PL_HashTableDestroy(ss->ss_oid2asi);
+	}
+	if (ss->ss_name2asi) {
+		PL_HashTableDestroy(ss->ss_name2asi);
+	}
+	slapi_ch_free((void **)&ss);
+}
+
+/*
+ * Look the attribute type up in the published snapshot, by name and then by
+ * oid when by_name is set.  Returns 0 if there is none, and the caller has
+ * to use the tables.
+ */
+static int
+attr_syntax_snapshot_lookup( const char *key, PRBool by_name,
+		struct asyntaxinfo **asip )
+{
+	struct asi_snapshot *ss;
+	struct asyntaxinfo *asi = NULL;
+
+	if (!asi_locking || 0 != slapi_epoch_enter()) {
+		return 0;
+	}
+	if (NULL == (ss = SLAPI_EPOCH_READ(asi_snapshot))) {
+		slapi_epoch_leave();
+		return 0;
+	}
+	if (by_name) {
+		asi = (struct asyntaxinfo *)PL_HashTableLookup_const(ss->ss_name2asi, key);
+	}
+	if (NULL == asi) {
+		asi = (struct asyntaxinfo *)PL_HashTableLookup_const(ss->ss_oid2asi, key);
+	}
+	if (asi) {
+		PR_AtomicIncrement( &asi->asi_refcnt );
+	}
+	slapi_epoch_leave();
+
+	*asip = asi;
+	return 1;
+}
+
+/*
+ * Called by the readers which went through the locks: once the tables
+ * have not changed for a while, publish a copy of them.
+ */
+static void
+attr_syntax_snapshot_publish(void)
+{
+	struct asi_snapshot *ss;
+
+	if (!asi_locking || asi_snapshot ||
+	    PR_AtomicIncrement(&asi_snapshot_misses) < ASI_SNAPSHOT_MISSES ||
+	    PR_AtomicSet(&asi_snapshot_building, 1)) {
+		return;
+	}
+
+	/* the writers are locked out until the copy is published */
+	AS_LOCK_READ(oid2asi_lock);
+	AS_LOCK_READ(name2asi_lock);
+	if (NULL == asi_snapshot && oid2asi && name2asi) {
+		ss = (struct asi_snapshot *)slapi_ch_calloc(1, sizeof(struct asi_snapshot));
+		ss->ss_oid2asi = attr_syntax_snapshot_copy_ht(oid2asi);
+		ss->ss_name2asi = attr_syntax_snapshot_copy_ht(name2asi);
+		if (ss->ss_oid2asi && ss->ss_name2asi) {
+			SLAPI_EPOCH_PUBLISH(asi_snapshot, ss);
+		} else {
+			attr_syntax_snapshot_free(ss);
+		}
+	}
+	AS_UNLOCK_READ(name2asi_lock);
+	AS_UNLOCK_READ(oid2asi_lock);
+
+	PR_AtomicSet(&asi_snapshot_building, 0);
+}
+
+/*
+ * Called with a write lock held, before the tables change or anything
+ * they referred to is freed.
+ */
+static void
+attr_syntax_snapshot_unpublish(void)
+{
+	struct asi_snapshot *ss = asi_snapshot;
+
+	PR_AtomicSet(&asi_snapshot_misses, 0);
+	if (ss) {
+		asi_snapshot = NULL;
+		slapi_epoch_synchronize();
+		attr_syntax_snapshot_free(ss);
+	}
+}
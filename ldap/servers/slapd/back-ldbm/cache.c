@@ -1081,6 +1081,7 @@ static int entrycache_replace(struct cache *cache, struct backentry *olde,
         slapi_counter_subtract(cache->c_cursize, olde->ep_size - newe->ep_size);
     }
     newe->ep_state = 0;
+    entry_set_attrs_shared(newe->ep_entry);
     cache_unlock(cache);
     LOG("<= entrycache_replace OK,  cache size now %lu cache count now %ld\n",
              slapi_counter_get_value(cache->c_cursize), cache->c_curentries, 0);
@@ -1410,6 +1411,10 @@ entrycache_add_int(struct cache *cache, struct backentry *e, int state,
     }
 
     e->ep_state = state;
+    if (0 == state) {
+        /* from now on the entry is only read; see entry_attr_find() */
+        entry_set_attrs_shared(e->ep_entry);
+    }
 
     if (! already_in) {
         e->ep_refcnt = 1;
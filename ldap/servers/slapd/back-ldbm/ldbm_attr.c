@@ -1181,6 +1181,7 @@ static int grok_and_rewrite_filter(Slapi_Filter	*f)
 			/* we rewrite this search to (objectclass=*) */
 			slapi_ch_free((void**)&(f->f_type));
 			f->f_type = slapi_ch_strdup("objectclass");
+			filter_compute_typeid(f);
 			return 0;
 		} /* We already weeded out the special search we use use in the console */
 		break;
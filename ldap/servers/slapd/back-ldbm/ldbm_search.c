@@ -654,8 +654,10 @@ ldbm_back_search( Slapi_PBlock *pb )
         }
         if (candidates == NULL)
         {
+            PRUint64 start = slapi_op_phase_begin(operation);
             int rc = build_candidate_list(pb, be, e, base, scope,
                                           &lookup_returned_allids, &candidates);
+            slapi_op_phase_end(operation, SLAPI_OP_PHASE_CANDIDATES, start);
             if (rc)
             {
                 /* Error result sent by build_candidate_list */
@@ -1427,6 +1429,7 @@ ldbm_back_next_search_entry_ext( Slapi_PBlock *pb, int use_extension )
     Slapi_Connection       *conn;
     Slapi_Operation        *op;
     int                    reverse_list = 0;
+    PRUint64               phase_start;
 
     slapi_pblock_get( pb, SLAPI_SEARCH_TARGET_SDN, &basesdn );
     if (NULL == basesdn) {
@@ -1619,7 +1622,9 @@ ldbm_back_next_search_entry_ext( Slapi_PBlock *pb, int use_extension )
         }
 
         /* get the entry */
+        phase_start = slapi_op_phase_begin( op );
         e = id2entry( be, id, &txn, &err );
+        slapi_op_phase_end( op, SLAPI_OP_PHASE_FETCH, phase_start );
         if ( e == NULL )
         {
             if ( err != 0 && err != DB_NOTFOUND )
@@ -1707,6 +1712,7 @@ ldbm_back_next_search_entry_ext( Slapi_PBlock *pb, int use_extension )
           else
           {
             /* it's a regular entry, check if it matches the filter, and passes the ACL check */
+             phase_start = slapi_op_phase_begin( op );
              if ( 0 != ( sr->sr_flags & SR_FLAG_CAN_SKIP_FILTER_TEST )) {
                   /* Since we do access control checking in the filter test (?Why?) we need to check access now */
                   LDAPDebug( LDAP_DEBUG_FILTER, "Bypassing filter test\n", 0, 0, 0 );
@@ -1731,6 +1737,7 @@ ldbm_back_next_search_entry_ext( Slapi_PBlock *pb, int use_extension )
                   /* Old-style case---we need to do a filter test */
                   filter_test = slapi_vattr_filter_test( pb, e->ep_entry, filter, ACL_CHECK_FLAG);
               }
+              slapi_op_phase_end( op, SLAPI_OP_PHASE_FILTER, phase_start );
          }
          if ( (filter_test == 0) || (sr->sr_virtuallistview && (filter_test != -1)) )
             /* ugaston - if filter failed due to subentries or tombstones (filter_test=-1),
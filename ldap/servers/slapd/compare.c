@@ -163,10 +163,13 @@ do_compare( Slapi_PBlock *pb )
 		if ( plugin_call_plugins( pb,
 				SLAPI_PLUGIN_PRE_COMPARE_FN ) == 0 ) {
 			int	rc;
+			PRUint64 start;
 
 			slapi_pblock_set( pb, SLAPI_PLUGIN, be->be_database );
 			set_db_default_result_handlers(pb);
+			start = slapi_op_phase_begin( pb->pb_op );
 			rc = (*be->be_compare)( pb );
+			optiming_backend_end( pb->pb_op, be, start );
 
 			slapi_pblock_set( pb, SLAPI_PLUGIN_OPRETURN, &rc );
 			plugin_call_plugins( pb, SLAPI_PLUGIN_POST_COMPARE_FN );
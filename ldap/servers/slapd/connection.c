@@ -1601,6 +1601,7 @@ connection_threadmain()
 		/* Once we're here we have a pb */ 
 		conn = pb->pb_conn;
 		op = pb->pb_op;
+		optiming_op_start(op);
 		maxthreads = config_get_maxthreadsperconn();
 		more_data = 0;
 		ret = connection_read_operation(conn,op,&tag,&more_data);
@@ -1755,6 +1756,7 @@ connection_threadmain()
 		 * Call the do_<operation> function to process this request.
 		 */
 		connection_dispatch_operation(conn, op, pb);
+		optiming_op_done(op);
 
 done:	
 		if (doshutdown) {
@@ -1887,6 +1889,7 @@ add_work_q( work_q_item *wqitem, struct Slapi_op_stack *op_stack_obj )
 
 	LDAPDebug( LDAP_DEBUG_TRACE, "add_work_q \n", 0,  0, 0 );
 
+	optiming_op_queued(op_stack_obj->op);
 	new_work_q = create_work_q();
 	new_work_q->work_item = wqitem;
 	new_work_q->op_stack_obj = op_stack_obj;
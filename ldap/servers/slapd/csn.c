@@ -159,6 +159,11 @@ void csn_set_seqnum(CSN *csn, PRUint16 seqnum)
     csn->seqnum= seqnum;
 }
 
+void csn_set_subseqnum(CSN *csn, PRUint16 subseqnum)
+{
+    csn->subseqnum= subseqnum;
+}
+
 ReplicaId csn_get_replicaid(const CSN *csn)
 {
     return csn->rid;
@@ -1332,6 +1332,7 @@ void slapd_daemon( daemon_ports_t *ports )
 	be_flushall();
 	op_thread_cleanup();
 	housekeeping_stop(); /* Run this after op_thread_cleanup() logged sth */
+	log_access_writer_stop();
 	disk_monitoring_stop(disk_thread_p);
 
 	threads = g_get_active_threadcnt();
@@ -330,7 +330,11 @@ static void op_shared_delete (Slapi_PBlock *pb)
 		set_db_default_result_handlers(pb);
 		if (be->be_delete != NULL)
 		{
-			if ((rc = (*be->be_delete)(pb)) == 0)
+			PRUint64 start = slapi_op_phase_begin(pb->pb_op);
+
+			rc = (*be->be_delete)(pb);
+			optiming_backend_end(pb->pb_op, be, start);
+			if (rc == 0)
 			{
 				/* we don't perform acl check for internal operations */
 				/* Dont update aci store for remote acis              */
@@ -41,14 +41,21 @@ ndn_cache_lru
     char *key;
 };
 
+/*
+ * The cache is split in shards, selected by the hash of the dn, each one
+ * with its own hashtable, locks, lru list and share of the memory: the
+ * threads normalizing different dns seldom wait for each other.
+ */
 struct
 ndn_cache_ctx
 {
+    PLHashTable *hashtable;
+    Slapi_RWLock *lock;
+    PRLock *lru_lock;
     struct ndn_cache_lru *head;
     struct ndn_cache_lru *tail;
     Slapi_Counter *cache_hits;
     Slapi_Counter *cache_tries;
-    Slapi_Counter *cache_misses;
     size_t cache_size;
     size_t cache_max_size;
     long cache_count;
@@ -63,22 +70,20 @@ ndn_hash_val
     struct ndn_cache_lru *lru_node; /* used to speed up lru shuffling */
 };
 
-#define NDN_FLUSH_COUNT 10000 /* number of DN's to remove when cache fills up */
-#define NDN_MIN_COUNT 1000 /* the minimum number of DN's to keep in the cache */
+#define NDN_CACHE_SHARDS 16 /* power of two */
+#define NDN_FLUSH_COUNT (10000 / NDN_CACHE_SHARDS) /* number of DN's to remove when a shard fills up */
+#define NDN_MIN_COUNT (1000 / NDN_CACHE_SHARDS) /* the minimum number of DN's to keep in a shard */
 #define NDN_CACHE_BUCKETS 2053 /* prime number */
 
 static PLHashNumber ndn_hash_string(const void *key);
 static int ndn_cache_lookup(char *dn, size_t dn_len, char **result, char **udn, int *rc);
-static void ndn_cache_update_lru(struct ndn_cache_lru **node);
+static void ndn_cache_update_lru(struct ndn_cache_ctx *shard, struct ndn_cache_lru **node);
 static void ndn_cache_add(char *dn, size_t dn_len, char *ndn, size_t ndn_len);
-static void ndn_cache_delete(char *dn);
-static void ndn_cache_flush();
-static void ndn_cache_free();
+static void ndn_cache_delete(struct ndn_cache_ctx *shard, char *dn);
+static void ndn_cache_flush(struct ndn_cache_ctx *shard);
+static void ndn_cache_free(struct ndn_cache_ctx *shard);
 static int ndn_started = 0;
-static PRLock *lru_lock = NULL;
-static Slapi_RWLock *ndn_cache_lock = NULL;
-static struct ndn_cache_ctx *ndn_cache = NULL;
-static PLHashTable *ndn_cache_hashtable = NULL;
+static struct ndn_cache_ctx *ndn_cache = NULL; /* NDN_CACHE_SHARDS shards */
 
 #define ISBLANK(c)	((c) == ' ')
 #define ISBLANKSTR(s)	(((*(s)) == '2') && (*((s)+1) == '0'))
@@ -470,6 +475,66 @@ ISEOV(char *s, char *ends)
     return 1;
 }
 
+/*
+ * Most dns reaching slapi_dn_normalize_ext are already normalized: plain
+ * ascii "type=value,type=value" strings without any space, escape, quote
+ * or multi-valued rdn, which the state machine would copy as they are.
+ * dn_is_normalized_fast recognizes them, scanning 8 bytes at a time, so
+ * that they skip both the state machine and the ndn cache.
+ * Returns 1 if the dn is normalized; 0 if it has to take the slow path.
+ */
+#define DNFAST_ONES  ((PRUint64)0x0101010101010101ULL)
+#define DNFAST_HIGHS ((PRUint64)0x8080808080808080ULL)
+/* some byte of v is less than n (n <= 128) */
+#define DNFAST_HASLESS(v, n) (((v) - DNFAST_ONES * (n)) & ~(v) & DNFAST_HIGHS)
+/* some byte of v is c */
+#define DNFAST_HASBYTE(v, c) DNFAST_HASLESS((v) ^ (DNFAST_ONES * (c)), 1)
+#define DNFAST_REJECT(c) \
+    (((unsigned char)(c) < 0x21) || ((unsigned char)(c) >= 0x80) || \
+     ISQUOTE(c) || ISESCAPE(c) || ISPLUS(c) || ((c) == ';'))
+
+static int
+dn_is_normalized_fast(const char *dn, size_t dn_len)
+{
+    const char *p = dn;
+    const char *end = dn + dn_len;
+    const char *rdnend, *eq;
+    PRUint64 v;
+
+    /* no space, control, non-ascii, quote, escape, '+' or ';' */
+    for (; p + sizeof(v) <= end; p += sizeof(v)) {
+        memcpy(&v, p, sizeof(v));
+        if ((v & DNFAST_HIGHS) || DNFAST_HASLESS(v, 0x21) ||
+            DNFAST_HASBYTE(v, '"') || DNFAST_HASBYTE(v, '\\') ||
+            DNFAST_HASBYTE(v, '+') || DNFAST_HASBYTE(v, ';')) {
+            return 0;
+        }
+    }
+    for (; p < end; p++) {
+        if (DNFAST_REJECT(*p)) {
+            return 0;
+        }
+    }
+
+    /* each rdn is a non empty type, '=' and a non empty value */
+    for (p = dn; p < end; p = rdnend + 1) {
+        rdnend = memchr(p, ',', end - p);
+        if (NULL == rdnend) {
+            rdnend = end;
+        }
+        eq = memchr(p, '=', rdnend - p);
+        if ((NULL == eq) || (eq == p) || (eq + 1 == rdnend) ||
+            /* ACL macros are left to the state machine */
+            memchr(p, ')', eq - p) || memchr(p, ']', eq - p)) {
+            return 0;
+        }
+        if (rdnend == end) {
+            return 1;
+        }
+    }
+    return 0; /* empty dn or trailing ',' */
+}
+
 /*
  * 1) Escaped NEEDSESCAPE chars (e.g., ',', '<', '=', etc.) are converted to 
  * ESC HEX HEX (e.g., \2C, \3C, \3D, etc.)
@@ -530,6 +595,11 @@ slapi_dn_normalize_ext(char *src, size_t src_len, char **dest, size_t *dest_len)
     if (0 == src_len) {
         src_len = strlen(src);
     }
+    if (dn_is_normalized_fast(src, src_len)) {
+        *dest = src;
+        *dest_len = src_len;
+        return 0;
+    }
     /*
      *  Check the normalized dn cache
      */
@@ -2778,54 +2848,76 @@ ndn_hash_string(const void *key)
     return hash;
 }
 
+/*
+ * The hash of the dn selects the shard, and is then reused to look the dn
+ * up in the hashtable of the shard, rather than hashing it twice.
+ */
+static struct ndn_cache_ctx *
+ndn_cache_get_shard(const char *dn, PLHashNumber *hash)
+{
+    *hash = ndn_hash_string(dn);
+    return &ndn_cache[*hash & (NDN_CACHE_SHARDS - 1)];
+}
+
 void
 ndn_cache_init()
 {
+    struct ndn_cache_ctx *shard;
+    int i;
+
     if(!config_get_ndn_cache_enabled() || ndn_started){
         return;
     }
-    ndn_cache_hashtable = PL_NewHashTable( NDN_CACHE_BUCKETS, ndn_hash_string, PL_CompareStrings, PL_CompareValues, 0, 0);
-    ndn_cache = (struct ndn_cache_ctx *)slapi_ch_malloc(sizeof(struct ndn_cache_ctx));
-    ndn_cache->cache_max_size = config_get_ndn_cache_size();
-    ndn_cache->cache_hits = slapi_counter_new();
-    ndn_cache->cache_tries = slapi_counter_new();
-    ndn_cache->cache_misses = slapi_counter_new();
-    ndn_cache->cache_count = 0;
-    ndn_cache->cache_size = sizeof(struct ndn_cache_ctx) + sizeof(PLHashTable) + sizeof(PLHashTable);
-    ndn_cache->head = NULL;
-    ndn_cache->tail = NULL;
+    ndn_cache = (struct ndn_cache_ctx *)slapi_ch_calloc(NDN_CACHE_SHARDS, sizeof(struct ndn_cache_ctx));
     ndn_started = 1;
-    if ( NULL == ( lru_lock = PR_NewLock()) ||  NULL == ( ndn_cache_lock = slapi_new_rwlock())) {
-        ndn_cache_destroy();
-        slapi_log_error( SLAPI_LOG_FATAL, "ndn_cache_init", "Failed to create locks.  Disabling cache.\n" );
+    for(i = 0; i < NDN_CACHE_SHARDS; i++){
+        shard = &ndn_cache[i];
+        shard->hashtable = PL_NewHashTable( NDN_CACHE_BUCKETS, ndn_hash_string, PL_CompareStrings, PL_CompareValues, 0, 0);
+        shard->cache_max_size = config_get_ndn_cache_size() / NDN_CACHE_SHARDS;
+        shard->cache_hits = slapi_counter_new();
+        shard->cache_tries = slapi_counter_new();
+        shard->cache_count = 0;
+        shard->cache_size = sizeof(struct ndn_cache_ctx) + sizeof(PLHashTable) + sizeof(PLHashTable);
+        shard->head = NULL;
+        shard->tail = NULL;
+        if ( NULL == shard->hashtable || NULL == ( shard->lru_lock = PR_NewLock()) ||
+             NULL == ( shard->lock = slapi_new_rwlock())) {
+            ndn_cache_destroy();
+            slapi_log_error( SLAPI_LOG_FATAL, "ndn_cache_init", "Failed to create locks.  Disabling cache.\n" );
+            return;
+        }
     }
 }
 
 void
 ndn_cache_destroy()
 {
+    struct ndn_cache_ctx *shard;
     char *errorbuf = NULL;
+    int i;
 
     if(!ndn_started){
         return;
     }
-    if(lru_lock){
-        PR_DestroyLock(lru_lock);
-        lru_lock = NULL;
-    }
-    if(ndn_cache_lock){
-        slapi_destroy_rwlock(ndn_cache_lock);
-        ndn_cache_lock = NULL;
-    }
-    if(ndn_cache_hashtable){
-    	ndn_cache_free();
-        PL_HashTableDestroy(ndn_cache_hashtable);
-        ndn_cache_hashtable = NULL;
+    for(i = 0; i < NDN_CACHE_SHARDS; i++){
+        shard = &ndn_cache[i];
+        if(shard->lru_lock){
+            PR_DestroyLock(shard->lru_lock);
+            shard->lru_lock = NULL;
+        }
+        if(shard->lock){
+            slapi_destroy_rwlock(shard->lock);
+            shard->lock = NULL;
+        }
+        if(shard->hashtable){
+            ndn_cache_free(shard);
+            PL_HashTableDestroy(shard->hashtable);
+            shard->hashtable = NULL;
+        }
+        slapi_counter_destroy(&shard->cache_hits);
+        slapi_counter_destroy(&shard->cache_tries);
     }
     config_set_ndn_cache_enabled(CONFIG_NDN_CACHE, "off", errorbuf, 1 );
-    slapi_counter_destroy(&ndn_cache->cache_hits);
-    slapi_counter_destroy(&ndn_cache->cache_tries);
-    slapi_counter_destroy(&ndn_cache->cache_misses);
     slapi_ch_free((void **)&ndn_cache);
 
     ndn_started = 0;
@@ -2843,7 +2935,10 @@ ndn_cache_started()
 static int
 ndn_cache_lookup(char *dn, size_t dn_len, char **result, char **udn, int *rc)
 {
+    struct ndn_cache_ctx *shard;
     struct ndn_hash_val *ndn_ht_val = NULL;
+    PLHashEntry *he;
+    PLHashNumber hash;
     char *ndn, *key;
     int rv = 0;
 
@@ -2859,12 +2954,13 @@ ndn_cache_lookup(char *dn, size_t dn_len, char **result, char **udn, int *rc)
         *rc = 0;
         return 1;
     }
-    slapi_counter_increment(ndn_cache->cache_tries);
-    slapi_rwlock_rdlock(ndn_cache_lock);
-    ndn_ht_val = (struct ndn_hash_val *)PL_HashTableLookupConst(ndn_cache_hashtable, dn);
-    if(ndn_ht_val){
-        ndn_cache_update_lru(&ndn_ht_val->lru_node);
-        slapi_counter_increment(ndn_cache->cache_hits);
+    shard = ndn_cache_get_shard(dn, &hash);
+    slapi_counter_increment(shard->cache_tries);
+    slapi_rwlock_rdlock(shard->lock);
+    if((he = *PL_HashTableRawLookupConst(shard->hashtable, hash, dn))){
+        ndn_ht_val = (struct ndn_hash_val *)he->value;
+        ndn_cache_update_lru(shard, &ndn_ht_val->lru_node);
+        slapi_counter_increment(shard->cache_hits);
         if ((ndn_ht_val->len != dn_len) || 
             /* even if the lengths match, dn may not be normalized yet.
              * (e.g., 'cn="o=ABC",o=XYZ' vs. 'cn=o\3DABC,o=XYZ') */
@@ -2887,7 +2983,7 @@ ndn_cache_lookup(char *dn, size_t dn_len, char **result, char **udn, int *rc)
         key[dn_len] = '\0';
         *udn = key;
     }
-    slapi_rwlock_unlock(ndn_cache_lock);
+    slapi_rwlock_unlock(shard->lock);
 
     return rv;
 }
@@ -2896,17 +2992,17 @@ ndn_cache_lookup(char *dn, size_t dn_len, char **result, char **udn, int *rc)
  *  Move this lru node to the top of the list
  */
 static void
-ndn_cache_update_lru(struct ndn_cache_lru **node)
+ndn_cache_update_lru(struct ndn_cache_ctx *shard, struct ndn_cache_lru **node)
 {
     struct ndn_cache_lru *prev, *next, *curr_node = *node;
 
     if(curr_node == NULL){
         return;
     }
-    PR_Lock(lru_lock);
+    PR_Lock(shard->lru_lock);
     if(curr_node->prev == NULL){
         /* already the top node */
-        PR_Unlock(lru_lock);
+        PR_Unlock(shard->lru_lock);
         return;
     }
     prev = curr_node->prev;
@@ -2916,14 +3012,14 @@ ndn_cache_update_lru(struct ndn_cache_lru **node)
         prev->next = next;
     } else {
         /* this was the tail, so reset the tail */
-        ndn_cache->tail = prev;
+        shard->tail = prev;
         prev->next = NULL;
     }
     curr_node->prev = NULL;
-    curr_node->next = ndn_cache->head;
-    ndn_cache->head->prev = curr_node;
-    ndn_cache->head = curr_node;
-    PR_Unlock(lru_lock);
+    curr_node->next = shard->head;
+    shard->head->prev = curr_node;
+    shard->head = curr_node;
+    PR_Unlock(shard->lru_lock);
 }
 
 /*
@@ -2932,9 +3028,11 @@ ndn_cache_update_lru(struct ndn_cache_lru **node)
 static void
 ndn_cache_add(char *dn, size_t dn_len, char *ndn, size_t ndn_len)
 {
+    struct ndn_cache_ctx *shard;
     struct ndn_hash_val *ht_entry;
     struct ndn_cache_lru *new_node = NULL;
-    PLHashEntry *he;
+    PLHashEntry *he, **hep;
+    PLHashNumber hash;
     int size;
 
     if(ndn_started == 0 || dn_len == 0){
@@ -2961,11 +3059,11 @@ ndn_cache_add(char *dn, size_t dn_len, char *ndn, size_t ndn_len)
     /*
      *  Its possible this dn was added to the hash by another thread.
      */
-    slapi_rwlock_wrlock(ndn_cache_lock);
-    ht_entry = (struct ndn_hash_val *)PL_HashTableLookupConst(ndn_cache_hashtable, dn);
-    if(ht_entry){
+    shard = ndn_cache_get_shard(dn, &hash);
+    slapi_rwlock_wrlock(shard->lock);
+    if(*PL_HashTableRawLookupConst(shard->hashtable, hash, dn)){
         /* already exists, free the node and return */
-        slapi_rwlock_unlock(ndn_cache_lock);
+        slapi_rwlock_unlock(shard->lock);
         slapi_ch_free_string(&new_node->key);
         slapi_ch_free((void **)&new_node);
         return;
@@ -2975,7 +3073,7 @@ ndn_cache_add(char *dn, size_t dn_len, char *ndn, size_t ndn_len)
      */
     ht_entry = (struct ndn_hash_val *)slapi_ch_malloc(sizeof(struct ndn_hash_val));
     if(ht_entry == NULL){
-        slapi_rwlock_unlock(ndn_cache_lock);
+        slapi_rwlock_unlock(shard->lock);
         slapi_log_error( SLAPI_LOG_FATAL, "ndn_cache_add", "Failed to allocate new hash entry.\n");
         slapi_ch_free_string(&new_node->key);
         slapi_ch_free((void **)&new_node);
@@ -2990,58 +3088,59 @@ ndn_cache_add(char *dn, size_t dn_len, char *ndn, size_t ndn_len)
     /*
      *  Check if our cache is full
      */
-    PR_Lock(lru_lock); /* grab the lru lock now, as ndn_cache_flush needs it */
-    if(ndn_cache->cache_max_size != 0 && ((ndn_cache->cache_size + size) > ndn_cache->cache_max_size)){
-        ndn_cache_flush();
+    PR_Lock(shard->lru_lock); /* grab the lru lock now, as ndn_cache_flush needs it */
+    if(shard->cache_max_size != 0 && ((shard->cache_size + size) > shard->cache_max_size)){
+        ndn_cache_flush(shard);
     }
     /*
      * Set the ndn cache lru nodes
      */
-    if(ndn_cache->head == NULL && ndn_cache->tail == NULL){
+    if(shard->head == NULL && shard->tail == NULL){
         /* this is the first node */
-        ndn_cache->head = new_node;
-        ndn_cache->tail = new_node;
+        shard->head = new_node;
+        shard->tail = new_node;
         new_node->next = NULL;
     } else {
-        new_node->next = ndn_cache->head;
-        if(ndn_cache->head)
-            ndn_cache->head->prev = new_node;
+        new_node->next = shard->head;
+        if(shard->head)
+            shard->head->prev = new_node;
     }
-    ndn_cache->head = new_node;
-    PR_Unlock(lru_lock);
+    shard->head = new_node;
+    PR_Unlock(shard->lru_lock);
     /*
      *  Add the new object to the hashtable, and update our stats
      */
-    he = PL_HashTableAdd(ndn_cache_hashtable, new_node->key, (void *)ht_entry);
+    hep = PL_HashTableRawLookup(shard->hashtable, hash, new_node->key);
+    he = PL_HashTableRawAdd(shard->hashtable, hep, hash, new_node->key, (void *)ht_entry);
     if(he == NULL){
         slapi_log_error( SLAPI_LOG_FATAL, "ndn_cache_add", "Failed to add new entry to hash(%s)\n",dn);
     } else {
-        ndn_cache->cache_count++;
-        ndn_cache->cache_size += size;
+        shard->cache_count++;
+        shard->cache_size += size;
     }
-    slapi_rwlock_unlock(ndn_cache_lock);
+    slapi_rwlock_unlock(shard->lock);
 }
 
 /*
- *  cache is full, remove the least used dn's.  lru_lock/ndn_cache write lock are already taken
+ *  shard is full, remove the least used dn's.  lru_lock/shard write lock are already taken
  */
 static void
-ndn_cache_flush()
+ndn_cache_flush(struct ndn_cache_ctx *shard)
 {
     struct ndn_cache_lru *node, *next, *flush_node;
     int i;
 
-    node = ndn_cache->tail;
-    for(i = 0; node && i < NDN_FLUSH_COUNT && ndn_cache->cache_count > NDN_MIN_COUNT; i++){
+    node = shard->tail;
+    for(i = 0; node && i < NDN_FLUSH_COUNT && shard->cache_count > NDN_MIN_COUNT; i++){
         flush_node = node;
         /* update the lru */
         next = node->prev;
         next->next = NULL;
-        ndn_cache->tail = next;
+        shard->tail = next;
         node = next;
         /* now update the hash */
-        ndn_cache->cache_count--;
-        ndn_cache_delete(flush_node->key);
+        shard->cache_count--;
+        ndn_cache_delete(shard, flush_node->key);
         slapi_ch_free_string(&flush_node->key);
         slapi_ch_free((void **)&flush_node);
     }
@@ -3050,27 +3149,23 @@ ndn_cache_flush()
 }
 
 static void
-ndn_cache_free()
+ndn_cache_free(struct ndn_cache_ctx *shard)
 {
     struct ndn_cache_lru *node, *next, *flush_node;
 
-    if(!ndn_cache){
-        return;
-    }
-
-    node = ndn_cache->tail;
-    while(node && ndn_cache->cache_count){
+    node = shard->tail;
+    while(node && shard->cache_count){
         flush_node = node;
         /* update the lru */
         next = node->prev;
         if(next){
             next->next = NULL;
         }
-        ndn_cache->tail = next;
+        shard->tail = next;
         node = next;
         /* now update the hash */
-        ndn_cache->cache_count--;
-        ndn_cache_delete(flush_node->key);
+        shard->cache_count--;
+        ndn_cache_delete(shard, flush_node->key);
         slapi_ch_free_string(&flush_node->key);
         slapi_ch_free((void **)&flush_node);
     }
@@ -3078,30 +3173,39 @@ ndn_cache_free()
 
 /* this is already "write" locked from ndn_cache_add */
 static void
-ndn_cache_delete(char *dn)
+ndn_cache_delete(struct ndn_cache_ctx *shard, char *dn)
 {
     struct ndn_hash_val *ht_entry;
 
-    ht_entry = (struct ndn_hash_val *)PL_HashTableLookupConst(ndn_cache_hashtable, dn);
+    ht_entry = (struct ndn_hash_val *)PL_HashTableLookupConst(shard->hashtable, dn);
     if(ht_entry){
-        ndn_cache->cache_size -= ht_entry->size;
+        shard->cache_size -= ht_entry->size;
         slapi_ch_free_string(&ht_entry->ndn);
         slapi_ch_free((void **)&ht_entry);
-        PL_HashTableRemove(ndn_cache_hashtable, dn);
+        PL_HashTableRemove(shard->hashtable, dn);
     }
 }
 
-/* stats for monitor */
+/* stats for monitor, summed over the shards */
 void
 ndn_cache_get_stats(PRUint64 *hits, PRUint64 *tries, size_t *size, size_t *max_size, long *count)
 {
-    slapi_rwlock_rdlock(ndn_cache_lock);
-    *hits = slapi_counter_get_value(ndn_cache->cache_hits);
-    *tries = slapi_counter_get_value(ndn_cache->cache_tries);
-    *size = ndn_cache->cache_size;
-    *max_size = ndn_cache->cache_max_size;
-    *count = ndn_cache->cache_count;
-    slapi_rwlock_unlock(ndn_cache_lock);
+    struct ndn_cache_ctx *shard;
+    int i;
+
+    *hits = *tries = 0;
+    *size = *max_size = 0;
+    *count = 0;
+    for(i = 0; i < NDN_CACHE_SHARDS; i++){
+        shard = &ndn_cache[i];
+        slapi_rwlock_rdlock(shard->lock);
+        *hits += slapi_counter_get_value(shard->cache_hits);
+        *tries += slapi_counter_get_value(shard->cache_tries);
+        *size += shard->cache_size;
+        *max_size += shard->cache_max_size;
+        *count += shard->cache_count;
+        slapi_rwlock_unlock(shard->lock);
+    }
 }
 
 /* Common ancestor sdn is allocated.
@@ -1988,6 +1988,7 @@ slapi_entry_init(Slapi_Entry *e, char *dn, Slapi_Attr *a)
     e->e_virtual_watermark= 0;
     e->e_virtual_lock= slapi_new_rwlock();
     e->e_flags= 0;
+    e->e_attr_index= NULL;
 }
 
 void
@@ -2003,6 +2004,7 @@ slapi_entry_init_ext(Slapi_Entry *e, Slapi_DN *sdn, Slapi_Attr *a)
     e->e_virtual_watermark= 0;
     e->e_virtual_lock= slapi_new_rwlock();
     e->e_flags= 0;
+    e->e_attr_index= NULL;
 }
 
 void
@@ -2018,6 +2020,7 @@ slapi_entry_free( Slapi_Entry *e ) /* JCM - Should be ** so that we can NULL the
 	    csnset_free(&e->e_dncsnset);
 	    csn_free(&e->e_maxcsn);
 		slapi_ch_free((void **)&e->e_uniqueid);
+		entry_attrs_changed(e);
 		attrlist_free(e->e_attrs);
 		attrlist_free(e->e_deleted_attrs);
                 VATTR_WRITE_LOCK(e);
@@ -2155,8 +2158,8 @@ slapi_entry_dup( const Slapi_Entry *e )
 		lastattr= newattr;
 	}
 
-	/* Copy flags as well */
-	ec->e_flags = e->e_flags;
+	/* Copy flags as well, the copy is not shared yet */
+	ec->e_flags = e->e_flags & ~SLAPI_ENTRY_ATTRS_SHARED;
 
 	/* Copy extension */
 	for (aiep = attrs_in_extension; aiep && aiep->ext_type; aiep++) {
@@ -2340,6 +2343,140 @@ slapi_entry_next_attr( const Slapi_Entry *e, Slapi_Attr *prevattr, Slapi_Attr **
 	return( *a ? 0 : -1 );
 }
 
+/*
+ * Attribute index.  The entries shared read only by the threads (those of
+ * the entry cache, see entry_set_attrs_shared()) get an open addressing
+ * table from the attribute type to the Slapi_Attr, if they have at least
+ * ENTRY_ATTR_INDEX_MIN attributes.  It is built by the first lookup, and
+ * dropped by entry_attrs_changed(), which must be called by whoever adds
+ * or removes attributes from e_attrs.  It is published with a release store
+ * and read with an acquire load, so that a thread finding it sees it filled.
+ */
+#define ENTRY_ATTR_INDEX_MIN	16
+
+struct entry_attr_index {
+	PRUint32	ei_mask;
+	Slapi_Attr	*ei_slots[1];
+};
+
+/* the index of the entries which have too few attributes */
+static struct entry_attr_index entry_attr_index_none;
+static PRLock *entry_attr_index_lock = NULL;
+static PRCallOnceType entry_attr_index_callonce;
+
+static PRStatus
+entry_attr_index_init( void )
+{
+	entry_attr_index_lock = PR_NewLock();
+	return entry_attr_index_lock ? PR_SUCCESS : PR_FAILURE;
+}
+
+static struct entry_attr_index *
+entry_attr_index_build( const Slapi_Entry *e )
+{
+	struct entry_attr_index *ei;
+	Slapi_Attr *a;
+	PRUint32 n = 0, size, h;
+
+	for ( a = e->e_attrs; a != NULL; a = a->a_next ) {
+		n++;
+	}
+	if ( n < ENTRY_ATTR_INDEX_MIN ) {
+		return &entry_attr_index_none;
+	}
+	/* keep the table at most half full */
+	for ( size = 2 * ENTRY_ATTR_INDEX_MIN; size < 2 * n; size <<= 1 )
+		;
+	ei = (struct entry_attr_index *)slapi_ch_calloc( 1,
+			sizeof(struct entry_attr_index) + (size - 1) * sizeof(Slapi_Attr *) );
+	ei->ei_mask = size - 1;
+
+	for ( a = e->e_attrs; a != NULL; a = a->a_next ) {
+		h = hashNocaseString( a->a_type ) & ei->ei_mask;
+		while ( ei->ei_slots[h] != NULL &&
+				strcasecmp( ei->ei_slots[h]->a_type, a->a_type ) != 0 ) {
+			h = ( h + 1 ) & ei->ei_mask;
+		}
+		/* like attrlist_find(), the first one of the list wins */
+		if ( ei->ei_slots[h] == NULL ) {
+			ei->ei_slots[h] = a;
+		}
+	}
+	return ei;
+}
+
+static struct entry_attr_index *
+entry_attr_index_get( const Slapi_Entry *e )
+{
+	struct entry_attr_index *ei = SLAPI_EPOCH_READ( ((Slapi_Entry *)e)->e_attr_index );
+
+	if ( ei != NULL || !(e->e_flags & SLAPI_ENTRY_ATTRS_SHARED) ) {
+		return ei;
+	}
+	if ( PR_SUCCESS != PR_CallOnce( &entry_attr_index_callonce, entry_attr_index_init )) {
+		return NULL;
+	}
+
+	/* other threads may be looking the entry up as well */
+	ei = entry_attr_index_build( e );
+	PR_Lock( entry_attr_index_lock );
+	if ( e->e_attr_index == NULL ) {
+		SLAPI_EPOCH_PUBLISH( ((Slapi_Entry *)e)->e_attr_index, ei );
+	} else {
+		if ( ei != &entry_attr_index_none ) {
+			slapi_ch_free( (void **)&ei );
+		}
+		ei = e->e_attr_index;
+	}
+	PR_Unlock( entry_attr_index_lock );
+
+	return ei;
+}
+
+/*
+ * Same as attrlist_find( e->e_attrs, type ).
+ */
+Slapi_Attr *
+entry_attr_find( const Slapi_Entry *e, const char *type )
+{
+	struct entry_attr_index *ei = entry_attr_index_get( e );
+	Slapi_Attr *a;
+	PRUint32 h;
+
+	if ( ei == NULL || ei == &entry_attr_index_none ) {
+		return( attrlist_find( e->e_attrs, type ));
+	}
+	for ( h = hashNocaseString( type ) & ei->ei_mask;
+			( a = ei->ei_slots[h] ) != NULL;
+			h = ( h + 1 ) & ei->ei_mask ) {
+		if ( strcasecmp( a->a_type, type ) == 0 ) {
+			return( a );
+		}
+	}
+	return( NULL );
+}
+
+void
+entry_attrs_changed( Slapi_Entry *e )
+{
+	if ( e->e_attr_index != NULL ) {
+		if ( e->e_attr_index != &entry_attr_index_none ) {
+			slapi_ch_free( (void **)&e->e_attr_index );
+		}
+		e->e_attr_index = NULL;
+	}
+}
+
+/*
+ * The entry is about to be shared read only by the threads: its attribute
+ * list may be indexed from now on.
+ */
+void
+entry_set_attrs_shared( Slapi_Entry *e )
+{
+	e->e_flags |= SLAPI_ENTRY_ATTRS_SHARED;
+}
+
 int
 slapi_entry_attr_find( const Slapi_Entry *e, const char *type, Slapi_Attr **a )
 {
@@ -2348,7 +2485,7 @@ slapi_entry_attr_find( const Slapi_Entry *e, const char *type, Slapi_Attr **a )
 	if(e == NULL){
 		return r;
 	}
-	*a = attrlist_find( e->e_attrs, type );
+	*a = entry_attr_find( e, type );
 	if (*a != NULL)
 	{
 		if(valueset_isempty(&((*a)->a_present_values)))
@@ -2688,6 +2825,7 @@ slapi_entry_attr_merge( Slapi_Entry *e, const char *type, struct berval **vals )
 int
 slapi_entry_attr_merge_sv(Slapi_Entry *e, const char *type, Slapi_Value **vals )
 {
+    entry_attrs_changed(e);
     attrlist_merge_valuearray( &e->e_attrs, type, vals );
 	return 0;
 }
@@ -2764,6 +2902,7 @@ slapi_entry_vattrcache_merge_sv(Slapi_Entry *e, const char *type,
 int
 slapi_entry_attr_delete( Slapi_Entry *e, const char *type )
 {
+    entry_attrs_changed(e);
     return( attrlist_delete(&e->e_attrs, type) );
 }
 
@@ -2787,6 +2926,7 @@ int
 slapi_entry_add_value (Slapi_Entry *e, const char *type, const Slapi_Value *value)
 {
     Slapi_Attr **a= NULL;
+    entry_attrs_changed(e);
     attrlist_find_or_create(&e->e_attrs, type, &a);
     if(value != (Slapi_Value *) NULL) {
         slapi_valueset_add_attr_value_ext(*a, &(*a)->a_present_values, (Slapi_Value *)value, 0);
@@ -2799,6 +2939,7 @@ int
 slapi_entry_add_string(Slapi_Entry *e, const char *type, const char *value)
 {
 	Slapi_Attr **a= NULL;
+	entry_attrs_changed(e);
 	attrlist_find_or_create(&e->e_attrs, type, &a);
 	valueset_add_string ( *a, &(*a)->a_present_values, value, CSN_TYPE_UNKNOWN, NULL);
 	return 0;
@@ -2807,7 +2948,7 @@ slapi_entry_add_string(Slapi_Entry *e, const char *type, const char *value)
 int
 slapi_entry_delete_string(Slapi_Entry *e, const char *type, const char *value)
 {
-	Slapi_Attr *a= attrlist_find(e->e_attrs, type);
+	Slapi_Attr *a= entry_attr_find(e, type);
 	if (a != NULL)
 		valueset_remove_string(a,&a->a_present_values, value);
 	return 0;
@@ -3741,6 +3882,7 @@ slapi_entry_add_values_sv(Slapi_Entry *e,
 	{
 		Slapi_Attr **a= NULL;
 		Slapi_Attr **alist= &e->e_attrs;
+		entry_attrs_changed(e);
 		attrlist_find_or_create(alist, type, &a);
 		if (slapi_attr_is_dn_syntax_attr(*a)) {
 			valuearray_dn_normalize_value(vals);
@@ -3824,6 +3966,7 @@ delete_values_sv_internal(
 	if ( valuestodelete == NULL || valuestodelete[0] == NULL ){
 		LDAPDebug( LDAP_DEBUG_ARGS, "removing entire attribute %s\n",
 		    type, 0, 0 );
+		entry_attrs_changed(e);
 		retVal = attrlist_delete( &e->e_attrs, type);
 		if (flags & SLAPI_VALUE_FLAG_IGNOREERROR) {
 			return LDAP_SUCCESS;
@@ -3851,6 +3994,7 @@ delete_values_sv_internal(
 			 */
 			if ( valueset_isempty(&a->a_present_values) )
 			{
+				entry_attrs_changed(e);
 				attrlist_delete( &e->e_attrs, a->a_type );
 			}
 		}
@@ -3902,6 +4046,7 @@ entry_replace_values(
     struct berval	**vals
 )
 {
+    entry_attrs_changed(e);
     return attrlist_replace( &e->e_attrs, type, vals );
 }
 
@@ -3913,6 +4058,7 @@ entry_replace_values_with_flags(
     int flags
 )
 {
+    entry_attrs_changed(e);
     return attrlist_replace_with_flags( &e->e_attrs, type, vals, flags );
 }
 
@@ -70,6 +70,7 @@ entry_deleted_value_to_zapped_value(Slapi_Attr *a, Slapi_Value *v)
 static int
 entry_present_attribute_to_deleted_attribute(Slapi_Entry *e, Slapi_Attr *a)
 {
+	entry_attrs_changed(e);
 	attrlist_remove(&e->e_attrs,a->a_type);
 	attrlist_add(&e->e_deleted_attrs,a);
 	return LDAP_SUCCESS;
@@ -79,6 +80,7 @@ static int
 entry_deleted_attribute_to_present_attribute(Slapi_Entry *e, Slapi_Attr *a)
 {
 	attrlist_remove(&e->e_deleted_attrs,a->a_type);
+	entry_attrs_changed(e);
 	attrlist_add(&e->e_attrs,a);
 	return LDAP_SUCCESS;
 }
@@ -330,7 +332,7 @@ entry_attr_find_wsi(Slapi_Entry *e, const char *type, Slapi_Attr **a)
 	PR_ASSERT(a!=NULL);
 
 	/* Look on the present attribute list */
-	*a= attrlist_find(e->e_attrs,type);
+	*a= entry_attr_find(e,type);
 	if(*a!=NULL)
 	{
 		/* The attribute is present */
@@ -378,6 +380,7 @@ entry_add_present_attribute_wsi(Slapi_Entry *e, Slapi_Attr *a)
 {
 	PR_ASSERT( e!=NULL );
 	PR_ASSERT( a!=NULL );
+	entry_attrs_changed(e);
 	attrlist_add(&e->e_attrs, a);
 	return 0;
 }
@@ -406,6 +409,7 @@ entry_add_present_values_wsi(Slapi_Entry *e, const char *type, struct berval **b
 		/* Create a new attribute */
 		a = slapi_attr_new();
 		slapi_attr_init(a, type);
+		entry_attrs_changed(e);
 		attrlist_add(&e->e_attrs, a);
 	}
 
@@ -936,6 +940,7 @@ entry_apply_mod_wsi(Slapi_Entry *e, const LDAPMod *mod, const CSN *csn, int urp)
 			Slapi_Attr *a;
 
 			/* remove the attribute from the attr list */
+			entry_attrs_changed(e);
 			a = attrlist_remove(&e->e_attrs, mod->mod_type);
 			if (a && a->a_present_values.va) {
 				/* a->a_present_values.va is consumed if successful. */
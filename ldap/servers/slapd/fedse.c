@@ -96,6 +96,11 @@ static const char *internal_entries[] =
 	"objectclass:extensibleObject\n"
     "cn:counters\n",
 
+    "dn:cn=latency,cn=monitor\n"
+    "objectclass:top\n"
+	"objectclass:extensibleObject\n"
+    "cn:latency\n",
+
 	"dn:cn=sasl,cn=config\n"
     "objectclass:top\n"
     "objectclass:nsContainer\n"
@@ -1781,6 +1786,13 @@ search_snmp(Slapi_PBlock *pb, Slapi_Entry* entryBefore, Slapi_Entry* e, int *ret
 	return SLAPI_DSE_CALLBACK_OK;
 }
 
+static int
+search_latency(Slapi_PBlock *pb, Slapi_Entry* entryBefore, Slapi_Entry* e, int *returncode, char *returntext, void *arg)
+{
+	optiming_as_entry(entryBefore);
+	return SLAPI_DSE_CALLBACK_OK;
+}
+
 /*
  * Called from config.c to install the internal backends
  */
@@ -1802,6 +1814,7 @@ setup_internal_backends(char *configdir)
 		Slapi_DN monitor;
 		Slapi_DN counters;
 		Slapi_DN snmp;
+		Slapi_DN latency;
 		Slapi_DN root;
 		Slapi_Backend *be;
 		Slapi_DN encryption;
@@ -1811,6 +1824,7 @@ setup_internal_backends(char *configdir)
 		slapi_sdn_init_ndn_byref(&monitor,"cn=monitor");
 		slapi_sdn_init_ndn_byref(&counters,"cn=counters,cn=monitor");
 		slapi_sdn_init_ndn_byref(&snmp,"cn=snmp,cn=monitor");
+		slapi_sdn_init_ndn_byref(&latency,"cn=latency,cn=monitor");
 		slapi_sdn_init_ndn_byref(&root,"");
 
 		slapi_sdn_init_ndn_byref(&encryption,"cn=encryption,cn=config");
@@ -1824,6 +1838,7 @@ setup_internal_backends(char *configdir)
 		dse_register_callback(pfedse,SLAPI_OPERATION_SEARCH,DSE_FLAG_PREOP,&monitor,LDAP_SCOPE_SUBTREE,EGG_FILTER,search_easter_egg,NULL, NULL); /* Egg */
 		dse_register_callback(pfedse,SLAPI_OPERATION_SEARCH,DSE_FLAG_PREOP,&counters,LDAP_SCOPE_BASE,"(objectclass=*)",search_counters,NULL, NULL);
 		dse_register_callback(pfedse,SLAPI_OPERATION_SEARCH,DSE_FLAG_PREOP,&snmp,LDAP_SCOPE_BASE,"(objectclass=*)",search_snmp,NULL, NULL);
+		dse_register_callback(pfedse,SLAPI_OPERATION_SEARCH,DSE_FLAG_PREOP,&latency,LDAP_SCOPE_BASE,"(objectclass=*)",search_latency,NULL, NULL);
 		dse_register_callback(pfedse,SLAPI_OPERATION_SEARCH,DSE_FLAG_PREOP,&encryption,LDAP_SCOPE_BASE,"(objectclass=*)",search_encryption,NULL, NULL);
 
 		/* Modify */
@@ -1838,6 +1853,7 @@ setup_internal_backends(char *configdir)
 		dse_register_callback(pfedse,SLAPI_OPERATION_DELETE,DSE_FLAG_PREOP,&monitor,LDAP_SCOPE_BASE,"(objectclass=*)",dont_allow_that,NULL, NULL);
 		dse_register_callback(pfedse,SLAPI_OPERATION_DELETE,DSE_FLAG_PREOP,&counters,LDAP_SCOPE_BASE,"(objectclass=*)",dont_allow_that,NULL, NULL);
 		dse_register_callback(pfedse,SLAPI_OPERATION_DELETE,DSE_FLAG_PREOP,&snmp,LDAP_SCOPE_BASE,"(objectclass=*)",dont_allow_that,NULL, NULL);
+		dse_register_callback(pfedse,SLAPI_OPERATION_DELETE,DSE_FLAG_PREOP,&latency,LDAP_SCOPE_BASE,"(objectclass=*)",dont_allow_that,NULL, NULL);
 		dse_register_callback(pfedse,SLAPI_OPERATION_DELETE,DSE_FLAG_PREOP,&root,LDAP_SCOPE_BASE,"(objectclass=*)",dont_allow_that,NULL, NULL);
 		dse_register_callback(pfedse,SLAPI_OPERATION_DELETE,DSE_FLAG_PREOP,&encryption,LDAP_SCOPE_BASE,"(objectclass=*)",dont_allow_that,NULL, NULL);
 		dse_register_callback(pfedse,SLAPI_OPERATION_DELETE,DSE_FLAG_PREOP,&saslmapping,LDAP_SCOPE_SUBTREE,"(objectclass=nsSaslMapping)",sasl_map_config_delete,NULL, NULL);
@@ -1861,6 +1877,7 @@ setup_internal_backends(char *configdir)
 		slapi_sdn_done(&monitor);
 		slapi_sdn_done(&counters);
 		slapi_sdn_done(&snmp);
+		slapi_sdn_done(&latency);
 		slapi_sdn_done(&root);
 		slapi_sdn_done(&saslmapping);
 		slapi_sdn_done(&plugins);
@@ -726,6 +726,7 @@ slapi_filter_dup(Slapi_Filter *f)
 		    f->f_choice, 0, 0 );
 		break;
 	}
+	filter_compute_typeid(out);
 	
 	return out;
 }
@@ -1658,6 +1659,7 @@ int slapi_filter_changetype(Slapi_Filter *f, const char *newtype)
 
 	slapi_ch_free_string(target);
 	*target = slapi_ch_strdup(newtype);
+	filter_compute_typeid(f);
 
 bail:
 	return (!target);
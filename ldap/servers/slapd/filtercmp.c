@@ -122,6 +122,38 @@ static void done_mr_normval(Slapi_PBlock *pb)
     slapi_pblock_destroy(pb);
 }
 
+/*
+ * Remember the interned id of the type of a simple filter, for the tests
+ * of filterentry.c.  Whoever replaces the type of a filter with another
+ * attribute type must call this again.  Types with options have no id:
+ * they do not match all the subtypes of their base type.
+ */
+void filter_compute_typeid(struct slapi_filter *f)
+{
+    const char *type = NULL;
+
+    switch (f->f_choice) {
+    case LDAP_FILTER_EQUALITY:
+    case LDAP_FILTER_GE:
+    case LDAP_FILTER_LE:
+    case LDAP_FILTER_APPROX:
+	type = f->f_avtype;
+	break;
+    case LDAP_FILTER_SUBSTRINGS:
+	type = f->f_sub_type;
+	break;
+    case LDAP_FILTER_PRESENT:
+	type = f->f_type;
+	break;
+    }
+
+    if (type && NULL == strchr(type, ';')) {
+	f->f_typeid = slapi_attr_type_id(type);
+    } else {
+	f->f_typeid = 0;
+    }
+}
+
 static int hash_filters = 0;
 
 void set_hash_filters(int i) { hash_filters = i; }
@@ -140,6 +172,7 @@ void filter_compute_hash(struct slapi_filter *f)
     struct berval *inval[2], **outval;
     Slapi_Attr sattr;
 
+    filter_compute_typeid(f);
     if (! hash_filters)
 	return;
 
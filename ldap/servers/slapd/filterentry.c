@@ -21,6 +21,9 @@
 
 static int	test_filter_list();
 static int	test_extensible_filter();
+static int	test_ava_filter_typeid( Slapi_PBlock *pb, Slapi_Entry *e, Slapi_Attr *a,
+		struct ava *ava, PRUint32 typeid, int ftype, int verify_access,
+		int only_check_access, int *access_check_done );
 
 static int	vattr_test_filter_list();
 static int test_filter_access( Slapi_PBlock	*pb, Slapi_Entry*e,
@@ -115,8 +118,8 @@ slapi_filter_test_ext_internal(
 	switch ( f->f_choice ) {
 	case LDAP_FILTER_EQUALITY:
 		LDAPDebug( LDAP_DEBUG_FILTER, "    EQUALITY\n", 0, 0, 0 );
-		rc = test_ava_filter( pb, e, e->e_attrs, &f->f_ava, LDAP_FILTER_EQUALITY,
-					verify_access , only_check_access, access_check_done);
+		rc = test_ava_filter_typeid( pb, e, e->e_attrs, &f->f_ava, f->f_typeid,
+					LDAP_FILTER_EQUALITY, verify_access , only_check_access, access_check_done);
 		break;
 
 	case LDAP_FILTER_SUBSTRINGS:
@@ -126,14 +129,14 @@ slapi_filter_test_ext_internal(
 
 	case LDAP_FILTER_GE:
 		LDAPDebug( LDAP_DEBUG_FILTER, "    GE\n", 0, 0, 0 );
-		rc = test_ava_filter( pb, e, e->e_attrs, &f->f_ava, LDAP_FILTER_GE,
-					verify_access , only_check_access, access_check_done);
+		rc = test_ava_filter_typeid( pb, e, e->e_attrs, &f->f_ava, f->f_typeid,
+					LDAP_FILTER_GE, verify_access , only_check_access, access_check_done);
 		break;
 
 	case LDAP_FILTER_LE:
 		LDAPDebug( LDAP_DEBUG_FILTER, "    LE\n", 0, 0, 0 );
-		rc = test_ava_filter( pb, e, e->e_attrs, &f->f_ava, LDAP_FILTER_LE,
-					verify_access , only_check_access, access_check_done);
+		rc = test_ava_filter_typeid( pb, e, e->e_attrs, &f->f_ava, f->f_typeid,
+					LDAP_FILTER_LE, verify_access , only_check_access, access_check_done);
 		break;
 
 	case LDAP_FILTER_PRESENT:
@@ -143,8 +146,8 @@ slapi_filter_test_ext_internal(
 
 	case LDAP_FILTER_APPROX:
 		LDAPDebug( LDAP_DEBUG_FILTER, "    APPROX\n", 0, 0, 0 );
-		rc = test_ava_filter( pb, e, e->e_attrs, &f->f_ava, LDAP_FILTER_APPROX,
-					verify_access , only_check_access, access_check_done);
+		rc = test_ava_filter_typeid( pb, e, e->e_attrs, &f->f_ava, f->f_typeid,
+					LDAP_FILTER_APPROX, verify_access , only_check_access, access_check_done);
 		break;
 
 	case LDAP_FILTER_EXTENDED:
@@ -248,6 +251,25 @@ slapi_filter_test_ext(
 }
 
 
+/*
+ * Compare the type of a filter with the one of an attribute, with the
+ * subtype semantics of slapi_attr_type_cmp().  typeid is the interned id
+ * of the type of the filter, or 0 to compare the names.
+ */
+static int
+filter_attr_type_cmp( const char *type, PRUint32 typeid, const Slapi_Attr *a )
+{
+	if ( typeid != 0 && a->a_typeid != 0 ) {
+		if ( typeid == a->a_typeid ) {
+			return( 0 );
+		}
+		if ( attr_syntax_type_ids_stable() ) {
+			return( 1 );
+		}
+	}
+	return( slapi_attr_type_cmp( type, a->a_type, SLAPI_TYPE_CMP_SUBTYPE ));
+}
+
 int test_ava_filter(
     Slapi_PBlock	*pb,
     Slapi_Entry		*e,
@@ -258,6 +280,23 @@ int test_ava_filter(
 	int			only_check_access,
 	int			*access_check_done
 )
+{
+	return( test_ava_filter_typeid( pb, e, a, ava, 0, ftype, verify_access,
+				only_check_access, access_check_done ));
+}
+
+static int
+test_ava_filter_typeid(
+    Slapi_PBlock	*pb,
+    Slapi_Entry		*e,
+    Slapi_Attr	*a,
+    struct ava		*ava,
+    PRUint32		typeid,
+    int			ftype,
+    int			verify_access,
+	int			only_check_access,
+	int			*access_check_done
+)
 {
 	int			rc;
 	
@@ -273,7 +312,7 @@ int test_ava_filter(
 		{
 			rc = -1;
 			for ( ; a != NULL; a = a->a_next ) {
-				if ( slapi_attr_type_cmp( ava->ava_type, a->a_type, SLAPI_TYPE_CMP_SUBTYPE ) == 0 ) {
+				if ( filter_attr_type_cmp( ava->ava_type, typeid, a ) == 0 ) {
 					rc = plugin_call_syntax_filter_ava( a, ftype, ava );
 					if ( rc == 0 ) {
 						break;
@@ -308,7 +347,7 @@ int test_ava_filter(
 
 		rc = -1;
 		for ( ; a != NULL; a = a->a_next ) {
-			if ( slapi_attr_type_cmp( ava->ava_type, a->a_type, SLAPI_TYPE_CMP_SUBTYPE ) == 0 ) {
+			if ( filter_attr_type_cmp( ava->ava_type, typeid, a ) == 0 ) {
 				rc = plugin_call_syntax_filter_ava( a, ftype, ava );
 				if ( rc == 0 ) {
 					break;
@@ -681,7 +720,7 @@ int test_substring_filter(
 		{
 			rc = -1;
 			for ( a = e->e_attrs; a != NULL; a = a->a_next ) {
-				if ( slapi_attr_type_cmp( f->f_sub_type, a->a_type, SLAPI_TYPE_CMP_SUBTYPE ) == 0 ) {
+				if ( filter_attr_type_cmp( f->f_sub_type, f->f_typeid, a ) == 0 ) {
 					rc = plugin_call_syntax_filter_sub( pb, a, &f->f_sub );
 					if ( rc == 0 ) {
 						break;
@@ -714,7 +753,7 @@ int test_substring_filter(
 
 		rc = -1;
 		for ( a = e->e_attrs; a != NULL; a = a->a_next ) {
-			if ( slapi_attr_type_cmp( f->f_sub_type, a->a_type, SLAPI_TYPE_CMP_SUBTYPE ) == 0 ) {
+			if ( filter_attr_type_cmp( f->f_sub_type, f->f_typeid, a ) == 0 ) {
 				rc = plugin_call_syntax_filter_sub( pb, a, &f->f_sub );
 				if ( rc == 0 || rc == LDAP_TIMELIMIT_EXCEEDED ) {
 					break;
@@ -75,12 +75,13 @@ set_entry_points()
 	/* To apply the nsslapd-counters config value properly,
 	   these values are initialized here after config file is read */
 	if (config_get_slapi_counters()) {
-		ops_initiated = slapi_counter_new();
-		ops_completed = slapi_counter_new();
+		/* updated by every operation: sharded */
+		ops_initiated = slapi_counter_new_sharded();
+		ops_completed = slapi_counter_new_sharded();
 		max_threads_count = slapi_counter_new();
 		conns_in_maxthreads = slapi_counter_new();
-		g_set_num_entries_sent( slapi_counter_new() );
-		g_set_num_bytes_sent( slapi_counter_new() );
+		g_set_num_entries_sent( slapi_counter_new_sharded() );
+		g_set_num_bytes_sent( slapi_counter_new_sharded() );
 	} else {
 		ops_initiated = NULL;
 		ops_completed = NULL;
@@ -1055,13 +1055,14 @@ int slapi_index_register_index(char *plugin_id, indexed_item *registration_item,
 	 * callbacks disables the index for that plugin
 	 */
 
-	/* find the index if already registered */
+	/* find the index if already registered for this namespace */
 
 	index = plg->indexes;
 
 	while(index)
 	{
-		if(index_subsys_index_matches_filter(index, tmp_f))
+		if(index_subsys_index_matches_filter(index, tmp_f) &&
+			!slapi_sdn_compare(index->namespace_dn, slapi_be_getsuffix(be, 0)))
 		{
 			/* found it - free what is currently there, it will be replaced */
 			slapi_ch_free((void**)&index->indexfilterstr);
@@ -177,6 +177,7 @@ slapi_onoff_t init_auditlog_rotationsync_enabled;
 slapi_onoff_t init_auditfaillog_rotationsync_enabled;
 slapi_onoff_t init_accesslog_logging_enabled;
 slapi_onoff_t init_accesslogbuffering;
+slapi_onoff_t init_accesslogbinary;
 slapi_onoff_t init_errorlog_logging_enabled;
 slapi_onoff_t init_auditlog_logging_enabled;
 slapi_onoff_t init_auditlog_logging_hide_unhashed_pw;
@@ -232,6 +233,7 @@ slapi_onoff_t init_ndn_cache_enabled;
 slapi_onoff_t init_sasl_mapping_fallback;
 slapi_onoff_t init_return_orig_type;
 slapi_onoff_t init_enable_turbo_mode;
+slapi_onoff_t init_latency_stats;
 slapi_onoff_t init_connection_nocanon;
 slapi_onoff_t init_plugin_logging;
 slapi_int_t init_connection_buffer;
@@ -714,6 +716,10 @@ static struct config_get_and_set {
 		NULL, 0,
 		(void**)&global_slapdFrontendConfig.accesslogbuffering,
 		CONFIG_ON_OFF, NULL, &init_accesslogbuffering},
+	{CONFIG_ACCESSLOG_BINARY_ATTRIBUTE, config_set_accesslogbinary,
+		NULL, 0,
+		(void**)&global_slapdFrontendConfig.accesslogbinary,
+		CONFIG_ON_OFF, NULL, &init_accesslogbinary},
 	{CONFIG_CSNLOGGING_ATTRIBUTE, config_set_csnlogging,
 		NULL, 0,
 		(void**)&global_slapdFrontendConfig.csnlogging,
@@ -1052,6 +1058,10 @@ static struct config_get_and_set {
 		NULL, 0,
 		(void**)&global_slapdFrontendConfig.enable_turbo_mode,
 		CONFIG_ON_OFF, (ConfigGetFunc)config_get_enable_turbo_mode, &init_enable_turbo_mode},
+	{CONFIG_LATENCY_STATS, config_set_latency_stats,
+		NULL, 0,
+		(void**)&global_slapdFrontendConfig.latency_stats,
+		CONFIG_ON_OFF, (ConfigGetFunc)config_get_latency_stats, &init_latency_stats},
 	{CONFIG_CONNECTION_BUFFER, config_set_connection_buffer,
 		NULL, 0,
 		(void**)&global_slapdFrontendConfig.connection_buffer,
@@ -1561,6 +1571,7 @@ FrontendConfig_init () {
   cfg->accesslog_exptimeunit = slapi_ch_strdup(INIT_ACCESSLOG_EXPTIMEUNIT);
   cfg->accessloglevel = 256;
   init_accesslogbuffering = cfg->accesslogbuffering = LDAP_ON;
+  init_accesslogbinary = cfg->accesslogbinary = LDAP_OFF;
   init_csnlogging = cfg->csnlogging = LDAP_ON;
 
   init_errorlog_logging_enabled = cfg->errorlog_logging_enabled = LDAP_ON;
@@ -1631,6 +1642,7 @@ FrontendConfig_init () {
   cfg->unhashed_pw_switch = SLAPD_UNHASHED_PW_ON;
   init_return_orig_type = cfg->return_orig_type = LDAP_OFF;
   init_enable_turbo_mode = cfg->enable_turbo_mode = LDAP_ON;
+  init_latency_stats = cfg->latency_stats = LDAP_ON;
   init_connection_buffer = cfg->connection_buffer = CONNECTION_BUFFER_ON;
   init_connection_nocanon = cfg->connection_nocanon = LDAP_ON;
   init_plugin_logging = cfg->plugin_logging = LDAP_OFF;
@@ -6648,10 +6660,35 @@ config_set_accesslogbuffering(const char *attrname, char *value, char *errorbuf,
 							  &(slapdFrontendConfig->accesslogbuffering),
 							  errorbuf,
 							  apply);
+	if (apply && LDAP_SUCCESS == retVal) {
+		log_access_set_buffering(slapdFrontendConfig->accesslogbuffering);
+	}
   
 	return retVal;
 }
 
+int
+config_set_accesslogbinary(const char *attrname, char *value, char *errorbuf, int apply)
+{
+	int retVal = LDAP_SUCCESS;
+	slapdFrontendConfig_t *slapdFrontendConfig = getFrontendConfig();
+  
+	retVal = config_set_onoff(attrname,
+							  value, 
+							  &(slapdFrontendConfig->accesslogbinary),
+							  errorbuf,
+							  apply);
+  
+	return retVal;
+}
+
+int
+config_get_accesslogbinary()
+{
+	slapdFrontendConfig_t *slapdFrontendConfig = getFrontendConfig();
+	return (int)slapdFrontendConfig->accesslogbinary;
+}
+
 #ifdef MEMPOOL_EXPERIMENTAL
 int
 config_set_mempool_switch( const char *attrname, char *value, char *errorbuf, int apply ) {
@@ -7324,6 +7361,15 @@ config_get_enable_turbo_mode(void)
     return retVal;
 }
 
+/* read for every operation phase: no lock */
+int
+config_get_latency_stats(void)
+{
+    slapdFrontendConfig_t *slapdFrontendConfig = getFrontendConfig();
+
+    return (int)slapdFrontendConfig->latency_stats;
+}
+
 int
 config_get_connection_nocanon(void)
 {
@@ -7403,6 +7449,19 @@ config_set_enable_turbo_mode( const char *attrname, char *value,
     return retVal;
 }
 
+int
+config_set_latency_stats( const char *attrname, char *value,
+                          char *errorbuf, int apply )
+{
+    int retVal = LDAP_SUCCESS;
+    slapdFrontendConfig_t *slapdFrontendConfig = getFrontendConfig();
+
+    retVal = config_set_onoff(attrname, value,
+                              &(slapdFrontendConfig->latency_stats),
+                              errorbuf, apply);
+    return retVal;
+}
+
 int
 config_set_connection_nocanon( const char *attrname, char *value,
                             char *errorbuf, int apply )
@@ -37,8 +37,20 @@ struct logbufinfo *logbuf_accum;
 static struct logging_opts  loginfo;
 static int detached=0;
 
-/* used to lock the timestamp info used by vslapd_log_access */
-static PRLock *ts_time_lock = NULL;
+/*
+ * Access log records are appended by each thread to its own ring and the
+ * writer thread merges them, in the order of their sequence numbers, into
+ * the access log buffer.  log_ring_lock guards the list of rings and
+ * serializes their draining.
+ */
+static PRUintn log_thread_index;
+static LogRingInfo *log_rings = NULL;
+static PRLock *log_ring_lock = NULL;
+static PRCondVar *log_writer_cvar = NULL;
+static PRThread *log_writer_tid = NULL;
+static PRInt32 log_rings_enabled = LOG_RINGS_OFF;
+static int log_writer_wanted = 0;
+static PRInt32 log_access_seq = 0;
 
 /*
  * Note: the order of the values in the slapi_log_map array must exactly
@@ -71,6 +83,18 @@ static int slapi_log_map[] = {
 #define SLAPI_LOG_MAX	SLAPI_LOG_NUNCSTANS	/* from slapi-plugin.h */
 #define	TBUFSIZE 50				/* size for time buffers */
 #define SLAPI_LOG_BUFSIZ 2048			/* size for data buffers */
+#define LOG_RING_DRAIN_INTERVAL 100		/* msec between two drains */
+#define LOG_RECORD_SIZE(len) \
+	((sizeof(LogRecordInfo) + (len) + sizeof(LogRecordInfo) - 1) & \
+	 ~(sizeof(LogRecordInfo) - 1))
+
+/* what vslapd_log_access keeps for each thread */
+typedef struct log_thread_info {
+	time_t		lti_time;		/* time of the cached timestamp */
+	char		lti_tbuf[TBUFSIZE + 16];	/* "[timestamp zone] " */
+	int		lti_tlen;
+	LogRingInfo	*lti_ring;		/* NULL until the first record */
+} LogThreadInfo;
 /**************************************************************************
  * PROTOTYPES
  *************************************************************************/
@@ -99,9 +123,18 @@ static void	log_convert_time (time_t ctime, char *tbuf, int type);
 static time_t	log_reverse_convert_time (char *tbuf);
 static LogBufferInfo *log_create_buffer(size_t sz);
 static void	log_append_buffer2(time_t tnl, LogBufferInfo *lbi, char *msg1, size_t size1, char *msg2, size_t size2);
+static LogThreadInfo *log_get_thread_info(time_t tnl);
 static void	log_flush_buffer(LogBufferInfo *lbi, int type, int sync_now);
 static void	log_write_title(LOGFD fp);
+static void	log_write_binary_title(LOGFD fp);
+static char	*log_bin_put_header(char *p, int type, size_t len);
+static void	log_intern_reset(void);
 static void log__error_emergency(const char *errstr, int reopen, int locked);
+static void	log_thread_info_free(void *priv);
+static int	log_ring_append(LogThreadInfo *lti, time_t tnl, int type, char *msg1, size_t size1, char *msg2, size_t size2);
+static void	log_append_op(time_t tnl, LogBufferInfo *lbi, LogOpInfo *lop);
+static void	log__access_init_format(void);
+static void	log_access_drain(void);
 static void vslapd_log_emergency_error(LOGFD fp, const char *msg, int locked);
 
 static int
@@ -188,8 +221,11 @@ void g_log_init(int log_enabled)
 {
 	slapdFrontendConfig_t *slapdFrontendConfig = getFrontendConfig();
 
-	ts_time_lock = PR_NewLock();
-	if (! ts_time_lock)
+	if (PR_NewThreadPrivateIndex(&log_thread_index, log_thread_info_free) != PR_SUCCESS)
+	    exit(-1);
+	if ((log_ring_lock = PR_NewLock()) == NULL)
+	    exit(-1);
+	if ((log_writer_cvar = PR_NewCondVar(log_ring_lock)) == NULL)
 	    exit(-1);
 
 	/* ACCESS LOG */
@@ -216,6 +252,7 @@ void g_log_init(int log_enabled)
 	loginfo.log_accessinfo_file = NULL;
 	loginfo.log_numof_access_logs = 1;
 	loginfo.log_access_logchain = NULL;
+	loginfo.log_access_binary = -1;
     loginfo.log_access_buffer = log_create_buffer(LOG_BUFFER_MAXSIZE);
     if (loginfo.log_access_buffer == NULL)
         exit(-1);
@@ -1754,21 +1791,19 @@ log_set_expirationtimeunit(const char *attrname, char *expunit, int logtype, cha
 /******************************************************************************
  * Write title line in log file
  *****************************************************************************/
-static void
-log_write_title (LOGFD fp)
+static int
+log_format_title (char *buff, int bufflen)
 {
 	slapdFrontendConfig_t *fe_cfg = getFrontendConfig();
 	char *buildnum = config_get_buildnum();
-	char buff[512];
-	int bufflen = sizeof(buff);
+	int len;
 
-	PR_snprintf(buff, bufflen, "\t%s B%s\n",
+	len = PR_snprintf(buff, bufflen, "\t%s B%s\n",
 				fe_cfg->versionstring ? fe_cfg->versionstring : CAPBRAND "-Directory/" DS_PACKAGE_VERSION,
 				buildnum ? buildnum : "");
-	LOG_WRITE_NOW_NO_ERR(fp, buff, strlen(buff), 0);
 
 	if (fe_cfg->localhost) {
-		PR_snprintf(buff, bufflen, "\t%s:%d (%s)\n\n",
+		len += PR_snprintf(buff + len, bufflen - len, "\t%s:%d (%s)\n\n",
 				fe_cfg->localhost,
 				fe_cfg->security ? fe_cfg->secureport : fe_cfg->port,
 				fe_cfg->configdir ? fe_cfg->configdir : "");
@@ -1777,11 +1812,42 @@ log_write_title (LOGFD fp)
 		/* If fe_cfg->localhost is not set, ignore fe_cfg->port since
 		 * it is the default and might be misleading.
 		 */
-		PR_snprintf(buff, bufflen, "\t<host>:<port> (%s)\n\n",
+		len += PR_snprintf(buff + len, bufflen - len, "\t<host>:<port> (%s)\n\n",
 				fe_cfg->configdir ? fe_cfg->configdir : "");
 	}
-	LOG_WRITE_NOW_NO_ERR(fp, buff, strlen(buff), 0);
 	slapi_ch_free((void **)&buildnum);
+
+	return len;
+}
+
+static void
+log_write_title (LOGFD fp)
+{
+	char buff[1024];
+	int len = log_format_title(buff, sizeof(buff));
+
+	LOG_WRITE_NOW_NO_ERR(fp, buff, len, 0);
+}
+
+/*
+ * The title in a LOG_BIN_TEXT frame, preceded by the magic of the binary
+ * access log when the file is new: a file reopened by a restart already
+ * starts with it.
+ */
+static void
+log_write_binary_title (LOGFD fp)
+{
+	char buff[LOG_BIN_MAGIC_LEN + LOG_BIN_HDR_LEN + 1024];
+	char *p = buff;
+	int len;
+
+	if (log__getfilesize(fp) <= 0) {
+		memcpy(p, LOG_BIN_MAGIC, LOG_BIN_MAGIC_LEN);
+		p += LOG_BIN_MAGIC_LEN;
+	}
+	len = log_format_title(p + LOG_BIN_HDR_LEN, 1024);
+	p = log_bin_put_header(p, LOG_BIN_TEXT, len) + len;
+	LOG_WRITE_NOW_NO_ERR(fp, buff, p - buff, 0);
 }
 
 /******************************************************************************
@@ -2217,30 +2283,24 @@ slapi_is_loglevel_set ( const int loglevel )
 /******************************************************************************
 * write in the access log
 ******************************************************************************/ 
-static int vslapd_log_access(char *fmt, va_list ap)
+/*
+ * Return the logging data of the calling thread, with the timestamp of
+ * tnl.  Each thread keeps the strftime buffer of its last second.
+ */
+static LogThreadInfo *
+log_get_thread_info(time_t tnl)
 {
-    time_t	tnl;
+    LogThreadInfo *lti;
     long	tz;
     struct tm	*tmsp, tms;
     char	tbuf[ TBUFSIZE ];
     char	sign;
-    char	buffer[SLAPI_LOG_BUFSIZ];
-    char	vbuf[SLAPI_LOG_BUFSIZ];
-    int		blen, vlen;
-    /* info needed to keep us from calling localtime/strftime so often: */
-    static time_t	old_time = 0;
-    static char		old_tbuf[SLAPI_LOG_BUFSIZ];
-	static int old_blen = 0;
-
-    tnl = current_time();
 
-    /* check if we can use the old strftime buffer */
-    PR_Lock(ts_time_lock);
-    if (tnl == old_time) {
-        strcpy(buffer, old_tbuf);
-        blen = old_blen;
-        PR_Unlock(ts_time_lock);
-    } else {
+    if ( NULL == ( lti = (LogThreadInfo *)PR_GetThreadPrivate( log_thread_index ))) {
+        lti = (LogThreadInfo *)slapi_ch_calloc( 1, sizeof(LogThreadInfo) );
+        PR_SetThreadPrivate( log_thread_index, lti );
+    }
+    if (tnl != lti->lti_time) {
     /* nope... painstakingly create the new strftime buffer */
         (void)localtime_r( &tnl, &tms );
         tmsp = &tms;
@@ -2258,15 +2318,26 @@ static int vslapd_log_access(char *fmt, va_list ap)
             tz = -tz;
         }
         (void)strftime( tbuf, (size_t)TBUFSIZE, "%d/%b/%Y:%H:%M:%S", tmsp);
-        sprintf( buffer, "[%s %c%02d%02d] ", tbuf, sign,
+        lti->lti_tlen = PR_snprintf( lti->lti_tbuf, sizeof(lti->lti_tbuf),
+                "[%s %c%02d%02d] ", tbuf, sign,
                 (int)( tz / 3600 ), (int)( tz % 3600));
-        old_time = tnl;
-        strcpy(old_tbuf, buffer);
-        blen = strlen(buffer);
-        old_blen = blen;
-        PR_Unlock(ts_time_lock);
+        lti->lti_time = tnl;
     }
 
+    return lti;
+}
+
+static int vslapd_log_access(char *fmt, va_list ap)
+{
+    LogThreadInfo *lti;
+    time_t	tnl;
+    char	vbuf[SLAPI_LOG_BUFSIZ];
+    int		blen, vlen;
+
+    tnl = current_time();
+    lti = log_get_thread_info(tnl);
+    blen = lti->lti_tlen;
+
     vlen = PR_vsnprintf(vbuf, SLAPI_LOG_BUFSIZ, fmt, ap);
     if (! vlen) {
         return -1;
@@ -2276,7 +2347,12 @@ static int vslapd_log_access(char *fmt, va_list ap)
         return -1;
     }
 
-    log_append_buffer2(tnl, loginfo.log_access_buffer, buffer, blen, vbuf, vlen);    
+    /* unbuffered logging goes straight to the file */
+    if (PR_AtomicAdd(&log_rings_enabled, 0) &&
+            log_ring_append(lti, tnl, LOG_RECORD_TEXT, lti->lti_tbuf, blen, vbuf, vlen) == 0) {
+        return( 0 );
+    }
+    log_append_buffer2(tnl, loginfo.log_access_buffer, lti->lti_tbuf, blen, vbuf, vlen);    
 
     return( 0 );
 }
@@ -2301,6 +2377,82 @@ slapi_log_access( int level,
 	return( rc );
 }
 
+/*
+ * Log the result of an operation as a LOG_BIN_OP record.
+ * Returns 0, or -1 if the access log is not binary: the caller must then
+ * log its RESULT line.
+ */
+int
+log_access_result( PRUint64 connid, int opid, int optype, PRUint32 tag,
+    int err, int nentries, unsigned int notes, PRUint64 etime,
+    int etime_precise, const char *base, const char *filter )
+{
+	PRUint64 bufspace[(sizeof(LogOpInfo) + 2 * LOG_BIN_MAX_STRLEN) / sizeof(PRUint64) + 1];
+	char *buf = (char *)bufspace;
+	LogOpInfo *lop = (LogOpInfo *)buf;
+	LogThreadInfo *lti;
+	time_t tnl;
+	size_t len;
+
+	if (!log_access_is_binary()) {
+		return -1;
+	}
+	if (!(loginfo.log_access_state & LOGGING_ENABLED)) {
+		return 0;
+	}
+	if (!( LDAP_DEBUG_STATS & loginfo.log_access_level ) ||
+			( loginfo.log_access_fdes == NULL ) || (loginfo.log_access_file == NULL) ) {
+		return 0;
+	}
+
+	memset(lop, 0, sizeof(LogOpInfo));
+	lop->lop_connid = connid;
+	lop->lop_etime = etime;
+	lop->lop_opid = opid;
+	lop->lop_optype = optype;
+	lop->lop_tag = tag;
+	lop->lop_err = err;
+	lop->lop_nentries = nentries;
+	lop->lop_notes = notes;
+	lop->lop_flags = etime_precise ? LOG_BIN_OP_ETIME_PRECISE : 0;
+	len = sizeof(LogOpInfo);
+	if (base) {
+		lop->lop_baselen = PR_MIN(strlen(base), LOG_BIN_MAX_STRLEN);
+		memcpy(buf + len, base, lop->lop_baselen);
+		len += lop->lop_baselen;
+	}
+	if (filter) {
+		lop->lop_filterlen = PR_MIN(strlen(filter), LOG_BIN_MAX_STRLEN);
+		memcpy(buf + len, filter, lop->lop_filterlen);
+		len += lop->lop_filterlen;
+	}
+
+	tnl = current_time();
+	if (PR_AtomicAdd(&log_rings_enabled, 0)) {
+		lti = log_get_thread_info(tnl);
+		if (log_ring_append(lti, tnl, LOG_RECORD_OP, buf, len, buf + len, 0) == 0) {
+			return 0;
+		}
+	}
+	log_append_op(tnl, loginfo.log_access_buffer, lop);
+
+	return 0;
+}
+
+/*
+ * Whether the operation results go to the access log as LOG_BIN_OP
+ * records.  The format of the access log is chosen when the first line
+ * is logged, and does not change until the server restarts.
+ */
+int
+log_access_is_binary()
+{
+	if (loginfo.log_access_binary < 0) {
+		return config_get_accesslogbinary() == LDAP_ON;
+	}
+	return loginfo.log_access_binary;
+}
+
 /******************************************************************************
 * access_log_openf
 *
@@ -4645,13 +4797,21 @@ static void log_append_buffer2(time_t tnl, LogBufferInfo *lbi, char *msg1, size_
 {
 	slapdFrontendConfig_t *slapdFrontendConfig = getFrontendConfig();
 	size_t size = size1 + size2;
+	size_t frame = 0;
 	char* insert_point = NULL;
 
 	/* While holding the lock, we determine if there is space in the buffer for our payload, 
 	   and if we need to flush.
 	 */
     PR_Lock(lbi->lock);
-    if ( ((lbi->current - lbi->top) + size > lbi->maxsize) ||
+	if (loginfo.log_access_binary < 0) {
+		log__access_init_format();
+	}
+	if (loginfo.log_access_binary) {
+		/* the line goes in a LOG_BIN_TEXT frame */
+		frame = LOG_BIN_HDR_LEN;
+	}
+    if ( ((lbi->current - lbi->top) + frame + size > lbi->maxsize) ||
 		(tnl >= loginfo.log_access_rotationsyncclock &&
 		loginfo.log_access_rotationsync_enabled) ) {
 		
@@ -4660,12 +4820,15 @@ static void log_append_buffer2(time_t tnl, LogBufferInfo *lbi, char *msg1, size_
 		
     }
 	insert_point = lbi->current;
-	lbi->current += size;
+	lbi->current += frame + size;
 	/* Increment the copy refcount */
 	PR_AtomicIncrement(&(lbi->refcount));
 	PR_Unlock(lbi->lock);
 
 	/* Now we can copy without holding the lock */
+	if (frame) {
+		insert_point = log_bin_put_header(insert_point, LOG_BIN_TEXT, size);
+	}
     memcpy(insert_point, msg1, size1);
     memcpy(insert_point + size1, msg2, size2);
 	
@@ -4681,6 +4844,271 @@ static void log_append_buffer2(time_t tnl, LogBufferInfo *lbi, char *msg1, size_
 
 }    
 
+/*
+** Binary access log
+*/
+
+static char *
+log_bin_put16(char *p, PRUint32 v)
+{
+	*p++ = v & 0xff;
+	*p++ = (v >> 8) & 0xff;
+	return p;
+}
+
+static char *
+log_bin_put32(char *p, PRUint32 v)
+{
+	p = log_bin_put16(p, v & 0xffff);
+	return log_bin_put16(p, v >> 16);
+}
+
+static char *
+log_bin_put64(char *p, PRUint64 v)
+{
+	p = log_bin_put32(p, (PRUint32)(v & 0xffffffff));
+	return log_bin_put32(p, (PRUint32)(v >> 32));
+}
+
+static char *
+log_bin_put_header(char *p, int type, size_t len)
+{
+	*p++ = type;
+	*p++ = 0;
+	return log_bin_put16(p, len);
+}
+
+/*
+ * The base and filter strings of the LOG_BIN_OP records are interned in
+ * an open addressing table: a string is written once in a LOG_BIN_STRING
+ * frame, and then referred to by its id.  The table is emptied, by moving
+ * to a new generation, whenever the access log buffer is flushed.  It is
+ * protected by the lock of the access log buffer.
+ */
+#define LOG_INTERN_SIZE		4096	/* power of two */
+#define LOG_INTERN_MAX		(LOG_INTERN_SIZE / 4 * 3)
+
+typedef struct log_intern_entry {
+	PRUint32	li_gen;
+	PRUint32	li_hash;
+	PRUint32	li_id;
+	PRUint32	li_len;
+	char		*li_str;
+} LogInternEntry;
+
+static LogInternEntry *log_intern = NULL;
+static PRUint32 log_intern_gen = 1;
+static PRUint32 log_intern_count = 0;
+static PRUint32 log_intern_nextid = 1;
+
+static void
+log_intern_reset(void)
+{
+	log_intern_gen++;
+	log_intern_count = 0;
+	log_intern_nextid = 1;
+}
+
+static PRUint32
+log_intern_hash(const char *str, size_t len)
+{
+	PRUint32 hash = 2166136261U;	/* FNV-1a */
+
+	while (len-- > 0) {
+		hash = (hash ^ (unsigned char)*str++) * 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Return the id of str, and set *isnew if it has to be defined before it
+ * is used.
+ */
+static PRUint32
+log_intern_id(const char *str, size_t len, int *isnew)
+{
+	PRUint32 hash = log_intern_hash(str, len);
+	PRUint32 i = hash & (LOG_INTERN_SIZE - 1);
+	LogInternEntry *ent;
+
+	if (NULL == log_intern) {
+		log_intern = (LogInternEntry *)slapi_ch_calloc(LOG_INTERN_SIZE, sizeof(LogInternEntry));
+	}
+	for (;; i = (i + 1) & (LOG_INTERN_SIZE - 1)) {
+		ent = &log_intern[i];
+		if (ent->li_gen != log_intern_gen) {
+			break;
+		}
+		if (ent->li_hash == hash && ent->li_len == len &&
+				0 == memcmp(ent->li_str, str, len)) {
+			*isnew = 0;
+			return ent->li_id;
+		}
+	}
+	*isnew = 1;
+	if (log_intern_count >= LOG_INTERN_MAX) {
+		/* table full: define it every time until the next flush */
+		return log_intern_nextid++;
+	}
+	slapi_ch_free((void **)&ent->li_str);
+	ent->li_str = (char *)slapi_ch_malloc(len ? len : 1);
+	memcpy(ent->li_str, str, len);
+	ent->li_gen = log_intern_gen;
+	ent->li_hash = hash;
+	ent->li_len = len;
+	ent->li_id = log_intern_nextid++;
+	log_intern_count++;
+
+	return ent->li_id;
+}
+
+static char *
+log_bin_put_string(char *p, PRUint32 id, const char *str, size_t len)
+{
+	p = log_bin_put_header(p, LOG_BIN_STRING, 4 + len);
+	p = log_bin_put32(p, id);
+	memcpy(p, str, len);
+	return p + len;
+}
+
+/*
+ * Format lop as the RESULT line that log_result would have logged; used
+ * when a record reaches an access log which is not binary.
+ */
+static void
+log_append_op_text(time_t tnl, LogBufferInfo *lbi, LogOpInfo *lop)
+{
+	LogThreadInfo *lti = log_get_thread_info(tnl);
+	char vbuf[SLAPI_LOG_BUFSIZ];
+	char etime[32];
+	char notes[64];
+	int vlen;
+
+	if (lop->lop_flags & LOG_BIN_OP_ETIME_PRECISE) {
+		PR_snprintf(etime, sizeof(etime), "%f", (PRFloat64)lop->lop_etime / 1000000);
+	} else {
+		PR_snprintf(etime, sizeof(etime), "%" NSPRIu64, lop->lop_etime / 1000000);
+	}
+	notes[0] = '\0';
+	if (lop->lop_notes) {
+		notes[0] = ' ';
+		notes2str(lop->lop_notes, notes + 1, sizeof(notes) - 1);
+	}
+	vlen = PR_snprintf(vbuf, sizeof(vbuf),
+			"conn=%" NSPRIu64 " op=%d RESULT err=%d tag=%u nentries=%d etime=%s%s\n",
+			lop->lop_connid, lop->lop_opid, lop->lop_err, lop->lop_tag,
+			lop->lop_nentries, etime, notes);
+	log_append_buffer2(tnl, lbi, lti->lti_tbuf, lti->lti_tlen, vbuf, vlen);
+}
+
+/*
+ * Append a LOG_BIN_OP record, and the LOG_BIN_STRING frames of its base
+ * and filter when they are not interned yet.  As log_append_buffer2, only
+ * the space is reserved under the lock.
+ */
+static void
+log_append_op(time_t tnl, LogBufferInfo *lbi, LogOpInfo *lop)
+{
+	slapdFrontendConfig_t *slapdFrontendConfig = getFrontendConfig();
+	const char *base = (const char *)(lop + 1);
+	const char *filter = base + lop->lop_baselen;
+	PRUint32 baseid = 0, filterid = 0;
+	int basenew = 0, filternew = 0;
+	size_t size;
+	char *p;
+
+	PR_Lock(lbi->lock);
+	if (loginfo.log_access_binary < 0) {
+		log__access_init_format();
+	}
+	if (!loginfo.log_access_binary) {
+		PR_Unlock(lbi->lock);
+		log_append_op_text(tnl, lbi, lop);
+		return;
+	}
+	/* flush first if the worst case does not fit: it empties the table */
+	size = LOG_BIN_HDR_LEN + LOG_BIN_OP_LEN +
+		2 * (LOG_BIN_HDR_LEN + 4) + lop->lop_baselen + lop->lop_filterlen;
+	if ( ((lbi->current - lbi->top) + size > lbi->maxsize) ||
+		(tnl >= loginfo.log_access_rotationsyncclock &&
+		loginfo.log_access_rotationsync_enabled) ) {
+		log_flush_buffer(lbi, SLAPD_ACCESS_LOG,
+				0 /* do not sync to disk right now */ );
+	}
+	size = LOG_BIN_HDR_LEN + LOG_BIN_OP_LEN;
+	if (lop->lop_optype == SLAPI_OPERATION_SEARCH) {
+		baseid = log_intern_id(base, lop->lop_baselen, &basenew);
+		filterid = log_intern_id(filter, lop->lop_filterlen, &filternew);
+		if (basenew) {
+			size += LOG_BIN_HDR_LEN + 4 + lop->lop_baselen;
+		}
+		if (filternew) {
+			size += LOG_BIN_HDR_LEN + 4 + lop->lop_filterlen;
+		}
+	}
+	p = lbi->current;
+	lbi->current += size;
+	PR_AtomicIncrement(&(lbi->refcount));
+	PR_Unlock(lbi->lock);
+
+	if (basenew) {
+		p = log_bin_put_string(p, baseid, base, lop->lop_baselen);
+	}
+	if (filternew) {
+		p = log_bin_put_string(p, filterid, filter, lop->lop_filterlen);
+	}
+	p = log_bin_put_header(p, LOG_BIN_OP, LOG_BIN_OP_LEN);
+	p = log_bin_put64(p, (PRUint64)tnl);
+	p = log_bin_put64(p, lop->lop_connid);
+	p = log_bin_put64(p, lop->lop_etime);
+	p = log_bin_put32(p, lop->lop_opid);
+	p = log_bin_put32(p, lop->lop_optype);
+	p = log_bin_put32(p, lop->lop_tag);
+	p = log_bin_put32(p, lop->lop_err);
+	p = log_bin_put32(p, lop->lop_nentries);
+	p = log_bin_put32(p, lop->lop_notes);
+	p = log_bin_put32(p, lop->lop_flags);
+	p = log_bin_put32(p, baseid);
+	p = log_bin_put32(p, filterid);
+
+	PR_AtomicDecrement(&(lbi->refcount));
+
+	if (!slapdFrontendConfig->accesslogbuffering) {
+		PR_Lock(lbi->lock);
+		log_flush_buffer(lbi, SLAPD_ACCESS_LOG, 1 /* sync to disk now */ );
+		PR_Unlock(lbi->lock);
+	}
+}
+
+/*
+ * Decide the format of the access log, when the first line is logged:
+ * a current file in the other format is rotated.  The lock of the access
+ * log buffer is held.
+ */
+static void
+log__access_init_format(void)
+{
+	char magic[LOG_BIN_MAGIC_LEN];
+	PRFileDesc *fd;
+	int binary = (config_get_accesslogbinary() == LDAP_ON);
+	int current = binary;
+
+	if (loginfo.log_access_fdes && loginfo.log_access_file &&
+			log__getfilesize(loginfo.log_access_fdes) > 0 &&
+			(fd = PR_Open(loginfo.log_access_file, PR_RDONLY, 0))) {
+		current = (PR_Read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+				0 == memcmp(magic, LOG_BIN_MAGIC, sizeof(magic)));
+		PR_Close(fd);
+	}
+	loginfo.log_access_binary = binary;
+	if (current != binary &&
+			log__open_accesslogfile(LOGFILE_NEW, 1) != LOG_SUCCESS) {
+		LDAPDebug(LDAP_DEBUG_ANY,
+				"LOGINFO: Unable to open access file:%s\n",
+				loginfo.log_access_file,0,0);
+	}
+}
+
 /* this function assumes the lock is already acquired */
 /* if sync_now is non-zero, data is flushed to physical storage */
 static void log_flush_buffer(LogBufferInfo *lbi, int type, int sync_now)
@@ -4704,6 +5132,7 @@ static void log_flush_buffer(LogBufferInfo *lbi, int type, int sync_now)
     				"LOGINFO: Unable to open access file:%s\n",
     				loginfo.log_access_file,0,0);
 			lbi->current = lbi->top; /* reset counter to prevent overwriting rest of lbi struct */
+			log_intern_reset();
     			return;
 			}
 			while (loginfo.log_access_rotationsyncclock <= loginfo.log_access_ctime) {
@@ -4712,7 +5141,11 @@ static void log_flush_buffer(LogBufferInfo *lbi, int type, int sync_now)
 		}
 
 		if (loginfo.log_access_state & LOGGING_NEED_TITLE) {
-			log_write_title(loginfo.log_access_fdes);
+			if (loginfo.log_access_binary > 0) {
+				log_write_binary_title(loginfo.log_access_fdes);
+			} else {
+				log_write_title(loginfo.log_access_fdes);
+			}
 			loginfo.log_access_state &= ~LOGGING_NEED_TITLE; 
 		}
 		if (!sync_now && slapdFrontendConfig->accesslogbuffering) {
@@ -4723,17 +5156,339 @@ static void log_flush_buffer(LogBufferInfo *lbi, int type, int sync_now)
 		}
 
         lbi->current = lbi->top;
+        /* the next records must not refer to strings of this buffer */
+        log_intern_reset();
     }
 }    
 
 void log_access_flush()
 {
+    PR_Lock(log_ring_lock);
+    log_access_drain();
+    PR_Unlock(log_ring_lock);
+
     LOG_ACCESS_LOCK_WRITE();
     log_flush_buffer(loginfo.log_access_buffer, SLAPD_ACCESS_LOG,
 				1 /* sync to disk now */ );
     LOG_ACCESS_UNLOCK_WRITE();
 }    
 
+/*
+** Per thread access log rings
+**
+** Taking the access log buffer lock for every line makes the worker
+** threads wait for each other.  Instead, while the access log writer
+** thread runs, each thread copies its lines to its own ring of records,
+** and the writer periodically drains all the rings into the access log
+** buffer.  Each record gets a number from a global sequence when it is
+** complete, and the writer merges the rings in that order.
+**
+** A number is taken before the record is published, so the writer only
+** takes the records up to the number below which all of them are
+** published, and leaves the others for the next drain.  The rings are
+** only used while the access log is buffered: switching the buffering
+** off drains them before the threads log directly again.
+*/
+
+static void
+log_thread_info_free(void *priv)
+{
+	LogThreadInfo *lti = (LogThreadInfo *)priv;
+
+	if (lti->lti_ring) {
+		/* the writer frees it once drained */
+		PR_AtomicSet(&lti->lti_ring->lr_orphaned, 1);
+	}
+	slapi_ch_free((void **)&lti);
+}
+
+/*
+ * Append a record to the ring of the calling thread, waiting for the
+ * writer if the ring is full.
+ * Returns 0, or -1 if the writer has stopped: the caller must then log
+ * the line itself, once the rings are drained.
+ */
+static int
+log_ring_append(LogThreadInfo *lti, time_t tnl, int type, char *msg1, size_t size1, char *msg2, size_t size2)
+{
+	LogRingInfo *ring = lti->lti_ring;
+	LogRecordInfo rec;
+	PRUint32 need, head, tail, off, pad, busy;
+
+	if (NULL == ring) {
+		ring = (LogRingInfo *)slapi_ch_calloc(1, sizeof(LogRingInfo));
+		ring->lr_buf = (char *)slapi_ch_malloc(LOG_RING_SIZE);
+		PR_Lock(log_ring_lock);
+		ring->lr_next = log_rings;
+		log_rings = ring;
+		PR_Unlock(log_ring_lock);
+		lti->lti_ring = ring;
+	}
+
+	/* records are contiguous: the end of the ring is padded if needed */
+	need = LOG_RECORD_SIZE(size1 + size2);
+	for (;;) {
+		head = (PRUint32)PR_AtomicAdd(&ring->lr_head, 0);
+		tail = (PRUint32)ring->lr_tail;
+		off = tail & (LOG_RING_SIZE - 1);
+		pad = (LOG_RING_SIZE - off < need) ? LOG_RING_SIZE - off : 0;
+		if ((tail - head) + pad + need <= LOG_RING_SIZE) {
+			break;
+		}
+		if (LOG_RINGS_OFF == PR_AtomicAdd(&log_rings_enabled, 0)) {
+			return -1;
+		}
+		PR_Lock(log_ring_lock);
+		PR_NotifyCondVar(log_writer_cvar);
+		PR_Unlock(log_ring_lock);
+		DS_Sleep(PR_MillisecondsToInterval(1));
+	}
+
+	/*
+	 * Our number will not be lower than this one: the writer leaves the
+	 * records numbered from it on until we have published ours.
+	 */
+	busy = (PRUint32)PR_AtomicAdd(&log_access_seq, 0) + 1;
+	PR_AtomicSet(&ring->lr_busy, (PRInt32)(busy ? busy : 1));
+	if (LOG_RINGS_ON != PR_AtomicAdd(&log_rings_enabled, 0)) {
+		PR_AtomicSet(&ring->lr_busy, 0);
+		while (LOG_RINGS_STOPPING == PR_AtomicAdd(&log_rings_enabled, 0)) {
+			DS_Sleep(PR_MillisecondsToInterval(1));
+		}
+		return -1;
+	}
+
+	if (pad) {
+		rec.rec_seq = 0;
+		rec.rec_type = 0;
+		rec.rec_len = pad - sizeof(rec);
+		rec.rec_time = 0;
+		memcpy(ring->lr_buf + off, &rec, sizeof(rec));
+		tail += pad;
+		off = 0;
+	}
+	memcpy(ring->lr_buf + off + sizeof(rec), msg1, size1);
+	memcpy(ring->lr_buf + off + sizeof(rec) + size1, msg2, size2);
+	rec.rec_type = type;
+	rec.rec_len = size1 + size2;
+	rec.rec_time = tnl;
+	do {
+		rec.rec_seq = (PRUint32)PR_AtomicIncrement(&log_access_seq);
+	} while (0 == rec.rec_seq);
+	memcpy(ring->lr_buf + off, &rec, sizeof(rec));
+	/* publish the record */
+	PR_AtomicSet(&ring->lr_tail, (PRInt32)(tail + need));
+	PR_AtomicSet(&ring->lr_busy, 0);
+
+	return 0;
+}
+
+/* skip the padding, if any, and return the next record or NULL */
+static LogRecordInfo *
+log_ring_next(LogRingInfo *ring, PRUint32 *pos, PRUint32 end)
+{
+	LogRecordInfo *rec;
+
+	while (*pos != end) {
+		rec = (LogRecordInfo *)(ring->lr_buf + (*pos & (LOG_RING_SIZE - 1)));
+		if (rec->rec_seq) {
+			return rec;
+		}
+		*pos += sizeof(LogRecordInfo) + rec->rec_len;
+	}
+	return NULL;
+}
+
+/*
+ * Move the records of all the rings to the access log buffer, in sequence
+ * order, up to the last number below which all the records are published.
+ * log_ring_lock must be held.
+ */
+static void
+log_access_drain(void)
+{
+	LogRingInfo *ring, **prev;
+	LogRecordInfo *rec, *best;
+	PRUint32 *pos, *end;
+	PRUint32 limit, busy;
+	int i, besti, nrings = 0;
+
+	for (ring = log_rings; ring; ring = ring->lr_next) {
+		nrings++;
+	}
+	if (0 == nrings) {
+		return;
+	}
+	pos = (PRUint32 *)slapi_ch_malloc(2 * nrings * sizeof(PRUint32));
+	end = pos + nrings;
+	/*
+	 * The numbers up to limit are taken.  A record which is not published
+	 * yet belongs to a busy ring, and its number is at least lr_busy.
+	 * The tails must be read after lr_busy.
+	 */
+	limit = (PRUint32)PR_AtomicAdd(&log_access_seq, 0);
+	for (ring = log_rings; ring; ring = ring->lr_next) {
+		busy = (PRUint32)PR_AtomicAdd(&ring->lr_busy, 0);
+		if (busy && (PRInt32)(busy - 1 - limit) < 0) {
+			limit = busy - 1;
+		}
+	}
+	for (i = 0, ring = log_rings; ring; i++, ring = ring->lr_next) {
+		pos[i] = (PRUint32)ring->lr_head;
+		end[i] = (PRUint32)PR_AtomicAdd(&ring->lr_tail, 0);
+	}
+
+	for (;;) {
+		best = NULL;
+		besti = 0;
+		for (i = 0, ring = log_rings; ring; i++, ring = ring->lr_next) {
+			rec = log_ring_next(ring, &pos[i], end[i]);
+			if (rec && (NULL == best ||
+					(PRInt32)(rec->rec_seq - best->rec_seq) < 0)) {
+				best = rec;
+				besti = i;
+			}
+		}
+		if (NULL == best || (PRInt32)(best->rec_seq - limit) > 0) {
+			/* the others wait for the next drain */
+			break;
+		}
+		if (LOG_RECORD_OP == best->rec_type) {
+			log_append_op((time_t)best->rec_time, loginfo.log_access_buffer,
+					(LogOpInfo *)(best + 1));
+		} else {
+			log_append_buffer2((time_t)best->rec_time, loginfo.log_access_buffer,
+					(char *)(best + 1), best->rec_len,
+					(char *)(best + 1) + best->rec_len, 0);
+		}
+		pos[besti] += LOG_RECORD_SIZE(best->rec_len);
+	}
+
+	/* give the space back, and free the rings of the exited threads */
+	i = 0;
+	prev = &log_rings;
+	while ((ring = *prev)) {
+		PR_AtomicSet(&ring->lr_head, (PRInt32)pos[i++]);
+		if (PR_AtomicAdd(&ring->lr_orphaned, 0) &&
+				PR_AtomicAdd(&ring->lr_tail, 0) == ring->lr_head) {
+			*prev = ring->lr_next;
+			slapi_ch_free((void **)&ring->lr_buf);
+			slapi_ch_free((void **)&ring);
+		} else {
+			prev = &ring->lr_next;
+		}
+	}
+	slapi_ch_free((void **)&pos);
+}
+
+static void
+log_access_writer(void *arg)
+{
+	PR_Lock(log_ring_lock);
+	while (LOG_RINGS_ON == PR_AtomicAdd(&log_rings_enabled, 0)) {
+		PR_WaitCondVar(log_writer_cvar,
+				PR_MillisecondsToInterval(LOG_RING_DRAIN_INTERVAL));
+		log_access_drain();
+	}
+	PR_Unlock(log_ring_lock);
+}
+
+static void
+log_access_writer_run(void)
+{
+	if (log_writer_tid) {
+		return;
+	}
+	PR_AtomicSet(&log_rings_enabled, LOG_RINGS_ON);
+	if ((log_writer_tid = PR_CreateThread(PR_USER_THREAD,
+			(VFP) log_access_writer, NULL,
+			PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD, PR_JOINABLE_THREAD,
+			SLAPD_DEFAULT_THREAD_STACKSIZE)) == NULL) {
+		PR_AtomicSet(&log_rings_enabled, LOG_RINGS_OFF);
+		slapi_log_error(SLAPI_LOG_FATAL, NULL,
+				"access log writer PR_CreateThread failed. "
+				SLAPI_COMPONENT_NAME_NSPR " error %d (%s)\n",
+				PR_GetError(), slapd_pr_strerror( PR_GetError() ));
+	}
+}
+
+/*
+ * Stop the writer and drain the rings until no thread is appending to
+ * them: the threads which log meanwhile wait, so that their lines come
+ * after the ones of the rings.
+ */
+static void
+log_access_writer_halt(void)
+{
+	LogRingInfo *ring;
+	int idle;
+
+	if (NULL == log_writer_tid) {
+		return;
+	}
+	PR_AtomicSet(&log_rings_enabled, LOG_RINGS_STOPPING);
+	PR_Lock(log_ring_lock);
+	PR_NotifyCondVar(log_writer_cvar);
+	PR_Unlock(log_ring_lock);
+	(void)PR_JoinThread(log_writer_tid);
+	log_writer_tid = NULL;
+
+	for (;;) {
+		PR_Lock(log_ring_lock);
+		log_access_drain();
+		idle = 1;
+		for (ring = log_rings; ring; ring = ring->lr_next) {
+			if (PR_AtomicAdd(&ring->lr_busy, 0) ||
+					PR_AtomicAdd(&ring->lr_tail, 0) != ring->lr_head) {
+				idle = 0;
+			}
+		}
+		PR_Unlock(log_ring_lock);
+		if (idle) {
+			break;
+		}
+		DS_Sleep(PR_MillisecondsToInterval(1));
+	}
+	PR_AtomicSet(&log_rings_enabled, LOG_RINGS_OFF);
+}
+
+/*
+ * Start the access log writer thread: from then on, the threads log to
+ * their rings while the access log is buffered.
+ */
+void log_access_writer_start()
+{
+	slapdFrontendConfig_t *slapdFrontendConfig = getFrontendConfig();
+
+	log_writer_wanted = 1;
+	if (slapdFrontendConfig->accesslogbuffering) {
+		log_access_writer_run();
+	}
+}
+
+void log_access_writer_stop()
+{
+	log_writer_wanted = 0;
+	log_access_writer_halt();
+}
+
+/*
+ * Called when nsslapd-accesslog-logbuffering changes: the lines of the
+ * rings are written before the threads log directly.
+ */
+void log_access_set_buffering(int on)
+{
+	if (!log_writer_wanted) {
+		return;
+	}
+	if (on) {
+		log_access_writer_run();
+	} else {
+		log_access_writer_halt();
+		log_access_flush();
+	}
+}
+
 /*
  *
  * log_convert_time
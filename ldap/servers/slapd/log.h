@@ -96,6 +96,86 @@ struct logbufinfo  {
 };
 typedef struct logbufinfo LogBufferInfo;
 
+/*
+ * Per thread access log ring: the owning thread appends records to it
+ * without any lock, and the access log writer thread drains it.
+ */
+#define LOG_RING_SIZE               64 * 1024   /* power of two */
+
+/* log_rings_enabled */
+#define LOG_RINGS_OFF               0
+#define LOG_RINGS_ON                1
+#define LOG_RINGS_STOPPING          2   /* draining before the threads
+                                           log directly again */
+
+struct logringinfo {
+    char    *lr_buf;                    /* LOG_RING_SIZE bytes of records */
+    PRInt32 lr_head;                    /* bytes consumed by the writer */
+    PRInt32 lr_tail;                    /* bytes produced by the owner */
+    PRInt32 lr_busy;                    /* lowest number the owner may be
+                                           giving to a record; 0 if idle */
+    PRInt32 lr_orphaned;                /* owner exited; freed once drained */
+    struct logringinfo *lr_next;
+};
+typedef struct logringinfo LogRingInfo;
+
+/* record header in a LogRingInfo; the text or LogOpInfo follows it */
+#define LOG_RECORD_TEXT             1
+#define LOG_RECORD_OP               2
+
+struct logrecordinfo {
+    PRUint32 rec_seq;                   /* global order; 0 for padding */
+    PRUint16 rec_type;                  /* LOG_RECORD_xxx */
+    PRUint16 rec_len;                   /* length of the payload */
+    PRInt64  rec_time;                  /* time the record was logged */
+};
+typedef struct logrecordinfo LogRecordInfo;
+
+/*
+ * Result of an operation, logged by log_access_result; the base and the
+ * filter follow it.
+ */
+struct logopinfo {
+    PRUint64 lop_connid;
+    PRUint64 lop_etime;                 /* microseconds */
+    PRInt32  lop_opid;
+    PRInt32  lop_optype;                /* SLAPI_OPERATION_xxx */
+    PRUint32 lop_tag;
+    PRInt32  lop_err;
+    PRInt32  lop_nentries;
+    PRUint32 lop_notes;                 /* SLAPI_OP_NOTE_xxx */
+    PRUint32 lop_flags;                 /* LOG_BIN_OP_xxx */
+    PRUint16 lop_baselen;
+    PRUint16 lop_filterlen;
+};
+typedef struct logopinfo LogOpInfo;
+
+/*
+ * Binary access log (nsslapd-accesslog-binary)
+ *
+ * The file starts with LOG_BIN_MAGIC and is then a sequence of frames: a
+ * LOG_BIN_HDR_LEN bytes header (type, 0, payload length on 16 bits) and
+ * the payload.  All the integers are little endian.
+ *  LOG_BIN_TEXT    the text of a classic access log line
+ *  LOG_BIN_STRING  32 bits id and the bytes of a base or filter string;
+ *                  an id may be defined again later in the file
+ *  LOG_BIN_OP      result of an operation: time, connid, etime (64 bits),
+ *                  opid, optype, tag, err, nentries, notes, flags, base id
+ *                  and filter id (32 bits, 0 for none)
+ * The strings are defined again after each flush of the access log buffer,
+ * so that a frame never refers to another log file.  The logdecode tool
+ * turns the file back into text or JSON lines.
+ */
+#define LOG_BIN_MAGIC               "\211DSALOG\n"
+#define LOG_BIN_MAGIC_LEN           8
+#define LOG_BIN_HDR_LEN             4
+#define LOG_BIN_TEXT                1
+#define LOG_BIN_STRING              2
+#define LOG_BIN_OP                  3
+#define LOG_BIN_OP_LEN              60
+#define LOG_BIN_OP_ETIME_PRECISE    0x1     /* etime is not whole seconds */
+#define LOG_BIN_MAX_STRLEN          4096    /* longer strings are truncated */
+
 struct logging_opts {
 	/* These are access log specific */
 	int		log_access_state;
@@ -123,6 +203,7 @@ struct logging_opts {
 	LogFileInfo	*log_access_logchain;	/* all the logs info */
 	char		*log_accessinfo_file;	/* access log rotation info file */
     LogBufferInfo *log_access_buffer;   /* buffer for access log */
+	int		log_access_binary;	/* binary file, -1 until known */
     
 	/* These are error log specific */
 	int		log_error_state;
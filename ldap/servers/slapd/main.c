@@ -1057,6 +1057,7 @@ main( int argc, char **argv)
 			return_value = 1;
 			goto cleanup;
 		}
+		log_access_writer_start();
 
 		eq_start();					/* must be done after plugins started */
 
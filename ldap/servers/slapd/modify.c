@@ -1051,7 +1051,11 @@ static void op_shared_modify (Slapi_PBlock *pb, int pw_change, char *old_pw)
 		set_db_default_result_handlers(pb);
 		if (be->be_modify != NULL)
 		{
-			if ((rc = (*be->be_modify)(pb)) == 0)
+			PRUint64 start = slapi_op_phase_begin(pb->pb_op);
+
+			rc = (*be->be_modify)(pb);
+			optiming_backend_end(pb->pb_op, be, start);
+			if (rc == 0)
 			{
 				/* acl is not used for internal operations */
 				/* don't update aci store for remote acis  */
@@ -624,7 +624,11 @@ op_shared_rename(Slapi_PBlock *pb, int passin_args)
 		set_db_default_result_handlers(pb);
 		if (be->be_modrdn != NULL)
 		{
-			if ((rc = (*be->be_modrdn)(pb)) == 0)
+			PRUint64 start = slapi_op_phase_begin(pb->pb_op);
+
+			rc = (*be->be_modrdn)(pb);
+			optiming_backend_end(pb->pb_op, be, start);
+			if (rc == 0)
 			{
 				Slapi_Entry	*pse;
 				Slapi_Entry	*ecopy;
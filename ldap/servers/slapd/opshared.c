@@ -232,6 +232,7 @@ op_shared_search (Slapi_PBlock *pb, int send_result)
   int             flag_referral = 0;
   int             flag_psearch = 0;
   int             err_code = LDAP_SUCCESS;
+  PRUint64        backend_start;
   LDAPControl     **ctrlp;
   struct berval   *ctl_value = NULL;
   int             iscritical = 0;
@@ -799,7 +800,9 @@ op_shared_search (Slapi_PBlock *pb, int send_result)
       slapi_pblock_set(pb, SLAPI_SEARCH_RESULT_SET, NULL);
       
       /* ONREPL - we need to be able to tell the backend not to send results directly */
+      backend_start = slapi_op_phase_begin(operation);
       rc = (*be->be_search)(pb);
+      optiming_backend_end(operation, be, backend_start);
       switch (rc)
       {
       case 1:
@@ -1290,9 +1293,12 @@ iterate(Slapi_PBlock *pb, Slapi_Backend *be, int send_result,
     {
         Slapi_Entry *gerentry = NULL;
         Slapi_Operation *operation;
+        PRUint64 backend_start;
 
         slapi_pblock_get (pb, SLAPI_OPERATION, &operation);
+        backend_start = slapi_op_phase_begin(operation);
         rc = be->be_next_search_entry(pb);
+        optiming_backend_end(operation, be, backend_start);
         if (rc < 0) 
         {
             /*
@@ -0,0 +1,558 @@
+/** BEGIN COPYRIGHT BLOCK
+ * Copyright (C) 2015 Red Hat, Inc.
+ * All rights reserved.
+ *
+ * License: GPL (version 3 or any later version).
+ * See LICENSE for details.
+ * END COPYRIGHT BLOCK **/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+/* optiming.c - latency histograms of the operations and of their phases */
+
+/*
+ * The latencies are recorded in microseconds into log-linear histograms:
+ * each power of two is split in OPTIMING_SUB_BUCKETS buckets, so that a
+ * value is known within 1/OPTIMING_SUB_BUCKETS of itself whatever its
+ * magnitude, as HdrHistogram does.
+ *
+ * An operation carries the start of its queue wait and of its processing,
+ * and the time spent so far in each phase (see SLAPI_OP_PHASE_*).  The
+ * phases are timed by slapi_op_phase_begin()/slapi_op_phase_end(); the
+ * parse phase is the time from the start of the processing to the first
+ * other phase.  Phases may nest: the access control done while testing the
+ * filter counts both as acl and as filter time.
+ *
+ * When the operation completes, its total latency, its phases and its
+ * backend time go to histograms owned by the worker thread, so recording
+ * never writes to a shared cache line.  Plugin calls are recorded the same
+ * way.  The readers (cn=latency,cn=monitor and the snmp collator) sum the
+ * histograms of all the threads.
+ */
+
+#include <time.h>
+#include "slap.h"
+#include "agtmmap.h"
+
+#define OPTIMING_SUB_BITS		3
+#define OPTIMING_SUB_BUCKETS	(1 << OPTIMING_SUB_BITS)
+#define OPTIMING_MAX_EXP		36	/* 2^36 usec, about 19 hours */
+#define OPTIMING_BUCKETS		((OPTIMING_MAX_EXP - OPTIMING_SUB_BITS + 2) * OPTIMING_SUB_BUCKETS)
+
+/* histogram ids: the operation types, the phases, then backends and plugins */
+#define OPTIMING_OP_BIND		0
+#define OPTIMING_OP_UNBIND		1
+#define OPTIMING_OP_SEARCH		2
+#define OPTIMING_OP_MODIFY		3
+#define OPTIMING_OP_ADD			4
+#define OPTIMING_OP_DELETE		5
+#define OPTIMING_OP_MODRDN		6
+#define OPTIMING_OP_COMPARE		7
+#define OPTIMING_OP_ABANDON		8
+#define OPTIMING_OP_EXTENDED	9
+#define OPTIMING_OP_MAX			10
+#define OPTIMING_PHASE_BASE		OPTIMING_OP_MAX
+#define OPTIMING_OBJECT_BASE	(OPTIMING_PHASE_BASE + SLAPI_OP_PHASE_MAX)
+#define OPTIMING_MAX_HISTS		512
+
+#define OPTIMING_KIND_OP		0
+#define OPTIMING_KIND_PHASE		1
+#define OPTIMING_KIND_BACKEND	2
+#define OPTIMING_KIND_PLUGIN	3
+
+/* o_phase_flags: a bit per phase the operation went through, and this one */
+#define OPTIMING_PARSED			(1 << SLAPI_OP_PHASE_MAX)
+
+typedef struct op_histogram {
+	PRUint64	oh_count;
+	PRUint64	oh_sum;
+	PRUint64	oh_max;
+	PRUint32	oh_buckets[OPTIMING_BUCKETS];
+} op_histogram;
+
+typedef struct optiming_thread {
+	struct optiming_thread	*ot_next;
+	op_histogram			*ot_hists[OPTIMING_MAX_HISTS];
+} optiming_thread;
+
+typedef struct optiming_name {
+	int		on_kind;
+	char	*on_name;
+} optiming_name;
+
+static const char *optiming_op_names[OPTIMING_OP_MAX] = {
+	"bind", "unbind", "search", "modify", "add", "delete", "modrdn",
+	"compare", "abandon", "extended"
+};
+
+static const char *optiming_phase_names[SLAPI_OP_PHASE_MAX] = {
+	"queue", "parse", "preop", "backend", "candidates", "filter",
+	"fetch", "acl", "encode", "send"
+};
+
+static optiming_name optiming_names[OPTIMING_MAX_HISTS];
+static int optiming_nnames = OPTIMING_OBJECT_BASE;
+static optiming_thread *optiming_threads = NULL;
+/* histograms of the threads which exited */
+static optiming_thread optiming_retired;
+/* protects optiming_names, optiming_threads and optiming_retired */
+static PRLock *optiming_lock = NULL;
+static PRUintn optiming_thread_index;
+static PRCallOnceType optiming_init_callonce;
+
+static void optiming_thread_release( void *priv );
+
+static PRStatus
+optiming_init( void )
+{
+	int i;
+
+	optiming_lock = PR_NewLock();
+	for ( i = 0; i < OPTIMING_OP_MAX; i++ ) {
+		optiming_names[i].on_kind = OPTIMING_KIND_OP;
+		optiming_names[i].on_name = (char *)optiming_op_names[i];
+	}
+	for ( i = 0; i < SLAPI_OP_PHASE_MAX; i++ ) {
+		optiming_names[OPTIMING_PHASE_BASE + i].on_kind = OPTIMING_KIND_PHASE;
+		optiming_names[OPTIMING_PHASE_BASE + i].on_name = (char *)optiming_phase_names[i];
+	}
+	return PR_NewThreadPrivateIndex( &optiming_thread_index, optiming_thread_release );
+}
+
+static int
+optiming_enabled( void )
+{
+	return ( PR_SUCCESS == PR_CallOnce( &optiming_init_callonce, optiming_init ) &&
+			config_get_latency_stats() );
+}
+
+/* monotonic clock, in microseconds */
+static PRUint64
+optiming_now( void )
+{
+#if defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (PRUint64)ts.tv_sec * PR_USEC_PER_SEC + ts.tv_nsec / (PR_NSEC_PER_SEC / PR_USEC_PER_SEC);
+#else
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return (PRUint64)tv.tv_sec * PR_USEC_PER_SEC + tv.tv_usec;
+#endif
+}
+
+static int
+optiming_bucket( PRUint64 value )
+{
+	int exp;
+
+	if ( value < OPTIMING_SUB_BUCKETS ) {
+		return (int)value;
+	}
+	for ( exp = OPTIMING_SUB_BITS; exp < OPTIMING_MAX_EXP && (value >> (exp + 1)); exp++ )
+		;
+	if ( exp == OPTIMING_MAX_EXP && (value >> (exp + 1)) ) {
+		return OPTIMING_BUCKETS - 1;
+	}
+	return (exp - OPTIMING_SUB_BITS + 1) * OPTIMING_SUB_BUCKETS +
+			(int)((value >> (exp - OPTIMING_SUB_BITS)) & (OPTIMING_SUB_BUCKETS - 1));
+}
+
+/* highest value falling in the bucket */
+static PRUint64
+optiming_bucket_value( int bucket )
+{
+	int exp;
+	PRUint64 sub;
+
+	if ( bucket < OPTIMING_SUB_BUCKETS ) {
+		return (PRUint64)bucket;
+	}
+	exp = bucket / OPTIMING_SUB_BUCKETS + OPTIMING_SUB_BITS - 1;
+	sub = bucket % OPTIMING_SUB_BUCKETS;
+	return ((OPTIMING_SUB_BUCKETS + sub + 1) << (exp - OPTIMING_SUB_BITS)) - 1;
+}
+
+static void
+optiming_hist_add( op_histogram *h, PRUint64 value )
+{
+	h->oh_count++;
+	h->oh_sum += value;
+	if ( value > h->oh_max ) {
+		h->oh_max = value;
+	}
+	h->oh_buckets[optiming_bucket( value )]++;
+}
+
+static void
+optiming_hist_merge( op_histogram *to, const op_histogram *from )
+{
+	int i;
+
+	to->oh_count += from->oh_count;
+	to->oh_sum += from->oh_sum;
+	if ( from->oh_max > to->oh_max ) {
+		to->oh_max = from->oh_max;
+	}
+	for ( i = 0; i < OPTIMING_BUCKETS; i++ ) {
+		to->oh_buckets[i] += from->oh_buckets[i];
+	}
+}
+
+/* value below which lie permille/1000 of the recorded values */
+static PRUint64
+optiming_hist_percentile( const op_histogram *h, int permille )
+{
+	PRUint64 rank, seen = 0;
+	int i;
+
+	if ( 0 == h->oh_count ) {
+		return 0;
+	}
+	rank = (h->oh_count * permille + 999) / 1000;
+	for ( i = 0; i < OPTIMING_BUCKETS; i++ ) {
+		seen += h->oh_buckets[i];
+		if ( seen >= rank ) {
+			PRUint64 value = optiming_bucket_value( i );
+			return value < h->oh_max ? value : h->oh_max;
+		}
+	}
+	return h->oh_max;
+}
+
+static void
+optiming_thread_release( void *priv )
+{
+	optiming_thread *ot = (optiming_thread *)priv;
+	optiming_thread **prev;
+	int i;
+
+	PR_Lock( optiming_lock );
+	for ( prev = &optiming_threads; *prev; prev = &(*prev)->ot_next ) {
+		if ( *prev == ot ) {
+			*prev = ot->ot_next;
+			break;
+		}
+	}
+	for ( i = 0; i < OPTIMING_MAX_HISTS; i++ ) {
+		if ( NULL == ot->ot_hists[i] ) {
+			continue;
+		}
+		if ( NULL == optiming_retired.ot_hists[i] ) {
+			optiming_retired.ot_hists[i] = ot->ot_hists[i];
+			continue;
+		}
+		optiming_hist_merge( optiming_retired.ot_hists[i], ot->ot_hists[i] );
+		slapi_ch_free( (void **)&ot->ot_hists[i] );
+	}
+	PR_Unlock( optiming_lock );
+	slapi_ch_free( (void **)&ot );
+}
+
+static op_histogram *
+optiming_get_hist( int id )
+{
+	optiming_thread *ot;
+
+	if ( id < 0 || id >= OPTIMING_MAX_HISTS ) {
+		return NULL;
+	}
+	if ( NULL == ( ot = (optiming_thread *)PR_GetThreadPrivate( optiming_thread_index ))) {
+		ot = (optiming_thread *)slapi_ch_calloc( 1, sizeof(optiming_thread) );
+		PR_Lock( optiming_lock );
+		ot->ot_next = optiming_threads;
+		optiming_threads = ot;
+		PR_Unlock( optiming_lock );
+		PR_SetThreadPrivate( optiming_thread_index, ot );
+	}
+	if ( NULL == ot->ot_hists[id] ) {
+		ot->ot_hists[id] = (op_histogram *)slapi_ch_calloc( 1, sizeof(op_histogram) );
+	}
+	return ot->ot_hists[id];
+}
+
+static void
+optiming_record( int id, PRUint64 value )
+{
+	op_histogram *h = optiming_get_hist( id );
+
+	if ( h ) {
+		optiming_hist_add( h, value );
+	}
+}
+
+/*
+ * Returns the histogram id of a backend or a plugin, registering it the
+ * first time, or -1 when the table is full.
+ */
+static int
+optiming_register( int kind, const char *name )
+{
+	int id;
+
+	if ( NULL == name ) {
+		return -1;
+	}
+	PR_Lock( optiming_lock );
+	for ( id = OPTIMING_OBJECT_BASE; id < optiming_nnames; id++ ) {
+		if ( optiming_names[id].on_kind == kind &&
+				0 == strcmp( optiming_names[id].on_name, name )) {
+			break;
+		}
+	}
+	if ( id == optiming_nnames ) {
+		if ( id < OPTIMING_MAX_HISTS ) {
+			optiming_names[id].on_kind = kind;
+			optiming_names[id].on_name = slapi_ch_strdup( name );
+			optiming_nnames++;
+		} else {
+			id = -1;
+		}
+	}
+	PR_Unlock( optiming_lock );
+
+	return id;
+}
+
+/* sum of the histogram id of all the threads; optiming_lock must be held */
+static void
+optiming_snapshot( int id, op_histogram *h )
+{
+	optiming_thread *ot;
+
+	memset( h, 0, sizeof(op_histogram) );
+	if ( optiming_retired.ot_hists[id] ) {
+		optiming_hist_merge( h, optiming_retired.ot_hists[id] );
+	}
+	for ( ot = optiming_threads; ot; ot = ot->ot_next ) {
+		if ( ot->ot_hists[id] ) {
+			optiming_hist_merge( h, ot->ot_hists[id] );
+		}
+	}
+}
+
+static int
+optiming_op_index( ber_tag_t tag )
+{
+	switch ( tag ) {
+	case LDAP_REQ_BIND:		return OPTIMING_OP_BIND;
+	case LDAP_REQ_UNBIND:	return OPTIMING_OP_UNBIND;
+	case LDAP_REQ_SEARCH:	return OPTIMING_OP_SEARCH;
+	case LDAP_REQ_MODIFY:	return OPTIMING_OP_MODIFY;
+	case LDAP_REQ_ADD:		return OPTIMING_OP_ADD;
+	case LDAP_REQ_DELETE:	return OPTIMING_OP_DELETE;
+	case LDAP_REQ_MODDN:	return OPTIMING_OP_MODRDN;
+	case LDAP_REQ_COMPARE:	return OPTIMING_OP_COMPARE;
+	case LDAP_REQ_ABANDON:	return OPTIMING_OP_ABANDON;
+	case LDAP_REQ_EXTENDED:	return OPTIMING_OP_EXTENDED;
+	}
+	return -1;
+}
+
+/*
+ * Start timing a phase of the operation.  Returns the time to pass to
+ * slapi_op_phase_end(), or 0 when the operation is not timed.
+ */
+PRUint64
+slapi_op_phase_begin( Slapi_Operation *op )
+{
+	PRUint64 now;
+
+	if ( NULL == op || 0 == op->o_start_usec ) {
+		return 0;
+	}
+	now = optiming_now();
+	if ( !(op->o_phase_flags & OPTIMING_PARSED) ) {
+		op->o_phase_usec[SLAPI_OP_PHASE_PARSE] = now - op->o_start_usec;
+		op->o_phase_flags |= OPTIMING_PARSED | (1 << SLAPI_OP_PHASE_PARSE);
+	}
+	return now;
+}
+
+void
+slapi_op_phase_end( Slapi_Operation *op, int phase, PRUint64 start )
+{
+	if ( 0 == start || phase < 0 || phase >= SLAPI_OP_PHASE_MAX ) {
+		return;
+	}
+	op->o_phase_usec[phase] += optiming_now() - start;
+	op->o_phase_flags |= (1 << phase);
+}
+
+/* called when an operation is put in the work queue */
+void
+optiming_op_queued( Operation *op )
+{
+	if ( optiming_enabled() ) {
+		op->o_queue_usec = optiming_now();
+	}
+}
+
+/* called when a worker thread starts processing the operation */
+void
+optiming_op_start( Operation *op )
+{
+	if ( !optiming_enabled() ) {
+		op->o_queue_usec = 0;
+		return;
+	}
+	op->o_start_usec = optiming_now();
+	if ( op->o_queue_usec && op->o_start_usec >= op->o_queue_usec ) {
+		op->o_phase_usec[SLAPI_OP_PHASE_QUEUE] = op->o_start_usec - op->o_queue_usec;
+		op->o_phase_flags |= (1 << SLAPI_OP_PHASE_QUEUE);
+	}
+}
+
+/* the backend part of the operation, done by be */
+void
+optiming_backend_end( Operation *op, Slapi_Backend *be, PRUint64 start )
+{
+	if ( 0 == start ) {
+		return;
+	}
+	slapi_op_phase_end( op, SLAPI_OP_PHASE_BACKEND, start );
+	if ( be && 0 == be->be_latency_id ) {
+		be->be_latency_id = optiming_register( OPTIMING_KIND_BACKEND, be->be_name );
+	}
+	op->o_be_latency_id = be ? be->be_latency_id : 0;
+}
+
+/*
+ * Returns the time to pass to optiming_plugin_end(), or 0 if the call is
+ * not timed.  Only the calls made on behalf of an operation are.
+ */
+PRUint64
+optiming_plugin_begin( struct slapdplugin *plugin, Slapi_PBlock *pb )
+{
+	if ( NULL == pb->pb_op || !optiming_enabled() ) {
+		return 0;
+	}
+	return optiming_now();
+}
+
+void
+optiming_plugin_end( struct slapdplugin *plugin, Slapi_PBlock *pb, PRUint64 start )
+{
+	PRUint64 elapsed;
+
+	if ( 0 == start ) {
+		return;
+	}
+	elapsed = optiming_now() - start;
+	if ( 0 == plugin->plg_latency_id ) {
+		plugin->plg_latency_id = optiming_register( OPTIMING_KIND_PLUGIN, plugin->plg_name );
+	}
+	optiming_record( plugin->plg_latency_id, elapsed );
+
+	if ( pb->pb_op->o_start_usec &&
+			( SLAPI_PLUGIN_PREOPERATION == plugin->plg_type ||
+			  SLAPI_PLUGIN_BEPREOPERATION == plugin->plg_type ||
+			  SLAPI_PLUGIN_BETXNPREOPERATION == plugin->plg_type )) {
+		pb->pb_op->o_phase_usec[SLAPI_OP_PHASE_PREOP] += elapsed;
+		pb->pb_op->o_phase_flags |= (1 << SLAPI_OP_PHASE_PREOP);
+	}
+}
+
+/* called when the worker thread is done with the operation */
+void
+optiming_op_done( Operation *op )
+{
+	int i;
+
+	if ( 0 == op->o_start_usec || ( i = optiming_op_index( op->o_tag )) < 0 ) {
+		return;
+	}
+	optiming_record( i, optiming_now() -
+			( op->o_queue_usec ? op->o_queue_usec : op->o_start_usec ));
+	for ( i = 0; i < SLAPI_OP_PHASE_MAX; i++ ) {
+		if ( op->o_phase_flags & (1 << i) ) {
+			optiming_record( OPTIMING_PHASE_BASE + i, op->o_phase_usec[i] );
+		}
+	}
+	if ( op->o_be_latency_id > 0 ) {
+		optiming_record( op->o_be_latency_id,
+				op->o_phase_usec[SLAPI_OP_PHASE_BACKEND] );
+	}
+	/* a persistent search goes on in another thread: record it only once */
+	op->o_start_usec = 0;
+}
+
+static void
+optiming_add_value( Slapi_Entry *e, const char *type, const char *name,
+		const op_histogram *h )
+{
+	char value[BUFSIZ];
+
+	PR_snprintf( value, sizeof(value),
+			"%s count=%" NSPRIu64 " mean=%" NSPRIu64 " p50=%" NSPRIu64
+			" p90=%" NSPRIu64 " p99=%" NSPRIu64 " p999=%" NSPRIu64 " max=%" NSPRIu64,
+			name, h->oh_count, h->oh_sum / h->oh_count,
+			optiming_hist_percentile( h, 500 ), optiming_hist_percentile( h, 900 ),
+			optiming_hist_percentile( h, 990 ), optiming_hist_percentile( h, 999 ),
+			h->oh_max );
+	slapi_entry_add_string( e, type, value );
+}
+
+/*
+ * cn=latency,cn=monitor: one value per operation type, phase, backend and
+ * plugin which recorded something, in microseconds.
+ */
+void
+optiming_as_entry( Slapi_Entry *e )
+{
+	static const char *types[] = {
+		"operationLatency", "phaseLatency", "backendLatency", "pluginLatency"
+	};
+	op_histogram *h;
+	int id;
+
+	if ( PR_SUCCESS != PR_CallOnce( &optiming_init_callonce, optiming_init )) {
+		return;
+	}
+	for ( id = 0; id < 4; id++ ) {
+		slapi_entry_attr_delete( e, types[id] );
+	}
+	h = (op_histogram *)slapi_ch_malloc( sizeof(op_histogram) );
+	PR_Lock( optiming_lock );
+	for ( id = 0; id < optiming_nnames; id++ ) {
+		optiming_snapshot( id, h );
+		if ( h->oh_count ) {
+			optiming_add_value( e, types[optiming_names[id].on_kind],
+					optiming_names[id].on_name, h );
+		}
+	}
+	PR_Unlock( optiming_lock );
+	slapi_ch_free( (void **)&h );
+}
+
+/* fills the latency part of the snmp stats file */
+void
+optiming_snmp_update( struct latency_stats_t *stats )
+{
+	op_histogram *h;
+	struct latency_row_t *row;
+	int id;
+
+	if ( PR_SUCCESS != PR_CallOnce( &optiming_init_callonce, optiming_init )) {
+		return;
+	}
+	h = (op_histogram *)slapi_ch_malloc( sizeof(op_histogram) );
+	PR_Lock( optiming_lock );
+	for ( id = 0; id < OPTIMING_OBJECT_BASE; id++ ) {
+		optiming_snapshot( id, h );
+		row = ( id < OPTIMING_OP_MAX ) ? &stats->ops[id] :
+				&stats->phases[id - OPTIMING_PHASE_BASE];
+		row->count = h->oh_count;
+		row->mean = h->oh_count ? h->oh_sum / h->oh_count : 0;
+		row->p50 = optiming_hist_percentile( h, 500 );
+		row->p90 = optiming_hist_percentile( h, 900 );
+		row->p99 = optiming_hist_percentile( h, 990 );
+		row->max = h->oh_max;
+	}
+	PR_Unlock( optiming_lock );
+	slapi_ch_free( (void **)&h );
+}
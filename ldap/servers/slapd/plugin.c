@@ -1958,6 +1958,7 @@ plugin_call_func (struct slapdplugin *list, int operation, Slapi_PBlock *pb, int
 	for (; list != NULL; list = list->plg_next)
 	{
 		IFP func = NULL;
+		PRUint64 start;
 	
 		slapi_pblock_set (pb, SLAPI_PLUGIN, list);
 		set_db_default_result_handlers (pb); /* JCM: What's this do? Is it needed here? */
@@ -1982,11 +1983,13 @@ plugin_call_func (struct slapdplugin *list, int operation, Slapi_PBlock *pb, int
 			 *  calling the START and CLOSE functions - prevents double starts and stops.
 			 */
 			slapi_plugin_op_started(list);
+			start = optiming_plugin_begin(list, pb);
 			if (((SLAPI_PLUGIN_START_FN == operation && !list->plg_started) || /* Starting it up for the first time */
 			     (SLAPI_PLUGIN_CLOSE_FN == operation && !list->plg_stopped) || /* Shutting down, plugin has been stopped */
 			     (SLAPI_PLUGIN_START_FN != operation && list->plg_started)) && /* Started, and not trying to start again */
 			    ( rc = func (pb)) != 0 )
 			{
+				optiming_plugin_end(list, pb, start);
 				slapi_plugin_op_finished(list);
 				if (SLAPI_PLUGIN_PREOPERATION == list->plg_type ||
 				    SLAPI_PLUGIN_INTERNAL_PREOPERATION == list->plg_type ||
@@ -2023,6 +2026,7 @@ plugin_call_func (struct slapdplugin *list, int operation, Slapi_PBlock *pb, int
 					/* successfully stopped the plugin */
 					list->plg_stopped = 1;
 				}
+				optiming_plugin_end(list, pb, start);
 				slapi_plugin_op_finished(list);
 			}
 			/* counters_to_errors_log("after plugin call"); */
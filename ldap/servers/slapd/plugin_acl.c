@@ -46,6 +46,7 @@ plugin_call_acl_plugin ( Slapi_PBlock *pb, Slapi_Entry *e, char **attrs,
 	int			rc = LDAP_INSUFFICIENT_ACCESS;
 	int			aclplugin_initialized = 0;
 	Operation	*operation;
+	PRUint64	start;
 
 	slapi_pblock_get (pb, SLAPI_OPERATION, &operation);
 
@@ -53,6 +54,7 @@ plugin_call_acl_plugin ( Slapi_PBlock *pb, Slapi_Entry *e, char **attrs,
 	if (operation_is_flag_set(operation, SLAPI_OP_FLAG_NO_ACCESS_CHECK|OP_FLAG_INTERNAL|OP_FLAG_REPLICATED|OP_FLAG_LEGACY_REPLICATION_DN))
 		return LDAP_SUCCESS;
 	
+	start = slapi_op_phase_begin(operation);
 	/* call the global plugins first and then the backend specific */
 	for ( p = get_plugin_list(PLUGIN_LIST_ACL); p != NULL; p = p->plg_next ) {
 		if (plugin_invoke_plugin_sdn (p, SLAPI_PLUGIN_ACL_ALLOW_ACCESS, pb, 
@@ -66,6 +68,7 @@ plugin_call_acl_plugin ( Slapi_PBlock *pb, Slapi_Entry *e, char **attrs,
 	if (! aclplugin_initialized ) {
 		rc = acl_default_access ( pb, e, access);
 	}
+	slapi_op_phase_end(operation, SLAPI_OP_PHASE_ACL, start);
 	return rc;
 }
 
@@ -77,6 +80,7 @@ plugin_call_acl_mods_access ( Slapi_PBlock *pb, Slapi_Entry *e, LDAPMod **mods,
 	int			aclplugin_initialized = 0;
 	int			rc = LDAP_INSUFFICIENT_ACCESS;
 	Operation	*operation;
+	PRUint64	start;
 
 	slapi_pblock_get (pb, SLAPI_OPERATION, &operation);
 
@@ -84,6 +88,7 @@ plugin_call_acl_mods_access ( Slapi_PBlock *pb, Slapi_Entry *e, LDAPMod **mods,
 	if (operation_is_flag_set(operation, SLAPI_OP_FLAG_NO_ACCESS_CHECK|OP_FLAG_INTERNAL|OP_FLAG_REPLICATED|OP_FLAG_LEGACY_REPLICATION_DN))
 		return LDAP_SUCCESS;
 	
+	start = slapi_op_phase_begin(operation);
 	/* call the global plugins first and then the backend specific */
 	for ( p = get_plugin_list(PLUGIN_LIST_ACL); p != NULL; p = p->plg_next ) {
 		if (plugin_invoke_plugin_sdn (p, SLAPI_PLUGIN_ACL_MODS_ALLOWED, pb, 
@@ -96,6 +101,7 @@ plugin_call_acl_mods_access ( Slapi_PBlock *pb, Slapi_Entry *e, LDAPMod **mods,
 	if (! aclplugin_initialized ) {
 		rc = acl_default_access ( pb, e, SLAPI_ACL_WRITE);
 	}
+	slapi_op_phase_end(operation, SLAPI_OP_PHASE_ACL, start);
 	return rc;
 }
 
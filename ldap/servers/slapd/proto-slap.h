@@ -118,6 +118,7 @@ void attr_syntax_return( struct asyntaxinfo *asi );
 void attr_syntax_return_locking_optional( struct asyntaxinfo *asi, PRBool use_lock );
 void attr_syntax_delete_all(void);
 void attr_syntax_delete_all_for_schemareload(unsigned long flag);
+int attr_syntax_type_ids_stable(void);
 
 /*
  * value.c
@@ -364,6 +365,7 @@ int config_set_minssf(const char *attrname, char *value, char *errorbuf, int app
 int config_set_minssf_exclude_rootdse( const char *attrname, char *value, char *errorbuf, int apply );
 int config_set_validate_cert_switch(const char *attrname, char *value, char *errorbuf, int apply );
 int config_set_accesslogbuffering(const char *attrname, char *value, char *errorbuf, int apply);
+int config_set_accesslogbinary(const char *attrname, char *value, char *errorbuf, int apply);
 int config_set_csnlogging(const char *attrname, char *value, char *errorbuf, int apply);
 int config_set_force_sasl_external(const char *attrname, char *value, char *errorbuf, int apply );
 int config_set_entryusn_global( const char *attrname, char *value, char *errorbuf, int apply );
@@ -522,6 +524,7 @@ int config_get_localssf(void);
 int config_get_minssf(void);
 int config_get_minssf_exclude_rootdse(void);
 int config_get_validate_cert_switch(void);
+int config_get_accesslogbinary();
 int config_get_csnlogging();
 #ifdef MEMPOOL_EXPERIMENTAL
 int config_get_mempool_switch();
@@ -558,6 +561,8 @@ int config_get_unhashed_pw_switch();
 int config_get_sasl_maxbufsize();
 int config_get_enable_turbo_mode();
 int config_set_enable_turbo_mode(const char *attrname, char *value, char *errorbuf, int apply);
+int config_get_latency_stats(void);
+int config_set_latency_stats(const char *attrname, char *value, char *errorbuf, int apply);
 int config_get_connection_buffer();
 int config_set_connection_buffer(const char *attrname, char *value, char *errorbuf, int apply);
 int config_get_connection_nocanon();
@@ -662,6 +667,7 @@ void filter_normalize( struct slapi_filter *f );
  * filtercmp.c
  */
 void filter_compute_hash(struct slapi_filter *f);
+void filter_compute_typeid(struct slapi_filter *f);
 void set_hash_filters(int i);
 
 
@@ -680,6 +686,9 @@ int is_rootdse( const char *dn );
 int get_entry_object_type();
 int entry_computed_attr_init();
 void send_referrals_from_entry(Slapi_PBlock *pb, Slapi_Entry *referral);
+Slapi_Attr *entry_attr_find( const Slapi_Entry *e, const char *type );
+void entry_attrs_changed( Slapi_Entry *e );
+void entry_set_attrs_shared( Slapi_Entry *e );
 
 /*
  * dse.c
@@ -754,6 +763,13 @@ int slapi_log_access( int level, char *fmt, ... )
 int slapd_log_audit_proc(char *buffer, int buf_len);
 int slapd_log_auditfail_proc(char *buffer, int buf_len);
 void log_access_flush();
+void log_access_writer_start();
+void log_access_writer_stop();
+void log_access_set_buffering(int on);
+int log_access_result( PRUint64 connid, int opid, int optype, PRUint32 tag,
+    int err, int nentries, unsigned int notes, PRUint64 etime,
+    int etime_precise, const char *base, const char *filter );
+int log_access_is_binary();
 
 
 int access_log_openf( char *pathname, int locked);
@@ -968,6 +984,7 @@ void g_set_num_bytes_sent( Slapi_Counter *counter );
 PRUint64 g_get_num_bytes_sent();
 void g_set_default_referral( struct berval **ldap_url );
 struct berval	**g_get_default_referral();
+char *notes2str( unsigned int notes, char *buf, size_t buflen );
 void disconnect_server( Connection *conn, PRUint64 opconnid, int opid, PRErrorCode reason, PRInt32 error );
 int send_ldap_search_entry( Slapi_PBlock *pb, Slapi_Entry *e, LDAPControl **ectrls,
 	char **attrs, int attrsonly );
@@ -1005,6 +1022,9 @@ int read_schema_dse ( Slapi_PBlock *pb, Slapi_Entry *entryBefore, Slapi_Entry *e
 void oc_lock_read( void );
 void oc_lock_write( void );
 void oc_unlock( void );
+PLHashTable *oc_read_begin( void );
+void oc_read_end( PLHashTable *ht );
+void oc_check_plans_flush( void );
 /* Note: callers of g_get_global_oc_nolock() must hold a read or write lock */
 struct objclass* g_get_global_oc_nolock();
 /* Note: callers of g_set_global_oc_nolock() must hold a write lock */
@@ -1372,6 +1392,19 @@ void counters_to_errors_log(const char *text);
  */
 void snmp_as_entry(Slapi_Entry* e);
 
+/*
+ * optiming.c
+ */
+struct latency_stats_t;
+void optiming_op_queued(Operation *op);
+void optiming_op_start(Operation *op);
+void optiming_op_done(Operation *op);
+void optiming_backend_end(Operation *op, Slapi_Backend *be, PRUint64 start);
+PRUint64 optiming_plugin_begin(struct slapdplugin *plugin, Slapi_PBlock *pb);
+void optiming_plugin_end(struct slapdplugin *plugin, Slapi_PBlock *pb, PRUint64 start);
+void optiming_as_entry(Slapi_Entry *e);
+void optiming_snmp_update(struct latency_stats_t *stats);
+
 /*
  * subentry.c
  */
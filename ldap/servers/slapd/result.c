@@ -37,7 +37,6 @@ static PRLock	*current_conn_count_mutex;
 
 static int flush_ber( Slapi_PBlock *pb, Connection *conn,
 					  Operation *op, BerElement *ber, int type );
-static char *notes2str( unsigned int notes, char *buf, size_t buflen );
 static void log_result( Slapi_PBlock *pb, Operation *op, int err,
 						ber_tag_t tag, int nentries );
 static void log_entry( Operation *op, Slapi_Entry *e );
@@ -343,6 +342,7 @@ send_ldap_result_ext(
 	ber_tag_t bind_method = 0;
 	int internal_op;
 	int i, rc, logit = 0;
+	PRUint64 encode_start;
 
 	slapi_pblock_get (pb, SLAPI_BIND_METHOD, &bind_method);
 	slapi_pblock_get (pb, SLAPI_OPERATION, &operation);
@@ -439,6 +439,7 @@ send_ldap_result_ext(
 		}
 	}
         
+	encode_start = slapi_op_phase_begin( operation );
 	if ( ber == NULL ) {
 	    if ( (ber = der_alloc()) == NULL ) {
 	        LDAPDebug( LDAP_DEBUG_ANY, "ber_alloc failed\n", 0, 0, 0 );
@@ -603,6 +604,8 @@ send_ldap_result_ext(
 		goto log_and_return;
 	}
 
+	slapi_op_phase_end( operation, SLAPI_OP_PHASE_ENCODE, encode_start );
+
 	if ( flush_ber_element ) {
 		/* write only one pdu at a time - wait til it's our turn */
 		if ( flush_ber( pb, conn, operation, ber, _LDAP_SEND_RESULT ) == 0 ) {
@@ -1132,6 +1135,7 @@ static int send_all_attrs(Slapi_Entry *e,char **attrs,Slapi_Operation *op,Slapi_
 	int vattr_flags = 0;
 	const char *dn = NULL;
 	char **default_attrs = NULL;
+	char **acl_attrs = NULL;
 
 	if(real_attrs_only == SLAPI_SEND_VATTR_FLAG_REALONLY)
 		vattr_flags = SLAPI_REALATTRS_ONLY;
@@ -1168,6 +1172,28 @@ static int send_all_attrs(Slapi_Entry *e,char **attrs,Slapi_Operation *op,Slapi_
 
 	rewrite_rfc1274 = config_get_rewrite_rfc1274();
 
+#if !defined(DISABLE_ACL_CHECK)
+	/*
+	 * Let the acl plugin evaluate read access on all the user attributes
+	 * of the entry at once; encode_attr_2 then only looks the results up.
+	 */
+	for (current_type = vattr_typethang_first(typelist); current_type; current_type = vattr_typethang_next(current_type) ) {
+		i++;
+	}
+	acl_attrs = (char **)slapi_ch_calloc(i + 1, sizeof(char *));
+	i = 0;
+	for (current_type = vattr_typethang_first(typelist); current_type; current_type = vattr_typethang_next(current_type) ) {
+		if (!(vattr_typethang_get_flags(current_type) & SLAPI_ATTR_FLAG_OPATTR)) {
+			acl_attrs[i++] = vattr_typethang_get_name(current_type);
+		}
+	}
+	/* a failure only means each attribute gets evaluated on its own */
+	(void)plugin_call_acl_plugin(pb, e, acl_attrs, NULL, SLAPI_ACL_READ,
+	                             ACLPLUGIN_ACCESS_READ_ON_ATTRS, NULL);
+	slapi_ch_free((void **)&acl_attrs);
+	i = 0;
+#endif
+
 	dn = slapi_entry_get_dn_const(e);
 	if (dn == NULL || *dn == '\0' ) {
 		default_attrs = slapi_entry_attr_get_charray(e, CONFIG_RETURN_DEFAULT_OPATTR);
@@ -1333,6 +1359,7 @@ send_specific_attrs(Slapi_Entry *e, char **attrs, Slapi_Operation *op,
 	vattr_context *ctx;
 	char **attrs_ext = NULL;
 	char **my_searchattrs = NULL;
+	char **acl_attrs = NULL;
 
 	if (real_attrs_only == SLAPI_SEND_VATTR_FLAG_REALONLY) {
 		vattr_flags = SLAPI_REALATTRS_ONLY;
@@ -1354,6 +1381,20 @@ send_specific_attrs(Slapi_Entry *e, char **attrs, Slapi_Operation *op,
 	if (attrs_ext) {
 		attrs = attrs_ext;
 	}
+
+#if !defined(DISABLE_ACL_CHECK)
+	/* Evaluate read access on the requested attribute types at once */
+	for (i = 0; attrs && attrs[i]; i++) {
+		if (strcmp(LDAP_ALL_USER_ATTRS, attrs[i]) && strcmp(LDAP_NO_ATTRS, attrs[i])) {
+			charray_add(&acl_attrs, attrs[i]);
+		}
+	}
+	if (acl_attrs) {
+		(void)plugin_call_acl_plugin(pb, e, acl_attrs, NULL, SLAPI_ACL_READ,
+		                             ACLPLUGIN_ACCESS_READ_ON_ATTRS, NULL);
+		slapi_ch_free((void **)&acl_attrs);
+	}
+#endif
 	
 	for ( i = 0; attrs && attrs[i] != NULL; i++ ) {
 		char *current_type_name = attrs[i];
@@ -1481,6 +1522,7 @@ send_ldap_search_entry_ext(
 	Slapi_Entry *gerentry = NULL;
 	Slapi_Entry *ecopy = NULL;
 	LDAPControl	**searchctrlp = NULL;
+	PRUint64	encode_start;
 	
 
 	slapi_pblock_get (pb, SLAPI_OPERATION, &operation);
@@ -1537,6 +1579,7 @@ send_ldap_search_entry_ext(
 		goto cleanup;
 	}
 
+	encode_start = slapi_op_phase_begin( op );
 	if ( (ber = der_alloc()) == NULL ) {
 		LDAPDebug( LDAP_DEBUG_ANY, "ber_alloc failed\n", 0, 0, 0 );
 		send_ldap_result( pb, LDAP_OPERATIONS_ERROR, NULL,
@@ -1668,6 +1711,7 @@ send_ldap_search_entry_ext(
 		    "ber_printf entry end", 0, NULL );
 		goto cleanup;
 	}
+	slapi_op_phase_end( op, SLAPI_OP_PHASE_ENCODE, encode_start );
 
 	if (send_result) {
 	    send_ldap_result_ext( pb, LDAP_SUCCESS, NULL, NULL, nentries, urls, ber);
@@ -1748,6 +1792,7 @@ flush_ber(
 {
 	ber_len_t	bytes;
 	int		rc = 0;
+	PRUint64	send_start;
 
 	switch ( type ) {
 	case _LDAP_SEND_RESULT:
@@ -1776,9 +1821,11 @@ flush_ber(
 	} else {
 		ber_get_option( ber, LBER_OPT_BYTES_TO_WRITE, &bytes );
 
+		send_start = slapi_op_phase_begin( op );
 		PR_Lock( conn->c_pdumutex );
 		rc = ber_flush( conn->c_sb, ber, 1 );
 		PR_Unlock( conn->c_pdumutex );
+		slapi_op_phase_end( op, SLAPI_OP_PHASE_SEND, send_start );
 
 		if ( rc != 0 ) {
 			int oserr = errno;
@@ -1880,7 +1927,7 @@ static struct slapi_note_map notemap[] = {
  *
  * Return value: buf itself.
  */
-static char *
+char *
 notes2str( unsigned int notes, char *buf, size_t buflen )
 {
 	char *p;
@@ -1931,17 +1978,49 @@ log_result( Slapi_PBlock *pb, Operation *op, int err, ber_tag_t tag, int nentrie
 	char csn_str[CSN_STRSIZE + 5];
 	char etime[ETIME_BUFSIZ];
 	int pr_idx = -1;
+	PRUint64 etime_usec;
+	int etime_precise;
 
 	slapi_pblock_get(pb, SLAPI_PAGED_RESULTS_INDEX, &pr_idx);
 
 	internal_op = operation_is_flag_set( op, OP_FLAG_INTERNAL );
 
-	if ( (config_get_accesslog_level() & LDAP_DEBUG_TIMING) &&
-			(op->o_interval != (PRIntervalTime) 0) ) {
+	etime_precise = (config_get_accesslog_level() & LDAP_DEBUG_TIMING) &&
+			(op->o_interval != (PRIntervalTime) 0);
+	if ( etime_precise ) {
 		PRIntervalTime delta = PR_IntervalNow() - op->o_interval;
-		PR_snprintf(etime, ETIME_BUFSIZ, "%f", (PRFloat64)delta/PR_TicksPerSecond());
+		etime_usec = PR_IntervalToMicroseconds(delta);
+	} else {
+		etime_usec = (PRUint64)(current_time() - op->o_time) * 1000000;
+	}
+
+	/*
+	 * In a binary access log, the plain results are LOG_BIN_OP records
+	 * carrying the base and filter of the searches.
+	 */
+	if ( !internal_op && pr_idx == -1 && op->o_tag != LDAP_REQ_BIND &&
+			(config_get_csnlogging() != LDAP_ON || NULL == operation_get_csn(op)) &&
+			log_access_is_binary() ) {
+		char *base_dn = NULL;
+		char *filter_str = NULL;
+		int optype = 0;
+
+		slapi_pblock_get( pb, SLAPI_OPERATION_TYPE, &optype );
+		if ( optype == SLAPI_OPERATION_SEARCH ) {
+			slapi_pblock_get( pb, SLAPI_TARGET_DN, &base_dn );
+			slapi_pblock_get( pb, SLAPI_SEARCH_STRFILTER, &filter_str );
+		}
+		if ( log_access_result( op->o_connid, op->o_opid, optype, tag, err,
+				nentries, pb->pb_operation_notes, etime_usec, etime_precise,
+				base_dn, filter_str ) == 0 ) {
+			return;
+		}
+	}
+
+	if ( etime_precise ) {
+		PR_snprintf(etime, ETIME_BUFSIZ, "%f", (PRFloat64)etime_usec / 1000000);
 	} else {
-		PR_snprintf(etime, ETIME_BUFSIZ, "%ld", current_time() - op->o_time);
+		PR_snprintf(etime, ETIME_BUFSIZ, "%" NSPRIu64, etime_usec / 1000000);
 	}
 
 	if ( 0 == pb->pb_operation_notes ) {
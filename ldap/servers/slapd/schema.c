@@ -125,6 +125,11 @@ static int oc_delete_nolock (char *ocname);
 static int oc_replace_nolock(const char *ocname, struct objclass *newoc); 
 static int oc_check_required(Slapi_PBlock *, Slapi_Entry *,struct objclass *);
 static int oc_check_allowed_sv(Slapi_PBlock *, Slapi_Entry *e, const char *type, struct objclass **oclist );
+typedef struct oc_check_plan oc_check_plan;
+static oc_check_plan *oc_check_plan_get( struct objclass **oclist, int oc_count, int *cached );
+static void oc_check_plan_free( oc_check_plan *plan );
+static int oc_check_plan_required( Slapi_PBlock *pb, Slapi_Entry *e, oc_check_plan *plan );
+static int oc_check_plan_allowed( Slapi_PBlock *pb, Slapi_Entry *e, const char *type, oc_check_plan *plan );
 static int schema_delete_objectclasses ( Slapi_Entry *entryBefore,
 		LDAPMod *mod, char *errorbuf, size_t errorbufsize,
 		int schema_ds4x_compat, int is_internal_operation);
@@ -158,6 +163,7 @@ static int schema_check_oc_attrs ( struct objclass *poc, char *errorbuf,
 		size_t errorbufsize, int stripOptions );
 static struct objclass *oc_find_nolock( const char *ocname_or_oid, struct objclass *oc_private, PRBool use_private );
 static struct objclass *oc_find_oid_nolock( const char *ocoid );
+static struct objclass *oc_find_in( PLHashTable *ocs, const char *ocname_or_oid );
 static void oc_free( struct objclass **ocp );
 static PRBool oc_equal( struct objclass *oc1, struct objclass *oc2 );
 static PRBool attr_syntax_equal( struct asyntaxinfo *asi1,
@@ -251,6 +257,32 @@ static void schema_load_repl_policy(const char *dn, repl_schema_policy_t *replic
 static int schema_ignore_trailing_spaces =
 			SLAPD_DEFAULT_SCHEMA_IGNORE_TRAILING_SPACES;
 
+/*
+ * Schema check plans: for a set of objectclasses, the attribute types they
+ * require and allow, so that checking an entry takes one look up per
+ * attribute instead of walking the MUST/MAY lists of each objectclass.
+ * The plans are cached by objectclass set in oc_check_plans, and
+ * oc_check_plans_flush() empties the cache whenever the objectclasses
+ * change (see oc_lock_write()).
+ */
+struct oc_check_plan {
+	struct objclass	**ocp_ocs;			/* the set, sorted */
+	int				ocp_nocs;
+	PLHashTable		*ocp_types;			/* base type -> OC_PLAN_ALLOWED, or */
+										/* index in ocp_required + 2 */
+	char			**ocp_required;
+	struct objclass	**ocp_required_by;
+	int				ocp_nrequired;
+	int				ocp_allow_all;		/* some objectclass allows "*" */
+};
+
+#define OC_CHECK_PLANS		256		/* must be a power of 2 */
+#define OC_PLAN_ALLOWED		((void *)1)
+#define OC_PLAN_SMALL		16		/* objectclasses/required types on the stack */
+
+static oc_check_plan *volatile oc_check_plans[ OC_CHECK_PLANS ];
+static PRInt32 oc_check_plans_installing = 0;
+
 /* R/W lock used to serialize access to the schema DSE */
 static Slapi_RWLock	*schema_dse_lock = NULL;
 
@@ -713,6 +745,9 @@ slapi_entry_schema_check_ext( Slapi_PBlock *pb, Slapi_Entry *e, int repl_check )
 {
   struct objclass **oclist;
   struct objclass *oc;
+  PLHashTable *ocs = NULL;
+  oc_check_plan *plan = NULL;
+  int plan_cached = 0;
   const char *ocname;
   Slapi_Attr	*a, *aoc;
   Slapi_Value *v;
@@ -738,7 +773,7 @@ slapi_entry_schema_check_ext( Slapi_PBlock *pb, Slapi_Entry *e, int repl_check )
   }
 
   /* find the object class attribute - could error out here */
-  if ( (aoc = attrlist_find( e->e_attrs, "objectclass" )) == NULL ) {
+  if ( (aoc = entry_attr_find( e, "objectclass" )) == NULL ) {
     LDAPDebug( LDAP_DEBUG_ANY,
 	       "Entry \"%s\" required attribute \"objectclass\" missing\n",
 	       slapi_entry_get_dn_const(e), 0, 0 );
@@ -764,10 +799,10 @@ slapi_entry_schema_check_ext( Slapi_PBlock *pb, Slapi_Entry *e, int repl_check )
     slapi_ch_malloc((oc_count+1)*sizeof(struct objclass*));
 
   /*
-   * Need the read lock to create the oc array and while we use it.
+   * Need to be in oc_read_begin() to create the oc array and while we use it.
    */
   if (!(schema_flags & DSE_SCHEMA_LOCKED))
-    oc_lock_read();
+    ocs = oc_read_begin();
 
   oc_count = 0;
   for (i= slapi_attr_first_value(aoc,&v); i != -1;
@@ -798,7 +833,7 @@ slapi_entry_schema_check_ext( Slapi_PBlock *pb, Slapi_Entry *e, int repl_check )
       continue;
     }
 
-    if ((oc = oc_find_nolock( ocname, NULL, PR_FALSE )) != NULL ) {
+    if ((oc = oc_find_in( ocs, ocname )) != NULL ) {
       oclist[oc_count++] = oc;
     } else {
       /* we don't know about the oc; return an appropriate error message */
@@ -842,14 +877,28 @@ slapi_entry_schema_check_ext( Slapi_PBlock *pb, Slapi_Entry *e, int repl_check )
    * this information to the client as an error message.
    */
 
+  /*
+   * The objectclasses do not change while we hold the write lock for the
+   * schema reload, so the plans could be stale then.
+   */
+  if (!(schema_flags & DSE_SCHEMA_LOCKED))
+    plan = oc_check_plan_get( oclist, oc_count, &plan_cached );
+
   /*
    * check that the entry has required attrs for each oc
    */
-  for (i = 0; oclist[i] != NULL; i++) {
-    if ( oc_check_required( pb, e, oclist[i] ) != 0 ) {				
+  if ( plan ) {
+    if ( oc_check_plan_required( pb, e, plan ) != 0 ) {
       ret = 1;
       goto out;
-    }			
+    }
+  } else {
+    for (i = 0; oclist[i] != NULL; i++) {
+      if ( oc_check_required( pb, e, oclist[i] ) != 0 ) {
+        ret = 1;
+        goto out;
+      }
+    }
   }
 
   /*
@@ -868,7 +917,8 @@ slapi_entry_schema_check_ext( Slapi_PBlock *pb, Slapi_Entry *e, int repl_check )
 	  {
 	    char *attrtype;
 	    slapi_attr_get_type(a, &attrtype);
-	    if (oc_check_allowed_sv(pb, e, attrtype, oclist) != 0)
+	    if ((plan ? oc_check_plan_allowed(pb, e, attrtype, plan) :
+	         oc_check_allowed_sv(pb, e, attrtype, oclist)) != 0)
 	      {
 		ret = 1;
 	      }
@@ -896,16 +946,19 @@ slapi_entry_schema_check_ext( Slapi_PBlock *pb, Slapi_Entry *e, int repl_check )
   }
 
  out:
+  if ( plan && !plan_cached )
+    oc_check_plan_free( plan );
   /* Done with the oc array so can release the lock */
   if (!(schema_flags & DSE_SCHEMA_LOCKED))
-    oc_unlock();
+    oc_read_end(ocs);
   slapi_ch_free((void**)&oclist);
 
   return( ret );
 }
 
 /*
- * The caller must obtain a read lock first by calling oc_lock_read().
+ * The caller must obtain a read lock first by calling oc_lock_read(), or be
+ * within oc_read_begin().
  */
 static int
 oc_check_required( Slapi_PBlock *pb, Slapi_Entry *e, struct objclass *oc )
@@ -953,7 +1006,8 @@ oc_check_required( Slapi_PBlock *pb, Slapi_Entry *e, struct objclass *oc )
 
 
 /*
- * The caller must obtain a read lock first by calling oc_lock_read().
+ * The caller must obtain a read lock first by calling oc_lock_read(), or be
+ * within oc_read_begin().
  */
 static int
 oc_check_allowed_sv(Slapi_PBlock *pb, Slapi_Entry *e, const char *type, struct objclass **oclist )
@@ -1022,6 +1076,296 @@ oc_check_allowed_sv(Slapi_PBlock *pb, Slapi_Entry *e, const char *type, struct o
 
 
 
+static int
+oc_check_plan_cmp( const void *v1, const void *v2 )
+{
+	uintptr_t	p1 = (uintptr_t)*(struct objclass **)v1;
+	uintptr_t	p2 = (uintptr_t)*(struct objclass **)v2;
+
+	return ( p1 < p2 ) ? -1 : ( p1 > p2 );
+}
+
+static void
+oc_check_plan_free( oc_check_plan *plan )
+{
+	if ( plan->ocp_types ) {
+		PL_HashTableDestroy( plan->ocp_types );
+	}
+	slapi_ch_free( (void **)&plan->ocp_ocs );
+	slapi_ch_free( (void **)&plan->ocp_required );
+	slapi_ch_free( (void **)&plan->ocp_required_by );
+	slapi_ch_free( (void **)&plan );
+}
+
+/*
+ * Build the plan of a sorted objectclass set.  Returns NULL if the MUST/MAY
+ * lists have types with options, which only oc_check_required() and
+ * oc_check_allowed_sv() handle.
+ */
+static oc_check_plan *
+oc_check_plan_build( struct objclass **ocs, int nocs )
+{
+	oc_check_plan	*plan;
+	int				i, j, n = 0;
+
+	plan = (oc_check_plan *)slapi_ch_calloc( 1, sizeof( oc_check_plan ));
+	plan->ocp_ocs = (struct objclass **)slapi_ch_malloc(
+			nocs * sizeof( struct objclass * ));
+	memcpy( plan->ocp_ocs, ocs, nocs * sizeof( struct objclass * ));
+	plan->ocp_nocs = nocs;
+	plan->ocp_types = PL_NewHashTable( 64, hashNocaseString, hashNocaseCompare,
+			PL_CompareValues, 0, 0 );
+	if ( NULL == plan->ocp_types ) {
+		goto fail;
+	}
+
+	for ( i = 0; i < nocs; i++ ) {
+		for ( j = 0; ocs[i]->oc_required && ocs[i]->oc_required[j]; j++ ) {
+			n++;
+		}
+	}
+	if ( n > 0 ) {
+		plan->ocp_required = (char **)slapi_ch_malloc( n * sizeof( char * ));
+		plan->ocp_required_by = (struct objclass **)slapi_ch_malloc(
+				n * sizeof( struct objclass * ));
+	}
+
+	for ( i = 0; i < nocs; i++ ) {
+		char	**required = ocs[i]->oc_required;
+
+		for ( j = 0; required && required[j]; j++ ) {
+			if ( strchr( required[j], ';' )) {
+				goto fail;
+			}
+			if ( NULL == PL_HashTableLookup_const( plan->ocp_types, required[j] )) {
+				plan->ocp_required[ plan->ocp_nrequired ] = required[j];
+				plan->ocp_required_by[ plan->ocp_nrequired ] = ocs[i];
+				PL_HashTableAdd( plan->ocp_types, required[j],
+						(void *)(uintptr_t)( plan->ocp_nrequired + 2 ));
+				plan->ocp_nrequired++;
+			}
+		}
+	}
+	for ( i = 0; i < nocs; i++ ) {
+		char	**allowed = ocs[i]->oc_allowed;
+
+		for ( j = 0; allowed && allowed[j]; j++ ) {
+			if ( strcmp( allowed[j], "*" ) == 0 ) {
+				plan->ocp_allow_all = 1;
+				continue;
+			}
+			if ( strchr( allowed[j], ';' )) {
+				goto fail;
+			}
+			if ( NULL == PL_HashTableLookup_const( plan->ocp_types, allowed[j] )) {
+				PL_HashTableAdd( plan->ocp_types, allowed[j], OC_PLAN_ALLOWED );
+			}
+		}
+	}
+
+	return plan;
+
+fail:
+	oc_check_plan_free( plan );
+	return NULL;
+}
+
+/*
+ * Get the plan of the objectclasses of an entry, from the cache if it is
+ * there.  *cached tells whether the plan is the cache's or must be freed
+ * by the caller.
+ * The caller must obtain a read lock first by calling oc_lock_read(), or be
+ * within oc_read_begin().
+ */
+static oc_check_plan *
+oc_check_plan_get( struct objclass **oclist, int oc_count, int *cached )
+{
+	struct objclass	*ocs_buf[ OC_PLAN_SMALL ];
+	struct objclass	**ocs = ocs_buf;
+	oc_check_plan	*plan = NULL;
+	PRUint32		hash = 0;
+	int				i, nocs = 0;
+
+	*cached = 0;
+	if ( oc_count == 0 ) {
+		return NULL;
+	}
+	if ( oc_count > OC_PLAN_SMALL ) {
+		ocs = (struct objclass **)slapi_ch_malloc(
+				oc_count * sizeof( struct objclass * ));
+	}
+
+	/* the key is the sorted set, an objectclass may be listed twice */
+	memcpy( ocs, oclist, oc_count * sizeof( struct objclass * ));
+	qsort( ocs, oc_count, sizeof( struct objclass * ), oc_check_plan_cmp );
+	for ( i = 0; i < oc_count; i++ ) {
+		if ( nocs == 0 || ocs[ nocs - 1 ] != ocs[i] ) {
+			ocs[ nocs++ ] = ocs[i];
+			hash = hash * 31 + (PRUint32)( (uintptr_t)ocs[i] >> 4 );
+		}
+	}
+	hash &= OC_CHECK_PLANS - 1;
+
+	plan = SLAPI_EPOCH_READ( oc_check_plans[ hash ] );
+	if ( plan && plan->ocp_nocs == nocs &&
+			memcmp( plan->ocp_ocs, ocs, nocs * sizeof( struct objclass * )) == 0 ) {
+		*cached = 1;
+		goto done;
+	}
+
+	if ( NULL != ( plan = oc_check_plan_build( ocs, nocs ))) {
+		/* keep the first plan of the slot, until the objectclasses change */
+		if ( NULL == oc_check_plans[ hash ] &&
+				0 == PR_AtomicSet( &oc_check_plans_installing, 1 )) {
+			if ( NULL == oc_check_plans[ hash ] ) {
+				SLAPI_EPOCH_PUBLISH( oc_check_plans[ hash ], plan );
+				*cached = 1;
+			}
+			PR_AtomicSet( &oc_check_plans_installing, 0 );
+		}
+	}
+
+done:
+	if ( ocs != ocs_buf ) {
+		slapi_ch_free( (void **)&ocs );
+	}
+	return plan;
+}
+
+/*
+ * Empty the plan cache.  The caller holds the write lock, and the readers
+ * of the objectclass index are gone.
+ */
+void
+oc_check_plans_flush( void )
+{
+	int		i;
+
+	for ( i = 0; i < OC_CHECK_PLANS; i++ ) {
+		if ( oc_check_plans[i] ) {
+			oc_check_plan_free( oc_check_plans[i] );
+			oc_check_plans[i] = NULL;
+		}
+	}
+}
+
+static void *
+oc_check_plan_lookup( oc_check_plan *plan, const char *type )
+{
+	char	buf[ SLAPD_TYPICAL_ATTRIBUTE_NAME_MAX_LENGTH ];
+	char	*tmp;
+	void	*v;
+
+	tmp = slapi_attr_basetype( type, buf, sizeof( buf ));
+	v = PL_HashTableLookup_const( plan->ocp_types, tmp ? tmp : buf );
+	slapi_ch_free_string( &tmp );
+
+	return v;
+}
+
+/*
+ * The same as oc_check_required() for all the objectclasses of the plan:
+ * the missing types of the first objectclass which misses some are logged.
+ */
+static int
+oc_check_plan_required( Slapi_PBlock *pb, Slapi_Entry *e, oc_check_plan *plan )
+{
+	char			seen_buf[ OC_PLAN_SMALL ];
+	char			*seen = seen_buf;
+	struct objclass	*failed_oc = NULL;
+	Slapi_Attr		*a;
+	void			*v;
+	int				i, rc = 0;
+
+	if ( plan->ocp_nrequired == 0 ) {
+		return 0;	/* success, as none required */
+	}
+	if ( plan->ocp_nrequired > OC_PLAN_SMALL ) {
+		seen = (char *)slapi_ch_calloc( plan->ocp_nrequired, 1 );
+	} else {
+		memset( seen, 0, sizeof( seen_buf ));
+	}
+
+	for ( a = e->e_attrs; a != NULL; a = a->a_next ) {
+		v = oc_check_plan_lookup( plan, a->a_type );
+		if ( v != NULL && v != OC_PLAN_ALLOWED ) {
+			seen[ (uintptr_t)v - 2 ] = 1;
+		}
+	}
+
+	/* the types required by an objectclass follow each other */
+	for ( i = 0; i < plan->ocp_nrequired; i++ ) {
+		struct objclass	*oc = plan->ocp_required_by[i];
+
+		if ( seen[i] ) {
+			continue;
+		}
+		if ( failed_oc && failed_oc != oc ) {
+			break;
+		}
+		failed_oc = oc;
+
+		/* not there => schema violation */
+		{
+			char errtext[ BUFSIZ ];
+			LDAPDebug( LDAP_DEBUG_ANY,
+					   "Entry \"%s\" missing attribute \"%s\" required"
+					   " by object class \"%s\"\n",
+					   slapi_entry_get_dn_const(e),
+					   plan->ocp_required[i], oc->oc_name);
+			if (pb) {
+				PR_snprintf( errtext, sizeof( errtext ),
+					   "missing attribute \"%s\" required"
+					   " by object class \"%s\"\n",
+					   plan->ocp_required[i], oc->oc_name );
+				slapi_pblock_set( pb, SLAPI_PB_RESULT_TEXT, errtext );
+			}
+		}
+		rc = 1; /* failure */
+	}
+
+	if ( seen != seen_buf ) {
+		slapi_ch_free( (void **)&seen );
+	}
+	return rc;
+}
+
+/*
+ * The same as oc_check_allowed_sv() for all the objectclasses of the plan.
+ */
+static int
+oc_check_plan_allowed( Slapi_PBlock *pb, Slapi_Entry *e, const char *type, oc_check_plan *plan )
+{
+	char errtext[ BUFSIZ ];
+	char ebuf[ BUFSIZ ];
+
+	/* always allow objectclass and entryid attributes */
+	if ( slapi_attr_type_cmp( type, "objectclass", SLAPI_TYPE_CMP_EXACT ) == 0 ) {
+		return( 0 );
+	} else if ( slapi_attr_type_cmp( type, "entryid", SLAPI_TYPE_CMP_EXACT ) == 0 ) {
+		return( 0 );
+	}
+
+	if ( plan->ocp_allow_all || oc_check_plan_lookup( plan, type ) != NULL ) {
+		return( 0 );
+	}
+
+	LDAPDebug( LDAP_DEBUG_ANY,
+		"Entry \"%s\" -- attribute \"%s\" not allowed\n",
+		slapi_entry_get_dn_const(e),
+		escape_string( type, ebuf ),
+		0);
+	if (pb) {
+		PR_snprintf( errtext, sizeof( errtext ),
+			"attribute \"%s\" not allowed\n",
+			escape_string( type, ebuf ) );
+		slapi_pblock_set( pb, SLAPI_PB_RESULT_TEXT, errtext );
+	}
+
+	return( 1 );
+}
+
+
 /*
  * oc_find_name() will return a strdup'd string or NULL if the objectclass
  * could not be found.
@@ -1030,18 +1374,50 @@ char *
 oc_find_name( const char *name_or_oid )
 {
 	struct objclass	*oc;
+	PLHashTable		*ocs;
 	char			*ocname = NULL;
 
-	oc_lock_read();
-	if ( NULL != ( oc = oc_find_nolock( name_or_oid, NULL, PR_FALSE ))) {
+	ocs = oc_read_begin();
+	if ( NULL != ( oc = oc_find_in( ocs, name_or_oid ))) {
 		ocname = slapi_ch_strdup( oc->oc_name );
 	}
-	oc_unlock();
+	oc_read_end( ocs );
 
 	return ocname;
 }
 
 
+/*
+ * oc_find_in returns the objectclass which has the same name OR oid, like
+ * oc_find_nolock, from the index returned by oc_read_begin() or from the
+ * global list if there is none.
+ */
+static struct objclass *
+oc_find_in( PLHashTable *ocs, const char *ocname_or_oid )
+{
+	char		buf[ 256 ];
+	const char	*p;
+	size_t		len;
+
+	if ( NULL == ocs || NULL == ocname_or_oid ) {
+		return oc_find_nolock( ocname_or_oid, NULL, PR_FALSE );
+	}
+	if ( schema_ignore_trailing_spaces &&
+			NULL != ( p = strchr( ocname_or_oid, ' ' ))) {
+		/* the index has the names without their trailing spaces */
+		len = p - ocname_or_oid;
+		if ( len >= sizeof( buf )) {
+			return NULL;	/* no objectclass has such a long name */
+		}
+		memcpy( buf, ocname_or_oid, len );
+		buf[ len ] = '\0';
+		ocname_or_oid = buf;
+	}
+
+	return (struct objclass *)PL_HashTableLookup_const( ocs, ocname_or_oid );
+}
+
+
 /*
  * oc_find_nolock will return a pointer to the objectclass which has the
  *		same name OR oid.
@@ -6160,6 +6536,7 @@ slapi_schema_list_objectclass_attributes(const char *ocname_or_oid,
                                          PRUint32 flags)
 {
 	struct objclass *oc = NULL;
+	PLHashTable *ocs = NULL;
 	char **attrs = NULL;
 	PRUint32 mask = SLAPI_OC_FLAG_REQUIRED | SLAPI_OC_FLAG_ALLOWED;
 
@@ -6167,8 +6544,8 @@ slapi_schema_list_objectclass_attributes(const char *ocname_or_oid,
 		return attrs;
 	}
 		
-	oc_lock_read();
-	oc = oc_find_nolock(ocname_or_oid, NULL, PR_FALSE);
+	ocs = oc_read_begin();
+	oc = oc_find_in(ocs, ocname_or_oid);
 	if (oc) {
 		switch (flags & mask) {
 		case SLAPI_OC_FLAG_REQUIRED:
@@ -6187,7 +6564,7 @@ slapi_schema_list_objectclass_attributes(const char *ocname_or_oid,
 			break;
 		}
 	}
-	oc_unlock();
+	oc_read_end(ocs);
 	return attrs;
 }
 
@@ -6201,14 +6578,15 @@ char *
 slapi_schema_get_superior_name(const char *ocname_or_oid)
 {
 	struct objclass *oc = NULL;
+	PLHashTable *ocs = NULL;
 	char *superior = NULL;
 
-	oc_lock_read();
-	oc = oc_find_nolock(ocname_or_oid, NULL, PR_FALSE);
+	ocs = oc_read_begin();
+	oc = oc_find_in(ocs, ocname_or_oid);
 	if (oc) {
 		superior = slapi_ch_strdup(oc->oc_superior);
 	}
-	oc_unlock();
+	oc_read_end(ocs);
 	return superior;
 }
 
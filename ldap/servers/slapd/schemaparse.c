@@ -26,6 +26,21 @@ static Slapi_RWLock	*oc_lock = NULL;
 
 static int      is_duplicate( char *target, char **list, int list_max );
 static void     normalize_list( char **list );
+static void     oc_snapshot_unpublish( void );
+
+/*
+ * Lock free read path: a read only index of global_oc by name and oid,
+ * published through oc_snapshot and read within an epoch section (see
+ * slapi_epoch.c).  oc_lock_write() unpublishes it before anything changes,
+ * and the readers go back to the lock until one of them publishes a new
+ * index, so that loading the schema does not build it for every
+ * objectclass.
+ */
+static PLHashTable *volatile oc_snapshot = NULL;
+static PRInt32 oc_snapshot_misses = 0;
+static PRInt32 oc_snapshot_building = 0;
+/* number of locked reads before the index is published again */
+#define OC_SNAPSHOT_MISSES	64
 
 /*
  * The oc_init_lock_callonce structure is used by NSPR to ensure
@@ -64,6 +79,7 @@ oc_lock_write( void )
 	if ( NULL != oc_lock ||
 			PR_SUCCESS == PR_CallOnce( &oc_init_lock_callonce, oc_init_lock )) {
 		slapi_rwlock_wrlock( oc_lock );
+		oc_snapshot_unpublish();
 	}
 }
 
@@ -77,6 +93,94 @@ oc_unlock( void )
 }
 
 
+/*
+ * Build the index of global_oc.  Where an objectclass name is the oid of
+ * another one, the first in the list wins, as in oc_find_nolock().
+ * The caller must hold a read lock.
+ */
+static PLHashTable *
+oc_snapshot_build( void )
+{
+	PLHashTable		*ht;
+	struct objclass	*oc;
+
+	ht = PL_NewHashTable( 512, hashNocaseString, hashNocaseCompare,
+			PL_CompareValues, 0, 0 );
+	if ( NULL == ht ) {
+		return NULL;
+	}
+	for ( oc = global_oc; oc != NULL; oc = oc->oc_next ) {
+		if ( NULL == PL_HashTableLookup_const( ht, oc->oc_name )) {
+			PL_HashTableAdd( ht, oc->oc_name, oc );
+		}
+		if ( oc->oc_oid && NULL == PL_HashTableLookup_const( ht, oc->oc_oid )) {
+			PL_HashTableAdd( ht, oc->oc_oid, oc );
+		}
+	}
+
+	return ht;
+}
+
+/*
+ * Called with the write lock held, before the objectclasses change.
+ */
+static void
+oc_snapshot_unpublish( void )
+{
+	PLHashTable		*ht = oc_snapshot;
+
+	PR_AtomicSet( &oc_snapshot_misses, 0 );
+	if ( ht ) {
+		oc_snapshot = NULL;
+		slapi_epoch_synchronize();
+		PL_HashTableDestroy( ht );
+	}
+	/* the schema check plans refer to the objectclasses */
+	oc_check_plans_flush();
+}
+
+/*
+ * Start reading the objectclasses.  Returns the index to look them up in,
+ * or NULL after taking the read lock, in which case global_oc must be
+ * used.  Either way, oc_read_end() must be called with the returned value
+ * once done with the objectclasses.  The caller must not block in between.
+ */
+PLHashTable *
+oc_read_begin( void )
+{
+	PLHashTable		*ht;
+
+	if ( 0 == slapi_epoch_enter()) {
+		if ( NULL != ( ht = SLAPI_EPOCH_READ( oc_snapshot ))) {
+			return ht;
+		}
+		slapi_epoch_leave();
+	}
+
+	oc_lock_read();
+	if ( NULL == oc_snapshot &&
+			PR_AtomicIncrement( &oc_snapshot_misses ) >= OC_SNAPSHOT_MISSES &&
+			0 == PR_AtomicSet( &oc_snapshot_building, 1 )) {
+		/* no writer can get in while we hold the read lock */
+		if ( NULL == oc_snapshot ) {
+			SLAPI_EPOCH_PUBLISH( oc_snapshot, oc_snapshot_build());
+		}
+		PR_AtomicSet( &oc_snapshot_building, 0 );
+	}
+
+	return NULL;
+}
+
+void
+oc_read_end( PLHashTable *ht )
+{
+	if ( ht ) {
+		slapi_epoch_leave();
+	} else {
+		oc_unlock();
+	}
+}
+
 /*
  * Note: callers of g_get_global_oc_nolock() must hold a read or write lock
  */
@@ -310,6 +310,7 @@ struct slapi_filter {
 	unsigned long	f_choice;	/* values taken from ldap.h */
 	PRUint32	f_hash;		/* for quick comparisons */
 	void *assigned_decoder;
+	PRUint32	f_typeid;	/* interned id of the type, 0 if unknown */
 
 	union {
 		/* present */
@@ -431,6 +432,7 @@ struct slapi_attr {
 	struct slapdplugin	    *a_mr_eq_plugin; /* for the attribute EQUALITY matching rule, if any */
 	struct slapdplugin	    *a_mr_ord_plugin; /* for the attribute ORDERING matching rule, if any */
 	struct slapdplugin	    *a_mr_sub_plugin; /* for the attribute SUBSTRING matching rule, if any */
+	PRUint32				a_typeid;	/* interned id of the base type, 0 if unknown */
 };
 
 typedef struct oid_item {
@@ -462,11 +464,12 @@ typedef struct asyntaxinfo {
 	char				*asi_syntax_oid;	/* syntax oid */
 	unsigned long		asi_flags;			/* SLAPI_ATTR_FLAG_... */
 	int					asi_syntaxlength;	/* length associated w/syntax */
-	int					asi_refcnt;			/* outstanding references */
+	int					asi_refcnt;			/* outstanding references, and the tables' one */
 	PRBool				asi_marked_for_delete;	/* delete at next opportunity */
 	struct slapdplugin	*asi_mr_eq_plugin;	/* EQUALITY matching rule plugin */
 	struct slapdplugin	*asi_mr_sub_plugin;	/* SUBSTR matching rule plugin */
 	struct slapdplugin	*asi_mr_ord_plugin;	/* ORDERING matching rule plugin */
+	PRUint32			asi_typeid;			/* interned id, see attr_syntax_intern() */
 	struct asyntaxinfo	*asi_next;
 	struct asyntaxinfo	*asi_prev;
 } asyntaxinfo;
@@ -617,6 +620,7 @@ struct slapi_entry {
     void *e_extension;           /* A list of entry object extensions */
     unsigned char e_flags;
     Slapi_Attr *e_aux_attrs;     /* Attr list used for upgrade */
+    struct entry_attr_index *e_attr_index; /* see entry_attr_find() */
 };
 
 struct attrs_in_extension {
@@ -794,6 +798,7 @@ struct slapdplugin {
 	int					plg_removed;	/* mark plugin as removed/deleted */
 	PRUint64			plg_started;	/* plugin is started/running */
 	PRUint64			plg_stopped;	/* plugin has been fully shutdown */
+	int					plg_latency_id;	/* latency histogram, see optiming.c */
 	Slapi_Counter		*plg_op_counter;	/* operation counter, used for shutdown */
 
 /* NOTE: These LDIF2DB and DB2LDIF fn pointers are internal only for now.
@@ -1235,6 +1240,7 @@ typedef struct backend {
 	void        *vlvSearchList;
 	Slapi_Counter *be_usn_counter; /* USN counter; one counter per backend */
 	int	be_pagedsizelimit;    /* size limit for this backend for simple paged result searches */
+	int	be_latency_id;        /* latency histogram, see optiming.c */
 } backend;
 
 enum
@@ -1340,6 +1346,11 @@ typedef struct op {
 	struct slapi_operation_results o_results;
 	int o_pagedresults_sizelimit;
 	int o_reverse_search_state;
+	PRUint64 o_queue_usec;	/* monotonic time the op was queued, see optiming.c */
+	PRUint64 o_start_usec;	/* monotonic time a worker picked it up */
+	PRUint64 o_phase_usec[SLAPI_OP_PHASE_MAX];	/* time spent in each phase */
+	unsigned int o_phase_flags;
+	int o_be_latency_id;	/* latency histogram of the backend used */
 } Operation;
 
 /*
@@ -2047,6 +2058,7 @@ typedef struct _slapdEntryPoints {
 #define CONFIG_PW_ADMIN_DN_ATTRIBUTE "passwordAdminDN"
 #define CONFIG_PW_SEND_EXPIRING "passwordSendExpiringTime"
 #define CONFIG_ACCESSLOG_BUFFERING_ATTRIBUTE "nsslapd-accesslog-logbuffering"
+#define CONFIG_ACCESSLOG_BINARY_ATTRIBUTE "nsslapd-accesslog-binary"
 #define CONFIG_CSNLOGGING_ATTRIBUTE "nsslapd-csnlogging"
 #define CONFIG_RETURN_EXACT_CASE_ATTRIBUTE "nsslapd-return-exact-case"
 #define CONFIG_RESULT_TWEAK_ATTRIBUTE "nsslapd-result-tweak"
@@ -2100,6 +2112,7 @@ typedef struct _slapdEntryPoints {
 #define CONFIG_SASL_MAXBUFSIZE "nsslapd-sasl-max-buffer-size"
 #define CONFIG_SEARCH_RETURN_ORIGINAL_TYPE "nsslapd-search-return-original-type-switch"
 #define CONFIG_ENABLE_TURBO_MODE "nsslapd-enable-turbo-mode"
+#define CONFIG_LATENCY_STATS "nsslapd-latency-stats"
 #define CONFIG_CONNECTION_BUFFER "nsslapd-connection-buffer"
 #define CONFIG_CONNECTION_NOCANON "nsslapd-connection-nocanon"
 #define CONFIG_PLUGIN_LOGGING "nsslapd-plugin-logging"
@@ -2251,6 +2264,7 @@ typedef struct _slapdFrontendConfig {
   char *accesslog_exptimeunit;
   int	accessloglevel;
   slapi_onoff_t accesslogbuffering;
+  slapi_onoff_t accesslogbinary;
   slapi_onoff_t csnlogging;
 
    /* ERROR LOG */
@@ -2384,6 +2398,7 @@ typedef struct _slapdFrontendConfig {
   slapi_onoff_t ignore_vattrs;
   slapi_onoff_t unhashed_pw_switch;	/* switch to on/off/nolog unhashed pw */
   slapi_onoff_t enable_turbo_mode;
+  slapi_onoff_t latency_stats;	/* latency histograms, see optiming.c */
   slapi_int_t connection_buffer; /* values are CONNECTION_BUFFER_* below */
   slapi_onoff_t connection_nocanon; /* if "on" sets LDAP_OPT_X_SASL_NOCANON */
   slapi_onoff_t plugin_logging; /* log all internal plugin operations */
@@ -4147,6 +4147,33 @@ int slapi_attr_value_find( const Slapi_Attr *a, const struct berval *v );
  */
 int slapi_attr_type_cmp( const char *t1, const char *t2, int opt );
 
+/**
+ * Get the interned id of the base type of an attribute type.
+ *
+ * All the names, aliases and the OID of an attribute type defined in the
+ * schema share the same id, so that comparing two ids is the same as
+ * comparing the base types with slapi_attr_types_equivalent().
+ *
+ * \param type Name or OID of the attribute type.  Attribute options are
+ *        ignored.
+ * \return The id of the attribute type.
+ * \return \c 0 if the type is not defined in the schema.
+ * \warning An id only identifies the type for the life of the server
+ *          process; do not store it.
+ * \see slapi_attr_get_type_id()
+ */
+PRUint32 slapi_attr_type_id( const char *type );
+
+/**
+ * Get the interned id of the base type of an attribute.
+ *
+ * \param a Attribute whose type id you want.
+ * \return The id of the type of the attribute.
+ * \return \c 0 if the type is not defined in the schema.
+ * \see slapi_attr_type_id()
+ */
+PRUint32 slapi_attr_get_type_id( const Slapi_Attr *a );
+
 /* Mode of operation (opt) values for slapi_attr_type_cmp() */
 /**
  * Compare the types as-is.
@@ -7020,6 +7047,7 @@ typedef struct slapi_plugindesc {
 #define ACLPLUGIN_ACCESS_READ_ON_VLV		3
 #define ACLPLUGIN_ACCESS_MODRDN				4
 #define ACLPLUGIN_ACCESS_GET_EFFECTIVE_RIGHTS	5
+#define ACLPLUGIN_ACCESS_READ_ON_ATTRS		6	/* batch of READ_ON_ATTR */
 
 /* Authorization types */
 #define SLAPI_BE_MAXNESTLEVEL			742
@@ -41,6 +41,7 @@ extern "C" {
 #define SLAPI_FILTER_TOMBSTONE 2
 #define SLAPI_FILTER_RUV 4
 #define SLAPI_ENTRY_LDAPSUBENTRY 2
+#define SLAPI_ENTRY_ATTRS_SHARED 4	/* e_attrs is read only, see entry_set_attrs_shared() */
 #define SLAPI_FILTER_NORMALIZED_TYPE 8
 #define SLAPI_FILTER_NORMALIZED_VALUE 16
 
@@ -161,6 +162,7 @@ void csn_free(CSN **csn);
 void csn_set_replicaid(CSN *csn, ReplicaId rid);
 void csn_set_time(CSN *csn, time_t csntime);
 void csn_set_seqnum(CSN *csn, PRUint16 seqnum);
+void csn_set_subseqnum(CSN *csn, PRUint16 subseqnum);
 ReplicaId csn_get_replicaid(const CSN *csn);
 time_t csn_get_time(const CSN *csn);
 PRUint16 csn_get_seqnum(const CSN *csn);
@@ -497,6 +499,7 @@ int slapi_entry_vattrcache_findAndTest(const Slapi_Entry *e, const char *type,
 int slapi_vattrcache_iscacheable( const char * type );
 void slapi_vattrcache_cache_all();
 void slapi_vattrcache_cache_none();
+int slapi_vattr_is_registered(const char *type);
 
 int vattr_test_filter( Slapi_PBlock *pb, 
 						/* Entry we're interested in */ Slapi_Entry *e,
@@ -1291,6 +1294,36 @@ void schema_destroy_dse_lock();
 /* attrsyntax.c */
 int slapi_add_internal_attr_syntax( const char *name, const char *oid, const char *syntax, const char *mr_equality, unsigned long extraflags );
 
+/* slapi_epoch.c */
+int slapi_epoch_enter( void );
+void slapi_epoch_leave( void );
+void slapi_epoch_synchronize( void );
+/*
+ * Store a pointer read within epoch sections, once what it points to is
+ * fully written, and load it in such a section.
+ */
+#define SLAPI_EPOCH_PUBLISH(p, v)	__atomic_store_n( &(p), (v), __ATOMIC_RELEASE )
+#define SLAPI_EPOCH_READ(p)		__atomic_load_n( &(p), __ATOMIC_ACQUIRE )
+
+/* slapi_counter.c */
+Slapi_Counter *slapi_counter_new_sharded(void);
+
+/* optiming.c */
+/* the timed phases of an operation */
+#define SLAPI_OP_PHASE_QUEUE		0	/* waiting for a worker thread */
+#define SLAPI_OP_PHASE_PARSE		1	/* reading and decoding the request */
+#define SLAPI_OP_PHASE_PREOP		2	/* pre-operation plugins */
+#define SLAPI_OP_PHASE_BACKEND		3	/* in the backend, which includes: */
+#define SLAPI_OP_PHASE_CANDIDATES	4	/*   building the candidate list */
+#define SLAPI_OP_PHASE_FILTER		5	/*   testing the filter */
+#define SLAPI_OP_PHASE_FETCH		6	/*   fetching the entries */
+#define SLAPI_OP_PHASE_ACL			7	/* access control */
+#define SLAPI_OP_PHASE_ENCODE		8	/* encoding the entries and result */
+#define SLAPI_OP_PHASE_SEND			9	/* writing them to the client */
+#define SLAPI_OP_PHASE_MAX			10
+PRUint64 slapi_op_phase_begin( Slapi_Operation *op );
+void slapi_op_phase_end( Slapi_Operation *op, int phase, PRUint64 start );
+
 /* pw.c */
 void pw_exp_init ( void );
 int pw_copy_entry_ext(Slapi_Entry *src_e, Slapi_Entry *dest_e);
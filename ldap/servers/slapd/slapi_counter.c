@@ -11,6 +11,9 @@
 #endif
 
 #include "slap.h"
+#if defined(LINUX)
+#include <sched.h>
+#endif
 
 #ifdef SOLARIS
 PRUint64 _sparcv9_AtomicSet(PRUint64 *address, PRUint64 newval);
@@ -44,8 +47,62 @@ typedef struct slapi_counter {
 #ifndef ATOMIC_64BIT_OPERATIONS
     Slapi_Mutex *lock;
 #endif
+    struct counter_shard *shards; /* NULL unless sharded */
+    void *shards_mem; /* what was allocated for them */
 } slapi_counter;
 
+/*
+ * A sharded counter spreads its updates over one shard per CPU, each on
+ * its own cache line, so that the threads updating it do not make the
+ * line bounce between the cores.  Reading it sums the shards.
+ */
+#define COUNTER_MAX_SHARDS  64
+#define COUNTER_SHARD_SIZE  64  /* keep each shard on its own cache line */
+
+typedef struct counter_shard {
+    slapi_counter counter;
+    char pad[COUNTER_SHARD_SIZE - sizeof(slapi_counter) % COUNTER_SHARD_SIZE];
+} counter_shard;
+
+static int counter_nshards = 1; /* a power of two */
+static PRInt32 counter_nthreads = 0;
+static PRUintn counter_thread_index;
+static PRCallOnceType counter_init_callonce;
+
+static PRStatus
+counter_init(void)
+{
+    int ncpus = PR_GetNumberOfProcessors();
+
+    while (counter_nshards < ncpus && counter_nshards < COUNTER_MAX_SHARDS) {
+        counter_nshards *= 2;
+    }
+    return PR_NewThreadPrivateIndex(&counter_thread_index, NULL);
+}
+
+/*
+ * The shard of the calling thread: the one of the CPU it runs on, or when
+ * that is not known, one given to the thread the first time it asks.
+ */
+static slapi_counter *
+counter_get_shard(Slapi_Counter *counter)
+{
+    PRUword n;
+
+#if defined(LINUX)
+    int cpu = sched_getcpu();
+
+    if (cpu >= 0) {
+        return &(counter->shards[cpu & (counter_nshards - 1)].counter);
+    }
+#endif
+    if ((n = (PRUword)PR_GetThreadPrivate(counter_thread_index)) == 0) {
+        n = (PRUword)PR_AtomicIncrement(&counter_nthreads);
+        PR_SetThreadPrivate(counter_thread_index, (void *)n);
+    }
+    return &(counter->shards[n & (counter_nshards - 1)].counter);
+}
+
 /*
  * slapi_counter_new()
  *
@@ -64,6 +121,34 @@ Slapi_Counter *slapi_counter_new()
     return counter;
 }
 
+/*
+ * slapi_counter_new_sharded()
+ *
+ * Allocates and initializes a new sharded Slapi_Counter, for the
+ * counters updated by all the threads and seldom read.  Updating
+ * it does not return its value: use slapi_counter_get_value().
+ */
+Slapi_Counter *slapi_counter_new_sharded()
+{
+    Slapi_Counter *counter = NULL;
+    int i;
+
+    if (PR_SUCCESS != PR_CallOnce(&counter_init_callonce, counter_init)) {
+        return slapi_counter_new();
+    }
+
+    counter = (Slapi_Counter *)slapi_ch_calloc(1, sizeof(Slapi_Counter));
+    /* calloc only aligns on 16 bytes: one spare shard to align them */
+    counter->shards_mem = slapi_ch_calloc(counter_nshards + 1, sizeof(counter_shard));
+    counter->shards = (counter_shard *)((char *)counter->shards_mem + COUNTER_SHARD_SIZE -
+                                        (uintptr_t)counter->shards_mem % COUNTER_SHARD_SIZE);
+    for (i = 0; i < counter_nshards; i++) {
+        slapi_counter_init(&(counter->shards[i].counter));
+    }
+
+    return counter;
+}
+
 /*
  * slapi_counter_init()
  *
@@ -94,8 +179,14 @@ void slapi_counter_destroy(Slapi_Counter **counter)
 {
     if ((counter != NULL) && (*counter != NULL)) {
 #ifndef ATOMIC_64BIT_OPERATIONS
+        int i;
+
+        for (i = 0; (*counter)->shards && i < counter_nshards; i++) {
+            slapi_destroy_mutex((*counter)->shards[i].counter.lock);
+        }
         slapi_destroy_mutex((*counter)->lock);
 #endif
+        slapi_ch_free((void **)&((*counter)->shards_mem));
         slapi_ch_free((void **)counter);
     }
 }
@@ -138,6 +229,11 @@ PRUint64 slapi_counter_add(Slapi_Counter *counter, PRUint64 addvalue)
         return newvalue;
     }
 
+    if (counter->shards) {
+        slapi_counter_add(counter_get_shard(counter), addvalue);
+        return newvalue;
+    }
+
 #ifndef ATOMIC_64BIT_OPERATIONS
     slapi_lock_mutex(counter->lock);
     counter->value += addvalue;
@@ -195,6 +291,11 @@ PRUint64 slapi_counter_subtract(Slapi_Counter *counter, PRUint64 subvalue)
         return newvalue;
     }
 
+    if (counter->shards) {
+        slapi_counter_subtract(counter_get_shard(counter), subvalue);
+        return newvalue;
+    }
+
 #ifndef ATOMIC_64BIT_OPERATIONS
     slapi_lock_mutex(counter->lock);
     counter->value -= subvalue;
@@ -248,6 +349,16 @@ PRUint64 slapi_counter_set_value(Slapi_Counter *counter, PRUint64 newvalue)
         return value;
     }
 
+    if (counter->shards) {
+        int i;
+
+        /* not atomic as a whole: concurrent updates may be lost */
+        for (i = 1; i < counter_nshards; i++) {
+            slapi_counter_set_value(&(counter->shards[i].counter), 0);
+        }
+        return slapi_counter_set_value(&(counter->shards[0].counter), newvalue);
+    }
+
 #ifndef ATOMIC_64BIT_OPERATIONS
     slapi_lock_mutex(counter->lock);
     counter->value = newvalue;
@@ -325,6 +436,16 @@ PRUint64 slapi_counter_get_value(Slapi_Counter *counter)
         return value;
     }
 
+    if (counter->shards) {
+        int i;
+
+        /* the shards wrap around together, so does their sum */
+        for (i = 0; i < counter_nshards; i++) {
+            value += slapi_counter_get_value(&(counter->shards[i].counter));
+        }
+        return value;
+    }
+
 #ifndef ATOMIC_64BIT_OPERATIONS
     slapi_lock_mutex(counter->lock);
     value = counter->value;
@@ -0,0 +1,177 @@
+/** BEGIN COPYRIGHT BLOCK
+ * Copyright (C) 2015 Red Hat, Inc.
+ * All rights reserved.
+ *
+ * License: GPL (version 3 or any later version).
+ * See LICENSE for details.
+ * END COPYRIGHT BLOCK **/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+/* slapi_epoch.c - epoch based reclamation for read-mostly tables */
+
+/*
+ * A reader brackets its accesses to a published structure with
+ * slapi_epoch_enter()/slapi_epoch_leave().  A writer unpublishes the
+ * structure, calls slapi_epoch_synchronize() and may then free it: the
+ * readers which could still see it have all left by then.
+ *
+ * Each thread announces the epoch it entered in its own slot, so that
+ * readers never write to a shared cache line.  Only writers pay: they
+ * move the global epoch forward and scan the slots.
+ *
+ * A reader must not block on anything a writer may hold while it
+ * synchronizes (typically the lock serializing the writers), and must
+ * not keep a section open across operations.
+ */
+
+#include "slap.h"
+
+#define EPOCH_MAX_SLOTS		1024
+#define EPOCH_SLOT_SIZE		64	/* keep each slot on its own cache line */
+
+typedef struct epoch_slot {
+	PRInt32		es_epoch;	/* entered epoch, 0 when outside */
+	PRInt32		es_nesting;	/* only touched by the owning thread */
+	PRInt32		es_in_use;
+	char		es_pad[EPOCH_SLOT_SIZE - 3 * sizeof(PRInt32)];
+} epoch_slot;
+
+static epoch_slot *epoch_slots = NULL;	/* EPOCH_SLOT_SIZE aligned */
+static PRInt32 epoch_nslots = 0;	/* high water mark */
+static PRInt32 global_epoch = 1;
+static PRUintn epoch_slot_index;
+static PRCallOnceType epoch_init_callonce;
+
+static void
+epoch_slot_release( void *priv )
+{
+	epoch_slot	*slot = (epoch_slot *)priv;
+
+	PR_AtomicSet( &slot->es_epoch, 0 );
+	slot->es_nesting = 0;
+	PR_AtomicSet( &slot->es_in_use, 0 );
+}
+
+static PRStatus
+epoch_init( void )
+{
+	char	*mem;
+
+	/* calloc only aligns on 16 bytes: one spare slot to align them */
+	mem = (char *)slapi_ch_calloc( EPOCH_MAX_SLOTS + 1, sizeof(epoch_slot) );
+	epoch_slots = (epoch_slot *)( mem + EPOCH_SLOT_SIZE -
+			(uintptr_t)mem % EPOCH_SLOT_SIZE );
+	return PR_NewThreadPrivateIndex( &epoch_slot_index, epoch_slot_release );
+}
+
+/*
+ * Find a slot for the calling thread; the slots of exited threads are
+ * reused.  Returns NULL if they are all taken.
+ */
+static epoch_slot *
+epoch_get_slot( void )
+{
+	epoch_slot	*slot;
+	PRInt32		i, n;
+
+	if ( PR_SUCCESS != PR_CallOnce( &epoch_init_callonce, epoch_init )) {
+		return NULL;
+	}
+	if ( NULL != ( slot = (epoch_slot *)PR_GetThreadPrivate( epoch_slot_index ))) {
+		return slot;
+	}
+
+	n = PR_AtomicAdd( &epoch_nslots, 0 );
+	for ( i = 0; i < n; i++ ) {
+		if ( 0 == PR_AtomicSet( &epoch_slots[i].es_in_use, 1 )) {
+			slot = &epoch_slots[i];
+			break;
+		}
+	}
+	while ( NULL == slot ) {
+		if ( ( i = PR_AtomicIncrement( &epoch_nslots ) - 1 ) >= EPOCH_MAX_SLOTS ) {
+			PR_AtomicDecrement( &epoch_nslots );
+			return NULL;
+		}
+		if ( 0 == PR_AtomicSet( &epoch_slots[i].es_in_use, 1 )) {
+			slot = &epoch_slots[i];
+		}
+	}
+	PR_SetThreadPrivate( epoch_slot_index, slot );
+
+	return slot;
+}
+
+/*
+ * Enter a read side section.  Sections nest.
+ * Returns 0, or -1 if no slot is available: the caller must then fall back
+ * to its locks, and must not call slapi_epoch_leave().
+ */
+int
+slapi_epoch_enter( void )
+{
+	epoch_slot	*slot = epoch_get_slot();
+	PRInt32		epoch;
+
+	if ( NULL == slot ) {
+		return -1;
+	}
+	if ( slot->es_nesting++ == 0 ) {
+		do {
+			epoch = PR_AtomicAdd( &global_epoch, 0 );
+			PR_AtomicSet( &slot->es_epoch, epoch );
+			/* a writer which moved on meanwhile may have missed us */
+		} while ( epoch != PR_AtomicAdd( &global_epoch, 0 ));
+	}
+
+	return 0;
+}
+
+void
+slapi_epoch_leave( void )
+{
+	epoch_slot	*slot = (epoch_slot *)PR_GetThreadPrivate( epoch_slot_index );
+
+	PR_ASSERT( slot && slot->es_nesting > 0 );
+	if ( --slot->es_nesting == 0 ) {
+		PR_AtomicSet( &slot->es_epoch, 0 );
+	}
+}
+
+/*
+ * Wait until every reader which entered its section before the call has
+ * left it.  Whatever the caller unpublished beforehand may be freed once
+ * this returns.
+ */
+void
+slapi_epoch_synchronize( void )
+{
+	PRInt32		new_epoch, epoch;
+	PRInt32		i, n;
+
+	if ( PR_SUCCESS != PR_CallOnce( &epoch_init_callonce, epoch_init )) {
+		return;
+	}
+
+	new_epoch = PR_AtomicIncrement( &global_epoch );
+	if ( new_epoch == 0 ) {
+		/* 0 means "outside" */
+		new_epoch = PR_AtomicIncrement( &global_epoch );
+	}
+
+	n = PR_AtomicAdd( &epoch_nslots, 0 );
+	for ( i = 0; i < n; i++ ) {
+		for (;;) {
+			epoch = PR_AtomicAdd( &epoch_slots[i].es_epoch, 0 );
+			/* readers which entered at or after new_epoch do not matter */
+			if ( epoch == 0 ||
+					(PRInt32)((PRUint32)epoch - (PRUint32)new_epoch) >= 0 ) {
+				break;
+			}
+			DS_Sleep( PR_MillisecondsToInterval( 1 ));
+		}
+	}
+}
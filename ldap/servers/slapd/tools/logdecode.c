@@ -0,0 +1,397 @@
+/** BEGIN COPYRIGHT BLOCK
+ * Copyright (C) 2015 Red Hat, Inc.
+ * All rights reserved.
+ *
+ * License: GPL (version 3 or any later version).
+ * See LICENSE for details.
+ * END COPYRIGHT BLOCK **/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+
+/*
+ * small program to turn a binary access log (nsslapd-accesslog-binary)
+ * back into the classic access log text, or into JSON lines.
+ * See ldap/servers/slapd/log.h for the format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#if defined(linux)
+#include <getopt.h>
+#endif
+
+/* stolen from log.h */
+#define LOG_BIN_MAGIC               "\211DSALOG\n"
+#define LOG_BIN_MAGIC_LEN           8
+#define LOG_BIN_HDR_LEN             4
+#define LOG_BIN_TEXT                1
+#define LOG_BIN_STRING              2
+#define LOG_BIN_OP                  3
+#define LOG_BIN_OP_LEN              60
+#define LOG_BIN_OP_ETIME_PRECISE    0x1
+
+/* stolen from slapi-plugin.h */
+#define SLAPI_OPERATION_BIND     0x00000001UL
+#define SLAPI_OPERATION_UNBIND   0x00000002UL
+#define SLAPI_OPERATION_SEARCH   0x00000004UL
+#define SLAPI_OPERATION_MODIFY   0x00000008UL
+#define SLAPI_OPERATION_ADD      0x00000010UL
+#define SLAPI_OPERATION_DELETE   0x00000020UL
+#define SLAPI_OPERATION_MODDN    0x00000040UL
+#define SLAPI_OPERATION_COMPARE  0x00000080UL
+#define SLAPI_OPERATION_ABANDON  0x00000100UL
+#define SLAPI_OPERATION_EXTENDED 0x00000200UL
+
+#define SLAPI_OP_NOTE_UNINDEXED       0x01
+#define SLAPI_OP_NOTE_SIMPLEPAGED     0x02
+#define SLAPI_OP_NOTE_FULL_UNINDEXED  0x04
+
+#define MAX_FRAME (LOG_BIN_HDR_LEN + 0xffff)
+
+/* output mode */
+#define TEXTMODE 0
+#define JSONMODE 1
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+    char *str;
+} logstring;
+
+static logstring *strings = NULL;   /* by id */
+static uint32_t nstrings = 0;
+static int output_mode = TEXTMODE;
+
+static uint32_t
+get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+    return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static int
+define_string(uint32_t id, const unsigned char *str, uint32_t len)
+{
+    if (id >= nstrings) {
+        uint32_t n = nstrings ? nstrings : 1024;
+        logstring *tmp;
+
+        while (n <= id) {
+            n *= 2;
+        }
+        tmp = (logstring *)realloc(strings, n * sizeof(logstring));
+        if (NULL == tmp) {
+            return -1;
+        }
+        memset(tmp + nstrings, 0, (n - nstrings) * sizeof(logstring));
+        strings = tmp;
+        nstrings = n;
+    }
+    free(strings[id].str);
+    if (NULL == (strings[id].str = (char *)malloc(len + 1))) {
+        return -1;
+    }
+    memcpy(strings[id].str, str, len);
+    strings[id].str[len] = '\0';
+    strings[id].len = len;
+    strings[id].id = id;
+    return 0;
+}
+
+static const char *
+lookup_string(uint32_t id)
+{
+    if (0 == id || id >= nstrings || NULL == strings[id].str) {
+        return NULL;
+    }
+    return strings[id].str;
+}
+
+/* "[19/Oct/2015:10:00:00 +0200] ", as the server does */
+static void
+format_time(time_t t, char *buf, size_t buflen)
+{
+    struct tm tms;
+    char tbuf[64];
+    long tz;
+    char sign;
+
+    (void)localtime_r(&t, &tms);
+#ifdef BSD_TIME
+    tz = tms.tm_gmtoff;
+#else
+    tz = - timezone;
+    if (tms.tm_isdst) {
+        tz += 3600;
+    }
+#endif
+    sign = (tz >= 0 ? '+' : '-');
+    if (tz < 0) {
+        tz = -tz;
+    }
+    (void)strftime(tbuf, sizeof(tbuf), "%d/%b/%Y:%H:%M:%S", &tms);
+    snprintf(buf, buflen, "[%s %c%02d%02d] ", tbuf, sign,
+             (int)(tz / 3600), (int)((tz % 3600) / 60));
+}
+
+static const char *
+optype2str(uint32_t optype)
+{
+    switch (optype) {
+    case SLAPI_OPERATION_BIND:     return "bind";
+    case SLAPI_OPERATION_UNBIND:   return "unbind";
+    case SLAPI_OPERATION_SEARCH:   return "search";
+    case SLAPI_OPERATION_MODIFY:   return "modify";
+    case SLAPI_OPERATION_ADD:      return "add";
+    case SLAPI_OPERATION_DELETE:   return "delete";
+    case SLAPI_OPERATION_MODDN:    return "modrdn";
+    case SLAPI_OPERATION_COMPARE:  return "compare";
+    case SLAPI_OPERATION_ABANDON:  return "abandon";
+    case SLAPI_OPERATION_EXTENDED: return "extended";
+    }
+    return "unknown";
+}
+
+/* "U,P", as notes2str in result.c */
+static void
+notes2str(uint32_t notes, char *buf)
+{
+    *buf = '\0';
+    if (notes & SLAPI_OP_NOTE_UNINDEXED) {
+        strcat(buf, "U");
+    }
+    if (notes & SLAPI_OP_NOTE_SIMPLEPAGED) {
+        strcat(buf, *buf ? ",P" : "P");
+    }
+    if (notes & SLAPI_OP_NOTE_FULL_UNINDEXED) {
+        strcat(buf, *buf ? ",A" : "A");
+    }
+}
+
+static void
+print_json_string(const char *str, size_t len)
+{
+    size_t i;
+
+    putchar('"');
+    for (i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)str[i];
+
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c == '\n') {
+            printf("\\n");
+        } else if (c == '\t') {
+            printf("\\t");
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void
+print_text(const unsigned char *text, uint32_t len)
+{
+    if (JSONMODE == output_mode) {
+        /* the title lines have no timestamp */
+        printf("{\"text\": ");
+        print_json_string((const char *)text, (len && text[len - 1] == '\n') ? len - 1 : len);
+        printf("}\n");
+    } else {
+        fwrite(text, 1, len, stdout);
+    }
+}
+
+static void
+print_op(const unsigned char *p)
+{
+    time_t t = (time_t)get64(p);
+    uint64_t connid = get64(p + 8);
+    uint64_t etime = get64(p + 16);
+    int32_t opid = (int32_t)get32(p + 24);
+    uint32_t optype = get32(p + 28);
+    uint32_t tag = get32(p + 32);
+    int32_t err = (int32_t)get32(p + 36);
+    int32_t nentries = (int32_t)get32(p + 40);
+    uint32_t notes = get32(p + 44);
+    uint32_t flags = get32(p + 48);
+    const char *base = lookup_string(get32(p + 52));
+    const char *filter = lookup_string(get32(p + 56));
+    char tbuf[128];
+    char ebuf[64];
+    char nbuf[16];
+
+    if (flags & LOG_BIN_OP_ETIME_PRECISE) {
+        snprintf(ebuf, sizeof(ebuf), "%f", (double)etime / 1000000);
+    } else {
+        snprintf(ebuf, sizeof(ebuf), "%" PRIu64, etime / 1000000);
+    }
+    notes2str(notes, nbuf);
+
+    if (JSONMODE == output_mode) {
+        printf("{\"time\": %" PRIu64 ", \"conn\": %" PRIu64 ", \"op\": %d, "
+               "\"type\": \"%s\", \"tag\": %u, \"err\": %d, \"nentries\": %d, "
+               "\"etime\": %s",
+               (uint64_t)t, connid, opid, optype2str(optype), tag, err,
+               nentries, ebuf);
+        if (*nbuf) {
+            printf(", \"notes\": \"%s\"", nbuf);
+        }
+        if (base) {
+            printf(", \"base\": ");
+            print_json_string(base, strlen(base));
+        }
+        if (filter) {
+            printf(", \"filter\": ");
+            print_json_string(filter, strlen(filter));
+        }
+        printf("}\n");
+    } else {
+        format_time(t, tbuf, sizeof(tbuf));
+        printf("%sconn=%" PRIu64 " op=%d RESULT err=%d tag=%u nentries=%d etime=%s%s%s\n",
+               tbuf, connid, opid, err, tag, nentries, ebuf,
+               *nbuf ? " notes=" : "", nbuf);
+    }
+}
+
+static int
+decode_file(const char *filename)
+{
+    FILE *fp = stdin;
+    unsigned char *frame;
+    unsigned char magic[LOG_BIN_MAGIC_LEN];
+    uint32_t len;
+    int rc = 0;
+
+    if (strcmp(filename, "-") && NULL == (fp = fopen(filename, "r"))) {
+        fprintf(stderr, "Can't open %s: %s\n", filename, strerror(errno));
+        return 1;
+    }
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+        memcmp(magic, LOG_BIN_MAGIC, LOG_BIN_MAGIC_LEN)) {
+        fprintf(stderr, "%s is not a binary access log\n", filename);
+        if (fp != stdin) {
+            fclose(fp);
+        }
+        return 1;
+    }
+    if (NULL == (frame = (unsigned char *)malloc(MAX_FRAME))) {
+        fprintf(stderr, "Out of memory\n");
+        if (fp != stdin) {
+            fclose(fp);
+        }
+        return 1;
+    }
+
+    while (fread(frame, 1, LOG_BIN_HDR_LEN, fp) == LOG_BIN_HDR_LEN) {
+        if (0 == memcmp(frame, LOG_BIN_MAGIC, LOG_BIN_HDR_LEN)) {
+            /* older servers wrote the magic again after each restart */
+            if (fread(frame + LOG_BIN_HDR_LEN, 1, LOG_BIN_MAGIC_LEN - LOG_BIN_HDR_LEN, fp) !=
+                    LOG_BIN_MAGIC_LEN - LOG_BIN_HDR_LEN ||
+                memcmp(frame, LOG_BIN_MAGIC, LOG_BIN_MAGIC_LEN)) {
+                fprintf(stderr, "%s: bad record\n", filename);
+                rc = 1;
+                break;
+            }
+            continue;
+        }
+        len = get16(frame + 2);
+        if (fread(frame + LOG_BIN_HDR_LEN, 1, len, fp) != len) {
+            fprintf(stderr, "%s: truncated record\n", filename);
+            rc = 1;
+            break;
+        }
+        switch (frame[0]) {
+        case LOG_BIN_TEXT:
+            print_text(frame + LOG_BIN_HDR_LEN, len);
+            break;
+        case LOG_BIN_STRING:
+            if (len < 4 ||
+                define_string(get32(frame + LOG_BIN_HDR_LEN),
+                              frame + LOG_BIN_HDR_LEN + 4, len - 4)) {
+                fprintf(stderr, "%s: bad string record\n", filename);
+                rc = 1;
+            }
+            break;
+        case LOG_BIN_OP:
+            if (len < LOG_BIN_OP_LEN) {
+                fprintf(stderr, "%s: bad operation record\n", filename);
+                rc = 1;
+            } else {
+                print_op(frame + LOG_BIN_HDR_LEN);
+            }
+            break;
+        default:
+            /* unknown record type: skip it */
+            break;
+        }
+    }
+
+    free(frame);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    return rc;
+}
+
+static void usage(char *argv0)
+{
+    char *p0 = strrchr(argv0, '/');
+
+    p0 = p0 ? p0 + 1 : argv0;
+    printf("\n%s - decode a binary access log\n", p0);
+    printf("usage: %s [-j] [file ...]\n", p0);
+    printf("    -j              print JSON lines instead of the access log text\n");
+    printf("    -h              display this usage\n");
+    printf("  with no file, or when file is -, read the standard input\n\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int rc = 0;
+
+    while ((c = getopt(argc, argv, "jh")) != EOF) {
+        switch (c) {
+        case 'j':
+            output_mode = JSONMODE;
+            break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    tzset();
+    if (optind >= argc) {
+        rc = decode_file("-");
+    }
+    for (; optind < argc; optind++) {
+        rc |= decode_file(argv[optind]);
+    }
+    return rc;
+}
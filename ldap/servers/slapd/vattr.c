@@ -240,7 +240,7 @@ static int vattr_helper_get_entry_conts_with_subtypes(Slapi_Entry *e,const char
 static int vattr_helper_get_entry_conts_no_subtypes(Slapi_Entry *e,const char *type, vattr_get_thang **my_get)
 {
         int                     attr_count = 0;
-        Slapi_Attr *a = attrlist_find(e->e_attrs,type);
+        Slapi_Attr *a = entry_attr_find(e,type);
 
         if (a) {
                 attr_count = 1;
@@ -2154,6 +2154,24 @@ vattr_sp_handle_list *vattr_map_sp_getlist(char *type_to_find)
 	}
 }
 
+/* slapi_vattr_is_registered
+ * -------------------------
+ * tells whether a service provider generates the values of the
+ * type in the global namespace, i.e. whether the value of the type
+ * may change without the entry itself being modified
+ */
+int slapi_vattr_is_registered(const char *type)
+{
+	vattr_map_entry *result = NULL;
+
+	if(config_get_ignore_vattrs()){
+		/* the filters won't look at them */
+		return 0;
+	}
+
+	return (0 == vattr_map_lookup(type, &result));
+}
+
 /* same as above, but filters the list based on the supplied backend dn
  * when we stored these dn based attributes, we concatenated them with
  * the dn like this dn::attribute, so we need to do two checks for the